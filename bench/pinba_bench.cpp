@@ -0,0 +1,831 @@
+#include "pinba_config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+#include <meow/stopwatch.hpp>
+#include <meow/unix/time.hpp>
+
+#include "proto/pinba.pb-c.h"
+
+#include "pinba/globals.h"
+#include "pinba/engine.h"
+#include "pinba/dictionary.h"
+#include "pinba/report.h"
+#include "pinba/report_by_request.h"
+#include "pinba/report_by_timer.h"
+#include "pinba/datagram_capture.h"
+
+#include "traffic.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// end-to-end benchmark: engine runs in-process (same as src/main.cpp), udp traffic is sent to it
+// from sender threads at a controlled rate, either synthetic, or replayed from a file recorded with --record
+//
+// every phase sends at a fixed rate for --duration seconds, waits for the pipeline to drain,
+// and prints a json line with (per second) rates, drops, per-stage cpu and snapshot merge latency
+// with --search, rate is raised by --search-step every phase, until loss gets over --max-loss,
+// the last rate that was fine is reported as sustainable_pps in the final json line
+//
+// recorded stream format: [uint32_t length, little endian][packed Pinba__Request bytes], repeated
+// --replay also reads engine datagram capture files (see datagram_capture.h), those have timestamps,
+// so with --replay-speed datagrams are sent with original timing (sped up or slowed down), instead of at --rate
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct bench_conf_t
+	{
+		std::string  address           = "127.0.0.1";
+		std::string  port              = "30002";
+
+		uint32_t     udp_threads       = 2;
+		uint32_t     repacker_threads  = 2;
+		uint32_t     sender_threads    = 2;
+
+		double       rate              = 100000; // packets/sec, total for all senders, 0 = as fast as possible
+		double       duration_sec      = 10;     // per phase
+		double       drain_sec         = 1;      // after phase, before final stats sample
+
+		bool         search            = false;
+		double       search_step       = 1.5;
+		double       max_loss          = 0.001;  // fraction of sent packets, that didn't get to all reports
+		uint32_t     max_phases        = 20;
+
+		std::string  replay_file;                // empty = synthetic traffic
+		double       replay_speed      = 0;      // > 0 = keep recorded timing, this much faster (capture files only)
+		std::string  record_file;                // record mode, no engine, just dump datagrams from address:port
+
+		traffic_conf_t traffic;                  // synthetic traffic shape, see traffic.h
+
+		double       snapshot_interval_sec = 1;  // select every report once in a while, to measure merges under load
+	};
+
+	static void usage(char const *argv0)
+	{
+		ff::fmt(stderr,
+			"usage: {0} [options]\n"
+			"  --address=127.0.0.1 --port=30002   engine udp listener (senders connect here)\n"
+			"  --udp-threads=2 --repacker-threads=2 --sender-threads=2\n"
+			"  --rate=100000                      packets/sec, 0 = unlimited\n"
+			"  --duration=10 --drain=1            seconds per phase, seconds to wait for pipeline to drain\n"
+			"  --search [--search-step=1.5 --max-loss=0.001 --max-phases=20]\n"
+			"  --replay=<file>                    replay recorded stream or datagram capture, instead of synthetic traffic\n"
+			"  --replay-speed=0                   capture files: original timing, N times faster, 0 = at --rate instead\n"
+			"  --record=<file>                    record udp traffic on address:port for --duration seconds and exit\n"
+			"  --snapshot-interval=1              seconds between report selects, 0 = no selects\n"
+			"synthetic traffic:\n"
+			"{1}"
+			, argv0, traffic_conf___usage());
+	}
+
+	static bench_conf_t parse_args(int argc, char const *argv[])
+	{
+		bench_conf_t conf;
+
+		for (int i = 1; i < argc; i++)
+		{
+			std::string const arg = argv[i];
+
+			if (arg == "--help" || arg == "-h")
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+
+			if (arg == "--search")
+			{
+				conf.search = true;
+				continue;
+			}
+
+			size_t const eq = arg.find('=');
+			if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+				throw std::runtime_error(ff::fmt_str("bad argument '{0}', expected --name=value", arg));
+
+			std::string const name  = arg.substr(2, eq - 2);
+			std::string const value = arg.substr(eq + 1);
+
+			if (traffic_conf___parse_option(&conf.traffic, name, value))
+				continue;
+
+			auto const as_u32 = [&]() { return uint32_t(std::strtoul(value.c_str(), nullptr, 10)); };
+			auto const as_dbl = [&]() { return std::strtod(value.c_str(), nullptr); };
+
+			if      (name == "address")           conf.address = value;
+			else if (name == "port")              conf.port = value;
+			else if (name == "udp-threads")       conf.udp_threads = as_u32();
+			else if (name == "repacker-threads")  conf.repacker_threads = as_u32();
+			else if (name == "sender-threads")    conf.sender_threads = as_u32();
+			else if (name == "rate")              conf.rate = as_dbl();
+			else if (name == "duration")          conf.duration_sec = as_dbl();
+			else if (name == "drain")             conf.drain_sec = as_dbl();
+			else if (name == "search-step")       conf.search_step = as_dbl();
+			else if (name == "max-loss")          conf.max_loss = as_dbl();
+			else if (name == "max-phases")        conf.max_phases = as_u32();
+			else if (name == "replay")            conf.replay_file = value;
+			else if (name == "replay-speed")      conf.replay_speed = as_dbl();
+			else if (name == "record")            conf.record_file = value;
+			else if (name == "snapshot-interval") conf.snapshot_interval_sec = as_dbl();
+			else
+				throw std::runtime_error(ff::fmt_str("unknown option '--{0}', see --help", name));
+		}
+
+		if (conf.sender_threads == 0 || conf.udp_threads == 0 || conf.repacker_threads == 0)
+			throw std::runtime_error("thread counts must be > 0");
+
+		if (conf.search && conf.rate <= 0)
+			throw std::runtime_error("--search needs a starting --rate > 0");
+
+		if (conf.replay_speed > 0 && (conf.replay_file.empty() || conf.search))
+			throw std::runtime_error("--replay-speed needs --replay, and can't be used with --search");
+
+		if (conf.search_step <= 1.0)
+			throw std::runtime_error("--search-step must be > 1");
+
+		if (conf.traffic.n_timer_tags == 0 || conf.traffic.tags_per_timer == 0)
+			throw std::runtime_error("timer report needs --timer-tags > 0 and --tags-per-timer > 0");
+
+		traffic_conf___validate(conf.traffic);
+
+		return conf;
+	}
+
+	static duration_t duration_from_seconds(double sec)
+	{
+		return duration_t { int64_t(sec * 1000 * 1000 * 1000) };
+	}
+
+	static void sleep_for_seconds(double sec)
+	{
+		std::this_thread::sleep_for(std::chrono::nanoseconds(duration_from_seconds(sec).nsec));
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// traffic
+
+	using datagrams_t    = std::vector<std::string>;
+	using datagram_ts_t  = std::vector<int64_t>;  // nanoseconds, datagram capture files only
+
+	// datagram capture file, see datagram_capture.h
+	static void load_captured_datagrams(FILE *f, datagrams_t *result, datagram_ts_t *ts)
+	{
+		while (true)
+		{
+			int64_t  t;
+			uint32_t len;
+			if (1 != fread(&t, sizeof(t), 1, f) || 1 != fread(&len, sizeof(len), 1, f) || len == 0)
+				break; // end of file, or zeroes after last record (file wasn't closed)
+
+			std::string data(len, '\0');
+			if (1 != fread(&data[0], len, 1, f))
+				break;
+
+			result->push_back(std::move(data));
+			ts->push_back(t);
+		}
+
+		// records are in the order writer drained reader thread rings, not quite in time order
+		std::vector<size_t> order(ts->size());
+		for (size_t i = 0; i < order.size(); i++)
+			order[i] = i;
+
+		std::stable_sort(order.begin(), order.end(), [ts](size_t l, size_t r) { return (*ts)[l] < (*ts)[r]; });
+
+		datagrams_t   sorted;
+		datagram_ts_t sorted_ts;
+		sorted.reserve(order.size());
+		sorted_ts.reserve(order.size());
+
+		for (size_t const i : order)
+		{
+			sorted.push_back(std::move((*result)[i]));
+			sorted_ts.push_back((*ts)[i]);
+		}
+
+		result->swap(sorted);
+		ts->swap(sorted_ts);
+	}
+
+	static datagrams_t load_recorded_datagrams(std::string const& path, datagram_ts_t *ts)
+	{
+		FILE *f = fopen(path.c_str(), "rb");
+		if (!f)
+			throw std::runtime_error(ff::fmt_str("can't open {0}: {1}", path, strerror(errno)));
+
+		datagrams_t result;
+
+		uint32_t header[2];
+		if (1 == fread(header, sizeof(header), 1, f) && header[0] == PINBA_DATAGRAM_CAPTURE_MAGIC)
+		{
+			if (header[1] != PINBA_DATAGRAM_CAPTURE_VERSION)
+				throw std::runtime_error(ff::fmt_str("{0}: unsupported capture version {1}", path, header[1]));
+
+			load_captured_datagrams(f, &result, ts);
+		}
+		else
+		{
+			rewind(f);
+
+			uint8_t len_buf[4];
+			while (1 == fread(len_buf, sizeof(len_buf), 1, f))
+			{
+				uint32_t const len = uint32_t(len_buf[0]) | (uint32_t(len_buf[1]) << 8) | (uint32_t(len_buf[2]) << 16) | (uint32_t(len_buf[3]) << 24);
+
+				std::string data(len, '\0');
+				if (len > 0 && 1 != fread(&data[0], len, 1, f))
+					break; // truncated last record, recorder was killed probably
+
+				result.push_back(std::move(data));
+			}
+		}
+
+		fclose(f);
+
+		if (result.empty())
+			throw std::runtime_error(ff::fmt_str("{0}: no datagrams", path));
+
+		return result;
+	}
+
+	static int udp_socket(bench_conf_t const& conf, bool bind_to)
+	{
+		struct addrinfo hints = {};
+		hints.ai_family   = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+
+		struct addrinfo *ai = nullptr;
+		int const err = getaddrinfo(conf.address.c_str(), conf.port.c_str(), &hints, &ai);
+		if (err != 0)
+			throw std::runtime_error(ff::fmt_str("getaddrinfo({0}, {1}): {2}", conf.address, conf.port, gai_strerror(err)));
+
+		int const fd = socket(ai->ai_family, SOCK_DGRAM, 0);
+		if (fd < 0)
+		{
+			freeaddrinfo(ai);
+			throw std::runtime_error(ff::fmt_str("socket(): {0}", strerror(errno)));
+		}
+
+		int const rv = (bind_to)
+			? bind(fd, ai->ai_addr, ai->ai_addrlen)
+			: connect(fd, ai->ai_addr, ai->ai_addrlen);
+		freeaddrinfo(ai);
+
+		if (rv < 0)
+		{
+			close(fd);
+			throw std::runtime_error(ff::fmt_str("{0}({1}:{2}): {3}", (bind_to) ? "bind" : "connect", conf.address, conf.port, strerror(errno)));
+		}
+
+		return fd;
+	}
+
+	static void record(bench_conf_t const& conf)
+	{
+		FILE *f = fopen(conf.record_file.c_str(), "wb");
+		if (!f)
+			throw std::runtime_error(ff::fmt_str("can't open {0}: {1}", conf.record_file, strerror(errno)));
+
+		int const fd = udp_socket(conf, true);
+
+		struct timeval tv = { 0, 100 * 1000 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+		timeval_t const end_tv = os_unix::clock_monotonic_now() + duration_from_seconds(conf.duration_sec);
+
+		uint64_t n_datagrams = 0;
+		char buf[64 * 1024];
+
+		while (os_unix::clock_monotonic_now() < end_tv)
+		{
+			ssize_t const n = recv(fd, buf, sizeof(buf), 0);
+			if (n < 0)
+				continue; // timeout or EINTR
+
+			uint8_t const len_buf[4] = { uint8_t(n), uint8_t(n >> 8), uint8_t(n >> 16), uint8_t(n >> 24) };
+			fwrite(len_buf, sizeof(len_buf), 1, f);
+			fwrite(buf, n, 1, f);
+			n_datagrams++;
+		}
+
+		close(fd);
+		fclose(f);
+
+		ff::fmt(stdout, "{{\"recorded\":{0},\"file\":\"{1}\"}\n", n_datagrams, conf.record_file);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// senders
+
+	struct sender_t
+	{
+		std::thread            t;
+		std::atomic<uint64_t>  sent = {0};
+		std::atomic<uint64_t>  send_err = {0};
+	};
+
+	// sends datagrams in a loop at rate/sec (0 = unlimited) until stop is set
+	static void sender_thread(bench_conf_t const& conf, datagrams_t const& datagrams, uint32_t thread_id, double rate, std::atomic<bool> const& stop, sender_t *sender)
+	{
+		int const fd = udp_socket(conf, false);
+
+		constexpr uint32_t const max_batch = 64;
+		struct mmsghdr msgs[max_batch];
+		struct iovec   iovs[max_batch];
+
+		size_t    offset  = (datagrams.size() / conf.sender_threads) * thread_id; // don't send the same stream from all threads
+		uint64_t  sent    = 0;
+		uint64_t  errors  = 0;
+
+		timeval_t const start_tv = os_unix::clock_monotonic_now();
+
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			uint64_t allowed = max_batch;
+
+			if (rate > 0)
+			{
+				double const elapsed = timeval_to_double(os_unix::clock_monotonic_now() - start_tv);
+				uint64_t const target = uint64_t(elapsed * rate);
+
+				if (target <= sent)
+				{
+					std::this_thread::sleep_for(std::chrono::microseconds(100));
+					continue;
+				}
+
+				allowed = std::min<uint64_t>(target - sent, max_batch);
+			}
+
+			for (uint32_t i = 0; i < allowed; i++)
+			{
+				std::string const& d = datagrams[offset];
+				offset = (offset + 1) % datagrams.size();
+
+				iovs[i] = { (void*)d.data(), d.size() };
+				msgs[i] = {};
+				msgs[i].msg_hdr.msg_iov    = &iovs[i];
+				msgs[i].msg_hdr.msg_iovlen = 1;
+			}
+
+			int const n = sendmmsg(fd, msgs, allowed, 0);
+			if (n < 0)
+			{
+				errors += allowed;
+				sent   += allowed; // still counts to keep the pace, these are reported separately
+			}
+			else
+			{
+				errors += allowed - n;
+				sent   += allowed;
+			}
+
+			sender->sent.store(sent, std::memory_order_relaxed);
+			sender->send_err.store(errors, std::memory_order_relaxed);
+		}
+
+		close(fd);
+	}
+
+	// replays datagram capture with original timing, speed times faster, over and over until stop is set
+	// thread_id sends every sender_threads-th datagram, starting with thread_id-th
+	static void sender_thread___timed(bench_conf_t const& conf, datagrams_t const& datagrams, datagram_ts_t const& ts, uint32_t thread_id, double speed, std::atomic<bool> const& stop, sender_t *sender)
+	{
+		if (thread_id >= datagrams.size())
+			return; // more senders than datagrams
+
+		int const fd = udp_socket(conf, false);
+
+		constexpr uint32_t const max_batch = 64;
+		struct mmsghdr msgs[max_batch];
+		struct iovec   iovs[max_batch];
+
+		int64_t const first_ts = ts.front();
+		int64_t const span     = ts.back() - first_ts + 1000 * 1000; // 1ms gap between loops
+
+		size_t    idx     = thread_id;
+		uint64_t  loop    = 0;
+		uint64_t  sent    = 0;
+		uint64_t  errors  = 0;
+
+		timeval_t const start_tv = os_unix::clock_monotonic_now();
+
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			double const elapsed_ns = timeval_to_double(os_unix::clock_monotonic_now() - start_tv) * 1e9 * speed;
+
+			uint32_t n = 0;
+			while (n < max_batch)
+			{
+				if (idx >= datagrams.size())
+				{
+					idx = idx % conf.sender_threads;
+					loop++;
+				}
+
+				double const due_ns = double(ts[idx] - first_ts) + double(span) * loop;
+				if (due_ns > elapsed_ns)
+					break;
+
+				std::string const& d = datagrams[idx];
+				idx += conf.sender_threads;
+
+				iovs[n] = { (void*)d.data(), d.size() };
+				msgs[n] = {};
+				msgs[n].msg_hdr.msg_iov    = &iovs[n];
+				msgs[n].msg_hdr.msg_iovlen = 1;
+				n++;
+			}
+
+			if (n == 0)
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+				continue;
+			}
+
+			int const rv = sendmmsg(fd, msgs, n, 0);
+			errors += (rv < 0) ? n : (n - rv);
+			sent   += n;
+
+			sender->sent.store(sent, std::memory_order_relaxed);
+			sender->send_err.store(errors, std::memory_order_relaxed);
+		}
+
+		close(fd);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// measurements
+
+	static char const *report_names[] = { "bench/script", "bench/timer_tags" };
+
+	struct sample_t
+	{
+		timeval_t                  tv;
+
+		uint64_t                   sent;
+		uint64_t                   send_err;
+
+		pinba_udp_counters_t       udp;
+		pinba_repacker_counters_t  repacker;
+		uint64_t                   coordinator_send_err;
+
+		uint64_t                   report_recv_min;        // packets that got to every report
+		uint64_t                   report_send_err;        // over all reports
+		uint64_t                   report_aggregated;      // over all reports
+
+		double                     cpu_udp;                // seconds, utime + stime
+		double                     cpu_repacker;
+		double                     cpu_coordinator;
+		double                     cpu_reports;
+	};
+
+	static double ru_sec(timeval_t utime, timeval_t stime)
+	{
+		return timeval_to_double(utime) + timeval_to_double(stime);
+	}
+
+	static sample_t take_sample(pinba_engine_t *pinba, std::vector<std::unique_ptr<sender_t>> const& senders, sample_t const& prev_senders)
+	{
+		sample_t s = {};
+		s.tv = os_unix::clock_monotonic_now();
+
+		// senders are restarted every phase, so their counters are added to previous phases
+		s.sent     = prev_senders.sent;
+		s.send_err = prev_senders.send_err;
+		for (auto const& sender : senders)
+		{
+			s.sent     += sender->sent.load();
+			s.send_err += sender->send_err.load();
+		}
+
+		pinba_stats_t *stats = pinba->globals()->stats();
+		s.coordinator_send_err = stats->coordinator.batch_send_err;
+
+		{
+			std::lock_guard<std::mutex> lk_(stats->mtx);
+
+			s.udp      = pinba_stats___udp(stats);
+			s.repacker = pinba_stats___repacker(stats);
+
+			for (auto const& t : stats->collector_threads)
+				s.cpu_udp += ru_sec(t.ru_utime, t.ru_stime);
+			for (auto const& t : stats->repacker_threads)
+				s.cpu_repacker += ru_sec(t.ru_utime, t.ru_stime);
+
+			s.cpu_coordinator = ru_sec(stats->coordinator.ru_utime, stats->coordinator.ru_stime);
+		}
+
+		s.report_recv_min = UINT64_MAX;
+		for (char const *name : report_names)
+		{
+			auto const rstate = pinba->get_report_state(meow::str_ref(name));
+			if (!rstate)
+				throw std::runtime_error(ff::fmt_str("report {0} is gone", name));
+
+			std::lock_guard<std::mutex> lk_(rstate->stats->lock);
+
+			auto const counters = report_stats___counters(rstate->stats);
+			s.report_recv_min    = std::min(s.report_recv_min, counters.packets_recv_total);
+			s.report_send_err   += counters.packets_send_err;
+			s.report_aggregated += counters.packets_aggregated;
+			s.cpu_reports       += ru_sec(rstate->stats->ru_utime, rstate->stats->ru_stime);
+		}
+
+		return s;
+	}
+
+	struct latency_summary_t
+	{
+		size_t  count;
+		double  p50_ms;
+		double  p99_ms;
+		double  max_ms;
+	};
+
+	static latency_summary_t summarize(std::vector<double> v)
+	{
+		latency_summary_t r = {};
+		if (v.empty())
+			return r;
+
+		std::sort(v.begin(), v.end());
+
+		auto const at = [&v](double pct) { return v[std::min(v.size() - 1, size_t(pct / 100.0 * v.size()))]; };
+
+		r.count  = v.size();
+		r.p50_ms = at(50);
+		r.p99_ms = at(99);
+		r.max_ms = v.back();
+		return r;
+	}
+
+	struct phase_result_t
+	{
+		double   rate_target;
+		double   elapsed_sec;
+		double   sent_pps;
+		double   recv_pps;       // by udp readers
+		double   reported_pps;   // got to every report
+		double   loss;           // 1 - reported / sent
+		uint64_t sender_err;
+		uint64_t kernel_drops;
+		uint64_t decode_err;
+		uint64_t udp_send_err;   // udp reader -> repacker
+		uint64_t validate_err;
+		uint64_t coordinator_send_err;
+		uint64_t report_send_err;
+		double   cpu_udp;        // cores, i.e. 1.0 = one core busy
+		double   cpu_repacker;
+		double   cpu_coordinator;
+		double   cpu_reports;
+		latency_summary_t snapshot;
+	};
+
+	static void print_phase(uint32_t phase, phase_result_t const& r)
+	{
+		ff::fmt(stdout,
+			"{{\"phase\":{0},\"rate_target\":{1},\"elapsed_sec\":{2},\"sent_pps\":{3},\"recv_pps\":{4},\"reported_pps\":{5},\"loss\":{6},"
+			"\"sender_err\":{7},\"kernel_drops\":{8},\"decode_err\":{9},\"udp_send_err\":{10},\"validate_err\":{11},"
+			"\"coordinator_send_err\":{12},\"report_send_err\":{13},"
+			"\"cpu\":{{\"udp\":{14},\"repacker\":{15},\"coordinator\":{16},\"reports\":{17}},"
+			"\"snapshot_ms\":{{\"count\":{18},\"p50\":{19},\"p99\":{20},\"max\":{21}}}\n",
+			phase, r.rate_target, r.elapsed_sec, r.sent_pps, r.recv_pps, r.reported_pps, r.loss,
+			r.sender_err, r.kernel_drops, r.decode_err, r.udp_send_err, r.validate_err,
+			r.coordinator_send_err, r.report_send_err,
+			r.cpu_udp, r.cpu_repacker, r.cpu_coordinator, r.cpu_reports,
+			r.snapshot.count, r.snapshot.p50_ms, r.snapshot.p99_ms, r.snapshot.max_ms);
+		fflush(stdout);
+	}
+
+	static void add_reports(bench_conf_t const& bench_conf, pinba_engine_t *pinba)
+	{
+		dictionary_t *d = pinba->globals()->dictionary();
+
+		{
+			report_conf___by_request_t conf = {};
+			conf.name            = report_names[0];
+			conf.time_window     = 60 * d_second;
+			conf.tick_count      = 60;
+			conf.hv_bucket_count = 1000;
+			conf.hv_bucket_d     = 1 * d_millisecond;
+			conf.hv_kind         = HISTOGRAM_KIND__HDR;
+			conf.keys.push_back(report_conf___by_request_t::key_descriptor_by_request_field("script_name", &packet_t::script_id));
+
+			pinba_error_t const err = pinba->add_report(create_report_by_request(pinba->globals(), conf));
+			if (err)
+				throw std::runtime_error(err.what());
+		}
+
+		{
+			report_conf___by_timer_t conf = {};
+			conf.name            = report_names[1];
+			conf.time_window     = 60 * d_second;
+			conf.tick_count      = 60;
+			conf.hv_bucket_count = 1000;
+			conf.hv_bucket_d     = 1 * d_millisecond;
+			// tag0 is in every timer (see traffic.h), tag1 only in some, when there are more tag names than tags per timer
+			for (uint32_t i = 0; i < std::min(bench_conf.traffic.n_timer_tags, 2u); i++)
+			{
+				std::string const tag_name = ff::fmt_str("tag{0}", i);
+				conf.keys.push_back(report_conf___by_timer_t::key_descriptor_by_timer_tag(tag_name, d->add_nameword(tag_name).id));
+			}
+
+			pinba_error_t const err = pinba->add_report(create_report_by_timer(pinba->globals(), conf));
+			if (err)
+				throw std::runtime_error(err.what());
+		}
+	}
+
+	// one phase at fixed rate, senders are started and stopped here
+	static phase_result_t run_phase(bench_conf_t const& conf, pinba_engine_t *pinba, datagrams_t const& datagrams, datagram_ts_t const& ts, double rate, sample_t *total_senders)
+	{
+		std::vector<std::unique_ptr<sender_t>> senders;
+		sample_t const before = take_sample(pinba, senders, *total_senders);
+
+		std::atomic<bool> stop = { false };
+
+		for (uint32_t i = 0; i < conf.sender_threads; i++)
+		{
+			senders.emplace_back(new sender_t);
+			sender_t *sender = senders.back().get();
+
+			sender->t = std::thread([&, i, sender]()
+			{
+				if (conf.replay_speed > 0)
+					sender_thread___timed(conf, datagrams, ts, i, conf.replay_speed, stop, sender);
+				else
+					sender_thread(conf, datagrams, i, rate / conf.sender_threads, stop, sender);
+			});
+		}
+
+		// select reports while sending, selects are part of the load
+		std::vector<double> snapshot_ms;
+		timeval_t const end_tv = before.tv + duration_from_seconds(conf.duration_sec);
+
+		while (os_unix::clock_monotonic_now() < end_tv)
+		{
+			if (conf.snapshot_interval_sec <= 0)
+			{
+				sleep_for_seconds(std::min(0.1, conf.duration_sec));
+				continue;
+			}
+
+			sleep_for_seconds(conf.snapshot_interval_sec);
+
+			for (char const *name : report_names)
+			{
+				meow::stopwatch_t sw;
+
+				auto snapshot = pinba->get_report_snapshot(meow::str_ref(name));
+				snapshot->prepare();
+
+				snapshot_ms.push_back(timeval_to_double(sw.stamp()) * 1000);
+			}
+		}
+
+		stop.store(true);
+		for (auto& sender : senders)
+			sender->t.join();
+
+		timeval_t const send_end_tv = os_unix::clock_monotonic_now();
+
+		// let batches in flight get to reports, and rusage to be sampled (every second)
+		sleep_for_seconds(conf.drain_sec);
+
+		sample_t const after = take_sample(pinba, senders, *total_senders);
+		total_senders->sent     = after.sent;
+		total_senders->send_err = after.send_err;
+
+		double const elapsed = timeval_to_double(send_end_tv - before.tv);
+		double const cpu_elapsed = timeval_to_double(after.tv - before.tv);
+
+		uint64_t const sent     = after.sent - before.sent;
+		uint64_t const reported = after.report_recv_min - before.report_recv_min;
+
+		phase_result_t r = {};
+		r.rate_target          = rate;
+		r.elapsed_sec          = elapsed;
+		r.sent_pps             = sent / elapsed;
+		r.recv_pps             = (after.udp.recv_packets - before.udp.recv_packets) / elapsed;
+		r.reported_pps         = reported / elapsed;
+		r.loss                 = (sent > 0) ? (1.0 - double(std::min(reported, sent)) / sent) : 0;
+		r.sender_err           = after.send_err - before.send_err;
+		r.kernel_drops         = after.udp.recv_kernel_drops - before.udp.recv_kernel_drops;
+		r.decode_err           = after.udp.packet_decode_err - before.udp.packet_decode_err;
+		r.udp_send_err         = after.udp.packet_send_err - before.udp.packet_send_err;
+		r.validate_err         = after.repacker.packet_validate_err - before.repacker.packet_validate_err;
+		r.coordinator_send_err = after.coordinator_send_err - before.coordinator_send_err;
+		r.report_send_err      = after.report_send_err - before.report_send_err;
+		r.cpu_udp              = (after.cpu_udp - before.cpu_udp) / cpu_elapsed;
+		r.cpu_repacker         = (after.cpu_repacker - before.cpu_repacker) / cpu_elapsed;
+		r.cpu_coordinator      = (after.cpu_coordinator - before.cpu_coordinator) / cpu_elapsed;
+		r.cpu_reports          = (after.cpu_reports - before.cpu_reports) / cpu_elapsed;
+		r.snapshot             = summarize(std::move(snapshot_ms));
+		return r;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char const *argv[])
+try
+{
+	using namespace aux;
+
+	bench_conf_t const conf = parse_args(argc, argv);
+
+	if (!conf.record_file.empty())
+	{
+		record(conf);
+		return 0;
+	}
+
+	datagram_ts_t datagram_ts;
+	datagrams_t const datagrams = (conf.replay_file.empty())
+		? traffic_generator_t(conf.traffic).make_datagrams()
+		: load_recorded_datagrams(conf.replay_file, &datagram_ts);
+
+	if (conf.replay_speed > 0 && datagram_ts.empty())
+		throw std::runtime_error(ff::fmt_str("{0}: --replay-speed needs a datagram capture file, this one has no timestamps", conf.replay_file));
+
+	pinba_options_t options = {
+		.net_address              = conf.address,
+		.net_port                 = conf.port,
+
+		.udp_threads              = conf.udp_threads,
+		.udp_batch_messages       = 256,
+		.udp_batch_timeout        = 10 * d_millisecond,
+
+		.repacker_threads         = conf.repacker_threads,
+		.repacker_input_buffer    = 16 * 1024,
+		.repacker_batch_messages  = 1024,
+		.repacker_batch_timeout   = 100 * d_millisecond,
+
+		.coordinator_input_buffer = 128,
+		.report_input_buffer      = 128,
+
+		.logger                   = {},
+	};
+
+	auto pinba = pinba_engine_init(&options);
+	pinba->startup();
+	pinba->globals()->logger()->set_level(meow::logging::log_level::warning);
+
+	add_reports(conf, pinba.get());
+
+	sample_t total_senders = {};
+	double   rate = conf.rate;
+	double   sustainable_pps = 0;
+	double   best_reported_pps = 0;
+	uint32_t n_phases = 0;
+
+	for (uint32_t phase = 0; phase < ((conf.search) ? conf.max_phases : 1); phase++)
+	{
+		phase_result_t const r = run_phase(conf, pinba.get(), datagrams, datagram_ts, rate, &total_senders);
+		print_phase(phase, r);
+		n_phases++;
+
+		best_reported_pps = std::max(best_reported_pps, r.reported_pps);
+
+		if (r.loss > conf.max_loss)
+			break;
+
+		sustainable_pps = r.sent_pps;
+		rate *= conf.search_step;
+	}
+
+	ff::fmt(stdout,
+		"{{\"summary\":{{\"version\":\"{0}\",\"git\":\"{1}\",\"traffic\":\"{2}\",\"datagrams\":{3},\"phases\":{4},"
+		"\"udp_threads\":{5},\"repacker_threads\":{6},\"sender_threads\":{7},\"max_loss\":{8},"
+		"\"sustainable_pps\":{9},\"best_reported_pps\":{10}}}\n",
+		PINBA_VERSION, PINBA_VCS_FULL_HASH, (conf.replay_file.empty()) ? "synthetic" : "replay", datagrams.size(), n_phases,
+		conf.udp_threads, conf.repacker_threads, conf.sender_threads, conf.max_loss,
+		sustainable_pps, best_reported_pps);
+
+	pinba->shutdown();
+	return 0;
+}
+catch (std::exception const& e)
+{
+	ff::fmt(stderr, "error: {0}\n", e.what());
+	return 1;
+}
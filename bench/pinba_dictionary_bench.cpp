@@ -0,0 +1,370 @@
+#include "pinba_config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+#include <meow/unix/time.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/dictionary.h"
+#include "pinba/repacker_dictionary.h"
+
+#include "traffic.h" // zipf_distribution_t
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// dictionary contention benchmark, the way repackers and selects hit it, no network, no reports
+//
+// --writers threads run repacker_dictionary_t each, same as repacker threads do:
+//   words come in batches, every batch gets a wordslice of its own, that is held for --hold batches (reports do that),
+//   unused wordslices are reaped every --reap-every batches, releasing words in global dictionary
+//   words are zipf distributed over a --words sized set (shared by all writers), --new-rate fraction is never seen before
+// --readers threads call dictionary_t::get_word() for zipf distributed words of the same set (report selects do that)
+//
+// every --sample-every-th operation is timed, prints a json line per operation kind with throughput and latency percentiles
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct bench_conf_t
+	{
+		uint32_t     writers          = 16;
+		uint32_t     readers          = 4;
+		double       duration_sec     = 10;
+
+		uint32_t     n_words          = 1000000; // shared word set
+		double       zipf_s           = 1.0;
+		double       new_rate         = 0.01;    // fraction of writer lookups, that are new unique words
+
+		uint32_t     batch_size       = 1024;    // words per wordslice
+		uint32_t     hold_batches     = 64;      // wordslices kept referenced per writer
+		uint32_t     reap_every       = 16;      // batches between reaps
+		uint32_t     reap_words       = 0;       // max words per reap, 0 = all
+
+		uint32_t     shards           = dictionary_t::default_shard_count;
+		uint32_t     sample_every     = 64;
+	};
+
+	static void usage(char const *argv0)
+	{
+		ff::fmt(stderr,
+			"usage: {0} [options]\n"
+			"  --writers=16 --readers=4 --duration=10   repacker_dictionary_t threads, get_word() threads, seconds\n"
+			"  --words=1000000 --zipf=1.0               shared word set size, popularity skew (0 = uniform)\n"
+			"  --new-rate=0.01                          fraction of writer lookups, that are new unique words\n"
+			"  --batch=1024 --hold=64                   words per wordslice, wordslices held per writer\n"
+			"  --reap-every=16 --reap-words=0           batches between reaps, max words per reap (0 = all)\n"
+			"  --shards={1} --sample-every=64           dictionary shards, time every N-th operation\n"
+			, argv0, dictionary_t::default_shard_count);
+	}
+
+	static bench_conf_t parse_args(int argc, char const *argv[])
+	{
+		bench_conf_t conf;
+
+		for (int i = 1; i < argc; i++)
+		{
+			std::string const arg = argv[i];
+
+			if (arg == "--help" || arg == "-h")
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+
+			size_t const eq = arg.find('=');
+			if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+				throw std::runtime_error(ff::fmt_str("bad argument '{0}', expected --name=value", arg));
+
+			std::string const name  = arg.substr(2, eq - 2);
+			std::string const value = arg.substr(eq + 1);
+
+			auto const as_u32 = [&]() { return uint32_t(std::strtoul(value.c_str(), nullptr, 10)); };
+			auto const as_dbl = [&]() { return std::strtod(value.c_str(), nullptr); };
+
+			if      (name == "writers")      conf.writers = as_u32();
+			else if (name == "readers")      conf.readers = as_u32();
+			else if (name == "duration")     conf.duration_sec = as_dbl();
+			else if (name == "words")        conf.n_words = as_u32();
+			else if (name == "zipf")         conf.zipf_s = as_dbl();
+			else if (name == "new-rate")     conf.new_rate = as_dbl();
+			else if (name == "batch")        conf.batch_size = as_u32();
+			else if (name == "hold")         conf.hold_batches = as_u32();
+			else if (name == "reap-every")   conf.reap_every = as_u32();
+			else if (name == "reap-words")   conf.reap_words = as_u32();
+			else if (name == "shards")       conf.shards = as_u32();
+			else if (name == "sample-every") conf.sample_every = as_u32();
+			else
+				throw std::runtime_error(ff::fmt_str("unknown option '--{0}', see --help", name));
+		}
+
+		if (conf.writers == 0 && conf.readers == 0)
+			throw std::runtime_error("need some --writers or --readers");
+
+		if (conf.n_words == 0 || conf.batch_size == 0 || conf.reap_every == 0 || conf.sample_every == 0)
+			throw std::runtime_error("words, batch, reap-every and sample-every must be > 0");
+
+		if (conf.new_rate < 0 || conf.new_rate > 1)
+			throw std::runtime_error("new-rate must be in [0, 1]");
+
+		return conf;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct word_and_hash_t
+	{
+		std::string  word;
+		uint64_t     hash;
+	};
+
+	// what a thread has done, latencies are nanoseconds of sampled operations
+	struct thread_result_t
+	{
+		uint64_t              ops       = 0;
+		uint64_t              new_words = 0;
+		std::vector<uint64_t> latency_ns;
+		std::vector<uint64_t> reap_ns;   // writers only, every reap is timed
+	};
+
+	static std::atomic<uint64_t> result_sink = {0}; // keeps lookups from being optimized away
+
+	inline uint64_t elapsed_ns(timeval_t from)
+	{
+		return uint64_t(duration_from_timeval(os_unix::clock_monotonic_now() - from).nsec);
+	}
+
+	static void writer_thread(bench_conf_t const& conf, dictionary_t *d, std::vector<word_and_hash_t> const& words,
+		zipf_distribution_t const& zipf, uint32_t thread_id, std::atomic<bool> const& stop, thread_result_t *result)
+	{
+		std::mt19937_64 rng { 1000 + thread_id };
+		std::uniform_real_distribution<double> coin { 0, 1 };
+
+		auto r_dictionary = meow::make_unique<repacker_dictionary_t>(d);
+		std::deque<repacker_dictionary_t::wordslice_ptr> held; // same as reports holding batches
+
+		uint64_t id_sum   = 0;
+		uint64_t n_new    = 0;
+		uint64_t n_batch  = 0;
+		std::string new_word;
+
+		result->latency_ns.reserve(1024 * 1024);
+
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			for (uint32_t i = 0; i < conf.batch_size; i++, result->ops++)
+			{
+				str_ref  word;
+				uint64_t hash;
+
+				if ((conf.new_rate > 0) && (coin(rng) < conf.new_rate))
+				{
+					new_word = ff::fmt_str("/new/{0}/{1}/{2}", thread_id, n_new++, rng());
+					word = new_word;
+					hash = dictionary_word_hasher_t()(word);
+				}
+				else
+				{
+					word_and_hash_t const& w = words[zipf(rng)];
+					word = w.word;
+					hash = w.hash;
+				}
+
+				if ((result->ops % conf.sample_every) != 0)
+				{
+					id_sum += r_dictionary->get_or_add(word, hash);
+					continue;
+				}
+
+				timeval_t const start_tv = os_unix::clock_monotonic_now();
+				id_sum += r_dictionary->get_or_add(word, hash);
+				result->latency_ns.push_back(elapsed_ns(start_tv));
+			}
+
+			held.push_back(r_dictionary->current_wordslice());
+			r_dictionary->start_new_wordslice();
+
+			if (held.size() > conf.hold_batches)
+				held.pop_front();
+
+			if ((++n_batch % conf.reap_every) == 0)
+			{
+				timeval_t const start_tv = os_unix::clock_monotonic_now();
+
+				r_dictionary->reap_unused_wordslices(conf.reap_words);
+				while (r_dictionary->has_unreaped_wordslices())
+					r_dictionary->reap_unused_wordslices(conf.reap_words);
+
+				result->reap_ns.push_back(elapsed_ns(start_tv));
+			}
+		}
+
+		// release everything, so that dictionary is empty of our words by the end
+		held.clear();
+		r_dictionary->retire();
+		while (!r_dictionary->empty())
+			r_dictionary->reap_unused_wordslices(0);
+
+		result->new_words = n_new;
+		result_sink += id_sum;
+	}
+
+	static void reader_thread(bench_conf_t const& conf, dictionary_t *d, std::vector<uint32_t> const& word_ids,
+		zipf_distribution_t const& zipf, uint32_t thread_id, std::atomic<bool> const& stop, thread_result_t *result)
+	{
+		std::mt19937_64 rng { 2000 + thread_id };
+
+		uint64_t len_sum = 0;
+
+		result->latency_ns.reserve(1024 * 1024);
+
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			for (uint32_t i = 0; i < 1024; i++, result->ops++)
+			{
+				uint32_t const word_id = word_ids[zipf(rng)];
+
+				if ((result->ops % conf.sample_every) != 0)
+				{
+					len_sum += d->get_word(word_id).size();
+					continue;
+				}
+
+				timeval_t const start_tv = os_unix::clock_monotonic_now();
+				len_sum += d->get_word(word_id).size();
+				result->latency_ns.push_back(elapsed_ns(start_tv));
+			}
+		}
+
+		result_sink += len_sum;
+	}
+
+	static void print_result(char const *op, uint32_t n_threads, double elapsed_sec, std::vector<thread_result_t> const& results, bool reaps)
+	{
+		uint64_t ops       = 0;
+		uint64_t new_words = 0;
+		std::vector<uint64_t> v;
+
+		for (auto const& r : results)
+		{
+			ops       += r.ops;
+			new_words += r.new_words;
+
+			auto const& lat = (reaps) ? r.reap_ns : r.latency_ns;
+			v.insert(v.end(), lat.begin(), lat.end());
+		}
+
+		if (reaps)
+			ops = v.size();
+
+		std::sort(v.begin(), v.end());
+
+		auto const at = [&v](double pct) -> uint64_t
+		{
+			return (v.empty()) ? 0 : v[std::min(v.size() - 1, size_t(pct / 100.0 * v.size()))];
+		};
+
+		ff::fmt(stdout,
+			"{{\"op\":\"{0}\",\"threads\":{1},\"ops\":{2},\"ops_per_sec\":{3},\"new_words\":{4},\"samples\":{5},"
+			"\"latency_ns\":{{\"p50\":{6},\"p99\":{7},\"p999\":{8},\"max\":{9}}}\n",
+			op, n_threads, ops, ops / elapsed_sec, new_words, v.size(),
+			at(50), at(99), at(99.9), (v.empty()) ? 0 : v.back());
+		fflush(stdout);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char const *argv[])
+try
+{
+	using namespace aux;
+
+	bench_conf_t const conf = parse_args(argc, argv);
+
+	pinba_options_t options = {};
+	pinba_globals_init(&options); // repacker_dictionary_t uses global stats
+
+	dictionary_t dictionary { 0, conf.shards };
+
+	// shared word set, url-like, every word is referenced here for the whole run, so that readers can get_word() any of them
+	std::vector<word_and_hash_t> words;
+	std::vector<uint32_t>        word_ids;
+	words.reserve(conf.n_words);
+	word_ids.reserve(conf.n_words);
+
+	for (uint32_t i = 0; i < conf.n_words; i++)
+	{
+		std::string word = ff::fmt_str("/api/v2/script-{0}/{1}.phtml", i % 1000, i);
+		uint64_t const hash = dictionary_word_hasher_t()(word);
+
+		word_ids.push_back(dictionary.get_or_add___ref(word, hash)->id);
+		words.push_back(word_and_hash_t { std::move(word), hash });
+	}
+
+	zipf_distribution_t const zipf { conf.n_words, conf.zipf_s };
+
+	std::vector<thread_result_t> writer_results(conf.writers);
+	std::vector<thread_result_t> reader_results(conf.readers);
+	std::vector<std::thread>     threads;
+	std::atomic<bool>            stop = { false };
+
+	timeval_t const start_tv = os_unix::clock_monotonic_now();
+
+	for (uint32_t i = 0; i < conf.writers; i++)
+	{
+		threads.emplace_back([&, i]()
+		{
+			writer_thread(conf, &dictionary, words, zipf, i, stop, &writer_results[i]);
+		});
+	}
+
+	for (uint32_t i = 0; i < conf.readers; i++)
+	{
+		threads.emplace_back([&, i]()
+		{
+			reader_thread(conf, &dictionary, word_ids, zipf, i, stop, &reader_results[i]);
+		});
+	}
+
+	std::this_thread::sleep_for(std::chrono::nanoseconds(int64_t(conf.duration_sec * 1e9)));
+	stop.store(true);
+
+	for (auto& t : threads)
+		t.join();
+
+	double const elapsed_sec = timeval_to_double(os_unix::clock_monotonic_now() - start_tv);
+
+	if (conf.writers > 0)
+	{
+		print_result("get_or_add", conf.writers, elapsed_sec, writer_results, false);
+		print_result("reap", conf.writers, elapsed_sec, writer_results, true);
+	}
+
+	if (conf.readers > 0)
+		print_result("get_word", conf.readers, elapsed_sec, reader_results, false);
+
+	ff::fmt(stdout,
+		"{{\"summary\":{{\"version\":\"{0}\",\"git\":\"{1}\",\"shards\":{2},\"words\":{3},\"zipf\":{4},\"new_rate\":{5},\"elapsed_sec\":{6}}}\n",
+		PINBA_VERSION, PINBA_VCS_FULL_HASH, conf.shards, conf.n_words, conf.zipf_s, conf.new_rate, elapsed_sec);
+
+	dictionary.erase_words___ref(word_ids.data(), word_ids.size());
+	return 0;
+}
+catch (std::exception const& e)
+{
+	ff::fmt(stderr, "error: {0}\n", e.what());
+	return 1;
+}
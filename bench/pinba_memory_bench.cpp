@@ -0,0 +1,422 @@
+#include "pinba_config.h"
+
+#include <malloc.h> // mallinfo
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+#include <meow/unix/time.hpp>
+
+#include "proto/pinba.pb-c.h"
+
+#include "pinba/globals.h"
+#include "pinba/dictionary.h"
+#include "pinba/histogram.h"
+#include "pinba/packet.h"
+#include "pinba/packet_impl.h"
+#include "pinba/repacker.h"
+#include "pinba/report.h"
+#include "pinba/report_by_request.h"
+#include "pinba/report_by_timer.h"
+#include "pinba/report_by_packet.h"
+
+#include "misc/nmpa.h"
+#include "misc/nmpa_pba.h"
+
+#include "traffic.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// memory footprint benchmark, to size RAM by numbers instead of trial and error
+//
+// a tick worth of synthetic traffic (traffic.h, key cardinality is --scripts, --servers, --tag-values, ...)
+// is repacked once into global dictionary, then for every report kind (and histogram kind, for by_request)
+// the same packets are aggregated into --ticks ticks and merged into history, and a snapshot is taken with histograms
+//
+// measured (bytes, and bytes per unique row, word or packet)
+//  - dictionary: dictionary_t::memory_used() per word
+//  - batches: nmpa_mem_used() of packet batches per packet (transient, until batch is aggregated by all reports)
+//  - tick: report_agg_t::get_estimates() right before every tick, average and max
+//  - history: report_history_t::get_estimates() after the last tick (the number report_max_mem / mem_governor use)
+//  - heap: allocator in-use bytes (glibc mallinfo) around aggregation + history and around the snapshot,
+//    what reports really take, estimates above can be compared to it
+//
+// prints a json line for dictionary and batches, and one per report
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct bench_conf_t
+	{
+		std::vector<std::string> kinds    = { "request", "timer", "packet" };
+		std::vector<int>         hv_kinds = { HISTOGRAM_KIND__HDR, HISTOGRAM_KIND__FLAT }; // by_request only
+
+		uint32_t     packets_per_tick  = 100000;
+		uint32_t     batch_size        = 1024;
+		uint32_t     tick_count        = 60;
+		uint32_t     hv_bucket_count   = 1000;  // 0 = no histograms
+
+		traffic_conf_t traffic;
+
+		bench_conf_t()
+		{
+			traffic.n_datagrams = 100000; // distinct requests, so that key cardinality isn't capped by the cycle
+		}
+	};
+
+	static std::vector<std::string> split(std::string const& s)
+	{
+		std::vector<std::string> result;
+
+		size_t start = 0;
+		while (start <= s.size())
+		{
+			size_t const end = std::min(s.find(',', start), s.size());
+			if (end > start)
+				result.push_back(s.substr(start, end - start));
+			start = end + 1;
+		}
+
+		return result;
+	}
+
+	static char const* hv_kind_name(int hv_kind)
+	{
+		return (hv_kind == HISTOGRAM_KIND__HDR) ? "hdr" : "flat";
+	}
+
+	static void usage(char const *argv0)
+	{
+		ff::fmt(stderr,
+			"usage: {0} [options]\n"
+			"  --kinds=request,timer,packet        report kinds to run\n"
+			"  --hv-kinds=hdr,flat                 histogram kinds (by_request, others are always flat)\n"
+			"  --packets-per-tick=100000 --batch=1024 --ticks=60\n"
+			"  --hv-buckets=1000                   histogram buckets (1ms each), 0 = no histograms\n"
+			"synthetic traffic (--batch here is packet batch size, not requests per datagram, --datagrams default is 100000):\n"
+			"{1}"
+			, argv0, traffic_conf___usage());
+	}
+
+	static bench_conf_t parse_args(int argc, char const *argv[])
+	{
+		bench_conf_t conf;
+
+		for (int i = 1; i < argc; i++)
+		{
+			std::string const arg = argv[i];
+
+			if (arg == "--help" || arg == "-h")
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+
+			size_t const eq = arg.find('=');
+			if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+				throw std::runtime_error(ff::fmt_str("bad argument '{0}', expected --name=value", arg));
+
+			std::string const name  = arg.substr(2, eq - 2);
+			std::string const value = arg.substr(eq + 1);
+
+			auto const as_u32 = [&]() { return uint32_t(std::strtoul(value.c_str(), nullptr, 10)); };
+
+			if      (name == "kinds")            conf.kinds = split(value);
+			else if (name == "packets-per-tick") conf.packets_per_tick = as_u32();
+			else if (name == "batch")            conf.batch_size = as_u32();
+			else if (name == "ticks")            conf.tick_count = as_u32();
+			else if (name == "hv-buckets")       conf.hv_bucket_count = as_u32();
+			else if (name == "hv-kinds")
+			{
+				conf.hv_kinds.clear();
+				for (auto const& k : split(value))
+				{
+					if (k == "hdr")       conf.hv_kinds.push_back(HISTOGRAM_KIND__HDR);
+					else if (k == "flat") conf.hv_kinds.push_back(HISTOGRAM_KIND__FLAT);
+					else
+						throw std::runtime_error(ff::fmt_str("unknown --hv-kinds value '{0}', expected hdr or flat", k));
+				}
+			}
+			else if (traffic_conf___parse_option(&conf.traffic, name, value))
+				continue;
+			else
+				throw std::runtime_error(ff::fmt_str("unknown option '--{0}', see --help", name));
+		}
+
+		if (conf.packets_per_tick == 0 || conf.batch_size == 0 || conf.tick_count == 0)
+			throw std::runtime_error("packets-per-tick, batch and ticks must be > 0");
+
+		if (conf.hv_kinds.empty())
+			throw std::runtime_error("need at least one --hv-kinds value");
+
+		conf.traffic.requests_per_datagram = 1;
+		conf.traffic.lz4 = false;
+		traffic_conf___validate(conf.traffic);
+
+		return conf;
+	}
+
+	// allocator in-use bytes, small chunks + mmapped ones, 0 if we don't know how to get it
+	static uint64_t heap_in_use()
+	{
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 33)
+		struct mallinfo2 const mi = mallinfo2();
+		return uint64_t(mi.uordblks) + uint64_t(mi.hblkhd);
+#else
+		struct mallinfo const mi = mallinfo(); // int fields, wrap at 4gb
+		return uint64_t(unsigned(mi.uordblks)) + uint64_t(unsigned(mi.hblkhd));
+#endif
+#else
+		return 0;
+#endif
+	}
+
+	static int64_t heap_delta(uint64_t before)
+	{
+		return int64_t(heap_in_use()) - int64_t(before);
+	}
+
+	static double per_item(double bytes, uint64_t n)
+	{
+		return (n > 0) ? (bytes / n) : 0;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct packets_t
+	{
+		std::vector<packet_batch_ptr> batches;
+		uint64_t n_packets = 0;
+		uint64_t n_timers  = 0;
+	};
+
+	// same as pinba_report_bench, packets are repacked into global dictionary the way repacker does
+	static packets_t make_packets(bench_conf_t const& conf, pinba_globals_t *globals)
+	{
+		std::vector<std::string> const requests = traffic_generator_t(conf.traffic).make_datagrams();
+
+		packets_t result;
+
+		struct nmpa_s unpack_nmpa;
+		nmpa_init(&unpack_nmpa, 64 * 1024);
+
+		ProtobufCAllocator pba = {
+			.alloc = nmpa___pba_alloc,
+			.free = nmpa___pba_free,
+			.allocator_data = &unpack_nmpa,
+		};
+
+		for (uint32_t i = 0; i < conf.packets_per_tick; )
+		{
+			packet_batch_ptr batch { new packet_batch_t(conf.batch_size, 16 * 1024) };
+
+			for (; batch->packet_count < conf.batch_size && i < conf.packets_per_tick; i++)
+			{
+				std::string const& req_bytes = requests[i % requests.size()];
+
+				Pinba__Request *req = pinba__request__unpack(&pba, req_bytes.size(), (uint8_t const*)req_bytes.data());
+				if (req == nullptr)
+					throw std::runtime_error("generated request failed to unpack");
+
+				auto const vr = pinba_validate_request(req);
+				if (vr != request_validate_result::okay)
+					throw std::runtime_error(ff::fmt_str("generated request failed validation: {0}", enum_as_str_ref(vr)));
+
+				packet_t *packet = pinba_request_to_packet(req, globals->dictionary(), &batch->nmpa, &batch->tagsets);
+				batch->packets[batch->packet_count++] = packet;
+				batch->summary.add_packet(packet);
+
+				result.n_packets++;
+				result.n_timers += packet->timer_count;
+
+				nmpa_empty(&unpack_nmpa);
+			}
+
+			batch->build_columns();
+			result.batches.push_back(std::move(batch));
+		}
+
+		nmpa_free(&unpack_nmpa);
+		return result;
+	}
+
+	static report_ptr make_report(bench_conf_t const& conf, pinba_globals_t *globals, std::string const& kind, int hv_kind)
+	{
+		auto const init_common = [&](auto *rconf)
+		{
+			rconf->name            = ff::fmt_str("bench/{0}/{1}", kind, hv_kind_name(hv_kind));
+			rconf->time_window     = conf.tick_count * d_second;
+			rconf->tick_count      = conf.tick_count;
+			rconf->hv_bucket_count = conf.hv_bucket_count;
+			rconf->hv_bucket_d     = 1 * d_millisecond;
+		};
+
+		if (kind == "request")
+		{
+			report_conf___by_request_t rconf = {};
+			init_common(&rconf);
+			rconf.hv_kind = hv_kind;
+			rconf.keys.push_back(report_conf___by_request_t::key_descriptor_by_request_field("script_name", &packet_t::script_id));
+			rconf.keys.push_back(report_conf___by_request_t::key_descriptor_by_request_field("server_name", &packet_t::server_id));
+			return create_report_by_request(globals, rconf);
+		}
+
+		if (kind == "timer")
+		{
+			report_conf___by_timer_t rconf = {};
+			init_common(&rconf);
+
+			dictionary_t *d = globals->dictionary();
+			for (uint32_t i = 0; i < std::min(conf.traffic.tags_per_timer, 2u); i++)
+			{
+				std::string const tag_name = ff::fmt_str("tag{0}", i);
+				rconf.keys.push_back(report_conf___by_timer_t::key_descriptor_by_timer_tag(tag_name, d->add_nameword(tag_name).id));
+			}
+
+			if (rconf.keys.empty())
+				throw std::runtime_error("timer report needs --tags-per-timer > 0");
+
+			rconf.keys.push_back(report_conf___by_timer_t::key_descriptor_by_request_field("script_name", &packet_t::script_id));
+			return create_report_by_timer(globals, rconf);
+		}
+
+		if (kind == "packet")
+		{
+			report_conf___by_packet_t rconf = {};
+			init_common(&rconf);
+			return create_report_by_packet(globals, rconf);
+		}
+
+		throw std::runtime_error(ff::fmt_str("unknown report kind '{0}', expected request, timer or packet", kind));
+	}
+
+	static void run_report(bench_conf_t const& conf, pinba_globals_t *globals, packets_t const& packets, std::string const& kind, int hv_kind)
+	{
+		uint64_t const heap_start = heap_in_use();
+
+		report_ptr const report = make_report(conf, globals, kind, hv_kind);
+
+		report_stats_t stats;
+
+		report_agg_ptr     agg     = report->create_aggregator();
+		report_history_ptr history = report->create_history();
+		agg->stats_init(&stats);
+		history->stats_init(&stats);
+
+		timeval_t curr_tv = os_unix::clock_monotonic_now();
+
+		uint64_t tick_bytes_sum = 0;
+		uint64_t tick_bytes_max = 0;
+		uint64_t tick_rows_sum  = 0;
+
+		for (uint32_t tick = 1; tick <= conf.tick_count; tick++)
+		{
+			for (auto const& batch : packets.batches)
+				agg->add_batch(batch->columns, batch->packets);
+
+			report_estimates_t const e = agg->get_estimates();
+			tick_bytes_sum += e.mem_used;
+			tick_bytes_max  = std::max(tick_bytes_max, e.mem_used);
+			tick_rows_sum  += e.row_count;
+
+			curr_tv += d_second;
+			history->merge_tick(agg->tick_now(curr_tv));
+		}
+
+		report_estimates_t const history_e = history->get_estimates();
+		int64_t const report_heap = heap_delta(heap_start);
+
+		uint64_t const heap_before_snapshot = heap_in_use();
+
+		report_snapshot_ptr snapshot = history->get_snapshot();
+		snapshot->prepare(report_snapshot_t::merge_flags::with_histograms);
+
+		int64_t const snapshot_heap = heap_delta(heap_before_snapshot);
+		size_t const  rows          = snapshot->row_count();
+
+		double const tick_rows_avg  = double(tick_rows_sum) / conf.tick_count;
+		double const tick_bytes_avg = double(tick_bytes_sum) / conf.tick_count;
+
+		ff::fmt(stdout,
+			"{{\"kind\":\"{0}\",\"hv_kind\":\"{1}\",\"hv_buckets\":{2},\"ticks\":{3},\"packets_per_tick\":{4},\"timers_per_tick\":{5},\"rows\":{6},"
+			"\"tick\":{{\"rows_avg\":{7},\"bytes_avg\":{8},\"bytes_max\":{9},\"bytes_per_row\":{10}},"
+			"\"history\":{{\"bytes\":{11},\"bytes_per_row\":{12},\"bytes_per_row_tick\":{13}},"
+			"\"heap\":{{\"report_bytes\":{14},\"report_bytes_per_row\":{15},\"snapshot_bytes\":{16},\"snapshot_bytes_per_row\":{17}}}\n",
+			kind, (kind == "request") ? hv_kind_name(hv_kind) : "flat", conf.hv_bucket_count, conf.tick_count,
+			packets.n_packets, packets.n_timers, rows,
+			tick_rows_avg, tick_bytes_avg, tick_bytes_max, per_item(tick_bytes_avg, uint64_t(tick_rows_avg)),
+			history_e.mem_used, per_item(history_e.mem_used, rows), per_item(history_e.mem_used, rows * conf.tick_count),
+			report_heap, per_item(report_heap, rows), snapshot_heap, per_item(snapshot_heap, rows));
+		fflush(stdout);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char const *argv[])
+try
+{
+	using namespace aux;
+
+	bench_conf_t const conf = parse_args(argc, argv);
+
+	pinba_options_t options = {};
+	pinba_globals_t *globals = pinba_globals_init(&options);
+
+	uint64_t const heap_before_packets = heap_in_use();
+
+	packets_t const packets = make_packets(conf, globals);
+
+	{
+		dictionary_t const *d = globals->dictionary();
+		dictionary_memory_t const dm = d->memory_used();
+
+		uint64_t const words       = d->size();
+		uint64_t const dict_bytes  = dm.hash_bytes + dm.wordlist_bytes + dm.freelist_bytes + dm.strings_bytes;
+
+		uint64_t batch_bytes = 0;
+		for (auto const& batch : packets.batches)
+			batch_bytes += nmpa_mem_used(&batch->nmpa);
+
+		ff::fmt(stdout,
+			"{{\"dictionary\":{{\"words\":{0},\"bytes\":{1},\"bytes_per_word\":{2},\"hash_bytes\":{3},\"wordlist_bytes\":{4},\"freelist_bytes\":{5},\"strings_bytes\":{6}},"
+			"\"batches\":{{\"count\":{7},\"packets\":{8},\"nmpa_bytes\":{9},\"nmpa_bytes_per_packet\":{10},\"heap_bytes\":{11}}}\n",
+			words, dict_bytes, per_item(dict_bytes, words), dm.hash_bytes, dm.wordlist_bytes, dm.freelist_bytes, dm.strings_bytes,
+			packets.batches.size(), packets.n_packets, batch_bytes, per_item(batch_bytes, packets.n_packets), heap_delta(heap_before_packets));
+		fflush(stdout);
+	}
+
+	for (auto const& kind : conf.kinds)
+	{
+		if (kind == "request")
+		{
+			for (int const hv_kind : conf.hv_kinds)
+				run_report(conf, globals, packets, kind, hv_kind);
+		}
+		else
+		{
+			run_report(conf, globals, packets, kind, HISTOGRAM_KIND__FLAT);
+		}
+	}
+
+	ff::fmt(stdout,
+		"{{\"summary\":{{\"version\":\"{0}\",\"git\":\"{1}\",\"hosts\":{2},\"servers\":{3},\"scripts\":{4},\"timer_tags\":{5},\"tag_values\":{6},\"datagrams\":{7}}}\n",
+		PINBA_VERSION, PINBA_VCS_FULL_HASH, conf.traffic.n_hosts, conf.traffic.n_servers, conf.traffic.n_scripts,
+		conf.traffic.n_timer_tags, conf.traffic.n_tag_values, conf.traffic.n_datagrams);
+
+	return 0;
+}
+catch (std::exception const& e)
+{
+	ff::fmt(stderr, "error: {0}\n", e.what());
+	return 1;
+}
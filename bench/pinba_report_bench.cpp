@@ -0,0 +1,424 @@
+#include "pinba_config.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <meow/stopwatch.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+#include <meow/unix/time.hpp>
+
+#include "proto/pinba.pb-c.h"
+
+#include "pinba/globals.h"
+#include "pinba/dictionary.h"
+#include "pinba/histogram.h"
+#include "pinba/packet.h"
+#include "pinba/packet_impl.h"
+#include "pinba/repacker.h"
+#include "pinba/report.h"
+#include "pinba/report_by_request.h"
+#include "pinba/report_by_timer.h"
+#include "pinba/report_by_packet.h"
+
+#include "misc/nmpa.h"
+#include "misc/nmpa_pba.h"
+
+#include "traffic.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// report microbenchmarks, no threads, no network, just report parts driven the same way report hosts do
+//
+// packets are repacked once (from traffic.h synthetic requests) into packet batches with columns,
+// then for every report kind
+//  - aggregation: report_agg_t::add_batch() over all batches, ns/packet
+//  - ticks: report_agg_t::tick_now() + report_history_t::merge_tick(), ticks/sec
+//  - snapshot merge: get_snapshot() + prepare() with history filled to 1, 1/4, 1/2, all ticks, ms vs rows
+//  - percentiles: --percentiles for every row of the last merge, ns/row
+//
+// prints a json line per report kind
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct bench_conf_t
+	{
+		std::vector<std::string> kinds = { "request", "timer", "packet" };
+
+		uint32_t     packets_per_tick  = 100000;
+		uint32_t     batch_size        = 1024;   // packets per batch, same as repacker_batch_messages
+		uint32_t     tick_count        = 60;     // history depth
+		uint32_t     hv_bucket_count   = 1000;   // 0 = no histograms (and no percentiles)
+		int          hv_kind           = HISTOGRAM_KIND__HDR; // by_request only
+
+		std::vector<double> percentiles = { 50, 95, 99 };
+
+		traffic_conf_t traffic;
+	};
+
+	static std::vector<std::string> split(std::string const& s)
+	{
+		std::vector<std::string> result;
+
+		size_t start = 0;
+		while (start <= s.size())
+		{
+			size_t const end = std::min(s.find(',', start), s.size());
+			if (end > start)
+				result.push_back(s.substr(start, end - start));
+			start = end + 1;
+		}
+
+		return result;
+	}
+
+	static void usage(char const *argv0)
+	{
+		ff::fmt(stderr,
+			"usage: {0} [options]\n"
+			"  --kinds=request,timer,packet        report kinds to run\n"
+			"  --packets-per-tick=100000 --batch=1024 --ticks=60\n"
+			"  --hv-buckets=1000                   histogram buckets (1ms each), 0 = no histograms\n"
+			"  --hv-kind=hdr                       hdr or flat (by_request only)\n"
+			"  --percentiles=50,95,99\n"
+			"synthetic traffic (--batch here is packet batch size, not requests per datagram):\n"
+			"{1}"
+			, argv0, traffic_conf___usage());
+	}
+
+	static bench_conf_t parse_args(int argc, char const *argv[])
+	{
+		bench_conf_t conf;
+
+		for (int i = 1; i < argc; i++)
+		{
+			std::string const arg = argv[i];
+
+			if (arg == "--help" || arg == "-h")
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+
+			size_t const eq = arg.find('=');
+			if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+				throw std::runtime_error(ff::fmt_str("bad argument '{0}', expected --name=value", arg));
+
+			std::string const name  = arg.substr(2, eq - 2);
+			std::string const value = arg.substr(eq + 1);
+
+			auto const as_u32 = [&]() { return uint32_t(std::strtoul(value.c_str(), nullptr, 10)); };
+
+			if      (name == "kinds")            conf.kinds = split(value);
+			else if (name == "packets-per-tick") conf.packets_per_tick = as_u32();
+			else if (name == "batch")            conf.batch_size = as_u32();
+			else if (name == "ticks")            conf.tick_count = as_u32();
+			else if (name == "hv-buckets")       conf.hv_bucket_count = as_u32();
+			else if (name == "hv-kind")
+			{
+				if (value == "hdr")       conf.hv_kind = HISTOGRAM_KIND__HDR;
+				else if (value == "flat") conf.hv_kind = HISTOGRAM_KIND__FLAT;
+				else
+					throw std::runtime_error(ff::fmt_str("unknown --hv-kind '{0}', expected hdr or flat", value));
+			}
+			else if (name == "percentiles")
+			{
+				conf.percentiles.clear();
+				for (auto const& p : split(value))
+					conf.percentiles.push_back(std::strtod(p.c_str(), nullptr));
+			}
+			else if (traffic_conf___parse_option(&conf.traffic, name, value))
+				continue;
+			else
+				throw std::runtime_error(ff::fmt_str("unknown option '--{0}', see --help", name));
+		}
+
+		if (conf.packets_per_tick == 0 || conf.batch_size == 0 || conf.tick_count == 0)
+			throw std::runtime_error("packets-per-tick, batch and ticks must be > 0");
+
+		// datagrams are unpacked one request at a time here
+		conf.traffic.requests_per_datagram = 1;
+		conf.traffic.lz4 = false;
+		traffic_conf___validate(conf.traffic);
+
+		return conf;
+	}
+
+	static double per_item_ns(timeval_t elapsed, uint64_t n)
+	{
+		return (n > 0) ? (timeval_to_double(elapsed) * 1e9 / n) : 0;
+	}
+
+	static double as_ms(timeval_t elapsed)
+	{
+		return timeval_to_double(elapsed) * 1e3;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct packets_t
+	{
+		std::vector<packet_batch_ptr> batches;
+		uint64_t n_packets = 0;
+		uint64_t n_timers  = 0;
+		double   repack_ns_per_packet = 0;
+	};
+
+	// a tick worth of packets, repacked into global dictionary, the same way repacker does
+	// (so tag name ids, tagset ids, blooms and columns are all there)
+	static packets_t make_packets(bench_conf_t const& conf, pinba_globals_t *globals)
+	{
+		std::vector<std::string> const requests = traffic_generator_t(conf.traffic).make_datagrams();
+
+		packets_t result;
+
+		struct nmpa_s unpack_nmpa;
+		nmpa_init(&unpack_nmpa, 64 * 1024);
+
+		ProtobufCAllocator pba = {
+			.alloc = nmpa___pba_alloc,
+			.free = nmpa___pba_free,
+			.allocator_data = &unpack_nmpa,
+		};
+
+		timeval_t repack_time = {0,0};
+
+		for (uint32_t i = 0; i < conf.packets_per_tick; )
+		{
+			packet_batch_ptr batch { new packet_batch_t(conf.batch_size, 16 * 1024) };
+
+			for (; batch->packet_count < conf.batch_size && i < conf.packets_per_tick; i++)
+			{
+				std::string const& req_bytes = requests[i % requests.size()];
+
+				Pinba__Request *req = pinba__request__unpack(&pba, req_bytes.size(), (uint8_t const*)req_bytes.data());
+				if (req == nullptr)
+					throw std::runtime_error("generated request failed to unpack");
+
+				auto const vr = pinba_validate_request(req);
+				if (vr != request_validate_result::okay)
+					throw std::runtime_error(ff::fmt_str("generated request failed validation: {0}", enum_as_str_ref(vr)));
+
+				meow::stopwatch_t sw;
+
+				packet_t *packet = pinba_request_to_packet(req, globals->dictionary(), &batch->nmpa, &batch->tagsets);
+				batch->packets[batch->packet_count++] = packet;
+				batch->summary.add_packet(packet);
+
+				repack_time += sw.stamp();
+
+				result.n_packets++;
+				result.n_timers += packet->timer_count;
+
+				nmpa_empty(&unpack_nmpa);
+			}
+
+			batch->build_columns();
+			result.batches.push_back(std::move(batch));
+		}
+
+		nmpa_free(&unpack_nmpa);
+
+		result.repack_ns_per_packet = per_item_ns(repack_time, result.n_packets);
+		return result;
+	}
+
+	static report_ptr make_report(bench_conf_t const& conf, pinba_globals_t *globals, std::string const& kind)
+	{
+		auto const init_common = [&](auto *rconf)
+		{
+			rconf->name            = "bench/" + kind;
+			rconf->time_window     = conf.tick_count * d_second;
+			rconf->tick_count      = conf.tick_count;
+			rconf->hv_bucket_count = conf.hv_bucket_count;
+			rconf->hv_bucket_d     = 1 * d_millisecond;
+		};
+
+		if (kind == "request")
+		{
+			report_conf___by_request_t rconf = {};
+			init_common(&rconf);
+			rconf.hv_kind = conf.hv_kind;
+			rconf.keys.push_back(report_conf___by_request_t::key_descriptor_by_request_field("script_name", &packet_t::script_id));
+			rconf.keys.push_back(report_conf___by_request_t::key_descriptor_by_request_field("server_name", &packet_t::server_id));
+			return create_report_by_request(globals, rconf);
+		}
+
+		if (kind == "timer")
+		{
+			report_conf___by_timer_t rconf = {};
+			init_common(&rconf);
+
+			dictionary_t *d = globals->dictionary();
+			for (uint32_t i = 0; i < std::min(conf.traffic.tags_per_timer, 2u); i++)
+			{
+				std::string const tag_name = ff::fmt_str("tag{0}", i);
+				rconf.keys.push_back(report_conf___by_timer_t::key_descriptor_by_timer_tag(tag_name, d->add_nameword(tag_name).id));
+			}
+
+			if (rconf.keys.empty())
+				throw std::runtime_error("timer report needs --tags-per-timer > 0");
+
+			rconf.keys.push_back(report_conf___by_timer_t::key_descriptor_by_request_field("script_name", &packet_t::script_id));
+			return create_report_by_timer(globals, rconf);
+		}
+
+		if (kind == "packet")
+		{
+			report_conf___by_packet_t rconf = {};
+			init_common(&rconf);
+			return create_report_by_packet(globals, rconf);
+		}
+
+		throw std::runtime_error(ff::fmt_str("unknown report kind '{0}', expected request, timer or packet", kind));
+	}
+
+	struct merge_result_t
+	{
+		uint32_t  ticks;
+		size_t    rows;
+		double    ms;
+	};
+
+	static void run_kind(bench_conf_t const& conf, pinba_globals_t *globals, packets_t const& packets, std::string const& kind)
+	{
+		report_ptr const report = make_report(conf, globals, kind);
+
+		report_stats_t stats;
+
+		report_agg_ptr     agg     = report->create_aggregator();
+		report_history_ptr history = report->create_history();
+		agg->stats_init(&stats);
+		history->stats_init(&stats);
+
+		timeval_t add_time  = {0,0};
+		timeval_t tick_time = {0,0};
+		timeval_t curr_tv   = os_unix::clock_monotonic_now();
+
+		std::vector<merge_result_t> merges;
+		std::vector<uint32_t> const merge_points = { 1, std::max(conf.tick_count / 4, 1u), std::max(conf.tick_count / 2, 1u), conf.tick_count };
+
+		report_snapshot_ptr last_snapshot;
+
+		for (uint32_t tick = 1; tick <= conf.tick_count; tick++)
+		{
+			{
+				meow::stopwatch_t sw;
+
+				for (auto const& batch : packets.batches)
+					agg->add_batch(batch->columns, batch->packets);
+
+				add_time += sw.stamp();
+			}
+
+			{
+				meow::stopwatch_t sw;
+
+				curr_tv += d_second;
+				history->merge_tick(agg->tick_now(curr_tv));
+
+				tick_time += sw.stamp();
+			}
+
+			if (std::find(merge_points.begin(), merge_points.end(), tick) == merge_points.end())
+				continue;
+
+			if (!merges.empty() && merges.back().ticks == tick)
+				continue;
+
+			meow::stopwatch_t sw;
+
+			report_snapshot_ptr snapshot = history->get_snapshot();
+			snapshot->prepare(report_snapshot_t::merge_flags::with_histograms);
+
+			merges.push_back(merge_result_t { tick, snapshot->row_count(), as_ms(sw.stamp()) });
+			last_snapshot = std::move(snapshot);
+		}
+
+		// percentiles for every row, same calls as handler does for percentile fields
+		size_t    pct_rows = 0;
+		timeval_t pct_time = {0,0};
+		int64_t   pct_sum  = 0; // to keep calls from being optimized away
+
+		if (last_snapshot && conf.hv_bucket_count > 0 && !conf.percentiles.empty())
+		{
+			report_snapshot_t *snapshot = last_snapshot.get();
+			histogram_conf_t const *hv_conf = snapshot->histogram_conf();
+			int const hv_kind = snapshot->histogram_kind();
+
+			meow::stopwatch_t sw;
+
+			auto const end = snapshot->pos_last();
+			for (auto pos = snapshot->pos_first(); !snapshot->pos_equal(pos, end); pos = snapshot->pos_next(pos))
+			{
+				void const *histogram = snapshot->get_histogram(pos);
+				if (histogram == nullptr)
+					continue;
+
+				for (double const pct : conf.percentiles)
+				{
+					duration_t const d = (HISTOGRAM_KIND__HDR == hv_kind)
+						? get_percentile(*static_cast<hdr_histogram_t const*>(histogram), *hv_conf, pct)
+						: get_percentile(*static_cast<flat_histogram_t const*>(histogram), *hv_conf, pct);
+					pct_sum += d.nsec;
+				}
+
+				pct_rows++;
+			}
+
+			pct_time = sw.stamp();
+		}
+
+		uint64_t const total_packets = packets.n_packets * conf.tick_count;
+
+		ff::fmt(stdout,
+			"{{\"kind\":\"{0}\",\"packets_per_tick\":{1},\"timers_per_tick\":{2},\"batches_per_tick\":{3},\"ticks\":{4},"
+			"\"repack_ns_per_packet\":{5},\"add_ns_per_packet\":{6},\"add_ns_per_timer\":{7},\"tick_ms\":{8},\"ticks_per_sec\":{9},"
+			"\"merges\":[",
+			kind, packets.n_packets, packets.n_timers, packets.batches.size(), conf.tick_count,
+			packets.repack_ns_per_packet, per_item_ns(add_time, total_packets), per_item_ns(add_time, packets.n_timers * conf.tick_count),
+			as_ms(tick_time) / conf.tick_count, conf.tick_count / timeval_to_double(tick_time));
+
+		for (size_t i = 0; i < merges.size(); i++)
+		{
+			ff::fmt(stdout, "{0}{{\"ticks\":{1},\"rows\":{2},\"ms\":{3}}",
+				(i > 0) ? "," : "", merges[i].ticks, merges[i].rows, merges[i].ms);
+		}
+
+		ff::fmt(stdout, "],\"percentile_rows\":{0},\"percentiles_per_row\":{1},\"percentile_ns_per_row\":{2},\"checksum\":{3}}\n",
+			pct_rows, conf.percentiles.size(), per_item_ns(pct_time, pct_rows), pct_sum);
+		fflush(stdout);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char const *argv[])
+try
+{
+	using namespace aux;
+
+	bench_conf_t const conf = parse_args(argc, argv);
+
+	pinba_options_t options = {};
+	pinba_globals_t *globals = pinba_globals_init(&options);
+
+	packets_t const packets = make_packets(conf, globals);
+
+	for (auto const& kind : conf.kinds)
+		run_kind(conf, globals, packets, kind);
+
+	return 0;
+}
+catch (std::exception const& e)
+{
+	ff::fmt(stderr, "error: {0}\n", e.what());
+	return 1;
+}
@@ -0,0 +1,321 @@
+#include "pinba_config.h"
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+#include <meow/unix/time.hpp>
+
+#include "traffic.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// standalone synthetic traffic generator, see traffic.h for the traffic model
+// sends to a running pinba (or anything listening) over udp, or writes datagrams to a file for pinba_bench --replay
+//
+// every sender thread has its own set of connected sockets (different source ports = spread over SO_REUSEPORT readers)
+// and sends with sendmmsg(), round-robin over sockets, batch per syscall
+// prints a json line every second, and a summary line at exit
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct gen_conf_t
+	{
+		std::string     address            = "127.0.0.1";
+		std::string     port               = "30002";
+
+		uint32_t        threads            = 1;
+		uint32_t        sockets_per_thread = 4;
+		uint32_t        sendmmsg_batch     = 64;
+
+		double          rate               = 10000; // datagrams/sec, total for all threads, 0 = as fast as possible
+		double          duration_sec       = 0;     // 0 = until killed
+
+		std::string     output_file;                // write datagrams in pinba_bench --record format instead of sending
+
+		traffic_conf_t  traffic;
+	};
+
+	static void usage(char const *argv0)
+	{
+		ff::fmt(stderr,
+			"usage: {0} [options]\n"
+			"  --address=127.0.0.1 --port=30002    where to send\n"
+			"  --threads=1 --sockets=4 --sendmmsg=64   sender threads, sockets per thread, datagrams per sendmmsg()\n"
+			"  --rate=10000                        datagrams/sec, 0 = unlimited\n"
+			"  --duration=0                        seconds, 0 = until killed\n"
+			"  --output=<file>                     write --datagrams datagrams to file (for pinba_bench --replay) and exit\n"
+			"{1}"
+			, argv0, traffic_conf___usage());
+	}
+
+	static gen_conf_t parse_args(int argc, char const *argv[])
+	{
+		gen_conf_t conf;
+
+		for (int i = 1; i < argc; i++)
+		{
+			std::string const arg = argv[i];
+
+			if (arg == "--help" || arg == "-h")
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+
+			size_t const eq = arg.find('=');
+			if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+				throw std::runtime_error(ff::fmt_str("bad argument '{0}', expected --name=value", arg));
+
+			std::string const name  = arg.substr(2, eq - 2);
+			std::string const value = arg.substr(eq + 1);
+
+			if (traffic_conf___parse_option(&conf.traffic, name, value))
+				continue;
+
+			auto const as_u32 = [&]() { return uint32_t(std::strtoul(value.c_str(), nullptr, 10)); };
+			auto const as_dbl = [&]() { return std::strtod(value.c_str(), nullptr); };
+
+			if      (name == "address")   conf.address = value;
+			else if (name == "port")      conf.port = value;
+			else if (name == "threads")   conf.threads = as_u32();
+			else if (name == "sockets")   conf.sockets_per_thread = as_u32();
+			else if (name == "sendmmsg")  conf.sendmmsg_batch = as_u32();
+			else if (name == "rate")      conf.rate = as_dbl();
+			else if (name == "duration")  conf.duration_sec = as_dbl();
+			else if (name == "output")    conf.output_file = value;
+			else
+				throw std::runtime_error(ff::fmt_str("unknown option '--{0}', see --help", name));
+		}
+
+		if (conf.threads == 0 || conf.sockets_per_thread == 0 || conf.sendmmsg_batch == 0)
+			throw std::runtime_error("threads, sockets and sendmmsg must be > 0");
+
+		traffic_conf___validate(conf.traffic);
+		return conf;
+	}
+
+	static int connected_udp_socket(gen_conf_t const& conf)
+	{
+		struct addrinfo hints = {};
+		hints.ai_family   = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+
+		struct addrinfo *ai = nullptr;
+		int const err = getaddrinfo(conf.address.c_str(), conf.port.c_str(), &hints, &ai);
+		if (err != 0)
+			throw std::runtime_error(ff::fmt_str("getaddrinfo({0}, {1}): {2}", conf.address, conf.port, gai_strerror(err)));
+
+		int const fd = socket(ai->ai_family, SOCK_DGRAM, 0);
+		if (fd < 0)
+		{
+			freeaddrinfo(ai);
+			throw std::runtime_error(ff::fmt_str("socket(): {0}", strerror(errno)));
+		}
+
+		int const rv = connect(fd, ai->ai_addr, ai->ai_addrlen);
+		freeaddrinfo(ai);
+
+		if (rv < 0)
+		{
+			close(fd);
+			throw std::runtime_error(ff::fmt_str("connect({0}:{1}): {2}", conf.address, conf.port, strerror(errno)));
+		}
+
+		return fd;
+	}
+
+	static void write_datagrams(std::string const& path, std::vector<std::string> const& datagrams)
+	{
+		FILE *f = fopen(path.c_str(), "wb");
+		if (!f)
+			throw std::runtime_error(ff::fmt_str("can't open {0}: {1}", path, strerror(errno)));
+
+		uint64_t bytes = 0;
+		for (auto const& d : datagrams)
+		{
+			uint32_t const n = d.size();
+			uint8_t const len_buf[4] = { uint8_t(n), uint8_t(n >> 8), uint8_t(n >> 16), uint8_t(n >> 24) };
+			fwrite(len_buf, sizeof(len_buf), 1, f);
+			fwrite(d.data(), d.size(), 1, f);
+			bytes += d.size();
+		}
+
+		if (fclose(f) != 0)
+			throw std::runtime_error(ff::fmt_str("write to {0} failed: {1}", path, strerror(errno)));
+
+		ff::fmt(stdout, "{{\"written\":{0},\"bytes\":{1},\"file\":\"{2}\"}\n", datagrams.size(), bytes, path);
+	}
+
+	struct sender_t
+	{
+		std::thread            t;
+		std::atomic<uint64_t>  sent     = {0};
+		std::atomic<uint64_t>  bytes    = {0};
+		std::atomic<uint64_t>  send_err = {0};
+	};
+
+	static void sender_thread(gen_conf_t const& conf, std::vector<std::string> const& datagrams, uint32_t thread_id, std::atomic<bool> const& stop, sender_t *sender)
+	{
+		std::vector<int> fds;
+		for (uint32_t i = 0; i < conf.sockets_per_thread; i++)
+			fds.push_back(connected_udp_socket(conf));
+
+		std::vector<struct mmsghdr> msgs(conf.sendmmsg_batch);
+		std::vector<struct iovec>   iovs(conf.sendmmsg_batch);
+
+		double const rate   = conf.rate / conf.threads;
+		size_t       offset = (datagrams.size() / conf.threads) * thread_id;
+		size_t       fd_idx = 0;
+		uint64_t     sent   = 0, bytes = 0, errors = 0;
+
+		timeval_t const start_tv = os_unix::clock_monotonic_now();
+
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			uint64_t allowed = conf.sendmmsg_batch;
+
+			if (rate > 0)
+			{
+				uint64_t const target = uint64_t(timeval_to_double(os_unix::clock_monotonic_now() - start_tv) * rate);
+				if (target <= sent)
+				{
+					std::this_thread::sleep_for(std::chrono::microseconds(100));
+					continue;
+				}
+
+				allowed = std::min<uint64_t>(target - sent, conf.sendmmsg_batch);
+			}
+
+			uint64_t batch_bytes = 0;
+			for (uint32_t i = 0; i < allowed; i++)
+			{
+				std::string const& d = datagrams[offset];
+				offset = (offset + 1) % datagrams.size();
+
+				iovs[i] = { (void*)d.data(), d.size() };
+				msgs[i] = {};
+				msgs[i].msg_hdr.msg_iov    = &iovs[i];
+				msgs[i].msg_hdr.msg_iovlen = 1;
+				batch_bytes += d.size();
+			}
+
+			int const n = sendmmsg(fds[fd_idx], msgs.data(), allowed, 0);
+			fd_idx = (fd_idx + 1) % fds.size();
+
+			errors += (n < 0) ? allowed : (allowed - n);
+			sent   += allowed;
+			bytes  += batch_bytes;
+
+			sender->sent.store(sent, std::memory_order_relaxed);
+			sender->bytes.store(bytes, std::memory_order_relaxed);
+			sender->send_err.store(errors, std::memory_order_relaxed);
+		}
+
+		for (int fd : fds)
+			close(fd);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char const *argv[])
+try
+{
+	using namespace aux;
+
+	gen_conf_t const conf = parse_args(argc, argv);
+
+	std::vector<std::string> const datagrams = traffic_generator_t(conf.traffic).make_datagrams();
+
+	if (!conf.output_file.empty())
+	{
+		write_datagrams(conf.output_file, datagrams);
+		return 0;
+	}
+
+	std::atomic<bool> stop = { false };
+	std::vector<std::unique_ptr<sender_t>> senders;
+
+	for (uint32_t i = 0; i < conf.threads; i++)
+	{
+		senders.emplace_back(new sender_t);
+		sender_t *sender = senders.back().get();
+
+		sender->t = std::thread([&, i, sender]()
+		{
+			sender_thread(conf, datagrams, i, stop, sender);
+		});
+	}
+
+	struct totals_t { uint64_t sent, bytes, send_err; };
+
+	auto const get_totals = [&]()
+	{
+		totals_t r = {};
+		for (auto const& s : senders)
+		{
+			r.sent     += s->sent.load();
+			r.bytes    += s->bytes.load();
+			r.send_err += s->send_err.load();
+		}
+		return r;
+	};
+
+	timeval_t const start_tv = os_unix::clock_monotonic_now();
+	timeval_t prev_tv = start_tv;
+	totals_t  prev = {};
+
+	while (conf.duration_sec <= 0 || timeval_to_double(os_unix::clock_monotonic_now() - start_tv) < conf.duration_sec)
+	{
+		sleep(1);
+
+		timeval_t const now = os_unix::clock_monotonic_now();
+		totals_t const  cur = get_totals();
+		double const    elapsed = timeval_to_double(now - prev_tv);
+
+		ff::fmt(stdout, "{{\"elapsed_sec\":{0},\"sent_pps\":{1},\"sent_mbps\":{2},\"send_err\":{3}}\n",
+			timeval_to_double(now - start_tv),
+			(cur.sent - prev.sent) / elapsed,
+			(cur.bytes - prev.bytes) * 8 / elapsed / 1e6,
+			cur.send_err - prev.send_err);
+		fflush(stdout);
+
+		prev_tv = now;
+		prev    = cur;
+	}
+
+	stop.store(true);
+	for (auto& s : senders)
+		s->t.join();
+
+	totals_t const total = get_totals();
+	double const   elapsed = timeval_to_double(os_unix::clock_monotonic_now() - start_tv);
+
+	ff::fmt(stdout, "{{\"summary\":{{\"datagrams\":{0},\"requests_per_datagram\":{1},\"lz4\":{2},\"sent\":{3},\"send_err\":{4},\"bytes\":{5},\"sent_pps\":{6}}}\n",
+		datagrams.size(), conf.traffic.requests_per_datagram, (conf.traffic.lz4) ? "true" : "false",
+		total.sent, total.send_err, total.bytes, total.sent / elapsed);
+
+	return 0;
+}
+catch (std::exception const& e)
+{
+	ff::fmt(stderr, "error: {0}\n", e.what());
+	return 1;
+}
@@ -0,0 +1,753 @@
+#include "pinba_config.h"
+
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <meow/intrusive_ptr.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+#include <meow/unix/resource.hpp> // getrusage_ex
+#include <meow/unix/time.hpp>
+
+#include <nanomsg/nn.h>
+#include <nanomsg/pipeline.h>
+
+#include "pinba/globals.h"
+#include "pinba/nmsg_channel.h"
+#include "pinba/nmsg_poller.h"
+#include "pinba/nmsg_ring.h"
+#include "pinba/nmsg_socket.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// in-process transport benchmark, intrusive_ptr messages (same as packet_batch_ptr) from one producer to N consumers
+// every consumer thread runs nmsg_poller_t, the way repackers, coordinator and report hosts do
+//
+// topologies
+//   push      - every message goes to one of the consumers (repacker -> coordinator, relay -> report shards)
+//   broadcast - every message goes to every consumer (coordinator -> report hosts)
+//
+// transports
+//   nanomsg        - inproc PUSH/PULL, push: one PUSH load balancing between PULL sockets, broadcast: one pair per consumer
+//   channel        - nmsg_channel_t with raw pointers, push: one channel read by all consumers, broadcast: one per consumer
+//   mpmc_ring      - nmsg_ring_t, push: one ring, broadcast: one per consumer
+//   spsc_ring      - spsc_ring_t below, one per consumer, push: round robin (skipping full ones, same as PUSH does)
+//   broadcast_ring - nmsg_broadcast_ring_t, broadcast only, message is published once
+//
+// producer never blocks, delivery that doesn't fit is dropped and counted, same as coordinator does with NN_DONTWAIT
+// messages are sent at --rate per second (in bursts, when the producer oversleeps), 0 = as fast as possible
+// prints a json line per (topology, transport, consumers) with delivered msgs/sec, latency percentiles
+// (producer send -> consumer callback, every --sample-every-th delivery) and cpu time of the whole process per delivery
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct bench_conf_t
+	{
+		std::vector<std::string>  topologies   = { "push", "broadcast" };
+		std::vector<std::string>  transports   = { "nanomsg", "channel", "mpmc_ring", "spsc_ring", "broadcast_ring" };
+		std::vector<uint32_t>     consumers    = { 1, 4, 16, 64, 200 };
+
+		double                    rate         = 20000;  // messages per second, 0 = unlimited
+		double                    duration_sec = 3;      // per run
+		uint32_t                  buffer       = 1024;   // messages per consumer (or per shared queue)
+		uint32_t                  sample_every = 1;
+		uint32_t                  drain_ms     = 200;    // after producer stops, before consumers are
+	};
+
+	static std::vector<std::string> split_list(std::string const& value)
+	{
+		std::vector<std::string> result;
+
+		size_t pos = 0;
+		while (pos <= value.size())
+		{
+			size_t const comma = std::min(value.find(',', pos), value.size());
+			if (comma > pos)
+				result.push_back(value.substr(pos, comma - pos));
+			pos = comma + 1;
+		}
+		return result;
+	}
+
+	static void usage(char const *argv0)
+	{
+		ff::fmt(stderr,
+			"usage: {0} [options]\n"
+			"  --topologies=push,broadcast\n"
+			"  --transports=nanomsg,channel,mpmc_ring,spsc_ring,broadcast_ring\n"
+			"  --consumers=1,4,16,64,200\n"
+			"  --rate=20000 --duration=3             messages per second (0 = unlimited), seconds per run\n"
+			"  --buffer=1024                         queue size, in messages\n"
+			"  --sample-every=1 --drain-ms=200       time every N-th delivery, wait for consumers after producer stops\n"
+			, argv0);
+	}
+
+	static bench_conf_t parse_args(int argc, char const *argv[])
+	{
+		bench_conf_t conf;
+
+		for (int i = 1; i < argc; i++)
+		{
+			std::string const arg = argv[i];
+
+			if (arg == "--help" || arg == "-h")
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+
+			size_t const eq = arg.find('=');
+			if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+				throw std::runtime_error(ff::fmt_str("bad argument '{0}', expected --name=value", arg));
+
+			std::string const name  = arg.substr(2, eq - 2);
+			std::string const value = arg.substr(eq + 1);
+
+			auto const as_u32 = [&]() { return uint32_t(std::strtoul(value.c_str(), nullptr, 10)); };
+			auto const as_dbl = [&]() { return std::strtod(value.c_str(), nullptr); };
+
+			if      (name == "topologies")   conf.topologies = split_list(value);
+			else if (name == "transports")   conf.transports = split_list(value);
+			else if (name == "consumers")
+			{
+				conf.consumers.clear();
+				for (auto const& s : split_list(value))
+					conf.consumers.push_back(uint32_t(std::strtoul(s.c_str(), nullptr, 10)));
+			}
+			else if (name == "rate")         conf.rate = as_dbl();
+			else if (name == "duration")     conf.duration_sec = as_dbl();
+			else if (name == "buffer")       conf.buffer = as_u32();
+			else if (name == "sample-every") conf.sample_every = as_u32();
+			else if (name == "drain-ms")     conf.drain_ms = as_u32();
+			else
+				throw std::runtime_error(ff::fmt_str("unknown option '--{0}', see --help", name));
+		}
+
+		for (auto const& t : conf.topologies)
+		{
+			if (t != "push" && t != "broadcast")
+				throw std::runtime_error(ff::fmt_str("unknown topology '{0}'", t));
+		}
+
+		for (auto const n : conf.consumers)
+		{
+			if (n == 0 || n > 1000)
+				throw std::runtime_error("consumers must be in [1, 1000]");
+		}
+
+		if (conf.buffer == 0 || conf.sample_every == 0)
+			throw std::runtime_error("buffer and sample-every must be > 0");
+
+		return conf;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	inline int64_t mono_ns()
+	{
+		return duration_from_timeval(os_unix::clock_monotonic_now()).nsec;
+	}
+
+	struct bench_msg_t : public nmsg_message_ex_t<bench_msg_t>
+	{
+		int64_t   sent_ns;
+		uint64_t  seq;
+	};
+	using bench_msg_ptr = boost::intrusive_ptr<bench_msg_t>;
+
+	struct consumer_result_t
+	{
+		uint64_t              received = 0;
+		uint64_t              seq_sum  = 0; // keeps message reads from being optimized away
+		std::vector<uint64_t> latency_ns;
+	};
+
+	inline void consume(uint32_t sample_every, consumer_result_t *r, bench_msg_t const *msg)
+	{
+		if ((r->received++ % sample_every) == 0)
+			r->latency_ns.push_back(uint64_t(mono_ns() - msg->sent_ns));
+
+		r->seq_sum += msg->seq;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// proposed single producer + single consumer ring, same interface as nmsg_ring_t (and parks the same way)
+// no cas, producer and consumer only read each other's index when their cached copy says full/empty
+
+	template<class T>
+	struct spsc_ring_t : private boost::noncopyable
+	{
+		using value_ptr = boost::intrusive_ptr<T>;
+
+		// capacity is rounded up to power of 2
+		explicit spsc_ring_t(size_t capacity)
+		{
+			size_t sz = 1;
+			while (sz < capacity)
+				sz <<= 1;
+
+			slots_.reset(new T*[sz]);
+			mask_ = sz - 1;
+
+			efd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			if (efd_ < 0)
+				throw std::runtime_error(ff::fmt_str("spsc_ring_t: eventfd() failed: {0}:{1}", errno, strerror(errno)));
+		}
+
+		~spsc_ring_t()
+		{
+			while (T *obj = this->pop())
+				intrusive_ptr_release(obj);
+
+			close(efd_);
+		}
+
+		// producer, never waits, false = full
+		bool send_message(value_ptr const& value)
+		{
+			uint64_t const h = head_.load(std::memory_order_relaxed);
+
+			if (h - cached_tail_ > mask_)
+			{
+				cached_tail_ = tail_.load(std::memory_order_acquire);
+				if (h - cached_tail_ > mask_)
+					return false;
+			}
+
+			T *obj = value.get();
+			intrusive_ptr_add_ref(obj);
+
+			slots_[h & mask_] = obj;
+			head_.store(h + 1, std::memory_order_release);
+
+			std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the one in park()
+			if (parked_.load(std::memory_order_relaxed) != 0)
+			{
+				uint64_t const one = 1;
+				while ((write(efd_, &one, sizeof(one)) < 0) && (errno == EINTR))
+					;
+			}
+
+			return true;
+		}
+
+		// consumer
+		value_ptr recv_dontwait()
+		{
+			return value_ptr { this->pop(), /*add_ref=*/false };
+		}
+
+		bool empty() const
+		{
+			return tail_.load(std::memory_order_relaxed) >= head_.load(std::memory_order_acquire);
+		}
+
+		int wakeup_fd() const { return efd_; }
+
+		bool park()
+		{
+			parked_.store(1, std::memory_order_seq_cst);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			if (this->empty())
+				return true;
+
+			parked_.store(0, std::memory_order_relaxed);
+			return false;
+		}
+
+		void unpark()
+		{
+			parked_.store(0, std::memory_order_relaxed);
+
+			uint64_t value;
+			while ((read(efd_, &value, sizeof(value)) < 0) && (errno == EINTR))
+				;
+		}
+
+	private:
+
+		T* pop()
+		{
+			uint64_t const t = tail_.load(std::memory_order_relaxed);
+
+			if (t >= cached_head_)
+			{
+				cached_head_ = head_.load(std::memory_order_acquire);
+				if (t >= cached_head_)
+					return nullptr;
+			}
+
+			T *obj = slots_[t & mask_];
+			tail_.store(t + 1, std::memory_order_release);
+			return obj;
+		}
+
+	private:
+		std::unique_ptr<T*[]>              slots_;
+		uint64_t                           mask_;
+		int                                efd_;
+
+		alignas(64) std::atomic<uint64_t>  head_ = {0};  // written by producer
+		uint64_t                           cached_tail_ = 0;
+
+		alignas(64) std::atomic<uint64_t>  tail_ = {0};  // written by consumer
+		uint64_t                           cached_head_ = 0;
+
+		alignas(64) std::atomic<uint32_t>  parked_ = {0};
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct transport_t : private boost::noncopyable
+	{
+		virtual ~transport_t() {}
+
+		// producer thread, returns the number of deliveries that have been dropped
+		virtual uint32_t send(bench_msg_ptr const&) = 0;
+
+		// consumer thread, before poller loop starts
+		virtual void attach(uint32_t consumer_id, nmsg_poller_t&, consumer_result_t*) = 0;
+	};
+	using transport_ptr = std::unique_ptr<transport_t>;
+
+	struct nanomsg_transport_t : public transport_t
+	{
+		nanomsg_transport_t(bench_conf_t const& conf, std::string const& name, bool broadcast, uint32_t n_consumers)
+			: conf_(conf)
+		{
+			uint32_t const n_send = (broadcast) ? n_consumers : 1;
+
+			send_socks_.reserve(n_send);
+			for (uint32_t i = 0; i < n_send; i++)
+			{
+				nmsg_socket_t sock = nmsg_socket(AF_SP, NN_PUSH);
+				sock.bind(ff::fmt_str("inproc://{0}/{1}", name, i));
+				send_socks_.push_back(std::move(sock));
+			}
+
+			recv_socks_.reserve(n_consumers);
+			for (uint32_t i = 0; i < n_consumers; i++)
+			{
+				nmsg_socket_t sock = nmsg_socket(AF_SP, NN_PULL);
+				sock.set_option(NN_SOL_SOCKET, NN_RCVBUF, sizeof(bench_msg_ptr) * conf_.buffer, name);
+				sock.connect(ff::fmt_str("inproc://{0}/{1}", name, (broadcast) ? i : 0));
+				recv_socks_.push_back(std::move(sock));
+			}
+		}
+
+		virtual uint32_t send(bench_msg_ptr const& msg) override
+		{
+			uint32_t n_dropped = 0;
+			for (auto& sock : send_socks_)
+			{
+				if (!sock.send_message(msg, NN_DONTWAIT))
+					n_dropped++;
+			}
+			return n_dropped;
+		}
+
+		virtual void attach(uint32_t consumer_id, nmsg_poller_t& poller, consumer_result_t *r) override
+		{
+			nmsg_socket_t *sock = &recv_socks_[consumer_id];
+			uint32_t const sample_every = conf_.sample_every;
+
+			// one message per wakeup, same as report hosts read nanomsg
+			poller.read_nn_socket(*sock, [sock, sample_every, r](timeval_t)
+			{
+				bench_msg_ptr const msg = sock->recv<bench_msg_ptr>();
+				consume(sample_every, r, msg.get());
+			});
+		}
+
+	private:
+		bench_conf_t const&         conf_;
+		std::vector<nmsg_socket_t>  send_socks_;
+		std::vector<nmsg_socket_t>  recv_socks_;
+	};
+
+	struct channel_transport_t : public transport_t
+	{
+		using channel_t = nmsg_channel_t<bench_msg_t*>;
+
+		channel_transport_t(bench_conf_t const& conf, std::string const& name, bool broadcast, uint32_t n_consumers)
+			: conf_(conf)
+			, broadcast_(broadcast)
+		{
+			uint32_t const n_channels = (broadcast) ? n_consumers : 1;
+
+			for (uint32_t i = 0; i < n_channels; i++)
+				channels_.push_back(nmsg_channel_create<bench_msg_t*>(conf_.buffer, ff::fmt_str("{0}/{1}", name, i)));
+		}
+
+		virtual uint32_t send(bench_msg_ptr const& msg) override
+		{
+			uint32_t n_dropped = 0;
+			for (auto& chan : channels_)
+			{
+				intrusive_ptr_add_ref(msg.get());
+				if (!chan->send_dontwait(msg.get()))
+				{
+					intrusive_ptr_release(msg.get());
+					n_dropped++;
+				}
+			}
+			return n_dropped;
+		}
+
+		virtual void attach(uint32_t consumer_id, nmsg_poller_t& poller, consumer_result_t *r) override
+		{
+			channel_t& chan = *channels_[(broadcast_) ? consumer_id : 0];
+			uint32_t const sample_every = conf_.sample_every;
+
+			poller.read_nn_channel(chan, [sample_every, r](channel_t& chan, timeval_t)
+			{
+				bench_msg_t *obj = chan.recv_dontwait();
+				if (!obj) // shared channel, some other consumer got it first
+					return;
+
+				bench_msg_ptr const msg { obj, /*add_ref=*/false };
+				consume(sample_every, r, msg.get());
+			});
+		}
+
+	private:
+		bench_conf_t const&                       conf_;
+		bool                                      broadcast_;
+		std::vector<nmsg_channel_ptr<bench_msg_t*>> channels_;
+	};
+
+	struct mpmc_ring_transport_t : public transport_t
+	{
+		mpmc_ring_transport_t(bench_conf_t const& conf, std::string const& name, bool broadcast, uint32_t n_consumers)
+			: conf_(conf)
+			, broadcast_(broadcast)
+		{
+			uint32_t const n_rings = (broadcast) ? n_consumers : 1;
+
+			for (uint32_t i = 0; i < n_rings; i++)
+				rings_.push_back(nmsg_ring_create<bench_msg_t>(conf_.buffer, ff::fmt_str("{0}/{1}", name, i)));
+		}
+
+		virtual uint32_t send(bench_msg_ptr const& msg) override
+		{
+			uint32_t n_dropped = 0;
+			for (auto& ring : rings_)
+			{
+				if (!ring->send_message(msg, NN_DONTWAIT))
+					n_dropped++;
+			}
+			return n_dropped;
+		}
+
+		virtual void attach(uint32_t consumer_id, nmsg_poller_t& poller, consumer_result_t *r) override
+		{
+			nmsg_ring_t<bench_msg_t> *ring = rings_[(broadcast_) ? consumer_id : 0].get();
+			uint32_t const sample_every = conf_.sample_every;
+
+			poller.read_nmsg_ring(*ring, [ring, sample_every, r](timeval_t)
+			{
+				while (bench_msg_ptr const msg = ring->recv_dontwait())
+					consume(sample_every, r, msg.get());
+			});
+		}
+
+	private:
+		bench_conf_t const&                       conf_;
+		bool                                      broadcast_;
+		std::vector<nmsg_ring_ptr<bench_msg_t>>   rings_;
+	};
+
+	struct spsc_ring_transport_t : public transport_t
+	{
+		spsc_ring_transport_t(bench_conf_t const& conf, bool broadcast, uint32_t n_consumers)
+			: conf_(conf)
+			, broadcast_(broadcast)
+		{
+			for (uint32_t i = 0; i < n_consumers; i++)
+				rings_.push_back(meow::make_unique<spsc_ring_t<bench_msg_t>>(conf_.buffer));
+		}
+
+		virtual uint32_t send(bench_msg_ptr const& msg) override
+		{
+			if (broadcast_)
+			{
+				uint32_t n_dropped = 0;
+				for (auto& ring : rings_)
+				{
+					if (!ring->send_message(msg))
+						n_dropped++;
+				}
+				return n_dropped;
+			}
+
+			for (size_t i = 0; i < rings_.size(); i++)
+			{
+				auto& ring = rings_[next_];
+				next_ = (next_ + 1) % rings_.size();
+
+				if (ring->send_message(msg))
+					return 0;
+			}
+			return 1;
+		}
+
+		virtual void attach(uint32_t consumer_id, nmsg_poller_t& poller, consumer_result_t *r) override
+		{
+			spsc_ring_t<bench_msg_t> *ring = rings_[consumer_id].get();
+			uint32_t const sample_every = conf_.sample_every;
+
+			poller.read_parking_ring(*ring, [ring, sample_every, r](timeval_t)
+			{
+				while (bench_msg_ptr const msg = ring->recv_dontwait())
+					consume(sample_every, r, msg.get());
+			});
+		}
+
+	private:
+		bench_conf_t const&                                     conf_;
+		bool                                                    broadcast_;
+		std::vector<std::unique_ptr<spsc_ring_t<bench_msg_t>>>  rings_;
+		size_t                                                  next_ = 0; // push round robin
+	};
+
+	struct broadcast_ring_transport_t : public transport_t
+	{
+		using reader_t = nmsg_broadcast_reader_t<bench_msg_t>;
+
+		// subscribe()/unsubscribe() must be called from producer thread, that's the one that creates and destroys us
+		broadcast_ring_transport_t(bench_conf_t const& conf, uint32_t n_consumers)
+			: conf_(conf)
+			, ring_(conf.buffer)
+		{
+			for (uint32_t i = 0; i < n_consumers; i++)
+			{
+				readers_.push_back(meow::make_unique<reader_t>());
+				ring_.subscribe(readers_.back().get());
+			}
+		}
+
+		~broadcast_ring_transport_t()
+		{
+			for (auto& r : readers_)
+				ring_.unsubscribe(r.get());
+		}
+
+		virtual uint32_t send(bench_msg_ptr const& msg) override
+		{
+			return ring_.publish(msg, 1);
+		}
+
+		virtual void attach(uint32_t consumer_id, nmsg_poller_t& poller, consumer_result_t *r) override
+		{
+			reader_t *reader = readers_[consumer_id].get();
+			uint32_t const sample_every = conf_.sample_every;
+
+			poller.read_nmsg_broadcast(*reader, [reader, sample_every, r](timeval_t)
+			{
+				while (bench_msg_ptr const msg = reader->recv_dontwait())
+					consume(sample_every, r, msg.get());
+			});
+		}
+
+	private:
+		bench_conf_t const&                     conf_;
+		nmsg_broadcast_ring_t<bench_msg_t>      ring_;
+		std::vector<std::unique_ptr<reader_t>>  readers_;
+	};
+
+	// nullptr = this transport doesn't do this topology
+	static transport_ptr create_transport(bench_conf_t const& conf, std::string const& transport, bool broadcast, uint32_t n_consumers, uint32_t run_id)
+	{
+		std::string const name = ff::fmt_str("transport-bench/{0}", run_id);
+
+		if (transport == "nanomsg")
+			return meow::make_unique<nanomsg_transport_t>(conf, name, broadcast, n_consumers);
+
+		if (transport == "channel")
+			return meow::make_unique<channel_transport_t>(conf, name, broadcast, n_consumers);
+
+		if (transport == "mpmc_ring")
+			return meow::make_unique<mpmc_ring_transport_t>(conf, name, broadcast, n_consumers);
+
+		if (transport == "spsc_ring")
+			return meow::make_unique<spsc_ring_transport_t>(conf, broadcast, n_consumers);
+
+		if (transport == "broadcast_ring")
+			return (broadcast) ? meow::make_unique<broadcast_ring_transport_t>(conf, n_consumers) : nullptr;
+
+		throw std::runtime_error(ff::fmt_str("unknown transport '{0}'", transport));
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	static void run_one(bench_conf_t const& conf, std::string const& topology, std::string const& transport_name, uint32_t n_consumers, uint32_t run_id)
+	{
+		bool const broadcast = (topology == "broadcast");
+
+		transport_ptr transport = create_transport(conf, transport_name, broadcast, n_consumers, run_id);
+		if (!transport)
+			return;
+
+		std::vector<consumer_result_t> results(n_consumers);
+		std::vector<std::thread>       threads;
+		std::atomic<bool>              stop  = { false };
+		std::atomic<uint32_t>          ready = { 0 };
+
+		for (uint32_t i = 0; i < n_consumers; i++)
+		{
+			threads.emplace_back([&, i]()
+			{
+				nmsg_poller_t poller;
+				transport->attach(i, poller, &results[i]);
+
+				poller.ticker(10 * d_millisecond, [&poller, &stop](timeval_t)
+				{
+					if (stop.load(std::memory_order_relaxed))
+						poller.set_shutdown_flag();
+				});
+
+				ready.fetch_add(1);
+				poller.loop();
+			});
+		}
+
+		while (ready.load() < n_consumers)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+		os_rusage_t const ru_before  = os_unix::getrusage_ex(RUSAGE_SELF);
+		timeval_t const   cpu_before = os_unix::clock_gettime_ex(CLOCK_THREAD_CPUTIME_ID);
+
+		int64_t const start_ns = mono_ns();
+		int64_t const end_ns   = start_ns + int64_t(conf.duration_sec * nsec_in_sec);
+
+		uint64_t sent      = 0;
+		uint64_t n_dropped = 0;
+
+		while (true)
+		{
+			int64_t const now_ns = mono_ns();
+			if (now_ns >= end_ns)
+				break;
+
+			// unlimited rate still looks at the clock every 64 messages
+			uint64_t const due = (conf.rate > 0)
+					? uint64_t(double(now_ns - start_ns) * conf.rate / nsec_in_sec) + 1
+					: sent + 64;
+
+			if (sent >= due)
+			{
+				int64_t const next_ns = start_ns + int64_t(double(sent) * nsec_in_sec / conf.rate);
+				std::this_thread::sleep_for(std::chrono::nanoseconds(std::max<int64_t>(0, next_ns - now_ns)));
+				continue;
+			}
+
+			for (; sent < due; sent++)
+			{
+				auto msg = meow::make_intrusive<bench_msg_t>();
+				msg->seq     = sent;
+				msg->sent_ns = mono_ns();
+
+				n_dropped += transport->send(msg);
+			}
+		}
+
+		double const send_sec     = double(mono_ns() - start_ns) / nsec_in_sec;
+		double const producer_cpu = timeval_to_double(os_unix::clock_gettime_ex(CLOCK_THREAD_CPUTIME_ID)) - timeval_to_double(cpu_before);
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(conf.drain_ms));
+		stop.store(true);
+
+		for (auto& t : threads)
+			t.join();
+
+		os_rusage_t const ru_after = os_unix::getrusage_ex(RUSAGE_SELF);
+
+		auto const ru_cpu = [](os_rusage_t const& ru)
+		{
+			return timeval_to_double(timeval_from_os_timeval(ru.ru_utime)) + timeval_to_double(timeval_from_os_timeval(ru.ru_stime));
+		};
+		double const process_cpu = ru_cpu(ru_after) - ru_cpu(ru_before);
+
+		uint64_t delivered = 0;
+		uint64_t seq_sum   = 0;
+		std::vector<uint64_t> v;
+
+		for (auto const& r : results)
+		{
+			delivered += r.received;
+			seq_sum   += r.seq_sum;
+			v.insert(v.end(), r.latency_ns.begin(), r.latency_ns.end());
+		}
+
+		std::sort(v.begin(), v.end());
+
+		auto const at = [&v](double pct) -> uint64_t
+		{
+			return (v.empty()) ? 0 : v[std::min(v.size() - 1, size_t(pct / 100.0 * v.size()))];
+		};
+
+		auto const per_msg_ns = [](double cpu_sec, uint64_t n) -> uint64_t
+		{
+			return (n == 0) ? 0 : uint64_t(cpu_sec * nsec_in_sec / n);
+		};
+
+		ff::fmt(stdout,
+			"{{\"topology\":\"{0}\",\"transport\":\"{1}\",\"consumers\":{2},\"rate\":{3},\"sent\":{4},\"dropped\":{5},"
+			"\"delivered\":{6},\"msgs_per_sec\":{7},\"latency_ns\":{{\"p50\":{8},\"p99\":{9},\"p999\":{10},\"max\":{11}}},"
+			"\"cpu_ns_per_msg\":{12},\"producer_cpu_ns_per_msg\":{13},\"seq_sum\":{14}}}\n",
+			topology, transport_name, n_consumers, conf.rate, sent, n_dropped,
+			delivered, delivered / send_sec, at(50), at(99), at(99.9), (v.empty()) ? 0 : v.back(),
+			per_msg_ns(process_cpu, delivered), per_msg_ns(producer_cpu, sent), seq_sum);
+		fflush(stdout);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char const *argv[])
+try
+{
+	using namespace aux;
+
+	bench_conf_t const conf = parse_args(argc, argv);
+
+	uint32_t run_id = 0;
+
+	for (auto const& topology : conf.topologies)
+	{
+		for (auto const& transport : conf.transports)
+		{
+			for (auto const n_consumers : conf.consumers)
+				run_one(conf, topology, transport, n_consumers, run_id++);
+		}
+	}
+
+	ff::fmt(stdout,
+		"{{\"summary\":{{\"version\":\"{0}\",\"git\":\"{1}\",\"runs\":{2},\"rate\":{3},\"duration_sec\":{4},\"buffer\":{5}}}\n",
+		PINBA_VERSION, PINBA_VCS_FULL_HASH, run_id, conf.rate, conf.duration_sec, conf.buffer);
+
+	return 0;
+}
+catch (std::exception const& e)
+{
+	ff::fmt(stderr, "error: {0}\n", e.what());
+	return 1;
+}
@@ -0,0 +1,319 @@
+#ifndef PINBA__BENCH_TRAFFIC_H_
+#define PINBA__BENCH_TRAFFIC_H_
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <meow/format/format_to_string.hpp>
+
+#include "proto/pinba.pb-c.h"
+
+#include "pinba/collector.h" // PINBA_NET_DATAGRAM_*
+
+#ifdef PINBA_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// synthetic pinba traffic, shared by pinba_bench and pinba_traffic_gen
+//
+// every request picks hostname, server_name, script_name and timer tag values from fixed size sets,
+// with zipf distributed popularity (zipf_s = 0 is uniform, ~1 is 'realistic', higher = more skewed)
+// timers per request are zipf distributed as well, over [1, max_timers]
+//
+// datagrams are either v0 (single raw request), or v2 (multiple requests, maybe lz4 compressed), see collector.h
+
+struct traffic_conf_t
+{
+	uint32_t  n_hosts              = 64;
+	uint32_t  n_servers            = 50;
+	uint32_t  n_scripts            = 1000;
+	uint32_t  n_timer_tags         = 2;       // distinct tag names, tag0, tag1, ...
+	uint32_t  n_tag_values         = 256;     // distinct values per tag name
+	uint32_t  tags_per_timer       = 2;       // <= n_timer_tags
+	uint32_t  max_timers           = 10;      // per request
+	double    zipf_s               = 1.0;     // popularity skew for names and tag values
+	double    timers_zipf_s        = 0.5;     // skew for timers per request (1 timer is the most popular)
+
+	uint32_t  n_datagrams          = 4096;    // distinct datagrams to cycle through
+	uint32_t  requests_per_datagram = 1;      // > 1 = v2 datagrams
+	bool      lz4                  = false;   // v2 with compressed payload
+
+	uint32_t  seed                 = 42;      // same traffic every run, to compare releases
+};
+
+// parse traffic_conf_t option, returns false if name is not a traffic option
+inline bool traffic_conf___parse_option(traffic_conf_t *conf, std::string const& name, std::string const& value)
+{
+	auto const as_u32 = [&]() { return uint32_t(std::strtoul(value.c_str(), nullptr, 10)); };
+	auto const as_dbl = [&]() { return std::strtod(value.c_str(), nullptr); };
+
+	if      (name == "hosts")          conf->n_hosts = as_u32();
+	else if (name == "servers")        conf->n_servers = as_u32();
+	else if (name == "scripts")        conf->n_scripts = as_u32();
+	else if (name == "timer-tags")     conf->n_timer_tags = as_u32();
+	else if (name == "tag-values")     conf->n_tag_values = as_u32();
+	else if (name == "tags-per-timer") conf->tags_per_timer = as_u32();
+	else if (name == "timers")         conf->max_timers = as_u32();
+	else if (name == "zipf")           conf->zipf_s = as_dbl();
+	else if (name == "timers-zipf")    conf->timers_zipf_s = as_dbl();
+	else if (name == "datagrams")      conf->n_datagrams = as_u32();
+	else if (name == "batch")          conf->requests_per_datagram = as_u32();
+	else if (name == "lz4")            conf->lz4 = (value != "0");
+	else if (name == "seed")           conf->seed = as_u32();
+	else
+		return false;
+
+	return true;
+}
+
+inline void traffic_conf___validate(traffic_conf_t const& conf)
+{
+	if (conf.n_hosts == 0 || conf.n_servers == 0 || conf.n_scripts == 0 || conf.n_datagrams == 0)
+		throw std::runtime_error("hosts, servers, scripts and datagrams must be > 0");
+
+	if (conf.tags_per_timer > conf.n_timer_tags)
+		throw std::runtime_error("tags-per-timer must be <= timer-tags");
+
+	if (conf.tags_per_timer > 0 && conf.n_tag_values == 0)
+		throw std::runtime_error("tag-values must be > 0");
+
+	if (conf.requests_per_datagram == 0 || conf.requests_per_datagram > 0xffff)
+		throw std::runtime_error("batch must be in [1, 65535]");
+
+#ifndef PINBA_HAVE_LZ4
+	if (conf.lz4)
+		throw std::runtime_error("lz4 requested, but built without lz4 support (see --with-lz4)");
+#endif
+}
+
+inline char const* traffic_conf___usage()
+{
+	return
+		"  --hosts=64 --servers=50 --scripts=1000      distinct hostname, server_name, script_name values\n"
+		"  --timer-tags=2 --tag-values=256             distinct timer tag names, distinct values per tag name\n"
+		"  --tags-per-timer=2 --timers=10              tags per timer, max timers per request\n"
+		"  --zipf=1.0 --timers-zipf=0.5                popularity skew for values, timers per request (0 = uniform)\n"
+		"  --datagrams=4096 --batch=1 --lz4=0          distinct datagrams, requests per datagram (>1 = v2), lz4 compress (v2)\n"
+		"  --seed=42\n"
+		;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// zipf distribution over [0, n), item 0 is the most popular, s = 0 is uniform
+// cdf is precomputed, sampling is binary search, fine for sets up to a few million items
+struct zipf_distribution_t
+{
+	std::vector<double> cdf;
+
+	zipf_distribution_t(uint32_t n, double s)
+	{
+		cdf.resize(std::max(n, 1u));
+
+		double sum = 0;
+		for (uint32_t i = 0; i < cdf.size(); i++)
+		{
+			sum += 1.0 / std::pow(double(i + 1), s);
+			cdf[i] = sum;
+		}
+
+		for (auto& v : cdf)
+			v /= sum;
+	}
+
+	template<class Rng>
+	uint32_t operator()(Rng& rng) const
+	{
+		double const u = std::uniform_real_distribution<double>(0, 1)(rng);
+		auto const it = std::lower_bound(cdf.begin(), cdf.end(), u);
+		return std::min<size_t>(it - cdf.begin(), cdf.size() - 1);
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct traffic_generator_t
+{
+	traffic_conf_t const  conf;
+	std::mt19937          rng;
+
+	zipf_distribution_t   host_dist;
+	zipf_distribution_t   server_dist;
+	zipf_distribution_t   script_dist;
+	zipf_distribution_t   tag_value_dist;
+	zipf_distribution_t   timers_dist;
+
+	std::exponential_distribution<float> request_time_dist;
+
+	traffic_generator_t(traffic_conf_t const& c)
+		: conf(c)
+		, rng(c.seed)
+		, host_dist(c.n_hosts, c.zipf_s)
+		, server_dist(c.n_servers, c.zipf_s)
+		, script_dist(c.n_scripts, c.zipf_s)
+		, tag_value_dist(c.n_tag_values, c.zipf_s)
+		, timers_dist(c.max_timers, c.timers_zipf_s)
+		, request_time_dist(1.0 / 0.05) // ~50ms average
+	{
+		traffic_conf___validate(conf);
+	}
+
+	// single packed Pinba__Request
+	std::string next_request()
+	{
+		std::string const hostname    = ff::fmt_str("host-{0}", host_dist(rng));
+		std::string const server_name = ff::fmt_str("server-{0}.example.com", server_dist(rng));
+		std::string const script_name = ff::fmt_str("/script-{0}.php", script_dist(rng));
+
+		// request dictionary: tag names first, then values, as they're used
+		std::vector<std::string> words;
+		for (uint32_t t = 0; t < conf.n_timer_tags; t++)
+			words.push_back(ff::fmt_str("tag{0}", t));
+
+		auto const word_id = [&words](std::string w) -> uint32_t
+		{
+			auto const it = std::find(words.begin(), words.end(), w);
+			if (it != words.end())
+				return it - words.begin();
+
+			words.push_back(std::move(w));
+			return words.size() - 1;
+		};
+
+		std::vector<uint32_t> timer_hit_count, timer_tag_count, timer_tag_name, timer_tag_value;
+		std::vector<float>    timer_value;
+		std::vector<uint32_t> tag_names(conf.n_timer_tags);
+
+		float const request_time = request_time_dist(rng);
+		uint32_t const n_timers = (conf.max_timers > 0) ? (1 + timers_dist(rng)) : 0;
+
+		for (uint32_t i = 0; i < n_timers; i++)
+		{
+			timer_hit_count.push_back(1 + (rng() % 4));
+			timer_value.push_back(request_time / (n_timers + 1));
+			timer_tag_count.push_back(conf.tags_per_timer);
+
+			// tag0 is always there (so that group-by-tag0 reports get all timers), other tag names are a random subset
+			for (uint32_t t = 0; t < conf.n_timer_tags; t++)
+				tag_names[t] = t;
+			if (conf.n_timer_tags > 1)
+				std::shuffle(tag_names.begin() + 1, tag_names.end(), rng);
+
+			for (uint32_t j = 0; j < conf.tags_per_timer; j++)
+			{
+				uint32_t const tag = tag_names[j];
+
+				timer_tag_name.push_back(tag);
+				timer_tag_value.push_back(word_id(ff::fmt_str("tag{0}-value-{1}", tag, tag_value_dist(rng))));
+			}
+		}
+
+		std::vector<ProtobufCBinaryData> dictionary;
+		for (auto const& w : words)
+			dictionary.push_back(ProtobufCBinaryData { w.size(), (uint8_t*)w.data() });
+
+		Pinba__Request r = PINBA__REQUEST__INIT;
+		r.hostname      = ProtobufCBinaryData { hostname.size(), (uint8_t*)hostname.data() };
+		r.server_name   = ProtobufCBinaryData { server_name.size(), (uint8_t*)server_name.data() };
+		r.script_name   = ProtobufCBinaryData { script_name.size(), (uint8_t*)script_name.data() };
+		r.request_count = 1;
+		r.document_size = 1024 + (rng() % 65536);
+		r.memory_peak   = 1024 * 1024 + (rng() % (16 * 1024 * 1024));
+		r.request_time  = request_time;
+		r.ru_utime      = request_time / 2;
+		r.ru_stime      = request_time / 10;
+		r.has_status    = 1;
+		r.status        = (rng() % 100 == 0) ? 500 : 200;
+
+		r.n_timer_hit_count = timer_hit_count.size();
+		r.timer_hit_count   = timer_hit_count.data();
+		r.n_timer_value     = timer_value.size();
+		r.timer_value       = timer_value.data();
+		r.n_timer_tag_count = timer_tag_count.size();
+		r.timer_tag_count   = timer_tag_count.data();
+		r.n_timer_tag_name  = timer_tag_name.size();
+		r.timer_tag_name    = timer_tag_name.data();
+		r.n_timer_tag_value = timer_tag_value.size();
+		r.timer_tag_value   = timer_tag_value.data();
+		r.n_dictionary      = dictionary.size();
+		r.dictionary        = dictionary.data();
+
+		std::string packed(pinba__request__get_packed_size(&r), '\0');
+		pinba__request__pack(&r, (uint8_t*)&packed[0]);
+		return packed;
+	}
+
+	// single network datagram, see collector.h for formats
+	std::string next_datagram()
+	{
+		if (conf.requests_per_datagram == 1 && !conf.lz4)
+			return next_request();
+
+		std::string payload;
+		for (uint32_t i = 0; i < conf.requests_per_datagram; i++)
+		{
+			std::string const req = next_request();
+			if (req.size() > 0xffff)
+				throw std::runtime_error(ff::fmt_str("request is too large for v2 framing: {0} bytes", req.size()));
+
+			payload.push_back(char(req.size() >> 8));
+			payload.push_back(char(req.size() & 0xff));
+			payload.append(req);
+		}
+
+		uint32_t const flags = (conf.lz4) ? PINBA_NET_DATAGRAM_FLAG___COMPRESSED_LZ4 : 0;
+		uint32_t const count = conf.requests_per_datagram;
+
+		std::string result;
+		result.push_back(char(0x20 | ((flags >> 8) & 0x0f)));
+		result.push_back(char(flags & 0xff));
+		result.push_back(char(count >> 8));
+		result.push_back(char(count & 0xff));
+
+		if (!conf.lz4)
+		{
+			result.append(payload);
+			return result;
+		}
+
+#ifdef PINBA_HAVE_LZ4
+		if (payload.size() > PINBA_NET_DATAGRAM_MAX_DECOMPRESSED_SIZE)
+			throw std::runtime_error(ff::fmt_str("v2 payload too large to decompress: {0} bytes", payload.size()));
+
+		int const capacity = LZ4_compressBound(payload.size());
+		std::string compressed(capacity, '\0');
+
+		int const sz = LZ4_compress_default(payload.data(), &compressed[0], payload.size(), capacity);
+		if (sz <= 0)
+			throw std::runtime_error("LZ4_compress_default failed");
+
+		result.append(compressed.data(), sz);
+#endif
+		return result;
+	}
+
+	std::vector<std::string> make_datagrams()
+	{
+		std::vector<std::string> result;
+		result.reserve(conf.n_datagrams);
+
+		for (uint32_t i = 0; i < conf.n_datagrams; i++)
+		{
+			result.push_back(next_datagram());
+
+			if (result.back().size() > 65507)
+				throw std::runtime_error(ff::fmt_str("datagram too large for udp: {0} bytes, lower --batch or --timers", result.back().size()));
+		}
+
+		return result;
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__BENCH_TRAFFIC_H_
@@ -111,6 +111,53 @@ struct bloom_tester
 			, N, n_big_values, n_little_values
 			, n_iterations, collisions, ff::as_printf("%1.6lf%%", double(collisions)/n_iterations * 100.0), sw.stamp());
 	}
+
+	// packet-level bloom, as in timertag_bloom_t: union of tag names from all timers in a packet
+	// tags are taken from n_tag_names distinct names, report key needs n_key_tags of them
+	// false positive = bloom says packet has all key tags, while it doesn't
+	static void run_packet_false_positives(uint32_t n_tag_names, uint32_t n_timers, uint32_t n_timer_tags, uint32_t n_key_tags)
+	{
+		constexpr uint32_t const n_iterations = 100 * 1000;
+
+		uint32_t n_passed = 0;
+		uint32_t n_false_positives = 0;
+
+		for (uint32_t i = 0; i < n_iterations; i++)
+		{
+			bloom_t packet_bloom;
+			std::bitset<1024> packet_names; // n_tag_names must be <= 1024
+
+			for (uint32_t timer_i = 0; timer_i < n_timers; timer_i++)
+			{
+				for (uint32_t tag_i = 0; tag_i < n_timer_tags; tag_i++)
+				{
+					uint32_t const name_id = random() % n_tag_names;
+					packet_bloom.add(name_id);
+					packet_names.set(name_id);
+				}
+			}
+
+			bloom_t key_bloom;
+			bool has_all_names = true;
+
+			for (uint32_t key_i = 0; key_i < n_key_tags; key_i++)
+			{
+				uint32_t const name_id = random() % n_tag_names;
+				key_bloom.add(name_id);
+				has_all_names = has_all_names && packet_names.test(name_id);
+			}
+
+			if (!packet_bloom.contains(key_bloom))
+				continue;
+
+			n_passed++;
+			n_false_positives += !has_all_names;
+		}
+
+		ff::fmt(stdout, "{0}[names: {1}, timers: {2}x{3}, key: {4}]: passed: {5}, false positives: {6}, {7}\n"
+			, N, n_tag_names, n_timers, n_timer_tags, n_key_tags
+			, n_passed, n_false_positives, ff::as_printf("%1.3lf%%", double(n_false_positives)/n_iterations * 100.0));
+	}
 };
 
 
@@ -145,5 +192,14 @@ int main(int argc, char const *argv[])
 	run_perf_and_collisions<128>(15, 4);
 	run_perf_and_collisions<256>(15, 4);
 
+	// timertag_bloom_t width vs false positives, ~300 distinct tag names
+	for (uint32_t const n_timers : { 5, 10, 20, 40 })
+	{
+		bloom_tester<128>::run_packet_false_positives(300, n_timers, 3, 2);
+		bloom_tester<256>::run_packet_false_positives(300, n_timers, 3, 2);
+		bloom_tester<512>::run_packet_false_positives(300, n_timers, 3, 2);
+		bloom_tester<1024>::run_packet_false_positives(300, n_timers, 3, 2);
+	}
+
 	return 0;
 }
\ No newline at end of file
@@ -315,5 +315,55 @@ int main(int argc, char const *argv[])
 	// 	}
 	// }
 
+	// repacker dictionary cache hits, hashing the word vs using hash precalculated upstream
+	// (that's what pinba_request_to_packet() does now, hash is computed once per request dictionary word)
+	{
+		pinba_options_t options = {};
+		pinba_globals_init(&options); // repacker_dictionary_t uses global stats
+
+		constexpr size_t n_cached_words = 64 * 1024;
+
+		dictionary_t          dictionary;
+		repacker_dictionary_t r_dictionary(&dictionary);
+
+		for (size_t i = 0; i < n_cached_words; i++)
+			r_dictionary.get_or_add(words[i].word);
+
+		auto const run_hit_test = [&](str_ref name, size_t i_iter, auto const& func)
+		{
+			srandom(os_unix::gettimeofday_ex().tv_nsec);
+
+			uint64_t id_sum = 0; // to keep the loop from being optimized away
+
+			meow::stopwatch_t sw;
+
+			for (size_t i = 0; i < n_iterations; i++)
+				id_sum += func(words[random() % n_cached_words]);
+
+			auto const elapsed = sw.stamp();
+			double const elapsed_ns = elapsed.tv_sec * 1e9 + elapsed.tv_nsec;
+
+			ff::fmt(stdout, "[{0}/{1}] hit test done, {2} iterations, elapsed: {3}s, {4} ns/word (id_sum: {5})\n",
+				name, i_iter, n_iterations, elapsed, elapsed_ns / n_iterations, id_sum);
+
+			return elapsed_ns;
+		};
+
+		for (size_t i_iter = 0; i_iter < n_repeats; i_iter++)
+		{
+			double const hashing_ns = run_hit_test("rdict_hash_each_time", i_iter, [&](word_and_hash_t const& w)
+			{
+				return r_dictionary.get_or_add(w.word);
+			});
+
+			double const prehashed_ns = run_hit_test("rdict_prehashed", i_iter, [&](word_and_hash_t const& w)
+			{
+				return r_dictionary.get_or_add(w.word, w.hash_value);
+			});
+
+			ff::fmt(stdout, "[rdict/{0}] saved per word: {1} ns\n", i_iter, (hashing_ns - prehashed_ns) / n_iterations);
+		}
+	}
+
 	return 0;
 }
\ No newline at end of file
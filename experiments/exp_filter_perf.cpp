@@ -0,0 +1,127 @@
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <meow/stopwatch.hpp>
+#include <meow/format/format_and_namespace.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/packet.h"
+#include "pinba/packet_filter.h"
+#include "pinba/report_by_request.h"
+
+// compare per-packet std::function filter calls with packet_filter_program_t (single and batched)
+int main(int argc, char const *argv[])
+{
+	constexpr size_t   n_packets    = 1024 * 1024;
+	constexpr size_t   n_repeats    = 20;
+	constexpr uint32_t n_tags       = 8;
+	constexpr uint32_t batch_size   = 64;
+
+	using conf_t = report_conf___by_request_t;
+
+	std::vector<conf_t::filter_descriptor_t> const filters = {
+		conf_t::make_filter___by_min_time(10 * d_millisecond),
+		conf_t::make_filter___by_max_time(900 * d_millisecond),
+		conf_t::make_filter___by_request_field(&packet_t::server_id, 1),
+		conf_t::make_filter___by_request_tag(3, 1),
+	};
+
+	// generate packets, roughly half of them pass all filters
+	std::vector<packet_t>  packets(n_packets);
+	std::vector<uint32_t>  tag_ids(n_packets * n_tags * 2);
+	std::vector<packet_t*> packet_ptrs(n_packets);
+	{
+		meow::stopwatch_t sw;
+
+		for (size_t i = 0; i < n_packets; i++)
+		{
+			packet_t *p = &packets[i];
+
+			p->server_id     = (random() % 16 == 0) ? 2 : 1;
+			p->request_time  = duration_from_double((random() % 1000) / 1000.0);
+			p->tag_count     = n_tags;
+			p->tag_name_ids  = &tag_ids[i * n_tags * 2]; // names, then values
+
+			for (uint32_t tag_i = 0; tag_i < n_tags; tag_i++)
+			{
+				p->tag_name_ids[tag_i]  = tag_i;
+				p->tag_value_ids()[tag_i] = (random() % 8 == 0) ? 2 : 1;
+			}
+
+			packet_ptrs[i] = p;
+		}
+
+		ff::fmt(stdout, "generated {0} packets, elapsed: {1}s\n", n_packets, sw.stamp());
+	}
+
+	packet_filter_program_t program;
+	program.compile(filters);
+
+	auto const run_test = [&](str_ref name, auto const& func)
+	{
+		for (size_t i_iter = 0; i_iter < n_repeats; i_iter++)
+		{
+			meow::stopwatch_t sw;
+
+			size_t const n_passed = func();
+
+			auto const elapsed = sw.stamp();
+			double const elapsed_ns = elapsed.tv_sec * 1e9 + elapsed.tv_nsec;
+
+			ff::fmt(stdout, "[{0}/{1}] passed: {2}, elapsed: {3}s, {4} ns/packet\n",
+				name, i_iter, n_passed, elapsed, elapsed_ns / n_packets);
+		}
+	};
+
+	run_test("std_function", [&]()
+	{
+		size_t n_passed = 0;
+
+		for (size_t i = 0; i < n_packets; i++)
+		{
+			bool passed = true;
+			for (auto const& filter : filters)
+			{
+				if (!filter.func(packet_ptrs[i]))
+				{
+					passed = false;
+					break;
+				}
+			}
+
+			n_passed += passed;
+		}
+
+		return n_passed;
+	});
+
+	run_test("program_single", [&]()
+	{
+		size_t n_passed = 0;
+
+		for (size_t i = 0; i < n_packets; i++)
+			n_passed += program.run(packet_ptrs[i]);
+
+		return n_passed;
+	});
+
+	run_test("program_batch", [&]()
+	{
+		size_t n_passed = 0;
+
+		packet_t *batch[batch_size];
+
+		for (size_t offset = 0; offset < n_packets; offset += batch_size)
+		{
+			uint32_t const chunk_size = std::min<size_t>(batch_size, n_packets - offset);
+			std::copy(packet_ptrs.begin() + offset, packet_ptrs.begin() + offset + chunk_size, batch);
+
+			n_passed += program.run_batch(batch, chunk_size);
+		}
+
+		return n_passed;
+	});
+
+	return 0;
+}
@@ -0,0 +1,127 @@
+#include <cstdlib>
+#include <vector>
+
+#include <meow/stopwatch.hpp>
+#include <meow/str_ref.hpp>
+#include <meow/format/format_and_namespace.hpp>
+
+#include "pinba/report.h"
+#include "pinba/report_util.h"
+
+using meow::str_ref;
+
+// emulate what reports do with their key hashtables, see exp_key_hash_perf.cpp
+//  raw_item_reference()     - emplace_hash() into tick hashtable, most keys are already there
+//  merge_ticks_into_data()  - emplace_hash() of many ticks into a fresh hashtable, with known hashes
+//  find()                   - by_timer running aggregate removes expired ticks with find() + erase()
+template<size_t N, class HashtableP>
+static void run_test(str_ref name, uint32_t n_unique_keys)
+{
+	using key_t       = report_key_impl_t<N>;
+	using hashtable_t = typename HashtableP::template map_t<key_t, uint64_t>;
+
+	constexpr size_t n_packets = 10 * 1000 * 1000;
+	constexpr size_t n_ticks   = 10;
+	constexpr size_t n_repeats = 3;
+
+	std::vector<key_t> keys(n_unique_keys);
+	for (auto& k : keys)
+	{
+		for (auto& part : k)
+			part = random() % 100000;
+	}
+
+	std::vector<uint32_t> key_offsets(n_packets);
+	for (auto& off : key_offsets)
+		off = random() % n_unique_keys;
+
+	for (size_t i_iter = 0; i_iter < n_repeats; i_iter++)
+	{
+		std::vector<hashtable_t> ticks(n_ticks);
+
+		{
+			meow::stopwatch_t sw;
+
+			for (size_t i = 0; i < n_packets; i++)
+			{
+				hashtable_t& tick_ht = ticks[i % n_ticks];
+
+				key_t const& k = keys[key_offsets[i]];
+				uint64_t const key_hash = report_key_impl___hasher_t()(k);
+
+				auto inserted_pair = tick_ht.emplace_hash(key_hash, k, 0);
+				inserted_pair.first.value() += 1;
+			}
+
+			auto const elapsed = sw.stamp();
+			ff::fmt(stdout, "[{0}/{1}/{2}] raw_item_reference: {3} keys/tick, elapsed: {4}s, {5} Mops/sec\n",
+				name, N, i_iter, ticks[0].size(), elapsed, n_packets / timeval_to_double(elapsed) / 1e6);
+		}
+
+		hashtable_t merged_ht;
+
+		{
+			meow::stopwatch_t sw;
+
+			size_t n_merged = 0;
+
+			for (auto const& tick_ht : ticks)
+			{
+				for (auto const& pair : tick_ht)
+				{
+					uint64_t const key_hash = report_key_impl___hasher_t()(pair.first);
+
+					auto inserted_pair = merged_ht.emplace_hash(key_hash, pair.first, 0);
+					inserted_pair.first.value() += pair.second;
+				}
+
+				n_merged += tick_ht.size();
+			}
+
+			auto const elapsed = sw.stamp();
+			ff::fmt(stdout, "[{0}/{1}/{2}] merge_ticks_into_data: {3} keys, elapsed: {4}s, {5} Mops/sec\n",
+				name, N, i_iter, merged_ht.size(), elapsed, n_merged / timeval_to_double(elapsed) / 1e6);
+		}
+
+		{
+			meow::stopwatch_t sw;
+
+			size_t n_found = 0;
+
+			for (size_t i = 0; i < n_packets; i++)
+			{
+				key_t const& k = keys[key_offsets[i]];
+				uint64_t const key_hash = report_key_impl___hasher_t()(k);
+
+				auto const it = merged_ht.find(k, key_hash);
+				n_found += (it != merged_ht.end());
+			}
+
+			auto const elapsed = sw.stamp();
+			ff::fmt(stdout, "[{0}/{1}/{2}] find: {3} found, elapsed: {4}s, {5} Mops/sec\n",
+				name, N, i_iter, n_found, elapsed, n_packets / timeval_to_double(elapsed) / 1e6);
+		}
+
+		ff::fmt(stdout, "[{0}/{1}/{2}] memory: {3} buckets, {4} bytes\n",
+			name, N, i_iter, merged_ht.bucket_count(), merged_ht.bucket_count() * sizeof(*merged_ht.begin()));
+	}
+}
+
+template<size_t N>
+static void run_tests(uint32_t n_unique_keys)
+{
+	run_test<N, report_hashtable___robin_map_t>("robin_map", n_unique_keys);
+	run_test<N, report_hashtable___swiss_map_t>("swiss_map", n_unique_keys);
+}
+
+int main(int argc, char const *argv[])
+{
+	uint32_t const n_unique_keys = (argc > 1) ? atoi(argv[1]) : 100 * 1000;
+
+	run_tests<1>(n_unique_keys);
+	run_tests<2>(n_unique_keys);
+	run_tests<3>(n_unique_keys);
+	run_tests<5>(n_unique_keys);
+
+	return 0;
+}
@@ -6,6 +6,7 @@
 #include <meow/error.hpp>
 
 #include "pinba/globals.h"
+#include "pinba/multi_merge.h"
 
 // #include "hdr_histogram/hdr_histogram.h"
 
@@ -659,6 +660,77 @@ inline flat_histogram_t histogram___convert_hdr_to_flat(Histogram const& hv, typ
 	return result;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// multi_merge() variants, merging n_sources flat histograms (like rows merged from tick histograms)
+
+struct multi_merge_bench___merger_t
+{
+	histogram_values_t *to;
+
+	inline bool compare(histogram_value_t const& l, histogram_value_t const& r) const
+	{
+		return l.bucket_id < r.bucket_id;
+	}
+
+	inline void reserve(size_t const sz)
+	{
+		to->reserve(sz);
+	}
+
+	inline void push_back(histogram_values_t const *seq, histogram_value_t const& v)
+	{
+		if (!to->empty() && (to->back().bucket_id == v.bucket_id))
+			to->back().value += v.value;
+		else
+			to->emplace_back(v);
+	}
+};
+
+static void multi_merge_bench(size_t n_sources, size_t values_per_source, size_t n_merges)
+{
+	std::vector<histogram_values_t> sources(n_sources);
+	std::vector<histogram_values_t const*> sources_p;
+
+	for (auto& values : sources)
+	{
+		for (size_t i = 0; i < values_per_source; i++)
+			values.push_back({ .bucket_id = uint32_t(random() % (values_per_source * 4)), .value = 1 });
+
+		std::sort(values.begin(), values.end());
+		values.erase(std::unique(values.begin(), values.end(), [](histogram_value_t const& l, histogram_value_t const& r) { return l.bucket_id == r.bucket_id; }), values.end());
+
+		sources_p.push_back(&values);
+	}
+
+	auto const run = [&](meow::str_ref name, auto const& merge_fn)
+	{
+		histogram_values_t result;
+		size_t             result_size = 0;
+
+		meow::stopwatch_t sw;
+
+		for (size_t i = 0; i < n_merges; i++)
+		{
+			result.clear();
+			multi_merge_bench___merger_t merger = { .to = &result };
+			merge_fn(&merger, sources_p.begin(), sources_p.end());
+			result_size = result.size();
+		}
+
+		auto const d = timeval_to_double(sw.stamp());
+		ff::fmt(stdout, "multi_merge {0}: sources: {1}, values: {2}, result: {3}, {4} merges took: {5}, {6} per merge\n",
+			name, n_sources, values_per_source, result_size, n_merges, d, ff::as_printf("%1.10f", d / n_merges));
+	};
+
+	using iterator_t = decltype(sources_p.begin());
+
+	run("stdlib    ", &pinba::multi_merge__stdlib<multi_merge_bench___merger_t, iterator_t>);
+	run("loser_tree", &pinba::multi_merge__loser_tree<multi_merge_bench___merger_t, iterator_t>);
+	if (n_sources <= 8) // linear in n_sources per value, pointless after that
+		run("small     ", &pinba::multi_merge__small<multi_merge_bench___merger_t, iterator_t>);
+	run("auto      ", &pinba::multi_merge<multi_merge_bench___merger_t, iterator_t>);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 int main(int argc, char const *argv[])
@@ -1009,5 +1081,8 @@ int main(int argc, char const *argv[])
 	// 		, n_iterations, rnd_d, (double)n_iterations / rnd_d, hash_d / rnd_d);
 	// }
 
+	for (size_t const n_sources : { 2, 3, 4, 8, 60, 300, 900 })
+		multi_merge_bench(n_sources, 256, 300000 / n_sources);
+
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include <cstdlib>
+#include <vector>
+
+#include <tsl/robin_map.h>
+
+#include <meow/stopwatch.hpp>
+#include <meow/str_ref.hpp>
+#include <meow/format/format_and_namespace.hpp>
+
+#include "t1ha/t1ha.h"
+
+#include "pinba/hash.h"
+#include "pinba/report_util.h"
+
+using meow::str_ref;
+
+// report_key_impl___hasher_t we had before, t1ha0() over key bytes
+struct t1ha_key_hasher_t
+{
+	template<size_t N>
+	inline size_t operator()(report_key_impl_t<N> const& key) const
+	{
+		return t1ha0(key.data(), key.size() * sizeof(key[0]), 0);
+	}
+};
+
+// emulate what reports do with keys
+//  raw_item_reference()     - emplace_hash() into tick hashtable, most keys are already there
+//  merge_ticks_into_data()  - emplace_hash() of all tick rows into a fresh hashtable, with known hashes
+template<size_t N, class Hasher>
+static void run_test(str_ref name, uint32_t n_unique_keys)
+{
+	using key_t       = report_key_impl_t<N>;
+	using hashtable_t = tsl::robin_map<key_t, uint64_t, Hasher, report_key_impl___equal_t, std::allocator<std::pair<key_t, uint64_t>>, /*StoreHash=*/ true>;
+
+	constexpr size_t n_packets = 10 * 1000 * 1000;
+	constexpr size_t n_repeats = 5;
+
+	std::vector<key_t> keys(n_unique_keys);
+	for (auto& k : keys)
+	{
+		for (auto& part : k)
+			part = random() % 100000;
+	}
+
+	std::vector<uint32_t> key_offsets(n_packets);
+	for (auto& off : key_offsets)
+		off = random() % n_unique_keys;
+
+	for (size_t i_iter = 0; i_iter < n_repeats; i_iter++)
+	{
+		hashtable_t tick_ht;
+
+		{
+			meow::stopwatch_t sw;
+
+			for (size_t i = 0; i < n_packets; i++)
+			{
+				key_t const& k = keys[key_offsets[i]];
+				uint64_t const key_hash = Hasher()(k);
+
+				auto inserted_pair = tick_ht.emplace_hash(key_hash, k, 0);
+				inserted_pair.first.value() += 1;
+			}
+
+			auto const elapsed = sw.stamp();
+			ff::fmt(stdout, "[{0}/{1}/{2}] raw_item_reference: {3} keys, elapsed: {4}s, {5} Mops/sec\n",
+				name, N, i_iter, tick_ht.size(), elapsed, n_packets / timeval_to_double(elapsed) / 1e6);
+		}
+
+		{
+			meow::stopwatch_t sw;
+
+			hashtable_t merged_ht;
+
+			for (auto const& pair : tick_ht)
+			{
+				uint64_t const key_hash = Hasher()(pair.first);
+
+				auto inserted_pair = merged_ht.emplace_hash(key_hash, pair.first, 0);
+				inserted_pair.first.value() += pair.second;
+			}
+
+			auto const elapsed = sw.stamp();
+			ff::fmt(stdout, "[{0}/{1}/{2}] merge_ticks_into_data: {3} keys, elapsed: {4}s, {5} Mops/sec\n",
+				name, N, i_iter, merged_ht.size(), elapsed, tick_ht.size() / timeval_to_double(elapsed) / 1e6);
+		}
+	}
+}
+
+template<size_t N>
+static void run_tests(uint32_t n_unique_keys)
+{
+	run_test<N, t1ha_key_hasher_t>("t1ha0", n_unique_keys);
+	run_test<N, report_key_impl___hasher_t>("hash_fixed", n_unique_keys);
+}
+
+int main(int argc, char const *argv[])
+{
+	uint32_t const n_unique_keys = (argc > 1) ? atoi(argv[1]) : 100 * 1000;
+
+	run_tests<1>(n_unique_keys);
+	run_tests<2>(n_unique_keys);
+	run_tests<3>(n_unique_keys);
+	run_tests<5>(n_unique_keys);
+
+	return 0;
+}
@@ -19,6 +19,7 @@
 #include "pinba/collector.h"
 #include "pinba/packet.h"
 #include "pinba/packet_impl.h"
+#include "pinba/packet_wire.h"
 #include "pinba/bloom.h"
 
 #include "proto/pinba.pb-c.h"
@@ -30,7 +31,7 @@ using meow::string_ref;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-struct permanent_dictionary_t
+struct locked_dictionary_t
 {
 	// struct hasher_t
 	// {
@@ -52,7 +53,7 @@ struct permanent_dictionary_t
 	uint64_t lookup_count;
 	uint64_t insert_count;
 
-	permanent_dictionary_t()
+	locked_dictionary_t()
 		: hash(64 * 1024)
 		, mem_used_by_word_strings(0)
 		, lookup_count(0)
@@ -430,7 +431,7 @@ try
 	};
 
 	// dictionary_t d;
-	permanent_dictionary_t d;
+	locked_dictionary_t d;
 
 	if (argc < 2)
 		throw std::runtime_error(ff::fmt_str("usage {0} <filename>", argv[0]));
@@ -474,8 +475,12 @@ try
 
 		dictionary_t g_dictionary;
 
+		size_t const mem_before = nmpa_user_space_used(&nmpa);
 		packet_t *packet = pinba_request_to_packet(request, &g_dictionary, &nmpa);
 
+		ff::fmt(stdout, "repacked size {0} bytes, sizeof(packet_t): {1}, sizeof(packed_timer_t): {2}\n",
+			nmpa_user_space_used(&nmpa) - mem_before, sizeof(packet_t), sizeof(packed_timer_t));
+
 		debug_dump_packet(stdout, packet, &g_dictionary, &nmpa);
 		nmpa_empty(&nmpa);
 	}
@@ -558,10 +563,64 @@ try
 			name, n_iterations, elapsed, (double)n_iterations / timeval_to_double(elapsed));
 	};
 
+	// current repacker path: protobuf-c unpack + validate + repack
+	auto const run_unpack_repack = [&](str_ref name, ProtobufCAllocator *pba)
+	{
+		dictionary_t g_dictionary;
+
+		meow::stopwatch_t sw;
+
+		for (size_t i = 0; i < n_iterations; i++)
+		{
+			Pinba__Request *request = pinba__request__unpack(pba, buf_sz, buf);
+			if (request == NULL) {
+				throw std::runtime_error("packet decode failed\n");
+			}
+
+			auto const vr = pinba_validate_request(request);
+			if (vr != request_validate_result::okay)
+				throw std::runtime_error(ff::fmt_str("packet validation failed: {0}", enum_as_str_ref(vr)));
+
+			packet_t *packet = pinba_request_to_packet(request, &g_dictionary, &nmpa);
+			(void)packet;
+			nmpa_empty(&nmpa);
+		}
+
+		auto const elapsed = sw.stamp();
+		ff::fmt(stdout, "{0}; {1} iterations, elapsed: {2}, {3} req/sec\n",
+			name, n_iterations, elapsed, (double)n_iterations / timeval_to_double(elapsed));
+	};
+
+	// direct wire decoder path: decode + validate in one pass + repack
+	auto const run_wire_repack = [&](str_ref name)
+	{
+		dictionary_t g_dictionary;
+		pinba_wire_decoder_t decoder;
+
+		meow::stopwatch_t sw;
+
+		for (size_t i = 0; i < n_iterations; i++)
+		{
+			auto const vr = decoder.decode(str_ref { (char const*)buf, size_t(buf_sz) });
+			if (vr != request_validate_result::okay)
+				throw std::runtime_error(ff::fmt_str("packet wire decode failed: {0}", enum_as_str_ref(vr)));
+
+			packet_t *packet = pinba_request_to_packet(decoder.request(), &g_dictionary, &nmpa);
+			(void)packet;
+			nmpa_empty(&nmpa);
+		}
+
+		auto const elapsed = sw.stamp();
+		ff::fmt(stdout, "{0}; {1} iterations, elapsed: {2}, {3} req/sec\n",
+			name, n_iterations, elapsed, (double)n_iterations / timeval_to_double(elapsed));
+	};
+
 	// run_deserialize("deserialize[with_pba]", &pba);
 	// run_deserialize("deserialize[no_pba]", NULL);
 
 	run_repack("repack[with_pba]", &pba);
+	run_unpack_repack("unpack_repack[with_pba]", &pba);
+	run_wire_repack("wire_repack");
 	// run_repack("repack[no_pba]", NULL);
 
 	// run_full_repack("full[with_pba]", &pba);
@@ -0,0 +1,66 @@
+#include <cstdlib>
+#include <vector>
+
+#include <meow/stopwatch.hpp>
+#include <meow/str_ref.hpp>
+#include <meow/format/format_and_namespace.hpp>
+
+#include "pinba/tag_lookup.h"
+
+using meow::str_ref;
+
+// compare scalar and simd tag lookup, on key extraction-like workload:
+// timers with a few tags each, looking up all key parts in every timer
+int main(int argc, char const *argv[])
+{
+	constexpr size_t   n_timers     = 1024 * 1024;
+	constexpr size_t   n_repeats    = 10;
+	constexpr uint32_t n_key_parts  = 3;
+	constexpr uint32_t n_tag_names  = 16;
+
+	uint32_t const tags_per_timer[] = { 1, 3, 5, 8, 10, 16 };
+
+	uint32_t const key_parts[n_key_parts] = { 1, 2, 3 };
+
+	for (uint32_t const n_tags : tags_per_timer)
+	{
+		std::vector<uint32_t> names(n_timers * n_tags);
+		for (auto& name : names)
+			name = random() % n_tag_names;
+
+		auto const run_test = [&](str_ref name, auto const& func)
+		{
+			for (size_t i_iter = 0; i_iter < n_repeats; i_iter++)
+			{
+				meow::stopwatch_t sw;
+
+				size_t n_found = 0;
+
+				for (size_t i = 0; i < n_timers; i++)
+				{
+					uint32_t const *timer_names = &names[i * n_tags];
+
+					for (uint32_t part_i = 0; part_i < n_key_parts; part_i++)
+					{
+						if (func(timer_names, n_tags, key_parts[part_i]) == n_tags)
+							break;
+						n_found++;
+					}
+				}
+
+				auto const elapsed = sw.stamp();
+				double const elapsed_ns = elapsed.tv_sec * 1e9 + elapsed.tv_nsec;
+
+				ff::fmt(stdout, "[{0}/tags:{1}/{2}] found: {3}, elapsed: {4}s, {5} ns/timer\n",
+					name, n_tags, i_iter, n_found, elapsed, elapsed_ns / n_timers);
+			}
+		};
+
+		run_test("scalar", tag_lookup___scalar);
+#ifdef PINBA__TAG_LOOKUP_HAVE_SIMD
+		run_test("simd", tag_lookup___simd);
+#endif
+	}
+
+	return 0;
+}
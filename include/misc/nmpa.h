@@ -17,11 +17,22 @@
 
 #define autocleaned_nmpa_s nmpa_s __attribute__((cleanup(nmpa_free)))
 
+/* pool blocks come from here, if set (big chunks are always malloc-ed), see pinba/block_allocator.h
+   nmpa remembers allocator it was initialized with, so changing this affects only nmpa-s initialized afterwards */
+struct nmpa_block_allocator_s {
+	void *(*alloc)(void *ctx, size_t sz);
+	void (*free)(void *ctx, void *ptr, size_t sz);
+	void *ctx;
+};
+
+extern const struct nmpa_block_allocator_s *nmpa_block_allocator;
+
 struct nmpa_s {
 	struct array_s pool;
 	struct array_s big_chunks;
 	size_t block_sz;
 	unsigned next_empty;
+	const struct nmpa_block_allocator_s *allocator; /* NULL = malloc */
 };
 
 
@@ -43,12 +54,69 @@ static inline size_t nmpa_mem_used(const struct nmpa_s *nmpa)
 }
 
 
+/* bytes handed out since nmpa_init() or nmpa_empty() (aligned, big chunks included), i.e. what a single block would need to hold,
+   unlike nmpa_mem_used(), which counts whole blocks */
+static inline size_t nmpa_mem_requested(const struct nmpa_s *nmpa)
+{
+	size_t ret = 0;
+
+	for (unsigned i = 0; i < nmpa->next_empty; i++) {
+		const struct array_s *a = array_v(&nmpa->pool, struct array_s) + i;
+		ret += a->used;
+	}
+
+	for (unsigned i = 0; i < nmpa->big_chunks.used; i++) {
+		const struct array_s *a = array_v(&nmpa->big_chunks, struct array_s) + i;
+		ret += a->allocated;
+	}
+
+	return ret;
+}
+
+
 static inline void nmpa_init(struct nmpa_s *nmpa, size_t block_sz)
 {
 	memset(nmpa, 0, sizeof(*nmpa));
 	array_init(&nmpa->pool, sizeof(struct array_s), 0);
 	array_init(&nmpa->big_chunks, sizeof(struct array_s), 0);
 	nmpa->block_sz = block_sz;
+	nmpa->allocator = nmpa_block_allocator;
+}
+
+
+static inline int nmpa___block_init(struct nmpa_s *nmpa, struct array_s *a)
+{
+	if (!nmpa->allocator) {
+		return (0 != array_init(a, 1, nmpa->block_sz));
+	}
+
+	void *data = nmpa->allocator->alloc(nmpa->allocator->ctx, nmpa->block_sz);
+	if (!data) {
+		return 0;
+	}
+
+	a->data = data;
+	a->sz = 1;
+	a->used = 0;
+	a->allocated = nmpa->block_sz;
+	return 1;
+}
+
+
+static inline void nmpa___block_free(struct nmpa_s *nmpa, struct array_s *a)
+{
+	if (!nmpa->allocator) {
+		array_free(a);
+		return;
+	}
+
+	if (a->data) {
+		nmpa->allocator->free(nmpa->allocator->ctx, a->data, a->allocated);
+	}
+
+	a->data = 0;
+	a->sz = 0;
+	a->used = a->allocated = 0;
 }
 
 
@@ -71,7 +139,7 @@ static inline void nmpa_empty(struct nmpa_s *nmpa)
 
 	while (nmpa->pool.used > max_pool_items) {
 		struct array_s *a = (__typeof__(a))array_item_last(&nmpa->pool);
-		array_free(a);
+		nmpa___block_free(nmpa, a);
 		nmpa->pool.used --;
 	}
 
@@ -83,12 +151,31 @@ static inline void nmpa_empty(struct nmpa_s *nmpa)
 }
 
 
+/* change size of blocks allocated from now on, nmpa must be empty (just nmpa_init()-ed or nmpa_empty()-ed)
+   blocks kept by nmpa_empty() are freed, when size changes */
+static inline void nmpa_set_block_sz(struct nmpa_s *nmpa, size_t block_sz)
+{
+	if (nmpa->block_sz == block_sz) {
+		return;
+	}
+
+	for (unsigned i = 0; i < nmpa->pool.used; i++) {
+		struct array_s *a = array_v(&nmpa->pool, struct array_s) + i;
+		nmpa___block_free(nmpa, a);
+	}
+
+	nmpa->pool.used = 0;
+	nmpa->next_empty = 0;
+	nmpa->block_sz = block_sz;
+}
+
+
 static inline void nmpa_free(struct nmpa_s *nmpa)
 {
 	nmpa_empty(nmpa);
 	for (unsigned i = 0; i < nmpa->pool.used; i++) {
 		struct array_s *a = array_v(&nmpa->pool, struct array_s) + i;
-		array_free(a);
+		nmpa___block_free(nmpa, a);
 	}
 	array_free(&nmpa->pool);
 	array_free(&nmpa->big_chunks);
@@ -154,7 +241,7 @@ static inline void *nmpa_alloc(struct nmpa_s *nmpa, size_t sz)
 			return 0;
 		}
 
-		if (0 == array_init(a, 1, nmpa->block_sz)) {
+		if (0 == nmpa___block_init(nmpa, a)) {
 			nmpa->pool.used --;
 			errno = ENOMEM;
 			return 0;
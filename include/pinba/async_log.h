@@ -0,0 +1,80 @@
+#ifndef PINBA__ASYNC_LOG_H_
+#define PINBA__ASYNC_LOG_H_
+
+#include <memory>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/byte_ring.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// logging from hot paths (packet_debug dumps and such), without taking logger lock or doing io there
+//
+// every producer thread has an async_log_writer_t, messages are formatted into its reusable buffer
+// and pushed to a ring of its own (single producer + single consumer, no locks, allocated on first write)
+// async log thread drains rings into the logger every few ms, messages are dropped when a ring is full
+//
+// formatting stays in producer, since what messages refer to (batch memory, dictionary words) doesn't outlive the call,
+// but that's cheap compared to logger sink writes, which are now done by async log thread only
+
+struct async_log_t : private boost::noncopyable
+{
+	using level_t  = decltype(meow::logging::log_level::info);
+	using ring_t   = byte_ring_t<1 * 1024 * 1024>;
+	using ring_ptr = std::shared_ptr<ring_t>;
+
+	virtual ~async_log_t() {}
+
+	// any thread, ring is drained until the last writer reference is gone and it's empty
+	virtual ring_ptr create_ring() = 0;
+};
+using async_log_ptr = std::unique_ptr<async_log_t>;
+
+// starts async log thread, writes out what's left in rings on destruction
+async_log_ptr create_async_log(pinba_globals_t*);
+
+// per producer thread handle, owner thread only
+struct async_log_writer_t : private boost::noncopyable
+{
+	using level_t = async_log_t::level_t;
+
+	explicit async_log_writer_t(pinba_globals_t *globals)
+		: globals_(globals)
+	{
+	}
+
+	// never blocks, message is dropped if async log thread is behind
+	void write(level_t level, str_ref message)
+	{
+		if (!ring_)
+			ring_ = globals_->async_log()->create_ring();
+
+		if (!ring_->push(0, uint32_t(level), message))
+			globals_->stats()->async_log.messages_dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	template<class F, class... A>
+	void write_fmt(level_t level, F const& fmt, A const&... args)
+	{
+		ff::fmt(this->scratch(), fmt, args...);
+		this->write(level, buf_);
+	}
+
+	// cleared buffer for sink based formatters (like debug_dump_packet()), write() it afterwards
+	std::string& scratch()
+	{
+		buf_.clear();
+		return buf_;
+	}
+
+private:
+	pinba_globals_t        *globals_;
+	async_log_t::ring_ptr  ring_;
+	std::string            buf_;   // keeps capacity between messages
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__ASYNC_LOG_H_
@@ -0,0 +1,60 @@
+#ifndef PINBA__BLOCK_ALLOCATOR_H_
+#define PINBA__BLOCK_ALLOCATOR_H_
+
+#include <cstdint>
+
+#include "pinba/globals.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// where nmpa pool blocks come from (see nmpa_block_allocator in misc/nmpa.h)
+//
+// repacker batches, report ticks and snapshots all churn through nmpa-s, every one of which mallocs and frees its blocks
+// this keeps freed blocks around instead, in a small per-thread cache (no locking) backed by a global depot (mutex per size class)
+// block sizes are rounded up to power of 2 (1KB .. 512KB), bigger blocks go straight to malloc()
+//
+// memory for blocks comes from
+//   MALLOC   - not installed at all, nmpa uses malloc() as before
+//   CACHED   - malloc(), depot keeps up to depot_max_bytes of free blocks, the rest is freed
+//   THP      - 2MB aligned mmap()-ed chunks with madvise(MADV_HUGEPAGE), carved into blocks, never returned to os
+//   HUGETLB  - same as THP, but MAP_HUGETLB (needs vm.nr_hugepages), falls back to THP chunks when pool is exhausted
+//
+// numa_local keeps a depot per numa node (node of the cpu the thread runs on, taken once per thread, so pin threads with *_cpus options)
+// and binds chunks to that node with mbind(MPOL_PREFERRED), blocks freed on other node go to that thread cache, i.e. migrate, that's fine
+
+#define PINBA_BLOCK_ALLOCATOR__MALLOC   0
+#define PINBA_BLOCK_ALLOCATOR__CACHED   1
+#define PINBA_BLOCK_ALLOCATOR__THP      2
+#define PINBA_BLOCK_ALLOCATOR__HUGETLB  3
+
+struct block_allocator_conf_t
+{
+	uint32_t  mode;                 // PINBA_BLOCK_ALLOCATOR__*
+	bool      numa_local;
+	uint32_t  thread_cache_bytes;   // per size class, per thread
+	uint64_t  depot_max_bytes;      // per size class, per node, CACHED mode only
+};
+
+struct block_allocator_stats_t
+{
+	uint32_t  mode;                 // installed mode, PINBA_BLOCK_ALLOCATOR__MALLOC if none
+	uint64_t  os_bytes;             // got from os (or malloc), minus freed back
+	uint64_t  in_use_bytes;         // given out to nmpa-s
+	uint64_t  cached_bytes;         // os_bytes - in_use_bytes, sitting in thread caches and depots
+	uint64_t  thread_cache_hits;
+	uint64_t  depot_hits;
+	uint64_t  os_allocs;            // chunks (THP, HUGETLB) or blocks (CACHED, big blocks) allocated
+	uint64_t  hugetlb_fallbacks;    // HUGETLB chunks that had to fall back to THP
+};
+
+// installs nmpa_block_allocator for the whole process (nmpa-s initialized after this will use it)
+// first successful install wins, allocator is never destroyed, as nmpa-s might outlive globals
+// MALLOC mode is a no-op
+pinba_error_t block_allocator___install(pinba_globals_t*, block_allocator_conf_t const&);
+
+block_allocator_stats_t block_allocator___stats();
+
+char const* block_allocator___mode_name(uint32_t mode);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__BLOCK_ALLOCATOR_H_
@@ -3,13 +3,22 @@
 
 #include <memory>
 #include <bitset>
+#include <cassert>
+#include <cstring>
 #include <type_traits>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include <boost/noncopyable.hpp>
 
 #include <meow/utility/static_math.hpp>
 
 #include "pinba/hash.h"
+#include "pinba/limits.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 namespace pinba {
@@ -57,11 +66,21 @@ namespace pinba {
 			bits_.reset();
 		}
 
+		void merge(self_t const& other)
+		{
+			bits_ |= other.bits_;
+		}
+
 		bool contains(self_t const& other) const
 		{
 			return (bits_ & other.bits_) == other.bits_;
 		}
 
+		bool operator==(self_t const& other) const
+		{
+			return bits_ == other.bits_;
+		}
+
 		std::string to_string() const
 		{
 			return bits_.to_string();
@@ -78,15 +97,70 @@ namespace pinba {
 	static_assert(fixlen_bloom_t<256>::mask  == 0xff, "");
 	static_assert(fixlen_bloom_t<256>::shift == 8, "");
 
+	static_assert(fixlen_bloom_t<512>::mask  == 0x1ff, "");
+	static_assert(fixlen_bloom_t<512>::shift == 9, "");
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 } // namespace pinba {
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 // bloom with all timer tag names from a packet
-struct timertag_bloom_t : public pinba::fixlen_bloom_t<128> {};
+struct timertag_bloom_t : public pinba::fixlen_bloom_t<PINBA_LIMIT___TIMERTAG_BLOOM_BITS> {};
 
 // bloom with all timer tag names from a timer
 struct timer_bloom_t : public pinba::fixlen_bloom_t<64> {};
+static_assert(sizeof(timer_bloom_t) == sizeof(uint64_t), "timer_bloom_t must be a single 64bit word, see timer_bloom___contains_mask()");
+
+// test blooms[0, count) against needle (i.e. blooms[i].contains(needle)) for up to 64 sequential timer blooms
+// returns bitmask with bit i set if blooms[i] contains needle
+// vectorized, 4 (avx2) or 2 (sse2) blooms per compare, blooms don't need to be aligned
+inline uint64_t timer_bloom___contains_mask(timer_bloom_t const *blooms, uint32_t count, timer_bloom_t const& needle)
+{
+	assert(count <= 64);
+
+	uint64_t needle_bits;
+	memcpy(&needle_bits, &needle, sizeof(needle_bits)); // bitset storage, standard layout
+
+	uint64_t const *bits = (uint64_t const*)blooms;
+
+	uint64_t result = 0;
+	uint32_t i = 0;
+
+#if defined(__AVX2__)
+	{
+		__m256i const n = _mm256_set1_epi64x((long long)needle_bits);
+
+		for (; i + 4 <= count; i += 4)
+		{
+			__m256i const v  = _mm256_loadu_si256((__m256i const*)(bits + i));
+			__m256i const eq = _mm256_cmpeq_epi64(_mm256_and_si256(v, n), n);
+			result |= uint64_t(_mm256_movemask_pd(_mm256_castsi256_pd(eq))) << i;
+		}
+	}
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+	{
+		__m128i const n = _mm_set1_epi64x((long long)needle_bits);
+
+		for (; i + 2 <= count; i += 2)
+		{
+			// no 64bit compare in sse2, compare 32bit halves and require both to match
+			__m128i const eq32 = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128((__m128i const*)(bits + i)), n), n);
+			__m128i const eq   = _mm_and_si128(eq32, _mm_shuffle_epi32(eq32, _MM_SHUFFLE(2, 3, 0, 1)));
+			result |= uint64_t(_mm_movemask_pd(_mm_castsi128_pd(eq))) << i;
+		}
+	}
+#endif
+
+	for (; i < count; ++i)
+		result |= uint64_t((bits[i] & needle_bits) == needle_bits) << i;
+
+	return result;
+}
+
+// bloom with ids of some packet field (script_id, server_id, etc.) over a batch of packets
+struct packet_id_bloom_t : public pinba::fixlen_bloom_t<512> {};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -0,0 +1,122 @@
+#ifndef PINBA__BYTE_RING_H_
+#define PINBA__BYTE_RING_H_
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <memory>
+
+#include <boost/noncopyable.hpp>
+
+#include <meow/str_ref.hpp>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// single producer + single consumer ring of variable size records, no locks
+// records are { header_t, bytes }, padded to header size, never split between ring end and start
+// record that doesn't fit till the ring end goes to ring start, leaving wrap marker behind
+// used by datagram_capture.h and async_log.h
+
+template<uint64_t RingSize>
+struct byte_ring_t : private boost::noncopyable
+{
+	static constexpr uint64_t const ring_size = RingSize;
+	static constexpr uint64_t const mask      = RingSize - 1;
+	static_assert((RingSize & mask) == 0, "ring size must be a power of 2");
+
+	struct header_t
+	{
+		int64_t   ts;
+		uint32_t  len;
+		uint32_t  tag;  // whatever producer wants to pass along with bytes
+	};
+	static_assert(sizeof(header_t) == 16, "header_t must have no padding");
+
+	static constexpr uint32_t const wrap_marker = UINT32_MAX;
+
+	static uint64_t record_size(uint32_t len)
+	{
+		return (sizeof(header_t) + len + sizeof(header_t) - 1) & ~uint64_t(sizeof(header_t) - 1);
+	}
+
+	alignas(64) std::atomic<uint64_t>  head = {0}; // written by producer
+	alignas(64) std::atomic<uint64_t>  tail = {0}; // written by consumer
+
+	std::unique_ptr<char[]>  data { new char[RingSize] };
+
+	// producer, false = no space
+	bool push(int64_t ts, uint32_t tag, meow::str_ref const bytes)
+	{
+		uint64_t const need = record_size(bytes.size());
+		if (need > RingSize / 2)
+			return false;
+
+		uint64_t const h      = head.load(std::memory_order_relaxed);
+		uint64_t const t      = tail.load(std::memory_order_acquire);
+		uint64_t const pos    = h & mask;
+		uint64_t const to_end = RingSize - pos;
+		uint64_t const skip   = (need > to_end) ? to_end : 0;
+
+		if (h + skip + need - t > RingSize)
+			return false;
+
+		if (skip > 0)
+		{
+			header_t const marker = { 0, wrap_marker, 0 };
+			memcpy(data.get() + pos, &marker, sizeof(marker));
+		}
+
+		char *p = data.get() + ((h + skip) & mask);
+
+		header_t const hdr = { ts, uint32_t(bytes.size()), tag };
+		memcpy(p, &hdr, sizeof(hdr));
+		memcpy(p + sizeof(hdr), bytes.data(), bytes.size());
+
+		head.store(h + skip + need, std::memory_order_release);
+		return true;
+	}
+
+	// consumer, calls func(ts, tag, bytes) for every record, returns false as soon as func does (record is left in ring then)
+	template<class Function>
+	bool drain(Function const& func)
+	{
+		uint64_t const h = head.load(std::memory_order_acquire);
+		uint64_t       t = tail.load(std::memory_order_relaxed);
+
+		bool result = true;
+
+		while (t < h)
+		{
+			uint64_t const pos = t & mask;
+
+			header_t hdr;
+			memcpy(&hdr, data.get() + pos, sizeof(hdr));
+
+			if (hdr.len == wrap_marker)
+			{
+				t += RingSize - pos;
+				continue;
+			}
+
+			if (!func(hdr.ts, hdr.tag, meow::str_ref { data.get() + pos + sizeof(hdr), hdr.len }))
+			{
+				result = false;
+				break;
+			}
+
+			t += record_size(hdr.len);
+		}
+
+		tail.store(t, std::memory_order_release);
+		return result;
+	}
+
+	// consumer, nothing to drain
+	bool empty() const
+	{
+		return tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire);
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__BYTE_RING_H_
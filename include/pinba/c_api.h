@@ -0,0 +1,165 @@
+#ifndef PINBA__C_API_H_
+#define PINBA__C_API_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// plain-C api, for embedding the library into non-c++ programs (think go server with cgo)
+//
+// everything is built to make as few calls across the language boundary as possible
+//  - rows are read in pages, keys as word ids, data as fixed layout structs
+//  - word ids are resolved to strings in batches, strings are not copied, they point to dictionary memory
+//    and stay valid while the snapshot they came from is alive
+//
+// errors: functions return 0 (or a valid pointer) on success, -1 (or NULL) on failure,
+//         pinba2_last_error() has the message then (thread local, valid until the next failing call)
+//
+// threading: engine functions are thread safe, snapshot functions are not (use one snapshot per thread)
+// there can only be one engine per process, library has global state
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pinba2_engine   pinba2_engine_t;
+typedef struct pinba2_snapshot pinba2_snapshot_t;
+typedef struct pinba2_tick_subscription pinba2_tick_subscription_t;
+
+char const* pinba2_last_error(void);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// engine
+
+// zero values mean defaults
+typedef struct pinba2_options
+{
+	char const *net_address;       // default: "0.0.0.0"
+	char const *net_port;          // default: "30002"
+	uint32_t    udp_threads;       // default: 4
+	uint32_t    repacker_threads;  // default: 4
+} pinba2_options_t;
+
+// create and start the engine (starts listening for packets immediately)
+pinba2_engine_t* pinba2_engine_start(pinba2_options_t const *options);
+
+// stop the engine and free it, all snapshots must be freed before this
+void pinba2_engine_stop(pinba2_engine_t *engine);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// reports
+
+// same values as REPORT_KIND__*
+#define PINBA2_REPORT_KIND__REQUEST 0
+#define PINBA2_REPORT_KIND__TIMER   1
+#define PINBA2_REPORT_KIND__PACKET  2
+
+typedef struct pinba2_report_conf
+{
+	char const        *name;             // must be unique
+	int                kind;             // PINBA2_REPORT_KIND__*
+
+	uint64_t           time_window_ms;
+	uint32_t           tick_count;       // time_window is split into this many ticks
+
+	// keys, same as in mysql table comments
+	// ~host, ~script, ~server, ~schema, ~status - request fields
+	// +<name> - request tag, @<name> - timer tag (timer reports only)
+	// packet reports have no keys
+	char const* const *keys;
+	uint32_t           n_keys;
+
+	// histograms, for percentiles, hv_bucket_count = 0 - no histograms
+	uint32_t           hv_bucket_count;
+	uint64_t           hv_bucket_ns;
+	uint64_t           hv_min_ns;
+} pinba2_report_conf_t;
+
+int pinba2_report_add(pinba2_engine_t *engine, pinba2_report_conf_t const *conf);
+int pinba2_report_delete(pinba2_engine_t *engine, char const *name);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// snapshots
+
+typedef struct pinba2_snapshot_info
+{
+	int       kind;            // PINBA2_REPORT_KIND__*, selects row struct for pinba2_snapshot_read()
+	uint32_t  n_key_parts;
+	uint64_t  n_rows;
+	uint64_t  time_window_ns;
+	uint32_t  tick_count;
+	uint64_t  time_window_covered_ns;  // actually covered by data, less than time_window_ns until history fills up, use for rates
+} pinba2_snapshot_info_t;
+
+typedef struct pinba2_row___by_request
+{
+	uint64_t  req_count;
+	uint64_t  distinct_count;
+	int64_t   time_total_ns;
+	int64_t   ru_utime_ns;
+	int64_t   ru_stime_ns;
+	uint64_t  traffic;
+	uint64_t  mem_used;
+} pinba2_row___by_request_t;
+
+typedef struct pinba2_row___by_timer
+{
+	uint64_t  req_count;
+	uint64_t  hit_count;
+	int64_t   time_total_ns;
+	int64_t   ru_utime_ns;
+	int64_t   ru_stime_ns;
+} pinba2_row___by_timer_t;
+
+typedef struct pinba2_row___by_packet
+{
+	uint64_t  req_count;
+	uint64_t  timer_count;
+	int64_t   time_total_ns;
+	int64_t   ru_utime_ns;
+	int64_t   ru_stime_ns;
+	uint64_t  traffic;
+	uint64_t  mem_used;
+} pinba2_row___by_packet_t;
+
+typedef struct pinba2_str
+{
+	char const *data;
+	size_t      len;
+} pinba2_str_t;
+
+// prepared snapshot of report data, shared with other readers of the same report tick
+pinba2_snapshot_t* pinba2_snapshot_get(pinba2_engine_t *engine, char const *report_name);
+void               pinba2_snapshot_free(pinba2_snapshot_t *snapshot);
+
+int pinba2_snapshot_info(pinba2_snapshot_t *snapshot, pinba2_snapshot_info_t *info);
+
+// read up to max_rows rows from the cursor, advance the cursor, return number of rows read (0 at the end)
+// key_ids - max_rows * n_key_parts word ids, row after row
+// rows    - max_rows of pinba2_row___by_<kind>_t, for kind in pinba2_snapshot_info_t
+size_t pinba2_snapshot_read(pinba2_snapshot_t *snapshot, uint32_t *key_ids, void *rows, size_t max_rows);
+
+// move cursor back to the first row
+void pinba2_snapshot_rewind(pinba2_snapshot_t *snapshot);
+
+// word ids -> strings, word id 0 is an empty string
+void pinba2_snapshot_resolve(pinba2_snapshot_t *snapshot, uint32_t const *word_ids, size_t n, pinba2_str_t *out);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// tick subscriptions, every report tick pushed as it's merged (timer reports only, see include/pinba/tick_subscription.h)
+
+// up to max_queued ticks are kept for a subscriber not keeping up, it's dropped after that
+pinba2_tick_subscription_t* pinba2_tick_subscribe(pinba2_engine_t *engine, char const *report_name, uint32_t max_queued);
+void                        pinba2_tick_unsubscribe(pinba2_tick_subscription_t *sub); // frees sub as well
+
+// wait up to timeout_ms for the next tick, tick is a single tick in report_persist format (keys are strings)
+// returns 1 - got a tick (data is valid until the next call), 0 - timeout, -1 - dropped (or report is gone), nothing left to read
+int pinba2_tick_next(pinba2_tick_subscription_t *sub, uint32_t timeout_ms, pinba2_str_t *tick);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__C_API_H_
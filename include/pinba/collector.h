@@ -6,49 +6,134 @@
 #include <meow/unix/time.hpp>
 
 #include "pinba/globals.h"
-#include "pinba/nmsg_socket.h" // nmsg_message_ex_t
+#include "pinba/nmsg_socket.h"
+#include "pinba/nmsg_ring.h"
+#include "pinba/object_pool.h" // pooled_object_t
 
 #include "misc/nmpa.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+// network datagram formats
+//  v0 - single raw protobuf Pinba.Request
+//  v1 - <version:4><flags:12><original_data_len:16> header + single request (maybe compressed)
+//  v2 - <version:4><flags:12><request_count:16> header + payload (maybe compressed as one lz4 block)
+//       payload is `request_count` frames, each is <length:16><Pinba.Request bytes>, all ints are big-endian
+//       i.e. multiple requests per datagram, to save on per-packet overhead for high-rate clients
+
 #define PINBA_NET_DATAGRAM_FLAG___COMPRESSED_LZ4 (1 << 0)
 
+// max size of decompressed datagram payload, v2 datagrams can carry more than udp message size when compressed
+#define PINBA_NET_DATAGRAM_MAX_DECOMPRESSED_SIZE (256 * 1024)
+
 struct net_datagram_t // network datagram
 {
 	uint8_t   version;
 	uint32_t  flags;
-	str_ref   data; // without header, if any
+	str_ref   data;          // without header, if any
+	uint32_t  request_count; // number of requests in data, v2 only, 1 otherwise
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 // these are sent over PUSH/PULL channel
 struct raw_request_t
-	: public nmsg_message_ex_t<raw_request_t>
+	: public pooled_object_t<raw_request_t>
 {
 	struct nmpa_s   nmpa;
 	uint32_t        request_count;
-	Pinba__Request **requests;
+	Pinba__Request **requests;   // unpacked requests, NULL if collector defers decoding (see collector_conf_t::defer_decode)
+	str_ref         *datagrams;  // raw request bytes (in nmpa) if collector defers decoding, NULL otherwise
+
+	uint32_t        max_requests;
+	bool            raw_datagrams;
+
+	timeval_t       created_tv;  // monotonic, when the first datagram got in, see pipeline_latency.h
+
+	size_t          mem_charged; // nmpa memory accounted in pinba_stats_t::inflight_mem, see charge_mem()
 
-	raw_request_t(uint32_t max_requests, size_t nmpa_block_sz)
+	raw_request_t(uint32_t max_requests, size_t nmpa_block_sz, bool raw_datagrams = false)
+		: max_requests(max_requests)
+		, raw_datagrams(raw_datagrams)
+		, mem_charged(0)
 	{
 		PINBA_STATS_(objects).n_raw_batches++;
 
 		nmpa_init(&nmpa, nmpa_block_sz);
-		request_count = 0;
-		requests = (Pinba__Request**)nmpa_alloc(&nmpa, sizeof(requests[0]) * max_requests);
+		this->reset();
 	}
 
 	~raw_request_t()
 	{
+		this->credit_mem();
 		nmpa_free(&nmpa);
 
 		PINBA_STATS_(objects).n_raw_batches--;
 	}
+
+	// object_pool_t support, keep nmpa blocks, but forget everything allocated from them
+	void pool_recycle()
+	{
+		this->credit_mem();
+		nmpa_empty(&nmpa);
+		this->reset();
+	}
+
+	// fresh (or just recycled) batch only, see nmpa_block_sizer_t
+	void set_nmpa_block_size(size_t nmpa_block_sz)
+	{
+		if (nmpa.block_sz == nmpa_block_sz)
+			return;
+
+		assert(request_count == 0 && mem_charged == 0);
+
+		nmpa_empty(&nmpa);
+		nmpa_set_block_sz(&nmpa, nmpa_block_sz);
+		this->reset();
+	}
+
+	// batch is complete and is about to be sent, memory is in flight until it's recycled or destroyed
+	void charge_mem()
+	{
+		assert(mem_charged == 0);
+
+		mem_charged = nmpa_mem_used(&nmpa);
+		PINBA_STATS_(inflight_mem).raw_batches += mem_charged;
+	}
+
+private:
+
+	void credit_mem()
+	{
+		if (mem_charged == 0)
+			return;
+
+		PINBA_STATS_(inflight_mem).raw_batches -= mem_charged;
+		mem_charged = 0;
+	}
+
+	void reset()
+	{
+		request_count = 0;
+		requests  = NULL;
+		datagrams = NULL;
+		created_tv = {0,0};
+
+		if (raw_datagrams)
+			datagrams = (str_ref*)nmpa_alloc(&nmpa, sizeof(datagrams[0]) * max_requests);
+		else
+			requests = (Pinba__Request**)nmpa_alloc(&nmpa, sizeof(requests[0]) * max_requests);
+	}
 };
 using raw_request_ptr = boost::intrusive_ptr<raw_request_t>;
 
+// how udp reader threads receive packets
+#define PINBA_COLLECTOR_BACKEND__AUTO      0  // recvmmsg() if available, recv() otherwise
+#define PINBA_COLLECTOR_BACKEND__RECV      1  // poll() + recv() for every packet
+#define PINBA_COLLECTOR_BACKEND__RECVMMSG  2  // poll() + recvmmsg() batches
+#define PINBA_COLLECTOR_BACKEND__IO_URING  3  // io_uring multishot recvmsg into provided buffers, falls back to AUTO if unavailable
+#define PINBA_COLLECTOR_BACKEND__AF_XDP    4  // AF_XDP socket per rx queue of xdp_interface (+ regular sockets for the rest), falls back to AUTO if unavailable
+
 struct collector_conf_t
 {
 	std::string  address;
@@ -61,6 +146,32 @@ struct collector_conf_t
 
 	uint32_t     batch_size;     // max number of messages to return in batch
 	duration_t   batch_timeout;  // max time to wait to assemble a batch
+
+	uint32_t     backend;        // PINBA_COLLECTOR_BACKEND__*
+	std::string  xdp_interface;  // network interface for AF_XDP backend, reader thread N takes its rx queue N
+	bool         defer_decode;   // don't unpack protobuf, pass raw bytes to repacker, that decodes them straight to packet_t
+
+	pinba_cpu_list_t cpus;       // run reader threads on these cpus, empty = anywhere
+	pinba_thread_sched_t sched;  // reader threads scheduling, see pinba_set_thread_sched()
+
+	// pin every reader thread to a single cpu (see collector_conf___steering_cpu()) and make kernel pick its socket
+	// for datagrams that were received (softirq) on that cpu, instead of hashing flows over sockets
+	// needs nic rx queue irqs spread over the same cpus (see /proc/irq/*/smp_affinity_list, or irqbalance with a hint policy)
+	bool         cpu_steering;
+
+	size_t       socket_rcvbuf_size; // SO_RCVBUF for each socket, 0 = keep system default
+
+	nmsg_ring_ptr<raw_request_t> out_ring; // send raw requests here instead of nn_output, if set
+
+	// low latency mode (recvmmsg reader only), 0 spins = off
+	// keep calling non-blocking recvmmsg() up to busy_poll_spins times in a row while socket is empty, before going back to poll()
+	// with busy_poll_usec > 0 sockets also get SO_BUSY_POLL (+ SO_PREFER_BUSY_POLL), i.e. kernel polls the nic on every empty recv
+	uint32_t     busy_poll_spins;
+	uint32_t     busy_poll_usec;
+
+	// opt in to UDP_GRO on recvmmsg reader sockets, kernel coalesces same-size datagrams of a flow into one message (up to 64KB)
+	// that is split back into datagrams here, saves on per datagram skbs and recvmmsg slots
+	bool         gro;
 };
 
 struct collector_t
@@ -69,12 +180,26 @@ struct collector_t
 
 	virtual void startup() = 0;
 	virtual void shutdown() = 0;
+
+	// resize reader thread pool at runtime, new threads bind sockets of their own (same as on startup)
+	// stopped threads send datagrams received so far and close their sockets, datagrams still queued there are lost
+	// not supported with cpu_steering and AF_XDP backend, as both are set up for startup thread count
+	virtual pinba_error_t set_thread_count(uint32_t n_threads) = 0;
+	virtual uint32_t      thread_count() const = 0;
 };
 
 typedef std::unique_ptr<collector_t> collector_ptr;
 
 collector_ptr create_collector(pinba_globals_t*, collector_conf_t*);
 
+// cpu that reader thread is pinned to with cpu_steering: cpus[thread_id] (wrapping around), or just thread_id if cpus are empty
+inline uint32_t collector_conf___steering_cpu(collector_conf_t const *conf, uint32_t thread_id)
+{
+	return (conf->cpus.empty())
+		? thread_id
+		: conf->cpus[thread_id % conf->cpus.size()];
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 #endif // PINBA__COLLECTOR_H_
\ No newline at end of file
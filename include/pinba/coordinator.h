@@ -1,7 +1,14 @@
 #ifndef PINBA__COORDINATOR_H_
 #define PINBA__COORDINATOR_H_
 
+#include <functional>
+#include <future>
+#include <string>
+#include <vector>
+
 #include "pinba/globals.h"
+#include "pinba/nmsg_ring.h"
+#include "pinba/repacker.h"  // packet_batch_t
 #include "pinba/report.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -13,6 +20,35 @@ struct coordinator_conf_t
 
 	std::string  nn_control;              // control messages received here (binds, REP)
 	size_t       nn_report_input_buffer;  // report_handler uses this as NN_RCVBUF
+
+	pinba_cpu_list_t relay_cpus;          // run packet relay threads on these cpus, empty = anywhere
+	pinba_thread_sched_t relay_sched;     // packet relay threads scheduling, see pinba_set_thread_sched()
+	uint32_t     relay_threads;           // relay thread + (relay_threads - 1) fanout threads, splitting report hosts between them
+	                                      // relay thread still receives every batch once, 0 or 1 = one relay thread for everything
+	pinba_cpu_list_t report_cpus;         // run report threads on these cpus, empty = anywhere
+	pinba_thread_sched_t report_sched;    // report threads scheduling
+	pinba_thread_sched_t snapshot_merge_sched; // snapshot prewarm thread scheduling, select side work, can be below ingestion
+
+	// called with new prefilter every time reports are added or removed (and on startup), can be empty
+	std::function<void(packet_prefilter_ptr)> on_packet_prefilter;
+
+	nmsg_ring_ptr<packet_batch_t> in_ring; // read batches from here instead of nn_input, if set
+
+	uint32_t     report_ring_size;        // relay publishes batches to all reports through one nmsg_broadcast_ring_t of this size
+	                                      // 0 = nanomsg socket per report (nn_report_input_buffer)
+
+	uint32_t     report_fuse_max;         // run up to this many compatible reports in one thread, aggregating each batch once for all of them
+	                                      // 0 or 1 = thread per report
+
+	uint32_t     report_executor_threads; // run reports (single aggregator ones, not fused) as tasks on this many shared threads (see report_executor_t)
+	                                      // 0 = thread per report
+
+	duration_t   report_tick_stagger;     // spread report ticks of the same interval over this much time, 0 = all at once (see report_ticker_conf_t)
+
+	uint32_t     snapshot_prewarm_min_qpm; // reports getting at least this many prepared snapshot selects per minute (decayed average) are hot
+	                                       // their snapshots are prepared in background right after every tick, selects find them ready
+	                                       // 0 = off, snapshots are only prepared by selects
+	uint64_t     snapshot_prewarm_max_mem; // max estimated memory of snapshots of hot reports, hottest ones first, 0 = no limit
 };
 
 struct coordinator_t : private boost::noncopyable
@@ -23,9 +59,37 @@ struct coordinator_t : private boost::noncopyable
 	virtual void shutdown() = 0;
 
 	virtual pinba_error_t       add_report(report_ptr report) = 0;
+
+	// same as add_report() for every report, but report threads are started (and load their history) all at once
+	// returns an error per report, in the same order
+	virtual std::vector<pinba_error_t> add_reports(std::vector<report_ptr> const& reports) = 0;
+
 	virtual pinba_error_t       delete_report(std::string const& name) = 0;
 	virtual report_snapshot_ptr get_report_snapshot(std::string const& name) = 0;
+
+	// same as get_report_snapshot(), caller gets future right away and can do its own setup while snapshot is taken
+	// requests are run on a small fixed pool of threads and queue per report, not on coordinator lock (errors are in the future)
+	virtual std::future<report_snapshot_ptr> get_report_snapshot_async(std::string const& name) = 0;
+
+	// snapshots of several reports (not prepared), in the same order as names, all cut at the same moment
+	// i.e. no report ticks between any two of them, so totals from different reports line up
+	// one request per report host thread, all of them stop until every host has got the request
+	virtual std::vector<report_snapshot_ptr> get_report_snapshots(std::vector<std::string> const& names) = 0;
+
+	// report data only changes on tick, so snapshot prepared after the last tick is kept
+	// and given to all selects coming before the next one (concurrent ones wait for the first merge to finish)
+	// returned snapshot is prepared already, prepare() on it is a no-op
+	virtual report_snapshot_ptr get_prepared_report_snapshot(std::string const& name, report_snapshot_t::merge_flags_t flags) = 0;
 	virtual report_state_ptr    get_report_state(std::string const& name) = 0;
+
+	// select wants percentiles from report, histograms are collected for a while after that (see report_stats___hv_collect())
+	virtual void                report_hv_wanted(std::string const& name) = 0;
+
+	// tick from edge pinba, merged into report history in report thread (see federation.h)
+	virtual pinba_error_t       merge_remote_tick(std::string const& name, std::string tick_data) = 0;
+
+	// subscriber gets every tick of the report from now on, right after it's merged (see tick_subscription.h)
+	virtual pinba_error_t       subscribe_to_ticks(std::string const& name, report_tick_subscription_ptr) = 0;
 };
 typedef std::unique_ptr<coordinator_t> coordinator_ptr;
 
@@ -0,0 +1,47 @@
+#ifndef PINBA__DATAGRAM_CAPTURE_H_
+#define PINBA__DATAGRAM_CAPTURE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include "pinba/globals.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// raw udp datagram recording, to reproduce incident traffic offline (see pinba_options_t::datagram_capture_path)
+//
+// collector threads push every datagram they get (as is, before any parsing) into rings of their own,
+// single producer + single consumer, no locks, datagrams are dropped when the ring is full (writer is behind)
+// writer thread drains rings into a memory-mapped file, preallocated to max size
+// when the file is full it's renamed to <path>.1 (replacing the previous one) and a new file is started
+// same happens on startup, so that restart doesn't overwrite a capture of what made us restart
+//
+// bench/pinba_bench --replay reads these files (as well as its own --record ones), with --replay-speed to keep original timing
+//
+// file format, all ints are in host byte order
+//   header   magic:u32, version:u32
+//   records  { ts:i64 (realtime, nanoseconds), len:u32, len bytes }, until end of file or first zero len record (file wasn't closed)
+
+#define PINBA_DATAGRAM_CAPTURE_MAGIC    0x31444250 // "PBD1"
+#define PINBA_DATAGRAM_CAPTURE_VERSION  1
+
+struct datagram_capture_t : private boost::noncopyable
+{
+	static constexpr uint32_t const max_threads = 1024;             // collector threads, same as collector max
+	static constexpr uint32_t const ring_size   = 4 * 1024 * 1024;  // per collector thread, allocated on first push
+
+	virtual ~datagram_capture_t() {}
+
+	// collector thread thread_id only, never blocks
+	virtual void push(uint32_t thread_id, str_ref datagram) = 0;
+};
+using datagram_capture_ptr = std::unique_ptr<datagram_capture_t>;
+
+// starts writer thread, stops it on destruction (writing out what's left in rings)
+datagram_capture_ptr create_datagram_capture(pinba_globals_t*, std::string const& path, uint64_t max_file_size);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__DATAGRAM_CAPTURE_H_
@@ -1,9 +1,17 @@
 #ifndef PINBA__DICTIONARY_H_
 #define PINBA__DICTIONARY_H_
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <string>
 #include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <pthread.h>
 
@@ -12,7 +20,9 @@
 #include "t1ha/t1ha.h"
 
 #include "pinba/globals.h"
+#include "pinba/dictionary_arena.h"
 #include "pinba/hash.h"
+#include "pinba/probes.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -96,6 +106,83 @@ struct scoped_write_lock_t : private boost::noncopyable
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+// append-only list of T, elements and chunk directory never move once published
+// so elements can be read without locks, while a (single, externally synchronized) writer appends
+// that's why deque won't do - it moves the chunk directory
+// chunk k holds (first_chunk_size << k) elements, so a fixed small directory covers the whole uint32_t range
+template<class T>
+struct dictionary_chunked_list_t : private boost::noncopyable
+{
+	static constexpr uint32_t const first_chunk_bits = 10;
+	static constexpr uint32_t const max_chunks       = 32 - first_chunk_bits;
+
+	dictionary_chunked_list_t()
+	{
+		for (auto& chunk : chunks_)
+			chunk.store(nullptr, std::memory_order_relaxed);
+	}
+
+	~dictionary_chunked_list_t()
+	{
+		for (auto& chunk : chunks_)
+			delete [] chunk.load(std::memory_order_relaxed);
+	}
+
+	// safe to call without lock, for elements that have been published with emplace_back()
+	uint32_t size() const
+	{
+		return size_.load(std::memory_order_acquire);
+	}
+
+	T& operator[](uint32_t offset)
+	{
+		auto const pos = position_for_offset(offset);
+		return chunks_[pos.first].load(std::memory_order_acquire)[pos.second];
+	}
+
+	T const& operator[](uint32_t offset) const
+	{
+		return const_cast<dictionary_chunked_list_t&>(*this)[offset];
+	}
+
+	T& back()
+	{
+		return (*this)[size_.load(std::memory_order_relaxed) - 1];
+	}
+
+	// writer only, externally synchronized
+	void emplace_back()
+	{
+		uint32_t const offset = size_.load(std::memory_order_relaxed);
+		auto const pos = position_for_offset(offset);
+
+		if (pos.second == 0) // first element in chunk, allocate it
+		{
+			assert(pos.first < max_chunks);
+			chunks_[pos.first].store(new T[size_t(1) << (pos.first + first_chunk_bits)], std::memory_order_release);
+		}
+
+		size_.store(offset + 1, std::memory_order_release);
+	}
+
+private:
+
+	// offset -> (chunk index, offset in chunk)
+	static inline std::pair<uint32_t, uint64_t> position_for_offset(uint32_t offset)
+	{
+		uint64_t const i     = uint64_t(offset) + (uint64_t(1) << first_chunk_bits);
+		uint32_t const chunk = (63 - __builtin_clzll(i)) - first_chunk_bits;
+
+		return { chunk, i - (uint64_t(1) << (chunk + first_chunk_bits)) };
+	}
+
+private:
+	std::array<std::atomic<T*>, max_chunks>  chunks_;
+	std::atomic<uint32_t>                    size_ = {0};
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
 struct dictionary_word_hasher_t
 {
 	inline uint64_t operator()(str_ref const& key) const
@@ -112,6 +199,316 @@ struct dictionary_memory_t
 	uint64_t strings_bytes;
 };
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// word matchers, for report filters on patterns (prefixes, regexes), see dictionary_t::add_word_matcher()
+// every word is tested against every registered matcher once, when it's added to dictionary
+// results are bits in the word itself, so checking a packet word is one load, and strings are never looked at per packet
+
+using dictionary_word_match_func_t = std::function<bool(str_ref)>;
+
+struct dictionary_word_matchers_t : private boost::noncopyable
+{
+	static constexpr uint32_t const max_matchers = 32; // bits in word_t::match_bits
+
+	std::atomic<uint32_t>         active = {0}; // bits of registered matchers, funcs are set before their bit
+	dictionary_word_match_func_t  funcs[max_matchers];
+
+	// called by writers, under lock of the dictionary (or shard) word is being added to
+	uint32_t match(str_ref const word) const
+	{
+		uint32_t bits   = active.load(std::memory_order_acquire);
+		uint32_t result = 0;
+
+		while (bits != 0)
+		{
+			uint32_t const bit = __builtin_ctz(bits);
+			bits &= bits - 1;
+
+			if (funcs[bit](word))
+				result |= (uint32_t(1) << bit);
+		}
+
+		return result;
+	}
+};
+
+struct dictionary_word_matcher_t;
+using dictionary_word_matcher_ptr = std::shared_ptr<dictionary_word_matcher_t>;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// integer words, tag values clients send as numbers instead of strings (see pinba_request_to_packet())
+// these are never interned, word id is the value itself with top two bits set (permanent_dictionary_t ids have top bit only)
+// so everyone treats them as permanent words: no refcounts, never removed, nothing to reap
+// strings are only made on get_word(), i.e. when keys are rendered, and are kept forever (any snapshot might hold any id)
+
+struct dictionary_int_words_t : private boost::noncopyable
+{
+	static constexpr uint32_t const id_bits   = 0xC0000000;
+	static constexpr uint32_t const value_max = 0x3FFFFFFE; // all bits set would be PINBA_INTERNAL___EMPTY_KEY_PART
+
+	static bool is_int_id(uint32_t word_id)
+	{
+		return (word_id & id_bits) == id_bits;
+	}
+
+	static uint32_t id_from_value(uint32_t value)
+	{
+		return id_bits | value;
+	}
+
+	static uint32_t value_from_id(uint32_t word_id)
+	{
+		return word_id & ~id_bits;
+	}
+
+	// id of decimal integer word, as get_word() would render it (no sign, no leading zeroes), 0 if it's not one
+	static uint32_t id_from_str(str_ref const s)
+	{
+		if (s.size() == 0 || s.size() > 10 || (s.size() > 1 && s[0] == '0'))
+			return 0;
+
+		uint64_t value = 0;
+		for (char const c : s)
+		{
+			if (c < '0' || c > '9')
+				return 0;
+			value = value * 10 + (c - '0');
+		}
+
+		return (value <= value_max) ? id_from_value(uint32_t(value)) : 0;
+	}
+
+	str_ref get_word(uint32_t word_id) const
+	{
+		std::lock_guard<std::mutex> lk_(mtx_);
+
+		// map nodes never move, so strings don't either
+		auto const inserted_pair = words_.emplace(word_id, std::string{});
+		if (inserted_pair.second)
+		{
+			meow::format::type_tunnel<uint32_t>::buffer_t buf;
+			inserted_pair.first->second = meow::format::type_tunnel<uint32_t>::call(value_from_id(word_id), buf).str();
+		}
+
+		return inserted_pair.first->second;
+	}
+
+	size_t size() const
+	{
+		std::lock_guard<std::mutex> lk_(mtx_);
+		return words_.size();
+	}
+
+private:
+	mutable std::mutex                                 mtx_;
+	mutable std::unordered_map<uint32_t, std::string>  words_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// append-only dictionary, for words that are never removed
+// i.e. tag names and low-cardinality packet fields (see pinba_options_t::permanent_dictionary_fields)
+//
+// lookups (both ways) never lock, no refcounting either
+// writers are serialized with a mutex, they append the word first, and publish it in hash after that
+// hash is an open-addressing table of atomic slots, growth builds a new table and publishes it
+// old tables are kept until destruction, as readers might still be probing them (total is < 2x the last one)
+
+struct permanent_dictionary_t : private boost::noncopyable
+{
+	// all permanent word ids have top bit set, so they never clash with dictionary_t shard ids
+	// and the next one clear, that's dictionary_int_words_t ids
+	static constexpr uint32_t const id_bit  = 0x80000000;
+	static constexpr uint32_t const id_mask = 0x7FFFFFFF;
+
+	struct word_t
+	{
+		uint32_t               id   = 0;
+		uint64_t               hash = 0;
+		std::string            str;
+		std::atomic<uint32_t>  match_bits = {0}; // see dictionary_word_matchers_t
+	};
+
+private:
+
+	// slot = (upper 32 bits of word hash << 32) | (word_offset + 1), 0 = empty
+	struct table_t
+	{
+		uint64_t                                  mask;
+		std::unique_ptr<std::atomic<uint64_t>[]>  slots;
+
+		table_t(uint64_t capacity)
+			: mask(capacity - 1)
+			, slots(new std::atomic<uint64_t>[capacity])
+		{
+			assert((capacity & mask) == 0 && "capacity must be a power of 2");
+
+			for (uint64_t i = 0; i < capacity; i++)
+				slots[i].store(0, std::memory_order_relaxed);
+		}
+
+		uint64_t capacity() const
+		{
+			return mask + 1;
+		}
+	};
+	using table_ptr = std::unique_ptr<table_t>;
+
+	std::mutex                            mtx_;         // writers only
+	dictionary_chunked_list_t<word_t>     words_;
+	std::atomic<table_t*>                 table_;       // current table, owned by tables_
+	std::vector<table_ptr>                tables_;      // current + retired
+	std::atomic<uint64_t>                 mem_used_by_word_strings_;
+	dictionary_word_matchers_t const      *matchers_ = nullptr;
+
+public:
+
+	permanent_dictionary_t(uint64_t initial_capacity = 1024)
+		: mem_used_by_word_strings_(0)
+	{
+		tables_.emplace_back(new table_t(initial_capacity));
+		table_.store(tables_.back().get(), std::memory_order_release);
+	}
+
+	// new words are tested against these, set once, before any words are added
+	void set_word_matchers(dictionary_word_matchers_t const *matchers)
+	{
+		matchers_ = matchers;
+	}
+
+	// caller must make sure word_id has come from this dictionary
+	uint32_t word_match_bits(uint32_t word_id) const
+	{
+		uint32_t const word_offset = (word_id & id_mask) - 1;
+		return words_[word_offset].match_bits.load(std::memory_order_relaxed);
+	}
+
+	// func(word_t&) for every word, with writers locked out, see dictionary_t::add_word_matcher()
+	template<class Function>
+	void for_each_word___writers_locked(Function const& func)
+	{
+		std::lock_guard<std::mutex> lk_(mtx_);
+
+		for (uint32_t i = 0, n = words_.size(); i < n; i++)
+			func(words_[i]);
+	}
+
+	uint32_t size() const
+	{
+		return words_.size();
+	}
+
+	dictionary_memory_t memory_used() const
+	{
+		dictionary_memory_t result = {};
+		result.hash_bytes     = table_.load(std::memory_order_acquire)->capacity() * sizeof(uint64_t);
+		result.wordlist_bytes = words_.size() * sizeof(word_t);
+		result.strings_bytes  = mem_used_by_word_strings_.load(std::memory_order_relaxed);
+		return result;
+	}
+
+	// caller must make sure word_id has come from this dictionary
+	str_ref get_word(uint32_t word_id) const
+	{
+		uint32_t const word_offset = (word_id & id_mask) - 1;
+
+		assert((word_offset < words_.size()) && "word_offset >= words.size(), bad permanent word_id reference");
+		return str_ref { words_[word_offset].str };
+	}
+
+	// nullptr if not found
+	word_t const* find(str_ref word, uint64_t word_hash) const
+	{
+		table_t const *t = table_.load(std::memory_order_acquire);
+		return this->find_in_table(t, word, word_hash);
+	}
+
+	word_t const* get_or_add(str_ref word, uint64_t word_hash)
+	{
+		// fastpath, no lock
+		if (word_t const *w = this->find(word, word_hash))
+			return w;
+
+		std::lock_guard<std::mutex> lk_(mtx_);
+
+		// recheck, might've been added while we were waiting for the lock
+		// or we might've been looking at retired table
+		table_t *t = table_.load(std::memory_order_relaxed);
+
+		if (word_t const *w = this->find_in_table(t, word, word_hash))
+			return w;
+
+		// keep load factor <= 0.5, so that probing always ends on empty slot quickly
+		if ((uint64_t(words_.size()) + 1) * 2 > t->capacity())
+			t = this->grow___locked(t);
+
+		uint32_t const word_offset = words_.size();
+		assert(((word_offset + 1) & dictionary_int_words_t::id_bits) == 0);
+
+		words_.emplace_back();
+		word_t& w = words_.back();
+		w.id   = (word_offset + 1) | id_bit;
+		w.hash = word_hash;
+		w.str  = word.str();
+		w.match_bits.store((matchers_) ? matchers_->match(word) : 0, std::memory_order_relaxed);
+
+		mem_used_by_word_strings_.fetch_add(word.size(), std::memory_order_relaxed);
+
+		// publish, word contents are visible to whoever sees the slot
+		this->insert_slot(t, word_offset, word_hash);
+
+		PINBA_PROBE2(dictionary_insert, w.id, w.str.c_str());
+
+		return &w;
+	}
+
+private:
+
+	static uint64_t make_slot(uint32_t word_offset, uint64_t word_hash)
+	{
+		return (word_hash & 0xFFFFFFFF00000000ULL) | (uint64_t(word_offset) + 1);
+	}
+
+	word_t const* find_in_table(table_t const *t, str_ref word, uint64_t word_hash) const
+	{
+		uint64_t const hash_tag = word_hash & 0xFFFFFFFF00000000ULL;
+
+		for (uint64_t i = word_hash & t->mask; ; i = (i + 1) & t->mask)
+		{
+			uint64_t const slot = t->slots[i].load(std::memory_order_acquire);
+			if (slot == 0)
+				return nullptr;
+
+			if ((slot & 0xFFFFFFFF00000000ULL) != hash_tag)
+				continue;
+
+			word_t const& w = words_[uint32_t(slot) - 1];
+			if ((w.hash == word_hash) && (str_ref { w.str } == word))
+				return &w;
+		}
+	}
+
+	static void insert_slot(table_t *t, uint32_t word_offset, uint64_t word_hash)
+	{
+		uint64_t i = word_hash & t->mask;
+		while (t->slots[i].load(std::memory_order_relaxed) != 0)
+			i = (i + 1) & t->mask;
+
+		t->slots[i].store(make_slot(word_offset, word_hash), std::memory_order_release);
+	}
+
+	table_t* grow___locked(table_t *old_t)
+	{
+		tables_.emplace_back(new table_t(old_t->capacity() * 2));
+		table_t *t = tables_.back().get();
+
+		for (uint32_t i = 0, i_end = words_.size(); i < i_end; i++)
+			insert_slot(t, i, words_[i].hash);
+
+		table_.store(t, std::memory_order_release);
+		return t;
+	}
+};
+
 struct dictionary_t : private boost::noncopyable
 {
 /*
@@ -141,53 +538,11 @@ struct dictionary_t : private boost::noncopyable
 	};
 	static_assert(std::is_nothrow_move_constructible<nameword_t>::value);
 
-	struct name_words_t : private boost::noncopyable
-	{
-		struct equal_t
-		{
-			using is_transparent = void;
-
-			inline bool operator()(std::string const& l, str_ref const& r) const
-			{
-				return str_ref {l} == r;
-			}
-
-			inline bool operator()(str_ref const& l, std::string const& r) const
-			{
-				return l == str_ref{r};
-			}
-
-			inline bool operator()(std::string const& l, std::string const& r) const
-			{
-				return l == r;
-			}
-		};
-
-		using hashtable_t = tsl::robin_map<
-								  std::string
-								, nameword_t
-								, dictionary_word_hasher_t
-								, equal_t
-								, std::allocator<std::pair<std::string, nameword_t>>
-								, /*StoreHash=*/ true>;
-
-		mutable rw_mutex_t   mtx;
-		hashtable_t          hash;
-		uint64_t             mem_used_by_word_strings;
-
-		name_words_t()
-			: mtx(true) // writer priority
-			, hash(1024) // pre-size moderately
-			, mem_used_by_word_strings(0)
-		{
-		}
-	};
-
-
-	static constexpr uint32_t const shard_count   = 32;
-	static constexpr uint32_t const shard_id_bits = 5;          // number of bits in mask below
-	static constexpr uint32_t const shard_id_mask = 0xF8000000; // shard_id = top bits
-	static constexpr uint32_t const word_id_mask  = 0x07FFFFFF; // word_id  = lower bits
+	// top bit is reserved for permanent_dictionary_t ids (see permanent_dictionary_t::id_bit)
+	// shard_id = top bits (after permanent bit), as many as shard count needs, word offset in shard (+1) = lower bits
+	// i.e. 31 bits of id space are split between shards, 64M words per shard with 32 shards, 8M with 256
+	static constexpr uint32_t const default_shard_count = 32;
+	static constexpr uint32_t const max_shard_count     = 256;
 
 	struct word_t : private boost::noncopyable
 	{
@@ -198,20 +553,27 @@ struct dictionary_t : private boost::noncopyable
 
 		uint32_t    id;
 		uint64_t    hash;
-		std::string str;
+		char       *str_p;    // nul-terminated, in shard string arena, nullptr for free words
+		uint32_t    str_len;
+
+		std::atomic<uint32_t> match_bits; // see dictionary_word_matchers_t, set under shard write lock, read without it
 
 		word_t() noexcept
 			: refcount(0)
 			, id(0)
 			, hash(0)
-			, str()
+			, str_p(nullptr)
+			, str_len(0)
+			, match_bits(0)
 		{
 		}
 
-		word_t(word_t&& other) = default;
-		word_t& operator=(word_t&& other) = default;
+		str_ref str() const noexcept
+		{
+			return str_ref { str_p, str_len };
+		}
 	};
-	static_assert((sizeof(word_t) == (2*sizeof(uint32_t) + sizeof(uint64_t) + sizeof(std::string))), "word_t should have no padding");
+	static_assert((sizeof(word_t) == (4*sizeof(uint32_t) + sizeof(uint64_t) + sizeof(char*))), "word_t should have no padding");
 
 	// str_ref key   - references words_t content
 	// word_t* value - references the same word as the key
@@ -226,18 +588,176 @@ struct dictionary_t : private boost::noncopyable
 							, std::allocator<std::pair<str_ref, word_t*>>
 							, /*StoreHash=*/ true>;
 
-	// word -> word_ptr
-	struct hash_t : public hashtable_t
+	// word -> word_ptr, with incremental growth
+	//
+	// robin_map grows by rehashing everything at once, under shard write lock that stalls every repacker
+	// looking up words in the shard, for milliseconds when the shard is big
+	// so when a big table is about to grow, a new one (2x buckets) becomes current, and the old one is kept around
+	// every insert moves a few entries (migrate_step) from old to current, lookups check both
+	// old table is never inserted to or erased from while migrating (so the cursor iterator stays valid),
+	// moved and erased entries are tombstoned in place instead (value = nullptr, key = empty)
+	//
+	// all methods require shard lock (read for find(), write for the rest)
+	struct hash_t : private boost::noncopyable
 	{
-	};
+		static constexpr size_t   const incremental_min_size = 64 * 1024; // smaller tables just rehash, that's quick
+		static constexpr uint32_t const migrate_step         = 16;
 
-	// id -> word_t,
-	// deque is critical here, since `hash` stores pointers to it's elements,
-	// appends must not invalidate them
-	struct words_t : public std::deque<word_t>
-	{
+	private:
+		hashtable_t             current_;
+		hashtable_t             old_;
+		hashtable_t::iterator   old_pos_;       // migration cursor in old_
+		size_t                  old_live_  = 0; // not yet moved entries in old_
+		bool                    migrating_ = false;
+
+	public:
+
+		size_t size() const
+		{
+			return current_.size() + old_live_;
+		}
+
+		size_t bucket_count() const
+		{
+			return current_.bucket_count() + old_.bucket_count();
+		}
+
+		bool is_migrating() const
+		{
+			return migrating_;
+		}
+
+		void reserve(size_t n)
+		{
+			if (!migrating_)
+				current_.reserve(n);
+		}
+
+		// nullptr if not found
+		word_t* find(str_ref const word, uint64_t word_hash) const
+		{
+			auto const it = current_.find(word, word_hash);
+			if (it != current_.end())
+				return it->second;
+
+			if (migrating_)
+			{
+				auto const old_it = old_.find(word, word_hash);
+				if (old_it != old_.end())
+					return old_it->second; // nullptr for tombstones
+			}
+
+			return nullptr;
+		}
+
+		// same as robin_map::emplace_hash(), returned iterator is always in current table
+		// fully migrated old table is swapped to *retired, so that caller can free it outside of lock
+		std::pair<hashtable_t::iterator, bool> emplace_hash(uint64_t word_hash, str_ref const word, word_t *value, hashtable_t *retired)
+		{
+			// all moves first, current table iterators are invalidated by them
+			if (migrating_)
+			{
+				// current is about to rehash (very unlikely, it's 2x the old one), finish migration first
+				size_t const n_migrate = (current_.will_grow_on_next_insert()) ? old_live_ : migrate_step;
+				this->migrate___(n_migrate, retired);
+			}
+
+			if (!migrating_ && current_.size() >= incremental_min_size && current_.will_grow_on_next_insert())
+				this->start_migration___();
+
+			if (migrating_)
+			{
+				auto old_it = old_.find(word, word_hash);
+				if (old_it != old_.end() && old_it->second != nullptr)
+				{
+					word_t *w = old_it->second;
+					this->tombstone___(old_it);
+
+					auto const res = current_.emplace_hash(word_hash, w->str(), w);
+					assert(res.second && "word exists in both tables");
+					return { res.first, false };
+				}
+			}
+
+			return current_.emplace_hash(word_hash, word, value);
+		}
+
+		// iterator must have come from emplace_hash()
+		void erase(hashtable_t::iterator it)
+		{
+			current_.erase(it);
+		}
+
+		size_t erase(str_ref const word, uint64_t word_hash)
+		{
+			if (current_.erase(word, word_hash) > 0)
+				return 1;
+
+			if (migrating_)
+			{
+				auto old_it = old_.find(word, word_hash);
+				if (old_it != old_.end() && old_it->second != nullptr)
+				{
+					this->tombstone___(old_it);
+					return 1;
+				}
+			}
+
+			return 0;
+		}
+
+	private:
+
+		void start_migration___()
+		{
+			hashtable_t grown { current_.bucket_count() * 2 };
+
+			old_.swap(current_);
+			current_.swap(grown);
+
+			old_pos_   = old_.begin();
+			old_live_  = old_.size();
+			migrating_ = true;
+		}
+
+		void migrate___(size_t n, hashtable_t *retired)
+		{
+			for (size_t i = 0; (i < n) && (old_live_ > 0) && (old_pos_ != old_.end()); ++old_pos_)
+			{
+				word_t *w = old_pos_->second;
+				if (w == nullptr)
+					continue;
+
+				current_.emplace_hash(w->hash, w->str(), w);
+				this->tombstone___(old_pos_);
+				i++;
+			}
+
+			if (old_live_ > 0)
+				return;
+
+			// done, hand the old table over to be freed
+			retired->swap(old_);
+			hashtable_t().swap(old_);
+
+			old_pos_   = old_.end();
+			migrating_ = false;
+		}
+
+		void tombstone___(hashtable_t::iterator it)
+		{
+			// words are never empty, so empty key never matches a lookup
+			// and it doesn't reference word string any more (that is going to be freed, once word is)
+			const_cast<str_ref&>(it->first) = str_ref {};
+			it.value() = nullptr;
+			old_live_--;
+		}
 	};
 
+	// id -> word_t
+	// `hash` stores pointers to elements, and get_word() reads elements without taking shard lock
+	using words_t = dictionary_chunked_list_t<word_t>;
+
 private:
 
 	struct shard_t
@@ -246,43 +766,92 @@ private:
 
 		uint32_t      id;
 		uint32_t      freelist_head; // (offset+1) of the first elt in freelist, aka 0 -> unset, 1 -> offset == 0
-		hash_t        hash;          // TODO: shard this as well, to amortize the cost of rehash
+		hash_t        hash;
 		words_t       words;
 
-		uint64_t      mem_used_by_word_strings = 0;
+		dictionary_string_arena_t strings; // word_t::str_p point here
 	};
 
-	mutable std::array<shard_t, shard_count> shards_;
+	uint32_t const          shard_count_;
+	uint32_t const          shard_id_bits_;    // log2(shard_count_)
+	uint32_t const          shard_id_shift_;
+	uint32_t const          shard_id_mask_;
+	uint32_t const          word_id_mask_;
+	std::unique_ptr<shard_t[]> shards_;
+
+	// tag names and words for fields from permanent_fields_
+	permanent_dictionary_t  permanent_;
+	uint32_t const          permanent_fields_;
+
+	// integer tag values, rendered on demand
+	dictionary_int_words_t  int_words_;
 
-	name_words_t  name_words;
+	// registered with add_word_matcher(), mutex serializes registration only, writers never take it
+	dictionary_word_matchers_t  matchers_;
+	std::mutex                  matchers_mtx_;
+
+	// words loaded by image_load(), each one has an extra reference, until image_release()
+	std::vector<uint32_t>   image_word_ids_;
+	timeval_t               image_release_tv_ = {};
+	std::atomic<bool>       image_pending_    = { false };
+
+	// admission control for new transient words from traffic, see get_or_add___ref_if_admitted()
+	std::atomic<bool>       reject_new_words_ = { false };
+	std::atomic<uint64_t>   words_rejected_   = { 0 };
 
 public:
 
-	dictionary_t()
+	// permanent_fields - PINBA_PERMANENT_FIELD__* flags, see pinba_options_t::permanent_dictionary_fields
+	// shard_count      - power of 2, up to max_shard_count, more shards = less lock contention between repackers, but fewer words per shard
+	dictionary_t(uint32_t permanent_fields = 0, uint32_t shard_count = default_shard_count)
+		: shard_count_(shard_count)
+		, shard_id_bits_(shard_count ? __builtin_ctz(shard_count) : 0)
+		, shard_id_shift_(31 - shard_id_bits_)
+		, shard_id_mask_(uint32_t((uint64_t(shard_count) - 1) << shard_id_shift_))
+		, word_id_mask_((uint32_t(1) << shard_id_shift_) - 1)
+		, permanent_fields_(permanent_fields)
 	{
-		for (uint32_t i = 0; i < shard_count; ++i)
+		if ((shard_count == 0) || (shard_count > max_shard_count) || ((shard_count & (shard_count - 1)) != 0))
+			throw std::runtime_error(ff::fmt_str("dictionary shard count must be a power of 2 within [1, {0}], got {1}", max_shard_count, shard_count));
+
+		shards_.reset(new shard_t[shard_count_]);
+
+		for (uint32_t i = 0; i < shard_count_; ++i)
 		{
 			shard_t *shard = &shards_[i];
 
 			shard->id            = i;
 			shard->freelist_head = 0;
 		}
+
+		permanent_.set_word_matchers(&matchers_);
+	}
+
+	~dictionary_t()
+	{
+		// arenas free their pages, but strings that didn't fit a page are freed one by one
+		for (auto& shard : this->shards())
+		{
+			for (uint32_t offset = 0, n_slots = shard.words.size(); offset < n_slots; offset++)
+			{
+				word_t& w = shard.words[offset];
+				if (w.str_p)
+					shard.strings.free(w.str_p, w.str_len);
+			}
+		}
 	}
 
 	uint32_t size() const
 	{
 		uint32_t result = 0;
 
-		for (auto const& shard : shards_)
+		for (auto const& shard : this->shards())
 		{
 			scoped_read_lock_t lock_(shard.mtx);
 			result += shard.words.size();
 		}
 
-		{
-			scoped_read_lock_t lock_(name_words.mtx);
-			result += name_words.hash.size();
-		}
+		result += permanent_.size();
 
 		return result;
 	}
@@ -291,19 +860,20 @@ public:
 	{
 		dictionary_memory_t result = {};
 
-		for (auto const& shard : shards_)
+		for (auto const& shard : this->shards())
 		{
 			scoped_read_lock_t lock_(shard.mtx);
 
-			result.hash_bytes     += shard.hash.bucket_count() * sizeof(*shard.hash.begin());
-			result.wordlist_bytes += shard.words.size() * sizeof(*shard.words.begin());
-			result.strings_bytes  += shard.mem_used_by_word_strings;
+			result.hash_bytes     += shard.hash.bucket_count() * sizeof(hashtable_t::value_type);
+			result.wordlist_bytes += shard.words.size() * sizeof(word_t);
+			result.strings_bytes  += shard.strings.mem_allocated();
 		}
 
 		{
-			scoped_read_lock_t lock_(name_words.mtx);
-			result.hash_bytes    += name_words.hash.bucket_count() * sizeof(*name_words.hash.begin());
-			result.strings_bytes += name_words.mem_used_by_word_strings;
+			dictionary_memory_t const pm = permanent_.memory_used();
+			result.hash_bytes     += pm.hash_bytes;
+			result.wordlist_bytes += pm.wordlist_bytes;
+			result.strings_bytes  += pm.strings_bytes;
 		}
 
 		return result;
@@ -313,38 +883,68 @@ public:
 
 	nameword_t get_nameword(str_ref word) const
 	{
-		uint64_t const word_hash = hash_dictionary_word(word);
-
-		scoped_read_lock_t lock_(name_words.mtx);
+		return this->get_nameword(word, hash_dictionary_word(word));
+	}
 
-		auto const it = name_words.hash.find(word, word_hash);
-		if (it == name_words.hash.end())
+	// same as above, but with precalculated word_hash
+	// names live in permanent dictionary, so this never locks
+	// NOTE: permanent field values are found here as well, that's harmless, reports only look for ids they've added
+	nameword_t get_nameword(str_ref word, uint64_t word_hash) const
+	{
+		permanent_dictionary_t::word_t const *w = permanent_.find(word, word_hash);
+		if (!w)
 			return {};
 
-		return it->second;
+		return make_nameword(w);
 	}
 
 	nameword_t add_nameword(str_ref word)
 	{
-		uint64_t const word_hash = hash_dictionary_word(word);
+		if (!word)
+			return {};
 
-		scoped_write_lock_t lock_(name_words.mtx);
+		return make_nameword(permanent_.get_or_add(word, hash_dictionary_word(word)));
+	}
 
-		uint32_t const word_id = name_words.hash.size() + 1;
+public:
 
-		nameword_t nw = {
-			.id       = word_id,
-			.id_hash  = pinba::hash_number(word_id),
-			.str_hash = word_hash,
-		};
+	uint32_t permanent_fields() const
+	{
+		return permanent_fields_;
+	}
+
+	bool is_permanent_field(uint32_t field_flag) const
+	{
+		return (permanent_fields_ & field_flag) != 0;
+	}
+
+	// get or add a word for packet field with given PINBA_PERMANENT_FIELD__* flag
+	// use this for both packet repacking and report filter values, to always get the same id for the field
+	uint32_t get_or_add___field(uint32_t field_flag, str_ref const word)
+	{
+		if (!word)
+			return 0;
+
+		return this->get_or_add___field(field_flag, word, hash_dictionary_word(word));
+	}
 
-		auto const inserted_pair = name_words.hash.emplace_hash(word_hash, word.str(), nw);
-		auto const& it = inserted_pair.first;
+	// same as above, but with precalculated word_hash
+	uint32_t get_or_add___field(uint32_t field_flag, str_ref const word, uint64_t word_hash)
+	{
+		if (!word)
+			return 0;
 
-		if (inserted_pair.second) // inserted
-			name_words.mem_used_by_word_strings += word.size();
+		if (this->is_permanent_field(field_flag))
+			return permanent_.get_or_add(word, word_hash)->id;
 
-		return it->second;
+		return this->get_or_add___permanent(word, word_hash)->id;
+	}
+
+	// status field, see repacker_dictionary_t::get_or_add___status() for cached version
+	uint32_t get_or_add___status(uint32_t status)
+	{
+		meow::format::type_tunnel<uint32_t>::buffer_t buf;
+		return this->get_or_add___field(PINBA_PERMANENT_FIELD__STATUS, meow::format::type_tunnel<uint32_t>::call(status, buf));
 	}
 
 public:
@@ -355,18 +955,83 @@ public:
 		if (word_id == 0)
 			return {};
 
+		if (dictionary_int_words_t::is_int_id(word_id))
+			return int_words_.get_word(word_id);
+
+		if (word_id & permanent_dictionary_t::id_bit)
+			return permanent_.get_word(word_id);
+
 		shard_t const *shard   = get_shard_for_word_id(word_id);
-		uint32_t const word_offset = (word_id & word_id_mask) - 1;
+		uint32_t const word_offset = (word_id & word_id_mask_) - 1;
 
-		// can use only READ lock, here, since word refcount is not incremented
-		scoped_read_lock_t lock_(shard->mtx);
+		// no lock here
+		// word storage never moves, and the word itself can't be reused while caller holds a reference to word_id
+		// word contents are published to us (happens-before) by whatever channel has brought word_id here
 
 		assert((word_offset < shard->words.size()) && "word_offset >= wordlist.size(), bad word_id reference");
 
 		word_t const *w = &shard->words[word_offset];
-		assert((w && !w->str.empty()) && "got empty word ptr from wordlist, dangling word_id reference");
+		assert((w && w->str_p) && "got empty word ptr from wordlist, dangling word_id reference");
+
+		return w->str();
+	}
+
+	// word matchers, see dictionary_word_matchers_t
+	// func is tested on all existing words right here (with writers locked out, shard by shard), and on every new word after that
+	// words matching func have matcher bit set, until matcher is destroyed, throws if all matcher bits are taken
+	// func is called under dictionary locks, must be quick and must not touch dictionary
+	dictionary_word_matcher_ptr add_word_matcher(dictionary_word_match_func_t func);
+
+	// word_id must be alive, i.e. referenced by packet being processed
+	uint32_t word_match_bits(uint32_t word_id) const
+	{
+		if (word_id == 0)
+			return 0;
+
+		// patterns are for strings, integer values are matched by ranges (see packet_filter_word_set_t)
+		if (dictionary_int_words_t::is_int_id(word_id))
+			return 0;
+
+		if (word_id & permanent_dictionary_t::id_bit)
+			return permanent_.word_match_bits(word_id);
+
+		shard_t const *shard       = get_shard_for_word_id(word_id);
+		uint32_t const word_offset = (word_id & word_id_mask_) - 1;
+
+		return shard->words[word_offset].match_bits.load(std::memory_order_relaxed);
+	}
+
+private:
+
+	friend struct dictionary_word_matcher_t;
+	void remove_word_matcher(uint32_t bit);
+
+public:
+
+	// find existing word, never adds, 0 if not found
+	// permanent field values (see is_permanent_field()) live in permanent dictionary and have different ids,
+	// so callers matching report keys by word_id should check both
+	uint32_t find_word_id(str_ref const word) const
+	{
+		if (!word)
+			return 0;
+
+		uint64_t const word_hash = hash_dictionary_word(word);
+		shard_t const *shard     = get_shard_for_word_hash(word_hash);
+
+		scoped_read_lock_t lock_(shard->mtx);
+
+		word_t const *w = shard->hash.find(word, word_hash);
+		return (w) ? w->id : 0;
+	}
+
+	uint32_t find_word_id___permanent(str_ref const word) const
+	{
+		if (!word)
+			return 0;
 
-		return str_ref { w->str }; // TODO: optimize pointer deref here (string::size(), etc.)
+		permanent_dictionary_t::word_t const *w = permanent_.find(word, hash_dictionary_word(word));
+		return (w) ? w->id : 0;
 	}
 
 	void erase_word___ref(uint32_t word_id) // pair to get_or_add___ref()
@@ -374,44 +1039,39 @@ public:
 		if (word_id == 0)
 			return; // allow for some leeway
 
-		shard_t *shard = get_shard_for_word_id(word_id);
-		uint32_t const word_offset = (word_id & word_id_mask) - 1;
+		if (word_id & permanent_dictionary_t::id_bit)
+			return; // permanent words are never removed
 
-		// a tmp string to use in case we're freeing the word
-		// the idea is to free memory outside of lock in that case
-		std::string to_release_tmp;
+		shard_t *shard = get_shard_for_word_id(word_id);
 
 		// TODO: not worth using rlock just for quick assert that should never fire
 		//       but might be worth using it for refcount check (in case it's atomic) and upgrade only after
-		{
-			scoped_write_lock_t lock_(shard->mtx);
-
-			assert((word_offset < shard->words.size()) && "word_offset >= wordlist.size(), bad word_id reference");
-
-			word_t *w = &shard->words[word_offset];
-			assert(w->id == word_id);
-			assert(!w->str.empty() && "got empty word ptr from wordlist, dangling word_id reference");
+		scoped_write_lock_t lock_(shard->mtx);
+		this->erase_word___ref___locked(shard, word_id);
+	}
 
-			// LOG_DEBUG(PINBA_LOOGGER_, "{0}; erasing {1} {2} {3}", __func__, w->str, w->id, w->refcount);
+	// same as erase_word___ref() for many words, every shard lock is taken once per call instead of once per word
+	// NOTE: reorders word_ids
+	void erase_words___ref(uint32_t *word_ids, size_t n_words)
+	{
+		// shard id is in top bits (after permanent bit), so sorting groups words by shard
+		// zeroes come first and permanent words last, skip both
+		std::sort(word_ids, word_ids + n_words);
 
-			if (0 == --w->refcount)
-			{
-				size_t const n_erased = shard->hash.erase(str_ref { w->str }, w->hash);
-				assert((n_erased == 1) && "must have erased something here");
+		uint32_t const *it  = word_ids;
+		uint32_t const *end = word_ids + n_words;
 
-				shard->mem_used_by_word_strings -= w->str.size();
+		while (it != end && *it == 0)
+			++it;
 
-				// clear the word, and put it to shard's freelist
-				w->next_freelist_offset = shard->freelist_head;
-				shard->freelist_head    = word_offset + 1;
+		while (it != end && !(*it & permanent_dictionary_t::id_bit))
+		{
+			shard_t *shard = get_shard_for_word_id(*it);
+			scoped_write_lock_t lock_(shard->mtx);
 
-				w->id       = 0;
-				w->hash     = 0;
-				w->str.swap(to_release_tmp);
-			}
+			for (; it != end && !(*it & permanent_dictionary_t::id_bit) && (get_shard_for_word_id(*it) == shard); ++it)
+				this->erase_word___ref___locked(shard, *it);
 		}
-
-		// to_release_tmp is destroyed, freeing memory
 	}
 
 	// get or add a word that is never supposed to be removed
@@ -420,7 +1080,15 @@ public:
 		if (!word)
 			return {};
 
-		uint64_t const word_hash = hash_dictionary_word(word);
+		return this->get_or_add___permanent(word, hash_dictionary_word(word));
+	}
+
+	// same as above, but with precalculated word_hash
+	word_t const* get_or_add___permanent(str_ref const word, uint64_t word_hash)
+	{
+		if (!word)
+			return {};
+
 		shard_t *shard = get_shard_for_word_hash(word_hash);
 
 		// MUST make word permanent here (aka increment refcount) -> no fastpath
@@ -429,13 +1097,10 @@ public:
 		// also if word already exists as permanent, we still increment refcount by 2
 		// this is not an issue, since permanent words are not to be removed anyway (any refcount would work)
 
-		// pre-copy the word for locked insert
-		std::string word_str = word.str();
-
-
+		hashtable_t retired_tmp; // destroyed after unlock, see hash_t::emplace_hash()
 		scoped_write_lock_t lock_(shard->mtx);
 
-		word_t *w = this->get_or_add___wrlocked(shard, std::move(word_str), word_hash);
+		word_t *w = this->get_or_add___wrlocked(shard, word, word_hash, &retired_tmp);
 		w->refcount += 2;
 
 		return w;
@@ -450,6 +1115,14 @@ public:
 		return this->get_or_add___permanent(word)->id;
 	}
 
+	uint32_t get_or_add(str_ref const word, uint64_t word_hash)
+	{
+		if (!word)
+			return 0;
+
+		return this->get_or_add___permanent(word, word_hash)->id;
+	}
+
 	// get or add a word that might get removed with erase_word___ref() later
 	word_t const* get_or_add___ref(str_ref const word)
 	{
@@ -461,28 +1134,178 @@ public:
 
 	// same as above, but with precalculated word_hash
 	word_t const* get_or_add___ref(str_ref const word, uint64_t word_hash)
+	{
+		return this->get_or_add___ref_impl(word, word_hash, /*admit_new=*/ true);
+	}
+
+	// same as above, but returns nullptr (and refcount is untouched) if the word doesn't exist
+	// and new words are not admitted at the moment (see set_reject_new_words())
+	word_t const* get_or_add___ref_if_admitted(str_ref const word, uint64_t word_hash)
+	{
+		return this->get_or_add___ref_impl(word, word_hash, !reject_new_words_.load(std::memory_order_relaxed));
+	}
+
+	// one word of get_or_add_words___ref_if_admitted() batch
+	struct word_request_t
+	{
+		str_ref         word;    // not empty
+		uint64_t        hash;    // from dictionary_word_hasher_t
+		word_t const   *result;  // out, nullptr = rejected, see get_or_add___ref_if_admitted()
+	};
+
+	// same as get_or_add___ref_if_admitted() for many words, words are grouped by shard
+	// and every shard is read locked once (for words that exist) and write locked at most once (for the rest)
+	// duplicate words are fine, every one gets its own reference
+	// NOTE: reorders words
+	void get_or_add_words___ref_if_admitted(word_request_t *words, size_t n_words)
+	{
+		bool const admit_new = !reject_new_words_.load(std::memory_order_relaxed);
+
+		std::sort(words, words + n_words, [this](word_request_t const& a, word_request_t const& b)
+		{
+			return get_shard_for_word_hash(a.hash) < get_shard_for_word_hash(b.hash);
+		});
+
+		word_request_t *it  = words;
+		word_request_t *end = words + n_words;
+
+		while (it != end)
+		{
+			shard_t *shard = get_shard_for_word_hash(it->hash);
+
+			word_request_t *shard_end = it;
+			while (shard_end != end && get_shard_for_word_hash(shard_end->hash) == shard)
+				++shard_end;
+
+			// fastpath, same as get_or_add___ref_impl()
+			size_t n_missing = 0;
+			{
+				scoped_read_lock_t lock_(shard->mtx);
+
+				for (word_request_t *wr = it; wr != shard_end; ++wr)
+				{
+					word_t *w = shard->hash.find(wr->word, wr->hash);
+					if (w)
+						__atomic_add_fetch(&w->refcount, 1, __ATOMIC_RELAXED);
+
+					wr->result = w;
+					n_missing += (w == nullptr);
+				}
+			}
+
+			if (n_missing > 0 && !admit_new)
+				words_rejected_.fetch_add(n_missing, std::memory_order_relaxed);
+
+			if (n_missing > 0 && admit_new)
+			{
+				hashtable_t retired_tmp; // destroyed after unlock, see hash_t::emplace_hash()
+				scoped_write_lock_t lock_(shard->mtx);
+
+				for (word_request_t *wr = it; wr != shard_end; ++wr)
+				{
+					if (wr->result)
+						continue;
+
+					word_t *w = this->get_or_add___wrlocked(shard, wr->word, wr->hash, &retired_tmp);
+					w->refcount += 1;
+
+					wr->result = w;
+				}
+			}
+
+			it = shard_end;
+		}
+	}
+
+	// memory governor backpressure, existing words are still found as usual
+	void set_reject_new_words(bool reject)
+	{
+		reject_new_words_.store(reject, std::memory_order_relaxed);
+	}
+
+	bool is_rejecting_new_words() const
+	{
+		return reject_new_words_.load(std::memory_order_relaxed);
+	}
+
+	uint64_t words_rejected() const
+	{
+		return words_rejected_.load(std::memory_order_relaxed);
+	}
+
+private:
+
+	word_t const* get_or_add___ref_impl(str_ref const word, uint64_t word_hash, bool admit_new)
 	{
 		if (!word)
 			return {};
 
 		shard_t *shard = get_shard_for_word_hash(word_hash);
 
-		// TODO: not sure how to build fastpath here, since we need to increment refcount on return
-
-		// NOTE: now this is very likely to be an insert (as we're called from repacker here on it's cache-miss)
-		//  so to reduce the amount of time spent under write lock, we'll do some hax here
-		std::string word_str = word.str();
+		// fastpath, word exists, under read lock
+		// refcount is incremented atomically, since other readers might be doing the same
+		// removals (decrements to zero) are done under write lock, so the word can't go away under us
+		{
+			scoped_read_lock_t lock_(shard->mtx);
 
+			if (word_t *w = shard->hash.find(word, word_hash))
+			{
+				__atomic_add_fetch(&w->refcount, 1, __ATOMIC_RELAXED);
+				return w;
+			}
+		}
 
+		// racy, the word might get added by someone else right now, that's fine, next packet will find it
+		if (!admit_new)
+		{
+			words_rejected_.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
 
+		// NOTE: now this is very likely to be an insert (as we're called from repacker here on it's cache-miss)
+		//  string copy goes to shard arena under lock, but that's a memcpy into a free slot mostly, no malloc
+		hashtable_t retired_tmp; // destroyed after unlock, see hash_t::emplace_hash()
 		scoped_write_lock_t lock_(shard->mtx);
 
-		word_t *w = this->get_or_add___wrlocked(shard, std::move(word_str), word_hash);
+		word_t *w = this->get_or_add___wrlocked(shard, word, word_hash, &retired_tmp);
 		w->refcount += 1;
 
 		return w;
 	}
 
+public: // image, see dictionary.cpp
+
+	// dictionary image makes words keep their ids between restarts, and is loaded in bulk instead of word by word from traffic
+	// (so that report history saved with report_persist_writer_t finds all its words with the same ids)
+	// only transient words are saved, permanent ones come back from report configs, permanent fields are repopulated from traffic
+	//
+	// file format (host byte order)
+	//   magic u32 "PBD1", version u32, shard_count u32, reserved u32
+	//   shard_count x { n_slots:u32, n_words:u32, n_words x { offset:u32, len:u32, bytes } }
+	//   checksum u64, t1ha0 of everything above
+
+	// all shards are read locked, one at a time
+	pinba_error_t image_save(std::string const& path) const;
+
+	// must be called before any word is added, words get an extra reference, that is held for hold_time
+	// so that reports (and their saved history) get a chance to grab the words they need
+	pinba_error_t image_load(std::string const& path, duration_t hold_time, uint32_t *n_words);
+
+	// drop references taken by image_load() when hold time is over, words nobody else has wanted by now are freed
+	// cheap to call often, only the first call after hold time does the work
+	void image_release_if_expired(timeval_t now)
+	{
+		if (!image_pending_.load(std::memory_order_acquire))
+			return;
+
+		if (now < image_release_tv_)
+			return;
+
+		this->image_release();
+	}
+
+	void image_release();
+
 private:
 
 	static uint64_t hash_dictionary_word(str_ref word)
@@ -490,9 +1313,65 @@ private:
 		return dictionary_word_hasher_t()(word);
 	}
 
+	static nameword_t make_nameword(permanent_dictionary_t::word_t const *w)
+	{
+		return nameword_t {
+			.id       = w->id,
+			.id_hash  = pinba::hash_number(w->id),
+			.str_hash = w->hash,
+		};
+	}
+
 	shard_t* get_shard_for_word_id(uint32_t word_id) const
 	{
-		return &shards_[(word_id & shard_id_mask) >> (32 - shard_id_bits)];
+		return &shards_[(word_id & shard_id_mask_) >> shard_id_shift_];
+	}
+
+	struct shard_range_t
+	{
+		shard_t *b, *e;
+		shard_t* begin() const { return b; }
+		shard_t* end() const   { return e; }
+	};
+
+	shard_range_t shards() const
+	{
+		return { shards_.get(), shards_.get() + shard_count_ };
+	}
+
+	// drop a reference to the word, under shard write lock
+	// if that was the last one, the word is freed and its string slot goes back to shard arena
+	void erase_word___ref___locked(shard_t *shard, uint32_t word_id)
+	{
+		uint32_t const word_offset = (word_id & word_id_mask_) - 1;
+
+		assert((word_offset < shard->words.size()) && "word_offset >= wordlist.size(), bad word_id reference");
+
+		word_t *w = &shard->words[word_offset];
+		assert(w->id == word_id);
+		assert(w->str_p && "got empty word ptr from wordlist, dangling word_id reference");
+
+		// LOG_DEBUG(PINBA_LOOGGER_, "{0}; erasing {1} {2} {3}", __func__, w->str(), w->id, w->refcount);
+
+		if (0 == --w->refcount)
+		{
+			PINBA_PROBE2(dictionary_remove, word_id, w->str_p);
+
+			size_t const n_erased = shard->hash.erase(w->str(), w->hash);
+			assert((n_erased == 1) && "must have erased something here");
+
+			shard->strings.free(w->str_p, w->str_len);
+
+			// clear the word, and put it to shard's freelist
+			w->next_freelist_offset = shard->freelist_head;
+			shard->freelist_head    = word_offset + 1;
+
+			w->id       = 0;
+			w->hash     = 0;
+			w->str_p    = nullptr;
+			w->str_len  = 0;
+			w->match_bits.store(0, std::memory_order_relaxed);
+		}
 	}
 
 	shard_t* get_shard_for_word_hash(uint64_t word_hash) const
@@ -501,26 +1380,27 @@ private:
 		//  since hashtable_t will store lower 32 bits for rehash speedup
 		//  and we don't want all words in this shard to have same lower bits
 		// SO take higher order bits of our 64 bit hash for shard number
-		// TODO: when hashtable sharding is implemented - MUST edit this
-		return &shards_[word_hash >> (64 - shard_id_bits)];
+		return (shard_id_bits_ == 0)
+				? &shards_[0]
+				: &shards_[word_hash >> (64 - shard_id_bits_)];
 	}
 
 	// get or create a word, REFCOUNT IS NOT MODIFIED, i.e. even if just created -> refcount == 0
-	word_t* get_or_add___wrlocked(shard_t *shard, std::string word, uint64_t word_hash)
+	word_t* get_or_add___wrlocked(shard_t *shard, str_ref const word, uint64_t word_hash, hashtable_t *retired)
 	{
 		// potential SLOW things here (like alloc/free)
 		//  1. wordlist push_back (should be rare in steady state, freelist should be non-empty)
 		//  2. freelist pop_back (possible, and probably the most frequent one)
 		//      TODO: try pop_front here, to amortize the cost of alloc/free to once per chunk
-		//  3. hash growth (should be very rare in steady state) - but this is SUPER SLOW
-		//  4. std::string move doing alloc+copy (no sane impl would do this, but small string optimization is fine)
+		//  3. hash growth (should be very rare in steady state), incremental for big shards, see hash_t
+		//  4. string arena getting a new page (rare, freed slots of the same size class are reused first)
 
 		// to avoid extra hash lookup (find) - do some hax
 		//
-		// just insert right away, with the word we've got
-		// it's going to "stay alive", as we'll move it into the final word object
+		// just insert right away, with the word we've got (it references caller memory)
+		// key is fixed up to point to arena copy below
 		// we've got no word yet, so just insert nullptr for now
-		auto insert_res = shard->hash.emplace_hash(word_hash, str_ref { word }, nullptr);
+		auto insert_res = shard->hash.emplace_hash(word_hash, word, nullptr, retired);
 		auto& it = insert_res.first;
 
 		// word already exists
@@ -528,14 +1408,19 @@ private:
 			return it->second;
 
 		// slower path, need to actually fix newly inserted word
-		shard->mem_used_by_word_strings += word.size();
+		char *str_p = shard->strings.alloc(word);
+		if (str_p == nullptr)
+		{
+			shard->hash.erase(it);
+			throw std::bad_alloc();
+		}
 
 		word_t *w = [&]()
 		{
 			if (shard->freelist_head != 0)
 			{
 				uint32_t const word_offset = shard->freelist_head - 1;
-				uint32_t const word_id = shard->freelist_head | (shard->id << (32 - shard_id_bits));
+				uint32_t const word_id = shard->freelist_head | (shard->id << shard_id_shift_);
 
 				word_t *w = &shard->words[word_offset];
 
@@ -549,8 +1434,8 @@ private:
 			else
 			{
 				// word_id starts with 1, since 0 is reserved for empty
-				assert(((shard->words.size() + 1) & word_id_mask) != 0);
-				uint32_t const word_id = static_cast<uint32_t>(shard->words.size() + 1) | (shard->id << (32 - shard_id_bits));
+				assert(((shard->words.size() + 1) & word_id_mask_) != 0);
+				uint32_t const word_id = static_cast<uint32_t>(shard->words.size() + 1) | (shard->id << shard_id_shift_);
 
 				// XXX(antoxa): if this throws, we're screwed - hash value (the inconsistent one at that :) )  is not removed
 				shard->words.emplace_back();
@@ -564,21 +1449,53 @@ private:
 		}();
 
 		// finish initializing word
-		w->hash = word_hash;
-		w->str  = std::move(word);
+		w->hash    = word_hash;
+		w->str_p   = str_p;
+		w->str_len = uint32_t(word.size());
+		w->match_bits.store(matchers_.match(w->str()), std::memory_order_relaxed);
 
 		// fixup the key to point to long-living data now
-		// this is not always required, but needed to for small string optimization for example
 		str_ref& key_ref = const_cast<str_ref&>(it->first);
-		key_ref = str_ref { w->str };
+		key_ref = w->str();
 
 		// commit value
 		it.value() = w;
 
+		PINBA_PROBE2(dictionary_insert, w->id, w->str_p);
+
 		return w;
 	}
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+// registered matcher, unregisters on destruction (and clears its bit from all words), keep it while filter using it is alive
+struct dictionary_word_matcher_t : private boost::noncopyable
+{
+	dictionary_word_matcher_t(dictionary_t *d, uint32_t bit)
+		: d_(d)
+		, bit_(bit)
+		, mask_(uint32_t(1) << bit)
+	{
+	}
+
+	~dictionary_word_matcher_t()
+	{
+		d_->remove_word_matcher(bit_);
+	}
+
+	// word_id must be alive, same as dictionary_t::word_match_bits()
+	bool matches(uint32_t word_id) const
+	{
+		return (d_->word_match_bits(word_id) & mask_) != 0;
+	}
+
+private:
+	dictionary_t    *d_;
+	uint32_t const  bit_;
+	uint32_t const  mask_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
 #endif // PINBA__DICTIONARY_H_
@@ -0,0 +1,312 @@
+#ifndef PINBA__DICTIONARY_ARENA_H_
+#define PINBA__DICTIONARY_ARENA_H_
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+
+#include <boost/noncopyable.hpp>
+
+#include <meow/str_ref.hpp>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// string storage for dictionary_t words, one per shard, externally synchronized (shard write lock)
+//
+// strings are nul-terminated copies in fixed size slots, carved from 64KB pages, a page per size class
+// size class is derived from string length, so there's nothing to remember per string, except the pointer
+// strings longer than max_slot_size (rare, urls mostly fit) get malloc() of their own
+//
+// allocated strings NEVER move, lock-free get_word() and str_refs all over the place (repacker caches, snapshots) point to them
+// so instead of moving live strings around, freed slots are reused by strings of the same size class
+// and pages are given back as soon as their last string is freed (one empty page per class is kept, not to flap)
+// this keeps highly unique traffic (millions of urls coming and going) from fragmenting the heap with per word allocations
+
+struct dictionary_string_arena_t : private boost::noncopyable
+{
+	static constexpr uint32_t const page_size      = 64 * 1024;
+	static constexpr uint32_t const max_slot_size  = 2048;
+
+	// 16 byte steps up to 256, then x1.5 steps up to max_slot_size
+	static constexpr uint32_t const n_small_classes = 16;
+	static constexpr uint32_t const n_classes       = n_small_classes + 6;
+
+	static uint32_t class_size(uint32_t class_id)
+	{
+		static constexpr uint32_t const big_sizes[n_classes - n_small_classes] = { 384, 512, 768, 1024, 1536, 2048 };
+
+		return (class_id < n_small_classes)
+				? (class_id + 1) * 16
+				: big_sizes[class_id - n_small_classes];
+	}
+
+private:
+
+	// page header is at the start of every page, pages are page_size aligned, page of a slot is just (ptr & ~(page_size - 1))
+	struct page_t
+	{
+		page_t    *prev;        // in class partial or full list
+		page_t    *next;
+		uint32_t   class_id;
+		uint32_t   n_slots;
+		uint32_t   n_used;
+		uint32_t   n_carved;    // slots below this have been handed out at least once
+		uint32_t   free_head;   // (slot + 1) of first free slot, 0 = none, next is stored in slot itself
+		uint32_t   padding__;
+
+		char* slot_ptr(uint32_t slot)
+		{
+			return reinterpret_cast<char*>(this) + header_size + size_t(slot) * class_size(class_id);
+		}
+
+		uint32_t slot_of(char const *p) const
+		{
+			return uint32_t((p - reinterpret_cast<char const*>(this) - header_size) / class_size(class_id));
+		}
+
+		bool is_full() const
+		{
+			return (free_head == 0) && (n_carved == n_slots);
+		}
+	};
+
+	static constexpr uint32_t const header_size = 64; // sizeof(page_t) rounded up, keeps slots 16 byte aligned
+	static_assert(sizeof(page_t) <= header_size, "page_t must fit header");
+
+	struct class_t
+	{
+		page_t    *partial = nullptr;  // pages with free slots
+		page_t    *full    = nullptr;  // the rest, every page is in one of the lists
+		uint32_t   n_pages = 0;
+		uint32_t   n_empty = 0;        // pages with n_used == 0 (at most 1)
+	};
+
+	class_t    classes_[n_classes];
+
+	uint64_t   pages_bytes_ = 0;
+	uint64_t   big_bytes_   = 0;
+	uint64_t   used_bytes_  = 0;  // string bytes, including nul terminators
+
+public:
+
+	dictionary_string_arena_t() = default;
+
+	~dictionary_string_arena_t()
+	{
+		// big strings have to be freed by their owners (dictionary_t frees words that are still alive), pages are ours
+		for (auto& cls : classes_)
+		{
+			for (page_t **list : { &cls.partial, &cls.full })
+			{
+				while (page_t *page = *list)
+				{
+					this->list_remove(list, page);
+					std::free(page);
+				}
+			}
+		}
+	}
+
+	static int class_for_size(size_t sz)
+	{
+		if (sz > max_slot_size)
+			return -1;
+
+		if (sz <= n_small_classes * 16)
+			return int((sz + 15) / 16) - 1;
+
+		for (uint32_t i = n_small_classes; i < n_classes; i++)
+		{
+			if (sz <= class_size(i))
+				return int(i);
+		}
+		return -1; // unreachable
+	}
+
+	// copy of str with nul terminator, nullptr on allocation failure
+	char* alloc(str_ref const str)
+	{
+		size_t const sz  = str.size() + 1;
+		int const    cls = class_for_size(sz);
+
+		char *p = (cls < 0)
+				? this->big_alloc(sz)
+				: this->slot_alloc(uint32_t(cls));
+
+		if (!p)
+			return nullptr;
+
+		memcpy(p, str.data(), str.size());
+		p[str.size()] = '\0';
+
+		used_bytes_ += sz;
+		return p;
+	}
+
+	// len must be the same as the one passed to alloc()
+	void free(char *p, size_t len)
+	{
+		size_t const sz  = len + 1;
+		int const    cls = class_for_size(sz);
+
+		used_bytes_ -= sz;
+
+		if (cls < 0)
+		{
+			big_bytes_ -= sz;
+			std::free(p);
+			return;
+		}
+
+		this->slot_free(uint32_t(cls), p);
+	}
+
+	// memory taken from heap, pages and big strings
+	uint64_t mem_allocated() const
+	{
+		return pages_bytes_ + big_bytes_;
+	}
+
+	// string bytes, including nul terminators, mem_allocated() - mem_used() is slack and free slots
+	uint64_t mem_used() const
+	{
+		return used_bytes_;
+	}
+
+private:
+
+	char* big_alloc(size_t sz)
+	{
+		char *p = static_cast<char*>(std::malloc(sz));
+		if (p)
+			big_bytes_ += sz;
+		return p;
+	}
+
+	char* slot_alloc(uint32_t class_id)
+	{
+		class_t *cls = &classes_[class_id];
+
+		page_t *page = cls->partial;
+		if (!page)
+		{
+			page = this->page_alloc(class_id);
+			if (!page)
+				return nullptr;
+
+			this->list_push(&cls->partial, page);
+			cls->n_pages++;
+			cls->n_empty++;
+		}
+
+		if (page->n_used == 0)
+			cls->n_empty--;
+
+		char *p;
+		if (page->free_head != 0)
+		{
+			p = page->slot_ptr(page->free_head - 1);
+
+			uint32_t next;
+			memcpy(&next, p, sizeof(next));
+			page->free_head = next;
+		}
+		else
+		{
+			p = page->slot_ptr(page->n_carved);
+			page->n_carved++;
+		}
+
+		page->n_used++;
+
+		if (page->is_full())
+		{
+			this->list_remove(&cls->partial, page);
+			this->list_push(&cls->full, page);
+		}
+
+		return p;
+	}
+
+	void slot_free(uint32_t class_id, char *p)
+	{
+		class_t *cls  = &classes_[class_id];
+		page_t  *page = reinterpret_cast<page_t*>(reinterpret_cast<uintptr_t>(p) & ~uintptr_t(page_size - 1));
+
+		assert(page->class_id == class_id && "string freed with wrong length");
+
+		bool const was_full = page->is_full();
+
+		uint32_t const next = page->free_head;
+		memcpy(p, &next, sizeof(next));
+		page->free_head = page->slot_of(p) + 1;
+		page->n_used--;
+
+		if (was_full)
+		{
+			this->list_remove(&cls->full, page);
+			this->list_push(&cls->partial, page);
+		}
+
+		if (page->n_used > 0)
+			return;
+
+		// keep one empty page per class, give back the rest
+		if (cls->n_empty == 0)
+		{
+			cls->n_empty++;
+			return;
+		}
+
+		this->list_remove(&cls->partial, page);
+		cls->n_pages--;
+		pages_bytes_ -= page_size;
+		std::free(page);
+	}
+
+	page_t* page_alloc(uint32_t class_id)
+	{
+		void *mem = nullptr;
+		if (0 != posix_memalign(&mem, page_size, page_size))
+			return nullptr;
+
+		page_t *page = static_cast<page_t*>(mem);
+		page->prev      = nullptr;
+		page->next      = nullptr;
+		page->class_id  = class_id;
+		page->n_slots   = (page_size - header_size) / class_size(class_id);
+		page->n_used    = 0;
+		page->n_carved  = 0;
+		page->free_head = 0;
+
+		pages_bytes_ += page_size;
+		return page;
+	}
+
+	static void list_push(page_t **list, page_t *page)
+	{
+		page->prev = nullptr;
+		page->next = *list;
+		if (*list)
+			(*list)->prev = page;
+		*list = page;
+	}
+
+	static void list_remove(page_t **list, page_t *page)
+	{
+		if (page->prev)
+			page->prev->next = page->next;
+		else
+			*list = page->next;
+
+		if (page->next)
+			page->next->prev = page->prev;
+
+		page->prev = page->next = nullptr;
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__DICTIONARY_ARENA_H_
@@ -1,8 +1,11 @@
 #ifndef PINBA__ENGINE_H_
 #define PINBA__ENGINE_H_
 
+#include <future>
+
 #include "pinba/globals.h"
 #include "pinba/report.h"
+#include "pinba/exporter.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -20,9 +23,32 @@ struct pinba_engine_t : private boost::noncopyable
 	virtual pinba_options_t*       options_mutable() = 0;
 
 	virtual pinba_error_t       add_report(report_ptr) = 0;
+	virtual std::vector<pinba_error_t> add_reports(std::vector<report_ptr> const&) = 0; // see coordinator_t::add_reports()
 	virtual pinba_error_t       delete_report(str_ref name) = 0;
 	virtual report_state_ptr    get_report_state(str_ref name) = 0;
 	virtual report_snapshot_ptr get_report_snapshot(str_ref name) = 0;
+	virtual std::future<report_snapshot_ptr> get_report_snapshot_async(str_ref name) = 0; // see coordinator_t::get_report_snapshot_async()
+
+	// consistent snapshots of several reports, see coordinator_t::get_report_snapshots()
+	virtual std::vector<report_snapshot_ptr> get_report_snapshots(std::vector<std::string> const& names) = 0;
+
+	// snapshot that has already been prepared with (at least) given flags, shared with other selects
+	// between two report ticks, see coordinator_t::get_prepared_report_snapshot()
+	virtual report_snapshot_ptr get_prepared_report_snapshot(str_ref name, report_snapshot_t::merge_flags_t flags) = 0;
+
+	// keep report histograms collected, see coordinator_t::report_hv_wanted()
+	virtual void                report_hv_wanted(str_ref name) = 0;
+
+	// push every report tick to subscriber, see coordinator_t::subscribe_to_ticks()
+	virtual pinba_error_t       subscribe_to_ticks(str_ref name, report_tick_subscription_ptr) = 0;
+
+	// serve report on /metrics (see exporter.h), replaces previous conf for the same report, forgotten on delete_report()
+	virtual void set_report_metrics(report_metrics_conf_ptr) = 0;
+
+	// resize thread pools at runtime, see collector_t::set_thread_count(), repacker_t::set_thread_count()
+	// options()->udp_threads and repacker_threads are updated on success
+	virtual pinba_error_t set_udp_reader_threads(uint32_t n_threads) = 0;
+	virtual pinba_error_t set_repacker_threads(uint32_t n_threads) = 0;
 };
 typedef std::unique_ptr<pinba_engine_t> pinba_engine_ptr;
 
@@ -0,0 +1,116 @@
+#ifndef PINBA__EXPORTER_H_
+#define PINBA__EXPORTER_H_
+
+#include <string>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <meow/std_unique_ptr.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/report.h"
+#include "pinba/snapshot_gather.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// binary snapshot export over unix socket, for scrapers that don't want to pay for mysql protocol
+//
+// client connects, sends report name (same as in pinba.active) terminated with '\n'
+// gets the whole snapshot (or an error) back, then server closes the connection
+// 'gather:<report name>' gets the report merged over all exporter_conf_t::gather nodes instead (see snapshot_gather.h)
+//
+// all ints are little-endian, snapshot is columnar:
+//   header
+//     magic         u32 PINBA_EXPORT_MAGIC
+//     version       u32 PINBA_EXPORT_VERSION
+//     kind          u32 REPORT_KIND__*
+//     time_window   u64 nanoseconds
+//     n_key_parts   u32
+//     n_columns     u32 data columns
+//     n_rows        u64
+//     n_words       u32
+//   string table, every word used in keys, exactly once
+//     n_words x { word_id:u32, len:u32, bytes }
+//   key columns
+//     n_key_parts x { n_rows x word_id:u32 }, word_id 0 is an empty string and is not in string table
+//   data columns
+//     n_columns x { name_len:u8, name, type:u8 (PINBA_EXPORT_COLUMN__*), n_rows x value:u64 }
+//
+// error is
+//   magic u32 PINBA_EXPORT_MAGIC_ERROR, len:u32, message
+
+#define PINBA_EXPORT_MAGIC         0x31584250 // "PBX1"
+#define PINBA_EXPORT_MAGIC_ERROR   0x45584250 // "PBXE"
+#define PINBA_EXPORT_VERSION       1
+
+#define PINBA_EXPORT_COLUMN__COUNT        0 // plain unsigned counter
+#define PINBA_EXPORT_COLUMN__DURATION_NS  1 // duration in nanoseconds, signed
+
+// serialize prepared snapshot to out (appends), straight from pos_first()/pos_next()
+// big snapshots are gathered in parallel over report_snapshot_t::pos_split() ranges in pool (if any), output is the same
+void report_snapshot_export_binary(report_snapshot_t*, std::string *out, thread_pool_t *pool = nullptr);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// prometheus text exposition format (0.0.4), served over http as /metrics
+//
+// every data column becomes a gauge family <prefix>_<column>, key parts are labels, i.e.
+//   <prefix>_req_count{host="h1",script="/index.php"} 123
+//   <prefix>_time_seconds{host="h1",script="/index.php",quantile="0.99"} 0.104000000
+// values are aggregated over report time window, they go up and down as ticks come and go, so these are not counters
+
+struct report_metrics_conf_t
+{
+	std::string               report_name;
+	std::string               prefix;       // metric family names are <prefix>_<column>
+	std::vector<std::string>  key_names;    // label names, one per report key part
+	std::vector<double>       percentiles;  // <prefix>_time_seconds{quantile="<percentile / 100>"}, needs histograms
+};
+using report_metrics_conf_ptr = std::shared_ptr<report_metrics_conf_t const>;
+
+// reusable buffers, keep between calls to avoid allocating on every scrape
+struct report_metrics_scratch_t
+{
+	std::string                                 labels;         // label sets of all rows, back to back
+	std::vector<size_t>                         label_offsets;  // row i labels are [offsets[i], offsets[i+1])
+	std::vector<report_snapshot_t::position_t>  positions;
+	report_snapshot_t::row_batch_t              batch;          // fetch_rows() page
+	std::vector<str_ref>                        key_words;      // its key words, row-major
+};
+
+// serialize prepared snapshot (with histograms, if there are percentiles to export) to out (appends)
+void report_snapshot_export_prometheus(report_snapshot_t*, report_metrics_conf_t const&, std::string *out, report_metrics_scratch_t *scratch);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct exporter_conf_t
+{
+	std::string  unix_socket_path;  // binary export, listen here, stale socket file is removed on startup, empty = off
+	std::string  tcp_address;       // binary export over tcp, for other nodes to gather from
+	std::string  tcp_port;          // empty = off
+	std::string  metrics_address;   // http /metrics listener
+	std::string  metrics_port;      // empty = off
+	std::string  nn_shutdown;       // used for graceful shutdown
+
+	// get prepared report snapshot by name, should throw if there is no such report
+	std::function<report_snapshot_ptr(std::string const&, report_snapshot_t::merge_flags_t)> get_snapshot;
+
+	// reports to serve on /metrics
+	std::function<std::vector<report_metrics_conf_ptr>()> get_metrics_confs;
+
+	// nodes to serve 'gather:' requests from, empty = off
+	snapshot_gather_conf_t gather;
+};
+
+struct exporter_t
+{
+	virtual ~exporter_t() {}
+
+	virtual void startup() = 0;
+	virtual void shutdown() = 0;
+};
+using exporter_ptr = std::unique_ptr<exporter_t>;
+
+exporter_ptr create_exporter(pinba_globals_t*, exporter_conf_t*);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__EXPORTER_H_
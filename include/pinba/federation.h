@@ -0,0 +1,67 @@
+#ifndef PINBA__FEDERATION_H_
+#define PINBA__FEDERATION_H_
+
+#include <string>
+#include <functional>
+#include <memory>
+#include <meow/std_unique_ptr.hpp>
+
+#include "pinba/globals.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// edge-to-central tick federation
+//
+// edge pinba (pinba_options_t::federation_upstream) sends every tick of its reports upstream,
+// right after the tick is merged into report history, central pinba (pinba_options_t::federation_listen)
+// merges rows of remote ticks into the next local tick of the report with the same name
+// so that central report covers traffic of all edges (and its own, if any), at the cost of aggregated rows instead of packets
+//
+// report configs must be the same on edges and central (see report_persist_reader_t::validate()), except for agg_threads
+// only timer reports support this for now (see report_history_t::federation_merge())
+//
+// transport is nanomsg PUSH (edges, connect) -> PULL (central, bind), every message is
+//   magic         u32 PINBA_FEDERATION_MAGIC
+//   name_len      u32
+//   name          report name
+//   tick          single tick in report_persist format (see report_persist.h), keys are sent as strings
+//
+// edges never wait for upstream, ticks that don't fit into socket send buffer are dropped
+
+#define PINBA_FEDERATION_MAGIC  0x31464250 // "PBF1"
+
+struct federation_sender_t
+{
+	virtual ~federation_sender_t() {}
+
+	// called from report threads, never blocks
+	virtual void send_tick(str_ref report_name, std::string const& tick_data) = 0;
+};
+using federation_sender_ptr = std::unique_ptr<federation_sender_t>;
+
+federation_sender_ptr create_federation_sender(pinba_globals_t*, std::string const& upstream);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct federation_receiver_conf_t
+{
+	std::string  listen;       // nanomsg endpoint to bind to, i.e. tcp://*:3003
+	std::string  nn_shutdown;  // used for graceful shutdown
+
+	// merge remote tick into report, called from receiver thread
+	std::function<pinba_error_t(std::string const& report_name, std::string tick_data)> merge_tick;
+};
+
+struct federation_receiver_t
+{
+	virtual ~federation_receiver_t() {}
+
+	virtual void startup() = 0;
+	virtual void shutdown() = 0;
+};
+using federation_receiver_ptr = std::unique_ptr<federation_receiver_t>;
+
+federation_receiver_ptr create_federation_receiver(pinba_globals_t*, federation_receiver_conf_t*);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__FEDERATION_H_
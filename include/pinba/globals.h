@@ -3,10 +3,13 @@
 
 #include <cstdint>
 #include <cassert>
+#include <cstring>     // memcpy
 
 #include <atomic>
+#include <deque>
 #include <memory>      // unique_ptr, shared_ptr
 #include <mutex>
+#include <type_traits>
 #include <vector>
 
 #include <boost/noncopyable.hpp>
@@ -20,6 +23,7 @@
 #include <meow/unix/time.hpp>
 
 #include "pinba/limits.h"
+#include "pinba/rate_window.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -35,6 +39,13 @@ typedef meow::error_t pinba_error_t;
 
 struct pinba_os_symbols_t;
 struct dictionary_t;
+struct thread_pool_t;
+struct pipeline_latency_t;
+struct federation_sender_t;
+struct packet_capture_t;
+struct datagram_capture_t;
+struct reclaimer_t;
+struct async_log_t;
 
 struct repacker_state_t;
 using repacker_state_ptr = std::shared_ptr<repacker_state_t>;
@@ -58,22 +69,193 @@ inline void repacker_state___merge_to_from(repacker_state_ptr& to, repacker_stat
 		to->merge_other(*from);
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// counters bumped by exactly one thread (or strand), i.e. per thread counter blocks
+// plain load + store, instead of locked read-modify-write of shared atomics
+// readers get relaxed loads, might be behind a little, but never torn
+
+struct pinba_counter_t
+{
+	std::atomic<uint64_t> value = {0};
+
+	void operator+=(uint64_t n) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+	void operator++()           { *this += 1; }
+	void operator++(int)        { *this += 1; }
+	void operator=(uint64_t v)  { value.store(v, std::memory_order_relaxed); }
+
+	operator uint64_t() const   { return value.load(std::memory_order_relaxed); }
+};
+
+// cpu cycle counter for attributing work to reports independently of threads doing it (see report_counters___t::cycles_*)
+// tsc on x86 (constant rate on anything we care about, not serializing, good enough for ~batch sized intervals)
+// virtual counter on aarch64, monotonic clock nanoseconds elsewhere
+inline uint64_t pinba_cycles_now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+	uint64_t v;
+	asm volatile("mrs %0, cntvct_el0" : "=r" (v));
+	return v;
+#else
+	timeval_t const tv = os_unix::clock_monotonic_now();
+	return uint64_t(tv.tv_sec) * 1000000000ULL + tv.tv_nsec;
+#endif
+}
+
+// blocks are placed next to each other (in std::deque mostly), pad them to avoid false sharing
+// a full cache line at the end, so that the last counter of one block and the first of the next one never share a line
+// (blocks are not cache line aligned, no aligned new in c++14)
+template<class T>
+struct pinba_padded_t : public T
+{
+	char pad___[PINBA_INTERNAL___CACHELINE_SIZE];
+};
+
+// single writer, any number of readers, readers never block the writer (and never take locks)
+// value is kept as relaxed atomic words, odd sequence = store() in progress, readers retry until they get the same even one twice
+template<class T>
+struct pinba_seqlock_t : private boost::noncopyable
+{
+	static_assert(std::is_trivially_copyable<T>::value, "seqlock values are copied as raw words");
+
+	static constexpr size_t const n_words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	// writer thread only
+	void store(T const& value)
+	{
+		uint64_t words[n_words] = {};
+		memcpy(words, &value, sizeof(T));
+
+		uint64_t const seq = seq_.load(std::memory_order_relaxed);
+		seq_.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		for (size_t i = 0; i < n_words; i++)
+			words_[i].store(words[i], std::memory_order_relaxed);
+
+		seq_.store(seq + 2, std::memory_order_release);
+	}
+
+	// any thread, zero filled value until the first store()
+	T load() const
+	{
+		uint64_t words[n_words];
+
+		for (;;)
+		{
+			uint64_t const seq = seq_.load(std::memory_order_acquire);
+			if (seq & 1)
+				continue;
+
+			for (size_t i = 0; i < n_words; i++)
+				words[i] = words_[i].load(std::memory_order_relaxed);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			if (seq_.load(std::memory_order_relaxed) == seq)
+				break;
+		}
+
+		T result;
+		memcpy(&result, words, sizeof(T));
+		return result;
+	}
+
+	// stores so far, 0 = never stored
+	uint64_t version() const
+	{
+		return seq_.load(std::memory_order_acquire) / 2;
+	}
+
+private:
+	std::atomic<uint64_t> seq_ = {0};
+	std::atomic<uint64_t> words_[n_words] = {};
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 struct collector_stats_t
 {
 	timeval_t ru_utime = {0,0};
 	timeval_t ru_stime = {0,0};
+
+	// busy poll mode only (see collector_conf_t::busy_poll_spins), idle / (busy + idle) is the fraction of spinning wasted
+	uint64_t busy_poll_busy = 0;  // recvmmsg() calls while spinning, that got some packets
+	uint64_t busy_poll_idle = 0;  // recvmmsg() calls while spinning, that got EAGAIN
 };
 
 struct repacker_stats_t
 {
 	timeval_t ru_utime = {0,0};
 	timeval_t ru_stime = {0,0};
+
+	// current batching decisions, see repacker_conf_t::batch_latency_target
+	uint32_t   batch_size    = 0;
+	duration_t batch_timeout = {0};
+	double     packet_rate   = 0;   // packets per second, smoothed
+
+	uint64_t   dictionary_mem_used = 0; // repacker_dictionary_t::mem_used(), thread local dictionary cache
+};
+
+// udp and repacker counters are bumped for every packet by every collector/repacker thread,
+// so every thread has a block of its own, summed up on read
+template<class T>
+struct pinba_udp_counters___t
+{
+	T poll_total        = {};      // total poll calls
+	T recv_total        = {};      // total recv* calls
+	T recv_eagain       = {};      // EAGAIN errors from recv* calls
+	T recv_bytes        = {};      // bytes received
+	T recv_packets      = {};      // total udp packets received
+	T packet_decode_err = {};      // number of times we've failed to decode incoming message
+	T recv_kernel_drops = {};      // packets dropped by kernel due to socket buffer overflow (SO_RXQ_OVFL, recvmmsg reader, or AF_XDP ring stats)
+	T recv_gro_segments = {};      // datagrams that came coalesced by UDP_GRO (i.e. in messages with more than one datagram), counted in recv_packets as well
+	T batch_send_total  = {};      // batch send attempts (to repacker)
+	T batch_send_err    = {};      // batch sends that failed
+	T packet_send_total = {};      // n packets in batches we attempted to send (to repacker)
+	T packet_send_err   = {};      // n packets that were lost to batch send fails
+	T packet_mem_sampled = {};     // datagrams dropped by memory governor sampling (see mem_governor.h)
+};
+using pinba_udp_counters_t        = pinba_udp_counters___t<uint64_t>;
+using pinba_udp_thread_counters_t = pinba_padded_t<pinba_udp_counters___t<pinba_counter_t>>;
+
+template<class T>
+struct pinba_repacker_counters___t
+{
+	T poll_total            = {};
+	T recv_total            = {};
+	T recv_eagain           = {};
+	T recv_packets          = {};
+	T packet_validate_err   = {};
+	T packet_prefilter_drop = {}; // packets no report is interested in, see packet_prefilter_t
+	T packet_ingest_sampled = {}; // packets sampled out over ingest budget, see repacker_conf_t::ingest_budget
+	T packet_summaries      = {}; // pre-aggregated summaries, see pinba_summary_to_packets()
+	T packet_summary_requests = {}; // requests those summaries stand for
+	T batch_send_total      = {};
+	T batch_send_by_timer   = {};
+	T batch_send_by_size    = {};
 };
+using pinba_repacker_counters_t        = pinba_repacker_counters___t<uint64_t>;
+using pinba_repacker_thread_counters_t = pinba_padded_t<pinba_repacker_counters___t<pinba_counter_t>>;
 
 // this one is updated from multiple threads
 // use atomic primitives to set/fetch values
+// counters sampled for pinba_stats_t::rates, by coordinator relay thread every second
+#define PINBA_STATS_RATE__UDP_RECV_PACKETS               0
+#define PINBA_STATS_RATE__UDP_RECV_BYTES                 1
+#define PINBA_STATS_RATE__UDP_RECV_KERNEL_DROPS          2
+#define PINBA_STATS_RATE__UDP_PACKET_DECODE_ERR          3
+#define PINBA_STATS_RATE__UDP_PACKET_SEND_ERR            4
+#define PINBA_STATS_RATE__REPACKER_RECV_PACKETS          5
+#define PINBA_STATS_RATE__REPACKER_PACKET_VALIDATE_ERR   6
+#define PINBA_STATS_RATE__REPACKER_PACKET_PREFILTER_DROP 7
+#define PINBA_STATS_RATE__COORDINATOR_BATCHES_RECEIVED   8
+#define PINBA_STATS_RATE__COORDINATOR_BATCH_SEND_ERR     9
+#define PINBA_STATS_RATE__RU_UTIME_USEC                  10 // whole process
+#define PINBA_STATS_RATE__RU_STIME_USEC                  11
+#define PINBA_STATS_RATE__COUNT                          12
+
 // if using atomic is impossible - use pinba_stats_wrap_t below and lock
 // when this structure is returned by value from pinba_globals_t::stats_copy() - the lock is held while copying
 struct pinba_stats_t
@@ -91,35 +273,30 @@ struct pinba_stats_t
 		std::atomic<uint64_t> n_report_snapshots    = {0};
 		std::atomic<uint64_t> n_report_ticks        = {0};
 		std::atomic<uint64_t> n_coord_requests      = {0};
+		std::atomic<uint64_t> raw_pool_hit          = {0};  // raw_request_t reused from collector pool
+		std::atomic<uint64_t> raw_pool_miss         = {0};  // raw_request_t created, since pool was empty
+		std::atomic<uint64_t> packet_pool_hit       = {0};  // packet_batch_t reused from repacker pool
+		std::atomic<uint64_t> packet_pool_miss      = {0};  // packet_batch_t created, since pool was empty
+		std::atomic<uint64_t> tick_arena_pool_hit   = {0};  // report_by_timer tick hashtable/nmpa reused from aggregator pool
+		std::atomic<uint64_t> tick_arena_pool_miss  = {0};  // report_by_timer tick hashtable/nmpa created, since pool was empty
 	// 	std::atomic<uint64_t> n_ = {0};
 	// 	std::atomic<uint64_t> n_ = {0};
 	} objects;
 
+	// transient memory, data read from the network, that is not aggregated yet (nmpa_mem_used() of whole batches)
+	// charged once per batch when it's sent, credited when it's recycled or destroyed
 	struct {
-		std::atomic<uint64_t> poll_total        = {0};      // total poll calls
-		std::atomic<uint64_t> recv_total        = {0};      // total recv* calls
-		std::atomic<uint64_t> recv_eagain       = {0};      // EAGAIN errors from recv* calls
-		std::atomic<uint64_t> recv_bytes        = {0};      // bytes received
-		std::atomic<uint64_t> recv_packets      = {0};      // total udp packets received
-		std::atomic<uint64_t> packet_decode_err = {0};      // number of times we've failed to decode incoming message
-		std::atomic<uint64_t> batch_send_total  = {0};      // batch send attempts (to repacker)
-		std::atomic<uint64_t> batch_send_err    = {0};      // batch sends that failed
-		std::atomic<uint64_t> packet_send_total = {0};      // n packets in batches we attempted to send (to repacker)
-		std::atomic<uint64_t> packet_send_err   = {0};      // n packets that were lost to batch send fails
-	} udp;
+		std::atomic<uint64_t> raw_batches    = {0}; // raw_request_t sent by collector, not yet released by repacker
+		std::atomic<uint64_t> packet_batches = {0}; // packet_batch_t sent by repacker, not yet released by all reports
+	} inflight_mem;
+
+	// per collector thread, use pinba_stats___udp() to get the totals
+	std::deque<pinba_udp_thread_counters_t> udp_threads;  // created on collector startup, under mtx, never shrinks
 
 	std::vector<collector_stats_t> collector_threads;
 
-	struct {
-		std::atomic<uint64_t> poll_total          = {0};
-		std::atomic<uint64_t> recv_total          = {0};
-		std::atomic<uint64_t> recv_eagain         = {0};
-		std::atomic<uint64_t> recv_packets        = {0};
-		std::atomic<uint64_t> packet_validate_err = {0};
-		std::atomic<uint64_t> batch_send_total    = {0};
-		std::atomic<uint64_t> batch_send_by_timer = {0};
-		std::atomic<uint64_t> batch_send_by_size  = {0};
-	} repacker;
+	// per repacker thread, use pinba_stats___repacker() to get the totals
+	std::deque<pinba_repacker_thread_counters_t> repacker_counter_threads;  // created on repacker startup, under mtx, never shrinks
 
 	std::vector<repacker_stats_t> repacker_threads;
 
@@ -128,17 +305,154 @@ struct pinba_stats_t
 		std::atomic<uint64_t> batch_send_total = {0};    // total batch send attempts (to all reports)
 		std::atomic<uint64_t> batch_send_err   = {0};    // total batch send errors (to all reports)
 		std::atomic<uint64_t> control_requests = {0};    // control requests processed
+		std::atomic<uint64_t> batch_send_skipped = {0};  // batches not given to reports, that can't use any packet from them
 
 		timeval_t ru_utime                     = {0,0};
 		timeval_t ru_stime                     = {0,0};
 	} coordinator;
+
+	struct {
+		std::atomic<uint64_t> mem_used = {0};  // history memory of all reports, when report_max_mem_total or mem_governor_max is set
+	} reports;
+
+	// see mem_governor.h
+	struct {
+		std::atomic<uint32_t> stage         = {0};  // PINBA_MEM_STAGE__*
+		std::atomic<uint64_t> mem_used      = {0};  // memory counted against the budget, at last check
+		std::atomic<uint64_t> stage_changes = {0};
+	} mem_governor;
+
+	// see federation.h
+	struct {
+		std::atomic<uint64_t> ticks_sent      = {0};  // edge: ticks sent upstream
+		std::atomic<uint64_t> ticks_send_err  = {0};  // edge: ticks dropped, upstream is slow or not connected
+		std::atomic<uint64_t> ticks_received  = {0};  // central: ticks received from edges
+		std::atomic<uint64_t> ticks_merge_err = {0};  // central: received ticks dropped (unknown report, config mismatch, etc.)
+	} federation;
+
+	// see packet_capture.h
+	struct {
+		std::atomic<uint64_t> packets_captured = {0};
+	} packet_capture;
+
+	// see datagram_capture.h
+	struct {
+		std::atomic<uint64_t> datagrams_captured = {0};  // written to capture file
+		std::atomic<uint64_t> datagrams_dropped  = {0};  // collector ring was full, writer is behind
+		std::atomic<uint64_t> bytes_written      = {0};
+		std::atomic<uint64_t> files_rotated      = {0};
+	} datagram_capture;
+
+	// see reclaimer.h
+	struct {
+		std::atomic<uint64_t> objects_retired = {0};  // handed over by report threads
+		std::atomic<uint64_t> objects_freed   = {0};  // dropped by reclaimer thread
+	} reclaimer;
+
+	// see async_log.h
+	struct {
+		std::atomic<uint64_t> messages_written = {0};  // handed to logger by async log thread
+		std::atomic<uint64_t> messages_dropped = {0};  // producer ring was full, async log thread is behind
+	} async_log;
+
+	// see coordinator_conf_t::snapshot_prewarm_min_qpm
+	struct {
+		std::atomic<uint64_t> snapshots_prepared = {0};  // prepared after tick, ahead of selects
+		std::atomic<uint64_t> skipped_mem        = {0};  // hot report snapshots left to selects, over memory budget
+		std::atomic<uint64_t> hot_reports        = {0};  // on last scan, within budget
+		std::atomic<uint64_t> mem_used           = {0};  // estimated, of hot report snapshots, on last scan
+	} snapshot_prewarm;
+
+	// see packet_relay.h
+	struct {
+		std::atomic<uint64_t> batches_sent       = {0};  // relay: repacked batches sent upstream
+		std::atomic<uint64_t> batches_send_err   = {0};  // relay: batches dropped, upstream is slow or not connected
+		std::atomic<uint64_t> bytes_sent         = {0};  // relay: after compression
+		std::atomic<uint64_t> batches_received   = {0};  // aggregator: batches received from relays
+		std::atomic<uint64_t> batches_decode_err = {0};  // aggregator: batches (or their tails) dropped as malformed
+		std::atomic<uint64_t> packets_received   = {0};  // aggregator: packets decoded from relayed batches
+	} packet_relay;
+
+	rate_window_t<PINBA_STATS_RATE__COUNT> rates;  // PINBA_STATS_RATE__*, protected by mtx
 };
 
+// totals over all threads, mtx must be held
+inline pinba_udp_counters_t pinba_stats___udp(pinba_stats_t const *stats)
+{
+	pinba_udp_counters_t r;
+
+	for (auto const& t : stats->udp_threads)
+	{
+		r.poll_total        += t.poll_total;
+		r.recv_total        += t.recv_total;
+		r.recv_eagain       += t.recv_eagain;
+		r.recv_bytes        += t.recv_bytes;
+		r.recv_packets      += t.recv_packets;
+		r.packet_decode_err += t.packet_decode_err;
+		r.recv_kernel_drops += t.recv_kernel_drops;
+		r.recv_gro_segments += t.recv_gro_segments;
+		r.batch_send_total  += t.batch_send_total;
+		r.batch_send_err    += t.batch_send_err;
+		r.packet_send_total += t.packet_send_total;
+		r.packet_send_err   += t.packet_send_err;
+		r.packet_mem_sampled += t.packet_mem_sampled;
+	}
+
+	return r;
+}
+
+inline pinba_repacker_counters_t pinba_stats___repacker(pinba_stats_t const *stats)
+{
+	pinba_repacker_counters_t r;
+
+	for (auto const& t : stats->repacker_counter_threads)
+	{
+		r.poll_total            += t.poll_total;
+		r.recv_total            += t.recv_total;
+		r.recv_eagain           += t.recv_eagain;
+		r.recv_packets          += t.recv_packets;
+		r.packet_validate_err   += t.packet_validate_err;
+		r.packet_prefilter_drop += t.packet_prefilter_drop;
+		r.packet_ingest_sampled += t.packet_ingest_sampled;
+		r.packet_summaries      += t.packet_summaries;
+		r.packet_summary_requests += t.packet_summary_requests;
+		r.batch_send_total      += t.batch_send_total;
+		r.batch_send_by_timer   += t.batch_send_by_timer;
+		r.batch_send_by_size    += t.batch_send_by_size;
+	}
+
+	return r;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 using pinba_logger_t   = meow::logging::logger_t;
 using pinba_logger_ptr = std::shared_ptr<pinba_logger_t>;
 
+// packet fields, values of which can be kept in permanent dictionary
+// permanent words are never removed, and are looked up without locks or refcounting
+// good for low-cardinality fields only (status, host names, etc.)
+#define PINBA_PERMANENT_FIELD__HOST    (1 << 0)
+#define PINBA_PERMANENT_FIELD__SERVER  (1 << 1)
+#define PINBA_PERMANENT_FIELD__SCRIPT  (1 << 2)
+#define PINBA_PERMANENT_FIELD__SCHEMA  (1 << 3)
+#define PINBA_PERMANENT_FIELD__STATUS  (1 << 4)
+
+// list of cpu ids to run threads on, empty = no affinity
+using pinba_cpu_list_t = std::vector<uint32_t>;
+
+// scheduling of pipeline stage threads, see pinba_set_thread_sched()
+#define PINBA_THREAD_SCHED__DEFAULT  0 // leave as inherited
+#define PINBA_THREAD_SCHED__NICE     1 // SCHED_OTHER, with nice value
+#define PINBA_THREAD_SCHED__FIFO     2 // SCHED_FIFO, realtime, needs CAP_SYS_NICE (or RLIMIT_RTPRIO)
+#define PINBA_THREAD_SCHED__RR       3 // SCHED_RR, same
+
+struct pinba_thread_sched_t
+{
+	int  policy   = PINBA_THREAD_SCHED__DEFAULT;
+	int  priority = 0;  // nice value (-20 to 19) for NICE, realtime priority (1 to 99) for FIFO and RR
+};
+
 struct pinba_options_t
 {
 	std::string net_address;
@@ -160,6 +474,84 @@ struct pinba_options_t
 
 	bool        packet_debug;           // dump arriving packets to log (at info level)
 	double      packet_debug_fraction;  // probability of dumping a single packet (aka, 0.01 = dump roughly every 100th)
+
+	uint32_t    snapshot_merge_threads; // extra threads to merge large report snapshots with, 0 = merge in selecting thread only
+	uint32_t    tick_finalize_threads;  // threads to merge report ticks into history with, 0 = merge in report thread
+
+	uint32_t    permanent_dictionary_fields; // PINBA_PERMANENT_FIELD__* flags, values of these fields go to permanent dictionary
+	uint32_t    dictionary_shards;      // power of 2, see dictionary_t::max_shard_count
+
+	uint32_t    udp_backend;            // PINBA_COLLECTOR_BACKEND__*, see collector.h
+	std::string udp_xdp_interface;      // network interface for AF_XDP udp backend
+	bool        packet_wire_decoder;    // decode requests in repacker threads with pinba_wire_decoder_t, instead of protobuf-c in udp readers
+
+	pinba_cpu_list_t udp_cpus;          // cpu affinity for udp reader threads
+	pinba_cpu_list_t repacker_cpus;     // cpu affinity for repacker threads
+	pinba_cpu_list_t relay_cpus;        // cpu affinity for coordinator packet relay thread
+	pinba_cpu_list_t report_cpus;       // cpu affinity for report threads (including extra aggregator threads)
+	bool        udp_cpu_steering;       // pin udp reader N to its own cpu, steer datagrams to reader on the cpu they were received on
+
+	uint32_t    udp_rcvbuf_traffic_mb;  // expected udp traffic (MB/sec) to size socket buffers for, 0 = keep system default
+	duration_t  udp_rcvbuf_time;        // socket buffers should hold this much traffic (total for all udp reader sockets)
+
+	bool        pipeline_rings;         // pass messages between udp readers, repackers and relay with nmsg_ring_t, instead of nanomsg
+
+	uint32_t    udp_busy_poll_spins;    // empty recvmmsg() calls to spin for, before falling back to poll(), 0 = off
+	uint32_t    udp_busy_poll_usec;     // SO_BUSY_POLL for udp sockets in busy poll mode, 0 = don't set
+	bool        udp_gro;                // UDP_GRO on recvmmsg reader sockets
+
+	uint32_t    repacker_dictionary_reap_words; // max repacker dictionary words to reap per poll iteration, 0 = no limit
+	uint32_t    repacker_dictionary_prefetch;   // requests per window to prefetch dictionary words for, 0 = off (see repacker_conf_t)
+	bool        repacker_columnar_batches;      // repacker adds columnar copy of packet fields to every batch, see packet_columns_t
+
+	uint32_t    report_fuse_max;        // max compatible reports to aggregate in one thread, 0 or 1 = thread per report (see coordinator_conf_t)
+	uint32_t    report_executor_threads; // shared threads to run reports on, 0 = thread per report (see coordinator_conf_t)
+	uint32_t    relay_threads;          // packet relay threads, report hosts are split between them, 0 or 1 = one thread (see coordinator_conf_t)
+	duration_t  report_tick_stagger;    // spread report ticks over this much time after aligned tick, 0 = off (see report_ticker_conf_t)
+	duration_t  report_overload_lag;    // batch lag for report hosts to start aggregating only some batches, 0 = off (see report_overload_t)
+	uint64_t    report_max_mem_total;   // soft limit on memory of all reports (bytes), 0 = no limit (see report_mem_budget_t)
+	uint64_t    mem_governor_max;       // engine-wide memory budget (bytes), 0 = off (see mem_governor.h)
+
+	std::string export_socket_path;     // unix socket to serve binary report snapshots on, empty = off (see exporter.h)
+	std::string export_address;         // tcp listener for binary report snapshots, for other nodes to gather from
+	std::string export_port;            // empty = off
+	std::string gather_nodes;           // comma-separated nodes to gather sharded reports from, empty = off (see snapshot_gather.h)
+	std::string metrics_address;        // http listener for prometheus /metrics
+	std::string metrics_port;           // empty = off
+
+	duration_t  repacker_batch_latency_target; // adaptive repacker batching, 0 = off (see repacker_conf_t)
+	double      repacker_batch_fill_target;
+
+	std::string history_dir;            // save report history here on report delete/shutdown, load on create, empty = off (see report_persist.h)
+
+	std::string federation_upstream;    // edge mode, send report ticks to central pinba at this nanomsg endpoint, empty = off (see federation.h)
+	std::string federation_listen;      // central mode, receive report ticks from edges on this nanomsg endpoint, empty = off
+
+	std::string relay_upstream;         // relay-only mode, send repacked packet batches to this nanomsg endpoint, empty = off (see packet_relay.h)
+	std::string relay_listen;           // aggregator mode, receive repacked batches from relays on this nanomsg endpoint, empty = off
+
+	uint32_t    nmpa_block_allocator;      // PINBA_BLOCK_ALLOCATOR__*, process-wide, see block_allocator.h
+	bool        nmpa_block_allocator_numa; // keep freed nmpa blocks per numa node, bind huge page chunks to it
+
+	std::string sample_rate_tag;        // request tag with client sample rate (1-in-N), empty = off (see packet_t::sample_rate)
+	uint32_t    ingest_budget;          // packets/sec to aggregate, sampling with scaling over it, 0 = off (see repacker_conf_t)
+
+	uint32_t    packet_capture_size;    // recent raw packets to keep for ad-hoc selects, 0 = off (see packet_capture.h)
+	uint32_t    packet_capture_sample;  // capture every N-th packet
+
+	std::string datagram_capture_path;      // record raw udp datagrams to this file, empty = off (see datagram_capture.h)
+	uint64_t    datagram_capture_file_size; // max file size (bytes), file is rotated to <path>.1 when full
+
+	uint32_t    snapshot_prewarm_min_qpm; // selects per minute to prepare report snapshots right after tick, 0 = off (see coordinator_conf_t)
+	uint64_t    snapshot_prewarm_max_mem; // memory budget (bytes) for those, 0 = no limit
+
+	bool        reclaim_thread;         // expired history ticks are freed in a background thread, not report ones (see reclaimer.h)
+
+	pinba_thread_sched_t udp_sched;             // scheduling for udp reader threads
+	pinba_thread_sched_t repacker_sched;        // repacker threads
+	pinba_thread_sched_t relay_sched;           // coordinator packet relay threads
+	pinba_thread_sched_t report_sched;          // report threads (including extra aggregators, executor and tick finalize threads)
+	pinba_thread_sched_t snapshot_merge_sched;  // select side, snapshot merge and prewarm threads
 };
 
 struct pinba_globals_t : private boost::noncopyable
@@ -174,6 +566,14 @@ struct pinba_globals_t : private boost::noncopyable
 	virtual pinba_options_t*       options_mutable() = 0;
 	virtual dictionary_t*          dictionary() const = 0;
 	virtual pinba_os_symbols_t*    os_symbols() const = 0;
+	virtual thread_pool_t*         snapshot_merge_pool() const = 0; // nullptr if parallel merge is disabled
+	virtual thread_pool_t*         tick_finalize_pool() const = 0;  // nullptr if ticks are merged into history in report threads
+	virtual pipeline_latency_t*    pipeline_latency() const = 0;
+	virtual federation_sender_t*   federation_sender() const = 0;   // nullptr unless pinba_options_t::federation_upstream is set
+	virtual packet_capture_t*      packet_capture() const = 0;      // nullptr unless pinba_options_t::packet_capture_size is set
+	virtual datagram_capture_t*    datagram_capture() const = 0;    // nullptr unless pinba_options_t::datagram_capture_path is set
+	virtual reclaimer_t*           reclaimer() const = 0;           // nullptr unless pinba_options_t::reclaim_thread is set
+	virtual async_log_t*           async_log() const = 0;           // always there, see async_log_writer_t
 };
 typedef std::unique_ptr<pinba_globals_t> pinba_globals_ptr;
 
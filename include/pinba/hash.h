@@ -2,6 +2,7 @@
 #define PINBA__HASH_H_
 
 #include <cstdint>
+#include <cstring>
 #include <type_traits>
 
 #include <meow/str_ref.hpp>
@@ -50,6 +51,68 @@ namespace pinba {
 		}
 	};
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// hashing for small fixed-size integer keys (word ids, report keys), width is selected at compile time
+// <= 8 bytes  - one multiply-xorshift round (splitmix64 finalizer)
+// <= 16 bytes - two rounds, second one over first result
+// wider       - t1ha0(), it's fast enough when there's something to chew on
+//
+// all output bits depend on all input bits, both low (hashtable buckets) and high (partitions) bits are usable
+// NOTE: not the same values as hash_number(), don't mix them up (blooms use hash_number())
+
+	inline uint64_t hash_mix64(uint64_t x)
+	{
+		x ^= x >> 30;
+		x *= 0xbf58476d1ce4e5b9ULL;
+		x ^= x >> 27;
+		x *= 0x94d049bb133111ebULL;
+		x ^= x >> 31;
+		return x;
+	}
+
+	template<size_t N>
+	inline uint64_t hash_fixed(void const *data, std::integral_constant<int, 1> /*one_word*/)
+	{
+		uint64_t w = 0;
+		memcpy(&w, data, N);
+		return hash_mix64(w);
+	}
+
+	template<size_t N>
+	inline uint64_t hash_fixed(void const *data, std::integral_constant<int, 2> /*two_words*/)
+	{
+		uint64_t w[2] = { 0, 0 };
+		memcpy(w, data, N);
+		return hash_mix64(hash_mix64(w[0]) ^ w[1]);
+	}
+
+	template<size_t N>
+	inline uint64_t hash_fixed(void const *data, std::integral_constant<int, 0> /*wide*/)
+	{
+		return t1ha0(data, N, 0);
+	}
+
+	template<size_t N>
+	inline uint64_t hash_fixed(void const *data)
+	{
+		static_assert(N > 0, "can't hash nothing");
+		return hash_fixed<N>(data, std::integral_constant<int, (N <= 8) ? 1 : (N <= 16) ? 2 : 0>{});
+	}
+
+	template<class T>
+	struct fixed_hasher_t
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "need plain bytes to hash");
+
+		using result_type   = uint64_t;
+		using argument_type = T;
+
+		inline result_type operator()(argument_type const& key) const
+		{
+			return hash_fixed<sizeof(T)>(&key);
+		}
+	};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 } // namespace pinba {
 ////////////////////////////////////////////////////////////////////////////////////////////////
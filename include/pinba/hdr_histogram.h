@@ -1,11 +1,17 @@
 #ifndef PINBA__HDR_HISTOGRAM_H_
 #define PINBA__HDR_HISTOGRAM_H_
 
+#include <algorithm> // fill
 #include <cstdint>
+#include <iterator>  // next
 #include <cmath>   // ceil
 #include <memory>
 #include <type_traits>
 
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
 #include <boost/noncopyable.hpp>
 
 #include <meow/error.hpp>
@@ -228,6 +234,17 @@ public: // reads
 
 public:
 
+	// forget all values, but keep counts memory (can't give it back to nmpa anyway)
+	void reset() noexcept
+	{
+		negative_inf_   = 0;
+		positive_inf_   = 0;
+		total_count_    = 0;
+		counts_nonzero_ = 0;
+
+		std::fill(counts_, counts_ + counts_len_, 0);
+	}
+
 	bool increment(config_t const& conf, int64_t value, counter_t increment_by = 1) noexcept
 	{
 		// copy-pasted comment from histogram_t::increment on boundary inclusion
@@ -240,16 +257,27 @@ public:
 		// [bucket_count-1] -> (min_value+bucket_d*(bucket_count-1), min_value+bucket_d*bucket_count]
 		// [positive_inf]   -> (max_value, +inf)
 
-		if (__builtin_expect(value < conf.lowest_trackable_value, 0))
+		int32_t const counts_index = (__builtin_expect(value < conf.lowest_trackable_value, 0))
+				? counts_index___negative_inf
+				: (__builtin_expect(value > conf.highest_trackable_value, 0))
+					? counts_index___positive_inf
+					: counts_index_for(value);
+
+		return this->increment_at_counts_index(counts_index, increment_by);
+	}
+
+	// counts_index is from counts_index_for_multi() (or counts_index___*_inf markers)
+	bool increment_at_counts_index(int32_t counts_index, counter_t increment_by) noexcept
+	{
+		if (__builtin_expect(counts_index == counts_index___negative_inf, 0))
 		{
 			this->negative_inf_ += increment_by;
 		}
-		else if (__builtin_expect(value > conf.highest_trackable_value, 0))
+		else if (__builtin_expect(counts_index == counts_index___positive_inf, 0))
 		{
 			this->positive_inf_ += increment_by;
 		}
 		else {
-			int32_t const counts_index = counts_index_for(value);
 			// assert((counts_index >= 0) && ((uint32_t)counts_index < this->counts_len_));
 
 			if ((uint32_t)counts_index >= counts_len_)
@@ -277,6 +305,49 @@ public:
 		return true;
 	}
 
+	// same as increment() for every value, but indexes are computed in bulk (see counts_index_for_multi())
+	// and sorted, so that every counter is written once, with all the values that hit it
+	// returns false if any of increments failed (see increment())
+	bool increment_multi(config_t const& conf, int64_t const *values, counter_t const *increment_by, size_t n) noexcept
+	{
+		constexpr size_t const block_size = 64;
+
+		struct run_t
+		{
+			int32_t    counts_index;
+			counter_t  increment_by;
+		};
+
+		int32_t indexes[block_size];
+		run_t   runs[block_size];
+		bool    result = true;
+
+		for (size_t offset = 0; offset < n; offset += block_size)
+		{
+			size_t const n_block = std::min(block_size, n - offset);
+
+			counts_index_for_multi(conf, values + offset, n_block, indexes);
+
+			for (size_t i = 0; i < n_block; i++)
+				runs[i] = { indexes[i], increment_by[offset + i] };
+
+			std::sort(runs, runs + n_block, [](run_t const& l, run_t const& r) { return l.counts_index < r.counts_index; });
+
+			for (size_t i = 0; i < n_block; /**/)
+			{
+				int32_t const counts_index = runs[i].counts_index;
+				counter_t     total_by     = 0;
+
+				for (; (i < n_block) && (runs[i].counts_index == counts_index); i++)
+					total_by += runs[i].increment_by;
+
+				result &= this->increment_at_counts_index(counts_index, total_by);
+			}
+		}
+
+		return result;
+	}
+
 	void merge_other_with_same_conf(self_t const& other, config_t const& conf)
 	{
 		assert(this->counts_maxlen_ == other.counts_maxlen_);
@@ -308,6 +379,46 @@ public:
 		this->total_count_ += other.total_count_;
 	}
 
+	// add counts from many histograms with the same conf at once, sources are iterators over pointers
+	// inner loop is a plain array add (no branches, so compiler vectorizes it)
+	// and counts_nonzero is recalculated once after all adds
+	template<class Iterator>
+	void merge_multi_with_same_conf(Iterator begin, Iterator end, config_t const& conf)
+	{
+		for (auto it = begin; it != end; it = std::next(it))
+		{
+			self_t const& other = **it;
+			assert(this->counts_maxlen_ == other.counts_maxlen_);
+
+			if (this->counts_len_ < other.counts_len_)
+			{
+				counter_t *tmp = (counter_t*)nmpa_realloc(nmpa_, counts_, counts_len_ * sizeof(counter_t), counts_maxlen_ * sizeof(counter_t));
+				if (tmp == nullptr)
+					throw std::bad_alloc();
+
+				std::uninitialized_fill(tmp + counts_len_, tmp + counts_maxlen_, 0);
+				counts_len_ = counts_maxlen_;
+				counts_ = tmp;
+			}
+
+			counter_t       *__restrict dst = this->counts_;
+			counter_t const *__restrict src = other.counts_;
+
+			for (uint32_t i = 0; i < other.counts_len_; i++)
+				dst[i] += src[i];
+
+			this->negative_inf_ += other.negative_inf_;
+			this->positive_inf_ += other.positive_inf_;
+			this->total_count_  += other.total_count_;
+		}
+
+		uint32_t nonzero = 0;
+		for (uint32_t i = 0; i < this->counts_len_; i++)
+			nonzero += (this->counts_[i] != 0);
+
+		this->counts_nonzero_ = nonzero;
+	}
+
 public:
 
 	inline int64_t get_percentile(config_t const& conf, double percentile) const
@@ -392,6 +503,90 @@ public:
 		assert(!"must not be reached");
 	}
 
+	// same as get_percentile() for every one of percentiles[0 .. n), but in one scan over counts
+	// percentiles can be in any order
+	inline void get_percentiles(config_t const& conf, double const *percentiles, size_t n, int64_t *result) const
+	{
+		if (n == 0)
+			return;
+
+		// percentiles that need the scan, required sums are past negative_inf
+		struct want_t
+		{
+			uint64_t required_sum;
+			size_t   index;
+		};
+		want_t wants[n];
+		size_t n_wants = 0;
+
+		uint64_t const total = (uint64_t)this->total_count();
+
+		for (size_t i = 0; i < n; i++)
+		{
+			double const percentile = percentiles[i];
+
+			if ((percentile == 0.) || (total == 0))
+			{
+				result[i] = conf.lowest_trackable_value;
+				continue;
+			}
+
+			uint64_t const required_sum = [&]()
+			{
+				uint64_t const res = std::ceil(total * percentile / 100.0);
+				return (res > total) ? total : res;
+			}();
+
+			if (required_sum <= (uint64_t)this->negative_inf())
+			{
+				result[i] = conf.lowest_trackable_value;
+				continue;
+			}
+
+			if (required_sum > (uint64_t)(total - this->positive_inf()))
+			{
+				result[i] = conf.highest_trackable_value;
+				continue;
+			}
+
+			wants[n_wants++] = { required_sum - this->negative_inf(), i };
+		}
+
+		std::sort(wants, wants + n_wants, [](want_t const& l, want_t const& r) { return l.required_sum < r.required_sum; });
+
+		uint64_t current_sum = 0;
+		size_t   w           = 0;
+
+		auto const counts_r = this->get_counts_range();
+
+		for (uint32_t i = 0; (i < counts_r.size()) && (w < n_wants); i++)
+		{
+			uint32_t const bucket_id       = i;
+			uint64_t const next_has_values = counts_r[i];
+
+			// every percentile that ends in this bucket
+			for (; w < n_wants; w++)
+			{
+				uint64_t const need_values = wants[w].required_sum - current_sum;
+				if (next_has_values < need_values)
+					break;
+
+				int64_t const value = (next_has_values == need_values)
+						? this->highest_equivalent_value(this->value_at_index(bucket_id))
+						: this->lowest_equivalent_value(this->value_at_index(bucket_id))
+							+ this->size_of_equivalent_value_range(bucket_id) * need_values / next_has_values;
+
+				result[wants[w].index] = (value < conf.highest_trackable_value)
+						? value
+						: conf.highest_trackable_value;
+			}
+
+			current_sum += next_has_values;
+		}
+
+		assert((w == n_wants) && "must have found all percentiles");
+	}
+
 public:
 
 	inline counter_t count_at_index(int32_t index) const
@@ -477,6 +672,94 @@ public: // utilities
 		return counts_index(bucket_index, sub_bucket_index);
 	}
 
+	// markers for values out of trackable range, see counts_index_for_multi() and increment_at_counts_index()
+	enum : int32_t
+	{
+		counts_index___negative_inf = -1,
+		counts_index___positive_inf = -2,
+	};
+
+	// counts_index_for() for config, values out of [lowest, highest] trackable range get counts_index___*_inf
+	static inline int32_t counts_index_for___conf(config_t const& conf, int64_t value)
+	{
+		if (value < conf.lowest_trackable_value)
+			return counts_index___negative_inf;
+
+		if (value > conf.highest_trackable_value)
+			return counts_index___positive_inf;
+
+		int32_t const pow2ceiling      = 64 - __builtin_clzll(value | conf.sub_bucket_mask);
+		int32_t const bucket_index     = pow2ceiling - conf.unit_magnitude - (conf.sub_bucket_half_count_magnitude + 1);
+		int32_t const sub_bucket_index = get_sub_bucket_index(value, bucket_index, conf.unit_magnitude);
+
+		return ((bucket_index + 1) << conf.sub_bucket_half_count_magnitude) + (sub_bucket_index - conf.sub_bucket_half_count);
+	}
+
+	// counts_index_for___conf() for every value, 2 values at a time with sse4.2 (64bit compares)
+	// there are no packed clz or variable shifts for 64bit lanes, so both are done with doubles instead:
+	//   exponent of double(v | sub_bucket_mask) is the highest bit of it, shifting right is multiplying by 2^-shift and flooring
+	// both are exact for values < 2^52, histograms tracking larger values use the scalar version
+	static inline void counts_index_for_multi(config_t const& conf, int64_t const *values, size_t n, int32_t *result)
+	{
+		size_t i = 0;
+
+#if defined(__SSE4_2__)
+		if (conf.highest_trackable_value < (int64_t(1) << 52))
+		{
+			// int64 in [0, 2^52) <-> double, by or-ing/adding 2^52 (and subtracting it back)
+			__m128i const magic_i = _mm_set1_epi64x(0x4330000000000000LL);
+			__m128d const magic_d = _mm_set1_pd(4503599627370496.0); // 2^52
+
+			__m128i const mask       = _mm_set1_epi64x(conf.sub_bucket_mask);
+			__m128i const lowest     = _mm_set1_epi64x(conf.lowest_trackable_value);
+			__m128i const highest    = _mm_set1_epi64x(conf.highest_trackable_value);
+			__m128i const exp_sub    = _mm_set1_epi64x(1023 + conf.unit_magnitude + conf.sub_bucket_half_count_magnitude);
+			__m128i const half_count = _mm_set1_epi64x(conf.sub_bucket_half_count);
+			__m128i const one        = _mm_set1_epi64x(1);
+			__m128i const shbhcm     = _mm_cvtsi32_si128(conf.sub_bucket_half_count_magnitude);
+			__m128i const neg_inf    = _mm_set1_epi64x(counts_index___negative_inf);
+			__m128i const pos_inf    = _mm_set1_epi64x(counts_index___positive_inf);
+			__m128i const bias_1023  = _mm_set1_epi64x(1023);
+			__m128i const unit_mag   = _mm_set1_epi64x(conf.unit_magnitude);
+
+			for (; i + 2 <= n; i += 2)
+			{
+				__m128i const v = _mm_loadu_si128((__m128i const*)(values + i));
+
+				__m128i const is_neg = _mm_cmpgt_epi64(lowest, v);
+				__m128i const is_pos = _mm_cmpgt_epi64(v, highest);
+
+				// clamp out of range lanes to something sane, their results are replaced below
+				__m128i const vc = _mm_blendv_epi8(v, lowest, _mm_or_si128(is_neg, is_pos));
+
+				// bucket_index = floor(log2(v | mask)) + 1 - unit_magnitude - (half_count_magnitude + 1)
+				__m128i const vm     = _mm_or_si128(vc, mask);
+				__m128d const vm_d   = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(vm, magic_i)), magic_d);
+				__m128i const bucket = _mm_sub_epi64(_mm_srli_epi64(_mm_castpd_si128(vm_d), 52), exp_sub);
+
+				// sub_bucket_index = v >> (bucket_index + unit_magnitude) = floor(v * 2^-(bucket_index + unit_magnitude))
+				__m128i const shift    = _mm_add_epi64(bucket, unit_mag);
+				__m128d const scale    = _mm_castsi128_pd(_mm_slli_epi64(_mm_sub_epi64(bias_1023, shift), 52));
+				__m128d const v_d      = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(vc, magic_i)), magic_d);
+				__m128d const sub_d    = _mm_add_pd(_mm_floor_pd(_mm_mul_pd(v_d, scale)), magic_d);
+				__m128i const sub      = _mm_xor_si128(_mm_castpd_si128(sub_d), magic_i);
+
+				// ((bucket_index + 1) << half_count_magnitude) + (sub_bucket_index - half_count)
+				__m128i idx = _mm_add_epi64(_mm_sll_epi64(_mm_add_epi64(bucket, one), shbhcm), _mm_sub_epi64(sub, half_count));
+				idx = _mm_blendv_epi8(idx, neg_inf, is_neg);
+				idx = _mm_blendv_epi8(idx, pos_inf, is_pos);
+
+				// low 32 bits of both lanes
+				__m128i const packed = _mm_shuffle_epi32(idx, _MM_SHUFFLE(3, 3, 2, 0));
+				_mm_storel_epi64((__m128i*)(result + i), packed);
+			}
+		}
+#endif
+
+		for (; i < n; i++)
+			result[i] = counts_index_for___conf(conf, values[i]);
+	}
+
 private:
 	struct nmpa_s *nmpa_;
 	// 8
@@ -1,11 +1,19 @@
 #ifndef PINBA__HISTOGRAM_H_
 #define PINBA__HISTOGRAM_H_
 
+#include <algorithm> // sort
 #include <cstdint>
 #include <cmath>   // ceil
+#include <vector>
+
+#include <smmintrin.h> // sse4.1, _mm_testz_si128
+
+#include <meow/utility/offsetof.hpp> // MEOW_SELF_FROM_MEMBER
 
 #include "pinba/limits.h"
 #include "pinba/hdr_histogram.h"
+#include "pinba/multi_merge.h"
+#include "pinba/varint.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // histograms
@@ -21,8 +29,45 @@ struct histogram_conf_t
 	duration_t bucket_d;     // bucket width
 
 	hdr_histogram_conf_t hdr;
+
+	// log-scale buckets with bounded relative error (aka ddsketch), when rel_accuracy > 0
+	// bucket i covers (gamma^(i-2), gamma^(i-1)] units, bucket 1 takes everything <= 1 unit
+	// bucket ids are stored instead of values in hdr/flat histograms (hdr is configured to keep each id separately),
+	// so all merges work as is and only percentile calculation needs to know
+	double     rel_accuracy;     // 0 for linear buckets
+	double     dd_gamma;         // (1 + rel_accuracy) / (1 - rel_accuracy)
+	double     dd_log_gamma_inv; // 1 / ln(gamma)
 };
 
+inline double histogram___dd_gamma(double rel_accuracy)
+{
+	return (1.0 + rel_accuracy) / (1.0 - rel_accuracy);
+}
+
+// number of log-scale buckets needed to cover [1, max_units]
+inline uint32_t histogram___dd_bucket_count(double rel_accuracy, double max_units)
+{
+	return 1 + (uint32_t)std::ceil(std::log(max_units) / std::log(histogram___dd_gamma(rel_accuracy)));
+}
+
+inline int64_t histogram___dd_bucket_for(histogram_conf_t const& conf, int64_t value)
+{
+	if (value <= 1)
+		return 1;
+
+	return 1 + (int64_t)std::ceil(std::log((double)value) * conf.dd_log_gamma_inv);
+}
+
+// value, that is within rel_accuracy of everything in bucket
+inline duration_t histogram___dd_value_at(histogram_conf_t const& conf, int64_t bucket_id)
+{
+	if (bucket_id <= 1)
+		return conf.unit_size;
+
+	double const value = 2.0 * std::pow(conf.dd_gamma, double(bucket_id - 1)) / (conf.dd_gamma + 1.0);
+	return duration_t { (int64_t)(value * conf.unit_size.nsec) };
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // plain sorted-array histograms, should be faster to merge and calculate percentiles from
 
@@ -49,8 +94,13 @@ struct flat_histogram_t
 };
 static_assert(sizeof(flat_histogram_t) == (sizeof(histogram_values_t)+4*sizeof(uint32_t)), "flat_histogram_t must have no padding");
 
+inline duration_t get_percentile___dd(flat_histogram_t const& hv, histogram_conf_t const& conf, double percentile);
+
 inline duration_t get_percentile(flat_histogram_t const& hv, histogram_conf_t const& conf, double percentile)
 {
+	if (conf.rel_accuracy > 0)
+		return get_percentile___dd(hv, conf, percentile);
+
 	if (percentile == 0.)
 		return conf.min_value;
 
@@ -129,6 +179,189 @@ inline duration_t get_percentile(flat_histogram_t const& hv, histogram_conf_t co
 	assert(!"must not be reached");
 }
 
+// log-scale buckets, no interpolation within bucket, bucket value is already within rel_accuracy
+inline duration_t get_percentile___dd(flat_histogram_t const& hv, histogram_conf_t const& conf, double percentile)
+{
+	if (hv.total_count == 0)
+		return conf.min_value;
+
+	uint32_t const required_sum = [&]()
+	{
+		uint32_t const res = std::ceil(hv.total_count * percentile / 100.0);
+		return (res > hv.total_count) ? hv.total_count : ((res == 0) ? 1 : res);
+	}();
+
+	if (required_sum <= hv.negative_inf)
+		return conf.min_value;
+
+	if (required_sum > (hv.total_count - hv.positive_inf))
+		return conf.max_value;
+
+	uint32_t current_sum = hv.negative_inf;
+
+	for (auto const& item : hv.values)
+	{
+		current_sum += item.value;
+		if (current_sum >= required_sum)
+			return histogram___dd_value_at(conf, item.bucket_id);
+	}
+
+	assert(!"must not be reached");
+	return conf.max_value;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// all percentiles at once, result[i] is the same as get_percentile(hv, conf, percentiles[i])
+// but every histogram is scanned once, instead of once per percentile
+// percentiles can be in any order (views have them in column order)
+
+inline void get_percentiles___dd(flat_histogram_t const& hv, histogram_conf_t const& conf, double const *percentiles, size_t n, duration_t *result);
+
+inline void get_percentiles(flat_histogram_t const& hv, histogram_conf_t const& conf, double const *percentiles, size_t n, duration_t *result)
+{
+	if (conf.rel_accuracy > 0)
+		return get_percentiles___dd(hv, conf, percentiles, n, result);
+
+	if (n == 0)
+		return;
+
+	// percentiles that need the scan, required sums are past negative_inf
+	struct want_t
+	{
+		uint32_t required_sum;
+		uint32_t index;
+	};
+	want_t wants[n];
+	size_t n_wants = 0;
+
+	for (size_t i = 0; i < n; i++)
+	{
+		double const percentile = percentiles[i];
+
+		if ((percentile == 0.) || (hv.total_count == 0))
+		{
+			result[i] = conf.min_value;
+			continue;
+		}
+
+		uint32_t const required_sum = [&]()
+		{
+			uint32_t const res = std::ceil(hv.total_count * percentile / 100.0);
+			return (res > hv.total_count) ? hv.total_count : res;
+		}();
+
+		if ((required_sum == 0) || (required_sum <= hv.negative_inf))
+		{
+			result[i] = conf.min_value;
+			continue;
+		}
+
+		if (required_sum > (hv.total_count - hv.positive_inf))
+		{
+			result[i] = conf.max_value;
+			continue;
+		}
+
+		wants[n_wants++] = { required_sum - hv.negative_inf, uint32_t(i) };
+	}
+
+	std::sort(wants, wants + n_wants, [](want_t const& l, want_t const& r) { return l.required_sum < r.required_sum; });
+
+	uint32_t current_sum = 0;
+	size_t   w           = 0;
+
+	for (auto const& item : hv.values)
+	{
+		if (w == n_wants)
+			break;
+
+		uint32_t const bucket_id       = item.bucket_id;
+		uint32_t const next_has_values = item.value;
+
+		// every percentile that ends in this bucket, see get_percentile() for complete/incomplete bucket math
+		for (; w < n_wants; w++)
+		{
+			uint32_t const need_values = wants[w].required_sum - current_sum;
+			if (next_has_values < need_values)
+				break;
+
+			if (next_has_values == need_values)
+			{
+				result[wants[w].index] = conf.min_value + conf.bucket_d * bucket_id;
+				continue;
+			}
+
+			assert(bucket_id > 0);
+			result[wants[w].index] = conf.min_value + conf.bucket_d * (bucket_id - 1) + conf.bucket_d * need_values / next_has_values;
+		}
+
+		current_sum += next_has_values;
+	}
+
+	assert((w == n_wants) && "must have found all percentiles");
+}
+
+inline void get_percentiles___dd(flat_histogram_t const& hv, histogram_conf_t const& conf, double const *percentiles, size_t n, duration_t *result)
+{
+	if (n == 0)
+		return;
+
+	struct want_t
+	{
+		uint32_t required_sum;
+		uint32_t index;
+	};
+	want_t wants[n];
+	size_t n_wants = 0;
+
+	for (size_t i = 0; i < n; i++)
+	{
+		if (hv.total_count == 0)
+		{
+			result[i] = conf.min_value;
+			continue;
+		}
+
+		uint32_t const required_sum = [&]()
+		{
+			uint32_t const res = std::ceil(hv.total_count * percentiles[i] / 100.0);
+			return (res > hv.total_count) ? hv.total_count : ((res == 0) ? 1 : res);
+		}();
+
+		if (required_sum <= hv.negative_inf)
+		{
+			result[i] = conf.min_value;
+			continue;
+		}
+
+		if (required_sum > (hv.total_count - hv.positive_inf))
+		{
+			result[i] = conf.max_value;
+			continue;
+		}
+
+		wants[n_wants++] = { required_sum, uint32_t(i) };
+	}
+
+	std::sort(wants, wants + n_wants, [](want_t const& l, want_t const& r) { return l.required_sum < r.required_sum; });
+
+	uint32_t current_sum = hv.negative_inf;
+	size_t   w           = 0;
+
+	for (auto const& item : hv.values)
+	{
+		if (w == n_wants)
+			break;
+
+		current_sum += item.value;
+
+		for (; (w < n_wants) && (current_sum >= wants[w].required_sum); w++)
+			result[wants[w].index] = histogram___dd_value_at(conf, item.bucket_id);
+	}
+
+	assert((w == n_wants) && "must have found all percentiles");
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // hdr histogram - used for current timeslice histograms aggregation
 
@@ -141,27 +374,79 @@ struct hdr_histogram_t : public hdr_histogram___impl_t<uint32_t>
 	{
 	}
 
-	void increment(histogram_conf_t const& conf, duration_t const d, uint32_t increment_by = 1)
+	// value to track in hdr histogram for duration
+	static int64_t hdr_value_for(histogram_conf_t const& conf, duration_t const d)
 	{
 		// round the value up, to nearest multiple of unit_size
 		auto const dr = std::div(d.nsec, conf.unit_size.nsec);
 		int64_t const value = dr.quot + (dr.rem != 0);
 
-		this->base_t::increment(conf.hdr, value, increment_by);
+		// log-scale buckets store bucket id as value, see histogram_conf_t::rel_accuracy
+		return (conf.rel_accuracy > 0)
+				? histogram___dd_bucket_for(conf, value)
+				: value;
+	}
+
+	void increment(histogram_conf_t const& conf, duration_t const d, uint32_t increment_by = 1)
+	{
+		this->base_t::increment(conf.hdr, hdr_value_for(conf, d), increment_by);
+	}
+
+	// bulk version of increment(), see hdr_histogram___impl_t::increment_multi()
+	void increment_multi(histogram_conf_t const& conf, duration_t const *values, uint32_t const *increment_by, size_t n)
+	{
+		constexpr size_t const block_size = 64;
+		int64_t hdr_values[block_size];
+
+		for (size_t offset = 0; offset < n; offset += block_size)
+		{
+			size_t const n_block = std::min(block_size, n - offset);
+
+			for (size_t i = 0; i < n_block; i++)
+				hdr_values[i] = hdr_value_for(conf, values[offset + i]);
+
+			this->base_t::increment_multi(conf.hdr, hdr_values, increment_by + offset, n_block);
+		}
 	}
 
 	void merge_other_with_same_conf(hdr_histogram_t const& other, histogram_conf_t const& conf)
 	{
 		return this->base_t::merge_other_with_same_conf(other, conf.hdr);
 	}
+
+	template<class Iterator>
+	void merge_multi_with_same_conf(Iterator begin, Iterator end, histogram_conf_t const& conf)
+	{
+		return this->base_t::merge_multi_with_same_conf(begin, end, conf.hdr);
+	}
 };
 
 inline duration_t get_percentile(hdr_histogram_t const& hv, histogram_conf_t const& conf, double percentile)
 {
 	int64_t const pct_value = hv.get_percentile(conf.hdr, percentile);
+
+	if (conf.rel_accuracy > 0)
+		return histogram___dd_value_at(conf, pct_value);
+
 	return pct_value * conf.unit_size;
 }
 
+inline void get_percentiles(hdr_histogram_t const& hv, histogram_conf_t const& conf, double const *percentiles, size_t n, duration_t *result)
+{
+	if (n == 0)
+		return;
+
+	int64_t pct_values[n];
+	hv.get_percentiles(conf.hdr, percentiles, n, pct_values);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		result[i] = (conf.rel_accuracy > 0)
+				? histogram___dd_value_at(conf, pct_values[i])
+				: pct_values[i] * conf.unit_size;
+	}
+}
+
 inline meow::error_t hdr_histogram_configure(hdr_histogram_conf_t *conf, histogram_conf_t const& hv_conf)
 {
 	// FIXME: find a better way to fix this
@@ -207,6 +492,307 @@ inline flat_histogram_t histogram___convert_hdr_to_flat(hdr_histogram_t const& h
 	return flat;
 }
 
+// quantile summary of hv, at most n_points buckets (report_conf___by_*_t::hv_summary_points), built once per row per tick
+// values are split by rank into n_points groups of (about) equal size, every group goes to the bucket of its middle value
+// infinities are kept as is
+//
+// no value moves further than half a group (in rank) of its own histogram, so percentiles of summaries merged from any number of ticks
+// are off by at most 50 / n_points percentile points from percentiles of merged full histograms
+// (i.e. n_points = 100 -> p95 is somewhere in [p94.5, p95.5]), bucket width error is the same as for full histograms
+inline flat_histogram_t flat_histogram___summarize(flat_histogram_t const& hv, uint32_t n_points)
+{
+	if ((n_points == 0) || (hv.values.size() <= n_points))
+		return hv;
+
+	flat_histogram_t result;
+	result.total_count  = hv.total_count;
+	result.negative_inf = hv.negative_inf;
+	result.positive_inf = hv.positive_inf;
+	result.values.reserve(n_points);
+
+	uint64_t const n_values = hv.total_count - hv.negative_inf - hv.positive_inf;
+
+	auto     it      = hv.values.begin();
+	uint64_t cum_end = it->value; // ranks [0, cum_end) are in buckets up to and including it
+
+	for (uint32_t g = 0; g < n_points; g++)
+	{
+		uint64_t const begin = n_values * g / n_points;
+		uint64_t const end   = n_values * (g + 1) / n_points;
+		if (begin == end)
+			continue;
+
+		uint64_t const mid = begin + (end - begin) / 2;
+		while (cum_end <= mid)
+		{
+			++it;
+			cum_end += it->value;
+		}
+
+		uint32_t const count = uint32_t(end - begin);
+
+		if (!result.values.empty() && (result.values.back().bucket_id == it->bucket_id))
+			result.values.back().value += count;
+		else
+			result.values.push_back({ it->bucket_id, count });
+	}
+
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// flat histogram multi-merge
+// sources are given as pointers to flat_histogram_t::values (this is a 'limitation' of multi_merge())
+// and full flat_histogram_t structs are restored from those to merge totals
+
+// sparse merge, k-way with a heap, good when sources have few values spread over a wide bucket range
+template<class Iterator>
+inline void flat_histogram___merge_multi_sparse(flat_histogram_t *to, Iterator begin, Iterator end)
+{
+	struct merger_t
+	{
+		flat_histogram_t *to;
+
+		inline bool compare(histogram_value_t const& l, histogram_value_t const& r) const
+		{
+			return l.bucket_id < r.bucket_id;
+		}
+
+		inline bool equal(histogram_value_t const& l, histogram_value_t const& r) const
+		{
+			return l.bucket_id == r.bucket_id;
+		}
+
+		inline void reserve(size_t const sz)
+		{
+			to->values.reserve(sz);
+		}
+
+		inline void push_back(histogram_values_t const *seq, histogram_value_t const& v)
+		{
+			bool const should_insert = [&]()
+			{
+				if (to->values.empty())
+					return true;
+
+				return !equal(to->values.back(), v);
+			}();
+
+			if (should_insert)
+			{
+				to->values.emplace_back(v);
+			}
+			else
+			{
+				to->values.back().value += v.value;
+			}
+		}
+	};
+
+	merger_t merger = { .to = to };
+	pinba::multi_merge(&merger, begin, end);
+}
+
+// dense merge, accumulates into a bucket_id indexed array of counters, then compacts non-zero counters
+// good when sources cover the same (reasonably small) bucket range, O(values + range) vs O(values * log(sources))
+// scratch is zeroed on entry and left zeroed on exit, so it can be reused without clearing
+template<class Iterator>
+inline void flat_histogram___merge_multi_dense(flat_histogram_t *to, Iterator begin, Iterator end, uint32_t min_bucket, uint32_t max_bucket, std::vector<uint32_t> *scratch)
+{
+	// round up to 4 counters, so compaction loop below can always read them in full sse registers
+	size_t const range = (((size_t)max_bucket - min_bucket + 1) + 3) & ~size_t(3);
+
+	if (scratch->size() < range)
+		scratch->resize(range, 0);
+
+	uint32_t *counts = scratch->data();
+
+	size_t n_values = 0;
+	for (auto i = begin; i != end; i = std::next(i))
+	{
+		histogram_values_t const *seq = *i;
+		for (auto const& v : *seq)
+			counts[v.bucket_id - min_bucket] += v.value;
+
+		n_values += seq->size();
+	}
+
+	// result can't have more values than the input or the range
+	to->values.reserve(std::min(n_values, range));
+
+	for (size_t off = 0; off < range; off += 4)
+	{
+		__m128i const v4 = _mm_loadu_si128((__m128i const*)(counts + off));
+
+		// fastpath, skip empty buckets 4 at a time
+		if (_mm_testz_si128(v4, v4))
+			continue;
+
+		for (size_t j = off; j < off + 4; j++)
+		{
+			if (counts[j] == 0)
+				continue;
+
+			to->values.push_back(histogram_value_t { .bucket_id = (uint32_t)(min_bucket + j), .value = counts[j] });
+			counts[j] = 0;
+		}
+	}
+}
+
+// merge sources into 'to', picks dense or sparse merge per call, based on source value count and bucket range
+template<class Iterator>
+inline void flat_histogram___merge_multi(flat_histogram_t *to, Iterator begin, Iterator end)
+{
+	// max counters array size for dense merge, 256k counters = 1MB, fits in L2 on most modern cpus
+	constexpr size_t dense_merge_max_range = 256 * 1024;
+
+	// take dense path only if counters array is not much larger than the number of values we're merging
+	// otherwise we're going to scan mostly zeroes in compaction
+	constexpr size_t dense_merge_max_sparseness = 4;
+
+	uint32_t min_bucket = PINBA_INTERNAL___UINT32_MAX;
+	uint32_t max_bucket = 0;
+	size_t   n_values   = 0;
+	size_t   n_sources  = 0;
+
+	for (auto i = begin; i != end; i = std::next(i))
+	{
+		histogram_values_t const *seq = *i;
+		flat_histogram_t   const *src = MEOW_SELF_FROM_MEMBER(flat_histogram_t, values, seq);
+
+		to->total_count  += src->total_count;
+		to->negative_inf += src->negative_inf;
+		to->positive_inf += src->positive_inf;
+
+		if (seq->empty())
+			continue;
+
+		// values are sorted by bucket_id
+		min_bucket = std::min(min_bucket, seq->front().bucket_id);
+		max_bucket = std::max(max_bucket, seq->back().bucket_id);
+		n_values  += seq->size();
+		n_sources += 1;
+	}
+
+	if (n_values == 0)
+		return;
+
+	size_t const range = (size_t)max_bucket - min_bucket + 1;
+
+	bool const use_dense = (n_sources > 2)
+						&& (range <= dense_merge_max_range)
+						&& (range <= n_values * dense_merge_max_sparseness);
+
+	if (use_dense)
+	{
+		thread_local std::vector<uint32_t> scratch;
+		flat_histogram___merge_multi_dense(to, begin, end, min_bucket, max_bucket, &scratch);
+	}
+	else
+	{
+		flat_histogram___merge_multi_sparse(to, begin, end);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// flat histograms packed for long term storage (history ticks), unpacked on access
+//
+// per histogram: total_count, negative_inf, positive_inf, n_values, then (bucket_id delta, value) pairs, all varints
+// history histograms are sparse with small bucket gaps and mostly small counts,
+// so a value is usually 2-3 bytes instead of sizeof(histogram_value_t), counters only get wider when they need to
+// (and there's no per histogram vector, a histogram is just an offset)
+
+inline void flat_histogram___pack_append(std::vector<uint8_t> *out, flat_histogram_t const& hv)
+{
+	varint___append(out, hv.total_count);
+	varint___append(out, hv.negative_inf);
+	varint___append(out, hv.positive_inf);
+	varint___append(out, hv.values.size());
+
+	uint32_t prev_bucket_id = 0;
+	for (auto const& v : hv.values)
+	{
+		varint___append(out, uint32_t(v.bucket_id - prev_bucket_id));
+		varint___append(out, v.value);
+		prev_bucket_id = v.bucket_id;
+	}
+}
+
+// replaces hv contents, hv == nullptr just skips packed histogram
+inline void flat_histogram___unpack(uint8_t const **p, flat_histogram_t *hv)
+{
+	uint32_t const total_count  = (uint32_t)varint___read(p);
+	uint32_t const negative_inf = (uint32_t)varint___read(p);
+	uint32_t const positive_inf = (uint32_t)varint___read(p);
+	uint32_t const n_values     = (uint32_t)varint___read(p);
+
+	if (hv == nullptr)
+	{
+		for (uint32_t i = 0; i < n_values * 2; i++)
+			varint___read(p);
+		return;
+	}
+
+	hv->total_count  = total_count;
+	hv->negative_inf = negative_inf;
+	hv->positive_inf = positive_inf;
+	hv->values.resize(n_values);
+
+	uint32_t bucket_id = 0;
+	for (auto& v : hv->values)
+	{
+		bucket_id  += (uint32_t)varint___read(p);
+		v.bucket_id = bucket_id;
+		v.value     = (uint32_t)varint___read(p);
+	}
+}
+
+struct packed_flat_histograms_t
+{
+	std::vector<uint8_t>   data;
+	std::vector<uint32_t>  offsets; // histogram i starts at data[offsets[i]]
+
+	size_t size() const  { return offsets.size(); }
+	bool   empty() const { return offsets.empty(); }
+
+	void reserve(size_t n)
+	{
+		offsets.reserve(n);
+	}
+
+	void push_back(flat_histogram_t const& hv)
+	{
+		offsets.push_back(data.size());
+		flat_histogram___pack_append(&data, hv);
+	}
+
+	// call after the last push_back()
+	void shrink_to_fit()
+	{
+		data.shrink_to_fit();
+		offsets.shrink_to_fit();
+	}
+
+	// replaces hv contents
+	void unpack(size_t i, flat_histogram_t *hv) const
+	{
+		uint8_t const *p = data.data() + offsets[i];
+		flat_histogram___unpack(&p, hv);
+	}
+
+	flat_histogram_t unpack(size_t i) const
+	{
+		flat_histogram_t hv = {};
+		this->unpack(i, &hv);
+		return hv;
+	}
+
+	uint64_t mem_used() const
+	{
+		return data.capacity() + offsets.capacity() * sizeof(*offsets.begin());
+	}
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 #endif // PINBA__HISTOGRAM_H_
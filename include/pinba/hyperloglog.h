@@ -0,0 +1,95 @@
+#ifndef PINBA__HYPERLOGLOG_H_
+#define PINBA__HYPERLOGLOG_H_
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// hyperloglog distinct count sketch, dense registers, fixed precision
+// 2^P registers -> 2^P bytes per sketch, standard error ~1.04/sqrt(2^P)
+//
+// inputs must be well mixed 64bit hashes (see pinba::hash_mix64()),
+// top bits select the register, the rest give the rank (number of leading zeroes + 1)
+
+template<unsigned Precision>
+struct hll_sketch_ex_t
+{
+	static constexpr unsigned precision   = Precision;
+	static constexpr unsigned n_registers = 1u << precision;
+
+	static_assert(precision >= 4 && precision <= 16, "sse merge needs at least 16 registers, and rank must fit in the rest of the hash");
+
+	uint8_t registers[n_registers];
+
+public:
+
+	hll_sketch_ex_t()
+	{
+		memset(registers, 0, sizeof(registers));
+	}
+
+	void add_hash(uint64_t h)
+	{
+		uint32_t const idx = uint32_t(h >> (64 - precision));
+
+		// guard bit keeps clz defined and caps rank at 64 - precision + 1
+		uint64_t const w   = (h << precision) | (uint64_t(1) << (precision - 1));
+		uint8_t const rank = uint8_t(__builtin_clzll(w) + 1);
+
+		if (registers[idx] < rank)
+			registers[idx] = rank;
+	}
+
+	// union, register-wise max
+	void merge(hll_sketch_ex_t const& other)
+	{
+#if defined(__SSE2__)
+		for (unsigned i = 0; i < n_registers; i += 16)
+		{
+			__m128i const a = _mm_loadu_si128((__m128i const*)(registers + i));
+			__m128i const b = _mm_loadu_si128((__m128i const*)(other.registers + i));
+			_mm_storeu_si128((__m128i*)(registers + i), _mm_max_epu8(a, b));
+		}
+#else
+		for (unsigned i = 0; i < n_registers; i++)
+			registers[i] = (registers[i] < other.registers[i]) ? other.registers[i] : registers[i];
+#endif
+	}
+
+	uint64_t estimate() const
+	{
+		double const m     = n_registers;
+		double const alpha = 0.7213 / (1.0 + 1.079 / m);
+
+		double   sum   = 0;
+		unsigned zeros = 0;
+
+		for (unsigned i = 0; i < n_registers; i++)
+		{
+			sum   += std::ldexp(1.0, -int(registers[i]));
+			zeros += (registers[i] == 0);
+		}
+
+		double const raw = alpha * m * m / sum;
+
+		// small range correction, linear counting is way more precise here
+		if ((raw <= 2.5 * m) && (zeros > 0))
+			return uint64_t(std::llround(m * std::log(m / zeros)));
+
+		// 64bit hashes, no large range correction needed
+		return uint64_t(std::llround(raw));
+	}
+};
+
+// per report row per tick, so keep it small, we need "about how many hosts", not exact numbers
+// 256 bytes per sketch, ~6.5% error
+using hll_sketch_t = hll_sketch_ex_t<8>;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__HYPERLOGLOG_H_
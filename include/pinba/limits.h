@@ -12,12 +12,36 @@
 #define PINBA_LIMIT___MAX_KEY_PARTS 15
 #endif
 
+// packet-level timer tag bloom width (bits), see timertag_bloom_t
+// with many distinct timer tag names (hundreds) 128 bits saturate, and most packets pass the bloom
+// check packets_bloom_false_positive in active reports table, to see if it's worth making this wider
+// must be a power of 2, packet_t grows by (bits / 8) bytes
+#ifndef PINBA_LIMIT___TIMERTAG_BLOOM_BITS
+#define PINBA_LIMIT___TIMERTAG_BLOOM_BITS 128
+#endif
+
 // max histogram size
 // here mostly for sanity check, no idea who'd want this kind of precision honestly
 #ifndef PINBA_LIMIT___MAX_HISTOGRAM_SIZE
 #define PINBA_LIMIT___MAX_HISTOGRAM_SIZE (100 * 1000 * 1000)
 #endif
 
+// number of samples kept for per-second rates in stats and active reports tables, see rate_window_t
+// samples are taken every second, so this is the window length in seconds + 1
+#ifndef PINBA_LIMIT___RATE_WINDOW_SAMPLES
+#define PINBA_LIMIT___RATE_WINDOW_SAMPLES 61
+#endif
+
+// max request sample rate (1 in N), larger values from clients are clamped, see packet_t::sample_rate
+#ifndef PINBA_LIMIT___MAX_SAMPLE_RATE
+#define PINBA_LIMIT___MAX_SAMPLE_RATE (1000 * 1000)
+#endif
+
+// max request_time histogram buckets in a pre-aggregated summary, every bucket becomes a packet, see pinba_summary_to_packets()
+#ifndef PINBA_LIMIT___MAX_SUMMARY_BUCKETS
+#define PINBA_LIMIT___MAX_SUMMARY_BUCKETS 64
+#endif
+
 
 // INTERNAL limits
 // don't change these unless you REALLY know what you're doing
@@ -25,6 +49,8 @@
 #define PINBA_INTERNAL___EMPTY_KEY_PART     PINBA_INTERNAL___UINT32_MAX
 #define PINBA_INTERNAL___EMPTY_HV_BUCKET_ID PINBA_INTERNAL___UINT32_MAX
 #define PINBA_INTERNAL___STATUS_MAX         PINBA_INTERNAL___UINT32_MAX
+#define PINBA_INTERNAL___CACHELINE_SIZE     64 // per-thread counter blocks are padded to this, see pinba_counter_t
+#define PINBA_INTERNAL___INT_TAG_VALUE_BIT  0x80000000u // tag value 'offsets' with this bit are integer values, see proto/pinba.proto
 
 
 //
@@ -0,0 +1,53 @@
+#ifndef PINBA__MEM_GOVERNOR_H_
+#define PINBA__MEM_GOVERNOR_H_
+
+#include <cstdint>
+
+#include "pinba/globals.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// engine-wide memory budget (pinba_options_t::mem_governor_max), so it's not the oom killer taking mysqld out
+//
+// memory counted is dictionary + report history + in-flight batches + repacker dictionary caches
+// (current ticks being aggregated are not, the same way report_mem_budget_t doesn't count them)
+// checked every second by coordinator, as usage grows the stage goes up, every stage keeps doing what lower ones do
+//   SAMPLE        - collectors keep every PINBA_MEM_GOVERNOR___SAMPLE_KEEP_EVERY-th datagram only
+//   NO_NEW_WORDS  - dictionary rejects new words from traffic, packets get empty ones instead
+//   NO_NEW_KEYS   - timer reports stop creating new keys, those go to overflow row (see report_mem_budget_t)
+// stage goes down when usage drops a hysteresis step below the threshold, not to flap on every tick
+//
+// stage is published in pinba_stats_t::mem_governor, readers on hot paths just load it relaxed
+
+#define PINBA_MEM_STAGE__NORMAL        0
+#define PINBA_MEM_STAGE__SAMPLE        1
+#define PINBA_MEM_STAGE__NO_NEW_WORDS  2
+#define PINBA_MEM_STAGE__NO_NEW_KEYS   3
+
+#define PINBA_MEM_GOVERNOR___SAMPLE_KEEP_EVERY 4
+
+// stage thresholds, fractions of max memory, and a step to go below to leave the stage
+static constexpr double const mem_governor___stage_threshold[] = { 0.0, 0.80, 0.90, 0.95 };
+static constexpr double const mem_governor___hysteresis        = 0.05;
+
+// memory currently counted against the budget
+uint64_t mem_governor___mem_used(pinba_globals_t*);
+
+// recalculates stage and applies it (dictionary admission, etc.), no-op if governor is off
+// called periodically by coordinator
+void mem_governor___update(pinba_globals_t*);
+
+char const* mem_governor___stage_name(uint32_t stage);
+
+inline bool mem_governor___is_enabled(pinba_globals_t *globals)
+{
+	return globals->options()->mem_governor_max > 0;
+}
+
+inline uint32_t mem_governor___stage(pinba_stats_t const *stats)
+{
+	return stats->mem_governor.stage.load(std::memory_order_relaxed);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__MEM_GOVERNOR_H_
@@ -3,6 +3,8 @@
 
 #include <algorithm>
 
+#include "pinba/probes.h"
+
 // #include "binheap/binary_heap.c" // FIXME
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -106,6 +108,8 @@ namespace pinba {
 			std::pop_heap(heap, heap_end, item_greater);
 			merge_item_t *last = heap_end - 1;
 
+			PINBA_PROBE1(multi_merge_row, size_t(heap_end - heap));
+
 			result->push_back(last->seq, *last->iter);
 
 			// advance to next item if exists
@@ -208,11 +212,190 @@ namespace pinba {
 	}
 #endif
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// loser (tournament) tree, ~log2(n) compares per merged value, vs ~2*log2(n) for pop_heap + push_heap
+// good for many sources (rows merged from 60 .. 900 tick histograms)
+// same requirements for 'result' as multi_merge__stdlib()
+
+	template<class Merger, class Iterator>
+	inline void multi_merge__loser_tree(Merger *result, Iterator begin, Iterator end)
+	{
+		using SequencePtr = typename std::iterator_traits<Iterator>::value_type;
+		static_assert(std::is_pointer<SequencePtr>::value, "expected a range of pointers to sequences");
+
+		using SequenceT    = typename std::remove_pointer<SequencePtr>::type;
+		using SequenceIter = typename SequenceT::const_iterator;
+
+		using merge_item_t = detail::merge_heap_item_t<SequenceT, SequenceIter>;
+
+		size_t       result_length = 0;
+		size_t const input_size = std::distance(begin, end);
+
+		merge_item_t *items = (merge_item_t*)alloca(input_size * sizeof(merge_item_t));
+		size_t        n     = 0;
+
+		for (auto i = begin; i != end; i = std::next(i))
+		{
+			auto *sequence = *i;
+
+			auto const curr_b = std::begin(*sequence);
+			auto const curr_e = std::end(*sequence);
+
+			if (curr_b == curr_e)
+				continue;
+
+			result_length += detail::maybe_calculate_size(curr_b, curr_e);
+			items[n].seq  = sequence;
+			items[n].iter = curr_b;
+			n++;
+		}
+
+		if (n == 0)
+			return;
+
+		if (result_length > 0)
+			result->reserve(result_length);
+
+		// exhausted sources lose to everything
+		auto const item_less = [&](uint32_t l, uint32_t r)
+		{
+			bool const l_done = (items[l].iter == std::end(*items[l].seq));
+			bool const r_done = (items[r].iter == std::end(*items[r].seq));
+
+			if (l_done || r_done)
+				return !l_done;
+
+			return result->compare(*items[l].iter, *items[r].iter);
+		};
+
+		// tree[1 .. n-1] are losers of internal nodes, leaf i is at (n + i), parent of p is p/2
+		// winners are only needed to build the tree, they share the same array (for the n..2n range)
+		uint32_t *tree    = (uint32_t*)alloca(n * sizeof(uint32_t));
+		uint32_t *winners = (uint32_t*)alloca(2 * n * sizeof(uint32_t));
+
+		for (uint32_t i = 0; i < n; i++)
+			winners[n + i] = i;
+
+		for (size_t p = n - 1; p >= 1; p--)
+		{
+			uint32_t const l = winners[2 * p];
+			uint32_t const r = winners[2 * p + 1];
+
+			bool const r_wins = item_less(r, l);
+			winners[p] = (r_wins) ? r : l;
+			tree[p]    = (r_wins) ? l : r;
+		}
+
+		uint32_t winner = (n > 1) ? winners[1] : 0;
+
+		while (items[winner].iter != std::end(*items[winner].seq))
+		{
+			merge_item_t *w = &items[winner];
+
+			PINBA_PROBE1(multi_merge_row, n);
+
+			result->push_back(w->seq, *w->iter);
+			w->iter = std::next(w->iter);
+
+			// replay winner's path to the root
+			for (size_t p = (n + winner) / 2; p >= 1; p /= 2)
+			{
+				if (item_less(tree[p], winner))
+					std::swap(tree[p], winner);
+			}
+		}
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// direct merge for a few sources (2 .. 4), no heap or tree, next value is the min of sources' heads
+// min is picked with conditional moves instead of branches, as compare results are unpredictable on real data
+// same requirements for 'result' as multi_merge__stdlib()
+
+	template<class Merger, class Iterator>
+	inline void multi_merge__small(Merger *result, Iterator begin, Iterator end)
+	{
+		using SequencePtr = typename std::iterator_traits<Iterator>::value_type;
+		static_assert(std::is_pointer<SequencePtr>::value, "expected a range of pointers to sequences");
+
+		using SequenceT    = typename std::remove_pointer<SequencePtr>::type;
+		using SequenceIter = typename SequenceT::const_iterator;
+
+		using merge_item_t = detail::merge_heap_item_t<SequenceT, SequenceIter>;
+
+		size_t       result_length = 0;
+		size_t const input_size = std::distance(begin, end);
+
+		merge_item_t *items = (merge_item_t*)alloca(input_size * sizeof(merge_item_t));
+		size_t        n     = 0;
+
+		for (auto i = begin; i != end; i = std::next(i))
+		{
+			auto *sequence = *i;
+
+			auto const curr_b = std::begin(*sequence);
+			auto const curr_e = std::end(*sequence);
+
+			if (curr_b == curr_e)
+				continue;
+
+			result_length += detail::maybe_calculate_size(curr_b, curr_e);
+			items[n].seq  = sequence;
+			items[n].iter = curr_b;
+			n++;
+		}
+
+		if (result_length > 0)
+			result->reserve(result_length);
+
+		// all sources in items[0 .. n) are non-empty, exhausted one is replaced with the last
+		while (n > 1)
+		{
+			size_t best = 0;
+			for (size_t i = 1; i < n; i++)
+			{
+				bool const less = result->compare(*items[i].iter, *items[best].iter);
+				best = (less) ? i : best;
+			}
+
+			merge_item_t *w = &items[best];
+
+			PINBA_PROBE1(multi_merge_row, n);
+
+			result->push_back(w->seq, *w->iter);
+			w->iter = std::next(w->iter);
+
+			if (w->iter == std::end(*w->seq))
+			{
+				*w = items[n - 1];
+				n--;
+			}
+		}
+
+		// the rest of the last one
+		if (n == 1)
+		{
+			merge_item_t *w = &items[0];
+
+			for (auto it = w->iter; it != std::end(*w->seq); it = std::next(it))
+				result->push_back(w->seq, *it);
+		}
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// sources are few when merging remote/snapshot parts, and many when merging tick histograms
+	// see experiments/exp_histogram_perf.cpp for benchmarks
+	constexpr size_t const multi_merge___small_max_inputs = 4;
+
 	template<class Merger, class Iterator>
 	inline void multi_merge(Merger *result, Iterator begin, Iterator end)
 	{
-		return multi_merge__stdlib(result, begin, end);
-		// return multi_merge__binheap(result, begin, end);
+		size_t const input_size = std::distance(begin, end);
+
+		if (input_size <= multi_merge___small_max_inputs)
+			return multi_merge__small(result, begin, end);
+
+		return multi_merge__loser_tree(result, begin, end);
 	}
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
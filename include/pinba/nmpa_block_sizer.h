@@ -0,0 +1,75 @@
+#ifndef PINBA__NMPA_BLOCK_SIZER_H_
+#define PINBA__NMPA_BLOCK_SIZER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+#include "misc/nmpa.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// picks nmpa block size for the next batch from what previous batches have taken (nmpa_mem_requested())
+// so that a typical batch fits into a single block, instead of a chain of fixed size blocks + big chunks for large timers
+// and small traffic doesn't sit in blocks that are mostly empty
+//
+// one per stage thread (collector reader, repacker), no locking
+// sizes are powers of 2, block allocator rounds up to that anyway (see pinba/block_allocator.h)
+
+struct nmpa_block_sizer_t
+{
+	static constexpr double const avg_weight = 1.0 / 16;  // moving average over ~16 batches
+	static constexpr double const headroom   = 1.25;      // for batches a bit above average
+	static constexpr size_t const shrink_at  = 4;         // shrink when block is this many times bigger than needed
+
+	nmpa_block_sizer_t(size_t initial_sz, size_t min_sz, size_t max_sz)
+		: min_sz_(min_sz)
+		, max_sz_(max_sz)
+		, block_sz_(initial_sz)
+		, avg_requested_(0)
+		, n_observed_(0)
+	{
+	}
+
+	size_t block_size() const
+	{
+		return block_sz_;
+	}
+
+	// batch is complete, mem_requested = nmpa_mem_requested() of its nmpa
+	void observe(size_t mem_requested)
+	{
+		avg_requested_ = (n_observed_ == 0)
+			? double(mem_requested)
+			: avg_requested_ + (double(mem_requested) - avg_requested_) * avg_weight;
+		n_observed_++;
+
+		size_t const want_sz = round_up_pow2(std::min(double(max_sz_), avg_requested_ * headroom));
+		size_t const new_sz  = std::max(min_sz_, std::min(max_sz_, want_sz));
+
+		// grow right away, shrink only when way too big,
+		// as pooled batches free their kept block on every size change
+		if (new_sz > block_sz_ || new_sz * shrink_at <= block_sz_)
+			block_sz_ = new_sz;
+	}
+
+private:
+
+	static size_t round_up_pow2(double sz)
+	{
+		size_t result = 1;
+		while (double(result) < sz)
+			result <<= 1;
+		return result;
+	}
+
+private:
+	size_t    min_sz_;
+	size_t    max_sz_;
+	size_t    block_sz_;
+	double    avg_requested_;
+	uint64_t  n_observed_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__NMPA_BLOCK_SIZER_H_
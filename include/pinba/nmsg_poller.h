@@ -6,8 +6,14 @@
 #endif
 
 #include <poll.h>
+#include <unistd.h>    // close
+
+#ifdef PINBA_HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
 #include <cassert>
+#include <algorithm>   // min, max
 #include <vector>
 #include <map>
 #include <memory>      // unique_ptr
@@ -21,6 +27,7 @@
 #include <meow/format/format_to_string.hpp>
 
 #include "pinba/nmsg_channel.h"
+#include "pinba/nmsg_ring.h"
 #include "pinba/nmsg_socket.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -35,6 +42,12 @@ private: // io pollers
 		virtual int   fd() const = 0;
 		virtual short ev() const = 0;
 		virtual void  callback(timeval_t) = 0;
+
+		// called around every poll(), true from prepare_wait() = ready already, don't sleep
+		// only for pollers that say they need it, so that others don't cost anything per iteration
+		virtual bool  needs_prepare_wait() const { return false; }
+		virtual bool  prepare_wait() { return false; }
+		virtual void  finish_wait() {}
 	};
 
 	template<class Function>
@@ -109,6 +122,60 @@ private: // io pollers
 		virtual void  callback(timeval_t now) override { func(now); }
 	};
 
+	// ring is 'readable' through its eventfd only when parked, see nmsg_ring_t
+	// spin a bit before parking, spin longer if spinning helped last time, shorter otherwise
+	// Ring is nmsg_ring_t or nmsg_broadcast_reader_t
+	template<class Ring, class Function>
+	struct poller___nmsg_ring_t : public poller_t
+	{
+		static constexpr uint32_t min_spins = 16;
+		static constexpr uint32_t max_spins = 2048;
+
+		Ring&     ring;
+		Function  func;
+		uint32_t  spins;
+		bool      parked;
+
+		poller___nmsg_ring_t(Ring& r, Function const& fn)
+			: ring(r)
+			, func(fn)
+			, spins(min_spins)
+			, parked(false)
+		{
+		}
+
+		virtual int   fd() const override { return ring.wakeup_fd(); }
+		virtual short ev() const override { return POLLIN; }
+		virtual void  callback(timeval_t now) override { func(now); }
+
+		virtual bool needs_prepare_wait() const override { return true; }
+
+		virtual bool prepare_wait() override
+		{
+			for (uint32_t i = 0; i < spins; i++)
+			{
+				if (!ring.empty())
+				{
+					spins = std::min(max_spins, spins * 2);
+					return true;
+				}
+				nmsg_ring___cpu_relax();
+			}
+
+			spins = std::max(min_spins, spins / 2);
+
+			parked = ring.park();
+			return !parked;
+		}
+
+		virtual void finish_wait() override
+		{
+			if (parked)
+				ring.unpark();
+			parked = false;
+		}
+	};
+
 	using poller_ptr = std::unique_ptr<poller_t>;
 
 private: // periodic events
@@ -118,6 +185,7 @@ private: // periodic events
 		virtual ~ticker_t() {}
 		virtual timeval_t  when() const = 0;
 		virtual duration_t interval() const = 0;
+		virtual void       set_interval(duration_t) = 0;
 		virtual void       set_when(timeval_t) = 0;
 		virtual void       callback(timeval_t) = 0;
 	};
@@ -139,6 +207,7 @@ private: // periodic events
 
 		virtual timeval_t  when() const override { return next_tv; }
 		virtual duration_t interval() const override { return interval_d; }
+		virtual void       set_interval(duration_t iv) override { interval_d = iv; }
 		virtual void       set_when(timeval_t tv) override { next_tv = tv; }
 		virtual void       callback(timeval_t now) override { func(now); }
 	};
@@ -151,6 +220,12 @@ private:
 	std::function<void(timeval_t, duration_t)> before_poll_;
 	bool shutting_down;
 
+	// epoll backend state, set up once in loop()
+	std::vector<size_t>     spinners_;      // pollers that need prepare_wait()
+	std::vector<size_t>     ready_;         // pollers to call back this iteration
+	std::vector<uint64_t>   ready_gen_;     // per poller, == iteration_gen_ if it's in ready_ already
+	uint64_t                iteration_gen_ = 0;
+
 private:
 
 	nmsg_poller_t& add_poller(poller_ptr p)
@@ -187,6 +262,27 @@ public: // readers
 		return this->add_poller(meow::make_unique<poller___nn_sock_t<Function>>(sock, NN_POLLIN, func));
 	}
 
+	// func is called when ring (most likely) has something, use nmsg_ring_t::recv_dontwait() there
+	template<class T, class Function>
+	nmsg_poller_t& read_nmsg_ring(nmsg_ring_t<T>& ring, Function const& func)
+	{
+		return this->add_poller(meow::make_unique<poller___nmsg_ring_t<nmsg_ring_t<T>, Function>>(ring, func));
+	}
+
+	// same as above, but for broadcast ring reader, see nmsg_broadcast_ring_t
+	template<class T, class Function>
+	nmsg_poller_t& read_nmsg_broadcast(nmsg_broadcast_reader_t<T>& reader, Function const& func)
+	{
+		return this->add_poller(meow::make_unique<poller___nmsg_ring_t<nmsg_broadcast_reader_t<T>, Function>>(reader, func));
+	}
+
+	// any other ring with the same parking interface (empty(), park(), unpark(), wakeup_fd()), i.e. benchmark ones
+	template<class Ring, class Function>
+	nmsg_poller_t& read_parking_ring(Ring& ring, Function const& func)
+	{
+		return this->add_poller(meow::make_unique<poller___nmsg_ring_t<Ring, Function>>(ring, func));
+	}
+
 	template<class Function>
 	nmsg_poller_t& read_plain_fd(int fd, Function const& func)
 	{
@@ -253,6 +349,13 @@ public: // tickers
 		tickers_.emplace(next_tv, move(ticker));
 	}
 
+	// same as above, but the ticker fires every interval from now on
+	void reset_ticker(ticker_t const *t, timeval_t now, duration_t interval)
+	{
+		const_cast<ticker_t*>(t)->set_interval(interval);
+		this->reset_ticker(t, now);
+	}
+
 public: // utility
 
 	void set_shutdown_flag()
@@ -284,6 +387,18 @@ public: // utility
 
 		// TODO: add support for changing number of pollers/tickers when inside this function
 
+		// epoll: fds are registered once, and only ready pollers are looked at after every wait
+		// poll() fallback rebuilds nothing either, but scans all fds every iteration
+		int epoll_fd = -1;
+		MEOW_DEFER(
+			if (epoll_fd >= 0)
+				close(epoll_fd);
+		);
+
+#ifdef PINBA_HAVE_SYS_EPOLL_H
+		epoll_fd = this->epoll_setup();
+#endif
+
 		while (true)
 		{
 			// do not start next iteration if shutting down
@@ -344,7 +459,9 @@ public: // utility
 				before_poll_(now, wait_for);
 
 			// and perform a single poll iteration
-			int const r = this->poll_and_callback(pfd, pfd_size, wait_for_ms);
+			int const r = (epoll_fd >= 0)
+						? this->epoll_and_callback(epoll_fd, wait_for_ms)
+						: this->poll_and_callback(pfd, pfd_size, wait_for_ms);
 			if (r < 0)
 				return r;
 		}
@@ -354,14 +471,127 @@ public: // utility
 
 private:
 
+#ifdef PINBA_HAVE_SYS_EPOLL_H
+
+	// returns -1 if epoll can't be used (i.e. the same fd is polled twice, epoll doesn't like that), poll() is used then
+	int epoll_setup()
+	{
+		int const epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0)
+			return -1;
+
+		for (size_t i = 0; i < pollers_.size(); i++)
+		{
+			struct epoll_event ev = {};
+			ev.events   = ((pollers_[i]->ev() & POLLIN) ? EPOLLIN : 0) | ((pollers_[i]->ev() & POLLOUT) ? EPOLLOUT : 0);
+			ev.data.u64 = i;
+
+			if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pollers_[i]->fd(), &ev) < 0)
+			{
+				close(epoll_fd);
+				return -1;
+			}
+		}
+
+		spinners_.clear();
+		for (size_t i = 0; i < pollers_.size(); i++)
+		{
+			if (pollers_[i]->needs_prepare_wait())
+				spinners_.push_back(i);
+		}
+
+		ready_.clear();
+		ready_.reserve(pollers_.size());
+		ready_gen_.assign(pollers_.size(), 0);
+
+		return epoll_fd;
+	}
+
+	int epoll_and_callback(int epoll_fd, int wait_for_ms)
+	{
+		size_t const n_pollers = pollers_.size();
+
+		iteration_gen_++;
+		ready_.clear();
+
+		auto const mark_ready = [this](size_t i)
+		{
+			if (ready_gen_[i] == iteration_gen_)
+				return;
+
+			ready_gen_[i] = iteration_gen_;
+			ready_.push_back(i);
+		};
+
+		// some pollers might be ready without waiting, just check others and don't sleep then
+		for (size_t const i : spinners_)
+		{
+			if (pollers_[i]->prepare_wait())
+				mark_ready(i);
+		}
+
+		struct epoll_event events[(n_pollers > 0) ? n_pollers : 1];
+
+		int const r = epoll_wait(epoll_fd, events, (n_pollers > 0) ? n_pollers : 1, (ready_.empty()) ? wait_for_ms : 0);
+		int const wait_errno = errno; // finish_wait() might clobber it
+
+		for (size_t const i : spinners_)
+			pollers_[i]->finish_wait();
+
+		if (r < 0)
+		{
+			if (EINTR == wait_errno)
+				return 0;
+
+			return -wait_errno;
+		}
+
+		for (int i = 0; i < r; i++)
+			mark_ready(size_t(events[i].data.u64));
+
+		if (ready_.empty()) // timeout, not an error
+			return 1;
+
+		// call dem callbacks, starting at random position
+		timeval_t const now = os_unix::clock_monotonic_now();
+		size_t const n_ready = ready_.size();
+		size_t const offset  = now.tv_nsec % n_ready;
+
+		for (size_t i = 0; i < n_ready; i++)
+		{
+			pollers_[ready_[(i + offset) % n_ready]]->callback(now);
+
+			if (shutting_down) // this flag is set from inside the callback often
+				return -ECANCELED;
+		}
+
+		return 0;
+	}
+
+#endif // PINBA_HAVE_SYS_EPOLL_H
+
 	int poll_and_callback(struct pollfd *pfd, size_t pfd_size, int wait_for_ms)
 	{
-		int const r = poll(pfd, pfd_size, wait_for_ms);
+		// some pollers might be ready without poll(), just check others and don't sleep then
+		bool ready[pfd_size];
+		bool any_ready = false;
+
+		for (size_t i = 0; i < pfd_size; i++)
+		{
+			ready[i] = pollers_[i]->prepare_wait();
+			any_ready |= ready[i];
+		}
+
+		int const r = poll(pfd, pfd_size, (any_ready) ? 0 : wait_for_ms);
+		int const poll_errno = errno; // finish_wait() might clobber it
 		// meow::format::fmt(stderr, "r = {0}\n", r);
 
+		for (size_t i = 0; i < pfd_size; i++)
+			pollers_[i]->finish_wait();
+
 		if (r < 0)
 		{
-			int e = errno;
+			int e = poll_errno;
 
 			if (EINTR == e)
 				return 0;
@@ -369,7 +599,7 @@ private:
 			return -e;
 		}
 
-		if (r == 0) // timeout, not an error
+		if ((r == 0) && !any_ready) // timeout, not an error
 			return 1;
 
 		// call dem callbacks, starting at random position
@@ -380,7 +610,7 @@ private:
 		{
 			size_t real_offset = (i + offset) % pfd_size;
 
-			if ((pfd[real_offset].revents & pfd[real_offset].events) == 0)
+			if (!ready[real_offset] && ((pfd[real_offset].revents & pfd[real_offset].events) == 0))
 				continue;
 
 			pollers_[real_offset]->callback(now);
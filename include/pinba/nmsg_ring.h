@@ -0,0 +1,502 @@
+#ifndef PINBA__NMSG__RING_H_
+#define PINBA__NMSG__RING_H_
+
+#include <errno.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <boost/noncopyable.hpp>
+
+#include <meow/str_ref.hpp>
+#include <meow/intrusive_ptr.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+
+#include <nanomsg/nn.h>        // NN_DONTWAIT, send flags are the same as with nmsg_socket_t
+
+#include "pinba/object_pool.h" // object_freelist_t
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// in-process bounded ring, passing intrusive_ptr-s to messages between pipeline stages
+// replaces nanomsg inproc PUSH/PULL pair, no mutexes or syscalls when both sides are busy
+//
+// any number of producers and consumers (it's the same ring object pool free list uses)
+// producer adds a reference and pushes raw pointer, consumer adopts it back into intrusive_ptr
+//
+// consumers spin for a while on empty ring, and then park in poll() on eventfd, see nmsg_poller_t::read_nmsg_ring()
+// producers only touch eventfd when some consumer is parked
+
+inline void nmsg_ring___cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield" ::: "memory");
+#else
+	std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+// producer waiting for free space, spin -> yield -> sleep
+inline void nmsg_ring___backoff(uint32_t attempt)
+{
+	if (attempt < 64)
+	{
+		nmsg_ring___cpu_relax();
+	}
+	else if (attempt < 128)
+	{
+		sched_yield();
+	}
+	else
+	{
+		struct timespec const ts = { .tv_sec = 0, .tv_nsec = 50 * 1000 };
+		nanosleep(&ts, NULL);
+	}
+}
+
+template<class T>
+struct nmsg_ring_t
+	: public  boost::intrusive_ref_counter<nmsg_ring_t<T>>
+	, private boost::noncopyable
+{
+	using value_ptr = boost::intrusive_ptr<T>;
+
+	nmsg_ring_t(size_t capacity, meow::str_ref name)
+		: name_(name.str())
+		, ring_(capacity)
+		, n_parked_(0)
+	{
+		efd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (efd_ < 0)
+			throw std::runtime_error(meow::format::fmt_str("nmsg_ring_t({0}): eventfd() failed: {1}:{2}", name_, errno, strerror(errno)));
+	}
+
+	~nmsg_ring_t()
+	{
+		// drop references to whatever nobody has received
+		while (T *obj = ring_.pop())
+			intrusive_ptr_release(obj);
+
+		close(efd_);
+	}
+
+	// same as nmsg_socket_t::send_message()
+	// waits while the ring is full, unless NN_DONTWAIT is given, returns false then
+	bool send_message(value_ptr const& value, int flags = 0)
+	{
+		T *obj = value.get();
+		intrusive_ptr_add_ref(obj);
+
+		for (uint32_t attempt = 0; !ring_.push(obj); attempt++)
+		{
+			if (flags & NN_DONTWAIT)
+			{
+				intrusive_ptr_release(obj);
+				return false;
+			}
+
+			nmsg_ring___backoff(attempt);
+		}
+
+		this->wakeup_parked();
+		return true;
+	}
+
+	// empty ptr if there is nothing in the ring
+	value_ptr recv_dontwait()
+	{
+		return value_ptr { ring_.pop(), /*add_ref=*/false };
+	}
+
+	bool empty() const
+	{
+		return ring_.empty();
+	}
+
+	std::string const& name() const { return name_; }
+	int wakeup_fd() const { return efd_; }
+
+public: // consumer parking, see nmsg_poller_t
+
+	// call before sleeping on wakeup_fd(), false = don't sleep, something has been pushed meanwhile
+	bool park()
+	{
+		n_parked_.fetch_add(1, std::memory_order_seq_cst);
+		std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the one in wakeup_parked()
+
+		if (ring_.empty())
+			return true;
+
+		n_parked_.fetch_sub(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	// call after waking up, for every successful park()
+	void unpark()
+	{
+		n_parked_.fetch_sub(1, std::memory_order_relaxed);
+
+		// reset eventfd counter, EAGAIN is fine here, some other consumer got to it first
+		uint64_t value;
+		while ((read(efd_, &value, sizeof(value)) < 0) && (errno == EINTR))
+			;
+	}
+
+private:
+
+	void wakeup_parked()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (n_parked_.load(std::memory_order_relaxed) == 0)
+			return;
+
+		uint64_t const value = 1;
+		while ((write(efd_, &value, sizeof(value)) < 0) && (errno == EINTR))
+			;
+	}
+
+private:
+	std::string           name_;
+	object_freelist_t<T>  ring_;
+	int                   efd_;
+
+	char                  pad0_[64];
+	std::atomic<uint32_t> n_parked_;
+	char                  pad1_[64];
+};
+
+template<class T>
+using nmsg_ring_ptr = boost::intrusive_ptr<nmsg_ring_t<T>>;
+
+template<class T>
+inline nmsg_ring_ptr<T> nmsg_ring_create(size_t capacity, meow::str_ref name)
+{
+	return nmsg_ring_ptr<T>(new nmsg_ring_t<T>(capacity, name));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// single producer broadcast ring, every reader sees every message (or every stride-th one, see below)
+// message is published once, with one reference held by the ring, readers take their own when reading
+//
+// producer never waits for readers, it overwrites the oldest slot and a reader that hasn't got to it
+// loses that message (counted as dropped for that reader), i.e. slow readers are visible as lag, not as failed sends
+//
+// overwrite safety: reader announces slot it's about to read in hazard_, producer waits for that hazard to clear
+// before releasing the slot. it's only held for one add_ref, so producer doesn't really wait
+//
+// subscribe(), unsubscribe() and publish() must be called from the producer thread
+
+template<class T>
+struct nmsg_broadcast_ring_t;
+
+// reads messages with (index % stride == offset), so that multiple threads of one consumer can split the work
+template<class T>
+struct nmsg_broadcast_reader_t : private boost::noncopyable
+{
+	using value_ptr = boost::intrusive_ptr<T>;
+	static constexpr uint64_t no_index = UINT64_MAX;
+
+	nmsg_broadcast_reader_t(uint32_t stride = 1, uint32_t offset = 0)
+		: ring_(nullptr)
+		, stride_(stride)
+		, offset_(offset)
+		, start_head_(0)
+		, start_weight_(0)
+		, active_(false)
+		, cursor_(0)
+		, hazard_(no_index)
+		, parked_(0)
+		, dropped_messages_(0)
+		, dropped_weight_(0)
+	{
+		efd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (efd_ < 0)
+			throw std::runtime_error(meow::format::fmt_str("nmsg_broadcast_reader_t: eventfd() failed: {0}:{1}", errno, strerror(errno)));
+	}
+
+	~nmsg_broadcast_reader_t()
+	{
+		close(efd_);
+	}
+
+	// empty ptr if there is nothing new (or not subscribed)
+	value_ptr recv_dontwait()
+	{
+		if (!active_.load(std::memory_order_acquire))
+			return {};
+
+		auto *ring = ring_;
+
+		while (true)
+		{
+			uint64_t c = cursor_.load(std::memory_order_relaxed);
+			uint64_t const head = ring->head_.load(std::memory_order_acquire);
+			if (c >= head)
+				return {};
+
+			// overrun, skip to the oldest message still in the ring (producer has counted the drops)
+			if ((head - c) > ring->capacity_)
+			{
+				cursor_.store(this->align_index(head - ring->capacity_), std::memory_order_relaxed);
+				continue;
+			}
+
+			hazard_.store(c, std::memory_order_seq_cst);
+
+			if (!active_.load(std::memory_order_seq_cst)) // unsubscribed meanwhile
+			{
+				hazard_.store(no_index, std::memory_order_release);
+				return {};
+			}
+
+			auto& slot = ring->slots_[c & ring->mask_];
+			if (slot.seq.load(std::memory_order_seq_cst) != c) // being overwritten, check again
+			{
+				hazard_.store(no_index, std::memory_order_release);
+				continue;
+			}
+
+			T *obj = slot.obj.load(std::memory_order_relaxed);
+			intrusive_ptr_add_ref(obj);
+
+			// cursor before hazard, producer checks them in reverse
+			cursor_.store(c + stride_, std::memory_order_release);
+			hazard_.store(no_index, std::memory_order_release);
+
+			return value_ptr { obj, /*add_ref=*/false };
+		}
+	}
+
+	bool empty() const
+	{
+		if (!active_.load(std::memory_order_acquire))
+			return true;
+
+		return cursor_.load(std::memory_order_relaxed) >= ring_->head_.load(std::memory_order_acquire);
+	}
+
+	int wakeup_fd() const { return efd_; }
+
+	// since subscribe()
+	uint64_t published_messages() const { return active_.load() ? (ring_->head_.load() - start_head_) : 0; }
+	uint64_t published_weight() const   { return active_.load() ? (ring_->weight_.load() - start_weight_) : 0; }
+
+	uint64_t dropped_messages() const { return dropped_messages_.load(std::memory_order_relaxed); }
+	uint64_t dropped_weight() const   { return dropped_weight_.load(std::memory_order_relaxed); }
+
+public: // parking, same as nmsg_ring_t
+
+	bool park()
+	{
+		parked_.store(1, std::memory_order_seq_cst);
+		std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with fence in publish()
+
+		if (this->empty())
+			return true;
+
+		parked_.store(0, std::memory_order_relaxed);
+		return false;
+	}
+
+	void unpark()
+	{
+		parked_.store(0, std::memory_order_relaxed);
+
+		uint64_t value;
+		while ((read(efd_, &value, sizeof(value)) < 0) && (errno == EINTR))
+			;
+	}
+
+private:
+
+	// first index >= idx, that this reader is supposed to read
+	uint64_t align_index(uint64_t idx) const
+	{
+		return idx + ((offset_ + stride_ - (idx % stride_)) % stride_);
+	}
+
+	bool owns_index(uint64_t idx) const
+	{
+		return (idx % stride_) == offset_;
+	}
+
+private:
+	friend struct nmsg_broadcast_ring_t<T>;
+
+	nmsg_broadcast_ring_t<T>  *ring_;      // set in subscribe(), read only after active_
+	uint32_t                  stride_;
+	uint32_t                  offset_;
+	uint64_t                  start_head_;
+	uint64_t                  start_weight_;
+	int                       efd_;
+
+	char                      pad0_[64];
+	std::atomic<bool>         active_;
+	std::atomic<uint64_t>     cursor_;     // next index to read, written by reader only
+	std::atomic<uint64_t>     hazard_;     // index being read right now, or no_index
+	std::atomic<uint32_t>     parked_;
+
+	char                      pad1_[64];
+	std::atomic<uint64_t>     dropped_messages_; // written by producer
+	std::atomic<uint64_t>     dropped_weight_;
+};
+
+template<class T>
+struct nmsg_broadcast_ring_t : private boost::noncopyable
+{
+	using value_ptr = boost::intrusive_ptr<T>;
+	using reader_t  = nmsg_broadcast_reader_t<T>;
+
+	// capacity is rounded up to power of 2
+	explicit nmsg_broadcast_ring_t(size_t capacity)
+		: head_(0)
+		, weight_(0)
+	{
+		size_t sz = 1;
+		while (sz < capacity)
+			sz <<= 1;
+
+		slots_.reset(new slot_t[sz]);
+		capacity_ = sz;
+		mask_     = sz - 1;
+
+		for (size_t i = 0; i < sz; i++)
+		{
+			slots_[i].seq.store(reader_t::no_index, std::memory_order_relaxed);
+			slots_[i].obj.store(nullptr, std::memory_order_relaxed);
+			slots_[i].weight = 0;
+		}
+	}
+
+	~nmsg_broadcast_ring_t()
+	{
+		for (size_t i = 0; i < capacity_; i++)
+		{
+			if (T *obj = slots_[i].obj.load())
+				intrusive_ptr_release(obj);
+		}
+	}
+
+	// reader starts with messages published after this call
+	void subscribe(reader_t *r)
+	{
+		uint64_t const head = head_.load(std::memory_order_relaxed);
+
+		r->ring_         = this;
+		r->start_head_   = head;
+		r->start_weight_ = weight_.load(std::memory_order_relaxed);
+		r->cursor_.store(r->align_index(head), std::memory_order_relaxed);
+		r->active_.store(true, std::memory_order_release);
+
+		readers_.push_back(r);
+	}
+
+	// reader is not touching the ring after this returns
+	void unsubscribe(reader_t *r)
+	{
+		r->active_.store(false, std::memory_order_seq_cst);
+
+		while (r->hazard_.load(std::memory_order_seq_cst) != reader_t::no_index)
+			nmsg_ring___cpu_relax();
+
+		readers_.erase(std::remove(readers_.begin(), readers_.end(), r), readers_.end());
+	}
+
+	// weight is just summed up for published/dropped counters (i.e. packets in a batch)
+	// returns the number of readers that lost an unread message, to make room for this one
+	uint32_t publish(value_ptr const& value, uint64_t weight = 1)
+	{
+		uint64_t const idx = head_.load(std::memory_order_relaxed);
+		slot_t& slot = slots_[idx & mask_];
+
+		uint32_t n_dropped = 0;
+
+		if (T *old_obj = slot.obj.load(std::memory_order_relaxed))
+		{
+			uint64_t const old_idx = idx - capacity_;
+
+			// readers that see this, skip the slot
+			slot.seq.store(reader_t::no_index, std::memory_order_seq_cst);
+
+			for (reader_t *r : readers_)
+			{
+				while (r->hazard_.load(std::memory_order_seq_cst) == old_idx)
+					nmsg_ring___cpu_relax();
+
+				if (r->owns_index(old_idx) && (r->cursor_.load(std::memory_order_acquire) <= old_idx))
+				{
+					r->dropped_messages_.fetch_add(1, std::memory_order_relaxed);
+					r->dropped_weight_.fetch_add(slot.weight, std::memory_order_relaxed);
+					n_dropped++;
+				}
+			}
+
+			intrusive_ptr_release(old_obj);
+		}
+
+		T *obj = value.get();
+		intrusive_ptr_add_ref(obj);
+
+		slot.obj.store(obj, std::memory_order_relaxed);
+		slot.weight = weight;
+		slot.seq.store(idx, std::memory_order_release);
+
+		weight_.fetch_add(weight, std::memory_order_relaxed);
+		head_.store(idx + 1, std::memory_order_release);
+
+		// wake up parked readers, that are supposed to read this one
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		for (reader_t *r : readers_)
+		{
+			if (!r->owns_index(idx) || (r->parked_.load(std::memory_order_relaxed) == 0))
+				continue;
+
+			uint64_t const one = 1;
+			while ((write(r->efd_, &one, sizeof(one)) < 0) && (errno == EINTR))
+				;
+		}
+
+		return n_dropped;
+	}
+
+	size_t capacity() const { return capacity_; }
+	size_t reader_count() const { return readers_.size(); }
+
+private:
+	friend struct nmsg_broadcast_reader_t<T>;
+
+	struct slot_t
+	{
+		std::atomic<uint64_t>  seq;     // index of message in slot, no_index while being overwritten
+		std::atomic<T*>        obj;
+		uint64_t               weight;  // producer only
+	};
+
+	std::unique_ptr<slot_t[]>  slots_;
+	size_t                     capacity_;
+	size_t                     mask_;
+
+	std::vector<reader_t*>     readers_;   // producer only
+
+	char                       pad0_[64];
+	std::atomic<uint64_t>      head_;      // next index to publish
+	std::atomic<uint64_t>      weight_;    // total weight published
+	char                       pad1_[64];
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__NMSG__RING_H_
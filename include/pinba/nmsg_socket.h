@@ -28,6 +28,10 @@ struct nmsg_message_t : public nmsg_message_ex_t<nmsg_message_t>
 	virtual ~nmsg_message_t() {} // an absolute must have, to properly delete children
 };
 
+// messages recycled through object pool, see pinba/object_pool.h
+template<class Derived>
+struct pooled_object_t;
+
 template<int ID>
 struct nmsg_message__with_id_t : public nmsg_message_t
 {
@@ -279,7 +283,7 @@ public:
 	bool send_message(boost::intrusive_ptr<T> const& value, int flags = 0)
 	{
 		static_assert(
-			(std::is_base_of<nmsg_message_ex_t<T>, T>::value || std::is_base_of<nmsg_message_t, T>::value),
+			(std::is_base_of<nmsg_message_ex_t<T>, T>::value || std::is_base_of<nmsg_message_t, T>::value || std::is_base_of<pooled_object_t<T>, T>::value),
 			"send_message expects an intrusive_ptr to something derived from nmsg_message_t");
 
 		return this->send(value, flags);
@@ -0,0 +1,234 @@
+#ifndef PINBA__OBJECT_POOL_H_
+#define PINBA__OBJECT_POOL_H_
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+#include <boost/noncopyable.hpp>
+
+#include <meow/intrusive_ptr.hpp>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// bounded lock-free multi-producer multi-consumer free list of object pointers
+// ring of cells with sequence numbers, see D. Vyukov's bounded mpmc queue
+// objects are usually taken by one stage thread, and returned by whatever thread drops the last reference
+
+template<class T>
+struct object_freelist_t : private boost::noncopyable
+{
+	// capacity is rounded up to power of 2
+	explicit object_freelist_t(size_t capacity)
+	{
+		size_t sz = 1;
+		while (sz < capacity)
+			sz <<= 1;
+
+		cells_.reset(new cell_t[sz]);
+		mask_ = sz - 1;
+
+		for (size_t i = 0; i < sz; i++)
+			cells_[i].seq.store(i, std::memory_order_relaxed);
+
+		enqueue_pos_.store(0, std::memory_order_relaxed);
+		dequeue_pos_.store(0, std::memory_order_relaxed);
+	}
+
+	// returns false if the list is full, object is not taken then
+	bool push(T *obj)
+	{
+		size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+
+		while (true)
+		{
+			cell_t *cell = &cells_[pos & mask_];
+			size_t const seq = cell->seq.load(std::memory_order_acquire);
+			intptr_t const diff = (intptr_t)seq - (intptr_t)pos;
+
+			if (diff == 0)
+			{
+				// pos is updated on failure
+				if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					cell->obj = obj;
+					cell->seq.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				return false; // full
+			}
+			else
+			{
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// returns nullptr if the list is empty
+	T* pop()
+	{
+		size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+
+		while (true)
+		{
+			cell_t *cell = &cells_[pos & mask_];
+			size_t const seq = cell->seq.load(std::memory_order_acquire);
+			intptr_t const diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+			if (diff == 0)
+			{
+				if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					T *obj = cell->obj;
+					cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+					return obj;
+				}
+			}
+			else if (diff < 0)
+			{
+				return nullptr; // empty
+			}
+			else
+			{
+				pos = dequeue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// racy by nature, something might be pushed/popped right after the check
+	bool empty() const
+	{
+		size_t const pos = dequeue_pos_.load(std::memory_order_relaxed);
+		cell_t const *cell = &cells_[pos & mask_];
+		size_t const seq = cell->seq.load(std::memory_order_acquire);
+		return ((intptr_t)seq - (intptr_t)(pos + 1)) < 0;
+	}
+
+private:
+
+	struct cell_t
+	{
+		std::atomic<size_t>  seq;
+		T                    *obj;
+	};
+
+	std::unique_ptr<cell_t[]>  cells_;
+	size_t                     mask_;
+
+	// keep producer and consumer positions on separate cache lines
+	char                       pad0_[64];
+	std::atomic<size_t>        enqueue_pos_;
+	char                       pad1_[64];
+	std::atomic<size_t>        dequeue_pos_;
+	char                       pad2_[64];
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// intrusively refcounted objects, that are returned to their pool when refcount drops to zero
+// (instead of being deleted), the pool calls Derived::pool_recycle() before putting them to the free list
+//
+// objects keep their pool alive while they're in use, so the pool can outlive the stage that created it
+// and objects in the free list don't, so there is no cycle
+
+template<class T>
+struct object_pool_t;
+
+template<class Derived>
+struct pooled_object_t : private boost::noncopyable
+{
+	using pool_ptr = std::shared_ptr<object_pool_t<Derived>>;
+
+	friend inline void intrusive_ptr_add_ref(Derived const *p)
+	{
+		p->pooled_refcount_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	friend inline void intrusive_ptr_release(Derived const *p)
+	{
+		if (p->pooled_refcount_.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return;
+
+		Derived *obj = const_cast<Derived*>(p);
+
+		// take pool reference out of the object, to keep the pool alive while it takes the object back
+		pool_ptr pool = std::move(obj->pooled_pool_);
+		if (pool)
+			pool->put(obj);
+		else
+			delete obj;
+	}
+
+private:
+	friend struct object_pool_t<Derived>;
+
+	mutable std::atomic<uint32_t>  pooled_refcount_ = {0};
+	pool_ptr                       pooled_pool_;           // empty while in free list (or not pooled at all)
+};
+
+template<class T>
+struct object_pool_t
+	: public std::enable_shared_from_this<object_pool_t<T>>
+	, private boost::noncopyable
+{
+	object_pool_t(size_t capacity, std::atomic<uint64_t> *hits, std::atomic<uint64_t> *misses)
+		: freelist_(capacity)
+		, hits_(hits)
+		, misses_(misses)
+	{
+	}
+
+	~object_pool_t()
+	{
+		while (T *obj = freelist_.pop())
+			delete obj;
+	}
+
+	// get object from the free list, or create a new one with args given
+	// NOTE: args are only used for new objects, recycled ones should've been reset by pool_recycle()
+	template<class... A>
+	boost::intrusive_ptr<T> get(A&&... args)
+	{
+		T *obj = freelist_.pop();
+		if (obj)
+		{
+			++(*hits_);
+		}
+		else
+		{
+			++(*misses_);
+			obj = new T(std::forward<A>(args)...);
+		}
+
+		obj->pooled_pool_ = this->shared_from_this();
+		return boost::intrusive_ptr<T> { obj };
+	}
+
+	// called by pooled_object_t, when refcount drops to zero
+	void put(T *obj)
+	{
+		obj->pool_recycle();
+
+		if (!freelist_.push(obj))
+			delete obj;
+	}
+
+private:
+	object_freelist_t<T>   freelist_;
+	std::atomic<uint64_t>  *hits_;
+	std::atomic<uint64_t>  *misses_;
+};
+
+template<class T>
+using object_pool_ptr = std::shared_ptr<object_pool_t<T>>;
+
+template<class T>
+inline object_pool_ptr<T> create_object_pool(size_t capacity, std::atomic<uint64_t> *hits, std::atomic<uint64_t> *misses)
+{
+	return std::make_shared<object_pool_t<T>>(capacity, hits, misses);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__OBJECT_POOL_H_
@@ -18,6 +18,31 @@
 
 #endif
 
+// io_uring is used directly (no liburing), need a header new enough to have multishot recvmsg (linux 6.0+)
+// the kernel we run on might still be older, that's what has_io_uring() is for
+#ifdef PINBA_HAVE_LINUX_IO_URING_H
+	#include <linux/io_uring.h>
+
+	#ifdef IORING_RECV_MULTISHOT
+		#define PINBA_HAVE_IO_URING_RECV_MULTISHOT 1
+	#endif
+#endif
+
+struct io_uring_params;
+
+// AF_XDP is used directly as well (no libbpf/libxdp), redirect program is assembled at runtime
+// need headers with bpf links for xdp and need_wakeup rings (BPF_F_XDP_HAS_FRAGS is just a marker of new enough headers, linux 5.18+)
+#if defined(PINBA_HAVE_LINUX_IF_XDP_H) && defined(PINBA_HAVE_LINUX_BPF_H)
+	#include <linux/if_xdp.h>
+	#include <linux/bpf.h>
+
+	#if defined(XDP_USE_NEED_WAKEUP) && defined(BPF_F_XDP_HAS_FRAGS)
+		#define PINBA_HAVE_AF_XDP 1
+	#endif
+#endif
+
+union bpf_attr;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 struct pinba_os_symbols_t : private boost::noncopyable
@@ -34,14 +59,39 @@ struct pinba_os_symbols_t : private boost::noncopyable
 	using funcp___pthread_setaffinity_np_t = int (*)(pthread_t thread, size_t cpusetsize, const cpu_set_t *cpuset);
 	virtual int set_thread_affinity(size_t cpusetsize, const cpu_set_t *cpuset) = 0;
 
+	// calling thread scheduling policy, returns errno value, 0 = ok
+	virtual int set_thread_sched(pinba_thread_sched_t const&) = 0;
+
 	using funcp___recvmmsg_t = int (*)(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, const struct timespec *timeout);
 	virtual int  recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, const struct timespec *timeout) = 0;
 	virtual bool has_recvmmsg() const = 0;
+
+	// raw io_uring syscalls, return -1 and set errno on error (ENOSYS if built without io_uring support)
+	virtual int  io_uring_setup(unsigned entries, struct io_uring_params *p) = 0;
+	virtual int  io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) = 0;
+	virtual int  io_uring_register(int ring_fd, unsigned opcode, void *arg, unsigned nr_args) = 0;
+
+	// true if running kernel has io_uring with recvmsg and provided buffer rings
+	// multishot recvmsg itself can't be probed, kernel rejects it with EINVAL when arming, if unsupported
+	virtual bool has_io_uring() const = 0;
+
+	// raw bpf syscall, returns -1 and sets errno on error (ENOSYS if built without AF_XDP support)
+	// there is no probe, AF_XDP needs CAP_NET_ADMIN (+ CAP_BPF or CAP_SYS_ADMIN), that's what fails most of the time anyway
+	virtual int  bpf(int cmd, union bpf_attr *attr, unsigned size) = 0;
 };
 using pinba_os_symbols_ptr = std::unique_ptr<pinba_os_symbols_t>;
 
 pinba_os_symbols_ptr pinba_os_symbols___init(pinba_globals_t*);
 
+// pin calling thread to cpus given (all of them, scheduler picks within), does nothing if the list is empty
+// failure is not fatal, just logged, thread_name is for the log message
+// allocating memory after this call is what makes it numa-local (first-touch policy)
+void pinba_set_thread_cpus(pinba_globals_t*, pinba_cpu_list_t const& cpus, str_ref thread_name);
+
+// set calling thread scheduling policy and priority, does nothing for PINBA_THREAD_SCHED__DEFAULT
+// failure is not fatal, just logged (realtime policies need privileges), thread_name is for the log message
+void pinba_set_thread_sched(pinba_globals_t*, pinba_thread_sched_t const& sched, str_ref thread_name);
+
 
 #define PINBA___OS_CALL(g, func_name, ...)   \
 	g->os_symbols()->func_name(__VA_ARGS__); \
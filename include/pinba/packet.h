@@ -2,6 +2,7 @@
 #define PINBA__PACKET_H_
 
 #include <cstdint>
+#include <cstring>
 #include <type_traits>
 
 #include <meow/unix/time.hpp>
@@ -9,6 +10,7 @@
 
 #include "pinba/globals.h"
 #include "pinba/bloom.h"
+#include "pinba/hash.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // TODO: maybe move this to it's own header
@@ -59,24 +61,47 @@ namespace meow { namespace format {
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+// compact time values for timers, microseconds in uint32_t
+// max representable time interval: 4294,967295 seconds ~= 71 minutes, longer values saturate
+// timer values are validated to be >= 0 (and negative ru_* are reset to 0), see pinba_validate_request()
+inline uint32_t packet_usec___from_float(double const d)
+{
+	constexpr double const max_value = double(UINT32_MAX) / 1000000;
+
+	if (!(d > 0))
+		return 0;
+
+	if (d >= max_value)
+		return UINT32_MAX;
+
+	return uint32_t(d * 1000000);
+}
+
+inline duration_t packet_usec___to_duration(uint32_t const usec)
+{
+	return duration_t { int64_t(usec) * 1000 };
+}
+
 struct packed_timer_t
 {
 	uint32_t        hit_count;
 	uint32_t        tag_count;
-	duration_t      value;
-	duration_t      ru_utime;
-	duration_t      ru_stime;
-	uint32_t        *tag_name_ids;
-	uint32_t        *tag_value_ids;  // TODO: remove this ptr, address via tag_name_ids
+	uint32_t        value_us;        // see packet_usec___from_float()
+	uint32_t        ru_utime_us;
+	uint32_t        ru_stime_us;
+	uint32_t        tagset_id;       // id of tag_name_ids sequence within a batch, 0 = none, see timer_tagset_interner_t
+	uint32_t        *tag_name_ids;   // tag_count names, followed by tag_count values
 	// timer_bloom_t   bloom;           // 64bit
+
+	duration_t value() const    { return packet_usec___to_duration(value_us); }
+	duration_t ru_utime() const { return packet_usec___to_duration(ru_utime_us); }
+	duration_t ru_stime() const { return packet_usec___to_duration(ru_stime_us); }
+
+	uint32_t* tag_value_ids() const { return tag_name_ids + tag_count; }
 }; // __attribute__((packed)); // needed only with sizeof() == 28 below
 
-// check the size, had to add __attribute__((packed)) to definition, since the compiler likes
-// to have struct sizes % 8 == 0, to have them nicely aligned in arrays
-// but we don't need that, since 1st member is uint32 and is aligned properly in arrays as well
-// static_assert(sizeof(packed_timer_t) == 28, "make sure packed_timer_t has no padding inside");
-static_assert(sizeof(packed_timer_t) == 48, "make sure packed_timer_t has no padding inside");
-// static_assert(sizeof(packed_timer_t) == 56, "make sure packed_timer_t has no padding inside");
+// check the size, tagset_id occupies the 4 bytes that would otherwise be padding before tag_name_ids
+static_assert(sizeof(packed_timer_t) == 32, "make sure packed_timer_t has no padding inside");
 static_assert(std::is_standard_layout<packed_timer_t>::value == true, "packed_timer_t must have standard layout");
 
 struct packet_t
@@ -90,22 +115,193 @@ struct packet_t
 	uint32_t          mem_used;        // memory_footprint
 	uint16_t          tag_count;       // length of this->tags
 	uint16_t          timer_count;     // length of this->timers
+	uint32_t          sample_rate;     // >= 1, number of requests this packet stands for (client 1-in-N sampling, ingest budget, summaries)
+	uint32_t          tagset_id;       // id of request tag_name_ids sequence within a batch, 0 = none, see timer_tagset_interner_t
 	duration_t        request_time;    // use microseconds_t here?
 	duration_t        ru_utime;        // use microseconds_t here?
 	duration_t        ru_stime;        // use microseconds_t here?
-	uint32_t          *tag_name_ids;   // request tag names  (sequential in memory = scan speed)
-	uint32_t          *tag_value_ids;  // request tag values (sequential in memory = scan speed) TODO: remove this ptr, address via tag_name_ids
+	uint32_t          *tag_name_ids;   // request tag names, followed by values (sequential in memory = scan speed)
 	timer_bloom_t     *timers_blooms;  // blooms for all timers, sequential for check speed
 	packed_timer_t    *timers;
 	timertag_bloom_t  bloom;     // poor man's bloom filter over timer[].tag_name_ids
+
+	uint32_t* tag_value_ids() const { return tag_name_ids + tag_count; }
 };
 
+// aggregators add every packet value this many times, see packet_t::sample_rate
+inline duration_t packet___scaled(duration_t const d, uint32_t const sample_rate)
+{
+	return duration_t { d.nsec * int64_t(sample_rate) };
+}
+
+// sample rate from request tag value (see pinba_options_t::sample_rate_tag), decimal N for 1-in-N sampling
+// 1 for anything that doesn't parse, clamped to PINBA_LIMIT___MAX_SAMPLE_RATE
+inline uint32_t packet___sample_rate_from_str(str_ref const s)
+{
+	if (s.size() == 0)
+		return 1;
+
+	uint64_t result = 0;
+	for (size_t i = 0; i < s.size(); i++)
+	{
+		char const c = s.data()[i];
+		if (c < '0' || c > '9')
+			return 1;
+
+		result = result * 10 + (c - '0');
+		if (result > PINBA_LIMIT___MAX_SAMPLE_RATE)
+			return PINBA_LIMIT___MAX_SAMPLE_RATE;
+	}
+
+	return (result > 0) ? uint32_t(result) : 1;
+}
+
+// same, for integer tag value (see PINBA_INTERNAL___INT_TAG_VALUE_BIT)
+inline uint32_t packet___sample_rate_from_int(uint32_t value)
+{
+	if (value > PINBA_LIMIT___MAX_SAMPLE_RATE)
+		return PINBA_LIMIT___MAX_SAMPLE_RATE;
+
+	return (value > 0) ? value : 1;
+}
+
 // packet_t has been carefully crafted to avoid padding inside and eat as little memory as possible
 // make sure we haven't made a mistake anywhere
-// static_assert(sizeof(packet_t) == 96, "make sure packet_t has no padding inside");
-static_assert(sizeof(packet_t) == 104, "make sure packet_t has no padding inside");
+static_assert(sizeof(packet_t) == 88 + sizeof(timertag_bloom_t), "make sure packet_t has no padding inside");
 static_assert(std::is_standard_layout<packet_t>::value == true, "packet_t must be a standard layout type");
 
+// columnar (SoA) copy of packet fields over a batch, for aggregators that scan a few fields of every packet
+// column[i] is the field of packets[i] in the batch, packets themselves stay where they are
+// request tags and timers are flattened, packet i has [offset[i], offset[i+1]) elements
+// timers are copied by value, but tags of each timer still live behind its pointers
+struct packet_columns_t
+{
+	uint32_t          count;
+
+	uint32_t          *host_id;
+	uint32_t          *server_id;
+	uint32_t          *script_id;
+	uint32_t          *schema_id;
+	uint32_t          *status;
+	uint32_t          *traffic;
+	uint32_t          *mem_used;
+	uint32_t          *sample_rate;
+	duration_t        *request_time;
+	duration_t        *ru_utime;
+	duration_t        *ru_stime;
+	timertag_bloom_t  *bloom;
+
+	uint32_t          *tag_offset;     // count + 1 elements
+	uint32_t          *tag_name_ids;   // tag_offset[count] elements
+	uint32_t          *tag_value_ids;  // tag_offset[count] elements
+
+	uint32_t          *timer_offset;   // count + 1 elements
+	packed_timer_t    *timers;         // timer_offset[count] elements
+};
+
+// packets [begin, begin + count) of the same batch, offsets stay absolute, so tags and timers are shared
+inline packet_columns_t packet_columns___slice(packet_columns_t const& c, uint32_t begin, uint32_t count)
+{
+	packet_columns_t result = c;
+	result.count        = count;
+	result.host_id      += begin;
+	result.server_id    += begin;
+	result.script_id    += begin;
+	result.schema_id    += begin;
+	result.status       += begin;
+	result.traffic      += begin;
+	result.mem_used     += begin;
+	result.sample_rate  += begin;
+	result.request_time += begin;
+	result.ru_utime     += begin;
+	result.ru_stime     += begin;
+	result.bloom        += begin;
+	result.tag_offset   += begin;
+	result.timer_offset += begin;
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// most timers in a request (and in a batch) share a handful of tag name combinations
+// repacker assigns small ids to distinct timer tag name sequences (in order) within a batch,
+// so that reports can cache per-tagset results (like tag positions for key extraction)
+// instead of rescanning tag names of every timer
+// request tag names are interned by the same interner (packet_t::tagset_id), requests from the same code send the same tags
+//
+// ids are only comparable between timers from the same batch, and are in [1, max_ids]
+// 0 means 'no id' (interner is full), every such timer must be scanned the slow way
+// reset is O(1), slots from previous generations are treated as empty
+
+struct timer_tagset_interner_t
+{
+	static constexpr uint32_t max_ids = 255;
+	static constexpr uint32_t n_slots = 1024; // power of 2, load factor stays under 1/4
+
+	timer_tagset_interner_t()
+		: generation_{1}
+		, n_ids_{0}
+	{
+		memset(slots_, 0, sizeof(slots_));
+	}
+
+	void reset()
+	{
+		generation_++;
+		n_ids_ = 0;
+
+		// wrapped around, old slots might look current, clear them for real
+		if (__builtin_expect(generation_ == 0, 0))
+		{
+			memset(slots_, 0, sizeof(slots_));
+			generation_ = 1;
+		}
+	}
+
+	// names must stay alive and unchanged until reset(), i.e. be allocated from batch nmpa
+	uint32_t intern(uint32_t const *names, uint32_t count)
+	{
+		uint64_t const hash = t1ha0(names, sizeof(names[0]) * count, count);
+
+		for (uint32_t i = hash & (n_slots - 1);; i = (i + 1) & (n_slots - 1))
+		{
+			slot_t& slot = slots_[i];
+
+			if (slot.generation != generation_)
+			{
+				if (n_ids_ >= max_ids)
+					return 0;
+
+				slot.generation = generation_;
+				slot.id         = ++n_ids_;
+				slot.count      = count;
+				slot.hash       = hash;
+				slot.names      = names;
+				return slot.id;
+			}
+
+			if (slot.hash == hash && slot.count == count && 0 == memcmp(slot.names, names, sizeof(names[0]) * count))
+				return slot.id;
+		}
+	}
+
+	uint32_t size() const { return n_ids_; }
+
+private:
+
+	struct slot_t
+	{
+		uint32_t        generation;
+		uint32_t        id;
+		uint64_t        hash;
+		uint32_t const  *names;
+		uint32_t        count;
+	};
+
+	slot_t   slots_[n_slots];
+	uint32_t generation_;
+	uint32_t n_ids_;
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 MEOW_DEFINE_SMART_ENUM(request_validate_result,
@@ -138,14 +334,35 @@ MEOW_DEFINE_SMART_ENUM(request_validate_result,
 
 					((bad_float_timer_ru_stime,       "bad_float_timer_ru_stime"))
 					// ((negative_float_timer_ru_stime,  "negative_float_timer_ru_stime"))
+
+					((bad_dictionary_offset,          "bad_dictionary_offset"))
+					((int_tag_value_too_large,        "int_tag_value_too_large"))
+					((summary_count_too_large,        "summary_count_too_large"))
+					((summary_bad_histogram,          "summary_bad_histogram"))
+					((wire_format_error,              "wire_format_error"))
 					);
 
+// PINBA_PERMANENT_FIELD__* flag for packet field (aka &packet_t::host_id), 0 if unknown field
+inline uint32_t packet_field___permanent_flag(uint32_t packet_t::* field)
+{
+	if (field == &packet_t::host_id)   return PINBA_PERMANENT_FIELD__HOST;
+	if (field == &packet_t::server_id) return PINBA_PERMANENT_FIELD__SERVER;
+	if (field == &packet_t::script_id) return PINBA_PERMANENT_FIELD__SCRIPT;
+	if (field == &packet_t::schema_id) return PINBA_PERMANENT_FIELD__SCHEMA;
+	if (field == &packet_t::status)    return PINBA_PERMANENT_FIELD__STATUS;
+	return 0;
+}
+
 // validate that request makes sense and can be used further,
 // i.e. other parts further down the pipeline depend on checks done here
 // this function might change request slightly
 // sometimes it's easier to do it here, than in pinba_request_to_packet()
 request_validate_result_t pinba_validate_request(Pinba__Request *r);
 
+// same for requests decoded with pinba_wire_decoder_t (see packet_wire.h)
+struct pinba_wire_request_t;
+request_validate_result_t pinba_validate_request(pinba_wire_request_t *r);
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 #endif // PINBA__PACKET_H_
\ No newline at end of file
@@ -0,0 +1,81 @@
+#ifndef PINBA__PACKET_CAPTURE_H_
+#define PINBA__PACKET_CAPTURE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "pinba/globals.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ring of recent raw packets, for one-off questions without creating a report and waiting for its window
+// (see pinba_options_t::packet_capture_size, packet_capture_sample)
+//
+// relay thread copies every packet_capture_sample-th packet of every batch into a fixed size ring, overwriting the oldest one
+// packets are copied with words resolved to strings (truncated to fixed sizes), as packet words might be gone by the time we read
+// slots are seqlocks, relay (the only writer) never waits for readers, readers skip slots that are being (or have been) overwritten
+
+struct packet_batch_t;
+
+struct captured_packet_t
+{
+	static constexpr unsigned max_tags      = 4;   // first request tags of a packet
+	static constexpr unsigned max_word_size = 64;  // longer words are truncated
+	static constexpr unsigned max_name_size = 32;  // tag names
+
+	timeval_t   captured_tv;     // realtime
+	duration_t  request_time;
+	duration_t  ru_utime;
+	duration_t  ru_stime;
+	uint32_t    status;
+	uint32_t    traffic;
+	uint32_t    mem_used;
+	uint32_t    sample_rate;
+	uint32_t    tag_count;       // <= max_tags
+
+	// nul-terminated
+	char        host[max_word_size];
+	char        server[max_word_size];
+	char        script[max_word_size * 2];
+
+	struct {
+		char name[max_name_size];
+		char value[max_word_size];
+	} tags[max_tags];
+};
+
+// what readers want, applied while copying out of the ring (same as pinba_key_filter_conf_t for report keys)
+#define PACKET_CAPTURE_FIELD__HOST    0
+#define PACKET_CAPTURE_FIELD__SERVER  1
+#define PACKET_CAPTURE_FIELD__SCRIPT  2
+
+struct packet_capture_filter_t
+{
+	struct part_t
+	{
+		uint32_t                  field;   // PACKET_CAPTURE_FIELD__*
+		std::vector<std::string>  values;  // field is any of these, empty = nothing matches
+	};
+
+	std::vector<part_t> parts;
+};
+
+struct packet_capture_t : private boost::noncopyable
+{
+	virtual ~packet_capture_t() {}
+
+	// relay thread only
+	virtual void capture_batch(packet_batch_t const*) = 0;
+
+	// any thread, never blocks the writer, oldest packets first
+	virtual std::vector<captured_packet_t> read(packet_capture_filter_t const&) const = 0;
+};
+using packet_capture_ptr = std::unique_ptr<packet_capture_t>;
+
+packet_capture_ptr create_packet_capture(pinba_globals_t*, uint32_t capacity, uint32_t sample_every);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__PACKET_CAPTURE_H_
@@ -0,0 +1,468 @@
+#ifndef PINBA__PACKET_FILTER_H_
+#define PINBA__PACKET_FILTER_H_
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pinba/globals.h"
+#include "pinba/dictionary.h"
+#include "pinba/packet.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// packet-level report filters
+// reports get filters as a list of descriptors, each with std::function and (maybe) an op describing it
+// aggregators lower that list to packet_filter_program_t, that runs common filters inline
+// and only calls std::function for custom ones
+
+#define PACKET_FILTER_OP__CALL            0  // call filter function, default for filters without op
+#define PACKET_FILTER_OP__MIN_TIME        1  // request_time >= time
+#define PACKET_FILTER_OP__MAX_TIME        2  // request_time < time
+#define PACKET_FILTER_OP__FIELD_EQ        3  // packet->*field == value_id
+#define PACKET_FILTER_OP__REQUEST_TAG_EQ  4  // request tag name_id present and has value value_id
+#define PACKET_FILTER_OP__FIELD_IN        5  // packet->*field is in word_set
+#define PACKET_FILTER_OP__REQUEST_TAG_IN  6  // request tag name_id present and its value is in word_set
+
+// set of word ids, for IN-lists and patterns (prefixes, regexes) on fields and tags
+// exact values are a sorted id list, patterns are a dictionary matcher (see dictionary_word_matchers_t)
+// so a packet word is checked with a binary search and one bit test, strings are only matched once per word, ever
+// integer tag values (see dictionary_int_words_t) never match patterns, they have numeric ranges instead
+struct packet_filter_word_set_t
+{
+	using int_range_t = std::pair<uint32_t, uint32_t>; // inclusive, integer word ids (not values, but the order is the same)
+
+	std::string                  spec;       // what the set was made from, for names and signatures
+	std::vector<uint32_t>        word_ids;   // sorted
+	dictionary_word_matcher_ptr  matcher;    // nullptr for plain lists
+	std::vector<int_range_t>     int_ranges; // usually none, or just a couple
+
+	inline bool contains(uint32_t word_id) const
+	{
+		if (std::binary_search(word_ids.begin(), word_ids.end(), word_id))
+			return true;
+
+		if (dictionary_int_words_t::is_int_id(word_id))
+		{
+			for (auto const& range : int_ranges)
+			{
+				if (word_id >= range.first && word_id <= range.second)
+					return true;
+			}
+			return false;
+		}
+
+		return (matcher) ? matcher->matches(word_id) : false;
+	}
+};
+using packet_filter_word_set_ptr = std::shared_ptr<packet_filter_word_set_t const>;
+
+struct packet_filter_op_t
+{
+	int                         opcode;    // PACKET_FILTER_OP__*
+	uint32_t packet_t::*        field;     // FIELD_EQ, FIELD_IN
+	uint32_t                    name_id;   // REQUEST_TAG_EQ, REQUEST_TAG_IN
+	uint32_t                    value_id;  // FIELD_EQ, REQUEST_TAG_EQ
+	duration_t                  time;      // MIN_TIME, MAX_TIME
+	packet_filter_word_set_ptr  word_set;  // FIELD_IN, REQUEST_TAG_IN
+};
+
+inline packet_filter_op_t packet_filter_op___min_time(duration_t min_time)
+{
+	packet_filter_op_t op = {};
+	op.opcode = PACKET_FILTER_OP__MIN_TIME;
+	op.time   = min_time;
+	return op;
+}
+
+inline packet_filter_op_t packet_filter_op___max_time(duration_t max_time)
+{
+	packet_filter_op_t op = {};
+	op.opcode = PACKET_FILTER_OP__MAX_TIME;
+	op.time   = max_time;
+	return op;
+}
+
+inline packet_filter_op_t packet_filter_op___field_eq(uint32_t packet_t::* field_ptr, uint32_t value_id)
+{
+	packet_filter_op_t op = {};
+	op.opcode   = PACKET_FILTER_OP__FIELD_EQ;
+	op.field    = field_ptr;
+	op.value_id = value_id;
+	return op;
+}
+
+inline packet_filter_op_t packet_filter_op___request_tag_eq(uint32_t name_id, uint32_t value_id)
+{
+	packet_filter_op_t op = {};
+	op.opcode   = PACKET_FILTER_OP__REQUEST_TAG_EQ;
+	op.name_id  = name_id;
+	op.value_id = value_id;
+	return op;
+}
+
+inline packet_filter_op_t packet_filter_op___field_in(uint32_t packet_t::* field_ptr, packet_filter_word_set_ptr word_set)
+{
+	packet_filter_op_t op = {};
+	op.opcode   = PACKET_FILTER_OP__FIELD_IN;
+	op.field    = field_ptr;
+	op.word_set = std::move(word_set);
+	return op;
+}
+
+inline packet_filter_op_t packet_filter_op___request_tag_in(uint32_t name_id, packet_filter_word_set_ptr word_set)
+{
+	packet_filter_op_t op = {};
+	op.opcode   = PACKET_FILTER_OP__REQUEST_TAG_IN;
+	op.name_id  = name_id;
+	op.word_set = std::move(word_set);
+	return op;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct packet_filter_program_t
+{
+	using filter_func_t = std::function<bool(packet_t*)>;
+
+	struct instruction_t
+	{
+		packet_filter_op_t op;
+		uint32_t           func_index; // CALL only, offset in funcs_
+	};
+
+public:
+
+	// FilterDescriptors is a container of report_conf___by_*_t::filter_descriptor_t
+	template<class FilterDescriptors>
+	void compile(FilterDescriptors const& filters)
+	{
+		code_.clear();
+		funcs_.clear();
+
+		for (auto const& filter : filters)
+		{
+			instruction_t insn = { .op = filter.op, .func_index = 0 };
+
+			if (insn.op.opcode == PACKET_FILTER_OP__CALL)
+			{
+				insn.func_index = funcs_.size();
+				funcs_.push_back(filter.func);
+			}
+
+			code_.push_back(insn);
+		}
+
+		// all filters must pass, so order doesn't change the result
+		// run cheap ones first (opcodes are ordered by cost), std::function calls last
+		std::stable_sort(code_.begin(), code_.end(), [](instruction_t const& l, instruction_t const& r)
+		{
+			auto const cost = [](int opcode) { return (opcode == PACKET_FILTER_OP__CALL) ? 1000 : opcode; };
+			return cost(l.op.opcode) < cost(r.op.opcode);
+		});
+	}
+
+	bool empty() const
+	{
+		return code_.empty();
+	}
+
+	size_t size() const
+	{
+		return code_.size();
+	}
+
+	// single packet, true if packet passes all filters
+	inline bool run(packet_t *packet) const
+	{
+		for (auto const& insn : code_)
+		{
+			if (!this->exec(insn, packet))
+				return false;
+		}
+		return true;
+	}
+
+	// run filters over a batch, instruction-major, compacting survivors to the start of packets[]
+	// returns number of survivors
+	inline uint32_t run_batch(packet_t **packets, uint32_t count) const
+	{
+		for (auto const& insn : code_)
+		{
+			packet_filter_op_t const& op = insn.op;
+
+			switch (op.opcode)
+			{
+				case PACKET_FILTER_OP__MIN_TIME:
+					count = compact(packets, count, [&op](packet_t const *p) { return (p->request_time >= op.time); });
+				break;
+
+				case PACKET_FILTER_OP__MAX_TIME:
+					count = compact(packets, count, [&op](packet_t const *p) { return (p->request_time < op.time); });
+				break;
+
+				case PACKET_FILTER_OP__FIELD_EQ:
+					count = compact(packets, count, [&op](packet_t const *p) { return (p->*op.field == op.value_id); });
+				break;
+
+				case PACKET_FILTER_OP__REQUEST_TAG_EQ:
+					count = compact(packets, count, [&op](packet_t const *p) { return request_tag_eq(op, p); });
+				break;
+
+				case PACKET_FILTER_OP__FIELD_IN:
+					count = compact(packets, count, [&op](packet_t const *p) { return op.word_set->contains(p->*op.field); });
+				break;
+
+				case PACKET_FILTER_OP__REQUEST_TAG_IN:
+					count = compact(packets, count, [&op](packet_t const *p) { return request_tag_in(op, p); });
+				break;
+
+				default:
+				{
+					auto const& func = funcs_[insn.func_index];
+					count = compact(packets, count, [&func](packet_t *p) { return func(p); });
+				}
+				break;
+			}
+
+			if (count == 0)
+				break;
+		}
+
+		return count;
+	}
+
+	// same as run_batch(), but reads fields from columns, instead of chasing packet pointers
+	// sel[] holds indexes into columns (and packets, for CALL filters), survivors are compacted to the start of sel[]
+	// returns number of survivors
+	inline uint32_t run_columns(packet_columns_t const& columns, packet_t **packets, uint32_t *sel, uint32_t count) const
+	{
+		for (auto const& insn : code_)
+		{
+			packet_filter_op_t const& op = insn.op;
+
+			switch (op.opcode)
+			{
+				case PACKET_FILTER_OP__MIN_TIME:
+				{
+					duration_t const *col = columns.request_time;
+					count = compact_sel(sel, count, [col, &op](uint32_t i) { return (col[i] >= op.time); });
+				}
+				break;
+
+				case PACKET_FILTER_OP__MAX_TIME:
+				{
+					duration_t const *col = columns.request_time;
+					count = compact_sel(sel, count, [col, &op](uint32_t i) { return (col[i] < op.time); });
+				}
+				break;
+
+				case PACKET_FILTER_OP__FIELD_EQ:
+				{
+					uint32_t const *col = field_column(columns, op.field);
+					if (col)
+						count = compact_sel(sel, count, [col, &op](uint32_t i) { return (col[i] == op.value_id); });
+					else
+						count = compact_sel(sel, count, [packets, &op](uint32_t i) { return (packets[i]->*op.field == op.value_id); });
+				}
+				break;
+
+				case PACKET_FILTER_OP__REQUEST_TAG_EQ:
+					count = compact_sel(sel, count, [&columns, &op](uint32_t i)
+					{
+						for (uint32_t t = columns.tag_offset[i]; t < columns.tag_offset[i + 1]; ++t)
+						{
+							if (columns.tag_name_ids[t] == op.name_id)
+								return (columns.tag_value_ids[t] == op.value_id);
+						}
+						return false;
+					});
+				break;
+
+				case PACKET_FILTER_OP__FIELD_IN:
+				{
+					packet_filter_word_set_t const *ws = op.word_set.get();
+					uint32_t const *col = field_column(columns, op.field);
+					if (col)
+						count = compact_sel(sel, count, [col, ws](uint32_t i) { return ws->contains(col[i]); });
+					else
+						count = compact_sel(sel, count, [packets, ws, &op](uint32_t i) { return ws->contains(packets[i]->*op.field); });
+				}
+				break;
+
+				case PACKET_FILTER_OP__REQUEST_TAG_IN:
+					count = compact_sel(sel, count, [&columns, &op](uint32_t i)
+					{
+						for (uint32_t t = columns.tag_offset[i]; t < columns.tag_offset[i + 1]; ++t)
+						{
+							if (columns.tag_name_ids[t] == op.name_id)
+								return op.word_set->contains(columns.tag_value_ids[t]);
+						}
+						return false;
+					});
+				break;
+
+				default:
+				{
+					auto const& func = funcs_[insn.func_index];
+					count = compact_sel(sel, count, [packets, &func](uint32_t i) { return func(packets[i]); });
+				}
+				break;
+			}
+
+			if (count == 0)
+				break;
+		}
+
+		return count;
+	}
+
+private:
+
+	static inline uint32_t const* field_column(packet_columns_t const& columns, uint32_t packet_t::* field)
+	{
+		if (field == &packet_t::host_id)   return columns.host_id;
+		if (field == &packet_t::server_id) return columns.server_id;
+		if (field == &packet_t::script_id) return columns.script_id;
+		if (field == &packet_t::schema_id) return columns.schema_id;
+		if (field == &packet_t::status)    return columns.status;
+		if (field == &packet_t::traffic)   return columns.traffic;
+		if (field == &packet_t::mem_used)  return columns.mem_used;
+		return nullptr;
+	}
+
+	template<class Predicate>
+	static inline uint32_t compact_sel(uint32_t *sel, uint32_t count, Predicate const& pred)
+	{
+		uint32_t n_passed = 0;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			if (pred(sel[i]))
+				sel[n_passed++] = sel[i];
+		}
+		return n_passed;
+	}
+
+	static inline bool request_tag_eq(packet_filter_op_t const& op, packet_t const *packet)
+	{
+		for (uint32_t i = 0; i < packet->tag_count; ++i)
+		{
+			if (packet->tag_name_ids[i] == op.name_id)
+				return (packet->tag_value_ids()[i] == op.value_id);
+		}
+		return false;
+	}
+
+	static inline bool request_tag_in(packet_filter_op_t const& op, packet_t const *packet)
+	{
+		for (uint32_t i = 0; i < packet->tag_count; ++i)
+		{
+			if (packet->tag_name_ids[i] == op.name_id)
+				return op.word_set->contains(packet->tag_value_ids()[i]);
+		}
+		return false;
+	}
+
+	inline bool exec(instruction_t const& insn, packet_t *packet) const
+	{
+		packet_filter_op_t const& op = insn.op;
+
+		switch (op.opcode)
+		{
+			case PACKET_FILTER_OP__MIN_TIME:       return (packet->request_time >= op.time);
+			case PACKET_FILTER_OP__MAX_TIME:       return (packet->request_time < op.time);
+			case PACKET_FILTER_OP__FIELD_EQ:       return (packet->*op.field == op.value_id);
+			case PACKET_FILTER_OP__REQUEST_TAG_EQ: return request_tag_eq(op, packet);
+			case PACKET_FILTER_OP__FIELD_IN:       return op.word_set->contains(packet->*op.field);
+			case PACKET_FILTER_OP__REQUEST_TAG_IN: return request_tag_in(op, packet);
+			default:                               return funcs_[insn.func_index](packet);
+		}
+	}
+
+	template<class Predicate>
+	static inline uint32_t compact(packet_t **packets, uint32_t count, Predicate const& pred)
+	{
+		uint32_t n_passed = 0;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			if (pred(packets[i]))
+				packets[n_passed++] = packets[i];
+		}
+		return n_passed;
+	}
+
+private:
+	std::vector<instruction_t>  code_;
+	std::vector<filter_func_t>  funcs_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// batch-level routing
+// repacker builds a summary for every batch, reports describe what every packet they use must have,
+// relay skips reports for which no packet in a batch can possibly pass
+// all blooms, so 'can't match' is exact and 'might match' is not
+
+struct packet_batch_summary_t
+{
+	timertag_bloom_t   timertag_bloom; // union of all packet blooms
+	packet_id_bloom_t  script_ids;
+	packet_id_bloom_t  server_ids;
+
+	inline void add_packet(packet_t const *packet)
+	{
+		timertag_bloom.merge(packet->bloom);
+		script_ids.add(packet->script_id);
+		server_ids.add(packet->server_id);
+	}
+
+	void reset()
+	{
+		timertag_bloom.reset();
+		script_ids.reset();
+		server_ids.reset();
+	}
+};
+
+// empty bloom is contained in any other, so unset parts match any batch
+struct packet_batch_filter_t
+{
+	timertag_bloom_t   timertag_bloom; // timer tag names every useful packet has
+	packet_id_bloom_t  script_id;      // script_id every useful packet has (if filtered by)
+	packet_id_bloom_t  server_id;      // server_id every useful packet has (if filtered by)
+
+	// picks FIELD_EQ filters on script_id/server_id, all others are ignored (any batch might pass them)
+	template<class FilterDescriptors>
+	void add_filters(FilterDescriptors const& filters)
+	{
+		for (auto const& filter : filters)
+		{
+			if (filter.op.opcode != PACKET_FILTER_OP__FIELD_EQ)
+				continue;
+
+			if (filter.op.field == &packet_t::script_id)
+				script_id.add(filter.op.value_id);
+			else if (filter.op.field == &packet_t::server_id)
+				server_id.add(filter.op.value_id);
+		}
+	}
+
+	inline bool might_match(packet_batch_summary_t const& summary) const
+	{
+		return summary.timertag_bloom.contains(timertag_bloom)
+			&& summary.script_ids.contains(script_id)
+			&& summary.server_ids.contains(server_id);
+	}
+
+	// same batches pass both filters
+	inline bool operator==(packet_batch_filter_t const& other) const
+	{
+		return (timertag_bloom == other.timertag_bloom)
+			&& (script_id == other.script_id)
+			&& (server_id == other.server_id);
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__PACKET_FILTER_H_
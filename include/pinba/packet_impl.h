@@ -1,11 +1,14 @@
 #ifndef PINBA__PACKET_IMPL_H_
 #define PINBA__PACKET_IMPL_H_
 
+#include <algorithm>
 #include <vector>
 #include <string>
+#include <cstring> // memmove
 
 #include "pinba/globals.h"
 #include "pinba/packet.h"
+#include "pinba/packet_simd.h"
 #include "pinba/bloom.h"
 #include "pinba/hash.h"
 #include "pinba/dictionary.h"
@@ -27,30 +30,10 @@ inline meow::str_ref pb_string_as_str_ref(ProtobufCBinaryData const& pb_bin)
 	return { (char const*)pb_bin.data, pb_bin.len };
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-
-inline std::vector<std::string> pinba_request_status_to_str_ref___generate(size_t sz)
-{
-	std::vector<std::string> result;
-	result.resize(sz);
-
-	for (size_t i = 0; i < result.size(); i++)
-	{
-		result[i] = ff::write_str(i);
-	}
-
-	return result;
-}
-
-inline meow::str_ref pinba_request_status_to_str_ref_tmp(uint32_t status, meow::format::type_tunnel<uint32_t>::buffer_t const& buf = {})
+// pinba_wire_request_t strings are str_ref already
+inline meow::str_ref pb_string_as_str_ref(meow::str_ref const& s)
 {
-	// a table with pre-generated strings for all http statuses
-	static auto const table = pinba_request_status_to_str_ref___generate(1024);
-
-	if (status < table.size())
-		return table[status];
-
-	return meow::format::type_tunnel<uint32_t>::call(status, buf);
+	return s;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -96,11 +79,90 @@ inline void for_each_timer(Pinba__Request const *r, Function const& cb)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-template<class D>
-inline packet_t* pinba_request_to_packet(Pinba__Request const *r, D *d, struct nmpa_s *nmpa)
+// same bloom as pinba_request_to_packet() builds in packet_t::bloom (timer tag names, that are present in dictionary)
+// but without adding anything to dictionary or allocating packet memory, used to check packet_prefilter_t before repacking
+template<class R, class D>
+inline void pinba_request_to_timertag_bloom(R const *r, D *d, timertag_bloom_t *bloom)
+{
+	// look up every name at most once, requests usually repeat the same few tag names across timers
+	uint8_t names_checked[r->n_dictionary];
+	memset(names_checked, 0, sizeof(names_checked));
+
+	for (unsigned i = 0; i < r->n_timer_tag_name; i++)
+	{
+		uint32_t const name_off = r->timer_tag_name[i];
+		if (names_checked[name_off])
+			continue;
+
+		names_checked[name_off] = 1;
+
+		dictionary_t::nameword_t const nw = d->get_nameword(pb_string_as_str_ref(r->dictionary[name_off]));
+		if (nw.id != 0)
+			bloom->add_hashed(nw.id_hash);
+	}
+}
+
+// phase 1 of pinba_request_to_packet() for a batch of requests (see repacker_dictionary_t::prefetch())
+// words that pinba_request_to_packet() adds are prefetched, i.e. fields and tag values with known names, for the same request and dictionary
+template<class R, class D>
+inline void pinba_request_prefetch_words(R const *r, D *d)
+{
+	d->prefetch___field(PINBA_PERMANENT_FIELD__HOST, pb_string_as_str_ref(r->hostname));
+	d->prefetch___field(PINBA_PERMANENT_FIELD__SERVER, pb_string_as_str_ref(r->server_name));
+	d->prefetch___field(PINBA_PERMANENT_FIELD__SCRIPT, pb_string_as_str_ref(r->script_name));
+	d->prefetch___field(PINBA_PERMANENT_FIELD__SCHEMA, pb_string_as_str_ref(r->schema));
+
+	// 0 = not checked, 1 = unknown name, 2 = known name
+	uint8_t names_checked[r->n_dictionary];
+	memset(names_checked, 0, sizeof(names_checked));
+
+	auto const prefetch_tag = [&](uint32_t name_off, uint32_t value_off)
+	{
+		uint8_t& nc = names_checked[name_off];
+		if (nc == 0)
+			nc = (d->get_nameword(pb_string_as_str_ref(r->dictionary[name_off])).id != 0) + 1;
+
+		if (nc != 2)
+			return;
+
+		if (value_off & PINBA_INTERNAL___INT_TAG_VALUE_BIT) // integers never touch dictionary
+			return;
+
+		str_ref const value = pb_string_as_str_ref(r->dictionary[value_off]);
+		d->prefetch(value, dictionary_word_hasher_t()(value));
+	};
+
+	for (unsigned i = 0; i < r->n_timer_tag_name; i++)
+		prefetch_tag(r->timer_tag_name[i], r->timer_tag_value[i]);
+
+	for (unsigned i = 0; i < r->n_tag_name; i++)
+		prefetch_tag(r->tag_name[i], r->tag_value[i]);
+}
+
+// R = Pinba__Request or pinba_wire_request_t (see packet_wire.h), must have been validated with pinba_validate_request()
+// tagsets - assigns packed_timer_t::tagset_id and packet_t::tagset_id, must be reset together with nmpa, nullptr = everything gets tagset_id 0
+// sample_rate_tag - request tag to take packet_t::sample_rate from (see repacker_conf_t), empty = always 1
+template<class R, class D>
+inline packet_t* pinba_request_to_packet(R const *r, D *d, struct nmpa_s *nmpa, timer_tagset_interner_t *tagsets = nullptr, str_ref const sample_rate_tag = {})
 {
 	auto *p = (packet_t*)nmpa_calloc(nmpa, sizeof(packet_t)); // NOTE: no ctor is called here!
 
+	// hash each dictionary string at most once, even if it's used both as a name and a value
+	// the hash is then used for all dictionary lookups, local and global
+	// 0 means 'not calculated yet' (a real 0 hash just gets recalculated, that's fine)
+	uint64_t dict_hashes[r->n_dictionary];
+	memset(dict_hashes, 0, sizeof(dict_hashes));
+
+	auto const get_hash_by_dict_offset = [&](uint32_t dict_offset) -> uint64_t
+	{
+		uint64_t& h = dict_hashes[dict_offset];
+
+		if (h == 0)
+			h = dictionary_word_hasher_t()(pb_string_as_str_ref(r->dictionary[dict_offset]));
+
+		return h;
+	};
+
 	struct name_id_t
 	{
 		// TODO: maybe redo with bit flags, and not status numbers (but probably doesn't matter)
@@ -124,7 +186,7 @@ inline packet_t* pinba_request_to_packet(Pinba__Request const *r, D *d, struct n
 		if (nid.status == name_id_t::not_checked)
 		{
 			// uint32_t const word_id = d->get_or_add(pb_string_as_str_ref(r->dictionary[dict_offset]));
-			dictionary_t::nameword_t const nw = d->get_nameword(pb_string_as_str_ref(r->dictionary[dict_offset]));
+			dictionary_t::nameword_t const nw = d->get_nameword(pb_string_as_str_ref(r->dictionary[dict_offset]), get_hash_by_dict_offset(dict_offset));
 			nid.status       += (nw.id != 0) + 1;
 			nid.word_id      = nw.id;
 			nid.bloom_hashed = nw.id_hash;
@@ -154,7 +216,7 @@ inline packet_t* pinba_request_to_packet(Pinba__Request const *r, D *d, struct n
 
 		if (vid.status == value_id_t::not_checked)
 		{
-			uint32_t const word_id = d->get_or_add(pb_string_as_str_ref(r->dictionary[dict_offset]));
+			uint32_t const word_id = d->get_or_add(pb_string_as_str_ref(r->dictionary[dict_offset]), get_hash_by_dict_offset(dict_offset));
 			vid.status  = value_id_t::ok;
 			vid.word_id = word_id;
 		}
@@ -164,13 +226,25 @@ inline packet_t* pinba_request_to_packet(Pinba__Request const *r, D *d, struct n
 		return vid;
 	};
 
-	p->host_id      = d->get_or_add(pb_string_as_str_ref(r->hostname));
-	p->server_id    = d->get_or_add(pb_string_as_str_ref(r->server_name));
-	p->script_id    = d->get_or_add(pb_string_as_str_ref(r->script_name));
-	p->schema_id    = d->get_or_add(pb_string_as_str_ref(r->schema));
-	p->status       = d->get_or_add(pinba_request_status_to_str_ref_tmp(r->status)); // TODO: can avoid get_or_add for small values (cache in perm dict)
+	// tag value is either an offset in r->dictionary or an integer (see PINBA_INTERNAL___INT_TAG_VALUE_BIT)
+	// integers are not interned, their word ids are made from value directly, see dictionary_int_words_t
+	auto const get_value_word_id = [&](uint32_t value_off) -> uint32_t
+	{
+		if (value_off & PINBA_INTERNAL___INT_TAG_VALUE_BIT)
+			return dictionary_int_words_t::id_from_value(value_off & ~PINBA_INTERNAL___INT_TAG_VALUE_BIT);
+
+		return get_value_id_by_dict_offset(value_off).word_id;
+	};
+
+	// fields might go to permanent dictionary, see pinba_options_t::permanent_dictionary_fields
+	p->host_id      = d->get_or_add___field(PINBA_PERMANENT_FIELD__HOST, pb_string_as_str_ref(r->hostname));
+	p->server_id    = d->get_or_add___field(PINBA_PERMANENT_FIELD__SERVER, pb_string_as_str_ref(r->server_name));
+	p->script_id    = d->get_or_add___field(PINBA_PERMANENT_FIELD__SCRIPT, pb_string_as_str_ref(r->script_name));
+	p->schema_id    = d->get_or_add___field(PINBA_PERMANENT_FIELD__SCHEMA, pb_string_as_str_ref(r->schema));
+	p->status       = d->get_or_add___status(r->status); // repacker dictionary caches these by number
 	p->traffic      = r->document_size;
 	p->mem_used     = r->memory_footprint;
+	p->sample_rate  = 1;
 	p->request_time = duration_from_float(r->request_time);
 	p->ru_utime     = duration_from_float(r->ru_utime);
 	p->ru_stime     = duration_from_float(r->ru_stime);
@@ -182,27 +256,50 @@ inline packet_t* pinba_request_to_packet(Pinba__Request const *r, D *d, struct n
 		p->timers_blooms = (timer_bloom_t*)nmpa_alloc(nmpa, sizeof(timer_bloom_t) * r->n_timer_value);
 		p->timers = (packed_timer_t*)nmpa_alloc(nmpa, sizeof(packed_timer_t) * r->n_timer_value);
 
-		// contiguous storage for all timer tag names/values
-		uint32_t *timer_tag_name_ids = (uint32_t*)nmpa_alloc(nmpa, sizeof(uint32_t) * r->n_timer_tag_name);
-		uint32_t *timer_tag_value_ids = (uint32_t*)nmpa_alloc(nmpa, sizeof(uint32_t) * r->n_timer_tag_value);
+		// contiguous storage for all timer tag names/values, every timer has its names followed by its values
+		uint32_t *timer_tag_ids = (uint32_t*)nmpa_alloc(nmpa, sizeof(uint32_t) * (r->n_timer_tag_name + r->n_timer_tag_value));
 
 		unsigned src_tag_offset = 0;
 		unsigned dst_tag_offset = 0;
 
+		// timer times are converted in bulk, a block at a time (see packet_simd.h), not to have unbounded arrays on stack
+		constexpr unsigned const usec_block_size = 64;
+		uint32_t value_us[usec_block_size];
+		uint32_t ru_utime_us[usec_block_size];
+		uint32_t ru_stime_us[usec_block_size];
+
+		auto const convert_block = [&](float const *src, size_t n_src, unsigned from, unsigned count, uint32_t *dst)
+		{
+			unsigned const n = (from < n_src) ? std::min<unsigned>(count, n_src - from) : 0; // rusage might be missing
+			if (n > 0)
+				packet_simd___usec_from_float(src + from, n, dst);
+			std::fill(dst + n, dst + count, 0);
+		};
+
 		for (unsigned timer_i = 0; timer_i < r->n_timer_value; timer_i++)
 		{
+			unsigned const block_i = timer_i % usec_block_size;
+			if (block_i == 0)
+			{
+				unsigned const count = std::min<unsigned>(usec_block_size, r->n_timer_value - timer_i);
+				convert_block(r->timer_value, r->n_timer_value, timer_i, count, value_us);
+				convert_block(r->timer_ru_utime, r->n_timer_ru_utime, timer_i, count, ru_utime_us);
+				convert_block(r->timer_ru_stime, r->n_timer_ru_stime, timer_i, count, ru_stime_us);
+			}
+
 			packed_timer_t *t = &p->timers[timer_i];
 			t->tag_count     = 0; // see it's incremented when scanning tags (as we can skip)
 			t->hit_count     = r->timer_hit_count[timer_i];
-			t->value         = duration_from_float(r->timer_value[timer_i]);
-			t->ru_utime      = (timer_i < r->n_timer_ru_utime) ? duration_from_float(r->timer_ru_utime[timer_i]) : duration_t{0};
-			t->ru_stime      = (timer_i < r->n_timer_ru_stime) ? duration_from_float(r->timer_ru_stime[timer_i]) : duration_t{0};
-
-			t->tag_name_ids  = timer_tag_name_ids + dst_tag_offset;
-			t->tag_value_ids = timer_tag_value_ids + dst_tag_offset;
+			t->value_us      = value_us[block_i];
+			t->ru_utime_us   = ru_utime_us[block_i];
+			t->ru_stime_us   = ru_stime_us[block_i];
 
 			uint32_t const src_tag_count = r->timer_tag_count[timer_i];
 
+			// values go after all possible names for now, moved closer below if some tags are skipped
+			t->tag_name_ids = timer_tag_ids + dst_tag_offset;
+			uint32_t *tag_value_ids = t->tag_name_ids + src_tag_count;
+
 			for (unsigned tag_i = 0; tag_i < src_tag_count; tag_i++)
 			{
 				// offsets in r->dictionary and td
@@ -216,11 +313,11 @@ inline packet_t* pinba_request_to_packet(Pinba__Request const *r, D *d, struct n
 					continue;
 
 				// translate value, it's going to be added if not already present
-				value_id_t const& vid = get_value_id_by_dict_offset(tag_value_off);
+				uint32_t const value_id = get_value_word_id(tag_value_off);
 
 				// copy to final destination
-				t->tag_name_ids[t->tag_count]  = nid.word_id;
-				t->tag_value_ids[t->tag_count] = vid.word_id;
+				t->tag_name_ids[t->tag_count] = nid.word_id;
+				tag_value_ids[t->tag_count]   = value_id;
 				t->tag_count++;
 
 				// packet and timer level blooms
@@ -241,9 +338,14 @@ inline packet_t* pinba_request_to_packet(Pinba__Request const *r, D *d, struct n
 
 			// ff::fmt(stdout, "timer_bloom[{0}]: {1}\n", i, t->bloom.to_string());
 
+			if (t->tag_count < src_tag_count)
+				memmove(t->tag_value_ids(), tag_value_ids, sizeof(uint32_t) * t->tag_count);
+
+			t->tagset_id = (tagsets) ? tagsets->intern(t->tag_name_ids, t->tag_count) : 0;
+
 			// advance base offset in original request
 			src_tag_offset += src_tag_count;
-			dst_tag_offset += t->tag_count;
+			dst_tag_offset += t->tag_count * 2;
 		}
 	}
 
@@ -251,27 +353,100 @@ inline packet_t* pinba_request_to_packet(Pinba__Request const *r, D *d, struct n
 	if (r->n_tag_name > 0)
 	{
 		p->tag_count     = 0; // see it's incremented below (as we can skip tags)
-		p->tag_name_ids  = (uint32_t*)nmpa_alloc(nmpa, sizeof(uint32_t) * r->n_tag_name);
-		p->tag_value_ids = (uint32_t*)nmpa_alloc(nmpa, sizeof(uint32_t) * r->n_tag_name);
+		p->tag_name_ids  = (uint32_t*)nmpa_alloc(nmpa, sizeof(uint32_t) * r->n_tag_name * 2);
+
+		// values go after all possible names for now, moved closer below if some tags are skipped
+		uint32_t *tag_value_ids = p->tag_name_ids + r->n_tag_name;
 
 		for (unsigned tag_i = 0; tag_i < r->n_tag_name; tag_i++)
 		{
+			// by raw name, it doesn't have to be a known tag name
+			if (sample_rate_tag.size() > 0 && pb_string_as_str_ref(r->dictionary[r->tag_name[tag_i]]) == sample_rate_tag)
+			{
+				uint32_t const value_off = r->tag_value[tag_i];
+				p->sample_rate = (value_off & PINBA_INTERNAL___INT_TAG_VALUE_BIT)
+					? packet___sample_rate_from_int(value_off & ~PINBA_INTERNAL___INT_TAG_VALUE_BIT)
+					: packet___sample_rate_from_str(pb_string_as_str_ref(r->dictionary[value_off]));
+			}
+
 			name_id_t const& nid  = get_name_id_by_dict_offset(r->tag_name[tag_i]);
 			if (nid.status != name_id_t::ok)
 				continue;
 
-			value_id_t const& vid = get_value_id_by_dict_offset(r->tag_value[tag_i]);
+			uint32_t const value_id = get_value_word_id(r->tag_value[tag_i]);
 
 			// copy to dest
-			p->tag_name_ids[p->tag_count]  = nid.word_id;
-			p->tag_value_ids[p->tag_count] = vid.word_id;
+			p->tag_name_ids[p->tag_count] = nid.word_id;
+			tag_value_ids[p->tag_count]   = value_id;
 			p->tag_count++;
 		}
+
+		if (p->tag_count < r->n_tag_name)
+			memmove(p->tag_value_ids(), tag_value_ids, sizeof(uint32_t) * p->tag_count);
+
+		p->tagset_id = (tagsets && p->tag_count > 0) ? tagsets->intern(p->tag_name_ids, p->tag_count) : 0;
 	}
 
 	return p;
 }
 
+// pre-aggregated summaries (r->summary_count > 0, see proto/pinba.proto) are repacked into packets weighted by request count
+// p is what pinba_request_to_packet() made of r, its totals become per-request averages (aggregators multiply them back)
+// with request_time histogram there is a packet per (non-empty) bucket, weighted by bucket count, with its own request_time
+// extra packets are shallow copies of p, i.e. they share tags and timers, out must have room for PINBA_LIMIT___MAX_SUMMARY_BUCKETS
+// timer hit counts are averages as well (rounded, at least 1), so summaries should group requests that have the same timers
+// returns number of packets in out, out[0] is always p
+template<class R>
+inline uint32_t pinba_summary_to_packets(R const *r, packet_t *p, struct nmpa_s *nmpa, packet_t **out)
+{
+	uint32_t const n_requests = r->summary_count;
+	assert(n_requests > 0);
+
+	// timer totals might not fit packed_timer_t microseconds, so these are taken from r again, not from p
+	auto const per_request_us = [&](float const *totals, size_t n_totals, unsigned i) -> uint32_t
+	{
+		return (i < n_totals) ? packet_usec___from_float(double(totals[i]) / n_requests) : 0;
+	};
+
+	p->sample_rate  = n_requests;
+	p->request_time = duration_t { p->request_time.nsec / n_requests };
+	p->ru_utime     = duration_t { p->ru_utime.nsec / n_requests };
+	p->ru_stime     = duration_t { p->ru_stime.nsec / n_requests };
+
+	for (unsigned i = 0; i < p->timer_count; i++)
+	{
+		packed_timer_t *t = &p->timers[i];
+		t->hit_count   = std::max<uint32_t>(1, uint32_t((uint64_t(t->hit_count) + n_requests / 2) / n_requests));
+		t->value_us    = per_request_us(r->timer_value, r->n_timer_value, i);
+		t->ru_utime_us = per_request_us(r->timer_ru_utime, r->n_timer_ru_utime, i);
+		t->ru_stime_us = per_request_us(r->timer_ru_stime, r->n_timer_ru_stime, i);
+	}
+
+	out[0] = p;
+
+	if (r->n_summary_hist_count == 0)
+		return 1;
+
+	uint32_t n_out = 0;
+
+	for (unsigned i = 0; i < r->n_summary_hist_count; i++)
+	{
+		if (r->summary_hist_count[i] == 0)
+			continue;
+
+		packet_t *bucket_p = (n_out == 0) ? p : (packet_t*)nmpa_alloc(nmpa, sizeof(packet_t));
+		if (bucket_p != p)
+			*bucket_p = *p;
+
+		bucket_p->sample_rate  = r->summary_hist_count[i];
+		bucket_p->request_time = packet_usec___to_duration(r->summary_hist_us[i]);
+
+		out[n_out++] = bucket_p;
+	}
+
+	return n_out;
+}
+
 
 template<class SinkT>
 inline SinkT& debug_dump_packet(SinkT& sink, packet_t *packet, dictionary_t *d, struct nmpa_s *nmpa = NULL)
@@ -303,7 +478,7 @@ inline SinkT& debug_dump_packet(SinkT& sink, packet_t *packet, dictionary_t *d,
 	for (unsigned i = 0; i < packet->tag_count; i++)
 	{
 		auto const name_id = packet->tag_name_ids[i];
-		auto const value_id = packet->tag_value_ids[i];
+		auto const value_id = packet->tag_value_ids()[i];
 		ff::fmt(sink, "  tag[{0}]: {{ [{1}] {2} -> {3} [{4}] }\n",
 			i,
 			name_id, d->get_word(name_id),
@@ -315,13 +490,13 @@ inline SinkT& debug_dump_packet(SinkT& sink, packet_t *packet, dictionary_t *d,
 		auto const& tbloom = packet->timers_blooms[i];
 		auto const& t      = packet->timers[i];
 
-		ff::fmt(sink, "  timer[{0}]: {{ h: {1}, v: {2}, ru_u: {3}, ru_s: {4} }\n", i, t.hit_count, t.value, t.ru_utime, t.ru_stime);
+		ff::fmt(sink, "  timer[{0}]: {{ h: {1}, v: {2}, ru_u: {3}, ru_s: {4} }\n", i, t.hit_count, t.value(), t.ru_utime(), t.ru_stime());
 		ff::fmt(sink, "    bloom: {0}\n", tbloom.to_string());
 
 		for (unsigned j = 0; j < t.tag_count; j++)
 		{
 			auto const name_id = t.tag_name_ids[j];
-			auto const value_id = t.tag_value_ids[j];
+			auto const value_id = t.tag_value_ids()[j];
 
 			ff::fmt(sink, "    [{0}] {1} -> {2} [{3}]\n",
 				name_id, d->get_word(name_id),
@@ -0,0 +1,90 @@
+#ifndef PINBA__PACKET_RELAY_H_
+#define PINBA__PACKET_RELAY_H_
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/packet.h"
+#include "pinba/repacker_dictionary.h"
+
+#include "misc/nmpa.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// repacked packet batches, forwarded from relay-only pinba to aggregator pinba (see repacker_conf_t::relay_upstream)
+// aggregator gets packets that are already validated and repacked, so it just maps words into its own dictionary
+//
+// every message is self-contained (nanomsg PUSH balances and reconnects on its own, so there is no 'connection' to keep state for)
+//   header          packet_relay_header_t
+//   payload         raw_size bytes, lz4 block when PINBA_RELAY_FLAG__LZ4 is set
+//     string table  n_words, n_words x { len, bytes }, every word packets refer to, exactly once; index 0 is the empty word
+//     packets       n_packets x { host, server, script, schema, status, traffic, mem_used, sample_rate
+//                                , request_time, ru_utime, ru_stime (nanoseconds, zigzag)
+//                                , tag_count, timer_count, tag_count x { name, value }
+//                                , timer_count x { hit_count, value_us, ru_utime_us, ru_stime_us, tag_count, tag_count x { name, value } } }
+//
+// everything in payload is varint (see varint.h), words are string table indexes
+// except tag values, those are (index << 1) for words and (value << 1 | 1) for integer values (see dictionary_int_words_t)
+// header ints are in host byte order, relays and aggregators are expected to run on the same arch
+
+#define PINBA_RELAY_MAGIC       0x31524250 // "PBR1"
+#define PINBA_RELAY_VERSION     3  // 2: packet sample_rate, 3: integer tag values
+
+#define PINBA_RELAY_FLAG__LZ4   (1 << 0)
+
+struct packet_relay_header_t
+{
+	uint32_t  magic;
+	uint32_t  version;
+	uint32_t  flags;       // PINBA_RELAY_FLAG__*
+	uint32_t  raw_size;    // payload size, before compression
+	uint32_t  n_packets;
+};
+static_assert(sizeof(packet_relay_header_t) == 20, "packet_relay_header_t must have no padding");
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// one per repacker thread, reuses buffers between batches
+struct packet_relay_encoder_t : private boost::noncopyable
+{
+	explicit packet_relay_encoder_t(dictionary_t const*);
+	~packet_relay_encoder_t();
+
+	// out is replaced, not appended to, packet word ids must be alive (i.e. batch repacker_state is still held)
+	void encode(packet_t const* const *packets, uint32_t n_packets, std::string *out);
+
+private:
+	struct impl_t;
+	std::unique_ptr<impl_t> impl_;
+};
+
+// one per relay receiver thread, words go through thread-local dictionary cache, the same way repacker threads do
+struct packet_relay_decoder_t : private boost::noncopyable
+{
+	explicit packet_relay_decoder_t(repacker_dictionary_t*);
+	~packet_relay_decoder_t();
+
+	// checks header, decompresses payload and reads the string table, words are not looked up yet
+	pinba_error_t open(str_ref message);
+
+	uint32_t packets_left() const;
+
+	// next packet, allocated from nmpa, words are mapped into dictionary on first use within current_wordslice()
+	// returns nullptr when there are no more packets or message is malformed (see error())
+	packet_t* next_packet(struct nmpa_s *nmpa, timer_tagset_interner_t *tagsets);
+
+	pinba_error_t const& error() const;
+
+	// call after repacker_dictionary_t::start_new_wordslice(), so that words are added to the new slice again
+	void forget_words();
+
+private:
+	struct impl_t;
+	std::unique_ptr<impl_t> impl_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__PACKET_RELAY_H_
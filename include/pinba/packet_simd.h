@@ -0,0 +1,179 @@
+#ifndef PINBA__PACKET_SIMD_H_
+#define PINBA__PACKET_SIMD_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
+#include "pinba/packet.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// bulk kernels for timer float arrays (timer_value, timer_ru_utime, timer_ru_stime)
+// used by pinba_validate_request() and pinba_request_to_packet(), requests with hundreds of timers are common
+//
+// floats are classified by their bits, which is the same as std::fpclassify() + std::signbit()
+//   ok       - +0 or positive normal
+//   negative - sign bit set, including -0 (but not nan)
+//   bad      - nan, inf or subnormal, any sign
+// scalar versions are used for array tails and when built without sse4.1
+
+namespace packet_simd { namespace detail {
+
+	constexpr uint32_t const exp_mask      = 0x7F800000; // >= this (without sign) = inf or nan
+	constexpr uint32_t const min_normal    = 0x00800000; // < this (without sign, but not 0) = subnormal
+
+	inline uint32_t float_bits(float const f)
+	{
+		uint32_t b;
+		memcpy(&b, &f, sizeof(b));
+		return b;
+	}
+
+	inline bool is_ok(uint32_t const b)
+	{
+		return (b == 0) || ((b >= min_normal) && (b < exp_mask));
+	}
+
+	inline bool is_bad(uint32_t const b)
+	{
+		uint32_t const abs = b & 0x7FFFFFFF;
+		return (abs >= exp_mask) || ((abs != 0) && (abs < min_normal));
+	}
+
+#if defined(__SSE4_1__)
+	// lanes that are not ok, as signed int32 compares (negative floats are negative ints)
+	inline __m128i not_ok_mask(__m128i const b)
+	{
+		__m128i const is_zero   = _mm_cmpeq_epi32(b, _mm_setzero_si128());
+		__m128i const ge_normal = _mm_cmpgt_epi32(b, _mm_set1_epi32(min_normal - 1));
+		__m128i const lt_exp    = _mm_cmplt_epi32(b, _mm_set1_epi32(exp_mask));
+		__m128i const ok        = _mm_or_si128(is_zero, _mm_and_si128(ge_normal, lt_exp));
+		return _mm_xor_si128(ok, _mm_set1_epi32(-1));
+	}
+
+	inline __m128i bad_mask(__m128i const b)
+	{
+		__m128i const abs    = _mm_and_si128(b, _mm_set1_epi32(0x7FFFFFFF));
+		__m128i const inf    = _mm_cmpgt_epi32(abs, _mm_set1_epi32(exp_mask - 1));
+		__m128i const nz     = _mm_xor_si128(_mm_cmpeq_epi32(abs, _mm_setzero_si128()), _mm_set1_epi32(-1));
+		__m128i const subn   = _mm_and_si128(nz, _mm_cmplt_epi32(abs, _mm_set1_epi32(min_normal)));
+		return _mm_or_si128(inf, subn);
+	}
+#endif
+
+}} // namespace packet_simd { namespace detail {
+
+// index of the first value that is not ok (i.e. bad or negative), n if all are ok
+inline size_t packet_simd___find_not_ok(float const *v, size_t const n)
+{
+	using namespace packet_simd::detail;
+
+	size_t i = 0;
+
+#if defined(__SSE4_1__)
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128i const b = _mm_loadu_si128((__m128i const*)(v + i));
+		int const mask  = _mm_movemask_ps(_mm_castsi128_ps(not_ok_mask(b)));
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+
+	for (; i < n; i++)
+	{
+		if (!is_ok(float_bits(v[i])))
+			return i;
+	}
+
+	return n;
+}
+
+// resets negative values to +0, until the first bad one
+// returns index of the first bad value, n if there are none
+inline size_t packet_simd___zero_negatives_find_bad(float *v, size_t const n)
+{
+	using namespace packet_simd::detail;
+
+	size_t i = 0;
+
+#if defined(__SSE4_1__)
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128i const b = _mm_loadu_si128((__m128i const*)(v + i));
+
+		if (_mm_movemask_ps(_mm_castsi128_ps(bad_mask(b))) != 0)
+			break; // let scalar loop find it, and reset negatives before it
+
+		__m128i const negative = _mm_cmplt_epi32(b, _mm_setzero_si128());
+		_mm_storeu_si128((__m128i*)(v + i), _mm_andnot_si128(negative, b));
+	}
+#endif
+
+	for (; i < n; i++)
+	{
+		uint32_t const b = float_bits(v[i]);
+		if (is_bad(b))
+			return i;
+
+		if (b & 0x80000000)
+			v[i] = 0;
+	}
+
+	return n;
+}
+
+// packet_usec___from_float() for every value, values must have been validated
+inline void packet_simd___usec_from_float(float const *v, size_t const n, uint32_t *result)
+{
+	size_t i = 0;
+
+#if defined(__SSE4_1__)
+	constexpr double const max_value = double(UINT32_MAX) / 1000000;
+
+	__m128d const zero      = _mm_setzero_pd();
+	__m128d const max_v     = _mm_set1_pd(max_value);
+	__m128d const usec      = _mm_set1_pd(1000000);
+	__m128d const bias      = _mm_set1_pd(2147483648.0);  // cvt is signed, shift [0, 2^32) to [-2^31, 2^31)
+	__m128i const bias_i    = _mm_set1_epi32(INT32_MIN);
+
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 const f = _mm_loadu_ps(v + i);
+
+		__m128d const d[2] = { _mm_cvtps_pd(f), _mm_cvtps_pd(_mm_movehl_ps(f, f)) };
+		__m128i       u[2];
+
+		for (unsigned k = 0; k < 2; k++)
+		{
+			// floor, not truncation, as shifted values can be negative, same as uint32_t(d * 1000000) for d > 0
+			__m128d const shifted = _mm_floor_pd(_mm_sub_pd(_mm_mul_pd(d[k], usec), bias));
+			__m128i       r       = _mm_xor_si128(_mm_cvtpd_epi32(shifted), bias_i);
+
+			__m128i const not_positive = _mm_castpd_si128(_mm_cmpngt_pd(d[k], zero)); // !(d > 0)
+			__m128i const saturated    = _mm_castpd_si128(_mm_cmpge_pd(d[k], max_v));
+
+			// 64bit lane masks -> low 2 int32 lanes (cvtpd_epi32 result is there)
+			__m128i const np32  = _mm_shuffle_epi32(not_positive, _MM_SHUFFLE(3, 3, 2, 0));
+			__m128i const sat32 = _mm_shuffle_epi32(saturated, _MM_SHUFFLE(3, 3, 2, 0));
+
+			r = _mm_andnot_si128(np32, r);
+			r = _mm_or_si128(r, sat32);
+			u[k] = r;
+		}
+
+		_mm_storeu_si128((__m128i*)(result + i), _mm_unpacklo_epi64(u[0], u[1]));
+	}
+#endif
+
+	for (; i < n; i++)
+		result[i] = packet_usec___from_float(v[i]);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__PACKET_SIMD_H_
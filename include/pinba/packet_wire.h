@@ -0,0 +1,94 @@
+#ifndef PINBA__PACKET_WIRE_H_
+#define PINBA__PACKET_WIRE_H_
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/packet.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// hand-written decoder for Pinba.Request protobuf wire format (see proto/pinba.proto)
+// that skips Pinba__Request materialization, i.e. no protobuf-c object graph and no per-field allocations
+//
+// decoding is a single pass over wire bytes, that also validates the request
+// and the result can be fed to pinba_request_to_packet() as is, since field names are the same as in Pinba__Request
+//
+// strings reference wire bytes directly, repeated fields are decoded into decoder-owned arrays
+// that are reused between requests (so no allocations in steady state)
+// nested requests (field 18) are skipped, same as pipeline does with them for unpacked requests
+
+struct pinba_wire_request_t
+{
+	str_ref    hostname;
+	str_ref    server_name;
+	str_ref    script_name;
+	str_ref    schema;
+	uint32_t   request_count;
+	uint32_t   document_size;
+	uint32_t   memory_peak;
+	uint32_t   status;
+	uint32_t   memory_footprint;
+	float      request_time;
+	float      ru_utime;
+	float      ru_stime;
+
+	size_t     n_timer_hit_count;
+	uint32_t   *timer_hit_count;
+	size_t     n_timer_value;
+	float      *timer_value;
+	size_t     n_timer_tag_count;
+	uint32_t   *timer_tag_count;
+	size_t     n_timer_tag_name;
+	uint32_t   *timer_tag_name;
+	size_t     n_timer_tag_value;
+	uint32_t   *timer_tag_value;
+	size_t     n_dictionary;
+	str_ref    *dictionary;
+	size_t     n_tag_name;
+	uint32_t   *tag_name;
+	size_t     n_tag_value;
+	uint32_t   *tag_value;
+	size_t     n_timer_ru_utime;
+	float      *timer_ru_utime;
+	size_t     n_timer_ru_stime;
+	float      *timer_ru_stime;
+	uint32_t   summary_count;
+	size_t     n_summary_hist_us;
+	uint32_t   *summary_hist_us;
+	size_t     n_summary_hist_count;
+	uint32_t   *summary_hist_count;
+};
+
+struct pinba_wire_decoder_t : private boost::noncopyable
+{
+	// decode and validate request from wire bytes
+	// on success request() is valid until next decode() call, and as long as wire bytes are alive
+	request_validate_result_t decode(str_ref wire);
+
+	pinba_wire_request_t* request()
+	{
+		return &req_;
+	}
+
+private:
+	pinba_wire_request_t   req_;
+
+	std::vector<uint32_t>  timer_hit_count_;
+	std::vector<float>     timer_value_;
+	std::vector<uint32_t>  timer_tag_count_;
+	std::vector<uint32_t>  timer_tag_name_;
+	std::vector<uint32_t>  timer_tag_value_;
+	std::vector<str_ref>   dictionary_;
+	std::vector<uint32_t>  tag_name_;
+	std::vector<uint32_t>  tag_value_;
+	std::vector<float>     timer_ru_utime_;
+	std::vector<float>     timer_ru_stime_;
+	std::vector<uint32_t>  summary_hist_us_;
+	std::vector<uint32_t>  summary_hist_count_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__PACKET_WIRE_H_
@@ -0,0 +1,167 @@
+#ifndef PINBA__PIPELINE_LATENCY_H_
+#define PINBA__PIPELINE_LATENCY_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "misc/nmpa.h"
+
+#include "pinba/globals.h"
+#include "pinba/histogram.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// how long batches wait between pipeline threads, to see where the lag comes from
+//
+// raw_request_t and packet_batch_t carry monotonic timestamps, every receiving thread records
+// 'now - timestamp' into a recorder of its own (plain hdr histogram, no atomics, no locks)
+// recorders publish what they've got every interval (under a per-recorder lock, once a second),
+// readers merge published histograms, so they always see the last complete interval
+
+#define PINBA_PIPELINE_STAGE__COLLECTOR  0  // raw batch got first datagram -> repacker got the batch (collector batching + queue)
+#define PINBA_PIPELINE_STAGE__REPACKER   1  // packet batch got first packet -> relay got the batch (repacker batching + queue)
+#define PINBA_PIPELINE_STAGE__REPORT     2  // relay got the batch -> report host got it (report input queue)
+#define PINBA_PIPELINE_STAGE__COUNT      3
+
+inline str_ref pipeline_stage___name(int stage)
+{
+	switch (stage)
+	{
+		case PINBA_PIPELINE_STAGE__COLLECTOR: return meow::ref_lit("collector");
+		case PINBA_PIPELINE_STAGE__REPACKER:  return meow::ref_lit("repacker");
+		case PINBA_PIPELINE_STAGE__REPORT:    return meow::ref_lit("report");
+	}
+	return meow::ref_lit("unknown");
+}
+
+struct pipeline_latency_recorder_t : private boost::noncopyable
+{
+	// hdr histogram, with nmpa it allocates from
+	struct histogram_t : private boost::noncopyable
+	{
+		struct nmpa_s    nmpa;
+		hdr_histogram_t  hv;
+		duration_t       max_value;
+
+		histogram_t(histogram_conf_t const& conf)
+			: hv(init_nmpa(&nmpa), conf)
+			, max_value{0}
+		{
+		}
+
+		~histogram_t()
+		{
+			nmpa_free(&nmpa);
+		}
+
+	private:
+
+		static struct nmpa_s* init_nmpa(struct nmpa_s *nmpa)
+		{
+			nmpa_init(nmpa, 1024);
+			return nmpa;
+		}
+	};
+
+public:
+
+	int                     const stage;   // PINBA_PIPELINE_STAGE__*
+	std::string             const source;  // thread or report host name
+	histogram_conf_t const *const hv_conf;
+	duration_t              const interval;
+
+	pipeline_latency_recorder_t(int stage, std::string source, histogram_conf_t const *hv_conf, duration_t interval)
+		: stage(stage)
+		, source(std::move(source))
+		, hv_conf(hv_conf)
+		, interval(interval)
+		, local_(*hv_conf)
+		, next_publish_tv_(os_unix::clock_monotonic_now() + interval)
+		, published_(*hv_conf)
+		, published_tv_{0,0}
+	{
+	}
+
+	// owner thread only (or anything serialized with it)
+	void record(timeval_t now, timeval_t since)
+	{
+		if (now >= next_publish_tv_)
+			this->publish(now);
+
+		duration_t const d = (now > since) ? duration_from_timeval(now - since) : duration_t{0};
+
+		local_.hv.increment(*hv_conf, d);
+		if (d.nsec > local_.max_value.nsec)
+			local_.max_value = d;
+	}
+
+	// merge last published interval into dst (configured with the same hv_conf)
+	// intervals older than 2x interval are ignored, nothing has been recorded since
+	void merge_published_to(histogram_t *dst, timeval_t now) const
+	{
+		std::lock_guard<std::mutex> lk_(mtx_);
+
+		if ((published_tv_ + 2 * interval) < now)
+			return;
+
+		dst->hv.merge_other_with_same_conf(published_.hv, *hv_conf);
+		if (published_.max_value.nsec > dst->max_value.nsec)
+			dst->max_value = published_.max_value;
+	}
+
+private:
+
+	void publish(timeval_t now)
+	{
+		{
+			std::lock_guard<std::mutex> lk_(mtx_);
+
+			published_.hv.reset();
+			published_.hv.merge_other_with_same_conf(local_.hv, *hv_conf);
+			published_.max_value = local_.max_value;
+			published_tv_        = now;
+		}
+
+		local_.hv.reset();
+		local_.max_value = {0};
+		next_publish_tv_ = now + interval;
+	}
+
+private:
+	histogram_t          local_;           // owner thread only
+	timeval_t            next_publish_tv_;
+
+	mutable std::mutex   mtx_;
+	histogram_t          published_;       // under mtx_
+	timeval_t            published_tv_;
+};
+using pipeline_latency_recorder_ptr = std::shared_ptr<pipeline_latency_recorder_t>;
+
+struct pipeline_latency_row_t
+{
+	int          stage;           // PINBA_PIPELINE_STAGE__*
+	std::string  source;          // empty = all sources of this stage
+	uint64_t     count;           // batches over the last interval
+	duration_t   p50;
+	duration_t   p99;
+	duration_t   max;
+};
+
+struct pipeline_latency_t : private boost::noncopyable
+{
+	virtual ~pipeline_latency_t() {}
+
+	// recorder is owned by caller, just drop it when done (any thread)
+	virtual pipeline_latency_recorder_ptr create_recorder(int stage, std::string const& source) = 0;
+
+	// a row per stage (all sources merged), followed by a row per source
+	virtual std::vector<pipeline_latency_row_t> get_rows() = 0;
+};
+using pipeline_latency_ptr = std::unique_ptr<pipeline_latency_t>;
+
+pipeline_latency_ptr create_pipeline_latency(pinba_globals_t*);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__PIPELINE_LATENCY_H_
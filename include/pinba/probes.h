@@ -0,0 +1,45 @@
+#ifndef PINBA__PROBES_H_
+#define PINBA__PROBES_H_
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// USDT (static tracepoints) for perf / bpftrace / systemtap, provider name is 'pinba'
+// built with ./configure --enable-usdt only (needs sys/sdt.h, from systemtap-sdt-dev or similar)
+// a probe is a single nop when nobody is attached, arguments are evaluated though, so keep them cheap
+//
+// probe names are as written, i.e. PINBA_PROBE3(udp_batch_send, ...) is 'usdt:/path/to/libpinba_engine2.so:pinba:udp_batch_send'
+// list them with: `bpftrace -l 'usdt:/path/to/libpinba_engine2.so:pinba:*'`
+//
+// udp_batch_send            (thread_id, request_count, success)  collector sent raw batch to repacker
+// repacker_batch_recv       (thread_id, request_count)           repacker got raw batch
+// repacker_batch_send       (thread_id, packet_count)            repacker sent packet batch to coordinator
+// repacker_packet_invalid   (thread_id, error)                   request failed to decode/validate, can't make a packet from it
+//                                                                error is request_validate_result::type
+// dictionary_insert         (word_id, word_str)                  new word in global dictionary
+// dictionary_remove         (word_id, word_str)                  word freed in global dictionary (last ref gone)
+// report_tick_start         (report_name)                        report host got tick
+// report_tick_end           (report_name, duration_nsec)         tick merged into history
+// snapshot_prepare_start    (report_name, n_ticks)
+// snapshot_prepare_end      (report_name, src_rows, uniq_rows)   src_rows is 0 for filtered merges (not calculated)
+// multi_merge_row           (n_sequences)                        every row merged by pinba::multi_merge(), n_sequences still left
+
+#ifdef PINBA_USDT_ENABLED
+
+#include <sys/sdt.h>
+
+#define PINBA_PROBE0(name)                  DTRACE_PROBE(pinba, name)
+#define PINBA_PROBE1(name, a1)              DTRACE_PROBE1(pinba, name, a1)
+#define PINBA_PROBE2(name, a1, a2)          DTRACE_PROBE2(pinba, name, a1, a2)
+#define PINBA_PROBE3(name, a1, a2, a3)      DTRACE_PROBE3(pinba, name, a1, a2, a3)
+
+#else // PINBA_USDT_ENABLED
+
+#define PINBA_PROBE0(name)                  do {} while (0)
+#define PINBA_PROBE1(name, a1)              do {} while (0)
+#define PINBA_PROBE2(name, a1, a2)          do {} while (0)
+#define PINBA_PROBE3(name, a1, a2, a3)      do {} while (0)
+
+#endif // PINBA_USDT_ENABLED
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__PROBES_H_
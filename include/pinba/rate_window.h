@@ -0,0 +1,82 @@
+#ifndef PINBA__RATE_WINDOW_H_
+#define PINBA__RATE_WINDOW_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <meow/unix/time.hpp>
+
+#include "pinba/limits.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// last few samples of ever-increasing counters, for per-second rates over a short sliding window
+// so that monitoring doesn't need to poll stats at high frequency and calculate deltas itself
+//
+// sampled by some ticker (once a second), not thread safe, protect with the lock of the stats being sampled
+
+template<size_t N>
+struct rate_window_t
+{
+	static constexpr size_t n_counters  = N;
+	static constexpr size_t max_samples = PINBA_LIMIT___RATE_WINDOW_SAMPLES;
+
+	static_assert(max_samples >= 2, "need at least 2 samples to calculate rates");
+
+	struct sample_t
+	{
+		timeval_t  tv;          // monotonic
+		uint64_t   values[N];
+	};
+
+private:
+
+	sample_t  samples_[max_samples];
+	size_t    head_      = 0; // next sample goes here
+	size_t    n_samples_ = 0;
+
+public:
+
+	void add(timeval_t tv, uint64_t const (&values)[N])
+	{
+		sample_t& s = samples_[head_];
+		s.tv = tv;
+		for (size_t i = 0; i < N; i++)
+			s.values[i] = values[i];
+
+		head_ = (head_ + 1) % max_samples;
+		if (n_samples_ < max_samples)
+			n_samples_++;
+	}
+
+	// per second rates between the oldest and the newest sample
+	// returns window length in seconds, 0 - not enough samples yet (rates are zeroes then)
+	double rates(double (&out)[N]) const
+	{
+		for (size_t i = 0; i < N; i++)
+			out[i] = 0;
+
+		if (n_samples_ < 2)
+			return 0;
+
+		sample_t const& newest = samples_[(head_ + max_samples - 1) % max_samples];
+		sample_t const& oldest = samples_[(head_ + max_samples - n_samples_) % max_samples];
+
+		double const window_sec = timeval_to_double(newest.tv - oldest.tv);
+		if (window_sec <= 0)
+			return 0;
+
+		for (size_t i = 0; i < N; i++)
+		{
+			// counters might get reset (i.e. report recreated), no negative rates
+			out[i] = (newest.values[i] >= oldest.values[i])
+					? double(newest.values[i] - oldest.values[i]) / window_sec
+					: 0;
+		}
+
+		return window_sec;
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__RATE_WINDOW_H_
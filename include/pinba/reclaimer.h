@@ -0,0 +1,48 @@
+#ifndef PINBA__RECLAIMER_H_
+#define PINBA__RECLAIMER_H_
+
+#include <memory>
+
+#include <boost/noncopyable.hpp>
+
+#include "pinba/globals.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// deferred destruction of big refcounted things, off report threads (see pinba_options_t::reclaim_thread)
+//
+// history ticks going out of the window free row vectors, histograms, nmpa chunks and their repacker state
+// (and whatever published history version still referenced them), which takes a while for large reports
+// report threads hand those references over here instead, reclaimer thread drops them in batches every few ms
+// words referenced by repacker state drop wordslice refcounts only, dictionary is unref-ed by repacker reaper in bulk, as usual
+//
+// retired object might not be the last reference, that's fine, it's just dropped here then (i.e. select still has it)
+
+struct reclaimer_t : private boost::noncopyable
+{
+	virtual ~reclaimer_t() {}
+
+	// any thread, obj is destroyed in reclaimer thread, never blocks for long (queue lock only)
+	template<class T>
+	void retire(T obj)
+	{
+		this->retire_erased(std::make_shared<T>(std::move(obj)));
+	}
+
+	virtual void retire_erased(std::shared_ptr<void>) = 0;
+};
+using reclaimer_ptr = std::unique_ptr<reclaimer_t>;
+
+// starts reclaimer thread, destroys everything that's left on destruction
+reclaimer_ptr create_reclaimer(pinba_globals_t*);
+
+// destroy obj in reclaimer thread if there is one, right here otherwise
+template<class T>
+inline void pinba_reclaim(pinba_globals_t *globals, T obj)
+{
+	if (reclaimer_t *r = globals->reclaimer())
+		r->retire(std::move(obj));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__RECLAIMER_H_
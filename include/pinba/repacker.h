@@ -1,18 +1,23 @@
 #ifndef PINBA__REPACKER_H_
 #define PINBA__REPACKER_H_
 
+#include <algorithm>
+#include <cstring>
 #include <string>
 
 #include "pinba/globals.h"
-#include "pinba/nmsg_socket.h" // nmsg_message_ex_t
+#include "pinba/packet.h"
+#include "pinba/nmsg_socket.h"
+#include "pinba/nmsg_ring.h"
+#include "pinba/collector.h"   // raw_request_t
+#include "pinba/object_pool.h" // pooled_object_t
+#include "pinba/report.h"      // packet_prefilter_t
 
 #include "misc/nmpa.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-struct packet_t;
-
-struct packet_batch_t : public nmsg_message_ex_t<packet_batch_t>
+struct packet_batch_t : public pooled_object_t<packet_batch_t>
 {
 	struct nmpa_s       nmpa;
 	uint32_t            packet_count;
@@ -20,9 +25,27 @@ struct packet_batch_t : public nmsg_message_ex_t<packet_batch_t>
 
 	repacker_state_ptr  repacker_state; // can be empty
 
+	size_t              max_packets;
+
+	packet_batch_summary_t summary;     // over all packets in batch, see packet_batch_filter_t
+
+	packet_columns_t    *columns;       // in nmpa, built by build_columns(), nullptr if not built
+
+	timer_tagset_interner_t tagsets;    // packed_timer_t::tagset_id for all timers in batch
+
+	// monotonic, see pipeline_latency.h
+	timeval_t           created_tv;     // when the first packet got in (repacker)
+	timeval_t           relayed_tv;     // when coordinator relay got the batch (set before giving it to reports)
+
+	size_t              mem_charged;    // nmpa memory accounted in pinba_stats_t::inflight_mem, see charge_mem()
 
 	packet_batch_t(size_t max_packets, size_t nmpa_block_sz)
 		: packet_count{0}
+		, max_packets{max_packets}
+		, columns{nullptr}
+		, created_tv{0,0}
+		, relayed_tv{0,0}
+		, mem_charged{0}
 	{
 		PINBA_STATS_(objects).n_packet_batches++;
 
@@ -32,10 +55,132 @@ struct packet_batch_t : public nmsg_message_ex_t<packet_batch_t>
 
 	~packet_batch_t()
 	{
+		this->credit_mem();
 		nmpa_free(&nmpa);
 
 		PINBA_STATS_(objects).n_packet_batches--;
 	}
+
+	// object_pool_t support, keep nmpa blocks, but forget everything allocated from them
+	// repacker state is released here, same as it would be on delete
+	void pool_recycle()
+	{
+		repacker_state.reset();
+		summary.reset();
+		columns = nullptr;
+		tagsets.reset();
+		created_tv = {0,0};
+		relayed_tv = {0,0};
+
+		this->credit_mem();
+		nmpa_empty(&nmpa);
+		packet_count = 0;
+		packets = (packet_t**)nmpa_alloc(&nmpa, sizeof(packets[0]) * max_packets);
+	}
+
+	// fresh (or just recycled) batch only, see nmpa_block_sizer_t
+	void set_nmpa_block_size(size_t nmpa_block_sz)
+	{
+		if (nmpa.block_sz == nmpa_block_sz)
+			return;
+
+		assert(packet_count == 0 && mem_charged == 0);
+
+		nmpa_empty(&nmpa);
+		nmpa_set_block_sz(&nmpa, nmpa_block_sz);
+		packets = (packet_t**)nmpa_alloc(&nmpa, sizeof(packets[0]) * max_packets);
+	}
+
+	// fill this->columns from packets, call once, when batch is complete
+	// one sequential pass over freshly repacked (so still in cache) packets, writing to nmpa
+	void build_columns()
+	{
+		assert(columns == nullptr);
+
+		uint32_t const n = packet_count;
+
+		auto const alloc = [this](size_t sz) { return nmpa_alloc(&nmpa, sz); };
+
+		packet_columns_t *c = (packet_columns_t*)alloc(sizeof(*c));
+		c->count        = n;
+		c->host_id      = (uint32_t*)alloc(sizeof(uint32_t) * n);
+		c->server_id    = (uint32_t*)alloc(sizeof(uint32_t) * n);
+		c->script_id    = (uint32_t*)alloc(sizeof(uint32_t) * n);
+		c->schema_id    = (uint32_t*)alloc(sizeof(uint32_t) * n);
+		c->status       = (uint32_t*)alloc(sizeof(uint32_t) * n);
+		c->traffic      = (uint32_t*)alloc(sizeof(uint32_t) * n);
+		c->mem_used     = (uint32_t*)alloc(sizeof(uint32_t) * n);
+		c->sample_rate  = (uint32_t*)alloc(sizeof(uint32_t) * n);
+		c->request_time = (duration_t*)alloc(sizeof(duration_t) * n);
+		c->ru_utime     = (duration_t*)alloc(sizeof(duration_t) * n);
+		c->ru_stime     = (duration_t*)alloc(sizeof(duration_t) * n);
+		c->bloom        = (timertag_bloom_t*)alloc(sizeof(timertag_bloom_t) * n);
+		c->tag_offset   = (uint32_t*)alloc(sizeof(uint32_t) * (n + 1));
+		c->timer_offset = (uint32_t*)alloc(sizeof(uint32_t) * (n + 1));
+
+		uint32_t n_tags = 0, n_timers = 0;
+
+		for (uint32_t i = 0; i < n; i++)
+		{
+			packet_t const *p = packets[i];
+
+			c->host_id[i]      = p->host_id;
+			c->server_id[i]    = p->server_id;
+			c->script_id[i]    = p->script_id;
+			c->schema_id[i]    = p->schema_id;
+			c->status[i]       = p->status;
+			c->traffic[i]      = p->traffic;
+			c->mem_used[i]     = p->mem_used;
+			c->sample_rate[i]  = p->sample_rate;
+			c->request_time[i] = p->request_time;
+			c->ru_utime[i]     = p->ru_utime;
+			c->ru_stime[i]     = p->ru_stime;
+			memcpy(&c->bloom[i], &p->bloom, sizeof(p->bloom)); // noncopyable, but standard layout
+
+			c->tag_offset[i]   = n_tags;
+			c->timer_offset[i] = n_timers;
+			n_tags   += p->tag_count;
+			n_timers += p->timer_count;
+		}
+
+		c->tag_offset[n]   = n_tags;
+		c->timer_offset[n] = n_timers;
+
+		c->tag_name_ids  = (uint32_t*)alloc(sizeof(uint32_t) * n_tags);
+		c->tag_value_ids = (uint32_t*)alloc(sizeof(uint32_t) * n_tags);
+		c->timers        = (packed_timer_t*)alloc(sizeof(packed_timer_t) * n_timers);
+
+		for (uint32_t i = 0; i < n; i++)
+		{
+			packet_t const *p = packets[i];
+
+			std::copy(p->tag_name_ids, p->tag_name_ids + p->tag_count, c->tag_name_ids + c->tag_offset[i]);
+			std::copy(p->tag_value_ids(), p->tag_value_ids() + p->tag_count, c->tag_value_ids + c->tag_offset[i]);
+			std::copy(p->timers, p->timers + p->timer_count, c->timers + c->timer_offset[i]);
+		}
+
+		columns = c;
+	}
+
+	// batch is complete and is about to be sent, memory is in flight until the last report releases it
+	void charge_mem()
+	{
+		assert(mem_charged == 0);
+
+		mem_charged = nmpa_mem_used(&nmpa);
+		PINBA_STATS_(inflight_mem).packet_batches += mem_charged;
+	}
+
+private:
+
+	void credit_mem()
+	{
+		if (mem_charged == 0)
+			return;
+
+		PINBA_STATS_(inflight_mem).packet_batches -= mem_charged;
+		mem_charged = 0;
+	}
 };
 typedef boost::intrusive_ptr<packet_batch_t> packet_batch_ptr;
 
@@ -53,6 +198,41 @@ struct repacker_conf_t
 
 	uint32_t     batch_size;       // max packets in batch
 	duration_t   batch_timeout;    // max delay between batches
+
+	pinba_cpu_list_t cpus;         // run repacker threads on these cpus, empty = anywhere
+	pinba_thread_sched_t sched;    // repacker threads scheduling, see pinba_set_thread_sched()
+
+	nmsg_ring_ptr<raw_request_t>  in_ring;   // read raw requests from here instead of nn_input, if set
+	nmsg_ring_ptr<packet_batch_t> out_ring;  // send batches here instead of nn_output, if set
+
+	uint32_t     dictionary_reap_words; // max dictionary words to reap per poll iteration, 0 = reap all unused at once
+
+	// requests are repacked in windows of this many, dictionary words of a window that are not in thread-local cache
+	// are fetched from global dictionary in one call, i.e. with every dictionary shard locked once, 0 = word by word
+	uint32_t     dictionary_prefetch;
+
+	bool         columnar_batches; // build packet_batch_t::columns for every batch (see report_agg_t::add_batch())
+
+	// adaptive batching, batch_size and batch_timeout become upper bounds, 0 = off (static batch_size and batch_timeout)
+	// every thread measures its packet rate and picks batch size, that fills up in about latency_target / fill_target
+	// and sends batches at least every latency_target, i.e. batches are fill_target full when sent by timer at steady rate
+	// low traffic = small batches sent often, peak traffic = batch_size batches, sent by size
+	duration_t   batch_latency_target;
+	double       batch_fill_target; // (0, 1]
+
+	// relay-only mode, see packet_relay.h
+	// relay_upstream - threads send every batch to this nanomsg endpoint (PUSH, connect) instead of nn_output/out_ring
+	// relay_listen   - an extra thread receives batches from relays on this nanomsg endpoint (PULL, bind)
+	//                  and sends them to nn_output/out_ring, as if they were repacked here
+	std::string  relay_upstream;
+	std::string  relay_listen;
+
+	// sampled requests, see packet_t::sample_rate
+	// sample_rate_tag - request tag with client sample rate (N for 1-in-N), empty = every request stands for itself
+	// ingest_budget   - packets/sec (all threads), over it threads keep 1-in-N requests (N = rate / budget, rounded up)
+	//                   picked by a hash of script name and sequence number, kept ones stand for N requests, 0 = off
+	std::string  sample_rate_tag;
+	uint32_t     ingest_budget;
 };
 
 struct repacker_t : private boost::noncopyable
@@ -60,6 +240,16 @@ struct repacker_t : private boost::noncopyable
 	virtual ~repacker_t() {}
 	virtual void startup() = 0;
 	virtual void shutdown() = 0;
+
+	// drop packets no report is interested in, before repacking them (nullptr = pass all, the default)
+	// can be called from any thread, threads pick new prefilter up on next raw request batch
+	virtual void set_packet_prefilter(packet_prefilter_ptr) = 0;
+
+	// resize repacker thread pool at runtime, relay thread (if any) is not counted
+	// stopped threads repack what's been queued to them and send their batches, their dictionary words are released
+	// by the remaining threads, as reports let go of them
+	virtual pinba_error_t set_thread_count(uint32_t n_threads) = 0;
+	virtual uint32_t      thread_count() const = 0;
 };
 using repacker_ptr = std::unique_ptr<repacker_t>;
 
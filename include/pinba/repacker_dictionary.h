@@ -1,8 +1,11 @@
 #ifndef PINBA__REPACKER_DICTIONARY_H_
 #define PINBA__REPACKER_DICTIONARY_H_
 
+#include <algorithm>
+#include <iterator>
 #include <string>
 #include <deque>
+#include <vector>
 #include <unordered_map>
 
 #include <t1ha/t1ha.h>
@@ -97,11 +100,22 @@ private: // FIXME
 	std::deque<wordslice_ptr>  slices;
 	wordslice_ptr              curr_slice;
 
+	// status code -> word, there are a few dozen distinct statuses, and every packet has one, see get_or_add___status()
+	// transient words are referenced from here, so they're never reaped while cached (that's fine for a few dozen words)
+	struct status_word_t
+	{
+		uint32_t  id;    // 0 = not cached yet
+		word_ptr  word;  // transient words only, nullptr for permanent ones
+	};
+	static constexpr uint32_t const status_cache_size = 1024;
+	std::vector<status_word_t> status_words;
+
 public:
 
 	repacker_dictionary_t(dictionary_t *dict)
 		: d(dict)
 		, curr_slice(meow::make_intrusive<wordslice_t>())
+		, status_words(status_cache_size)
 	{
 	}
 
@@ -116,6 +130,11 @@ public:
 		return d->get_nameword(word);
 	}
 
+	dictionary_t::nameword_t get_nameword(str_ref word, uint64_t word_hash) const
+	{
+		return d->get_nameword(word, word_hash);
+	}
+
 	dictionary_t::nameword_t add_nameword(str_ref word)
 	{
 		return d->add_nameword(word);
@@ -126,7 +145,15 @@ public:
 		if (!word)
 			return 0;
 
-		uint64_t const word_hash = dictionary_word_hasher_t()(word);
+		return this->get_or_add(word, dictionary_word_hasher_t()(word));
+	}
+
+	// same as above, but with precalculated word_hash (must be from dictionary_word_hasher_t)
+	// the same hash is used for local lookup and passed along to global dictionary on miss
+	uint32_t get_or_add(str_ref const word, uint64_t word_hash)
+	{
+		if (!word)
+			return 0;
 
 		// NOTE(antoxa): a hack, to avoid extra hash lookup *on slowpath*
 		//  (and use emplace with precomputed hash, that operator[] does not support)
@@ -149,10 +176,16 @@ public:
 		// 1. maybe (highly-likely) insert the word to global dictionary
 		// 2. insert the newly-acquired word locally (this is where we'd save from having 'it' already computed)
 
-		word_ptr w = [&]() {
-			dictionary_t::word_t const *dict_word = d->get_or_add___ref(word, word_hash);
-			return meow::make_intrusive<word_t>(dict_word->id, str_ref { dict_word->str }, word_hash);
-		}();
+		// new words might be rejected by memory governor, packet gets an empty word then (i.e. falls into the empty key part)
+		// the key we've just inserted references temporary memory, must not stay
+		dictionary_t::word_t const *dict_word = d->get_or_add___ref_if_admitted(word, word_hash);
+		if (!dict_word)
+		{
+			word_to_id.erase(it);
+			return 0;
+		}
+
+		word_ptr w = meow::make_intrusive<word_t>(dict_word->id, dict_word->str(), word_hash);
 
 		// fixup the key to point to long-living (in the global-dictionary) word str now
 		str_ref& key_ref = const_cast<str_ref&>(it->first);
@@ -166,6 +199,115 @@ public:
 		return it->second->id;
 	}
 
+	// packet field value, see dictionary_t::get_or_add___field()
+	// permanent fields skip local cache and wordslices altogether, as global lookups are lock-free for them
+	// and words are never removed, so there is no lifetime to track
+	uint32_t get_or_add___field(uint32_t field_flag, str_ref const word)
+	{
+		if (!word)
+			return 0;
+
+		uint64_t const word_hash = dictionary_word_hasher_t()(word);
+
+		if (d->is_permanent_field(field_flag))
+			return d->get_or_add___field(field_flag, word, word_hash);
+
+		return this->get_or_add(word, word_hash);
+	}
+
+	// same as get_or_add___field(PINBA_PERMANENT_FIELD__STATUS, <status as string>)
+	// but small codes are looked up by number, no formatting or hashing for them
+	uint32_t get_or_add___status(uint32_t status)
+	{
+		if (status < status_words.size())
+		{
+			status_word_t& sw = status_words[status];
+			if (sw.id != 0)
+			{
+				if (sw.word)
+					this->add_to_current_wordslice(sw.word);
+				return sw.id;
+			}
+		}
+
+		meow::format::type_tunnel<uint32_t>::buffer_t buf;
+		str_ref const status_str = meow::format::type_tunnel<uint32_t>::call(status, buf);
+
+		uint32_t const word_id = this->get_or_add___field(PINBA_PERMANENT_FIELD__STATUS, status_str);
+
+		// rejected by memory governor, try again next time
+		if ((word_id == 0) || (status >= status_words.size()))
+			return word_id;
+
+		status_word_t& sw = status_words[status];
+		sw.id = word_id;
+
+		if (!d->is_permanent_field(PINBA_PERMANENT_FIELD__STATUS))
+			sw.word = word_to_id.find(status_str)->second;
+
+		return word_id;
+	}
+
+	// two-phase get_or_add() for many requests at once, see pinba_request_prefetch_words()
+	//  1. prefetch() every word requests are going to need, local misses are remembered
+	//  2. prefetch_commit() brings all of them from global dictionary in one go (see dictionary_t::get_or_add_words___ref_if_admitted())
+	//  3. get_or_add() as usual, all local hits now
+	// words must stay alive until prefetch_commit(), nothing but prefetch() is allowed in between
+	void prefetch(str_ref const word, uint64_t word_hash)
+	{
+		if (!word)
+			return;
+
+		// same placeholder trick as in get_or_add(), key is fixed up (or erased) by prefetch_commit()
+		// placeholder also makes duplicates a local hit
+		auto inserted_pair = word_to_id.emplace_hash(word_hash, word, word_ptr{nullptr});
+		if (!inserted_pair.second)
+			return;
+
+		prefetch_words.push_back(dictionary_t::word_request_t { .word = word, .hash = word_hash, .result = nullptr });
+	}
+
+	void prefetch___field(uint32_t field_flag, str_ref const word)
+	{
+		if (!word || d->is_permanent_field(field_flag))
+			return;
+
+		this->prefetch(word, dictionary_word_hasher_t()(word));
+	}
+
+	void prefetch_commit()
+	{
+		if (prefetch_words.empty())
+			return;
+
+		d->get_or_add_words___ref_if_admitted(prefetch_words.data(), prefetch_words.size());
+
+		for (auto const& wr : prefetch_words)
+		{
+			auto it = word_to_id.find(wr.word, wr.hash);
+			assert((it != word_to_id.end()) && !it->second);
+
+			// rejected by memory governor, get_or_add() is going to try again (and most likely give 0)
+			if (!wr.result)
+			{
+				word_to_id.erase(it);
+				continue;
+			}
+
+			word_ptr w = meow::make_intrusive<word_t>(wr.result->id, wr.result->str(), wr.hash);
+
+			str_ref& key_ref = const_cast<str_ref&>(it->first);
+			key_ref = w->get_word_str_ref();
+
+			it.value() = w;
+
+			// right away, not to leak the word if no packet ends up using it
+			this->add_to_current_wordslice(it.value());
+		}
+
+		prefetch_words.clear();
+	}
+
 	void add_to_current_wordslice(word_ptr& wp)
 	{
 		if (wp->in_wordslice)
@@ -199,6 +341,51 @@ public:
 		curr_slice = meow::make_intrusive<wordslice_t>();
 	}
 
+	// this cache is not going to be used for lookups anymore (its thread is gone, see repacker_t::set_thread_count())
+	// every word goes to one last wordslice, so that reaping releases all words eventually (see empty())
+	// even the ones, whose wordslices have been reaped already, but were kept by status cache
+	void retire()
+	{
+		status_words.clear();
+
+		this->start_new_wordslice();
+
+		for (auto it = word_to_id.begin(); it != word_to_id.end(); ++it)
+			this->add_to_current_wordslice(it.value());
+
+		this->start_new_wordslice();
+	}
+
+	// all words have been released, after retire() and reap_unused_wordslices() calls
+	bool empty() const
+	{
+		return word_to_id.empty() && slices.empty() && reaping_slices.empty();
+	}
+
+	// rough estimate of memory held by this cache (hash, local words
+	// and wordslices referencing them), word strings are owned by global dictionary and not counted here
+	// walks all wordslices, so call it once in a while, not on every packet
+	size_t mem_used() const
+	{
+		// robin_map bucket = value + truncated hash + distance from ideal bucket
+		size_t result = word_to_id.bucket_count() * (sizeof(word_to_id_hash_t::value_type) + sizeof(uint64_t));
+		result += word_to_id.size() * sizeof(word_t);
+		result += status_words.capacity() * sizeof(status_word_t);
+
+		auto const slice_mem = [](wordslice_ptr const& ws)
+		{
+			return sizeof(wordslice_t) + ws->words.size() * sizeof(word_ptr);
+		};
+
+		result += slice_mem(curr_slice);
+		for (auto const& ws : slices)
+			result += slice_mem(ws);
+		for (auto const& ws : reaping_slices)
+			result += slice_mem(ws);
+
+		return result;
+	}
+
 public:
 
 	struct reap_stats_t
@@ -208,89 +395,108 @@ public:
 		uint64_t reaped_words_global;
 	};
 
-	// reaps all wordslices that are only referenced from this object
-	reap_stats_t reap_unused_wordslices()
+	// there are unused wordslices, that previous reap_unused_wordslices() calls didn't get to the end of
+	bool has_unreaped_wordslices() const
+	{
+		return !reaping_slices.empty();
+	}
+
+	// reaps wordslices that are only referenced from this object
+	// at most max_words words are processed per call (0 = no limit), to keep the calling thread responsive
+	// new unused slices are only picked up when all previously found ones are done, see has_unreaped_wordslices()
+	reap_stats_t reap_unused_wordslices(size_t max_words = 0)
 	{
 		reap_stats_t result = {};
 
-		// move all wordslices that are only referenced from `slices' to the end of the range
-		auto const erased_begin = std::partition(slices.begin(), slices.end(), [](wordslice_ptr& ws)
+		if (reaping_slices.empty())
 		{
-			// LOG_DEBUG(PINBA_LOOGGER_, "{0}; ws: {1}, uc: {2}", __func__, ws.get(), ws->use_count());
-			assert(ws->use_count() >= 1); // sanity
-			return (ws->use_count() != 1);
-		});
+			// move all wordslices that are only referenced from `slices' to the end of the range
+			auto const erased_begin = std::partition(slices.begin(), slices.end(), [](wordslice_ptr& ws)
+			{
+				// LOG_DEBUG(PINBA_LOOGGER_, "{0}; ws: {1}, uc: {2}", __func__, ws.get(), ws->use_count());
+				assert(ws->use_count() >= 1); // sanity
+				return (ws->use_count() != 1);
+			});
+
+			// fastpath exit if nothing to do
+			if (erased_begin == slices.end())
+				return result;
+
+			// noone else references these, so they stay unused while we're reaping them bit by bit
+			std::move(erased_begin, slices.end(), std::back_inserter(reaping_slices));
+			slices.erase(erased_begin, slices.end());
+			reaping_offset = 0;
+		}
 
-		// fastpath exit if nothing to do
-		if (erased_begin == slices.end())
-			return result;
+		// ids to erase from upstream dictionary, all at once, to lock every shard once
+		reaping_word_ids.clear();
 
-		// gather the list of words to erase from upstream dictionary
-		auto const words_to_erase = [&]() -> std::deque<word_ptr>
+		size_t words_left = (max_words > 0) ? max_words : SIZE_MAX;
+
+		while (!reaping_slices.empty() && (words_left > 0))
 		{
-			std::deque<word_ptr> words_to_erase;
+			auto& words = reaping_slices.front()->words;
+
+			size_t const n_words = std::min(words.size() - reaping_offset, words_left);
 
-			for (auto wordslice_it = erased_begin; wordslice_it != slices.end(); ++wordslice_it)
+			// check refcounts to all words in this slice
+			// and maybe delete from local dictionary if only this wordslice and local dictionary reference the word
+			// this class is single-threaded, so noone is modifying anything while we're on it
+			for (size_t i = reaping_offset; i < reaping_offset + n_words; i++)
 			{
-				wordslice_ptr& ws = *wordslice_it;
+				word_ptr& w = words[i];
+
+				assert(w->use_count() >= 2); // at least `this->word_to_id` and `w` must reference the word
 
-				result.reaped_slices      += 1;
-				result.reaped_words_local += ws->words.size();
+				// LOG_DEBUG(PINBA_LOOGGER_, "{0}; '{1}' {2} {3}", __func__, w->str, w->id, w->use_count());
 
-				// check refcounts to all words in this slice
-				// and maybe delete from local dictionary if only this wordslice and local dictionary reference the word
-				// this class is single-threaded, so noone is modifying anything while we're on it
-				for(auto& w : ws->words)
+				if (w->use_count() == 2) // can erase, since ONLY `this->word_to_id` and `w` reference the word
 				{
-					assert(w->use_count() >= 2); // at least `this->word_to_id` and `w` must reference the word
-
-					// LOG_DEBUG(PINBA_LOOGGER_, "{0}; '{1}' {2} {3}", __func__, w->str, w->id, w->use_count());
-
-					if (w->use_count() == 2) // can erase, since ONLY `this->word_to_id` and `w` reference the word
-					{
-						result.reaped_words_global += 1;
-
-						// LOG_DEBUG(PINBA_LOOGGER_, "reap_unused_wordslices; erase global '{0}' {1} {2}", w->str, w->id, w->use_count());
-
-						// erase from local hash
-						size_t const erased_count = word_to_id.erase(w->get_word_str_ref(), w->hash);
-						assert(erased_count == 1);
-
-						// save the word for later erase_ref from upstream dictionary
-						assert(w->use_count() == 1);
-						words_to_erase.emplace_back(std::move(w));
-					}
-					else
-					{
-						word_t *wptr = w.get();          // save
-						w.reset();                       // just deref as usual, if no delete is needed
-						assert(wptr->use_count() >= 2);  // some other wordslice must still be holding a ref
-					}
+					result.reaped_words_global += 1;
+
+					// LOG_DEBUG(PINBA_LOOGGER_, "reap_unused_wordslices; erase global '{0}' {1} {2}", w->str, w->id, w->use_count());
+
+					// erase from local hash
+					size_t const erased_count = word_to_id.erase(w->get_word_str_ref(), w->hash);
+					assert(erased_count == 1);
+
+					// local word is freed here, upstream dictionary still has the string it points to
+					assert(w->use_count() == 1);
+					reaping_word_ids.push_back(w->id);
 				}
-			}
 
-			return words_to_erase;
-		}();
+				w.reset(); // just deref as usual, frees the word if it's been erased above
+			}
 
-		// remember to erase wordslice, since we don't need them anymore
-		slices.erase(erased_begin, slices.end());
+			reaping_offset            += n_words;
+			words_left                -= n_words;
+			result.reaped_words_local += n_words;
 
-		// TODO: code from here and on does NOT depend on `this' anymore,
-		//       so it can be run in separate thread to reduce blocking
+			if (reaping_offset == words.size())
+			{
+				result.reaped_slices += 1;
 
-		// now deref in upstream dictionary
-		for (auto const& w : words_to_erase)
-		{
-			// tell global dictionary that we've erased the word
-			// XXX: are we immune to ABA problem here (since word ids are reused by global dictionary!)?
-			//      should be, since `word_id`s are unique in this hash
-			d->erase_word___ref(w->id);
+				reaping_slices.pop_front();
+				reaping_offset = 0;
+			}
 		}
 
-		// here `words_to_erase' is destroyed and all word_ptr's are released, freeing memory
+		// now deref in upstream dictionary
+		// XXX: are we immune to ABA problem here (since word ids are reused by global dictionary!)?
+		//      should be, since `word_id`s are unique in this hash
+		if (!reaping_word_ids.empty())
+			d->erase_words___ref(reaping_word_ids.data(), reaping_word_ids.size());
 
 		return result;
 	}
+
+private:
+
+	std::deque<wordslice_ptr>  reaping_slices;   // unused slices, being reaped incrementally (front one is in progress)
+	size_t                     reaping_offset = 0; // words in reaping_slices.front() that are done already
+	std::vector<uint32_t>      reaping_word_ids; // reused between calls
+
+	std::vector<dictionary_t::word_request_t> prefetch_words; // local misses since last prefetch_commit()
 };
 
 using repacker_dslice_t   = repacker_dictionary_t::wordslice_t;
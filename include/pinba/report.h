@@ -1,13 +1,19 @@
 #ifndef PINBA__REPORT_H_
 #define PINBA__REPORT_H_
 
+#include <algorithm>
 #include <atomic>
+#include <deque>
 #include <mutex>
+#include <vector>
 
 #include <meow/intrusive_ptr.hpp> // ref_counted_t
 
 #include "pinba/globals.h"
+#include "pinba/bloom.h"
+#include "pinba/packet_filter.h"
 #include "pinba/report_key.h"
+#include "pinba/tick_subscription.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -15,6 +21,21 @@
 #define REPORT_KIND__BY_TIMER_DATA    1
 #define REPORT_KIND__BY_PACKET_DATA   2
 
+#define REPORT_HASHTABLE__ROBIN_MAP   0 // tsl::robin_map, default
+#define REPORT_HASHTABLE__SWISS_MAP   1 // swiss_map_t
+
+#define REPORT_TICK_STORAGE__FLAT       0 // history rows as is, default
+#define REPORT_TICK_STORAGE__COMPRESSED 1 // history rows sorted and varint encoded, by_timer reports only
+
+#define REPORT_TOPK_METRIC__REQ_COUNT   0 // default
+#define REPORT_TOPK_METRIC__HIT_COUNT   1
+#define REPORT_TOPK_METRIC__TIME_TOTAL  2
+
+// data columns report doesn't need, aggregators skip them (they read as 0), bits
+#define REPORT_DATA_SKIP__RUSAGE        0x1 // ru_utime, ru_stime
+#define REPORT_DATA_SKIP__TRAFFIC       0x2 // by_request reports only
+#define REPORT_DATA_SKIP__MEM_USED      0x4 // by_request reports only
+
 // #define HISTOGRAM_KIND__HASHTABLE  0
 #define HISTOGRAM_KIND__FLAT       1
 #define HISTOGRAM_KIND__HDR        2
@@ -27,6 +48,7 @@ struct report_info_t
 
 	duration_t  time_window;
 	uint32_t    tick_count;
+	uint32_t    agg_threads;  // number of aggregator threads, each produces a tick every tick interval
 
 	uint32_t    n_key_parts;
 
@@ -35,13 +57,88 @@ struct report_info_t
 	uint32_t    hv_bucket_count;
 	duration_t  hv_bucket_d;
 	duration_t  hv_min_value;
+	double      hv_rel_accuracy; // > 0 - log-scale buckets, hv_bucket_count of them, hv_bucket_d is the unit
+	uint32_t    hv_summary_points; // > 0 - history keeps quantile summaries instead of histograms, see flat_histogram___summarize()
+
+	uint32_t    history_partitions;    // > 0 - history ticks keep rows grouped by hash of one key part, see report_conf___by_timer_t
+	uint32_t    history_partition_key; // that key part index
 };
 
-// TODO: a lot of different threads modifying this struct
-//       a lot of false sharding happening
-//       copying is tedious to code (as atomics are non-copyable)
+// TODO: copying is tedious to code (as atomics are non-copyable)
 //       actually there is a memory corruption risk when returning report_state_t and report_snapshot_t
 //        (aka report gets deleted when selecting -> dangling pointers)
+
+// per packet counters, every writer thread gets a block of its own (see report_stats_t::threads)
+template<class T>
+struct report_counters___t
+{
+	T batches_send_total          = {};
+	T batches_send_err            = {};
+	T batches_recv_total          = {};
+
+	T packets_send_total          = {};
+	T packets_send_err            = {};
+	T packets_recv_total          = {};
+
+	T packets_aggregated          = {}; // number of packets that we took useful information from
+	T packets_dropped_by_bloom    = {}; // number of packets dropped by bloom filter
+	T packets_dropped_by_filters  = {}; // number of packets dropped by packet-level filters
+	T packets_dropped_by_rfield   = {}; // number of packets dropped by request_field aggregation
+	T packets_dropped_by_rtag     = {}; // number of packets dropped by request_tag aggregation
+	T packets_dropped_by_timertag = {}; // number of packets dropped by timer_tag aggregation (i.e. no useful timers)
+	T packets_bloom_false_positive = {}; // number of packets that passed bloom, but had no timers with required tags
+
+	T timers_scanned              = {}; // number of timers scanned
+	T timers_aggregated           = {}; // number of timers that we took useful information from
+	T timers_skipped_by_bloom     = {}; // number of timers skipped by timer level bloom
+	T timers_skipped_by_filters   = {}; // number of timers skipped by timertag filters
+	T timers_skipped_by_tags      = {}; // number of timers skipped by not having required tags present
+
+	T rows_evicted                = {}; // number of rows thrown away to keep report size bounded (see report_conf___by_timer_t::topk_size, max_mem)
+	T keys_folded                 = {}; // number of times new key went to overflow row, report was over memory budget
+
+	// pinba_cycles_now() units, spent in this report only, whatever thread (or fused group) did the work
+	T cycles_add                  = {}; // add_multi() / add_batch()
+	T cycles_tick                 = {}; // tick_now()
+	T cycles_merge                = {}; // history merge_tick(), written by whoever runs the merge (one at a time)
+};
+using report_counters_t        = report_counters___t<uint64_t>;
+using report_thread_counters_t = pinba_padded_t<report_counters___t<pinba_counter_t>>;
+
+// counters sampled for report_stats_t::rates
+#define REPORT_STATS_RATE__PACKETS_RECV        0
+#define REPORT_STATS_RATE__PACKETS_SEND_ERR    1
+#define REPORT_STATS_RATE__PACKETS_AGGREGATED  2
+#define REPORT_STATS_RATE__TIMERS_SCANNED      3
+#define REPORT_STATS_RATE__TIMERS_AGGREGATED   4
+#define REPORT_STATS_RATE__ROWS_EVICTED        5
+#define REPORT_STATS_RATE__RU_UTIME_USEC       6 // report host thread
+#define REPORT_STATS_RATE__RU_STIME_USEC       7
+#define REPORT_STATS_RATE__COUNT               8
+
+struct report_estimates_t
+{
+	uint32_t  row_count = 0;
+	// uint32_t  padding__;
+	uint64_t  mem_used  = 0;
+};
+
+// lock protected part of report_stats_t (and totals over its counter blocks), as of the last report_stats___publish()
+struct report_stats_published_t
+{
+	report_counters_t   counters;
+	report_estimates_t  estimates;             // aggregator + history, see report_live_estimates_t
+
+	timeval_t   last_tick_tv;
+	duration_t  last_tick_prepare_d;
+	duration_t  last_snapshot_merge_d;
+	timeval_t   ru_utime;
+	timeval_t   ru_stime;
+
+	double      rate_window_sec;
+	double      rates[REPORT_STATS_RATE__COUNT]; // REPORT_STATS_RATE__*, per second
+};
+
 struct report_stats_t
 {
 	mutable std::mutex lock;
@@ -49,26 +146,17 @@ struct report_stats_t
 	timeval_t created_tv;
 	timeval_t created_realtime_tv;
 
-	std::atomic<uint64_t> batches_send_total          = {0};
-	std::atomic<uint64_t> batches_send_err            = {0};
-	std::atomic<uint64_t> batches_recv_total          = {0};
+	// batches_send_* and packets_send_*, written by coordinator relay thread only
+	report_thread_counters_t relay;
 
-	std::atomic<uint64_t> packets_send_total          = {0};
-	std::atomic<uint64_t> packets_send_err            = {0};
-	std::atomic<uint64_t> packets_recv_total          = {0};
+	// a block per report thread (host, agg shards, aggregators), use report_stats___counters() to get the totals
+	// created under lock, never shrinks, blocks never move (deque)
+	std::deque<report_thread_counters_t> threads;
 
-	std::atomic<uint64_t> packets_aggregated          = {0}; // number of packets that we took useful information from
-	std::atomic<uint64_t> packets_dropped_by_bloom    = {0}; // number of packets dropped by bloom filter
-	std::atomic<uint64_t> packets_dropped_by_filters  = {0}; // number of packets dropped by packet-level filters
-	std::atomic<uint64_t> packets_dropped_by_rfield   = {0}; // number of packets dropped by request_field aggregation
-	std::atomic<uint64_t> packets_dropped_by_rtag     = {0}; // number of packets dropped by request_tag aggregation
-	std::atomic<uint64_t> packets_dropped_by_timertag = {0}; // number of packets dropped by timer_tag aggregation (i.e. no useful timers)
-
-	std::atomic<uint64_t> timers_scanned              = {0}; // number of timers scanned
-	std::atomic<uint64_t> timers_aggregated           = {0}; // number of timers that we took useful information from
-	std::atomic<uint64_t> timers_skipped_by_bloom     = {0}; // number of timers skipped by timer level bloom
-	std::atomic<uint64_t> timers_skipped_by_filters   = {0}; // number of timers skipped by timertag filters
-	std::atomic<uint64_t> timers_skipped_by_tags      = {0}; // number of timers skipped by not having required tags present
+	// these are updated from select threads, keep them atomic
+	std::atomic<uint64_t> snapshot_cache_hits         = {0}; // number of selects that got already prepared snapshot (no new ticks since it was merged)
+	std::atomic<uint64_t> snapshot_cache_misses       = {0}; // number of selects that had to merge a new snapshot
+	std::atomic<uint64_t> cycles_prepare              = {0}; // snapshot prepare(), pinba_cycles_now() units, see report_counters___t::cycles_*
 
 	timeval_t  last_tick_tv          = {0,0};       // last tick happened at this time
 	duration_t last_tick_prepare_d   = {0};         // how long did last tick processing take
@@ -79,14 +167,153 @@ struct report_stats_t
 
 	timeval_t ru_utime = {0,0};
 	timeval_t ru_stime = {0,0};
+
+	// overload degradation, report host samples batches when it lags behind, see pinba_options_t::report_overload_lag
+	std::atomic<uint32_t> overload_sample_shift    = {0}; // aggregating 1 of (1 << shift) batches, 0 = all of them
+	std::atomic<uint64_t> overload_transitions     = {0}; // times shift has changed
+	std::atomic<uint64_t> overload_batches_skipped = {0}; // batches not aggregated (others were aggregated with scaled counts instead)
+
+	// histograms on demand, see report_conf___by_timer_t::hv_idle_d and report_stats___hv_collect()
+	std::atomic<int64_t>  hv_wanted_ns     = {0};     // monotonic ns, last time a select wanted percentiles, 0 = never
+	std::atomic<int64_t>  hv_resumed_ns    = {0};     // monotonic ns, histograms are warming up for time_window after this
+	std::atomic<bool>     hv_suspended     = {false}; // aggregators don't fill histograms (counters are still there)
+	std::atomic<uint64_t> hv_suspensions   = {0};     // times collection has been suspended
+
+	rate_window_t<REPORT_STATS_RATE__COUNT> rates; // REPORT_STATS_RATE__*, sampled by report host every second, protected by lock
+
+	// stored by report host every second, right after sampling rates, readable from any thread without lock
+	pinba_seqlock_t<report_stats_published_t> published;
 };
 
-struct report_estimates_t
+// new counters block for calling thread to write to, lives as long as stats do
+inline report_thread_counters_t* report_stats___add_thread(report_stats_t *stats)
 {
-	uint32_t  row_count = 0;
-	// uint32_t  padding__;
-	uint64_t  mem_used  = 0;
+	std::lock_guard<std::mutex> lk_(stats->lock);
+
+	stats->threads.emplace_back();
+	return &stats->threads.back();
+}
+
+// totals over relay and all threads, lock must be held
+inline report_counters_t report_stats___counters(report_stats_t const *stats)
+{
+	report_counters_t r;
+
+	auto const add = [&r](report_thread_counters_t const& t)
+	{
+		r.batches_send_total           += t.batches_send_total;
+		r.batches_send_err             += t.batches_send_err;
+		r.batches_recv_total           += t.batches_recv_total;
+		r.packets_send_total           += t.packets_send_total;
+		r.packets_send_err             += t.packets_send_err;
+		r.packets_recv_total           += t.packets_recv_total;
+		r.packets_aggregated           += t.packets_aggregated;
+		r.packets_dropped_by_bloom     += t.packets_dropped_by_bloom;
+		r.packets_dropped_by_filters   += t.packets_dropped_by_filters;
+		r.packets_dropped_by_rfield    += t.packets_dropped_by_rfield;
+		r.packets_dropped_by_rtag      += t.packets_dropped_by_rtag;
+		r.packets_dropped_by_timertag  += t.packets_dropped_by_timertag;
+		r.packets_bloom_false_positive += t.packets_bloom_false_positive;
+		r.timers_scanned               += t.timers_scanned;
+		r.timers_aggregated            += t.timers_aggregated;
+		r.timers_skipped_by_bloom      += t.timers_skipped_by_bloom;
+		r.timers_skipped_by_filters    += t.timers_skipped_by_filters;
+		r.timers_skipped_by_tags       += t.timers_skipped_by_tags;
+		r.rows_evicted                 += t.rows_evicted;
+		r.keys_folded                  += t.keys_folded;
+		r.cycles_add                   += t.cycles_add;
+		r.cycles_tick                  += t.cycles_tick;
+		r.cycles_merge                 += t.cycles_merge;
+	};
+
+	add(stats->relay);
+	for (auto const& t : stats->threads)
+		add(t);
+
+	return r;
+}
+
+// sample counters for report_stats_t::rates, lock must be held
+inline void report_stats___sample_rates(report_stats_t *stats, timeval_t now)
+{
+	auto const counters = report_stats___counters(stats);
+
+	uint64_t values[REPORT_STATS_RATE__COUNT];
+	values[REPORT_STATS_RATE__PACKETS_RECV]       = counters.packets_recv_total;
+	values[REPORT_STATS_RATE__PACKETS_SEND_ERR]   = counters.packets_send_err;
+	values[REPORT_STATS_RATE__PACKETS_AGGREGATED] = counters.packets_aggregated;
+	values[REPORT_STATS_RATE__TIMERS_SCANNED]     = counters.timers_scanned;
+	values[REPORT_STATS_RATE__TIMERS_AGGREGATED]  = counters.timers_aggregated;
+	values[REPORT_STATS_RATE__ROWS_EVICTED]       = counters.rows_evicted;
+	values[REPORT_STATS_RATE__RU_UTIME_USEC]      = uint64_t(duration_from_timeval(stats->ru_utime).nsec / 1000);
+	values[REPORT_STATS_RATE__RU_STIME_USEC]      = uint64_t(duration_from_timeval(stats->ru_stime).nsec / 1000);
+
+	stats->rates.add(now, values);
+}
+
+// copy what's protected by lock to stats->published, report host thread only, lock must be held
+inline void report_stats___publish(report_stats_t *stats, report_estimates_t const& estimates)
+{
+	report_stats_published_t p = {};
+	p.counters              = report_stats___counters(stats);
+	p.estimates             = estimates;
+	p.last_tick_tv          = stats->last_tick_tv;
+	p.last_tick_prepare_d   = stats->last_tick_prepare_d;
+	p.last_snapshot_merge_d = stats->last_snapshot_merge_d;
+	p.ru_utime              = stats->ru_utime;
+	p.ru_stime              = stats->ru_stime;
+	p.rate_window_sec       = stats->rates.rates(p.rates);
+
+	stats->published.store(p);
+}
+
+// aggregators call this on tick, to decide if the next tick gets histograms
+// idle_d == 0 - always, otherwise only if some select wanted percentiles in the last idle_d (report creation counts as one)
+// every aggregator thread of the report gets the same answer, only the first one to see the change updates stats
+inline bool report_stats___hv_collect(report_stats_t *stats, duration_t idle_d, timeval_t now)
+{
+	if (idle_d.nsec <= 0)
+		return true;
+
+	int64_t const now_ns    = duration_from_timeval(now).nsec;
+	int64_t const wanted_ns = std::max(stats->hv_wanted_ns.load(std::memory_order_relaxed), duration_from_timeval(stats->created_tv).nsec);
+
+	bool const collect = (now_ns - wanted_ns) < idle_d.nsec;
+
+	bool was_suspended = collect;
+	if (stats->hv_suspended.compare_exchange_strong(was_suspended, !collect))
+	{
+		if (collect)
+			stats->hv_resumed_ns.store(now_ns, std::memory_order_relaxed);
+		else
+			stats->hv_suspensions.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	return collect;
+}
+
+// report_estimates_t of the latest history version, stored by history on every merge_tick()
+// readable from any thread without stopping report thread, lives as long as its last reader (mysql shares keep it, for optimizer)
+struct report_live_estimates_t
+{
+	std::atomic<uint64_t> row_count = {0};
+	std::atomic<uint64_t> mem_used  = {0};
+
+	void store(report_estimates_t const& e)
+	{
+		row_count.store(e.row_count, std::memory_order_relaxed);
+		mem_used.store(e.mem_used, std::memory_order_relaxed);
+	}
+
+	report_estimates_t load() const
+	{
+		report_estimates_t e;
+		e.row_count = row_count.load(std::memory_order_relaxed);
+		e.mem_used  = mem_used.load(std::memory_order_relaxed);
+		return e;
+	}
 };
+using report_live_estimates_ptr = std::shared_ptr<report_live_estimates_t>;
 
 // FIXME: pointers in this struct must either be ref counted, or copies
 //        since report might be destroyed, while this struct is alive still (in other thread as well)
@@ -96,6 +323,7 @@ struct report_state_t
 	report_info_t        info;
 	report_stats_t       *stats;
 	report_estimates_t   estimates;
+	report_stats_published_t published; // stats->published, estimates are the same as above
 };
 using report_state_ptr = std::unique_ptr<report_state_t>;
 
@@ -105,6 +333,8 @@ struct packet_t;
 struct histogram_conf_t;
 struct dictionary_t;
 struct snapshot_dictionary_t;
+struct report_series_row___by_timer_t;
+struct report_exemplar_row___by_request_t;
 
 
 struct report_snapshot_t
@@ -127,6 +357,25 @@ struct report_snapshot_t
 		uintptr_t dummy___[3];
 	};
 
+	// page of rows, see fetch_rows()
+	struct row_batch_t
+	{
+		std::vector<position_t>    pos;
+		std::vector<report_key_t>  keys;
+		std::vector<void*>         data;
+		std::vector<void*>         histograms; // fetched with histograms only, empty otherwise
+
+		size_t size() const { return pos.size(); }
+
+		void clear()
+		{
+			pos.clear();
+			keys.clear();
+			data.clear();
+			histograms.clear();
+		}
+	};
+
 	virtual ~report_snapshot_t() {}
 
 	// get global snapshot data
@@ -138,6 +387,10 @@ struct report_snapshot_t
 	// histograms configuration
 	virtual histogram_conf_t const* histogram_conf() const = 0;
 
+	// time actually covered by snapshot data, might be less than report_info()->time_window
+	// when report history is not full yet, use this for per second rates
+	virtual duration_t time_window_covered() const = 0;
+
 	// get global dictionary used to translate ids to names, read only
 	virtual dictionary_t const*          dictionary() const = 0;
 	// get local dictionary cache, that can do cached word_id -> word translation
@@ -150,6 +403,22 @@ struct report_snapshot_t
 	virtual void prepare(merge_flags_t flags = 0) = 0;
 	virtual bool is_prepared() const = 0;
 
+	// merge only rows with keys matching the filter, MUST be called before prepare()
+	// rows filtered out still go to totals, so percent fields stay the same as without filter
+	virtual void set_key_filter(report_key_filter_t const&) = 0;
+
+	// streaming alternative to prepare(), for unordered full scans, call on a fresh snapshot (after set_key_filter(), if any)
+	// key space is split into count partitions by key hash (see report_snapshot_partition_t), merged one at a time:
+	// prepare_partition(i, count) frees rows of the partition merged before and merges partition i (count > 1, i < count)
+	// pos_*(), fetch_rows() and row_count() see rows of partition i only, positions taken in other partitions are invalid
+	// peak memory is ~1/count of prepare(), and the first rows are there after 1/count of the merge work
+	// ticks are kept, so partitions can be merged again (i.e. for another scan), totals are over partitions 0 to i
+	// returns false if snapshot can't do that, use prepare() then
+	virtual bool prepare_partition(uint32_t index, uint32_t count, merge_flags_t flags)
+	{
+		return false;
+	}
+
 	// will return 0 if !is_prepared()
 	virtual size_t row_count() const = 0;
 
@@ -162,6 +431,57 @@ struct report_snapshot_t
 	// virtual position_t pos_prev(position_t const&) = 0;
 	virtual bool       pos_equal(position_t const&, position_t const&) const = 0;
 
+	// row with exactly this key, pos_last() if there is none
+	virtual position_t pos_find(report_key_t const&) = 0;
+
+	// up to max_rows rows from *cursor to end, replacing batch contents, cursor is moved past the rows returned
+	// same as get_key() + get_data() (+ get_histogram()) + pos_next() for every row, but it's one virtual call per page
+	// batch vectors are reused, so keep the batch around between calls, returns number of rows fetched, 0 = at end
+	virtual uint32_t fetch_rows(position_t *cursor, position_t const& end, uint32_t max_rows, row_batch_t *batch, bool with_histograms)
+	{
+		batch->clear();
+
+		uint32_t n = 0;
+		for (; (n < max_rows) && !this->pos_equal(*cursor, end); n++, *cursor = this->pos_next(*cursor))
+		{
+			batch->pos.push_back(*cursor);
+			batch->keys.push_back(this->get_key(*cursor));
+			batch->data.push_back(this->get_data(*cursor));
+			if (with_histograms)
+				batch->histograms.push_back(this->get_histogram(*cursor));
+		}
+
+		return n;
+	}
+
+	// split rows into at most n_ranges contiguous ranges, for iterating them in parallel
+	// returns range boundaries, range i is [result[i], result[i + 1]), result.back() is pos_last()
+	// get_key(), get_key_str() and get_data() are safe to call concurrently from different ranges
+	// get_histogram() is not (histograms can be merged lazily, on first access)
+	// default impl walks all positions once, impls override that with something cheaper (i.e. hashtable partitions)
+	virtual std::vector<position_t> pos_split(uint32_t n_ranges)
+	{
+		size_t const n_rows = this->row_count();
+		n_ranges = uint32_t(std::max<size_t>(1, std::min<size_t>(n_ranges, n_rows)));
+
+		std::vector<position_t> result;
+		result.reserve(n_ranges + 1);
+
+		position_t pos = this->pos_first();
+		result.push_back(pos);
+
+		size_t row = 0;
+		for (uint32_t i = 1; i < n_ranges; i++)
+		{
+			for (size_t const range_begin = n_rows * i / n_ranges; row < range_begin; row++)
+				pos = this->pos_next(pos);
+			result.push_back(pos);
+		}
+
+		result.push_back(this->pos_last());
+		return result;
+	}
+
 	// key handling
 	virtual report_key_t     get_key(position_t const&) const = 0;
 	virtual report_key_str_t get_key_str(position_t const&) const = 0;
@@ -174,11 +494,31 @@ struct report_snapshot_t
 	// histograms
 	virtual int   histogram_kind() const = 0;
 	virtual void* get_histogram(position_t const&) = 0;
+
+	// per tick rows of keys matching set_key_filter(), read from history ticks in place, nothing is merged
+	// call instead of prepare(), on a fresh snapshot (shared ones are prepared already), 'timer' reports only
+	virtual pinba_error_t get_series___by_timer(std::vector<report_series_row___by_timer_t>*)
+	{
+		return ff::fmt_err("report kind doesn't support series");
+	}
+
+	// slowest requests of keys matching set_key_filter(), merged from per tick exemplars, slowest first for every key
+	// same as above, call instead of prepare(), 'request' reports with exemplars only
+	virtual pinba_error_t get_exemplars___by_request(std::vector<report_exemplar_row___by_request_t>*)
+	{
+		return ff::fmt_err("report kind doesn't support exemplars");
+	}
 };
 typedef std::unique_ptr<report_snapshot_t> report_snapshot_ptr;
 
 void debug_dump_report_snapshot(FILE*, report_snapshot_t*, str_ref name = {});
 
+// rows of prepared src, re-aggregated by some of its key parts (in given order), i.e. script+server+host -> script
+// for 'rollup' views, mysql gets reduced rows instead of building a temporary table from all of them for GROUP BY
+// 'request' and 'timer' reports only, result is prepared (keeps src alive), histograms are flat and merged on first access
+// distinct_count can't be added up, rolled up rows get the largest one of their source rows
+report_snapshot_ptr report_snapshot___rollup(report_snapshot_ptr src, std::vector<uint32_t> const& key_parts);
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 // a slice of aggregated data over a certain time period
@@ -203,8 +543,19 @@ struct report_agg_t : private boost::noncopyable
 	virtual void add(packet_t*) = 0;
 	virtual void add_multi(packet_t**, uint32_t) = 0;
 
+	// batch with columns (see repacker_conf_t::columnar_batches), columns->*[i] are fields of packets[i]
+	// aggregators that don't scan columns just take packets
+	virtual void add_batch(packet_columns_t const *columns, packet_t **packets)
+	{
+		this->add_multi(packets, columns->count);
+	}
+
 	virtual report_tick_ptr     tick_now(timeval_t curr_tv) = 0;
 	virtual report_estimates_t  get_estimates() = 0;
+
+	// aggregate packets as if their sample_rate was scale times bigger, 1 = as is
+	// report host feeds only every scale-th batch to aggregator when overloaded, see pinba_options_t::report_overload_lag
+	virtual void set_sample_scale(uint32_t scale) = 0;
 };
 using report_agg_ptr = std::shared_ptr<report_agg_t>;
 
@@ -218,6 +569,30 @@ struct report_history_t : private boost::noncopyable
 
 	virtual report_snapshot_ptr get_snapshot() = 0;
 	virtual report_estimates_t  get_estimates() = 0;
+
+	// snapshot of the tick list, published on last merge_tick(), can be called from any thread (while history is alive)
+	// report thread is not stopped for it, unlike get_snapshot()
+	// nullptr = not supported, or nothing suitable has been published, use get_snapshot() in report thread then
+	virtual report_snapshot_ptr get_published_snapshot() { return {}; }
+
+	// save all ticks to history file / restore those on report creation, see report_persist.h
+	// called from report host thread, load only before any tick has been merged
+	// reports that don't support this just start with empty history, as before
+	virtual pinba_error_t persist_save(std::string const& path) { return {}; }
+	virtual pinba_error_t persist_load(std::string const& path) { return {}; }
+
+	// merge tick, received from edge pinba, rows go into the next local tick (see federation.h)
+	// edge side needs nothing from here, reports that support federation send their ticks from merge_tick()
+	virtual pinba_error_t federation_merge(std::string tick_data)
+	{
+		return ff::fmt_err("report kind doesn't support federation");
+	}
+
+	// push every tick merged from now on to subscriber (see tick_subscription.h), called from report host thread
+	virtual pinba_error_t tick_subscribe(report_tick_subscription_ptr)
+	{
+		return ff::fmt_err("report kind doesn't support tick subscriptions");
+	}
 };
 using report_history_ptr = std::shared_ptr<report_history_t>;
 
@@ -231,9 +606,54 @@ struct report_t : private boost::noncopyable
 
 	virtual report_agg_ptr      create_aggregator() = 0;
 	virtual report_history_ptr  create_history() = 0;
+
+	// timer tag names a packet must have for this report to be interested in it (see packet_prefilter_t)
+	// nullptr = any packet might be interesting
+	virtual timertag_bloom_t const* packet_bloom() const { return nullptr; }
+
+	// what every packet must have for this report to use it, relay skips batches that can't match (see packet_batch_summary_t)
+	// nullptr = any batch might be useful
+	virtual packet_batch_filter_t const* batch_filter() const { return nullptr; }
+
+	// reports with equal (non-empty) signatures aggregate packets exactly the same way and only differ in history (time_window, tick_count)
+	// so ticks of one aggregator can be merged into histories of all of them, see report_host___fused_t
+	// empty = never share, also for reports whose history consumes ticks in merge_tick()
+	virtual std::string const& agg_signature() const { static std::string const empty; return empty; }
+
+	// estimates kept up to date by histories of this report, see report_live_estimates_t
+	// nullptr = not supported
+	virtual report_live_estimates_ptr live_estimates() const { return nullptr; }
 };
 using report_ptr = std::shared_ptr<report_t>;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+// repacker-side check, if any active report might be interested in a packet at all
+// built by coordinator from all reports, every time the report set changes
+//
+// packet passes if its bloom contains bloom of at least one report,
+// single union bloom over all reports can't be used here, since packet only needs tags of one report, not all of them
+struct packet_prefilter_t : private boost::noncopyable
+{
+	std::vector<report_ptr>               reports;   // keeps blooms below alive
+	std::vector<timertag_bloom_t const*>  blooms;
+	bool                                  pass_all = false;
+
+	bool pass(timertag_bloom_t const& packet_bloom) const
+	{
+		if (pass_all)
+			return true;
+
+		for (auto const *bloom : blooms)
+		{
+			if (packet_bloom.contains(*bloom))
+				return true;
+		}
+		return false;
+	}
+};
+using packet_prefilter_ptr = std::shared_ptr<packet_prefilter_t const>;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
 #endif // PINBA__REPORT_H_
\ No newline at end of file
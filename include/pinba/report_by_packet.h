@@ -3,10 +3,14 @@
 
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <string>
 
+#include <boost/noncopyable.hpp>
+
 #include "pinba/globals.h"
 #include "pinba/report.h"
+#include "pinba/packet_filter.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -35,18 +39,21 @@ struct report_conf___by_packet_t
 
 	duration_t  time_window;      // total time window this report covers (report host uses this for ticking)
 	uint32_t    tick_count;       // number of timeslices to store
+	uint32_t    agg_threads;      // number of threads aggregating packets, 0 or 1 means report host thread only
 
 	uint32_t    hv_bucket_count;  // number of histogram buckets, each bucket is hv_bucket_d 'wide'
 	duration_t  hv_bucket_d;      // width of each hv_bucket
 	duration_t  hv_min_value;     // lower bound time (upper_bound = min_time + bucket_d*bucket_count)
+	double      hv_rel_accuracy;  // > 0 - log-scale buckets with this relative error, see histogram_conf_t
 
 public: // packet filtering
 
 	using filter_func_t = std::function<bool(packet_t*)>;
 	struct filter_descriptor_t
 	{
-		std::string   name;
-		filter_func_t func;
+		std::string         name;
+		filter_func_t       func;
+		packet_filter_op_t  op;   // same filter for packet_filter_program_t, leave empty to just call func
 	};
 
 	std::vector<filter_descriptor_t> filters;
@@ -60,6 +67,7 @@ public: // packet filtering
 			{
 				return (packet->request_time >= min_time);
 			},
+			.op   = packet_filter_op___min_time(min_time),
 		};
 	}
 
@@ -71,6 +79,7 @@ public: // packet filtering
 			{
 				return (packet->request_time < max_time);
 			},
+			.op   = packet_filter_op___max_time(max_time),
 		};
 	}
 
@@ -82,6 +91,7 @@ public: // packet filtering
 			{
 				return (packet->*field_ptr == value_id);
 			},
+			.op   = packet_filter_op___field_eq(field_ptr, value_id),
 		};
 	}
 
@@ -95,11 +105,43 @@ public: // packet filtering
 				{
 					if (packet->tag_name_ids[i] == name_id)
 					{
-						return (packet->tag_value_ids[i] == value_id);
+						return (packet->tag_value_ids()[i] == value_id);
+					}
+				}
+				return false;
+			},
+			.op   = packet_filter_op___request_tag_eq(name_id, value_id),
+		};
+	}
+
+	static inline filter_descriptor_t make_filter___by_request_field_in(uint32_t packet_t::* field_ptr, packet_filter_word_set_ptr word_set)
+	{
+		return filter_descriptor_t {
+			.name    = ff::fmt_str("by_request_field/{0} in {1}", 0/*FIXME:field_ptr*/, word_set->spec),
+			.func = [=](packet_t *packet) -> bool
+			{
+				return word_set->contains(packet->*field_ptr);
+			},
+			.op   = packet_filter_op___field_in(field_ptr, word_set),
+		};
+	}
+
+	static inline filter_descriptor_t make_filter___by_request_tag_in(uint32_t name_id, packet_filter_word_set_ptr word_set)
+	{
+		return filter_descriptor_t {
+			.name    = ff::fmt_str("by_request_tag/{0} in {1}", name_id, word_set->spec),
+			.func = [=](packet_t *packet) -> bool
+			{
+				for (uint32_t i = 0; i < packet->tag_count; ++i)
+				{
+					if (packet->tag_name_ids[i] == name_id)
+					{
+						return word_set->contains(packet->tag_value_ids()[i]);
 					}
 				}
 				return false;
 			},
+			.op   = packet_filter_op___request_tag_in(name_id, word_set),
 		};
 	}
 
@@ -109,6 +151,29 @@ public: // packet filtering
 
 report_ptr create_report_by_packet(pinba_globals_t*, report_conf___by_packet_t const&);
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// current window totals of a by_packet report, kept up to date by report history on every tick
+// same data as report snapshot would have (minus histograms), but readable from any thread directly,
+// without asking coordinator for a snapshot and merging ticks (think load balancer health checks every second)
+//
+// history is the only writer, fields are atomics under a seqlock, readers never block it (and retry instead)
+
+struct report_live___by_packet_t : private boost::noncopyable
+{
+	virtual ~report_live___by_packet_t() {}
+
+	// time_window_covered - same as report_snapshot_t::time_window_covered()
+	virtual void read(report_row_data___by_packet_t *data, duration_t *time_window_covered) const = 0;
+
+	// single row snapshot over read() results, prepared already, has no histograms
+	// for code that wants report_snapshot_t, it's a small fixed size object, no ticks are held or merged
+	virtual report_snapshot_ptr get_snapshot() const = 0;
+};
+using report_live___by_packet_ptr = std::shared_ptr<report_live___by_packet_t const>;
+
+// nullptr if report is not a by_packet one
+report_live___by_packet_ptr report_by_packet___get_live(report_t*);
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 #endif // PINBA__REPORT_BY_PACKET_H_
\ No newline at end of file
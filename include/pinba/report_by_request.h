@@ -7,12 +7,14 @@
 #include "pinba/globals.h"
 #include "pinba/report.h"
 #include "pinba/packet.h"
+#include "pinba/packet_filter.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 struct report_row_data___by_request_t
 {
 	uint32_t   req_count;
+	uint32_t   distinct_count; // snapshot only, estimated from sketches (or exact), see report_conf___by_request_t::distinct_key
 	duration_t time_total;
 	duration_t ru_utime;
 	duration_t ru_stime;
@@ -26,6 +28,23 @@ struct report_row_data___by_request_t
 	}
 };
 
+// one of the slowest requests of a row, see report_conf___by_request_t::exemplars_count
+struct report_exemplar___by_request_t
+{
+	duration_t  request_time;
+	uint32_t    host_id;     // words
+	uint32_t    server_id;
+	uint32_t    script_id;
+	uint32_t    status;      // not a word
+};
+
+// slowest requests of one key over the whole snapshot window, see report_snapshot_t::get_exemplars___by_request()
+struct report_exemplar_row___by_request_t
+{
+	report_key_t                    key;
+	report_exemplar___by_request_t  exemplar;
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 struct report_conf___by_request_t
@@ -34,18 +53,32 @@ struct report_conf___by_request_t
 
 	duration_t  time_window;      // total time window this report covers (report host uses this for ticking)
 	uint32_t    tick_count;       // number of timeslices to store
+	uint32_t    agg_threads;      // number of threads aggregating packets, 0 or 1 means report host thread only
+	int         hashtable_kind;   // REPORT_HASHTABLE__*, aggregation/history/snapshot hashtables
 
 	uint32_t    hv_bucket_count;  // number of histogram buckets, each bucket is hv_bucket_d 'wide'
 	duration_t  hv_bucket_d;      // width of each hv_bucket
 	duration_t  hv_min_value;     // lower bound time (upper_bound = min_time + bucket_d*bucket_count)
+	double      hv_rel_accuracy;  // > 0 - log-scale buckets with this relative error, see histogram_conf_t
+	int         hv_kind;          // HISTOGRAM_KIND__HDR keeps hdr histograms through history and snapshots, flat otherwise
+
+	// > 0 - history keeps per tick quantile summaries of this many points, instead of full histograms (flat only)
+	// selects merge those instead, a lot cheaper for wide reports, percentiles are off by at most 50/hv_summary_points percentile points
+	// see flat_histogram___summarize()
+	uint32_t    hv_summary_points;
+
+	// > 0 - aggregators stop filling histograms after this long without selects asking for percentiles
+	// and start again on the first tick after one does (counters are always there), see report_stats___hv_collect()
+	duration_t  hv_idle_d;
 
 public: // packet filtering
 
 	using filter_func_t = std::function<bool(packet_t*)>;
 	struct filter_descriptor_t
 	{
-		std::string   name;
-		filter_func_t func;
+		std::string         name;
+		filter_func_t       func;
+		packet_filter_op_t  op;   // same filter for packet_filter_program_t, leave empty to just call func
 	};
 
 	std::vector<filter_descriptor_t> filters;
@@ -59,6 +92,7 @@ public: // packet filtering
 			{
 				return (packet->request_time >= min_time);
 			},
+			.op   = packet_filter_op___min_time(min_time),
 		};
 	}
 
@@ -70,6 +104,7 @@ public: // packet filtering
 			{
 				return (packet->request_time < max_time);
 			},
+			.op   = packet_filter_op___max_time(max_time),
 		};
 	}
 
@@ -81,6 +116,7 @@ public: // packet filtering
 			{
 				return (packet->*field_ptr == value_id);
 			},
+			.op   = packet_filter_op___field_eq(field_ptr, value_id),
 		};
 	}
 
@@ -94,11 +130,43 @@ public: // packet filtering
 				{
 					if (packet->tag_name_ids[i] == name_id)
 					{
-						return (packet->tag_value_ids[i] == value_id);
+						return (packet->tag_value_ids()[i] == value_id);
+					}
+				}
+				return false;
+			},
+			.op   = packet_filter_op___request_tag_eq(name_id, value_id),
+		};
+	}
+
+	static inline filter_descriptor_t make_filter___by_request_field_in(uint32_t packet_t::* field_ptr, packet_filter_word_set_ptr word_set)
+	{
+		return filter_descriptor_t {
+			.name    = ff::fmt_str("by_request_field/{0} in {1}", 0/*FIXME:field_ptr*/, word_set->spec),
+			.func = [=](packet_t *packet) -> bool
+			{
+				return word_set->contains(packet->*field_ptr);
+			},
+			.op   = packet_filter_op___field_in(field_ptr, word_set),
+		};
+	}
+
+	static inline filter_descriptor_t make_filter___by_request_tag_in(uint32_t name_id, packet_filter_word_set_ptr word_set)
+	{
+		return filter_descriptor_t {
+			.name    = ff::fmt_str("by_request_tag/{0} in {1}", name_id, word_set->spec),
+			.func = [=](packet_t *packet) -> bool
+			{
+				for (uint32_t i = 0; i < packet->tag_count; ++i)
+				{
+					if (packet->tag_name_ids[i] == name_id)
+					{
+						return word_set->contains(packet->tag_value_ids()[i]);
 					}
 				}
 				return false;
 			},
+			.op   = packet_filter_op___request_tag_in(name_id, word_set),
 		};
 	}
 
@@ -116,6 +184,8 @@ public: // key fetchers, from packet fields and tags
 	{
 		std::string       name;
 		key_fetch_func_t  fetcher;
+		uint32_t          request_tag_id; // key_descriptor_by_request_tag() only, aggregators find those by packet_t::tagset_id instead of calling fetcher
+		uint32_t packet_t::* request_field; // key_descriptor_by_request_field() only, aggregators load it directly instead of calling fetcher
 	};
 
 	std::vector<key_descriptor_t> keys;
@@ -131,11 +201,13 @@ public: // key fetchers, from packet fields and tags
 				{
 					if (packet->tag_name_ids[i] == tag_name_id)
 					{
-						return { packet->tag_value_ids[i], true };
+						return { packet->tag_value_ids()[i], true };
 					}
 				}
 				return { 0, false };
 			},
+			.request_tag_id = tag_name_id,
+			.request_field  = nullptr,
 		};
 	}
 
@@ -147,8 +219,31 @@ public: // key fetchers, from packet fields and tags
 			{
 				return { packet->*field_ptr, true };
 			},
+			.request_tag_id = 0,
+			.request_field  = field_ptr,
 		};
 	}
+
+public: // distinct counting
+
+	// when fetcher is set - every row gets a hyperloglog sketch of values fetched by it (i.e. unique hosts per script)
+	// packets where the value is not found are still aggregated, but not counted
+	key_descriptor_t distinct_key;
+
+	// count distinct_key values exactly, with word_bitmap_t per row instead of a sketch
+	// values are dictionary word ids, so memory is ~2 bytes per distinct value per row per tick, for bounded-cardinality stuff only
+	bool             distinct_exact;
+
+public: // exemplars
+
+	// keep this many slowest requests (min-heap by request_time) per row per tick, 0 = none
+	// memory is bounded by exemplars_count * rows, snapshots merge them only when asked (get_exemplars___by_request())
+	uint32_t         exemplars_count;
+
+public: // data columns
+
+	// REPORT_DATA_SKIP__* bits, aggregator has an increment variant for every combination, picked once per packet
+	uint32_t         data_skip;
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
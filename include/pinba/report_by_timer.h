@@ -3,9 +3,11 @@
 
 #include <string>
 #include <functional>
+#include <vector>
 
 #include "pinba/globals.h"
 #include "pinba/report.h"
+#include "pinba/packet_filter.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -24,6 +26,15 @@ struct report_row_data___by_timer_t
 	}
 };
 
+// one key over one tick interval (or a few, for rolled up history ticks), see report_snapshot_t::get_series___by_timer()
+struct report_series_row___by_timer_t
+{
+	report_key_t                  key;
+	uint32_t                      tick_ago;    // tick intervals between the end of this row and the latest tick, 0 = latest
+	uint32_t                      tick_width;  // tick intervals covered
+	report_row_data___by_timer_t  data;
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 // RKD = Report Key Descriptor
@@ -37,18 +48,47 @@ struct report_conf___by_timer_t
 
 	duration_t  time_window;      // total time window this report covers (report host uses this for ticking)
 	uint32_t    tick_count;         // number of timeslices to store
+	uint32_t    agg_threads;        // number of threads aggregating packets, 0 or 1 means report host thread only
+	int         hashtable_kind;     // REPORT_HASHTABLE__*, aggregation/history/snapshot hashtables
+	int         tick_storage;       // REPORT_TICK_STORAGE__*, history tick format
+
+	// history keeps older ticks rolled up into coarser ones, see report_history_tiered_ringbuffer_t
+	// i.e. {60, 10} = 1 tick -> 60 ticks -> 600 ticks, empty = all ticks are kept as is
+	std::vector<uint32_t> rollup_factors;
+
+	// keep only ~topk_size heaviest keys (by topk_metric), 0 = keep all keys
+	// ticks keep up to 2*topk_size rows, lightest ones are evicted when a tick grows to 4*topk_size,
+	// so memory is bounded, but whatever evicted keys had is lost (see report_counters___t::rows_evicted)
+	uint32_t    topk_size;
+	int         topk_metric;        // REPORT_TOPK_METRIC__*
+
+	uint32_t    data_skip;          // REPORT_DATA_SKIP__* bits, only RUSAGE makes sense here
+
+	// soft limit on report memory (bytes), 0 = no limit, see report_mem_budget_t
+	// global limit over all reports is pinba_options_t::report_max_mem_total
+	uint64_t    max_mem;
 
 	uint32_t    hv_bucket_count;  // number of histogram buckets, each bucket is hv_bucket_d 'wide'
 	duration_t  hv_bucket_d;      // width of each hv_bucket
 	duration_t  hv_min_value;     // lower bound time (upper_bound = min_time + bucket_d*bucket_count)
+	double      hv_rel_accuracy;  // > 0 - log-scale buckets with this relative error, see histogram_conf_t
+	uint32_t    hv_summary_points; // > 0 - quantile summaries instead of full histograms, see report_conf___by_request_t::hv_summary_points
+	duration_t  hv_idle_d;         // > 0 - histograms on demand only, see report_conf___by_request_t::hv_idle_d
+
+	// > 0 - history ticks keep rows grouped by hash of key part history_partition_key (0 based) into this many partitions
+	// merges filtered by that key part only scan matching partitions, parallel merges split work by partition
+	// flat tick storage only
+	uint32_t    history_partitions;
+	uint32_t    history_partition_key;
 
 public: // packet filters
 
 	using filter_func_t = std::function<bool(packet_t*)>;
 	struct filter_descriptor_t
 	{
-		std::string   name;
-		filter_func_t func;
+		std::string         name;
+		filter_func_t       func;
+		packet_filter_op_t  op;   // same filter for packet_filter_program_t, leave empty to just call func
 	};
 
 	std::vector<filter_descriptor_t> filters;
@@ -63,6 +103,7 @@ public: // packet filters
 			{
 				return (packet->request_time >= min_time);
 			},
+			.op   = packet_filter_op___min_time(min_time),
 		};
 	}
 
@@ -74,6 +115,7 @@ public: // packet filters
 			{
 				return (packet->request_time < max_time);
 			},
+			.op   = packet_filter_op___max_time(max_time),
 		};
 	}
 
@@ -85,6 +127,7 @@ public: // packet filters
 			{
 				return (packet->*field_ptr == value_id);
 			},
+			.op   = packet_filter_op___field_eq(field_ptr, value_id),
 		};
 	}
 
@@ -98,11 +141,43 @@ public: // packet filters
 				{
 					if (packet->tag_name_ids[i] == name_id)
 					{
-						return (packet->tag_value_ids[i] == value_id);
+						return (packet->tag_value_ids()[i] == value_id);
+					}
+				}
+				return false;
+			},
+			.op   = packet_filter_op___request_tag_eq(name_id, value_id),
+		};
+	}
+
+	static inline filter_descriptor_t make_filter___by_request_field_in(uint32_t packet_t::* field_ptr, packet_filter_word_set_ptr word_set)
+	{
+		return filter_descriptor_t {
+			.name    = ff::fmt_str("by_request_field/{0} in {1}", 0/*FIXME:field_ptr*/, word_set->spec),
+			.func = [=](packet_t *packet) -> bool
+			{
+				return word_set->contains(packet->*field_ptr);
+			},
+			.op   = packet_filter_op___field_in(field_ptr, word_set),
+		};
+	}
+
+	static inline filter_descriptor_t make_filter___by_request_tag_in(uint32_t name_id, packet_filter_word_set_ptr word_set)
+	{
+		return filter_descriptor_t {
+			.name    = ff::fmt_str("by_request_tag/{0} in {1}", name_id, word_set->spec),
+			.func = [=](packet_t *packet) -> bool
+			{
+				for (uint32_t i = 0; i < packet->tag_count; ++i)
+				{
+					if (packet->tag_name_ids[i] == name_id)
+					{
+						return word_set->contains(packet->tag_value_ids()[i]);
 					}
 				}
 				return false;
 			},
+			.op   = packet_filter_op___request_tag_in(name_id, word_set),
 		};
 	}
 
@@ -110,9 +185,12 @@ public: // timertag filters
 
 	struct timertag_filter_descriptor_t
 	{
-		std::string name;
-		uint32_t    name_id;
-		uint32_t    value_id;
+		std::string           name;
+		uint32_t              name_id;
+		uint32_t              value_id;
+		std::vector<uint32_t> value_ids; // timer tag value is any of these, when not empty (value_id is then value_ids[0])
+
+		packet_filter_word_set_ptr word_set; // timer tag value is in this set, when set (value_id and value_ids are then unused)
 	};
 
 	std::vector<timertag_filter_descriptor_t> timertag_filters;
@@ -121,9 +199,39 @@ public: // timertag filters
 	static inline timertag_filter_descriptor_t make_timertag_filter(uint32_t name_id, uint32_t value_id)
 	{
 		return timertag_filter_descriptor_t {
-			.name     = ff::fmt_str("timer_tag/{0}={1}", name_id, value_id),
-			.name_id  = name_id,
-			.value_id = value_id,
+			.name      = ff::fmt_str("timer_tag/{0}={1}", name_id, value_id),
+			.name_id   = name_id,
+			.value_id  = value_id,
+			.value_ids = {},
+			.word_set  = {},
+		};
+	}
+
+	// i.e. @group=db|cache, matches timers that have any of these tag values
+	static inline timertag_filter_descriptor_t make_timertag_filter_any(uint32_t name_id, std::vector<uint32_t> const& value_ids)
+	{
+		std::string ids_s;
+		for (uint32_t const id : value_ids)
+			ff::fmt(ids_s, "{0}{1}", (ids_s.empty() ? "" : "|"), id);
+
+		return timertag_filter_descriptor_t {
+			.name      = ff::fmt_str("timer_tag/{0}={1}", name_id, ids_s),
+			.name_id   = name_id,
+			.value_id  = value_ids.at(0),
+			.value_ids = value_ids,
+			.word_set  = {},
+		};
+	}
+
+	// patterns, i.e. @group=db_* or @server=re:^db[0-9]+$
+	static inline timertag_filter_descriptor_t make_timertag_filter_in(uint32_t name_id, packet_filter_word_set_ptr word_set)
+	{
+		return timertag_filter_descriptor_t {
+			.name      = ff::fmt_str("timer_tag/{0} in {1}", name_id, word_set->spec),
+			.name_id   = name_id,
+			.value_id  = 0,
+			.value_ids = {},
+			.word_set  = word_set,
 		};
 	}
 
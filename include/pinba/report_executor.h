@@ -0,0 +1,73 @@
+#ifndef PINBA__REPORT_EXECUTOR_H_
+#define PINBA__REPORT_EXECUTOR_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "pinba/globals.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// fixed number of worker threads running all reports, instead of a thread per report
+// (hundreds of reports = hundreds of mostly idle threads, context switches and cold caches otherwise)
+//
+// every report gets a strand - a queue of tasks (batches, ticks, control requests),
+// tasks of one strand are run in order and never concurrently, so report code can stay single threaded
+// strands with tasks to run are kept in per-worker deques, owner takes from the back (cache is still warm),
+// idle workers steal from the front of others' deques
+//
+// strand runs a few tasks at a time and goes back to the queue, so one busy report can't starve others
+
+struct report_executor_conf_t
+{
+	std::string       name;       // thread name prefix, for debugging
+	uint32_t          n_threads;  // number of worker threads, must be > 0
+	pinba_cpu_list_t  cpus;       // run workers on these cpus, empty = anywhere
+	pinba_thread_sched_t sched;   // workers scheduling, see pinba_set_thread_sched()
+};
+
+struct report_strand_t;
+using report_strand_ptr = std::shared_ptr<report_strand_t>;
+
+struct report_executor_t : private boost::noncopyable
+{
+	using task_t       = std::function<void()>;
+	using timer_func_t = std::function<void(timeval_t)>; // gets monotonic time task has started at
+	using timer_id_t   = uint64_t;
+
+	virtual ~report_executor_t() {}
+
+	virtual uint32_t thread_count() const = 0;
+
+	virtual report_strand_ptr create_strand() = 0;
+
+	// run task after all tasks posted to strand before it, never concurrently with others from the same strand
+	// task must not throw, if it does - std::terminate() gets called
+	virtual void post(report_strand_t*, task_t) = 0;
+
+	// post func to strand every interval, until cancel_timer()
+	// not posted again, while the previous one is still waiting in strand queue (slow strand gets fewer ticks, not a pile of them)
+	virtual timer_id_t add_timer(report_strand_t*, duration_t interval, timer_func_t) = 0;
+
+	// timer is never posted after this returns, already posted task might still run though
+	virtual void cancel_timer(timer_id_t) = 0;
+
+	// stop running strand tasks, waits for the running one to finish (if any)
+	// caller has the strand to itself after this returns, tasks posted meanwhile are queued until resume()
+	// can't be called from within strand tasks
+	virtual void pause(report_strand_t*) = 0;
+	virtual void resume(report_strand_t*) = 0;
+
+	// drop all queued tasks, strand must be paused
+	virtual void clear(report_strand_t*) = 0;
+
+	// cpu time spent running strand tasks (user + system)
+	virtual duration_t cpu_time(report_strand_t const*) const = 0;
+};
+using report_executor_ptr = std::unique_ptr<report_executor_t>;
+
+report_executor_ptr create_report_executor(pinba_globals_t*, report_executor_conf_t const&);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__REPORT_EXECUTOR_H_
@@ -1,7 +1,10 @@
 #ifndef PINBA__REPORT_KEY_H_
 #define PINBA__REPORT_KEY_H_
 
+#include <algorithm>
 #include <cstdint>
+#include <vector>
+
 #include <meow/chunk.hpp>
 #include <meow/str_ref.hpp>
 
@@ -18,6 +21,39 @@ using report_key_str_base_t = meow::chunk<meow::str_ref, N, uint32_t>;
 using report_key_t     = report_key_base_t<PINBA_LIMIT___MAX_KEY_PARTS>;
 using report_key_str_t = report_key_str_base_t<PINBA_LIMIT___MAX_KEY_PARTS>;
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// allowed word_ids for some key parts, simple WHERE conditions on key columns pushed down to snapshot merge
+// key matches when each restricted part is one of its word_ids, other parts match anything
+
+struct report_key_filter_t
+{
+	struct part_t
+	{
+		uint32_t              key_index;
+		std::vector<uint32_t> word_ids;   // sorted, empty = nothing matches
+	};
+
+	std::vector<part_t> parts;
+
+public:
+
+	bool empty() const
+	{
+		return parts.empty();
+	}
+
+	template<class Key>
+	bool matches(Key const& key) const
+	{
+		for (auto const& part : parts)
+		{
+			if (!std::binary_search(part.word_ids.begin(), part.word_ids.end(), key[part.key_index]))
+				return false;
+		}
+		return true;
+	}
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 #endif // PINBA__REPORT_KEY_H_
\ No newline at end of file
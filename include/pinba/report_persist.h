@@ -0,0 +1,127 @@
+#ifndef PINBA__REPORT_PERSIST_H_
+#define PINBA__REPORT_PERSIST_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include <meow/std_unique_ptr.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/histogram.h"
+#include "pinba/report.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// report history file, saved when report goes away, loaded when it's created again
+// so that restarts don't start report time windows from scratch (see pinba_options_t::history_dir)
+// same format carries single ticks from edge to central pinba (see federation.h)
+//
+// file is written to a temporary name, then renamed over, readers mmap() it and go through once
+// all ints are in host byte order (files are not supposed to move between machines)
+//   header          report_persist_header_t
+//   string table    n_words x { word_id:u32, len:u32, bytes }, every word used in keys, exactly once
+//   ticks           n_ticks x { width:u32, n_rows:u32, rows }, oldest first
+//     row           n_key_parts x word_id:u32, n_data_fields x u64
+//                   if hv_enabled: total_count:u32, negative_inf:u32, positive_inf:u32, n_values:u32, n_values x { bucket_id:u32, value:u32 }
+//   checksum        u64, t1ha0 of everything above
+//
+// word ids are from the dictionary of the process that has written the file, reader remaps them into current dictionary
+
+#define PINBA_PERSIST_MAGIC     0x31484250 // "PBH1"
+#define PINBA_PERSIST_VERSION   1
+
+struct report_persist_header_t
+{
+	uint32_t  magic;
+	uint32_t  version;
+	uint32_t  kind;             // REPORT_KIND__*
+	uint32_t  n_key_parts;
+	uint32_t  n_data_fields;
+	uint32_t  hv_enabled;
+	uint32_t  hv_bucket_count;
+	uint32_t  n_words;
+	int64_t   hv_bucket_d;      // nanoseconds
+	int64_t   hv_min_value;     // nanoseconds
+	double    hv_rel_accuracy;
+	uint64_t  signature;        // whatever else must match for rows to make sense, computed by report
+	int64_t   saved_at;         // realtime, nanoseconds
+	int64_t   tick_d;           // nanoseconds, time_window / tick_count
+	uint32_t  agg_threads;
+	uint32_t  n_ticks;
+};
+static_assert(sizeof(report_persist_header_t) == 88, "report_persist_header_t must have no padding");
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// words, remapped from history file into current dictionary, hold a reference to every one of those until destroyed
+// loaded ticks share a single object of this type (as opposed to repacker_state, that is merged per tick)
+struct report_persist_words_t : private boost::noncopyable
+{
+	dictionary_t           *dictionary;
+	std::vector<uint32_t>  word_ids;
+
+	~report_persist_words_t();
+};
+using report_persist_words_ptr = std::shared_ptr<report_persist_words_t>;
+
+// report_history_t::persist_save() calls tick_begin() and row() for every tick, oldest first
+struct report_persist_writer_t : private boost::noncopyable
+{
+	report_persist_writer_t(pinba_globals_t*, report_info_t const&, uint32_t n_data_fields, uint64_t signature);
+	~report_persist_writer_t();
+
+	void tick_begin(uint32_t width, uint32_t n_rows);
+	void row(uint32_t const *key, uint64_t const *data, flat_histogram_t const *hv); // hv is ignored, unless histograms are enabled
+
+	void          write_to_string(std::string *out);  // out is replaced, not appended to
+	pinba_error_t write_to_file(std::string const& path);
+
+private:
+	struct impl_t;
+	std::unique_ptr<impl_t> impl_;
+};
+
+// report_history_t::persist_load() checks header with validate(), then reads all ticks with next_tick() + next_row()
+struct report_persist_reader_t : private boost::noncopyable
+{
+	explicit report_persist_reader_t(pinba_globals_t*);
+	~report_persist_reader_t();
+
+	// maps the file, checks magic, version and checksum, remaps words
+	pinba_error_t open(std::string const& path);
+
+	// same as open(), for data that has come from elsewhere (see federation.h)
+	pinba_error_t open_buffer(std::string data);
+
+	// checks that file has been written by a report that has the same config as the one given
+	pinba_error_t validate(report_info_t const&, uint32_t n_data_fields, uint64_t signature) const;
+
+	report_persist_header_t const& header() const;
+
+	// false when there are no more ticks, or no more rows in current tick (or the file is malformed, see error())
+	bool next_tick(uint32_t *width, uint32_t *n_rows);
+	bool next_row(uint32_t *key, uint64_t *data, flat_histogram_t *hv); // key is remapped, hv can be nullptr to skip
+
+	pinba_error_t const& error() const;
+
+	// holds remapped words, attach to every loaded tick
+	report_persist_words_ptr const& words() const;
+
+private:
+	pinba_error_t parse(uint8_t const *data, size_t size);
+
+private:
+	struct impl_t;
+	std::unique_ptr<impl_t> impl_;
+};
+
+// per report file in history_dir (i.e. extension = ".history"), report name is %-escaped, to be a safe file name
+std::string report_persist___file_path(std::string const& history_dir, str_ref report_name, str_ref extension);
+
+// fine ticks to skip from the start of loaded history (oldest first),
+// so that the window ends at current time, as if we didn't stop at all (time between save and load is lost anyway)
+uint32_t report_persist___ticks_to_skip(report_persist_header_t const&, uint32_t max_ticks, uint32_t covered_ticks);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__REPORT_PERSIST_H_
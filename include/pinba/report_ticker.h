@@ -0,0 +1,52 @@
+#ifndef PINBA__REPORT_TICKER_H_
+#define PINBA__REPORT_TICKER_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "pinba/globals.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// one ticker for all reports, instead of a poller ticker in every report thread
+//
+// subscribers are grouped by tick interval, every group fires at the same aligned moments
+// (multiples of interval on monotonic clock), so ticks of all reports with the same interval line up
+// and the whole group is woken up at once, one timer per distinct interval instead of one per report
+//
+// with stagger, every subscriber gets a fixed phase in [0, stagger) and is called that much after the aligned moment
+// so that hundreds of reports don't all finalize their ticks in the same millisecond
+// tick time passed to func is still the aligned one, i.e. report ticks line up all the same
+//
+// tick funcs are called from ticker thread, with ticker lock held
+// they must be quick (post a message somewhere and return) and must not call back into the ticker
+
+struct report_ticker_conf_t
+{
+	std::string  name;     // thread name
+	duration_t   stagger;  // spread subscriber calls over this much time after aligned tick (capped at interval/2), 0 = all at once
+};
+
+struct report_ticker_t : private boost::noncopyable
+{
+	using tick_func_t       = std::function<void(timeval_t)>; // gets tick time (aligned, monotonic), not the time it's been called at
+	using subscription_id_t = uint64_t;
+
+	virtual ~report_ticker_t() {}
+
+	virtual void startup() = 0;
+	virtual void shutdown() = 0;
+
+	// first tick comes at the next aligned moment, i.e. might be less than interval from now
+	virtual subscription_id_t subscribe(duration_t interval, tick_func_t) = 0;
+
+	// func is never called after this returns
+	virtual void unsubscribe(subscription_id_t) = 0;
+};
+using report_ticker_ptr = std::unique_ptr<report_ticker_t>;
+
+report_ticker_ptr create_report_ticker(pinba_globals_t*, report_ticker_conf_t const&);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__REPORT_TICKER_H_
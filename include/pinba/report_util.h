@@ -1,12 +1,23 @@
 #ifndef PINBA__REPORT_UTIL_H_
 #define PINBA__REPORT_UTIL_H_
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstring>
 #include <limits>
+#include <memory>
+#include <new>
+#include <numeric>
 #include <string>
+#include <type_traits>
 #include <vector>
 #include <utility>
 
 #include <t1ha/t1ha.h>
+#include <tsl/robin_map.h>
 
 #include <meow/stopwatch.hpp>
 #include <meow/format/format_to_string.hpp>
@@ -14,33 +25,65 @@
 #include "misc/nmpa.h"
 
 #include "pinba/globals.h"
+#include "pinba/hash.h"
+#include "pinba/hyperloglog.h"
+#include "pinba/mem_governor.h"
+#include "pinba/probes.h"
 #include "pinba/snapshot_dictionary.h"
+#include "pinba/swiss_map.h"
 #include "pinba/histogram.h"
 #include "pinba/report_key.h"
+#include "pinba/thread_pool.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 template<size_t N>
 using report_key_impl_t = std::array<uint32_t, N>;
 
+// most reports have 1-4 key parts, these keys fit in one or two 64bit words
+// and are hashed with a mix per word, instead of t1ha0() over bytes (see pinba::hash_fixed())
+// high bits matter as well, see report_snapshot_partition_t
 struct report_key_impl___hasher_t
 {
 	template<size_t N>
 	inline size_t operator()(report_key_impl_t<N> const& key) const
 	{
-		return t1ha0(key.data(), key.size() * sizeof(key[0]), 0);
+		return pinba::hash_fixed<sizeof(key)>(key.data());
 	}
 };
 
+// fixed size memcmp, compiles down to one or two 64bit compares for small keys
 struct report_key_impl___equal_t
 {
 	template<size_t N>
 	inline bool operator()(report_key_impl_t<N> const& l, report_key_impl_t<N> const& r) const
 	{
-		return l == r;
+		return 0 == memcmp(l.data(), r.data(), sizeof(l));
 	}
 };
 
+// key -> value hashtable for report aggregation, history and snapshots
+// M::map_t<K, V> must support the tsl::robin_map subset used by reports, see swiss_map_t
+// selected by report_conf___*::hashtable_kind (REPORT_HASHTABLE__*), reports are instantiated for each one
+
+struct report_hashtable___robin_map_t
+{
+	template<class K, class V>
+	using map_t = tsl::robin_map<
+					  K
+					, V
+					, report_key_impl___hasher_t
+					, report_key_impl___equal_t
+					, std::allocator<std::pair<K, V>>
+					, /*StoreHash=*/ true>;
+};
+
+struct report_hashtable___swiss_map_t
+{
+	template<class K, class V>
+	using map_t = swiss_map_t<K, V, report_key_impl___hasher_t, report_key_impl___equal_t, /*StoreHash=*/ true>;
+};
+
 template<size_t N>
 inline report_key_impl_t<N> report_key_impl___make_empty()
 {
@@ -135,6 +178,148 @@ struct nmpa_autofree_t : public nmpa_s
 	}
 };
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// snapshot merge scratch, i.e. per row lists of histograms to merge (see report_snapshot_t::prepare())
+// those used to be std::vector-s, which is one malloc() + free() per row, on every select
+// now it's a bump allocation in an arena that is freed all at once, with data it belongs to
+
+// arena for one snapshot partition (partitions are merged in parallel, so they can't share one, i.e. report_snapshot_ctx_t::nmpa)
+// created on first use, snapshots of reports without histograms never need it
+struct report_snapshot_scratch_t
+{
+	static constexpr size_t const block_size = 64 * 1024;
+
+	mutable std::unique_ptr<nmpa_autofree_t> nmpa_;
+
+	struct nmpa_s* nmpa() const
+	{
+		if (!nmpa_)
+			nmpa_.reset(new nmpa_autofree_t(block_size));
+		return nmpa_.get();
+	}
+
+	uint64_t mem_used() const
+	{
+		return (nmpa_) ? nmpa_mem_used(nmpa_.get()) : 0;
+	}
+};
+
+// list of pointers, storage is in report_snapshot_scratch_t, trivially destructible
+// max size is usually known (pointer per tick at most), pass it as capacity hint and it never grows
+template<class T>
+struct nmpa_ptr_list_t
+{
+	T const   **items_   = nullptr;
+	uint32_t  size_      = 0;
+	uint32_t  capacity_  = 0;
+
+	void push_back(struct nmpa_s *nmpa, size_t capacity_hint, T const *ptr)
+	{
+		if (size_ == capacity_)
+		{
+			uint32_t const new_capacity = std::max<uint32_t>(capacity_ * 2, std::max<size_t>(capacity_hint, 1));
+
+			void *mem = nmpa_realloc(nmpa, items_, capacity_ * sizeof(T const*), new_capacity * sizeof(T const*));
+			if (mem == nullptr)
+				throw std::bad_alloc();
+
+			items_    = static_cast<T const**>(mem);
+			capacity_ = new_capacity;
+		}
+
+		items_[size_++] = ptr;
+	}
+
+	bool     empty() const { return (size_ == 0); }
+	uint32_t size() const  { return size_; }
+
+	// storage stays in the arena, it's reused if pushed to again
+	void clear() { size_ = 0; }
+
+	T const* const* begin() const { return items_; }
+	T const* const* end() const   { return items_ + size_; }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// batched aggregation helpers, for report_agg_t::add_multi() implementations
+
+// packets are processed in chunks of this size, survivors of each pass are kept in on-stack array
+static constexpr uint32_t report_agg___batch_size = 64;
+
+// how far ahead to prefetch, when scanning over packets in a batch
+static constexpr uint32_t report_agg___prefetch_distance = 4;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// soft memory limits of a report (own and total over all reports)
+// shared by report, its aggregators and history, which might live in different threads
+//  - history publishes its memory usage every tick (and adds it to the total)
+//  - aggregators check that plus their own current tick every now and then, and stop creating new keys when over
+//  - history trims older ticks when over
+// other aggregator threads' current ticks are not counted, so it is a soft limit
+//
+// memory governor (see mem_governor.h) needs the total as well, and its last stage stops new keys the same way (but never trims history)
+
+struct report_mem_budget_t : private boost::noncopyable
+{
+	uint64_t               max_mem;             // this report, 0 = no limit
+	uint64_t               max_mem_total;       // all reports, 0 = no limit
+	std::atomic<uint64_t>  *mem_used_total;     // all reports, nullptr if max_mem_total == 0 and there is no governor
+	std::atomic<uint32_t> const *governor_stage; // PINBA_MEM_STAGE__*, nullptr if governor is off
+
+	std::atomic<uint64_t>  history_mem_used = {0};
+
+public:
+
+	report_mem_budget_t(uint64_t max, uint64_t max_total, std::atomic<uint64_t> *used_total, std::atomic<uint32_t> const *gov_stage = nullptr)
+		: max_mem(max)
+		, max_mem_total(max_total)
+		, mem_used_total((max_total > 0 || gov_stage != nullptr) ? used_total : nullptr)
+		, governor_stage(gov_stage)
+	{
+	}
+
+	~report_mem_budget_t()
+	{
+		this->history_mem_update(0);
+	}
+
+	bool is_enabled() const
+	{
+		return (max_mem > 0) || (max_mem_total > 0) || (governor_stage != nullptr);
+	}
+
+	// history thread
+	void history_mem_update(uint64_t mem_used)
+	{
+		uint64_t const prev_mem_used = history_mem_used.exchange(mem_used, std::memory_order_relaxed);
+
+		if (mem_used_total)
+			mem_used_total->fetch_add(mem_used - prev_mem_used, std::memory_order_relaxed); // wraps, when shrinking
+	}
+
+	// aggregator with agg_mem_used in its current tick, or history with 0
+	bool is_over(uint64_t agg_mem_used) const
+	{
+		if ((max_mem > 0) && (history_mem_used.load(std::memory_order_relaxed) + agg_mem_used > max_mem))
+			return true;
+
+		if ((max_mem_total > 0) && (mem_used_total->load(std::memory_order_relaxed) + agg_mem_used > max_mem_total))
+			return true;
+
+		return false;
+	}
+
+	// aggregator, before creating new keys
+	bool is_over_for_new_keys(uint64_t agg_mem_used) const
+	{
+		if (governor_stage && governor_stage->load(std::memory_order_relaxed) >= PINBA_MEM_STAGE__NO_NEW_KEYS)
+			return true;
+
+		return this->is_over(agg_mem_used);
+	}
+};
+using report_mem_budget_ptr = std::shared_ptr<report_mem_budget_t>;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 /*
@@ -144,12 +329,23 @@ struct report_snapshot_traits___example
 	using hashtable_t = ; // result hashtable (that we're going to iterate over)
 	using totals_t    = ; // struct, holding merged report data totals
 
+	// can merge_ticks_into_data() be called in parallel for different partitions of the key space
+	static constexpr bool can_merge_partitioned = ;
+
 	// merge ticks from src_ticks_t to hashtable_t
+	// only rows with part.contains(key_hash) should be merged
+	// ticks must not be modified (i.e. cleared) when part.count > 1, as other partitions still read them
 	static void merge_ticks_into_data(
 			  report_snapshot_ctx_t *snapshot_ctx
 			, src_ticks_t& ticks
 			, hashtable_t& to
-			, report_snapshot_t::merge_flags_t flags);
+			, report_snapshot_t::merge_flags_t flags
+			, report_snapshot_partition_t const& part);
+
+	// unique rows in ticks (see report_unique_rows_estimator_t), 0 = don't know, history estimate is used then
+	static uint32_t estimate_unique_rows(
+		  report_snapshot_ctx_t *snapshot_ctx
+		, src_ticks_t const& ticks);
 
 	// calculate raw report stats
 	static void calculate_raw_stats(
@@ -164,6 +360,7 @@ struct report_snapshot_traits___example
 		, totals_t *totals);
 
 	// get iterator keys/values/histograms at iterator
+	// histograms might be merged (or even gathered from ticks) lazily here, if not requested in merge flags
 	static report_key_t key_at_position(hashtable_t const&, iterator_t const&);
 	static void*        value_at_position(hashtable_t const&, iterator_t const&);
 	static histogram_t* hv_at_position(hashtable_t const&, iterator_t const&);
@@ -175,6 +372,109 @@ struct report_raw_stats_t
 	uint64_t row_count; // total number of rows in all ticks
 };
 
+// a slice of the key space, for parallel snapshot merging
+// partitioning uses high bits of the hash, since hashtables use low bits for bucket selection
+// and we don't want all keys in a partition to end up in 1/count of the buckets
+struct report_snapshot_partition_t
+{
+	uint32_t index;
+	uint32_t count;
+
+	inline bool contains(uint64_t key_hash) const
+	{
+		if (count <= 1)
+			return true;
+
+		return (((key_hash >> 32) * count) >> 32) == index;
+	}
+};
+
+// index of tick rows, sorted by key hash
+// allows finding a single key in a tick without a hashtable,
+// used to gather histograms lazily, only for rows that are actually read from snapshot
+using report_tick_hash_index_t = std::vector<uint32_t>;
+
+// items[i].key_hash must be valid
+template<class Items>
+inline void report_tick_hash_index___build(report_tick_hash_index_t *index, Items const& items)
+{
+	index->resize(items.size());
+	std::iota(index->begin(), index->end(), 0);
+
+	std::sort(index->begin(), index->end(), [&items](uint32_t l, uint32_t r)
+	{
+		return items[l].key_hash < items[r].key_hash;
+	});
+}
+
+// returns offset of the item with given key, or items.size() if not found
+template<class Items, class Key>
+inline size_t report_tick_hash_index___find(report_tick_hash_index_t const& index, Items const& items, uint64_t key_hash, Key const& key)
+{
+	auto it = std::lower_bound(index.begin(), index.end(), key_hash, [&items](uint32_t offset, uint64_t hash)
+	{
+		return items[offset].key_hash < hash;
+	});
+
+	for (; it != index.end() && items[*it].key_hash == key_hash; ++it)
+	{
+		if (items[*it].key == key)
+			return *it;
+	}
+
+	return items.size();
+}
+
+// same, for ticks stored as columns (hashes and keys in separate arrays)
+inline void report_tick_hash_index___build_from_hashes(report_tick_hash_index_t *index, std::vector<uint64_t> const& key_hashes)
+{
+	index->resize(key_hashes.size());
+	std::iota(index->begin(), index->end(), 0);
+
+	std::sort(index->begin(), index->end(), [&key_hashes](uint32_t l, uint32_t r)
+	{
+		return key_hashes[l] < key_hashes[r];
+	});
+}
+
+template<class Keys, class Key>
+inline size_t report_tick_hash_index___find_in_columns(report_tick_hash_index_t const& index, std::vector<uint64_t> const& key_hashes, Keys const& keys, uint64_t key_hash, Key const& key)
+{
+	auto it = std::lower_bound(index.begin(), index.end(), key_hash, [&key_hashes](uint32_t offset, uint64_t hash)
+	{
+		return key_hashes[offset] < hash;
+	});
+
+	for (; it != index.end() && key_hashes[*it] == key_hash; ++it)
+	{
+		if (keys[*it] == key)
+			return *it;
+	}
+
+	return keys.size();
+}
+
+// repacker states of ticks in history, carried along by snapshots for their whole lifetime
+// (prepare() might release ticks, but words of keys read later are still needed)
+// history builds this once per tick, so that a snapshot takes one reference instead of one per tick
+using report_repacker_states_t   = std::vector<repacker_state_ptr>;
+using report_repacker_states_ptr = std::shared_ptr<report_repacker_states_t const>;
+
+template<class Ticks>
+inline report_repacker_states_ptr report_repacker_states___from_ticks(Ticks const& ticks)
+{
+	auto result = std::make_shared<report_repacker_states_t>();
+	result->reserve(ticks.size());
+
+	for (auto const& tick : ticks)
+	{
+		if (tick && tick->repacker_state)
+			result->push_back(tick->repacker_state);
+	}
+
+	return result;
+}
+
 // FIXME: stats pointer in this struct should be refcounted,
 //        since report might get deleted while we're touching snapshot
 struct report_snapshot_ctx_t
@@ -183,14 +483,17 @@ struct report_snapshot_ctx_t
 	report_stats_t      *stats;          // stats that we might want to update
 	report_info_t       rinfo;           // report info, immutable copy taken in ctor
 	report_estimates_t  estimates;       // estimates of row count, etc. immutable copy taken in ctor
+	duration_t          time_window_covered; // time covered by ticks, <= rinfo.time_window, see report_history___covered_time()
 	histogram_conf_t    hv_conf;         // histogram conf, immutable copy taken in ctor
 	nmpa_autofree_t     nmpa;            // snapshot-local nmpa, initialize with nmpa_create() or nmpa_init() or {}
 
 	// extra state we should carry along with ticks
 	// there is no need to merge anything really, just take them along for the lifetime of the snapshot
-	// report usually should not care about these when creating snapshot
-	using repacker_state_v_t = std::vector<repacker_state_ptr>;
-	repacker_state_v_t  repacker_state_v;
+	// history sets it when it has one ready, gathered from ticks in prepare() otherwise
+	report_repacker_states_ptr repacker_states;
+
+	// merge only keys matching this, empty = everything, see report_snapshot_t::set_key_filter()
+	report_key_filter_t key_filter;
 
 	// report_snapshot_ctx_t(pinba_globals_t *g, report_stats_t *st, report_info_t const& ri, histogram_conf_t const& hvcf, struct nmpa_s n)
 	// 	: globals(g)
@@ -223,21 +526,27 @@ struct report_snapshot__impl_t
 	using iterator_t  = typename hashtable_t::iterator;
 	using totals_t    = typename Traits::totals_t;
 
+	// don't bother merging in parallel, if snapshot is expected to be smaller than this
+	static constexpr uint32_t partitioned_merge_min_rows = 64 * 1024;
+
 public: // intentional, internal use only
 
-	hashtable_t            data_;      // real data we iterate over
+	std::vector<hashtable_t> data_;      // real data we iterate over, one hashtable per merge partition
 	src_ticks_t            ticks_;     // ticks we merge our data from (in other thread potentially)
 	snapshot_dictionary_t  snap_d_;    // local snapshot dictionary word_id -> word cache
 	totals_t               totals_;    // totals storage
 	bool                   prepared_;  // has data been prepared?
+	bool                   streamed_;  // prepared with prepare_partition(), data_ has a single partition
 
 public:
 
 	report_snapshot__impl_t(report_snapshot_ctx_t ctx, src_ticks_t const& ticks)
 		: report_snapshot_ctx_t(ctx)
+		, data_(1)
 		, ticks_(ticks)
-		, snap_d_(ctx.globals->dictionary())
+		, snap_d_(ctx.globals->dictionary(), snapshot_dictionary_t::size_hint_for(ctx.estimates.row_count, ctx.rinfo.n_key_parts))
 		, prepared_(false)
+		, streamed_(false)
 	{
 	}
 
@@ -253,6 +562,11 @@ private:
 		return &hv_conf;
 	}
 
+	virtual duration_t time_window_covered() const override
+	{
+		return time_window_covered;
+	}
+
 	virtual dictionary_t const* dictionary() const override
 	{
 		return globals->dictionary();
@@ -263,83 +577,202 @@ private:
 		return &snap_d_;
 	}
 
+	uint32_t merge_partition_count() const
+	{
+		if (!Traits::can_merge_partitioned)
+			return 1;
+
+		if (this->estimates.row_count < partitioned_merge_min_rows)
+			return 1;
+
+		thread_pool_t *pool = globals->snapshot_merge_pool();
+		if (!pool)
+			return 1;
+
+		return pool->thread_count() + 1; // selecting thread does the merge as well
+	}
+
 	virtual void prepare(merge_flags_t flags) override
 	{
 		if (this->is_prepared())
 			return;
 
+		PINBA_PROBE2(snapshot_prepare_start, rinfo.name.c_str(), ticks_.size());
+
 		report_raw_stats_t raw_stats = {};
 
-		if (this->stats)
+		// filtered merge stats would skew row count estimates for everyone else
+		bool const update_stats = (this->stats && this->key_filter.empty());
+
+		if (update_stats)
 		{
 			Traits::calculate_raw_stats(this, ticks_, &raw_stats);
 			this->stats->last_snapshot_src_rows = raw_stats.row_count;
 		}
 
 		// accumulate repacker state
-		this->repacker_state_v.reserve(ticks_.size());
-		for (auto& tick : ticks_)
-		{
-			if (!tick)
-				continue;
+		if (!this->repacker_states)
+			this->repacker_states = report_repacker_states___from_ticks(ticks_);
 
-			this->repacker_state_v.push_back(tick->repacker_state);
-		}
+		// history estimate is a guess from average tick size, this one is within a few percent of real unique rows
+		// merges reserve their hashtables from it, and it decides on partitioning as well
+		if (uint32_t const unique_rows = Traits::estimate_unique_rows(this, ticks_))
+			this->estimates.row_count = unique_rows;
 
 		// merge, measure the time
 		meow::stopwatch_t sw;
 
-		Traits::merge_ticks_into_data(this, ticks_, data_, flags);
+		uint32_t const n_parts = this->merge_partition_count();
+		if (n_parts <= 1)
+		{
+			Traits::merge_ticks_into_data(this, ticks_, data_[0], flags, report_snapshot_partition_t { .index = 0, .count = 1 });
+		}
+		else
+		{
+			data_.resize(n_parts);
+
+			std::vector<thread_pool_t::task_t> tasks;
+			tasks.reserve(n_parts);
+
+			for (uint32_t i = 0; i < n_parts; i++)
+			{
+				tasks.emplace_back([this, i, n_parts, flags]()
+				{
+					report_snapshot_partition_t const part = { .index = i, .count = n_parts };
+					Traits::merge_ticks_into_data(this, ticks_, data_[i], flags, part);
+				});
+			}
+
+			thread_pool___run_and_wait(globals->snapshot_merge_pool(), tasks);
+
+			// partitions can't release ticks themselves, do it here
+			// same rule as in single partition merge, histograms might hold pointers to tick data
+			// or be gathered from ticks lazily
+			if (!rinfo.hv_enabled)
+				ticks_.clear();
+		}
 
 		prepared_ = true;
 
-		if (this->stats)
+		if (update_stats)
 		{
 			this->stats->last_snapshot_merge_d = duration_from_timeval(sw.stamp());
 			this->stats->last_snapshot_uniq_rows = this->row_count();
 		}
 
 		if (flags & merge_flags::with_totals)
-			Traits::calculate_totals(this, data_, &totals_);
+		{
+			for (auto const& part_data : data_)
+				Traits::calculate_totals(this, part_data, &totals_);
+		}
+
+		PINBA_PROBE3(snapshot_prepare_end, rinfo.name.c_str(), raw_stats.row_count, this->row_count());
 
 		// do NOT clear ticks here, as snapshot impl might want to keep ref to it
 		// ticks_.clear();
 	}
 
+	virtual bool prepare_partition(uint32_t index, uint32_t count, merge_flags_t flags) override
+	{
+		if (!Traits::can_merge_partitioned)
+			return false;
+
+		assert((count > 1) && (index < count));
+		assert((!prepared_ || streamed_) && "snapshot is prepared with prepare() already");
+
+		if (!this->repacker_states)
+			this->repacker_states = report_repacker_states___from_ticks(ticks_);
+
+		// once per snapshot, partitions reserve 1/count of it
+		if (!streamed_)
+		{
+			if (uint32_t const unique_rows = Traits::estimate_unique_rows(this, ticks_))
+				this->estimates.row_count = unique_rows;
+
+			streamed_ = true;
+		}
+
+		// free previous partition before merging the next one, that's the whole point
+		data_.clear();
+		data_.resize(1);
+
+		if (index == 0)
+			totals_ = {};
+
+		// count > 1, so ticks are left alone, for next partitions and lazy histograms
+		Traits::merge_ticks_into_data(this, ticks_, data_[0], flags, report_snapshot_partition_t { .index = index, .count = count });
+
+		if (flags & merge_flags::with_totals)
+			Traits::calculate_totals(this, data_[0], &totals_);
+
+		prepared_ = true;
+		return true;
+	}
+
 	virtual bool is_prepared() const override
 	{
 		return prepared_;
 	}
 
+	virtual void set_key_filter(report_key_filter_t const& filter) override
+	{
+		assert(!prepared_ && "key filter must be set before prepare()");
+		this->key_filter = filter;
+	}
+
 	virtual size_t row_count() const override
 	{
-		return data_.size();
+		size_t result = 0;
+		for (auto const& part_data : data_)
+			result += part_data.size();
+		return result;
 	}
 
 private:
 
-	static_assert(sizeof(iterator_t) <= sizeof(position_t), "position_t must be able to hold iterator contents");
+	// position is an iterator + index of partition it's pointing into
+	struct position_impl_t
+	{
+		iterator_t  it;
+		uintptr_t   part;
+	};
+
+	static_assert(sizeof(position_impl_t) <= sizeof(position_t), "position_t must be able to hold iterator + partition contents");
+
+	static inline position_t position_from_iterator(iterator_t const& it, uintptr_t part)
+	{
+		position_t result = {};
+		new (&result) position_impl_t { it, part };
+		return result;
+	}
 
-	static inline position_t const& position_from_iterator(iterator_t const& it)
+	static inline position_impl_t const& impl_from_position(position_t const& pos)
 	{
-		return reinterpret_cast<position_t const&>(it);
+		return reinterpret_cast<position_impl_t const&>(pos);
 	}
 
-	static inline iterator_t const& iterator_from_position(position_t const& pos)
+	// skip to the first element of next non-empty partition, if 'it' is at the end of current one
+	position_t position_normalize(iterator_t it, uintptr_t part)
 	{
-		return reinterpret_cast<iterator_t const&>(pos);
+		while ((it == data_[part].end()) && (part + 1 < data_.size()))
+		{
+			part++;
+			it = data_[part].begin();
+		}
+
+		return position_from_iterator(it, part);
 	}
 
 private:
 
 	virtual position_t pos_first() override
 	{
-		return position_from_iterator(data_.begin());
+		return position_normalize(data_[0].begin(), 0);
 	}
 
 	virtual position_t pos_last() override
 	{
-		return position_from_iterator(data_.end());
+		return position_from_iterator(data_.back().end(), data_.size() - 1);
 	}
 
 	virtual position_t pos_next(position_t const& pos) override
@@ -349,8 +782,8 @@ private:
 				typename std::iterator_traits<iterator_t>::iterator_category>::value,
 			"forward iteration support");
 
-		auto const& it = iterator_from_position(pos);
-		return position_from_iterator(std::next(it));
+		auto const& impl = impl_from_position(pos);
+		return position_normalize(std::next(impl.it), impl.part);
 	}
 
 	// virtual position_t pos_prev(position_t const& pos) override
@@ -366,28 +799,98 @@ private:
 
 	virtual bool pos_equal(position_t const& l_pos, position_t const& r_pos) const override
 	{
-		auto const& l_it = iterator_from_position(l_pos);
-		auto const& r_it = iterator_from_position(r_pos);
-		return (l_it == r_it);
+		auto const& l = impl_from_position(l_pos);
+		auto const& r = impl_from_position(r_pos);
+		return (l.part == r.part) && (l.it == r.it);
+	}
+
+	virtual position_t pos_find(report_key_t const& key) override
+	{
+		// partitions split key space by hash, but key is found with a single lookup in each anyway
+		for (uintptr_t part = 0; part < data_.size(); part++)
+		{
+			auto const it = Traits::find_key(data_[part], key);
+			if (it != data_[part].end())
+				return position_from_iterator(it, part);
+		}
+
+		return this->pos_last();
+	}
+
+	virtual uint32_t fetch_rows(position_t *cursor, position_t const& end, uint32_t max_rows, row_batch_t *batch, bool with_histograms) override
+	{
+		batch->clear();
+
+		position_impl_t       curr    = impl_from_position(*cursor);
+		position_impl_t const end_pos = impl_from_position(end);
+
+		bool const hv_enabled = rinfo.hv_enabled;
+
+		// iterators directly, partitions are switched here, same as position_normalize()
+		uint32_t n = 0;
+		for (; (n < max_rows) && !((curr.part == end_pos.part) && (curr.it == end_pos.it)); n++)
+		{
+			auto& part_data = data_[curr.part];
+
+			batch->pos.push_back(position_from_iterator(curr.it, curr.part));
+			batch->keys.push_back(Traits::key_at_position(part_data, curr.it));
+			batch->data.push_back(Traits::value_at_position(part_data, curr.it));
+			if (with_histograms)
+				batch->histograms.push_back(hv_enabled ? Traits::hv_at_position(part_data, curr.it) : nullptr);
+
+			++curr.it;
+			while ((curr.it == data_[curr.part].end()) && (curr.part + 1 < data_.size()))
+			{
+				curr.part++;
+				curr.it = data_[curr.part].begin();
+			}
+		}
+
+		*cursor = position_from_iterator(curr.it, curr.part);
+		return n;
+	}
+
+	virtual std::vector<position_t> pos_split(uint32_t n_ranges) override
+	{
+		// single hashtable, nothing better than walking it
+		if (data_.size() <= 1)
+			return report_snapshot_t::pos_split(n_ranges);
+
+		// whole partitions per range, partitions are about the same size (split by key hash)
+		uintptr_t const n_parts = data_.size();
+		n_ranges = uint32_t(std::max<uintptr_t>(1, std::min<uintptr_t>(n_ranges, n_parts)));
+
+		std::vector<position_t> result;
+		result.reserve(n_ranges + 1);
+
+		for (uintptr_t i = 0; i < n_ranges; i++)
+		{
+			uintptr_t const part = n_parts * i / n_ranges;
+			result.push_back(position_normalize(data_[part].begin(), part));
+		}
+
+		result.push_back(this->pos_last());
+		return result;
 	}
 
 	virtual report_key_t get_key(position_t const& pos) const override
 	{
-		auto const& it = iterator_from_position(pos);
-		return Traits::key_at_position(data_, it);
+		auto const& impl = impl_from_position(pos);
+		return Traits::key_at_position(data_[impl.part], impl.it);
 	}
 
 	virtual report_key_str_t get_key_str(position_t const& pos) const override
 	{
-		report_key_t k = this->get_key(pos);
+		auto const& impl = impl_from_position(pos);
+		report_key_t const& k = Traits::key_at_position(data_[impl.part], impl.it);
+
+		// global dictionary get_word() is lock free, and unlike snapshot_dictionary() is safe to use from pos_split() ranges
+		// scans should use snapshot_dictionary_t::get_key_words() on fetch_rows() pages though, that caches
+		dictionary_t const *d = this->dictionary();
 
 		report_key_str_t result;
 		for (uint32_t i = 0; i < k.size(); ++i)
-		{
-			str_ref const word = dictionary()->get_word(k[i]);
-			// str_ref const word = snapshot_dictionary()->get_word(k[i]);
-			result.push_back(word);
-		}
+			result.push_back(d->get_word(k[i]));
 		return result;
 	}
 
@@ -398,8 +901,8 @@ private:
 
 	virtual void* get_data(position_t const& pos) override
 	{
-		auto const& it = iterator_from_position(pos);
-		return Traits::value_at_position(data_, it);
+		auto const& impl = impl_from_position(pos);
+		return Traits::value_at_position(data_[impl.part], impl.it);
 	}
 
 	virtual void* get_data_totals() const override
@@ -417,8 +920,8 @@ private:
 		if (!rinfo.hv_enabled)
 			return nullptr;
 
-		auto const& it = iterator_from_position(pos);
-		return Traits::hv_at_position(data_, it);
+		auto const& impl = impl_from_position(pos);
+		return Traits::hv_at_position(data_[impl.part], impl.it);
 	}
 };
 
@@ -502,6 +1005,142 @@ private:
 	tick_ptr      curr_tick_;
 };
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// running sums over ticks currently in history, so that get_estimates() doesn't walk the ring
+// history adds every tick it puts into the ring, and subtracts every one that leaves (eviction, rollup, replacement)
+// ticks are immutable, so whatever was added is exactly what is going to be subtracted
+
+struct report_history_totals_t
+{
+	uint32_t n_ticks  = 0;
+	uint64_t n_rows   = 0; // non-unique, i.e. a key in every tick is counted every time
+	uint64_t mem_used = 0;
+
+	void add(uint64_t rows, uint64_t mem)
+	{
+		n_ticks  += 1;
+		n_rows   += rows;
+		mem_used += mem;
+	}
+
+	void subtract(uint64_t rows, uint64_t mem)
+	{
+		assert(n_ticks > 0 && n_rows >= rows && mem_used >= mem);
+
+		n_ticks  -= 1;
+		n_rows   -= rows;
+		mem_used -= mem;
+	}
+
+	// unique rows estimate, for hashtable reserve in snapshots
+	uint32_t row_count_estimate(report_stats_t const *stats) const
+	{
+		if (n_ticks == 0)
+			return 0;
+
+		// got stats from snapshot merge with exact values, adjust based uniq to total rows ratio
+		if (stats && stats->last_snapshot_src_rows && stats->last_snapshot_uniq_rows)
+		{
+			double const uniq_to_raw_fraction = (double)stats->last_snapshot_uniq_rows / stats->last_snapshot_src_rows;
+			return n_rows * uniq_to_raw_fraction;
+		}
+
+		// no stats from snapshot merge yet,
+		// use average tick size (aka lean low and assume, all values repeat every tick)
+		return (uint32_t)std::ceil((double)n_rows / n_ticks);
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// unique rows over history ticks, so that snapshots reserve their hashtables once (see estimate_unique_rows() in traits)
+// ticks with many rows keep a sketch of their key hashes, built once, when tick is stored in history
+// smaller ticks don't, sketch would be too big compared to the tick itself, their hashes are added at snapshot time
+// 2^12 registers -> 4kb per sketch, standard error ~1.6%
+
+using report_key_sketch_t   = hll_sketch_ex_t<12>;
+using report_key_sketch_ptr = std::unique_ptr<report_key_sketch_t>;
+
+constexpr size_t const report_key_sketch_min_rows = 1024; // rows in tick to get a sketch
+
+// nullptr if there are too few rows to bother, func(i) is key hash of row i
+template<class Function>
+inline report_key_sketch_ptr report_key_sketch___build(size_t n_rows, Function const& key_hash_at)
+{
+	if (n_rows < report_key_sketch_min_rows)
+		return {};
+
+	auto result = meow::make_unique<report_key_sketch_t>();
+	for (size_t i = 0; i < n_rows; i++)
+		result->add_hash(pinba::hash_mix64(key_hash_at(i)));
+
+	return result;
+}
+
+struct report_unique_rows_estimator_t
+{
+	report_key_sketch_t  sketch;
+	bool                 empty = true;
+
+	void add_sketch(report_key_sketch_t const& s)
+	{
+		sketch.merge(s);
+		empty = false;
+	}
+
+	void add_key_hash(uint64_t key_hash)
+	{
+		sketch.add_hash(pinba::hash_mix64(key_hash));
+		empty = false;
+	}
+
+	// with ~3 standard errors of headroom, so that under-guessing (and rehashing at the end of merge) is unlikely
+	uint32_t estimate() const
+	{
+		if (empty)
+			return 0;
+
+		uint64_t const n = sketch.estimate();
+		return uint32_t(std::min<uint64_t>(n + n / 20, UINT32_MAX));
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// immutable version of history tick list, published by report thread on merge_tick()
+// snapshots can be made from it in any thread, without stopping report thread (see report_history_t::get_published_snapshot())
+// ticks are immutable and refcounted, so a version just holds on to the ones that were in history, when it was published
+
+template<class Source>
+struct report_history_version_t
+{
+	Source                      src;                  // what snapshot merges, ringbuffer or report specific source
+	report_estimates_t          estimates;
+	duration_t                  time_window_covered;
+	report_repacker_states_ptr  repacker_states;      // of src ticks
+};
+
+template<class Source>
+struct report_history_publisher_t : private boost::noncopyable
+{
+	using version_t   = report_history_version_t<Source>;
+	using version_ptr = std::shared_ptr<version_t const>;
+
+	// report thread, returns previous version, it's the last one to reference ticks that have just left history
+	// (unless some snapshot has it), hand it to pinba_reclaim() to keep freeing those off report thread
+	version_ptr publish(version_ptr v)
+	{
+		return std::atomic_exchange_explicit(&current_, std::move(v), std::memory_order_acq_rel);
+	}
+
+	// any thread, nullptr until the first publish()
+	version_ptr current() const
+	{
+		return std::atomic_load_explicit(&current_, std::memory_order_acquire);
+	}
+
+private:
+	version_ptr current_;
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 struct report_history_ringbuffer_t : private boost::noncopyable
@@ -534,11 +1173,184 @@ public:
 		return ringbuffer_;
 	}
 
+	// ticks are appended every tick interval (even empty ones), so this is the time covered
+	uint32_t covered_ticks() const
+	{
+		return ringbuffer_.size();
+	}
+
 private:
 	uint32_t      max_ticks_;
 	ringbuffer_t  ringbuffer_;
 };
 
+// history ring, where older ticks are rolled up into coarser ones (as in 60 x 1s -> 1 x 1min -> ...)
+// so that long windows keep and merge a lot less tick objects, at the cost of window edge precision
+//  - tier 0 has the latest (fine) ticks, tier i ticks cover rollup_factors[0] * ... * rollup_factors[i-1] fine ticks
+//  - when tier i has 2 * rollup_factors[i] ticks, oldest rollup_factors[i] of those are merged into a tick of tier i+1
+//  - oldest ticks are evicted while more than max_ticks fine ticks are covered
+//    so the window shrinks by up to one coarsest tick, right after eviction
+// with no rollup factors, this is exactly report_history_ringbuffer_t
+struct report_history_tiered_ringbuffer_t : private boost::noncopyable
+{
+	using ringbuffer_t = std::vector<report_tick_ptr>;
+
+public:
+
+	report_history_tiered_ringbuffer_t(uint32_t max_ticks, std::vector<uint32_t> const& rollup_factors)
+		: max_ticks_(max_ticks)
+		, covered_ticks_(0)
+		, tiers_(rollup_factors.size() + 1)
+	{
+		uint32_t width = 1;
+
+		for (size_t i = 0; i < tiers_.size(); i++)
+		{
+			tiers_[i].width  = width;
+			tiers_[i].factor = (i < rollup_factors.size()) ? rollup_factors[i] : 0;
+
+			width *= tiers_[i].factor;
+		}
+	}
+
+	// rollup(ringbuffer_t const& src) -> report_tick_ptr, must merge src ticks (all from the same tier) into one
+	// returns ticks that fell out of the window (to update running aggregates, etc.)
+	template<class RollupFunction>
+	ringbuffer_t append(report_tick_ptr tick, RollupFunction const& rollup)
+	{
+		tiers_[0].ticks.emplace_back(std::move(tick));
+		covered_ticks_ += 1;
+
+		for (size_t i = 0; (i + 1) < tiers_.size(); i++)
+		{
+			tier_t& tier = tiers_[i];
+
+			if (tier.ticks.size() < 2 * tier.factor)
+				break;
+
+			ringbuffer_t const src(tier.ticks.begin(), tier.ticks.begin() + tier.factor);
+			tier.ticks.erase(tier.ticks.begin(), tier.ticks.begin() + tier.factor);
+
+			tiers_[i + 1].ticks.emplace_back(rollup(src));
+		}
+
+		ringbuffer_t evicted;
+
+		while (covered_ticks_ > max_ticks_)
+		{
+			// oldest tick is the first one in the coarsest non-empty tier
+			auto tier_it = std::find_if(tiers_.rbegin(), tiers_.rend(), [](tier_t const& t) { return !t.ticks.empty(); });
+			assert(tier_it != tiers_.rend());
+
+			covered_ticks_ -= tier_it->width;
+			evicted.emplace_back(std::move(tier_it->ticks.front()));
+			tier_it->ticks.erase(tier_it->ticks.begin()); // XXX: O(n)
+		}
+
+		// oldest to newest, snapshots merge these
+		ringbuffer_.clear();
+		for (auto tier_it = tiers_.rbegin(); tier_it != tiers_.rend(); ++tier_it)
+			ringbuffer_.insert(ringbuffer_.end(), tier_it->ticks.begin(), tier_it->ticks.end());
+
+		return evicted;
+	}
+
+	ringbuffer_t const& get_ringbuffer() const
+	{
+		return ringbuffer_;
+	}
+
+	// replace(report_tick_ptr& tick) -> bool, called for ticks oldest first, might replace the tick with a new one (covering the same time)
+	// stops when replace() returns false
+	template<class ReplaceFunction>
+	void replace_oldest_first(ReplaceFunction const& replace)
+	{
+		bool keep_going = true;
+
+		for (auto tier_it = tiers_.rbegin(); keep_going && (tier_it != tiers_.rend()); ++tier_it)
+		{
+			for (auto& tick : tier_it->ticks)
+			{
+				keep_going = replace(tick);
+				if (!keep_going)
+					break;
+			}
+		}
+
+		ringbuffer_.clear();
+		for (auto tier_it = tiers_.rbegin(); tier_it != tiers_.rend(); ++tier_it)
+			ringbuffer_.insert(ringbuffer_.end(), tier_it->ticks.begin(), tier_it->ticks.end());
+	}
+
+	// func(report_tick_ptr const& tick, uint32_t width), oldest first, width is the number of fine ticks covered
+	template<class Function>
+	void for_each_tick(Function const& func) const
+	{
+		for (auto tier_it = tiers_.rbegin(); tier_it != tiers_.rend(); ++tier_it)
+		{
+			for (auto const& tick : tier_it->ticks)
+				func(tick, tier_it->width);
+		}
+	}
+
+	// put back a tick, got from for_each_tick() of a ring with the same config (i.e. when loading saved history)
+	// must be called oldest first, before any append()
+	// false if there is no tier for given width, or the tick doesn't fit into the window
+	bool restore(report_tick_ptr tick, uint32_t width)
+	{
+		auto tier_it = std::find_if(tiers_.begin(), tiers_.end(), [width](tier_t const& t) { return t.width == width; });
+		if (tier_it == tiers_.end())
+			return false;
+
+		if (covered_ticks_ + width > max_ticks_)
+			return false;
+
+		tier_it->ticks.emplace_back(std::move(tick));
+		covered_ticks_ += width;
+
+		ringbuffer_.clear();
+		for (auto it = tiers_.rbegin(); it != tiers_.rend(); ++it)
+			ringbuffer_.insert(ringbuffer_.end(), it->ticks.begin(), it->ticks.end());
+
+		return true;
+	}
+
+	uint32_t max_ticks() const
+	{
+		return max_ticks_;
+	}
+
+	// fine ticks covered by all tiers
+	uint32_t covered_ticks() const
+	{
+		return covered_ticks_;
+	}
+
+private:
+
+	struct tier_t
+	{
+		uint32_t      width;   // fine ticks per tick
+		uint32_t      factor;  // ticks per rollup into next tier, 0 for the last one
+		ringbuffer_t  ticks;
+	};
+
+	uint32_t             max_ticks_;
+	uint32_t             covered_ticks_;  // fine ticks, covered by all tiers
+	std::vector<tier_t>  tiers_;
+	ringbuffer_t         ringbuffer_;     // all tiers, oldest first
+};
+
+// time covered by n_ticks history ticks (ring covered_ticks()), every aggregator thread produces a tick per tick interval
+// this is less than rinfo.time_window until the ring fills up (i.e. right after start or history load)
+inline duration_t report_history___covered_time(report_info_t const& rinfo, uint32_t n_ticks)
+{
+	uint32_t const n_threads = (rinfo.agg_threads > 0) ? rinfo.agg_threads : 1;
+	uint32_t const n_fine    = std::min(n_ticks / n_threads, rinfo.tick_count);
+
+	return duration_t { rinfo.time_window.nsec / rinfo.tick_count * n_fine };
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 inline histogram_conf_t histogram___configure_with_rinfo(report_info_t const& rinfo)
@@ -546,6 +1358,32 @@ inline histogram_conf_t histogram___configure_with_rinfo(report_info_t const& ri
 	if (!rinfo.hv_enabled)
 		return {};
 
+	if (rinfo.hv_rel_accuracy > 0)
+	{
+		// log-scale buckets, values given to hdr are bucket ids in [1, hv_bucket_count]
+		// so give it enough precision bits to keep every id in a separate counter
+		int const precision_bits = 63 - __builtin_clzll(rinfo.hv_bucket_count);
+
+		histogram_conf_t hv_conf = {
+			.min_value        = rinfo.hv_min_value,
+			.max_value        = {},
+			.unit_size        = rinfo.hv_bucket_d,
+			.precision_bits   = precision_bits,
+			.bucket_d         = rinfo.hv_bucket_d,
+			.hdr              = {},
+			.rel_accuracy     = rinfo.hv_rel_accuracy,
+			.dd_gamma         = histogram___dd_gamma(rinfo.hv_rel_accuracy),
+			.dd_log_gamma_inv = 1.0 / std::log(histogram___dd_gamma(rinfo.hv_rel_accuracy)),
+		};
+		hv_conf.max_value = histogram___dd_value_at(hv_conf, rinfo.hv_bucket_count);
+
+		auto const err = hdr_histogram_configure(&hv_conf.hdr, 1, rinfo.hv_bucket_count, precision_bits);
+		if (err)
+			throw std::runtime_error(ff::fmt_str("bad log-scale histogram config: {0}", err));
+
+		return hv_conf;
+	}
+
 	histogram_conf_t hv_conf = {
 		.min_value      = rinfo.hv_min_value,
 		.max_value      = rinfo.hv_min_value + (rinfo.hv_bucket_count * rinfo.hv_bucket_d),
@@ -1,12 +1,15 @@
 #ifndef PINBA__SNAPSHOT_DICTIONARY_H_
 #define PINBA__SNAPSHOT_DICTIONARY_H_
 
-#include <sparsehash/dense_hash_map>
+#include <algorithm>
+#include <memory>
 
-#include "t1ha/t1ha.h"
+#include <sparsehash/dense_hash_map>
 
 #include "pinba/globals.h"
 #include "pinba/dictionary.h"
+#include "pinba/hash.h"
+#include "pinba/report_key.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // single threaded cache for dictionary_t
@@ -14,40 +17,49 @@
 // intended to be used in snapshot scans and save on global dictionary locking, by caching stuff locally
 // should be very efficient for wide reports with many repeating values
 // XXX(antoxa): maybe move this out of global header, somewhere close to report_snapshot impls
+//
+// hashtable is allocated on first get_word() only, sized from expected word count (see size_hint_for())
+// every snapshot has one of these, most are never used, or used on small reports
 
 struct snapshot_dictionary_t : private boost::noncopyable
 {
-	struct word_id_hasher_t
-	{
-		inline uint64_t operator()(uint32_t const key) const
-		{
-			return t1ha0(&key, sizeof(key), key);
-		}
-	};
+	using word_id_hasher_t = pinba::fixed_hasher_t<uint32_t>;
 
 	using hashtable_t = google::dense_hash_map<uint32_t, str_ref, word_id_hasher_t>;
 
+	// pre-allocate up to this many to avoid some resizes,
+	// this allocates (24 bytes per node) * 2^17 = 1.5Mb
+	// -1 is important, due to how dense_hash calculates real bucket_count (< vs <=)
+	static constexpr uint32_t const max_preallocate = 32 * 1024 - 1;
+
 	struct id_to_word_hash_t : public hashtable_t
 	{
-		id_to_word_hash_t()
-			// pre-allocate to avoid some resizes,
-			// this allocates (24 bytes per node) * 2^17 = 1.5Mb
-			// -1 is important, due to how dense_hash calculates real bucket_count (< vs <=)
-			: hashtable_t(32 * 1024 - 1)
+		explicit id_to_word_hash_t(uint32_t expected_words)
+			: hashtable_t(expected_words)
 		{
 			this->set_empty_key(PINBA_INTERNAL___UINT32_MAX);
 		}
 	};
 
+	// every key part of every row might be a distinct word, but there's no point to go over max_preallocate
+	// 0 = unknown, preallocate max
+	static uint32_t size_hint_for(uint64_t row_count, uint32_t n_key_parts)
+	{
+		uint64_t const n_words = row_count * std::max<uint32_t>(n_key_parts, 1);
+		return (n_words == 0 || n_words > max_preallocate) ? max_preallocate : uint32_t(n_words);
+	}
+
 private:
 
-	mutable id_to_word_hash_t  words_ht;
-	dictionary_t const         *d;
+	mutable std::unique_ptr<id_to_word_hash_t>  words_ht;
+	dictionary_t const                          *d;
+	uint32_t                                    size_hint;
 
 public:
 
-	explicit snapshot_dictionary_t(dictionary_t const *dict)
+	explicit snapshot_dictionary_t(dictionary_t const *dict, uint32_t sz_hint = 0)
 		: d(dict)
+		, size_hint((sz_hint == 0) ? max_preallocate : sz_hint)
 	{
 		assert(d != nullptr);
 	}
@@ -59,8 +71,11 @@ public:
 		if (word_id == 0)
 			return {};
 
+		if (__builtin_expect(!words_ht, 0))
+			words_ht = meow::make_unique<id_to_word_hash_t>(size_hint);
+
 		// fastpath: local lookup
-		str_ref& value_ref = this->words_ht[word_id];
+		str_ref& value_ref = (*words_ht)[word_id];
 		if (!value_ref.empty()) // found
 			return value_ref;
 
@@ -71,6 +86,36 @@ public:
 		value_ref = remote_value;
 		return value_ref;
 	}
+
+	// words for all key parts of a page of rows, out is row-major, n_key_parts words per row
+	// keys in the same page tend to share parts (host, server, etc.), so those are taken from previous row without hashing
+	// the rest go through get_word(), i.e. every distinct word_id hits global dictionary once per select at most
+	void get_key_words(report_key_t const *keys, size_t n_rows, uint32_t n_key_parts, str_ref *out) const
+	{
+		uint32_t last_id[PINBA_LIMIT___MAX_KEY_PARTS];
+		str_ref  last_word[PINBA_LIMIT___MAX_KEY_PARTS];
+
+		for (uint32_t i = 0; i < n_key_parts; i++)
+		{
+			last_id[i]   = 0;
+			last_word[i] = {};
+		}
+
+		for (size_t row = 0; row < n_rows; row++)
+		{
+			for (uint32_t i = 0; i < n_key_parts; i++)
+			{
+				uint32_t const word_id = keys[row][i];
+				if (word_id != last_id[i])
+				{
+					last_id[i]   = word_id;
+					last_word[i] = this->get_word(word_id);
+				}
+
+				*out++ = last_word[i];
+			}
+		}
+	}
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,35 @@
+#ifndef PINBA__SNAPSHOT_GATHER_H_
+#define PINBA__SNAPSHOT_GATHER_H_
+
+#include <string>
+#include <vector>
+
+#include "pinba/globals.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// scatter-gather over pinba nodes that have the same report sharded between them (i.e. by script hash)
+//
+// every node is asked for its binary snapshot of the report (see exporter.h), all at once, a thread per node
+// node responses are parsed as they arrive, then rows are sorted by key and merged into the result with pinba::multi_merge()
+// as soon as that node is done, i.e. slow nodes only delay their own part of the merge, not everyone else's
+// rows with equal keys (compared as strings, word ids are per node) have their columns summed
+//
+// result goes out in the same binary format, so clients can't tell merged snapshot from a local one
+// NOTE: distinct_count of request reports is summed as well, so it's an upper bound when shards overlap
+
+struct snapshot_gather_conf_t
+{
+	std::vector<std::string>  nodes;    // 'unix:/path/to/export.sock' or 'host:port' (pinba_export_port)
+	duration_t                timeout;  // per node connect/send/recv timeout
+};
+
+// parses comma-separated node list, empty items are skipped
+std::vector<std::string> snapshot_gather___parse_nodes(str_ref nodes);
+
+// fetch report_name from all nodes, merge, write to out (appends)
+// fails if any node fails or nodes disagree on report kind, key parts or columns, partial results would be silently wrong
+pinba_error_t snapshot_gather(pinba_globals_t*, snapshot_gather_conf_t const&, std::string const& report_name, std::string *out);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__SNAPSHOT_GATHER_H_
@@ -0,0 +1,552 @@
+#ifndef PINBA__SWISS_MAP_H_
+#define PINBA__SWISS_MAP_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// open addressing hashtable with a separate control byte per slot, probed 16 slots at a time (aka swiss table)
+// control byte is either 'empty', 'deleted' or 7 low bits of the key hash,
+// so most lookups compare 16 hash fragments with one simd compare and touch a single key
+//
+// api is the subset of tsl::robin_map that reports use, so they can be switched (see report_hashtable___*_t)
+//  - emplace_hash(hash, key, value) / find(key, hash), hash must be the same as Hash()(key)
+//  - iterators are forward only, invalidated by any insert (same as robin_map)
+//  - erase(iterator) leaves a tombstone, tombstones are cleaned on next rehash
+//  - StoreHash keeps low 32 bits of hash per slot (same as robin_map), so growing never calls Hash
+//    and long keys are compared only when hashes match
+
+template<class Key, class T, class Hash, class KeyEqual, bool StoreHash = false>
+struct swiss_map_t
+{
+	using key_type    = Key;
+	using mapped_type = T;
+	using value_type  = std::pair<Key, T>;
+	using size_type   = size_t;
+	using hasher      = Hash;
+	using key_equal   = KeyEqual;
+
+	static constexpr size_t group_size = 16;
+
+	// stored 32 bits of hash are enough to place slots in tables up to this size, see h1_of()
+	static constexpr size_t stored_hash_max_capacity = size_t(1) << 28;
+
+private:
+
+	enum : int8_t
+	{
+		ctrl_empty   = -128, // 0x80
+		ctrl_deleted = -2,   // 0xFE
+		// >= 0 - full, 7 bits of hash
+	};
+
+	// bitmask of matching slots in a group of 16 control bytes
+	struct group_t
+	{
+		int8_t const *ctrl;
+
+		explicit group_t(int8_t const *c) : ctrl(c) {}
+
+#if defined(__SSE2__)
+		uint32_t match(int8_t h2) const
+		{
+			__m128i const v = _mm_load_si128((__m128i const*)ctrl);
+			return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(h2)));
+		}
+
+		uint32_t match_empty() const
+		{
+			return this->match(ctrl_empty);
+		}
+
+		// high bit is set for both empty and deleted
+		uint32_t match_empty_or_deleted() const
+		{
+			return _mm_movemask_epi8(_mm_load_si128((__m128i const*)ctrl));
+		}
+#else
+		uint32_t match(int8_t h2) const
+		{
+			uint32_t result = 0;
+			for (uint32_t i = 0; i < group_size; i++)
+				result |= uint32_t(ctrl[i] == h2) << i;
+			return result;
+		}
+
+		uint32_t match_empty() const
+		{
+			return this->match(ctrl_empty);
+		}
+
+		uint32_t match_empty_or_deleted() const
+		{
+			uint32_t result = 0;
+			for (uint32_t i = 0; i < group_size; i++)
+				result |= uint32_t(ctrl[i] < 0) << i;
+			return result;
+		}
+#endif
+	};
+
+	template<bool IsConst>
+	struct iterator_impl_t
+	{
+		using map_t = typename std::conditional<IsConst, swiss_map_t const, swiss_map_t>::type;
+
+		using iterator_category = std::forward_iterator_tag;
+		using value_type        = swiss_map_t::value_type;
+		using difference_type   = std::ptrdiff_t;
+		using pointer           = typename std::conditional<IsConst, value_type const*, value_type*>::type;
+		using reference         = typename std::conditional<IsConst, value_type const&, value_type&>::type;
+
+		map_t   *map;
+		size_t  index;
+
+		iterator_impl_t() : map(nullptr), index(0) {}
+		iterator_impl_t(map_t *m, size_t i) : map(m), index(i) {}
+
+		// iterator -> const_iterator
+		template<bool C = IsConst, class = typename std::enable_if<C>::type>
+		iterator_impl_t(iterator_impl_t<false> const& other) : map(other.map), index(other.index) {}
+
+		reference operator*() const  { return map->slots_[index]; }
+		pointer   operator->() const { return &map->slots_[index]; }
+
+		typename std::conditional<IsConst, T const&, T&>::type value() const { return map->slots_[index].second; }
+
+		iterator_impl_t& operator++()
+		{
+			index = map->next_full(index + 1);
+			return *this;
+		}
+
+		iterator_impl_t operator++(int)
+		{
+			iterator_impl_t result = *this;
+			++(*this);
+			return result;
+		}
+
+		bool operator==(iterator_impl_t const& other) const { return index == other.index; }
+		bool operator!=(iterator_impl_t const& other) const { return index != other.index; }
+	};
+
+public:
+
+	using iterator       = iterator_impl_t<false>;
+	using const_iterator = iterator_impl_t<true>;
+
+public:
+
+	swiss_map_t()
+		: ctrl_(nullptr)
+		, slots_(nullptr)
+		, hashes_(nullptr)
+		, capacity_(0)
+		, size_(0)
+		, deleted_(0)
+	{
+	}
+
+	swiss_map_t(swiss_map_t const& other)
+		: swiss_map_t()
+	{
+		this->copy_from(other);
+	}
+
+	swiss_map_t(swiss_map_t&& other) noexcept
+		: swiss_map_t()
+	{
+		this->swap(other);
+	}
+
+	swiss_map_t& operator=(swiss_map_t const& other)
+	{
+		if (this != &other)
+		{
+			this->destroy();
+			this->copy_from(other);
+		}
+		return *this;
+	}
+
+	swiss_map_t& operator=(swiss_map_t&& other) noexcept
+	{
+		this->swap(other);
+		return *this;
+	}
+
+	~swiss_map_t()
+	{
+		this->destroy();
+	}
+
+	void swap(swiss_map_t& other) noexcept
+	{
+		std::swap(ctrl_, other.ctrl_);
+		std::swap(slots_, other.slots_);
+		std::swap(hashes_, other.hashes_);
+		std::swap(capacity_, other.capacity_);
+		std::swap(size_, other.size_);
+		std::swap(deleted_, other.deleted_);
+	}
+
+public: // capacity
+
+	size_t size() const         { return size_; }
+	bool   empty() const        { return size_ == 0; }
+	size_t bucket_count() const { return capacity_; }
+
+	hasher    hash_function() const { return hasher(); }
+	key_equal key_eq() const        { return key_equal(); }
+
+	// make room for n elements without rehashing
+	void reserve(size_t n)
+	{
+		size_t const need = capacity_for(n);
+		if (need > capacity_)
+			this->resize(need);
+	}
+
+	// rehash to fit max(n, size()) elements, rehash(0) shrinks the table to fit
+	void rehash(size_t n)
+	{
+		size_t const need = capacity_for(std::max(n, size_));
+
+		if (need == 0)
+		{
+			this->destroy();
+			return;
+		}
+
+		if (need != capacity_ || deleted_ > 0)
+			this->resize(need);
+	}
+
+	void clear()
+	{
+		for (size_t i = 0; i < capacity_; i++)
+		{
+			if (ctrl_[i] >= 0)
+				slots_[i].~value_type();
+		}
+
+		if (capacity_ > 0)
+			memset(ctrl_, ctrl_empty, capacity_);
+
+		size_    = 0;
+		deleted_ = 0;
+	}
+
+public: // iteration
+
+	iterator       begin()        { return iterator(this, this->next_full(0)); }
+	iterator       end()          { return iterator(this, capacity_); }
+	const_iterator begin() const  { return const_iterator(this, this->next_full(0)); }
+	const_iterator end() const    { return const_iterator(this, capacity_); }
+	const_iterator cbegin() const { return this->begin(); }
+	const_iterator cend() const   { return this->end(); }
+
+public: // lookup
+
+	iterator find(Key const& key, uint64_t hash)
+	{
+		return iterator(this, this->find_index(key, hash));
+	}
+
+	const_iterator find(Key const& key, uint64_t hash) const
+	{
+		return const_iterator(this, this->find_index(key, hash));
+	}
+
+	iterator find(Key const& key)              { return this->find(key, hasher()(key)); }
+	const_iterator find(Key const& key) const  { return this->find(key, hasher()(key)); }
+
+public: // modifiers
+
+	template<class K, class... Args>
+	std::pair<iterator, bool> emplace_hash(uint64_t hash, K&& key, Args&&... args)
+	{
+		size_t const found = this->find_index(key, hash);
+		if (found != capacity_)
+			return { iterator(this, found), false };
+
+		if ((size_ + deleted_ + 1) > max_load(capacity_))
+		{
+			// lots of tombstones, just cleaning them up is enough (and keeps memory usage flat)
+			size_t const need = capacity_for(size_ + 1);
+			this->resize((need <= capacity_) ? capacity_ : std::max(need, capacity_ * 2));
+		}
+
+		size_t const i = this->find_insert_slot(hash);
+
+		new (&slots_[i]) value_type(std::piecewise_construct,
+				std::forward_as_tuple(std::forward<K>(key)),
+				std::forward_as_tuple(std::forward<Args>(args)...));
+
+		if (ctrl_[i] == ctrl_deleted)
+			deleted_--;
+
+		ctrl_[i] = h2_of(hash);
+		if (StoreHash)
+			hashes_[i] = (uint32_t)hash;
+		size_++;
+
+		return { iterator(this, i), true };
+	}
+
+	template<class K, class... Args>
+	std::pair<iterator, bool> emplace(K&& key, Args&&... args)
+	{
+		uint64_t const hash = hasher()(key);
+		return this->emplace_hash(hash, std::forward<K>(key), std::forward<Args>(args)...);
+	}
+
+	void erase(const_iterator it)
+	{
+		size_t const i = it.index;
+		assert(i < capacity_ && ctrl_[i] >= 0);
+
+		slots_[i].~value_type();
+		size_--;
+
+		// if there is an empty slot in this group, no probe sequence has ever continued past this group
+		// so this slot can become empty again, without breaking lookups for other keys
+		if (group_t(&ctrl_[i & ~(group_size - 1)]).match_empty() != 0)
+		{
+			ctrl_[i] = ctrl_empty;
+		}
+		else
+		{
+			ctrl_[i] = ctrl_deleted;
+			deleted_++;
+		}
+	}
+
+	size_t erase(Key const& key)
+	{
+		auto const it = this->find(key);
+		if (it == this->end())
+			return 0;
+
+		this->erase(const_iterator(it));
+		return 1;
+	}
+
+private:
+
+	static int8_t h2_of(uint64_t hash)
+	{
+		return (int8_t)(hash & 0x7f);
+	}
+
+	static size_t h1_of(uint64_t hash)
+	{
+		return (size_t)(hash >> 7);
+	}
+
+	// 7/8 max load, groups are probed as a whole, so can go quite high
+	static size_t max_load(size_t capacity)
+	{
+		return capacity - capacity / 8;
+	}
+
+	static size_t capacity_for(size_t n)
+	{
+		if (n == 0)
+			return 0;
+
+		size_t capacity = group_size;
+		while (max_load(capacity) < n)
+			capacity *= 2;
+
+		return capacity;
+	}
+
+	size_t next_full(size_t i) const
+	{
+		for (; i < capacity_; i++)
+		{
+			if (ctrl_[i] >= 0)
+				return i;
+		}
+		return capacity_;
+	}
+
+	template<class K>
+	size_t find_index(K const& key, uint64_t hash) const
+	{
+		if (capacity_ == 0)
+			return capacity_;
+
+		size_t const group_mask = (capacity_ / group_size) - 1;
+		int8_t const h2 = h2_of(hash);
+
+		size_t g = h1_of(hash) & group_mask;
+
+		// triangular probing over groups, visits all groups since group count is a power of 2
+		for (size_t probe = 1;; probe++)
+		{
+			int8_t const *group_ctrl = ctrl_ + g * group_size;
+			group_t const group { group_ctrl };
+
+			for (uint32_t match = group.match(h2); match != 0; match &= (match - 1))
+			{
+				size_t const i = g * group_size + __builtin_ctz(match);
+
+				if (StoreHash && (hashes_[i] != (uint32_t)hash))
+					continue;
+
+				if (key_equal()(slots_[i].first, key))
+					return i;
+			}
+
+			if (group.match_empty() != 0)
+				return capacity_;
+
+			if (probe > group_mask)
+				return capacity_; // all groups checked (only possible with no empty slots at all)
+
+			g = (g + probe) & group_mask;
+		}
+	}
+
+	// there must be at least one empty or deleted slot
+	size_t find_insert_slot(uint64_t hash) const
+	{
+		size_t const group_mask = (capacity_ / group_size) - 1;
+
+		size_t g = h1_of(hash) & group_mask;
+
+		for (size_t probe = 1;; probe++)
+		{
+			uint32_t const match = group_t(ctrl_ + g * group_size).match_empty_or_deleted();
+			if (match != 0)
+				return g * group_size + __builtin_ctz(match);
+
+			g = (g + probe) & group_mask;
+		}
+	}
+
+	void allocate(size_t capacity)
+	{
+		assert(capacity % group_size == 0);
+
+		// single allocation, control bytes first, capacity is a multiple of 16, so slots stay aligned
+		static_assert(alignof(value_type) <= group_size, "value_type alignment is too large");
+
+		// stored hashes go last, capacity * sizeof(value_type) is a multiple of 16 as well
+		size_t const hashes_size = (StoreHash) ? capacity * sizeof(uint32_t) : 0;
+
+		char *mem = (char*)::operator new(capacity + capacity * sizeof(value_type) + hashes_size);
+
+		ctrl_     = (int8_t*)mem;
+		slots_    = (value_type*)(mem + capacity);
+		hashes_   = (StoreHash) ? (uint32_t*)(mem + capacity + capacity * sizeof(value_type)) : nullptr;
+		capacity_ = capacity;
+		size_     = 0;
+		deleted_  = 0;
+
+		memset(ctrl_, ctrl_empty, capacity);
+	}
+
+	void deallocate()
+	{
+		::operator delete((void*)ctrl_);
+
+		ctrl_     = nullptr;
+		slots_    = nullptr;
+		hashes_   = nullptr;
+		capacity_ = 0;
+		size_     = 0;
+		deleted_  = 0;
+	}
+
+	void destroy()
+	{
+		if (capacity_ == 0)
+			return;
+
+		this->clear();
+		this->deallocate();
+	}
+
+	void resize(size_t new_capacity)
+	{
+		int8_t     *old_ctrl     = ctrl_;
+		value_type *old_slots    = slots_;
+		uint32_t   *old_hashes   = hashes_;
+		size_t      old_capacity = capacity_;
+
+		// stored hashes are truncated, need full ones to place slots in huge tables
+		bool const use_stored_hash = StoreHash && (new_capacity <= stored_hash_max_capacity);
+
+		this->allocate(new_capacity);
+
+		for (size_t i = 0; i < old_capacity; i++)
+		{
+			if (old_ctrl[i] < 0)
+				continue;
+
+			value_type& src = old_slots[i];
+
+			uint64_t const hash = (use_stored_hash) ? old_hashes[i] : hasher()(src.first);
+			size_t const dst_i = this->find_insert_slot(hash);
+
+			new (&slots_[dst_i]) value_type(std::move(src));
+			ctrl_[dst_i] = h2_of(hash);
+			if (StoreHash)
+				hashes_[dst_i] = (uint32_t)hash;
+			size_++;
+
+			src.~value_type();
+		}
+
+		::operator delete((void*)old_ctrl);
+	}
+
+	void copy_from(swiss_map_t const& other)
+	{
+		if (other.capacity_ == 0)
+			return;
+
+		this->allocate(other.capacity_);
+
+		// same capacity, same layout, no need to rehash
+		memcpy(ctrl_, other.ctrl_, capacity_);
+		if (StoreHash)
+			memcpy(hashes_, other.hashes_, capacity_ * sizeof(uint32_t));
+
+		for (size_t i = 0; i < capacity_; i++)
+		{
+			if (ctrl_[i] >= 0)
+				new (&slots_[i]) value_type(other.slots_[i]);
+		}
+
+		size_    = other.size_;
+		deleted_ = other.deleted_;
+	}
+
+private:
+	int8_t      *ctrl_;
+	value_type  *slots_;
+	uint32_t    *hashes_;   // low 32 bits of slot hash, StoreHash only
+	size_t      capacity_;  // 0 or power of 2, >= group_size
+	size_t      size_;
+	size_t      deleted_;   // tombstones
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__SWISS_MAP_H_
@@ -0,0 +1,81 @@
+#ifndef PINBA__TAG_LOOKUP_H_
+#define PINBA__TAG_LOOKUP_H_
+
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// find first position of name_id in tag name ids array, returns count if not found
+// used for key extraction, where every required tag is looked up in every timer (and packet)
+//
+// simd version broadcasts name_id and compares 8 (avx2) or 4 (sse2) names at once, tail is scalar
+// avx2 needs to be enabled at compile time (i.e. CXXFLAGS="-mavx2" or "-march=native"), sse2 is always there on x86_64
+
+inline uint32_t tag_lookup___scalar(uint32_t const *names, uint32_t count, uint32_t name_id)
+{
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (names[i] == name_id)
+			return i;
+	}
+
+	return count;
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+#define PINBA__TAG_LOOKUP_HAVE_SIMD 1
+
+inline uint32_t tag_lookup___simd(uint32_t const *names, uint32_t count, uint32_t name_id)
+{
+	uint32_t i = 0;
+
+#if defined(__AVX2__)
+	__m256i const needle = _mm256_set1_epi32((int)name_id);
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i const v = _mm256_loadu_si256((__m256i const*)(names + i));
+		int const mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, needle)));
+
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+
+	__m128i const needle4 = _mm_set1_epi32((int)name_id);
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i const v = _mm_loadu_si128((__m128i const*)(names + i));
+		int const mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, needle4)));
+
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + tag_lookup___scalar(names + i, count - i, name_id);
+}
+
+inline uint32_t tag_lookup___find(uint32_t const *names, uint32_t count, uint32_t name_id)
+{
+	return tag_lookup___simd(names, count, name_id);
+}
+
+#else // no simd
+
+inline uint32_t tag_lookup___find(uint32_t const *names, uint32_t count, uint32_t name_id)
+{
+	return tag_lookup___scalar(names, count, name_id);
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__TAG_LOOKUP_H_
@@ -0,0 +1,89 @@
+#ifndef PINBA__THREAD_POOL_H_
+#define PINBA__THREAD_POOL_H_
+
+#include <functional>
+#include <future>
+#include <vector>
+
+#include "pinba/globals.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// a small fixed-size pool of worker threads, shared by everyone who needs to run cpu-heavy stuff
+// in parallel (snapshot merges for example), to avoid creating a thread per request
+
+struct thread_pool_conf_t
+{
+	std::string  name;       // thread name prefix, for debugging
+	uint32_t     n_threads;  // number of worker threads, must be > 0
+	pinba_thread_sched_t sched; // worker threads scheduling, see pinba_set_thread_sched()
+};
+
+struct thread_pool_t : private boost::noncopyable
+{
+	using task_t = std::function<void()>;
+
+	virtual ~thread_pool_t() {}
+
+	virtual uint32_t thread_count() const = 0;
+
+	// queue task for execution in one of the worker threads
+	// task must not throw, if it does - std::terminate() gets called
+	virtual void     enqueue(task_t const&) = 0;
+};
+using thread_pool_ptr = std::unique_ptr<thread_pool_t>;
+
+thread_pool_ptr create_thread_pool(pinba_globals_t*, thread_pool_conf_t const&);
+
+// run all tasks, first one in calling thread and all others in the pool, wait for all of them to finish
+// exceptions are propagated to the caller (first one wins), after all tasks have finished
+// pool can be nullptr, everything is run in the calling thread then
+inline void thread_pool___run_and_wait(thread_pool_t *pool, std::vector<thread_pool_t::task_t> const& tasks)
+{
+	if (tasks.empty())
+		return;
+
+	std::vector<std::future<void>> futures;
+	futures.reserve(tasks.size());
+
+	for (size_t i = 1; i < tasks.size(); i++)
+	{
+		auto task = std::make_shared<std::packaged_task<void()>>(tasks[i]);
+		futures.push_back(task->get_future());
+
+		if (pool)
+			pool->enqueue([task]() { (*task)(); });
+		else
+			(*task)();
+	}
+
+	std::exception_ptr first_error;
+
+	try
+	{
+		tasks[0]();
+	}
+	catch (...)
+	{
+		first_error = std::current_exception();
+	}
+
+	for (auto& f : futures)
+	{
+		try
+		{
+			f.get();
+		}
+		catch (...)
+		{
+			if (!first_error)
+				first_error = std::current_exception();
+		}
+	}
+
+	if (first_error)
+		std::rethrow_exception(first_error);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__THREAD_POOL_H_
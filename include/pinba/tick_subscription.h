@@ -0,0 +1,50 @@
+#ifndef PINBA__TICK_SUBSCRIPTION_H_
+#define PINBA__TICK_SUBSCRIPTION_H_
+
+#include <memory>
+#include <string>
+
+#include "pinba/globals.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// streaming consumers: every tick of a report, pushed right after it's merged into history, instead of polling snapshots
+//
+// tick data is the same thing federation sends upstream (single tick in report_persist format, keys as strings, see federation.h)
+// so it's self-contained, consumers don't need the dictionary, and it's encoded once per tick for all subscribers
+//
+// every subscriber has a bounded queue, report host thread never waits on it
+// when the queue is full, subscriber is dropped: report forgets it, ticks already queued can still be read
+// same when report is deleted, subscription is closed then
+// only timer reports support this for now (see report_history_t::tick_subscribe())
+
+using report_tick_data_ptr = std::shared_ptr<std::string const>;
+
+struct report_tick_subscription_t : private boost::noncopyable
+{
+	virtual ~report_tick_subscription_t() {}
+
+	// report host thread, never blocks
+	// false = subscriber is gone (dropped just now or earlier, or unsubscribed), stop pushing
+	virtual bool push(report_tick_data_ptr const&) = 0;
+
+	// report host thread, report is going away, no more ticks
+	virtual void close() = 0;
+
+	// consumer, waits up to timeout for a tick
+	// nullptr on timeout, or when closed and nothing is queued anymore
+	virtual report_tick_data_ptr pop(duration_t timeout) = 0;
+
+	// consumer, report forgets the subscription on next tick
+	virtual void unsubscribe() = 0;
+
+	virtual bool is_closed() const = 0;   // no more ticks are coming: dropped, report is gone or unsubscribed
+	virtual bool is_dropped() const = 0;  // closed, because consumer didn't keep up
+};
+using report_tick_subscription_ptr = std::shared_ptr<report_tick_subscription_t>;
+
+// max_queued - ticks to keep for a consumer not keeping up, before dropping it
+report_tick_subscription_ptr create_report_tick_subscription(uint32_t max_queued);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__TICK_SUBSCRIPTION_H_
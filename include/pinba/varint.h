@@ -0,0 +1,53 @@
+#ifndef PINBA__VARINT_H_
+#define PINBA__VARINT_H_
+
+#include <cstdint>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// variable length integers, 7 bits per byte, low bits first (aka LEB128)
+// meant for compact in-memory storage we encode ourselves (see report_by_timer compressed ticks)
+// so reads are not bounds checked, never use these for data coming from the network
+
+inline void varint___append(std::vector<uint8_t> *to, uint64_t v)
+{
+	while (v >= 0x80)
+	{
+		to->push_back(uint8_t(v) | 0x80);
+		v >>= 7;
+	}
+	to->push_back(uint8_t(v));
+}
+
+inline uint64_t varint___read(uint8_t const **p)
+{
+	uint8_t const *s = *p;
+
+	uint64_t result = 0;
+	for (unsigned shift = 0;; shift += 7)
+	{
+		uint8_t const b = *s++;
+		result |= uint64_t(b & 0x7f) << shift;
+
+		if (!(b & 0x80))
+			break;
+	}
+
+	*p = s;
+	return result;
+}
+
+// zigzag, so that small negative values stay short
+inline uint64_t varint___zigzag(int64_t v)
+{
+	return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+}
+
+inline int64_t varint___unzigzag(uint64_t v)
+{
+	return int64_t(v >> 1) ^ -int64_t(v & 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__VARINT_H_
@@ -0,0 +1,180 @@
+#ifndef PINBA__WORD_BITMAP_H_
+#define PINBA__WORD_BITMAP_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// exact set of uint32 values (dictionary word ids mostly), roaring-style compressed bitmap
+// values are split by high 16 bits into containers, a container is either
+//   - sorted array of low 16 bits, while it has up to array_max values (2 bytes per value)
+//   - 8KB bitmap of all 2^16 low values after that
+// word ids are dense and small, so bounded-cardinality stuff (hosts, servers) is usually one small array container
+//
+// this is exact distinct count (see report_conf___by_request_t::distinct_exact), memory grows with cardinality
+// don't use it for anything, that can have millions of values per row, that's what hll_sketch_t is for
+
+struct word_bitmap_t
+{
+	static constexpr uint32_t array_max    = 4096; // array is smaller than bitmap up to here
+	static constexpr uint32_t bitmap_words = 65536 / 64;
+
+private:
+
+	struct container_t
+	{
+		uint16_t                     high;
+		uint32_t                     cardinality = 0;
+		std::vector<uint16_t>        array;  // sorted, when bits is nullptr
+		std::unique_ptr<uint64_t[]>  bits;   // bitmap_words, when set
+
+		explicit container_t(uint16_t h)
+			: high(h)
+		{
+		}
+
+		void add(uint16_t low)
+		{
+			if (bits)
+			{
+				uint64_t& w      = bits[low >> 6];
+				uint64_t const m = uint64_t(1) << (low & 63);
+
+				cardinality += !(w & m);
+				w |= m;
+				return;
+			}
+
+			auto const it = std::lower_bound(array.begin(), array.end(), low);
+			if ((it != array.end()) && (*it == low))
+				return;
+
+			array.insert(it, low);
+			cardinality++;
+
+			if (array.size() > array_max)
+				this->to_bitmap();
+		}
+
+		void to_bitmap()
+		{
+			bits.reset(new uint64_t[bitmap_words]());
+
+			for (uint16_t const low : array)
+				bits[low >> 6] |= uint64_t(1) << (low & 63);
+
+			array.clear();
+			array.shrink_to_fit();
+		}
+
+		void merge(container_t const& other)
+		{
+			if (other.bits)
+			{
+				if (!bits)
+					this->to_bitmap();
+
+				uint64_t       *dst = bits.get();
+				uint64_t const *src = other.bits.get();
+
+#if defined(__SSE2__)
+				for (uint32_t i = 0; i < bitmap_words; i += 2)
+				{
+					__m128i const a = _mm_loadu_si128((__m128i const*)(dst + i));
+					__m128i const b = _mm_loadu_si128((__m128i const*)(src + i));
+					_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(a, b));
+				}
+#else
+				for (uint32_t i = 0; i < bitmap_words; i++)
+					dst[i] |= src[i];
+#endif
+
+				uint32_t n = 0;
+				for (uint32_t i = 0; i < bitmap_words; i++)
+					n += __builtin_popcountll(dst[i]);
+
+				cardinality = n;
+				return;
+			}
+
+			if (bits)
+			{
+				for (uint16_t const low : other.array)
+					this->add(low);
+				return;
+			}
+
+			std::vector<uint16_t> result;
+			result.reserve(array.size() + other.array.size());
+			std::set_union(array.begin(), array.end(), other.array.begin(), other.array.end(), std::back_inserter(result));
+
+			array.swap(result);
+			cardinality = array.size();
+
+			if (array.size() > array_max)
+				this->to_bitmap();
+		}
+
+		uint64_t mem_used() const
+		{
+			return (bits)
+				? bitmap_words * sizeof(uint64_t)
+				: array.capacity() * sizeof(uint16_t);
+		}
+	};
+
+	std::vector<container_t> containers_; // sorted by high
+
+	container_t* container_for(uint16_t high)
+	{
+		auto it = std::lower_bound(containers_.begin(), containers_.end(), high,
+			[](container_t const& c, uint16_t h) { return c.high < h; });
+
+		if ((it == containers_.end()) || (it->high != high))
+			it = containers_.emplace(it, high);
+
+		return &*it;
+	}
+
+public:
+
+	void add(uint32_t value)
+	{
+		this->container_for(uint16_t(value >> 16))->add(uint16_t(value & 0xFFFF));
+	}
+
+	// union
+	void merge(word_bitmap_t const& other)
+	{
+		for (auto const& oc : other.containers_)
+			this->container_for(oc.high)->merge(oc);
+	}
+
+	uint64_t cardinality() const
+	{
+		uint64_t result = 0;
+		for (auto const& c : containers_)
+			result += c.cardinality;
+		return result;
+	}
+
+	uint64_t mem_used() const
+	{
+		uint64_t result = sizeof(*this) + containers_.capacity() * sizeof(container_t);
+		for (auto const& c : containers_)
+			result += c.mem_used();
+		return result;
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // PINBA__WORD_BITMAP_H_
@@ -1,26 +1,44 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
 #include <type_traits>
 
 #include "mysql_engine/handler.h"
 #include "mysql_engine/plugin.h"
 
 #include "pinba/globals.h"
+#include "pinba/dictionary.h"
 #include "pinba/histogram.h"
+#include "pinba/pipeline_latency.h"
+#include "pinba/packet_capture.h"
 #include "pinba/report_by_request.h"
 #include "pinba/report_by_timer.h"
 #include "pinba/report_by_packet.h"
+#include "pinba/report_persist.h"
+#include "pinba/snapshot_dictionary.h"
 
 // FIXME: some of these headers were moved to pinba_view, reassess,
 //        or maybe move vews back here! since they're sql related anyway
 #ifdef PINBA_USE_MYSQL_SOURCE
 #include <sql/field.h> // <mysql/private/field.h>
 #include <sql/handler.h> // <mysql/private/handler.h>
+#include <sql/item.h> // <mysql/private/item.h>
+#include <sql/item_cmpfunc.h> // <mysql/private/item_cmpfunc.h>
 #include <include/mysqld_error.h> // <mysql/mysqld_error.h>
 #else
 #include <mysql/private/field.h>
 #include <mysql/private/handler.h>
+#include <mysql/private/item.h>
+#include <mysql/private/item_cmpfunc.h>
 #include <mysql/mysqld_error.h>
 #endif // PINBA_USE_MYSQL_SOURCE
 
+#include <dirent.h>
+#include <unistd.h>
+
 #include <meow/defer.hpp>
 #include <meow/stopwatch.hpp>
 #include <meow/smart_enum.hpp>
@@ -117,6 +135,16 @@ struct pinba_view___base_t : public pinba_view_t
 	{
 		return 0;
 	}
+
+	virtual int  start_stmt(pinba_handler_t*) override
+	{
+		return 0;
+	}
+
+	virtual int  index_read(pinba_handler_t*, uchar *buf, const uchar *key, key_part_map keypart_map, enum ha_rkey_function find_flag) override
+	{
+		return HA_ERR_WRONG_COMMAND;
+	}
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -207,6 +235,36 @@ struct pinba_view___stats_t : public pinba_view___base_t
 				STORE_FIELD(35, vars_->version_info, strlen(vars_->version_info), &my_charset_bin);
 				STORE_FIELD(36, vars_->build_string, strlen(vars_->build_string), &my_charset_bin);
 
+				// appended later, optional for older tables
+				STORE_FIELD(37, vars_->udp_recv_kernel_drops);
+				STORE_FIELD(38, vars_->repacker_packet_prefilter_drop);
+				STORE_FIELD(39, vars_->coordinator_batch_send_skipped);
+
+				// rates over a short window, optional as well
+				STORE_FIELD(40, vars_->rate_window_sec);
+				STORE_FIELD(41, vars_->udp_recv_packets_per_sec);
+				STORE_FIELD(42, vars_->udp_recv_bytes_per_sec);
+				STORE_FIELD(43, vars_->udp_recv_kernel_drops_per_sec);
+				STORE_FIELD(44, vars_->udp_packet_decode_err_per_sec);
+				STORE_FIELD(45, vars_->udp_packet_send_err_per_sec);
+				STORE_FIELD(46, vars_->repacker_recv_packets_per_sec);
+				STORE_FIELD(47, vars_->repacker_packet_validate_err_per_sec);
+				STORE_FIELD(48, vars_->repacker_packet_prefilter_drop_per_sec);
+				STORE_FIELD(49, vars_->coordinator_batches_received_per_sec);
+				STORE_FIELD(50, vars_->coordinator_batch_send_err_per_sec);
+				STORE_FIELD(51, vars_->ru_utime_per_sec);
+				STORE_FIELD(52, vars_->ru_stime_per_sec);
+
+				// repacker batching decisions, optional
+				STORE_FIELD(53, vars_->repacker_batch_size);
+				STORE_FIELD(54, vars_->repacker_batch_timeout);
+				STORE_FIELD(55, vars_->repacker_packet_rate);
+
+				// transient memory, optional
+				STORE_FIELD(56, vars_->inflight_mem_raw_batches);
+				STORE_FIELD(57, vars_->inflight_mem_packet_batches);
+				STORE_FIELD(58, vars_->inflight_mem_repacker_dictionaries);
+
 			default:
 				break;
 			}
@@ -318,6 +376,15 @@ struct pinba_view___active_reports_t : public pinba_view___base_t
 		return 0;
 	}
 
+	virtual int  start_stmt(pinba_handler_t *handler) override
+	{
+		LOG_DEBUG(P_L_, "active::{0}; handler: {1}, got_data: {2}", __func__, handler, !data_.empty());
+
+		// under 'lock tables' there is no external_lock(F_UNLCK) between statements
+		this->cleanup_select_data();
+		return 0;
+	}
+
 private:
 
 	int init_for_new_select(pinba_handler_t *handler)
@@ -398,9 +465,14 @@ private:
 		report_stats_t const     *rstats     = rstate->stats;
 		report_estimates_t const *restimates = &rstate->estimates;
 
-		// remember to lock this row stats data, since it might be changed by report host thread
-		// FIXME: this probably IS too coarse!
-		std::lock_guard<std::mutex> stats_lk_(rstats->lock);
+		// no stats lock here, lock protected fields come from the copy report host publishes every second
+		// the rest are atomics (or never change after report creation)
+		report_stats_published_t const& pstats = rstate->published;
+
+		double const (&rates)[REPORT_STATS_RATE__COUNT] = pstats.rates;
+		double const rate_window_sec = pstats.rate_window_sec;
+
+		auto const& counters = pstats.counters;
 
 		// mark all fields as writeable to avoid assert() in ::store() calls
 		// got no idea how to do this properly anyway
@@ -459,26 +531,71 @@ private:
 				STORE_FIELD (6,  rinfo->tick_count);
 				STORE_FIELD (7,  restimates->row_count);
 				STORE_FIELD (8,  restimates->mem_used);
-				STORE_FIELD (9,  rstats->batches_send_total);
-				STORE_FIELD (10, rstats->batches_recv_total);
-				STORE_FIELD (11, rstats->packets_recv_total);
-				STORE_FIELD (12, rstats->packets_send_err);
-				STORE_FIELD (13, rstats->packets_aggregated);
-				STORE_FIELD (14, rstats->packets_dropped_by_bloom);
-				STORE_FIELD (15, rstats->packets_dropped_by_filters);
-				STORE_FIELD (16, rstats->packets_dropped_by_rfield);
-				STORE_FIELD (17, rstats->packets_dropped_by_rtag);
-				STORE_FIELD (18, rstats->packets_dropped_by_timertag);
-				STORE_FIELD (19, rstats->timers_scanned);
-				STORE_FIELD (20, rstats->timers_aggregated);
-				STORE_FIELD (21, rstats->timers_skipped_by_bloom);
-				STORE_FIELD (22, rstats->timers_skipped_by_filters);
-				STORE_FIELD (23, rstats->timers_skipped_by_tags);
-				STORE_FIELD (24, timeval_to_double(rstats->ru_utime));
-				STORE_FIELD (25, timeval_to_double(rstats->ru_stime));
-				STORE_FIELD (26, timeval_to_double(rstats->last_tick_tv));
-				STORE_FIELD (27, duration_seconds_as_double(rstats->last_tick_prepare_d));
-				STORE_FIELD (28, duration_seconds_as_double(rstats->last_snapshot_merge_d));
+				STORE_FIELD (9,  counters.batches_send_total);
+				STORE_FIELD (10, counters.batches_recv_total);
+				STORE_FIELD (11, counters.packets_recv_total);
+				STORE_FIELD (12, counters.packets_send_err);
+				STORE_FIELD (13, counters.packets_aggregated);
+				STORE_FIELD (14, counters.packets_dropped_by_bloom);
+				STORE_FIELD (15, counters.packets_dropped_by_filters);
+				STORE_FIELD (16, counters.packets_dropped_by_rfield);
+				STORE_FIELD (17, counters.packets_dropped_by_rtag);
+				STORE_FIELD (18, counters.packets_dropped_by_timertag);
+				STORE_FIELD (19, counters.timers_scanned);
+				STORE_FIELD (20, counters.timers_aggregated);
+				STORE_FIELD (21, counters.timers_skipped_by_bloom);
+				STORE_FIELD (22, counters.timers_skipped_by_filters);
+				STORE_FIELD (23, counters.timers_skipped_by_tags);
+				STORE_FIELD (24, timeval_to_double(pstats.ru_utime));
+				STORE_FIELD (25, timeval_to_double(pstats.ru_stime));
+				STORE_FIELD (26, timeval_to_double(pstats.last_tick_tv));
+				STORE_FIELD (27, duration_seconds_as_double(pstats.last_tick_prepare_d));
+				STORE_FIELD (28, duration_seconds_as_double(pstats.last_snapshot_merge_d));
+				STORE_FIELD (29, counters.packets_bloom_false_positive);
+				STORE_FIELD (30, counters.rows_evicted);
+				STORE_FIELD (31, counters.keys_folded);
+				STORE_FIELD (32, rstats->snapshot_cache_hits);
+				STORE_FIELD (33, rstats->snapshot_cache_misses);
+
+				// per second, over last rate_window_sec seconds, see report_stats_t::rates
+				STORE_FIELD (34, rate_window_sec);
+				STORE_FIELD (35, rates[REPORT_STATS_RATE__PACKETS_RECV]);
+				STORE_FIELD (36, rates[REPORT_STATS_RATE__PACKETS_SEND_ERR]);
+				STORE_FIELD (37, rates[REPORT_STATS_RATE__PACKETS_AGGREGATED]);
+				STORE_FIELD (38, rates[REPORT_STATS_RATE__TIMERS_SCANNED]);
+				STORE_FIELD (39, rates[REPORT_STATS_RATE__TIMERS_AGGREGATED]);
+				STORE_FIELD (40, rates[REPORT_STATS_RATE__ROWS_EVICTED]);
+				STORE_FIELD (41, rates[REPORT_STATS_RATE__RU_UTIME_USEC] / 1000000.0);
+				STORE_FIELD (42, rates[REPORT_STATS_RATE__RU_STIME_USEC] / 1000000.0);
+
+				// see report_overload_t
+				STORE_FIELD (43, rstats->overload_sample_shift.load(std::memory_order_relaxed));
+				STORE_FIELD (44, rstats->overload_transitions.load(std::memory_order_relaxed));
+				STORE_FIELD (45, rstats->overload_batches_skipped.load(std::memory_order_relaxed));
+
+				// see report_counters___t::cycles_*
+				STORE_FIELD (46, counters.cycles_add);
+				STORE_FIELD (47, counters.cycles_tick);
+				STORE_FIELD (48, counters.cycles_merge);
+				STORE_FIELD (49, rstats->cycles_prepare.load(std::memory_order_relaxed));
+
+				// see report_stats___hv_collect()
+				STORE_FIELD (50, rstats->hv_suspended.load(std::memory_order_relaxed));
+				STORE_FIELD (51, rstats->hv_suspensions.load(std::memory_order_relaxed));
+
+				case 52:
+				{
+					// histograms resumed less than time_window ago, percentiles are over part of the window only
+					int64_t const resumed_ns = rstats->hv_resumed_ns.load(std::memory_order_relaxed);
+					int64_t const now_ns     = duration_from_timeval(os_unix::clock_monotonic_now()).nsec;
+					bool const warming_up    = !rstats->hv_suspended.load(std::memory_order_relaxed)
+												&& (resumed_ns > 0)
+												&& ((now_ns - resumed_ns) < rinfo->time_window.nsec);
+
+					(*field)->set_notnull();
+					(*field)->store(warming_up);
+				}
+				break;
 			}
 		} // field for
 
@@ -489,105 +606,54 @@ private:
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-struct pinba_view___report_snapshot_t : public pinba_view___base_t
+// recent raw packets, see packet_capture.h
+// columns are: hostname, server_name, script_name, captured_at, request_time, ru_utime, ru_stime, status, doc_size, mem_peak, sample_rate, tags
+// conditions on the first 3 columns are applied while reading the ring
+struct pinba_view___packet_capture_t : public pinba_view___base_t
 {
-	pinba_share_data_ptr           share_data_; // copied from share
-	report_snapshot_ptr            snapshot_;
-	report_snapshot_t::position_t  next_pos_;   // to read NEXT row, aka rnd_next()
-	report_snapshot_t::position_t  curr_pos_;   // last returned row pos, for position()
-
-	static constexpr unsigned const n_data_fields___by_request = 18;
-	static constexpr unsigned const n_data_fields___by_timer   = 15;
-	static constexpr unsigned const n_data_fields___by_packet  = 7;
-
-public:
-
-	// with 'order by' mysql calls us like this:
-	// XXX: rnd_init is basically called twice and we merge snapshot data twice (and DIFFERENT snapshot data!)
-	//
-	// 1. get the table data for filesort
-	//      extra(HA_EXTRA_IS_ATTACHED_CHILDREN)
-	//      extra(HA_EXTRA_IS_ATTACHED_CHILDREN)
-	//      extra(HA_EXTRA_ADD_CHILDREN_LIST)
-	//      external_lock(F_RDLCK)
-	//      info()
-	//      rnd_init(scan = 1)
-	//      extra(HA_EXTRA_CACHE)
-	//      rnd_next() + position() [...multiple...]
-	//      extra(HA_EXTRA_NO_CACHE)
-	//      rnd_end()
-	//
-	// 2. grab data from the table, using refs (depends on cache size, if it happens at all?)
-	//      rnd_init(scan = 0)
-	//      rnd_end()
-	//      extra(HA_EXTRA_NO_CACHE)
-	//      extra(HA_EXTRA_DETACH_CHILDREN)
-	//      external_lock(F_UNLCK)
-	//      extra(HA_EXTRA_DETACH_CHILDREN)
-
-	// for basic table scan (aka without 'order by'):
-	// 1. just one step here
-	//      extra(HA_EXTRA_IS_ATTACHED_CHILDREN)
-	//      extra(HA_EXTRA_IS_ATTACHED_CHILDREN)
-	//      extra(HA_EXTRA_ADD_CHILDREN_LIST)
-	//      external_lock(F_RDLCK)
-	//      info()
-	//      rnd_init(scan = 1)
-	//      extra(HA_EXTRA_CACHE)
-	//      rnd_next() [...multiple...], there are no calls to position()
-	//      rnd_end()
-	//      extra(HA_EXTRA_NO_CACHE), aka - stop caching comes after ending the scan!
-	//      extra(HA_EXTRA_DETACH_CHILDREN)
-	//      external_lock(F_UNLCK)
-	//      extra(HA_EXTRA_DETACH_CHILDREN)
-
-	// XXX: so the idea here, is to avoid getting report snapshot twice when sorting/grouping
-	//      AND to avoid deallocating snapshot on rnd_end() if it came from filesort()
-	//      since we store refs to rows (in position()) and later mysql is supposed to use those
-	//      to call rnd_pos() if it needs the data again and it's not in 'mysql memory' (though i've got no idea how to force that to test)
-	//
-	//      to implement
-	//      we're going to rely on external_lock(F_UNLCK) coming at the absolute end of select, after all scans/sorts/etc.
-	//
-	//      there was also an implementation, relying on HA_EXTRA_DETACH_CHILDREN, but this seems simpler
-	//
+	using view_t     = std::vector<captured_packet_t>;
+	using position_t = view_t::const_iterator;
 
-public:
+	view_t      data_;
+	bool        got_data_ = false;
+	position_t  next_pos_; // to read NEXT row, aka rnd_next()
+	position_t  curr_pos_; // last returned row pos, for position()
 
 	virtual int rnd_init(pinba_handler_t *handler, bool scan) override
 	{
-		LOG_DEBUG(P_L_, "snapshot::{0}; handler: {1}, scan: {2}, snapshot: {3}", __func__, handler, scan, snapshot_.get());
+		LOG_DEBUG(P_L_, "capture::{0}; handler: {1}, scan: {2}, got_data: {3}", __func__, handler, scan, got_data_);
 
-		if (!snapshot_)
+		if (!got_data_)
 		{
-			int const r = this->init_for_new_select(handler);
-			if (r != 0)
-				return r;
+			packet_capture_t const *capture = P_G_->packet_capture();
+			if (!capture)
+			{
+				my_printf_error(ER_INTERNAL_ERROR, "[pinba] packet capture is off, set pinba_packet_capture_size", MYF(0));
+				return HA_ERR_INTERNAL_ERROR;
+			}
+
+			packet_capture_filter_t filter;
+			for (auto const& part : handler->pushed_key_filter().parts)
+				filter.parts.push_back({ part.key_index, part.values }); // key index is PACKET_CAPTURE_FIELD__*
+
+			data_     = capture->read(filter);
+			got_data_ = true;
 		}
 
-		curr_pos_ = snapshot_->pos_first();
+		curr_pos_ = data_.begin();
 		next_pos_ = curr_pos_;
 
 		return 0;
 	}
 
-	virtual int rnd_end(pinba_handler_t *handler) override
-	{
-		LOG_DEBUG(P_L_, "snapshot::{0}; handler: {1}, snapshot: {2}", __func__, handler, snapshot_.get());
-		// nothing to see here, see cleanup_select_data()
-		return 0;
-	}
-
 	virtual int rnd_next(pinba_handler_t *handler, uchar *buf) override
 	{
-		// LOG_DEBUG(P_L_, "snapshot::{0}; handler: {1}, next_pos: {2}", __func__, handler, ff::as_hex_string(str_ref{(char*)&next_pos_, sizeof(next_pos_)}));
-
-		if (snapshot_->pos_equal(next_pos_, snapshot_->pos_last()))
+		if (next_pos_ == data_.end())
 			return HA_ERR_END_OF_FILE;
 
 		MEOW_DEFER(
 			curr_pos_ = next_pos_;
-			next_pos_ = snapshot_->pos_next(curr_pos_);
+			next_pos_ = std::next(curr_pos_);
 		);
 
 		return this->fill_row_at_position(handler, next_pos_);
@@ -600,171 +666,174 @@ public:
 
 	virtual int  rnd_pos(pinba_handler_t *handler, uchar *buf, uchar *pos_bytes) const override
 	{
-		auto const& pos = *(reinterpret_cast<decltype(curr_pos_) const*>(pos_bytes));
-		LOG_DEBUG(P_L_, "snapshot::{0}; snapshot; got {1}", __func__, ff::as_hex_string(str_ref{(char*)&pos, sizeof(pos)}));
+		auto const& pos = *(reinterpret_cast<position_t const*>(pos_bytes));
 		return this->fill_row_at_position(handler, pos);
 	}
 
 	virtual void position(pinba_handler_t *handler, const uchar *record) const override
 	{
-		// FIXME: gcc 4.9 doesn't support std::is_trivially_copyable
-		// static_assert(std::is_trivially_copyable<decltype(curr_pos_)>::value, "must be able to memcpy pos");
-		// LOG_DEBUG(P_L_, "{0}; snapshot; storing {1}", __func__, ff::as_hex_string(str_ref{(char*)&curr_pos_, sizeof(curr_pos_)}));
 		memcpy(handler->ref, &curr_pos_, sizeof(curr_pos_));
-		return;
 	}
 
-	virtual int  info(pinba_handler_t *handler, uint arg) const override
+	virtual int  external_lock(pinba_handler_t *handler, int lock_type) override
 	{
-		LOG_DEBUG(P_L_, "snapshot::{0}; handler: {1}, snapshot: {2}, arg: {3}", __func__, handler, snapshot_.get(), arg);
-		return 0;
-	}
+		if (lock_type == F_UNLCK)
+			this->cleanup_select_data();
 
-	virtual int  extra(pinba_handler_t *handler, enum ha_extra_function operation) override
-	{
-		LOG_DEBUG(P_L_, "snapshot::{0}; handler: {1}, snapshot: {2}, operation: {3}", __func__, handler, snapshot_.get(), operation);
 		return 0;
 	}
 
-	virtual int  external_lock(pinba_handler_t *handler, int lock_type) override
+	virtual int  start_stmt(pinba_handler_t *handler) override
 	{
-		LOG_DEBUG(P_L_, "snapshot::{0}; handler: {1}, snapshot: {2}, lock_type: {3}", __func__, handler, snapshot_.get(), lock_type);
-
-		if (lock_type == F_UNLCK)
-		{
-			this->cleanup_select_data();
-		}
-
+		// under 'lock tables' there is no external_lock(F_UNLCK) between statements
+		this->cleanup_select_data();
 		return 0;
 	}
 
 private:
 
-	int init_for_new_select(pinba_handler_t *handler)
-	try
+	void cleanup_select_data()
 	{
-		share_data_ = meow::make_unique<pinba_share_data_t>();
-
-		{
-			std::lock_guard<std::mutex> lk_(P_CTX_->lock);
-
-			auto const *share = handler->current_share().get();
-			*share_data_ = static_cast<pinba_share_data_t const&>(*share); // a copy
-		}
+		data_.clear();
+		data_.shrink_to_fit();
+		got_data_ = false;
+	}
 
-		LOG_DEBUG(P_L_, "snapshot::{0}; getting snapshot for t: {1}, r: {2}", __func__, share_data_->mysql_name, share_data_->report_name);
+	static void store_str(Field **field, char const *str)
+	{
+		(*field)->set_notnull();
+		(*field)->store(str, strlen(str), &my_charset_bin);
+	}
 
-		snapshot_ = P_E_->get_report_snapshot(share_data_->report_name);
+	int fill_row_at_position(pinba_handler_t *handler, position_t const& row_pos) const
+	{
+		auto const *row   = &(*row_pos);
+		auto       *table = handler->current_table();
 
-		// check if percentile fields are being requested and do not merge histograms if not
+		// mark all fields as writeable to avoid assert() in ::store() calls
+		auto *old_map = dbug_tmp_use_all_columns(table, table->write_set);
+		MEOW_DEFER(
+			dbug_tmp_restore_column_map(table->write_set, old_map);
+		);
 
-		bool const need_percentiles = [&]()
+		for (Field **field = table->field; *field; field++)
 		{
-			unsigned percentile_field_min = 0;
-			unsigned percentile_field_max = 0;
+			unsigned const field_index = (*field)->field_index;
 
-			auto const *view_conf = share_data_->view_conf.get();
+			if (!bitmap_is_set(table->read_set, field_index))
+				continue;
 
-			switch (view_conf->kind)
+			switch (field_index)
 			{
-				case pinba_view_kind::stats:
-				case pinba_view_kind::active_reports:
-					assert(!"must not happen");
-				break;
-
-				case pinba_view_kind::report_by_request_data:
-					percentile_field_min = view_conf->keys.size() + n_data_fields___by_request;
-					percentile_field_max = percentile_field_min + view_conf->percentiles.size();
-				break;
-
-				case pinba_view_kind::report_by_timer_data:
-					percentile_field_min = view_conf->keys.size() + n_data_fields___by_timer;
-					percentile_field_max = percentile_field_min + view_conf->percentiles.size();
-				break;
-
-				case pinba_view_kind::report_by_packet_data:
-					percentile_field_min = view_conf->keys.size() + n_data_fields___by_packet;
-					percentile_field_max = percentile_field_min + view_conf->percentiles.size();
-				break;
+				case 0: store_str(field, row->host);   break;
+				case 1: store_str(field, row->server); break;
+				case 2: store_str(field, row->script); break;
+
+				STORE_FIELD (3, timeval_to_double(row->captured_tv));
+				STORE_FIELD (4, duration_seconds_as_double(row->request_time));
+				STORE_FIELD (5, duration_seconds_as_double(row->ru_utime));
+				STORE_FIELD (6, duration_seconds_as_double(row->ru_stime));
+				STORE_FIELD (7, row->status);
+				STORE_FIELD (8, row->traffic);
+				STORE_FIELD (9, row->mem_used);
+				STORE_FIELD (10, row->sample_rate);
+
+				case 11:
+				{
+					std::string tags;
+					for (uint32_t i = 0; i < row->tag_count; i++)
+						ff::fmt(tags, "{0}{1}={2}", (i > 0) ? "," : "", row->tags[i].name, row->tags[i].value);
 
-				default:
-					assert(!"must not be reached");
+					(*field)->set_notnull();
+					(*field)->store(tags.c_str(), tags.length(), &my_charset_bin);
+				}
 				break;
 			}
+		} // field for
 
-			// check that a percentile field is set for reading
-			auto *table = handler->current_table();
-			for (Field **field = table->field; *field; field++)
-			{
-				unsigned const field_index = (*field)->field_index;
+		return 0;
+	}
+};
 
-				if (!bitmap_is_set(table->read_set, field_index))
-					continue;
+////////////////////////////////////////////////////////////////////////////////////////////////
 
-				if ((field_index >= percentile_field_min) && (field_index < percentile_field_max))
-					return true;
+struct pinba_view___pipeline_latency_t : public pinba_view___base_t
+{
+	using view_t     = std::vector<pipeline_latency_row_t>;
+	using position_t = view_t::const_iterator;
 
-				// raw histogram goes after percentiles
-				if (field_index == percentile_field_max)
-					return true;
-			}
-			return false;
-		}();
+	view_t      data_;
+	position_t  next_pos_; // to read NEXT row, aka rnd_next()
+	position_t  curr_pos_; // last returned row pos, for position()
+
+	virtual int rnd_init(pinba_handler_t *handler, bool scan) override
+	{
+		LOG_DEBUG(P_L_, "latency::{0}; handler: {1}, scan: {2}, got_data: {3}", __func__, handler, scan, !data_.empty());
 
-		// perform snapshot merge, this might take some time
-		// TODO: write this time back to originating report's stats (non-trivial)
+		if (data_.empty())
 		{
-			meow::stopwatch_t sw;
+			// no locks here, histograms are merged under per-thread locks one by one
+			data_ = P_G_->pipeline_latency()->get_rows();
+		}
 
-			report_snapshot_t::merge_flags_t flags = 0;
+		curr_pos_ = data_.begin();
+		next_pos_ = curr_pos_;
 
-			// always want totals, for percent fields
-			flags |= report_snapshot_t::merge_flags::with_totals;
+		return 0;
+	}
 
-			// maybe want histograms if percentile fields are being selected
-			if (need_percentiles)
-				flags |= report_snapshot_t::merge_flags::with_histograms;
+	virtual int rnd_next(pinba_handler_t *handler, uchar *buf) override
+	{
+		if (next_pos_ == data_.end())
+			return HA_ERR_END_OF_FILE;
 
-			snapshot_->prepare(flags);
+		MEOW_DEFER(
+			curr_pos_ = next_pos_;
+			next_pos_ = std::next(curr_pos_);
+		);
 
-			LOG_DEBUG(P_L_, "snapshot::{0}; snapshot for: {1}, prepare (flags: {2}) took {3} seconds ({4} rows)",
-				__func__, share_data_->mysql_name,
-				ff::as_hex(flags),
-				sw.stamp(), snapshot_->row_count());
-		}
+		return this->fill_row_at_position(handler, next_pos_);
+	}
 
-		if (P_L_->does_accept(meow::logging::log_level::debug))
-		{
-			debug_dump_report_snapshot(stderr, snapshot_.get(), share_data_->mysql_name);
-		}
+	virtual unsigned ref_length() const override
+	{
+		return (unsigned)sizeof(curr_pos_);
+	}
 
-		return 0;
+	virtual int  rnd_pos(pinba_handler_t *handler, uchar *buf, uchar *pos_bytes) const override
+	{
+		auto const& pos = *(reinterpret_cast<position_t const*>(pos_bytes));
+		return this->fill_row_at_position(handler, pos);
 	}
-	catch (std::exception const& e)
+
+	virtual void position(pinba_handler_t *handler, const uchar *record) const override
 	{
-		LOG_WARN(P_L_, "snapshot::{0}; internal error: {1}", __func__, e.what());
-		my_printf_error(ER_INTERNAL_ERROR, "[pinba] %s", MYF(0), e.what());
-		return HA_ERR_INTERNAL_ERROR;
+		memcpy(handler->ref, &curr_pos_, sizeof(curr_pos_));
 	}
 
-	void cleanup_select_data()
+	virtual int  external_lock(pinba_handler_t *handler, int lock_type) override
 	{
-		share_data_.reset();
-		snapshot_.reset();
+		if (lock_type == F_UNLCK)
+			data_.clear();
+
+		return 0;
 	}
 
-	int fill_row_at_position(pinba_handler_t *handler, report_snapshot_t::position_t const& row_pos) const
+	virtual int  start_stmt(pinba_handler_t *handler) override
 	{
-		// LOG_DEBUG(P_L_, "snapshot::{0}; snapshot, pos: {1}", __func__, ff::as_hex_string(str_ref{(char*)&row_pos, sizeof(row_pos)}));
+		// under 'lock tables' there is no external_lock(F_UNLCK) between statements
+		data_.clear();
+		return 0;
+	}
 
-		auto *table       = handler->current_table();
-		auto const *rinfo = snapshot_->report_info();
-		auto const key    = snapshot_->get_key_str(row_pos);
+private:
 
-		unsigned const n_key_fields = rinfo->n_key_parts;
+	int fill_row_at_position(pinba_handler_t *handler, position_t const& row_pos) const
+	{
+		auto const *row   = &(*row_pos);
+		auto       *table = handler->current_table();
 
 		// mark all fields as writeable to avoid assert() in ::store() calls
-		// got no idea how to do this properly anyway
 		auto *old_map = dbug_tmp_use_all_columns(table, table->write_set);
 		MEOW_DEFER(
 			dbug_tmp_restore_column_map(table->write_set, old_map);
@@ -773,394 +842,1925 @@ private:
 		for (Field **field = table->field; *field; field++)
 		{
 			unsigned const field_index = (*field)->field_index;
-			unsigned       findex      = field_index;
 
 			if (!bitmap_is_set(table->read_set, field_index))
 				continue;
 
-			// key comes first
+			switch (field_index)
 			{
-				if (findex < n_key_fields)
+				case 0:
 				{
+					str_ref const stage_name = pipeline_stage___name(row->stage);
 					(*field)->set_notnull();
-					(*field)->store(key[findex].begin(), key[findex].c_length(), &my_charset_bin);
-					continue;
+					(*field)->store(stage_name.data(), stage_name.c_length(), &my_charset_bin);
 				}
-				findex -= n_key_fields;
-			}
-
-			// row data comes next
-			if (REPORT_KIND__BY_REQUEST_DATA == rinfo->kind)
-			{
-				constexpr unsigned const n_data_fields = n_data_fields___by_request;
-				if (findex < n_data_fields)
-				{
-					auto const *row    = reinterpret_cast<report_row_data___by_request_t*>(snapshot_->get_data(row_pos));
-					auto const *totals = reinterpret_cast<report_row_data___by_request_t*>(snapshot_->get_data_totals());
+				break;
 
-					switch (findex)
+				case 1:
+					// NULL = all sources of the stage merged
+					if (row->source.empty())
 					{
-						// req_count
-						STORE_FIELD    (0,  row->req_count);
-						STORE_FIELD    (1,  double(row->req_count) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_I(2,  row->req_count, totals->req_count);
-
-						// time_total
-						STORE_FIELD    (3,  duration_seconds_as_double(row->time_total));
-						STORE_FIELD    (4,  duration_seconds_as_double(row->time_total) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_D(5,  row->time_total, totals->time_total);
-
-						// ru_utime
-						STORE_FIELD    (6,  duration_seconds_as_double(row->ru_utime));
-						STORE_FIELD    (7,  duration_seconds_as_double(row->ru_utime) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_D(8,  row->ru_utime, totals->ru_utime);
-
-						// ru_stime
-						STORE_FIELD    (9,  duration_seconds_as_double(row->ru_stime));
-						STORE_FIELD    (10, duration_seconds_as_double(row->ru_stime) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_D(11, row->ru_stime, totals->ru_stime);
-
-						// traffic
-						STORE_FIELD    (12, row->traffic);
-						STORE_FIELD    (13, double(row->traffic) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_I(14, row->traffic, totals->traffic);
-
-						// mem_used
-						STORE_FIELD    (15, row->mem_used);
-						STORE_FIELD    (16, double(row->mem_used) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_I(17, row->mem_used, totals->mem_used);
+						(*field)->set_null();
 					}
+					else
+					{
+						(*field)->set_notnull();
+						(*field)->store(row->source.c_str(), row->source.length(), &my_charset_bin);
+					}
+				break;
 
-					continue;
-				}
-				findex -= n_data_fields;
+				STORE_FIELD (2, row->count);
+				STORE_FIELD (3, duration_seconds_as_double(row->p50));
+				STORE_FIELD (4, duration_seconds_as_double(row->p99));
+				STORE_FIELD (5, duration_seconds_as_double(row->max));
 			}
-			else if (REPORT_KIND__BY_TIMER_DATA == rinfo->kind)
-			{
-				static unsigned const n_data_fields = n_data_fields___by_timer;
-				if (findex < n_data_fields)
-				{
-					auto const *row    = reinterpret_cast<report_row_data___by_timer_t*>(snapshot_->get_data(row_pos));
-					auto const *totals = reinterpret_cast<report_row_data___by_timer_t*>(snapshot_->get_data_totals());
+		} // field for
 
-					switch (findex)
-					{
-						// req_count
-						STORE_FIELD    (0, row->req_count);
-						STORE_FIELD    (1, double(row->req_count) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_I(2, row->req_count, totals->req_count);
-
-						// hit_count
-						STORE_FIELD    (3, row->hit_count);
-						STORE_FIELD    (4, double(row->hit_count) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_I(5, row->hit_count, totals->hit_count);
-
-						// time_total
-						STORE_FIELD    (6, duration_seconds_as_double(row->time_total));
-						STORE_FIELD    (7, duration_seconds_as_double(row->time_total) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_D(8, row->time_total, totals->time_total);
-
-						// ru_utime
-						STORE_FIELD    (9, duration_seconds_as_double(row->ru_utime));
-						STORE_FIELD    (10, duration_seconds_as_double(row->ru_utime) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_D(11, row->ru_utime, totals->ru_utime);
-
-						// ru_stime
-						STORE_FIELD    (12, duration_seconds_as_double(row->ru_stime));
-						STORE_FIELD    (13, duration_seconds_as_double(row->ru_stime) / duration_seconds_as_double(rinfo->time_window));
-						STORE_PERCENT_D(14, row->ru_stime, totals->ru_stime);
-					}
+		return 0;
+	}
+};
 
-					continue;
-				}
-				findex -= n_data_fields;
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct pinba_view___report_snapshot_t : public pinba_view___base_t
+{
+	pinba_share_data_ptr           share_data_; // copied from share
+	report_snapshot_ptr            snapshot_;
+	report_snapshot_t::position_t  next_pos_;   // to fetch NEXT page of rows from, aka rnd_next()
+	report_snapshot_t::position_t  curr_pos_;   // last returned row pos, for position()
+
+	// rnd_next() reads rows page by page, one fetch_rows() call instead of a few virtual calls per row
+	static constexpr uint32_t const fetch_batch_rows = 256;
+	report_snapshot_t::row_batch_t  batch_;
+	size_t                          batch_next_ = 0;
+	std::vector<str_ref>            batch_words_;    // key words of batch_ rows, row-major, resolved through snap_d_ per page
+	uint32_t                        batch_key_parts_ = 0;
+
+	// rows sorted by view_conf->order_metric (and cut to order_limit), iterated instead of snapshot when set
+	std::vector<report_snapshot_t::position_t>  ordered_pos_;
+	size_t                                      ordered_next_;
+	bool                                        ordered_ = false;
+
+	// 'stream' views, snapshot has one key hash partition merged at a time (see report_snapshot_t::prepare_partition())
+	// rnd_next() moves on to the next one when current is read out, rows can't be re-read by position then
+	uint32_t                                    stream_parts_ = 0; // 0 = not streaming, whole snapshot is prepared
+	uint32_t                                    stream_part_  = 0;
+	report_snapshot_t::merge_flags_t            stream_flags_ = 0;
+
+	// fields to fill, from read_set, so that fill_row_at_position() never even looks at columns nobody reads
+	// rebuilt on every rnd_init(), since after filesort read_set for rnd_pos() might differ from the one used for scan
+	struct field_plan_t
+	{
+		enum kind_t : unsigned { key, data, percentile, histogram };
+
+		Field    *field;
+		kind_t    kind;
+		unsigned  index; // within kind, i.e. key part, data field number, percentile number
+	};
+	std::vector<field_plan_t>               fields_plan_;
+	bool                                    fields_plan_needs_hv_ = false; // any percentile or raw histogram field
+
+	// data and percentile columns are described by this, table's own conf, or the one of report rollup table reads
+	pinba_view_conf_ptr                     data_conf_;
+	std::vector<uint32_t>                   rollup_key_parts_; // rollups only, report key part for every table key
+
+	// all percentiles of current row, calculated in one histogram scan on first percentile field
+	mutable std::vector<duration_t>         row_percentiles_;
+
+	// word_id -> word cache, for this select only
+	// the one in snapshot is single threaded, and snapshots can be shared between selects
+	std::unique_ptr<snapshot_dictionary_t>  snap_d_;
+
+	// 1 / seconds covered by snapshot, for *_per_sec fields, 0 when snapshot covers nothing yet (rates are 0 then)
+	double                                  per_sec_mult_ = 0;
+
+	static constexpr unsigned const n_data_fields___by_request = 18;
+	static constexpr unsigned const n_data_fields___by_timer   = 15;
+	static constexpr unsigned const n_data_fields___by_packet  = 7;
+
+	// distinct_count goes right after mem_used fields, only when configured
+	static unsigned n_data_fields___by_request_for(pinba_view_conf_t const *view_conf)
+	{
+		return n_data_fields___by_request + (view_conf->distinct_key.empty() ? 0 : 1);
+	}
+
+public:
+
+	// with 'order by' mysql calls us like this:
+	// rnd_init() is called twice, snapshot is taken and prepared only on the first call
+	//
+	// 1. get the table data for filesort
+	//      extra(HA_EXTRA_IS_ATTACHED_CHILDREN)
+	//      extra(HA_EXTRA_IS_ATTACHED_CHILDREN)
+	//      extra(HA_EXTRA_ADD_CHILDREN_LIST)
+	//      external_lock(F_RDLCK)
+	//      info()
+	//      rnd_init(scan = 1)
+	//      extra(HA_EXTRA_CACHE)
+	//      rnd_next() + position() [...multiple...]
+	//      extra(HA_EXTRA_NO_CACHE)
+	//      rnd_end()
+	//
+	// 2. grab data from the table, using refs (depends on cache size, if it happens at all?)
+	//      rnd_init(scan = 0)
+	//      rnd_end()
+	//      extra(HA_EXTRA_NO_CACHE)
+	//      extra(HA_EXTRA_DETACH_CHILDREN)
+	//      external_lock(F_UNLCK)
+	//      extra(HA_EXTRA_DETACH_CHILDREN)
+
+	// for basic table scan (aka without 'order by'):
+	// 1. just one step here
+	//      extra(HA_EXTRA_IS_ATTACHED_CHILDREN)
+	//      extra(HA_EXTRA_IS_ATTACHED_CHILDREN)
+	//      extra(HA_EXTRA_ADD_CHILDREN_LIST)
+	//      external_lock(F_RDLCK)
+	//      info()
+	//      rnd_init(scan = 1)
+	//      extra(HA_EXTRA_CACHE)
+	//      rnd_next() [...multiple...], there are no calls to position()
+	//      rnd_end()
+	//      extra(HA_EXTRA_NO_CACHE), aka - stop caching comes after ending the scan!
+	//      extra(HA_EXTRA_DETACH_CHILDREN)
+	//      external_lock(F_UNLCK)
+	//      extra(HA_EXTRA_DETACH_CHILDREN)
+
+	// so snapshot lifetime is the statement, not the scan
+	//      one get + prepare per statement, reused by every rnd_init(), rnd_pos() and index_read() in it
+	//      (refs stored in position() must stay valid for rnd_pos() after filesort, so no deallocation on rnd_end())
+	//      and freed on external_lock(F_UNLCK), which comes at the absolute end of select, after all scans/sorts/etc.
+	//      or on start_stmt(), when tables are locked with 'lock tables' and there is no F_UNLCK between statements
+	//
+	//      there was also an implementation, relying on HA_EXTRA_DETACH_CHILDREN, but this seems simpler
+	//
+
+public:
+
+	virtual int rnd_init(pinba_handler_t *handler, bool scan) override
+	{
+		LOG_DEBUG(P_L_, "snapshot::{0}; handler: {1}, scan: {2}, snapshot: {3}", __func__, handler, scan, snapshot_.get());
+
+		if (!snapshot_)
+		{
+			int const r = this->init_for_new_select(handler, scan);
+			if (r != 0)
+				return r;
+		}
+		else
+		{
+			this->build_fields_plan(handler);
+
+			// another scan in the same statement (i.e. join), start over from the first partition
+			if (scan && (stream_parts_ > 0) && (stream_part_ != 0))
+			{
+				int const r = this->stream_partition(0);
+				if (r != 0)
+					return r;
 			}
-			else if (REPORT_KIND__BY_PACKET_DATA == rinfo->kind)
+		}
+
+		curr_pos_ = snapshot_->pos_first();
+		next_pos_ = curr_pos_;
+		ordered_next_ = 0;
+
+		batch_.clear();
+		batch_next_ = 0;
+
+		return 0;
+	}
+
+	virtual int rnd_end(pinba_handler_t *handler) override
+	{
+		LOG_DEBUG(P_L_, "snapshot::{0}; handler: {1}, snapshot: {2}", __func__, handler, snapshot_.get());
+		// nothing to see here, see cleanup_select_data()
+		return 0;
+	}
+
+	virtual int rnd_next(pinba_handler_t *handler, uchar *buf) override
+	{
+		// LOG_DEBUG(P_L_, "snapshot::{0}; handler: {1}, next_pos: {2}", __func__, handler, ff::as_hex_string(str_ref{(char*)&next_pos_, sizeof(next_pos_)}));
+
+		if (ordered_)
+		{
+			if (ordered_next_ >= ordered_pos_.size())
+				return HA_ERR_END_OF_FILE;
+
+			curr_pos_ = ordered_pos_[ordered_next_++];
+			return this->fill_row_at_position(handler, curr_pos_);
+		}
+
+		if (batch_next_ >= batch_.size())
+		{
+			batch_next_ = 0;
+			while (0 == snapshot_->fetch_rows(&next_pos_, snapshot_->pos_last(), fetch_batch_rows, &batch_, fields_plan_needs_hv_))
 			{
-				static unsigned const n_data_fields = n_data_fields___by_packet;
-				if (findex < n_data_fields)
-				{
-					auto const *row = reinterpret_cast<report_row_data___by_packet_t*>(snapshot_->get_data(row_pos));
+				if ((stream_parts_ == 0) || (stream_part_ + 1 >= stream_parts_))
+					return HA_ERR_END_OF_FILE;
 
-					switch (findex)
-					{
-						STORE_FIELD(0, row->req_count);
-						STORE_FIELD(1, row->timer_count);
-						STORE_FIELD(2, duration_seconds_as_double(row->time_total));
-						STORE_FIELD(3, duration_seconds_as_double(row->ru_utime));
-						STORE_FIELD(4, duration_seconds_as_double(row->ru_stime));
-						STORE_FIELD(5, row->traffic);
-						STORE_FIELD(6, row->mem_used);
-					}
+				// current partition is read out (and batch_ with it), free it and merge the next one
+				int const r = this->stream_partition(stream_part_ + 1);
+				if (r != 0)
+					return r;
 
-					continue;
-				}
-				findex -= n_data_fields;
+				next_pos_ = snapshot_->pos_first();
 			}
-			else
+
+			batch_key_parts_ = snapshot_->report_info()->n_key_parts;
+			batch_words_.resize(batch_.size() * batch_key_parts_);
+			snap_d_->get_key_words(batch_.keys.data(), batch_.size(), batch_key_parts_, batch_words_.data());
+		}
+
+		size_t const row = batch_next_++;
+		curr_pos_ = batch_.pos[row];
+
+		void *const *histogram = (fields_plan_needs_hv_) ? &batch_.histograms[row] : nullptr;
+		return this->fill_row(handler, curr_pos_, batch_.keys[row], &batch_words_[row * batch_key_parts_], batch_.data[row], histogram);
+	}
+
+	virtual unsigned ref_length() const override
+	{
+		return (unsigned)sizeof(curr_pos_);
+	}
+
+	virtual int  rnd_pos(pinba_handler_t *handler, uchar *buf, uchar *pos_bytes) const override
+	{
+		auto const& pos = *(reinterpret_cast<decltype(curr_pos_) const*>(pos_bytes));
+		LOG_DEBUG(P_L_, "snapshot::{0}; snapshot; got {1}", __func__, ff::as_hex_string(str_ref{(char*)&pos, sizeof(pos)}));
+
+		// position might be in a partition that is gone already
+		if (stream_parts_ > 0)
+		{
+			my_printf_error(ER_INTERNAL_ERROR, "[pinba] table '%s' streams rows ('stream' option), they can't be re-read by position (i.e. when sorting), select from a table without it",
+				MYF(0), share_data_->mysql_name.c_str());
+			return HA_ERR_INTERNAL_ERROR;
+		}
+
+		return this->fill_row_at_position(handler, pos);
+	}
+
+	virtual void position(pinba_handler_t *handler, const uchar *record) const override
+	{
+		// FIXME: gcc 4.9 doesn't support std::is_trivially_copyable
+		// static_assert(std::is_trivially_copyable<decltype(curr_pos_)>::value, "must be able to memcpy pos");
+		// LOG_DEBUG(P_L_, "{0}; snapshot; storing {1}", __func__, ff::as_hex_string(str_ref{(char*)&curr_pos_, sizeof(curr_pos_)}));
+		memcpy(handler->ref, &curr_pos_, sizeof(curr_pos_));
+		return;
+	}
+
+	virtual int  index_read(pinba_handler_t *handler, uchar *buf, const uchar *key, key_part_map keypart_map, enum ha_rkey_function find_flag) override
+	{
+		if (find_flag != HA_READ_KEY_EXACT)
+			return HA_ERR_WRONG_COMMAND;
+
+		if (!snapshot_)
+		{
+			int const r = this->init_for_new_select(handler, false);
+			if (r != 0)
+				return r;
+		}
+
+		// key might be in any partition, not just the one merged now
+		if (stream_parts_ > 0)
+			return HA_ERR_WRONG_COMMAND;
+
+		TABLE  *table       = handler->current_table();
+		KEY    *key_info    = &table->key_info[handler->active_index];
+		size_t const n_keys = share_data_->view_conf->keys.size();
+
+		// key image -> strings, decoded through fields, so that column types don't matter here
+		// this overwrites key fields in record buffer, that's fine, we're going to fill the row anyway
+		pinba_key_filter_conf_t key_conf;
+
+		uchar const *key_ptr = key;
+		for (uint i = 0; i < key_info->user_defined_key_parts; i++)
+		{
+			KEY_PART_INFO *kp = &key_info->key_part[i];
+
+			uchar const *value_ptr = key_ptr;
+			if (kp->null_bit)
 			{
-				LOG_ERROR(P_L_, "snapshot::{0}; unknown report snapshot data_kind: {1}", __func__, rinfo->kind);
-				// XXX: should we assert here or something?
+				if (*value_ptr)
+					return HA_ERR_KEY_NOT_FOUND; // keys are never NULL
+				value_ptr++;
 			}
 
-			// percentiles
-			// TODO: calculate all required percentiles in one go
-			//       performance testing shows that for short (~100 items) histograms it gives no effect whatsoever
-			//       need to to test for large ones (10k+ items)
-			auto const& percentiles = share_data_->view_conf->percentiles;
+			kp->field->set_key_image(value_ptr, kp->length);
 
-			unsigned const n_percentile_fields = percentiles.size();
-			if (findex < n_percentile_fields)
-			{
-				auto const *hv_conf   = snapshot_->histogram_conf();
-				auto const *histogram = snapshot_->get_histogram(row_pos);
+			String tmp;
+			String const *str = kp->field->val_str(&tmp);
 
-				LOG_DEBUG(P_L_, "snapshot::{0}; histogram: {1}, conf: {{ [{2}, {3}], {4}, {5} }"
-					, __func__, histogram, hv_conf->min_value, hv_conf->max_value, hv_conf->unit_size, hv_conf->precision_bits);
+			key_conf.parts.push_back({ kp->field->field_index, { std::string(str->ptr(), str->length()) } });
 
-				// protect against percentile field in report without percentiles
-				if (histogram != nullptr)
-				{
-					auto const percentile_d = [&]() -> duration_t
-					{
-						// if (HISTOGRAM_KIND__HASHTABLE == rinfo->hv_kind)
-						// {
-						// 	auto const *hv = static_cast<histogram_t const*>(histogram);
-						// 	return get_percentile(*hv, *hv_conf, percentiles[findex]);
-						// }
+			key_ptr += kp->store_length;
+		}
 
-						if (HISTOGRAM_KIND__FLAT == rinfo->hv_kind)
-						{
-							auto const *hv = static_cast<flat_histogram_t const*>(histogram);
-							return get_percentile(*hv, *hv_conf, percentiles[findex]);
-						}
+		report_key_filter_t const kf = report_key_filter_from_conf(key_conf, snapshot_->dictionary());
 
-						if (HISTOGRAM_KIND__HDR == rinfo->hv_kind)
-						{
-							auto const *hv = static_cast<hdr_histogram_t const*>(histogram);
-							return get_percentile(*hv, *hv_conf, percentiles[findex]);
-						}
+		// index parts are in index order, report key is in column order, index covers all keys (see create())
+		std::array<report_key_filter_t::part_t const*, PINBA_LIMIT___MAX_KEY_PARTS> part_for_key = {};
+		for (auto const& part : kf.parts)
+		{
+			if (part.word_ids.empty())
+				return HA_ERR_KEY_NOT_FOUND; // word not in dictionary -> not in any row
 
-						assert(!"must not be reached");
-						return {0};
-					}();
+			part_for_key[part.key_index] = &part;
+		}
 
-					LOG_DEBUG(P_L_, "snapshot::{0}; percentile[{1}] = {2}", __func__, percentiles[findex], percentile_d);
+		for (size_t i = 0; i < n_keys; i++)
+		{
+			if (part_for_key[i] == nullptr)
+				return HA_ERR_WRONG_INDEX;
+		}
 
-					(*field)->set_notnull();
-					(*field)->store(duration_seconds_as_double(percentile_d));
-				}
+		// a word is very rarely in both permanent and regular dictionary, try all candidates
+		// so this is almost always exactly one lookup
+		std::array<size_t, PINBA_LIMIT___MAX_KEY_PARTS> choice = {};
+		while (true)
+		{
+			report_key_t rkey;
+			for (size_t i = 0; i < n_keys; i++)
+				rkey.push_back(part_for_key[i]->word_ids[choice[i]]);
 
-				continue;
+			auto const pos = snapshot_->pos_find(rkey);
+			if (!snapshot_->pos_equal(pos, snapshot_->pos_last()))
+			{
+				curr_pos_ = pos;
+				return this->fill_row_at_position(handler, curr_pos_);
 			}
-			findex -= n_percentile_fields;
 
-			// raw histogram field, if present and if percentiles are enabled
-			unsigned const n_histogram_fields = 1;
-			if (findex < n_histogram_fields)
+			size_t i = 0;
+			for (; i < n_keys; i++)
 			{
-				auto const *histogram = snapshot_->get_histogram(row_pos);
-				if (histogram != nullptr)
-				{
-					auto const hv_data = [&]() -> std::string
-					{
-						std::string result;
+				if (++choice[i] < part_for_key[i]->word_ids.size())
+					break;
+				choice[i] = 0;
+			}
+
+			if (i == n_keys)
+				return HA_ERR_KEY_NOT_FOUND;
+		}
+	}
+
+	virtual int  info(pinba_handler_t *handler, uint arg) const override
+	{
+		LOG_DEBUG(P_L_, "snapshot::{0}; handler: {1}, snapshot: {2}, arg: {3}", __func__, handler, snapshot_.get(), arg);
+
+		if (!(arg & HA_STATUS_VARIABLE))
+			return 0;
+
+		// row count as of last tick, stored by report history, we're not waiting for report thread here (optimizer calls this a lot)
+		report_live_estimates_ptr live_estimates;
+		{
+			std::lock_guard<std::mutex> lk_(P_CTX_->lock);
+			live_estimates = handler->current_share()->live_estimates;
+		}
+
+		if (live_estimates)
+		{
+			uint64_t const row_count = live_estimates->row_count.load(std::memory_order_relaxed);
+			handler->stats.records = std::max<ha_rows>(2, row_count); // 0 and 1 make mysql treat table as const, and read it while optimizing
+		}
+
+		return 0;
+	}
+
+	virtual int  extra(pinba_handler_t *handler, enum ha_extra_function operation) override
+	{
+		LOG_DEBUG(P_L_, "snapshot::{0}; handler: {1}, snapshot: {2}, operation: {3}", __func__, handler, snapshot_.get(), operation);
+		return 0;
+	}
+
+	virtual int  external_lock(pinba_handler_t *handler, int lock_type) override
+	{
+		LOG_DEBUG(P_L_, "snapshot::{0}; handler: {1}, snapshot: {2}, lock_type: {3}", __func__, handler, snapshot_.get(), lock_type);
+
+		if (lock_type == F_UNLCK)
+		{
+			this->cleanup_select_data();
+		}
 
-						uint32_t const hv_min_ms = (rinfo->hv_min_value / d_millisecond).nsec;
-						uint32_t const hv_max_ms = hv_min_ms + ((rinfo->hv_bucket_count * rinfo->hv_bucket_d) / d_millisecond).nsec;
+		return 0;
+	}
+
+	virtual int  start_stmt(pinba_handler_t *handler) override
+	{
+		LOG_DEBUG(P_L_, "snapshot::{0}; handler: {1}, snapshot: {2}", __func__, handler, snapshot_.get());
+
+		// under 'lock tables' there is no external_lock(F_UNLCK) between statements
+		// and every statement must get fresh data (and its own pushed conditions)
+		this->cleanup_select_data();
+		return 0;
+	}
+
+private:
+
+	// scan = select is going to read rows with rnd_next(), it can be streamed then
+	int init_for_new_select(pinba_handler_t *handler, bool scan)
+	try
+	{
+		share_data_ = meow::make_unique<pinba_share_data_t>();
+		data_conf_.reset();
+
+		{
+			std::lock_guard<std::mutex> lk_(P_CTX_->lock);
+
+			auto const *share = handler->current_share().get();
+			*share_data_ = static_cast<pinba_share_data_t const&>(*share); // a copy
+
+			data_conf_ = (share_data_->view_conf->kind == pinba_view_kind::report_rollup)
+					? rollup_source_conf_locked(share_data_->report_name)
+					: share_data_->view_conf;
+		}
+
+		pinba_key_filter_conf_t key_filter_conf = handler->pushed_key_filter();
+
+		if (share_data_->view_conf->kind == pinba_view_kind::report_rollup)
+		{
+			if (!data_conf_)
+				throw std::runtime_error(ff::fmt_str("rollup report '{0}' is not open, select from it first", share_data_->report_name));
+
+			this->resolve_rollup_keys();
+
+			// pushed conditions are on our keys, snapshot is filtered by report keys
+			for (auto& part : key_filter_conf.parts)
+				part.key_index = rollup_key_parts_[part.key_index];
+		}
+
+		// filtered snapshots are never shared (see below), ask for a fresh one right away, and plan fields while it's being taken
+
+		std::future<report_snapshot_ptr> filtered_snapshot;
+		if (!key_filter_conf.empty())
+			filtered_snapshot = P_E_->get_report_snapshot_async(share_data_->report_name);
+
+		// check if percentile fields are being requested and do not merge histograms if not
+		// rows read later with rnd_pos() (i.e. after filesort) will still get their histograms, gathered lazily per row
+		this->build_fields_plan(handler);
+
+		bool const need_percentiles = fields_plan_needs_hv_;
+
+		// percent fields need totals over all partitions right away, rollups and ordered views need all rows
+		uint32_t const stream_parts = (scan
+				&& (share_data_->view_conf->kind != pinba_view_kind::report_rollup)
+				&& (share_data_->view_conf->order_metric == PINBA_VIEW_ORDER__NONE)
+				&& !this->fields_plan_needs_totals())
+			? share_data_->view_conf->stream_partitions
+			: 0;
+
+		// get prepared snapshot, this might take some time, if there is no merged one since last tick
+		// concurrent selects from the same report share it (see coordinator_t::get_prepared_report_snapshot())
+		{
+			meow::stopwatch_t sw;
+
+			report_snapshot_t::merge_flags_t flags = 0;
+
+			// always want totals, for percent fields
+			flags |= report_snapshot_t::merge_flags::with_totals;
+
+			// maybe want histograms if percentile fields are being selected
+			// and make sure report keeps collecting them, if it does that on demand only (see report_stats___hv_collect())
+			if (need_percentiles)
+			{
+				flags |= report_snapshot_t::merge_flags::with_histograms;
+				P_E_->report_hv_wanted(share_data_->report_name);
+			}
+
+			LOG_DEBUG(P_L_, "snapshot::{0}; getting snapshot for t: {1}, r: {2}", __func__, share_data_->mysql_name, share_data_->report_name);
+
+			if (key_filter_conf.empty() && share_data_->live___by_packet && share_data_->report_active && !need_percentiles)
+			{
+				// single row, always up to date, no need to bother coordinator for it (and there are no keys to filter by)
+				snapshot_ = share_data_->live___by_packet->get_snapshot();
+			}
+			else if (key_filter_conf.empty() && (stream_parts == 0))
+			{
+				snapshot_ = P_E_->get_prepared_report_snapshot(share_data_->report_name, flags);
+			}
+			else
+			{
+				// streamed snapshots are not shared either, every select goes through partitions at its own pace
+				snapshot_ = (key_filter_conf.empty())
+					? P_E_->get_report_snapshot(share_data_->report_name)
+					: filtered_snapshot.get();
+
+				// resolve words only now, ticks in snapshot hold references to their words, so ids are stable
+				if (!key_filter_conf.empty())
+					snapshot_->set_key_filter(report_key_filter_from_conf(key_filter_conf, snapshot_->dictionary()));
+
+				if ((stream_parts > 0) && snapshot_->prepare_partition(0, stream_parts, flags))
+				{
+					stream_parts_ = stream_parts;
+					stream_part_  = 0;
+					stream_flags_ = flags;
+				}
+				else
+				{
+					snapshot_->prepare(flags);
+				}
+			}
+
+			// only rolled up rows get to mysql, instead of all of them going to a temporary table for GROUP BY
+			if (share_data_->view_conf->kind == pinba_view_kind::report_rollup)
+				snapshot_ = report_snapshot___rollup(std::move(snapshot_), rollup_key_parts_);
+
+			uint32_t const snap_d_hint = snapshot_dictionary_t::size_hint_for(snapshot_->row_count(), snapshot_->report_info()->n_key_parts);
+			snap_d_ = meow::make_unique<snapshot_dictionary_t>(snapshot_->dictionary(), snap_d_hint);
+
+			// real window, not the configured one, history is not full for a while after start
+			double const covered_sec = duration_seconds_as_double(snapshot_->time_window_covered());
+			per_sec_mult_ = (covered_sec > 0) ? (1.0 / covered_sec) : 0;
+
+			LOG_DEBUG(P_L_, "snapshot::{0}; snapshot for: {1}, prepare (flags: {2}) took {3} seconds ({4} rows)",
+				__func__, share_data_->mysql_name,
+				ff::as_hex(flags),
+				sw.stamp(), snapshot_->row_count());
+		}
+
+		if (share_data_->view_conf->order_metric != PINBA_VIEW_ORDER__NONE)
+		{
+			meow::stopwatch_t sw;
+
+			this->order_rows(share_data_->view_conf.get());
+
+			LOG_DEBUG(P_L_, "snapshot::{0}; snapshot for: {1}, ordering took {2} seconds ({3} rows)",
+				__func__, share_data_->mysql_name, sw.stamp(), ordered_pos_.size());
+		}
+
+		if (P_L_->does_accept(meow::logging::log_level::debug))
+		{
+			debug_dump_report_snapshot(stderr, snapshot_.get(), share_data_->mysql_name);
+		}
+
+		return 0;
+	}
+	catch (std::exception const& e)
+	{
+		LOG_WARN(P_L_, "snapshot::{0}; internal error: {1}", __func__, e.what());
+		my_printf_error(ER_INTERNAL_ERROR, "[pinba] %s", MYF(0), e.what());
+		return HA_ERR_INTERNAL_ERROR;
+	}
+
+	void build_fields_plan(pinba_handler_t *handler)
+	{
+		auto const *view_conf = share_data_->view_conf.get();
+		auto const *data_conf = data_conf_.get();
+		auto       *table     = handler->current_table();
+
+		unsigned const n_key_fields = view_conf->keys.size();
+		unsigned const n_data_fields = [&]() -> unsigned
+		{
+			switch (data_conf->kind)
+			{
+				case pinba_view_kind::report_by_request_data: return n_data_fields___by_request_for(data_conf);
+				case pinba_view_kind::report_by_timer_data:   return n_data_fields___by_timer;
+				case pinba_view_kind::report_by_packet_data:  return n_data_fields___by_packet;
+
+				default:
+					assert(!"must not be reached");
+					return 0;
+			}
+		}();
+		unsigned const n_percentile_fields = data_conf->percentiles.size();
+
+		fields_plan_.clear();
+		fields_plan_needs_hv_ = false;
+
+		for (Field **field = table->field; *field; field++)
+		{
+			unsigned findex = (*field)->field_index;
+
+			if (!bitmap_is_set(table->read_set, findex))
+				continue;
+
+			// key comes first
+			if (findex < n_key_fields)
+			{
+				fields_plan_.push_back(field_plan_t { *field, field_plan_t::key, findex });
+				continue;
+			}
+			findex -= n_key_fields;
+
+			// row data comes next
+			if (findex < n_data_fields)
+			{
+				fields_plan_.push_back(field_plan_t { *field, field_plan_t::data, findex });
+				continue;
+			}
+			findex -= n_data_fields;
+
+			// percentiles
+			if (findex < n_percentile_fields)
+			{
+				fields_plan_.push_back(field_plan_t { *field, field_plan_t::percentile, findex });
+				fields_plan_needs_hv_ = true;
+				continue;
+			}
+			findex -= n_percentile_fields;
+
+			// raw histogram goes after percentiles
+			if (findex == 0)
+			{
+				fields_plan_.push_back(field_plan_t { *field, field_plan_t::histogram, 0 });
+				fields_plan_needs_hv_ = true;
+				continue;
+			}
+		}
+	}
+
+	// conf of the table, that has the report rollup reads (P_CTX_->lock must be held), nullptr if it's not open
+	static pinba_view_conf_ptr rollup_source_conf_locked(std::string const& report_name)
+	{
+		for (auto const& kv : P_CTX_->open_shares)
+		{
+			pinba_share_t const *share = kv.second.get();
+
+			if (share->report_needs_engine && share->view_conf && (share->report_name == report_name))
+				return share->view_conf;
+		}
+		return {};
+	}
+
+	// table keys are matched to report keys by name, every one must be there
+	void resolve_rollup_keys()
+	{
+		auto const& keys     = share_data_->view_conf->keys;
+		auto const& src_keys = data_conf_->keys;
+
+		if ((data_conf_->kind != pinba_view_kind::report_by_request_data) && (data_conf_->kind != pinba_view_kind::report_by_timer_data))
+			throw std::runtime_error(ff::fmt_str("report '{0}' is not a 'request' or 'timer' report, can't roll it up", share_data_->report_name));
+
+		rollup_key_parts_.clear();
+
+		for (auto const& key : keys)
+		{
+			auto const it = std::find(src_keys.begin(), src_keys.end(), key);
+			if (it == src_keys.end())
+				throw std::runtime_error(ff::fmt_str("report '{0}' has no key '{1}'", share_data_->report_name, key));
+
+			rollup_key_parts_.push_back(uint32_t(it - src_keys.begin()));
+		}
+	}
+
+	void cleanup_select_data()
+	{
+		share_data_.reset();
+		data_conf_.reset();
+		rollup_key_parts_.clear();
+		snap_d_.reset(); // before snapshot, words are alive only while snapshot ticks are
+		snapshot_.reset();
+
+		fields_plan_.clear();
+		fields_plan_.shrink_to_fit();
+		fields_plan_needs_hv_ = false;
+
+		ordered_pos_.clear();
+		ordered_pos_.shrink_to_fit();
+		ordered_ = false;
+
+		stream_parts_ = 0;
+		stream_part_  = 0;
+		stream_flags_ = 0;
+	}
+
+	// merge another partition of streamed snapshot, rows (and positions) of the current one are gone after this
+	int stream_partition(uint32_t part)
+	try
+	{
+		meow::stopwatch_t sw;
+
+		snapshot_->prepare_partition(part, stream_parts_, stream_flags_);
+		stream_part_ = part;
+
+		LOG_DEBUG(P_L_, "snapshot::{0}; snapshot for: {1}, partition {2}/{3} took {4} seconds ({5} rows)",
+			__func__, share_data_->mysql_name, part, stream_parts_, sw.stamp(), snapshot_->row_count());
+
+		return 0;
+	}
+	catch (std::exception const& e)
+	{
+		LOG_WARN(P_L_, "snapshot::{0}; internal error: {1}", __func__, e.what());
+		my_printf_error(ER_INTERNAL_ERROR, "[pinba] %s", MYF(0), e.what());
+		return HA_ERR_INTERNAL_ERROR;
+	}
+
+	// any *_percent field in fields plan, those are every third data field of 'request' and 'timer' reports
+	bool fields_plan_needs_totals() const
+	{
+		if (data_conf_->kind == pinba_view_kind::report_by_packet_data)
+			return false;
+
+		for (auto const& fp : fields_plan_)
+		{
+			if ((fp.kind == field_plan_t::data) && (fp.index < n_data_fields___by_request) && ((fp.index % 3) == 2))
+				return true;
+		}
+
+		return false;
+	}
+
+	static int64_t row_order_value(int data_kind, int metric, void const *data)
+	{
+		switch (data_kind)
+		{
+			case REPORT_KIND__BY_REQUEST_DATA:
+			{
+				auto const *row = static_cast<report_row_data___by_request_t const*>(data);
+				switch (metric)
+				{
+					case PINBA_VIEW_ORDER__REQ_COUNT:  return row->req_count;
+					case PINBA_VIEW_ORDER__TIME_TOTAL: return row->time_total.nsec;
+					case PINBA_VIEW_ORDER__RU_UTIME:   return row->ru_utime.nsec;
+					case PINBA_VIEW_ORDER__RU_STIME:   return row->ru_stime.nsec;
+					case PINBA_VIEW_ORDER__TRAFFIC:    return row->traffic;
+					case PINBA_VIEW_ORDER__MEM_USED:   return row->mem_used;
+				}
+			}
+			break;
+
+			case REPORT_KIND__BY_TIMER_DATA:
+			{
+				auto const *row = static_cast<report_row_data___by_timer_t const*>(data);
+				switch (metric)
+				{
+					case PINBA_VIEW_ORDER__REQ_COUNT:  return row->req_count;
+					case PINBA_VIEW_ORDER__HIT_COUNT:  return row->hit_count;
+					case PINBA_VIEW_ORDER__TIME_TOTAL: return row->time_total.nsec;
+					case PINBA_VIEW_ORDER__RU_UTIME:   return row->ru_utime.nsec;
+					case PINBA_VIEW_ORDER__RU_STIME:   return row->ru_stime.nsec;
+				}
+			}
+			break;
+		}
+
+		assert(!"must not be reached, order metric is validated on table create");
+		return 0;
+	}
+
+	// top rows by metric, descending, mysql still sorts whatever we return for 'order by', but that's only order_limit rows now
+	// partial selection, i.e. O(n + k*log(k)), instead of mysql sorting all n rows through rnd_pos()
+	void order_rows(pinba_view_conf_t const *view_conf)
+	{
+		struct item_t
+		{
+			int64_t                        value;
+			report_snapshot_t::position_t  pos;
+		};
+
+		int const data_kind = snapshot_->data_kind();
+
+		std::vector<item_t> items;
+		items.reserve(snapshot_->row_count());
+
+		for (auto pos = snapshot_->pos_first(), end = snapshot_->pos_last(); !snapshot_->pos_equal(pos, end); pos = snapshot_->pos_next(pos))
+			items.push_back(item_t { row_order_value(data_kind, view_conf->order_metric, snapshot_->get_data(pos)), pos });
+
+		auto const greater = [](item_t const& l, item_t const& r) { return l.value > r.value; };
+
+		if ((view_conf->order_limit > 0) && (view_conf->order_limit < items.size()))
+		{
+			std::nth_element(items.begin(), items.begin() + view_conf->order_limit, items.end(), greater);
+			items.resize(view_conf->order_limit);
+		}
+
+		std::sort(items.begin(), items.end(), greater);
+
+		ordered_pos_.clear();
+		ordered_pos_.reserve(items.size());
+		for (auto const& item : items)
+			ordered_pos_.push_back(item.pos);
+
+		ordered_ = true;
+	}
+
+	static report_key_filter_t report_key_filter_from_conf(pinba_key_filter_conf_t const& conf, dictionary_t const *d)
+	{
+		report_key_filter_t result;
+
+		for (auto const& conf_part : conf.parts)
+		{
+			report_key_filter_t::part_t part = {
+				.key_index = conf_part.key_index,
+				.word_ids  = {},
+			};
+
+			for (auto const& value : conf_part.values)
+			{
+				// empty key parts are stored as 0, and are not in dictionary
+				if (value.empty())
+				{
+					part.word_ids.push_back(0);
+					continue;
+				}
+
+				// not found = not in any tick, nothing to add
+				// numbers might also be integer tag values, those are never in dictionary
+				for (uint32_t const word_id : { d->find_word_id(value), d->find_word_id___permanent(value), dictionary_int_words_t::id_from_str(value) })
+				{
+					if (word_id != 0)
+						part.word_ids.push_back(word_id);
+				}
+			}
+
+			std::sort(part.word_ids.begin(), part.word_ids.end());
+			part.word_ids.erase(std::unique(part.word_ids.begin(), part.word_ids.end()), part.word_ids.end());
+
+			result.parts.push_back(std::move(part));
+		}
+
+		return result;
+	}
+
+	int fill_row_at_position(pinba_handler_t *handler, report_snapshot_t::position_t const& row_pos) const
+	{
+		// LOG_DEBUG(P_L_, "snapshot::{0}; snapshot, pos: {1}", __func__, ff::as_hex_string(str_ref{(char*)&row_pos, sizeof(row_pos)}));
+		return this->fill_row(handler, row_pos, snapshot_->get_key(row_pos), nullptr, snapshot_->get_data(row_pos), nullptr);
+	}
+
+	// key_words are resolved key parts, nullptr = resolve through snap_d_ here
+	// prefetched_hv is row histogram from fetch_rows(), nullptr = get it from snapshot, if any field needs it
+	int fill_row(pinba_handler_t *handler, report_snapshot_t::position_t const& row_pos, report_key_t const& key, str_ref const *key_words, void const *row_data, void *const *prefetched_hv) const
+	{
+		auto *table       = handler->current_table();
+		auto const *rinfo = snapshot_->report_info();
+
+		void const *totals_data = snapshot_->get_data_totals();
+
+		// histogram might be gathered lazily for shared snapshots (and that takes a lock), so fetch it once per row
+		void const *histogram        = (prefetched_hv) ? *prefetched_hv : nullptr;
+		bool        histogram_loaded = (prefetched_hv != nullptr);
+		auto const get_histogram = [&]() -> void const*
+		{
+			if (!histogram_loaded)
+			{
+				histogram        = snapshot_->get_histogram(row_pos);
+				histogram_loaded = true;
+			}
+			return histogram;
+		};
+
+		bool percentiles_loaded = false;
+
+		// mark all fields as writeable to avoid assert() in ::store() calls
+		// got no idea how to do this properly anyway
+		auto *old_map = dbug_tmp_use_all_columns(table, table->write_set);
+		MEOW_DEFER(
+			dbug_tmp_restore_column_map(table->write_set, old_map);
+		);
+
+		for (auto const& fp : fields_plan_)
+		{
+			Field *const *field = &fp.field;
+
+			switch (fp.kind)
+			{
+				case field_plan_t::key:
+				{
+					str_ref const word = (key_words) ? key_words[fp.index] : snap_d_->get_word(key[fp.index]);
+
+					(*field)->set_notnull();
+					(*field)->store(word.begin(), word.c_length(), &my_charset_bin);
+				}
+				break;
+
+				case field_plan_t::data:
+				{
+					if (REPORT_KIND__BY_REQUEST_DATA == rinfo->kind)
+					{
+						auto const *row    = static_cast<report_row_data___by_request_t const*>(row_data);
+						auto const *totals = static_cast<report_row_data___by_request_t const*>(totals_data);
+
+						switch (fp.index)
+						{
+							// req_count
+							STORE_FIELD    (0,  row->req_count);
+							STORE_FIELD    (1,  double(row->req_count) * per_sec_mult_);
+							STORE_PERCENT_I(2,  row->req_count, totals->req_count);
+
+							// time_total
+							STORE_FIELD    (3,  duration_seconds_as_double(row->time_total));
+							STORE_FIELD    (4,  duration_seconds_as_double(row->time_total) * per_sec_mult_);
+							STORE_PERCENT_D(5,  row->time_total, totals->time_total);
+
+							// ru_utime
+							STORE_FIELD    (6,  duration_seconds_as_double(row->ru_utime));
+							STORE_FIELD    (7,  duration_seconds_as_double(row->ru_utime) * per_sec_mult_);
+							STORE_PERCENT_D(8,  row->ru_utime, totals->ru_utime);
+
+							// ru_stime
+							STORE_FIELD    (9,  duration_seconds_as_double(row->ru_stime));
+							STORE_FIELD    (10, duration_seconds_as_double(row->ru_stime) * per_sec_mult_);
+							STORE_PERCENT_D(11, row->ru_stime, totals->ru_stime);
+
+							// traffic
+							STORE_FIELD    (12, row->traffic);
+							STORE_FIELD    (13, double(row->traffic) * per_sec_mult_);
+							STORE_PERCENT_I(14, row->traffic, totals->traffic);
+
+							// mem_used
+							STORE_FIELD    (15, row->mem_used);
+							STORE_FIELD    (16, double(row->mem_used) * per_sec_mult_);
+							STORE_PERCENT_I(17, row->mem_used, totals->mem_used);
+
+							// distinct_count, approximate
+							STORE_FIELD    (18, row->distinct_count);
+						}
+					}
+					else if (REPORT_KIND__BY_TIMER_DATA == rinfo->kind)
+					{
+						auto const *row    = static_cast<report_row_data___by_timer_t const*>(row_data);
+						auto const *totals = static_cast<report_row_data___by_timer_t const*>(totals_data);
+
+						switch (fp.index)
+						{
+							// req_count
+							STORE_FIELD    (0, row->req_count);
+							STORE_FIELD    (1, double(row->req_count) * per_sec_mult_);
+							STORE_PERCENT_I(2, row->req_count, totals->req_count);
+
+							// hit_count
+							STORE_FIELD    (3, row->hit_count);
+							STORE_FIELD    (4, double(row->hit_count) * per_sec_mult_);
+							STORE_PERCENT_I(5, row->hit_count, totals->hit_count);
+
+							// time_total
+							STORE_FIELD    (6, duration_seconds_as_double(row->time_total));
+							STORE_FIELD    (7, duration_seconds_as_double(row->time_total) * per_sec_mult_);
+							STORE_PERCENT_D(8, row->time_total, totals->time_total);
+
+							// ru_utime
+							STORE_FIELD    (9, duration_seconds_as_double(row->ru_utime));
+							STORE_FIELD    (10, duration_seconds_as_double(row->ru_utime) * per_sec_mult_);
+							STORE_PERCENT_D(11, row->ru_utime, totals->ru_utime);
+
+							// ru_stime
+							STORE_FIELD    (12, duration_seconds_as_double(row->ru_stime));
+							STORE_FIELD    (13, duration_seconds_as_double(row->ru_stime) * per_sec_mult_);
+							STORE_PERCENT_D(14, row->ru_stime, totals->ru_stime);
+						}
+					}
+					else if (REPORT_KIND__BY_PACKET_DATA == rinfo->kind)
+					{
+						auto const *row = static_cast<report_row_data___by_packet_t const*>(row_data);
+
+						switch (fp.index)
+						{
+							STORE_FIELD(0, row->req_count);
+							STORE_FIELD(1, row->timer_count);
+							STORE_FIELD(2, duration_seconds_as_double(row->time_total));
+							STORE_FIELD(3, duration_seconds_as_double(row->ru_utime));
+							STORE_FIELD(4, duration_seconds_as_double(row->ru_stime));
+							STORE_FIELD(5, row->traffic);
+							STORE_FIELD(6, row->mem_used);
+						}
+					}
+					else
+					{
+						LOG_ERROR(P_L_, "snapshot::{0}; unknown report snapshot data_kind: {1}", __func__, rinfo->kind);
+						// XXX: should we assert here or something?
+					}
+				}
+				break;
+
+				// all percentiles of the row are calculated in one go, on first percentile field
+				case field_plan_t::percentile:
+				{
+					auto const& percentiles = data_conf_->percentiles;
+					auto const *hv_conf     = snapshot_->histogram_conf();
+					auto const *histogram   = get_histogram();
+
+					LOG_DEBUG(P_L_, "snapshot::{0}; histogram: {1}, conf: {{ [{2}, {3}], {4}, {5} }"
+						, __func__, histogram, hv_conf->min_value, hv_conf->max_value, hv_conf->unit_size, hv_conf->precision_bits);
+
+					// protect against percentile field in report without percentiles
+					if (histogram != nullptr)
+					{
+						if (!percentiles_loaded)
+						{
+							row_percentiles_.resize(percentiles.size());
+
+							if (HISTOGRAM_KIND__FLAT == rinfo->hv_kind)
+							{
+								auto const *hv = static_cast<flat_histogram_t const*>(histogram);
+								get_percentiles(*hv, *hv_conf, percentiles.data(), percentiles.size(), row_percentiles_.data());
+							}
+							else if (HISTOGRAM_KIND__HDR == rinfo->hv_kind)
+							{
+								auto const *hv = static_cast<hdr_histogram_t const*>(histogram);
+								get_percentiles(*hv, *hv_conf, percentiles.data(), percentiles.size(), row_percentiles_.data());
+							}
+							else
+							{
+								assert(!"must not be reached");
+								std::fill(row_percentiles_.begin(), row_percentiles_.end(), duration_t{0});
+							}
+
+							percentiles_loaded = true;
+						}
+
+						duration_t const percentile_d = row_percentiles_[fp.index];
+
+						LOG_DEBUG(P_L_, "snapshot::{0}; percentile[{1}] = {2}", __func__, percentiles[fp.index], percentile_d);
+
+						(*field)->set_notnull();
+						(*field)->store(duration_seconds_as_double(percentile_d));
+					}
+				}
+				break;
+
+				// raw histogram field, if present and if percentiles are enabled
+				case field_plan_t::histogram:
+				{
+					auto const *histogram = get_histogram();
+					if (histogram != nullptr)
+					{
+						auto const hv_data = [&]() -> std::string
+						{
+							std::string result;
+
+							uint32_t const hv_min_ms = (rinfo->hv_min_value / d_millisecond).nsec;
+							uint32_t const hv_max_ms = hv_min_ms + ((rinfo->hv_bucket_count * rinfo->hv_bucket_d) / d_millisecond).nsec;
+
+							// log-scale buckets, values are bucket ids, bucket value is ~ (1+acc)^id microseconds
+							if (rinfo->hv_rel_accuracy > 0)
+							{
+								uint32_t const dd_max_ms = (snapshot_->histogram_conf()->max_value / d_millisecond).nsec;
+								ff::fmt(result, "dd={0}:{1}:{2};", rinfo->hv_rel_accuracy * 100, dd_max_ms, rinfo->hv_bucket_count);
+							}
+							else
+							{
+								ff::fmt(result, "hv={0}:{1}:{2};", hv_min_ms, hv_max_ms, rinfo->hv_bucket_count);
+							}
+
+							// values are quantile summary points, not every bucket that got hit
+							if (rinfo->hv_summary_points > 0)
+								ff::fmt(result, "summary={0};", rinfo->hv_summary_points);
+							ff::fmt(result, "values=[");
+
+							// if (HISTOGRAM_KIND__HASHTABLE == rinfo->hv_kind)
+							// {
+							// 	auto const *hv = static_cast<histogram_t const*>(histogram);
+
+							// 	auto const& hv_map = hv->map_cref();
+							// 	for (auto it = hv_map.begin(), it_end = hv_map.end(); it != it_end; ++it)
+							// 	{
+							// 		ff::fmt(result, "{0}{1}:{2}", (hv_map.begin() == it)?"":", ", it->first, it->second);
+							// 	}
+
+							// 	if (hv->negative_inf() > 0)
+							// 		ff::fmt(result, "{0}min:{1}", hv_map.empty() ? "" : ", ", hv->negative_inf());
+
+							// 	if (hv->positive_inf() > 0)
+							// 		ff::fmt(result, "{0}max:{1}", hv_map.empty() ? "" : ", ", hv->positive_inf());
+							// }
+
+							if (HISTOGRAM_KIND__FLAT == rinfo->hv_kind)
+							{
+								auto const *hv = static_cast<flat_histogram_t const*>(histogram);
+
+								auto const& hvalues = hv->values;
+								for (auto it = hvalues.begin(), it_end = hvalues.end(); it != it_end; ++it)
+								{
+									ff::fmt(result, "{0}{1}:{2}", (hvalues.begin() == it)?"":", ", it->bucket_id, it->value);
+								}
+
+								if (hv->negative_inf > 0)
+									ff::fmt(result, "{0}min:{1}", hvalues.empty() ? "" : ", ", hv->negative_inf);
+
+								if (hv->positive_inf > 0)
+									ff::fmt(result, "{0}max:{1}", hvalues.empty() ? "" : ", ", hv->positive_inf);
+							}
+
+							if (HISTOGRAM_KIND__HDR == rinfo->hv_kind)
+							{
+								auto const *hv = static_cast<hdr_histogram_t const*>(histogram);
+
+								bool printed_something = false;
+
+								for (uint32_t i = 0; i < hv->counts_len(); i++)
+								{
+									if (hv->count_at_index(i) == 0)
+										continue;
+
+									ff::fmt(result, "{0}{1}: {2}", (printed_something)?", ":"", hv->value_at_index(i), hv->count_at_index(i));
+									printed_something = true;
+								}
+
+								if (hv->negative_inf() > 0)
+								{
+									ff::fmt(result, "{0}min:{1}", (printed_something)?", ":"", hv->negative_inf());
+									printed_something = true;
+								}
+
+								if (hv->positive_inf() > 0)
+								{
+									ff::fmt(result, "{0}max:{1}", (printed_something)?", ":"", hv->positive_inf());
+									printed_something = true;
+								}
+							}
+
+							ff::fmt(result, "]");
+
+							return result;
+						}();
+
+						(*field)->set_notnull();
+						(*field)->store(hv_data.data(), (uint)hv_data.size(), &my_charset_bin);
+					}
+				}
+				break;
+			}
+		} // loop over projected fields
+
+		return 0;
+	}
+
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// rows read from ticks of a report of another table (not merged), for selected keys
+// RowsT says what rows are and how to get them, see pinba_view___report_series_t, pinba_view___report_exemplars_t
+// columns are: keys, then RowsT::store_field() ones
+template<class RowsT>
+struct pinba_view___report_rows_t : public pinba_view___base_t
+{
+	using row_t      = typename RowsT::row_t;
+	using view_t     = std::vector<row_t>;
+	using position_t = typename view_t::const_iterator;
+
+	pinba_share_data_ptr    share_data_; // copied from share
+	report_snapshot_ptr     snapshot_;   // not prepared, just keeps ticks (and their words) alive
+	view_t                  data_;
+	bool                    got_data_ = false;
+	position_t              next_pos_;   // to read NEXT row, aka rnd_next()
+	position_t              curr_pos_;   // last returned row pos, for position()
+
+	std::unique_ptr<snapshot_dictionary_t>  snap_d_;
+
+	virtual int rnd_init(pinba_handler_t *handler, bool scan) override
+	{
+		LOG_DEBUG(P_L_, "{0}::{1}; handler: {2}, scan: {3}, got_data: {4}", RowsT::name(), __func__, handler, scan, got_data_);
+
+		if (!got_data_)
+		{
+			int const r = this->init_for_new_select(handler);
+			if (r != 0)
+				return r;
+		}
+
+		curr_pos_ = data_.begin();
+		next_pos_ = curr_pos_;
+
+		return 0;
+	}
+
+	virtual int rnd_next(pinba_handler_t *handler, uchar *buf) override
+	{
+		if (next_pos_ == data_.end())
+			return HA_ERR_END_OF_FILE;
+
+		MEOW_DEFER(
+			curr_pos_ = next_pos_;
+			next_pos_ = std::next(curr_pos_);
+		);
+
+		return this->fill_row_at_position(handler, next_pos_);
+	}
+
+	virtual unsigned ref_length() const override
+	{
+		return (unsigned)sizeof(curr_pos_);
+	}
+
+	virtual int  rnd_pos(pinba_handler_t *handler, uchar *buf, uchar *pos_bytes) const override
+	{
+		auto const& pos = *(reinterpret_cast<position_t const*>(pos_bytes));
+		return this->fill_row_at_position(handler, pos);
+	}
+
+	virtual void position(pinba_handler_t *handler, const uchar *record) const override
+	{
+		memcpy(handler->ref, &curr_pos_, sizeof(curr_pos_));
+	}
+
+	virtual int  external_lock(pinba_handler_t *handler, int lock_type) override
+	{
+		if (lock_type == F_UNLCK)
+			this->cleanup_select_data();
+
+		return 0;
+	}
+
+	virtual int  start_stmt(pinba_handler_t *handler) override
+	{
+		// under 'lock tables' there is no external_lock(F_UNLCK) between statements
+		this->cleanup_select_data();
+		return 0;
+	}
+
+private:
+
+	int init_for_new_select(pinba_handler_t *handler)
+	try
+	{
+		share_data_ = meow::make_unique<pinba_share_data_t>();
+
+		{
+			std::lock_guard<std::mutex> lk_(P_CTX_->lock);
+
+			auto const *share = handler->current_share().get();
+			*share_data_ = static_cast<pinba_share_data_t const&>(*share); // a copy
+		}
+
+		meow::stopwatch_t sw;
+
+		// fresh snapshot, never prepared, rows are read from its ticks directly
+		snapshot_ = P_E_->get_report_snapshot(share_data_->report_name);
+
+		report_info_t const *rinfo = snapshot_->report_info();
+		if (rinfo->kind != RowsT::report_kind)
+			throw std::runtime_error(ff::fmt_str("report '{0}' is not a '{1}' report", share_data_->report_name, RowsT::report_kind_name()));
+
+		if (rinfo->n_key_parts != share_data_->view_conf->keys.size())
+		{
+			throw std::runtime_error(ff::fmt_str("report '{0}' has {1} keys, table has {2}",
+				share_data_->report_name, rinfo->n_key_parts, share_data_->view_conf->keys.size()));
+		}
+
+		auto const& key_filter_conf = handler->pushed_key_filter();
+		if (!key_filter_conf.empty())
+			snapshot_->set_key_filter(report_key_filter_from_conf(key_filter_conf, snapshot_->dictionary()));
+
+		pinba_error_t const err = RowsT::get_rows(snapshot_.get(), &data_);
+		if (err)
+			throw std::runtime_error(err.what());
+
+		snap_d_ = meow::make_unique<snapshot_dictionary_t>(snapshot_->dictionary(), snapshot_dictionary_t::size_hint_for(data_.size(), rinfo->n_key_parts));
+		got_data_ = true;
+
+		LOG_DEBUG(P_L_, "{0}::{1}; table: {2}, report: {3}, key filter parts: {4}, got {5} rows in {6} seconds",
+			RowsT::name(), __func__, share_data_->mysql_name, share_data_->report_name, key_filter_conf.parts.size(), data_.size(), sw.stamp());
+
+		return 0;
+	}
+	catch (std::exception const& e)
+	{
+		LOG_WARN(P_L_, "{0}::{1}; internal error: {2}", RowsT::name(), __func__, e.what());
+		my_printf_error(ER_INTERNAL_ERROR, "[pinba] %s", MYF(0), e.what());
+		return HA_ERR_INTERNAL_ERROR;
+	}
+
+	void cleanup_select_data()
+	{
+		data_.clear();
+		data_.shrink_to_fit();
+		got_data_ = false;
+
+		snap_d_.reset(); // before snapshot, words are alive only while snapshot ticks are
+		snapshot_.reset();
+		share_data_.reset();
+	}
+
+	int fill_row_at_position(pinba_handler_t *handler, position_t const& row_pos) const
+	{
+		auto const *row    = &(*row_pos);
+		auto       *table  = handler->current_table();
+
+		unsigned const n_keys = row->key.size();
+
+		// mark all fields as writeable to avoid assert() in ::store() calls
+		auto *old_map = dbug_tmp_use_all_columns(table, table->write_set);
+		MEOW_DEFER(
+			dbug_tmp_restore_column_map(table->write_set, old_map);
+		);
+
+		for (Field **field = table->field; *field; field++)
+		{
+			unsigned const field_index = (*field)->field_index;
+
+			if (!bitmap_is_set(table->read_set, field_index))
+				continue;
+
+			if (field_index < n_keys)
+			{
+				str_ref const word = snap_d_->get_word(row->key[field_index]);
+
+				(*field)->set_notnull();
+				(*field)->store(word.begin(), word.c_length(), &my_charset_bin);
+				continue;
+			}
+
+			RowsT::store_field(field, field_index - n_keys, row, snap_d_.get());
+		} // field for
+
+		return 0;
+	}
+};
+
+// per tick rows of a timer report, see report_snapshot_t::get_series___by_timer()
+// columns are: keys, tick_ago, tick_width, req_count, hit_count, time_total, ru_utime, ru_stime
+struct pinba_view___report_series_rows_t
+{
+	using row_t = report_series_row___by_timer_t;
+
+	static constexpr int report_kind = REPORT_KIND__BY_TIMER_DATA;
+
+	static char const* name()             { return "series"; }
+	static char const* report_kind_name() { return "timer"; }
+
+	static pinba_error_t get_rows(report_snapshot_t *snapshot, std::vector<row_t> *rows)
+	{
+		return snapshot->get_series___by_timer(rows);
+	}
+
+	static void store_field(Field **field, unsigned data_index, row_t const *row, snapshot_dictionary_t *snap_d)
+	{
+		switch (data_index)
+		{
+			STORE_FIELD (0, row->tick_ago);
+			STORE_FIELD (1, row->tick_width);
+			STORE_FIELD (2, row->data.req_count);
+			STORE_FIELD (3, row->data.hit_count);
+			STORE_FIELD (4, duration_seconds_as_double(row->data.time_total));
+			STORE_FIELD (5, duration_seconds_as_double(row->data.ru_utime));
+			STORE_FIELD (6, duration_seconds_as_double(row->data.ru_stime));
+		}
+	}
+};
+using pinba_view___report_series_t = pinba_view___report_rows_t<pinba_view___report_series_rows_t>;
+
+// slowest requests of a request report (with 'exemplars' option), see report_snapshot_t::get_exemplars___by_request()
+// columns are: keys, request_time, hostname, server_name, script_name, status
+struct pinba_view___report_exemplars_rows_t
+{
+	using row_t = report_exemplar_row___by_request_t;
+
+	static constexpr int report_kind = REPORT_KIND__BY_REQUEST_DATA;
+
+	static char const* name()             { return "exemplars"; }
+	static char const* report_kind_name() { return "request"; }
+
+	static pinba_error_t get_rows(report_snapshot_t *snapshot, std::vector<row_t> *rows)
+	{
+		return snapshot->get_exemplars___by_request(rows);
+	}
+
+	static void store_word(Field **field, snapshot_dictionary_t *snap_d, uint32_t word_id)
+	{
+		str_ref const word = snap_d->get_word(word_id);
+
+		(*field)->set_notnull();
+		(*field)->store(word.begin(), word.c_length(), &my_charset_bin);
+	}
+
+	static void store_field(Field **field, unsigned data_index, row_t const *row, snapshot_dictionary_t *snap_d)
+	{
+		switch (data_index)
+		{
+			STORE_FIELD (0, duration_seconds_as_double(row->exemplar.request_time));
+			case 1: store_word(field, snap_d, row->exemplar.host_id); break;
+			case 2: store_word(field, snap_d, row->exemplar.server_id); break;
+			case 3: store_word(field, snap_d, row->exemplar.script_id); break;
+			STORE_FIELD (4, row->exemplar.status);
+		}
+	}
+};
+using pinba_view___report_exemplars_t = pinba_view___report_rows_t<pinba_view___report_exemplars_rows_t>;
+
+
+pinba_view_ptr pinba_view_create(pinba_view_conf_t const& vcf)
+{
+	switch (vcf.kind)
+	{
+		case pinba_view_kind::stats:
+			return meow::make_unique<pinba_view___stats_t>();
+
+		case pinba_view_kind::active_reports:
+			return meow::make_unique<pinba_view___active_reports_t>();
+
+		case pinba_view_kind::pipeline_latency:
+			return meow::make_unique<pinba_view___pipeline_latency_t>();
+
+		case pinba_view_kind::packet_capture:
+			return meow::make_unique<pinba_view___packet_capture_t>();
+
+		case pinba_view_kind::report_by_request_data:
+		case pinba_view_kind::report_by_timer_data:
+		case pinba_view_kind::report_by_packet_data:
+		case pinba_view_kind::report_rollup:
+			return meow::make_unique<pinba_view___report_snapshot_t>();
+
+		case pinba_view_kind::report_by_timer_series:
+			return meow::make_unique<pinba_view___report_series_t>();
+
+		case pinba_view_kind::report_by_request_exemplars:
+			return meow::make_unique<pinba_view___report_exemplars_t>();
+
+		default:
+			assert(!"must not be reached");
+			return {};
+	}
+}
+
+
+pinba_report_ptr pinba_view_report_create(pinba_view_conf_t const& vcf)
+{
+	switch (vcf.kind)
+	{
+		case pinba_view_kind::stats:
+		case pinba_view_kind::active_reports:
+		case pinba_view_kind::pipeline_latency:
+		case pinba_view_kind::report_by_timer_series: // reads other table's report
+		case pinba_view_kind::report_by_request_exemplars:
+		case pinba_view_kind::report_rollup:
+		case pinba_view_kind::packet_capture:
+			return {};
+
+		case pinba_view_kind::report_by_packet_data:
+			return create_report_by_packet(P_G_, *(vcf.get___by_packet()));
+
+		case pinba_view_kind::report_by_request_data:
+			return create_report_by_request(P_G_, *(vcf.get___by_request()));
+
+		case pinba_view_kind::report_by_timer_data:
+			return create_report_by_timer(P_G_, *(vcf.get___by_timer()));
+
+		default:
+			assert(!"must not be reached");
+			return {};
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+pinba_share_t::pinba_share_t(std::string const& table_name)
+{
+	P_CTX_->counters.n_shares++;
+
+	thr_lock_init(&this->lock);
+// XXX: this code is subtly NOT exception safe, if mysql_name assignment throws, thr lock will not be destroyed
+	this->mysql_name          = table_name;
+	this->report_active       = false;
+	this->report_needs_engine = false;
+}
+
+pinba_share_t::~pinba_share_t()
+{
+	thr_lock_delete(&this->lock);
+
+	P_CTX_->counters.n_shares--;
+}
+
+static pinba_share_ptr pinba_share_get_or_create_locked(char const *table_name)
+{
+	// P_CTX_->lock is locked here
+
+	LOG_DEBUG(P_L_, "{0}; table_name: {1}", __func__, table_name);
+
+	auto& open_shares = P_CTX_->open_shares;
+
+	auto const it = open_shares.find(table_name);
+	if (it != open_shares.end())
+		return it->second;
+
+	// share not found, create new one
+
+	auto share = std::make_shared<pinba_share_t>(table_name);
+	open_shares.emplace(share->mysql_name, share);
+
+	return share;
+}
+
+
+static void share_init_with_table_comment_locked(pinba_share_ptr& share, str_ref table_comment)
+{
+	assert(!share->view_conf);
+	assert(!share->report);
+	assert(!share->report_active);
+
+	share->view_conf   = pinba_view_conf_parse(share->mysql_name, table_comment);
+	share->report      = pinba_view_report_create(*share->view_conf);
+
+	if (share->report)
+	{
+		share->report_name         = share->mysql_name;
+		share->report_active       = false;
+		share->report_needs_engine = true;
+		share->live___by_packet    = report_by_packet___get_live(share->report.get()); // stays after activation, unlike report
+		share->live_estimates      = share->report->live_estimates();                    // same
+	}
+	else if ((share->view_conf->kind == pinba_view_kind::report_by_timer_series)
+		|| (share->view_conf->kind == pinba_view_kind::report_by_request_exemplars)
+		|| (share->view_conf->kind == pinba_view_kind::report_rollup))
+	{
+		// report of the table in the same database, report names are mysql table names, as of report creation
+		size_t const pos = share->mysql_name.rfind('/');
+
+		share->report_name         = share->mysql_name.substr(0, (pos == std::string::npos) ? 0 : pos + 1) + share->view_conf->source_report.str();
+		share->report_active       = true;
+		share->report_needs_engine = false;
+	}
+	else
+	{
+		share->report_name = ff::fmt_str("<virtual table: {0}>", pinba_view_kind::enum_as_str_ref(share->view_conf->kind));
+		share->report_active       = true;
+		share->report_needs_engine = false;
+	}
+}
+
+// serve on /metrics, when asked to
+static void share_set_report_metrics(pinba_share_t const *share)
+{
+	pinba_view_conf_t const& vcf = *share->view_conf;
+	if (vcf.metrics_prefix.empty())
+		return;
+
+	auto mconf = std::make_shared<report_metrics_conf_t>();
+	mconf->report_name = share->report_name;
+	mconf->prefix      = vcf.metrics_prefix.str();
+	mconf->percentiles = vcf.percentiles;
+
+	// prometheus label names are [a-zA-Z_][a-zA-Z0-9_]*, strip key sigil (~, +, @) and sanitize the rest
+	for (str_ref const& key : vcf.keys)
+	{
+		std::string name = meow::sub_str_ref(key, 1, key.size()).str();
+		for (char& c : name)
+		{
+			if (!isalnum((unsigned char)c) && (c != '_'))
+				c = '_';
+		}
+		if (name.empty() || isdigit((unsigned char)name[0]))
+			name.insert(0, 1, '_');
+
+		mconf->key_names.push_back(std::move(name));
+	}
+
+	P_E_->set_report_metrics(std::move(mconf));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// table configs, saved to history_dir when report is activated, so that reports can be created
+// at plugin startup (see pinba_reports_precreate()), without waiting for tables to be opened
+// file is: mysql table name, '\n', table comment
+
+#define PINBA_TABLE_CONF_EXTENSION ".table"
+
+static std::string share_table_conf_path(str_ref mysql_name)
+{
+	return report_persist___file_path(P_G_->options()->history_dir, mysql_name, meow::ref_lit(PINBA_TABLE_CONF_EXTENSION));
+}
+
+static pinba_error_t share_table_conf_save(pinba_share_t const *share)
+{
+	if (P_G_->options()->history_dir.empty())
+		return {};
+
+	std::string const path     = share_table_conf_path(share->mysql_name);
+	std::string const tmp_path = path + ".tmp";
+	std::string const content  = share->mysql_name + "\n" + share->view_conf->orig_comment;
+
+	FILE *f = fopen(tmp_path.c_str(), "we");
+	if (!f)
+		return ff::fmt_err("fopen({0}) failed: {1}:{2}", tmp_path, errno, strerror(errno));
+
+	bool const write_ok = (fwrite(content.data(), 1, content.size(), f) == content.size());
+	bool const close_ok = (fclose(f) == 0);
+
+	if (!write_ok || !close_ok || (rename(tmp_path.c_str(), path.c_str()) < 0))
+	{
+		int const saved_errno = errno;
+		unlink(tmp_path.c_str());
+		return ff::fmt_err("can't write {0}: {1}:{2}", path, saved_errno, strerror(saved_errno));
+	}
+
+	return {};
+}
+
+static void share_table_conf_remove(str_ref mysql_name)
+{
+	if (P_G_->options()->history_dir.empty())
+		return;
+
+	std::string const path = share_table_conf_path(mysql_name);
+	if ((unlink(path.c_str()) < 0) && (errno != ENOENT))
+		LOG_WARN(P_L_, "{0}; unlink({1}) failed: {2}:{3}", __func__, path, errno, strerror(errno));
+}
+
+// report has just been added to engine
+static void share_activated_locked(pinba_share_t const *share)
+{
+	// P_CTX_->lock is locked here
+
+	share_set_report_metrics(share);
+
+	pinba_error_t const err = share_table_conf_save(share);
+	if (err)
+		LOG_WARN(P_L_, "{0}; table: {1}, can't save table config: {2}", __func__, share->mysql_name, err.what());
+}
+
+void pinba_reports_precreate()
+{
+	std::string const& history_dir = P_G_->options()->history_dir;
+	if (history_dir.empty())
+		return;
+
+	DIR *dir = opendir(history_dir.c_str());
+	if (!dir)
+	{
+		if (errno != ENOENT)
+			LOG_WARN(P_L_, "{0}; opendir({1}) failed: {2}:{3}", __func__, history_dir, errno, strerror(errno));
+		return;
+	}
+
+	std::vector<std::string> conf_paths;
+	{
+		MEOW_DEFER(
+			closedir(dir);
+		);
+
+		str_ref const extension = meow::ref_lit(PINBA_TABLE_CONF_EXTENSION);
+
+		while (struct dirent *de = readdir(dir))
+		{
+			str_ref const name = { de->d_name, strlen(de->d_name) };
+			if (name.size() <= extension.size() || meow::sub_str_ref(name, name.size() - extension.size(), extension.size()) != extension)
+				continue;
+
+			conf_paths.push_back(history_dir + "/" + name.str());
+		}
+	}
+
+	if (conf_paths.empty())
+		return;
+
+	meow::stopwatch_t sw;
+
+	std::unique_lock<std::mutex> lk_(P_CTX_->lock);
+
+	std::vector<pinba_share_ptr> shares;
+	std::vector<report_ptr>      reports;
+
+	for (auto const& path : conf_paths)
+	{
+		std::string content;
+		{
+			FILE *f = fopen(path.c_str(), "re");
+			if (!f)
+			{
+				LOG_WARN(P_L_, "{0}; fopen({1}) failed: {2}:{3}", __func__, path, errno, strerror(errno));
+				continue;
+			}
+
+			char buf[4096];
+			size_t n;
+			while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+				content.append(buf, n);
+
+			fclose(f);
+		}
+
+		size_t const nl_pos = content.find('\n');
+		if (nl_pos == std::string::npos || nl_pos == 0)
+		{
+			LOG_WARN(P_L_, "{0}; {1}: malformed table config, ignored", __func__, path);
+			continue;
+		}
+
+		std::string const mysql_name = content.substr(0, nl_pos);
+		str_ref const     comment    = meow::sub_str_ref(str_ref { content }, nl_pos + 1, content.size() - nl_pos - 1);
+
+		auto share = pinba_share_get_or_create_locked(mysql_name.c_str());
+		if (share->view_conf)
+			continue;
+
+		try
+		{
+			share_init_with_table_comment_locked(share, comment);
+		}
+		catch (std::exception const& e)
+		{
+			P_CTX_->open_shares.erase(share->mysql_name);
+			LOG_WARN(P_L_, "{0}; {1}: can't parse table config: {2}", __func__, path, e.what());
+			continue;
+		}
+
+		if (!share->report_needs_engine)
+			continue;
+
+		shares.push_back(share);
+		reports.push_back(share->report);
+	}
 
-						ff::fmt(result, "hv={0}:{1}:{2};", hv_min_ms, hv_max_ms, rinfo->hv_bucket_count);
-						ff::fmt(result, "values=[");
+	if (reports.empty())
+		return;
 
-						// if (HISTOGRAM_KIND__HASHTABLE == rinfo->hv_kind)
-						// {
-						// 	auto const *hv = static_cast<histogram_t const*>(histogram);
+	// all reports at once, history is loaded in parallel
+	std::vector<pinba_error_t> const errors = P_E_->add_reports(reports);
 
-						// 	auto const& hv_map = hv->map_cref();
-						// 	for (auto it = hv_map.begin(), it_end = hv_map.end(); it != it_end; ++it)
-						// 	{
-						// 		ff::fmt(result, "{0}{1}:{2}", (hv_map.begin() == it)?"":", ", it->first, it->second);
-						// 	}
+	uint32_t n_created = 0;
 
-						// 	if (hv->negative_inf() > 0)
-						// 		ff::fmt(result, "{0}min:{1}", hv_map.empty() ? "" : ", ", hv->negative_inf());
+	for (size_t i = 0; i < shares.size(); i++)
+	{
+		pinba_share_ptr& share = shares[i];
 
-						// 	if (hv->positive_inf() > 0)
-						// 		ff::fmt(result, "{0}max:{1}", hv_map.empty() ? "" : ", ", hv->positive_inf());
-						// }
+		if (errors[i])
+		{
+			// tables must still be openable, config will be parsed again on open() and activation retried after that
+			LOG_WARN(P_L_, "{0}; table: {1}, can't create report: {2}", __func__, share->mysql_name, errors[i].what());
+			P_CTX_->open_shares.erase(share->mysql_name);
+			continue;
+		}
 
-						if (HISTOGRAM_KIND__FLAT == rinfo->hv_kind)
-						{
-							auto const *hv = static_cast<flat_histogram_t const*>(histogram);
+		share->report.reset(); // do not hold onto the report after activation
+		share->report_active = true;
 
-							auto const& hvalues = hv->values;
-							for (auto it = hvalues.begin(), it_end = hvalues.end(); it != it_end; ++it)
-							{
-								ff::fmt(result, "{0}{1}:{2}", (hvalues.begin() == it)?"":", ", it->bucket_id, it->value);
-							}
+		share_set_report_metrics(share.get());
+		n_created++;
+	}
 
-							if (hv->negative_inf > 0)
-								ff::fmt(result, "{0}min:{1}", hvalues.empty() ? "" : ", ", hv->negative_inf);
+	LOG_NOTICE(P_L_, "{0}; created {1}/{2} reports from table configs in {3}, took {4}",
+		__func__, n_created, reports.size(), history_dir, sw.stamp());
+}
 
-							if (hv->positive_inf > 0)
-								ff::fmt(result, "{0}max:{1}", hvalues.empty() ? "" : ", ", hv->positive_inf);
-						}
+////////////////////////////////////////////////////////////////////////////////////////////////
+// condition pushdown and index lookups, see pinba_handler_t::cond_push() and index_read_map()
 
-						if (HISTOGRAM_KIND__HDR == rinfo->hv_kind)
-						{
-							auto const *hv = static_cast<hdr_histogram_t const*>(histogram);
+// keys are matched by word_id, i.e. byte-wise, so the comparison must be byte-wise as well
+// *_bin collations with PAD SPACE are not, 'a' = 'a ' there
+static bool cond_collation_is_bytewise(CHARSET_INFO const *cs)
+{
+	if (cs == NULL)
+		return false;
 
-							bool printed_something = false;
+	if (cs == &my_charset_bin)
+		return true;
 
-							for (uint32_t i = 0; i < hv->counts_len(); i++)
-							{
-								if (hv->count_at_index(i) == 0)
-									continue;
+#ifdef MY_CS_NOPAD
+	return (cs->state & MY_CS_BINSORT) && (cs->state & MY_CS_NOPAD);
+#else
+	return false;
+#endif
+}
 
-								ff::fmt(result, "{0}{1}: {2}", (printed_something)?", ":"", hv->value_at_index(i), hv->count_at_index(i));
-								printed_something = true;
-							}
+// the only index supported is unique hash over all report key columns, in any order (see index_read_map())
+// lookups are done by word_id, so key columns must compare byte-wise, same as with condition pushdown
+static pinba_error_t share_validate_indexes(pinba_share_t const *share, TABLE const *table)
+{
+	auto const *vcf = share->view_conf.get();
 
-							if (hv->negative_inf() > 0)
-							{
-								ff::fmt(result, "{0}min:{1}", (printed_something)?", ":"", hv->negative_inf());
-								printed_something = true;
-							}
+	for (uint i = 0; i < table->s->keys; i++)
+	{
+		KEY const *key_info = &table->key_info[i];
 
-							if (hv->positive_inf() > 0)
-							{
-								ff::fmt(result, "{0}max:{1}", (printed_something)?", ":"", hv->positive_inf());
-								printed_something = true;
-							}
-						}
+		if ((vcf->kind != pinba_view_kind::report_by_request_data) && (vcf->kind != pinba_view_kind::report_by_timer_data) && (vcf->kind != pinba_view_kind::report_rollup))
+			return ff::fmt_err("indexes are only supported for 'request' and 'timer' reports, and their rollups");
 
-						ff::fmt(result, "]");
+		if (key_info->user_defined_key_parts != vcf->keys.size())
+			return ff::fmt_err("index must cover all {0} key columns, got {1}", vcf->keys.size(), key_info->user_defined_key_parts);
 
-						return result;
-					}();
+		uint32_t seen_mask = 0;
+		for (uint j = 0; j < key_info->user_defined_key_parts; j++)
+		{
+			KEY_PART_INFO const *kp = &key_info->key_part[j];
+			Field const *field      = kp->field;
 
-					(*field)->set_notnull();
-					(*field)->store(hv_data.data(), (uint)hv_data.size(), &my_charset_bin);
-				}
+			if (field->field_index >= vcf->keys.size())
+				return ff::fmt_err("index part {0} is not a key column", j + 1);
 
-				continue;
-			}
-			findex -= n_histogram_fields;
+			if (seen_mask & (1u << field->field_index))
+				return ff::fmt_err("index part {0} uses the same column as some other part", j + 1);
+			seen_mask |= (1u << field->field_index);
 
-		} // loop over all fields
+			if (kp->length != field->key_length())
+				return ff::fmt_err("index part {0} must not be a prefix", j + 1);
 
-		return 0;
+			if (!cond_collation_is_bytewise(field->charset()))
+				return ff::fmt_err("index part {0} column must compare byte-wise, i.e. be varbinary or use *_nopad_bin collation", j + 1);
+		}
 	}
 
-};
+	return {};
+}
 
-pinba_view_ptr pinba_view_create(pinba_view_conf_t const& vcf)
+// key index, if item is a key column of this table, -1 otherwise
+static int cond_key_index(TABLE *table, pinba_view_conf_t const *vcf, Item *item)
 {
-	switch (vcf.kind)
-	{
-		case pinba_view_kind::stats:
-			return meow::make_unique<pinba_view___stats_t>();
+	Item *real = item->real_item();
+	if (real->type() != Item::FIELD_ITEM)
+		return -1;
 
-		case pinba_view_kind::active_reports:
-			return meow::make_unique<pinba_view___active_reports_t>();
+	Field const *field = static_cast<Item_field*>(real)->field;
+	if ((field == NULL) || (field->table != table))
+		return -1;
 
-		case pinba_view_kind::report_by_request_data:
-		case pinba_view_kind::report_by_timer_data:
-		case pinba_view_kind::report_by_packet_data:
-			return meow::make_unique<pinba_view___report_snapshot_t>();
+	if (field->field_index >= vcf->keys.size())
+		return -1;
 
-		default:
-			assert(!"must not be reached");
-			return {};
-	}
+	return (int)field->field_index;
 }
 
-
-pinba_report_ptr pinba_view_report_create(pinba_view_conf_t const& vcf)
+// string literal, compared to a key column
+static bool cond_string_value(Item *item, Field const *field, std::string *result)
 {
-	switch (vcf.kind)
-	{
-		case pinba_view_kind::stats:
-		case pinba_view_kind::active_reports:
-			return {};
+	if (!item->basic_const_item() || (item->result_type() != STRING_RESULT) || item->is_null())
+		return false;
 
-		case pinba_view_kind::report_by_packet_data:
-			return create_report_by_packet(P_G_, *(vcf.get___by_packet()));
+	String tmp;
+	String const *str = item->val_str(&tmp);
+	if (str == NULL)
+		return false;
 
-		case pinba_view_kind::report_by_request_data:
-			return create_report_by_request(P_G_, *(vcf.get___by_request()));
+	// literal is converted to column charset for comparison, can only take it as is when that's a no-op
+	if ((str->charset() != field->charset()) && !str->is_ascii())
+		return false;
 
-		case pinba_view_kind::report_by_timer_data:
-			return create_report_by_timer(P_G_, *(vcf.get___by_timer()));
+	result->assign(str->ptr(), str->length());
+	return true;
+}
 
-		default:
-			assert(!"must not be reached");
-			return {};
+static void cond_collect_key_filter(TABLE *table, pinba_view_conf_t const *vcf, Item *cond, pinba_key_filter_conf_t *kf)
+{
+	// AND-ed conditions restrict keys independently, OR is not supported
+	if (cond->type() == Item::COND_ITEM)
+	{
+		Item_cond *item_cond = static_cast<Item_cond*>(cond);
+		if (item_cond->functype() != Item_func::COND_AND_FUNC)
+			return;
+
+		List_iterator<Item> li(*item_cond->argument_list());
+		while (Item *arg = li++)
+			cond_collect_key_filter(table, vcf, arg, kf);
+
+		return;
 	}
-}
 
-////////////////////////////////////////////////////////////////////////////////////////////////
+	if (cond->type() != Item::FUNC_ITEM)
+		return;
 
-pinba_share_t::pinba_share_t(std::string const& table_name)
-{
-	P_CTX_->counters.n_shares++;
+	Item_func *func = static_cast<Item_func*>(cond);
+	Item     **args = func->arguments();
 
-	thr_lock_init(&this->lock);
-// XXX: this code is subtly NOT exception safe, if mysql_name assignment throws, thr lock will not be destroyed
-	this->mysql_name          = table_name;
-	this->report_active       = false;
-	this->report_needs_engine = false;
-}
+	pinba_key_filter_conf_t::part_t part = {};
 
-pinba_share_t::~pinba_share_t()
-{
-	thr_lock_delete(&this->lock);
+	switch (func->functype())
+	{
+		case Item_func::EQ_FUNC:
+		{
+			if (!cond_collation_is_bytewise(static_cast<Item_func_eq*>(func)->compare_collation()))
+				return;
 
-	P_CTX_->counters.n_shares--;
-}
+			// column on either side
+			int const l_index = cond_key_index(table, vcf, args[0]);
+			int const r_index = cond_key_index(table, vcf, args[1]);
 
-static pinba_share_ptr pinba_share_get_or_create_locked(char const *table_name)
-{
-	// P_CTX_->lock is locked here
+			int const key_index = (l_index >= 0) ? l_index : r_index;
+			if (key_index < 0)
+				return;
 
-	LOG_DEBUG(P_L_, "{0}; table_name: {1}", __func__, table_name);
+			Item *value = (l_index >= 0) ? args[1] : args[0];
+			Field const *field = table->field[key_index];
 
-	auto& open_shares = P_CTX_->open_shares;
+			std::string str;
+			if (!cond_string_value(value, field, &str))
+				return;
 
-	auto const it = open_shares.find(table_name);
-	if (it != open_shares.end())
-		return it->second;
+			part.key_index = key_index;
+			part.values.push_back(std::move(str));
+		}
+		break;
 
-	// share not found, create new one
+		case Item_func::IN_FUNC:
+		{
+			Item_func_in *func_in = static_cast<Item_func_in*>(func);
+			if (func_in->negated)
+				return;
 
-	auto share = std::make_shared<pinba_share_t>(table_name);
-	open_shares.emplace(share->mysql_name, share);
+			if (!cond_collation_is_bytewise(func_in->compare_collation()))
+				return;
 
-	return share;
-}
+			int const key_index = cond_key_index(table, vcf, args[0]);
+			if (key_index < 0)
+				return;
 
+			Field const *field = table->field[key_index];
 
-static void share_init_with_table_comment_locked(pinba_share_ptr& share, str_ref table_comment)
-{
-	assert(!share->view_conf);
-	assert(!share->report);
-	assert(!share->report_active);
+			for (uint i = 1; i < func->argument_count(); i++)
+			{
+				std::string str;
+				if (!cond_string_value(args[i], field, &str))
+					return; // all or nothing, a value we skip here might match
 
-	share->view_conf   = pinba_view_conf_parse(share->mysql_name, table_comment);
-	share->report      = pinba_view_report_create(*share->view_conf);
+				part.values.push_back(std::move(str));
+			}
 
-	if (share->report)
-	{
-		share->report_name         = share->mysql_name;
-		share->report_active       = false;
-		share->report_needs_engine = true;
-	}
-	else
-	{
-		share->report_name = ff::fmt_str("<virtual table: {0}>", pinba_view_kind::enum_as_str_ref(share->view_conf->kind));
-		share->report_active       = true;
-		share->report_needs_engine = false;
+			part.key_index = key_index;
+		}
+		break;
+
+		default:
+			return;
 	}
+
+	kf->parts.push_back(std::move(part));
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1188,6 +2788,11 @@ TABLE* pinba_handler_t::current_table() const
 	return this->table;
 }
 
+pinba_key_filter_conf_t const& pinba_handler_t::pushed_key_filter() const
+{
+	return this->pushed_key_filter_;
+}
+
 int pinba_handler_t::create(const char *table_name, TABLE *table_arg, HA_CREATE_INFO *create_info)
 {
 	DBUG_ENTER(__PRETTY_FUNCTION__);
@@ -1203,6 +2808,13 @@ int pinba_handler_t::create(const char *table_name, TABLE *table_arg, HA_CREATE_
 
 		str_ref const comment = { table_arg->s->comment.str, size_t(table_arg->s->comment.length) };
 		share_init_with_table_comment_locked(share, comment);
+
+		pinba_error_t const err = share_validate_indexes(share.get(), table_arg);
+		if (err)
+		{
+			P_CTX_->open_shares.erase(share->mysql_name);
+			throw std::runtime_error(err.what());
+		}
 	}
 	catch (std::exception const& e)
 	{
@@ -1322,36 +2934,45 @@ int pinba_handler_t::close(void)
 	@see
 	filesort.cc, records.cc, sql_handler.cc, sql_select.cc, sql_table.cc and sql_update.cc
 */
-int pinba_handler_t::rnd_init(bool scan)
+int pinba_handler_t::activate_report_if_needed()
 {
-	DBUG_ENTER(__PRETTY_FUNCTION__);
+	std::unique_lock<std::mutex> lk_(P_CTX_->lock);
 
+	try
 	{
-		std::unique_lock<std::mutex> lk_(P_CTX_->lock);
-
-		try
+		// report not active - might need to activate
+		if (share_->report_needs_engine && !share_->report_active)
 		{
-			// report not active - might need to activate
-			if (share_->report_needs_engine && !share_->report_active)
-			{
-				assert(share_->report);
+			assert(share_->report);
 
-				pinba_error_t const err = P_E_->add_report(share_->report);
-				if (err)
-					throw std::runtime_error(ff::fmt_str("can't activate report: {0}", err.what()));
+			pinba_error_t const err = P_E_->add_report(share_->report);
+			if (err)
+				throw std::runtime_error(ff::fmt_str("can't activate report: {0}", err.what()));
 
-				share_->report.reset(); // do not hold onto the report after activation
-				share_->report_active = true;
-			}
-		}
-		catch (std::exception const& e)
-		{
-			LOG_ERROR(P_L_, "{0}; table: {1}, error: {2}", __func__, share_->mysql_name, e.what());
+			share_->report.reset(); // do not hold onto the report after activation
+			share_->report_active = true;
 
-			my_printf_error(ER_CANT_CREATE_TABLE, "[pinba] THIS IS A BUG, report! %s", MYF(0), e.what());
-			DBUG_RETURN(HA_ERR_INTERNAL_ERROR);
+			share_activated_locked(share_.get());
 		}
-	} // P_CTX_->lock released here
+	}
+	catch (std::exception const& e)
+	{
+		LOG_ERROR(P_L_, "{0}; table: {1}, error: {2}", __func__, share_->mysql_name, e.what());
+
+		my_printf_error(ER_CANT_CREATE_TABLE, "[pinba] THIS IS A BUG, report! %s", MYF(0), e.what());
+		return HA_ERR_INTERNAL_ERROR;
+	}
+
+	return 0;
+}
+
+int pinba_handler_t::rnd_init(bool scan)
+{
+	DBUG_ENTER(__PRETTY_FUNCTION__);
+
+	int const err = this->activate_report_if_needed();
+	if (err != 0)
+		DBUG_RETURN(err);
 
 	// this should be nothrow
 	int const r = pinba_view_->rnd_init(this, scan);
@@ -1359,6 +2980,57 @@ int pinba_handler_t::rnd_init(bool scan)
 	DBUG_RETURN(r);
 }
 
+/**
+	@brief
+	Index scans come instead of rnd_init(), report might need activation here as well.
+*/
+int pinba_handler_t::index_init(uint idx, bool sorted)
+{
+	DBUG_ENTER(__PRETTY_FUNCTION__);
+
+	int const err = this->activate_report_if_needed();
+	if (err != 0)
+		DBUG_RETURN(err);
+
+	active_index = idx;
+
+	DBUG_RETURN(0);
+}
+
+/**
+	@brief
+	Exact lookup by all key columns, at most one row per key.
+	Uses the same snapshot as scans do (it lives until the end of statement), i.e. repeated lookups in joins
+	do not merge anything again, just translate strings to word_ids and do a hashtable lookup.
+*/
+int pinba_handler_t::index_read_map(uchar *buf, const uchar *key, key_part_map keypart_map, enum ha_rkey_function find_flag)
+{
+	DBUG_ENTER(__PRETTY_FUNCTION__);
+
+	int const r = pinba_view_->index_read(this, buf, key, keypart_map, find_flag);
+
+	current_table()->status = (r != 0) ? STATUS_NOT_FOUND : 0;
+
+	DBUG_RETURN(r);
+}
+
+int pinba_handler_t::index_next(uchar *buf)
+{
+	DBUG_ENTER(__PRETTY_FUNCTION__);
+
+	current_table()->status = STATUS_NOT_FOUND;
+	DBUG_RETURN(HA_ERR_END_OF_FILE);
+}
+
+int pinba_handler_t::index_next_same(uchar *buf, const uchar *key, uint keylen)
+{
+	DBUG_ENTER(__PRETTY_FUNCTION__);
+
+	// unique, there is never another row with the same key
+	current_table()->status = STATUS_NOT_FOUND;
+	DBUG_RETURN(HA_ERR_END_OF_FILE);
+}
+
 int pinba_handler_t::rnd_end()
 {
 	DBUG_ENTER(__PRETTY_FUNCTION__);
@@ -1448,6 +3120,19 @@ void pinba_handler_t::position(const uchar *record)
 	DBUG_VOID_RETURN;
 }
 
+ha_rows pinba_handler_t::records_in_range(uint inx, key_range *min_key, key_range *max_key)
+{
+	DBUG_ENTER(__PRETTY_FUNCTION__);
+
+	// whole key equality, single row (or none)
+	if (min_key && max_key && (min_key->length == max_key->length) && (0 == memcmp(min_key->key, max_key->key, min_key->length)))
+		DBUG_RETURN(1);
+
+	// open range, can't be served by hash index, make optimizer prefer anything else
+	DBUG_RETURN(stats.records);
+}
+
+
 /**
 	@brief
 	::info() is used to return information to the optimizer. See my_base.h for
@@ -1513,6 +3198,69 @@ int pinba_handler_t::extra(enum ha_extra_function operation)
 	DBUG_RETURN(r);
 }
 
+int pinba_handler_t::reset()
+{
+	DBUG_ENTER(__PRETTY_FUNCTION__);
+
+	// end of statement, pushed conditions are for that statement only
+	pushed_key_filter_ = {};
+
+	DBUG_RETURN(0);
+}
+
+/**
+	@brief
+	Condition pushdown, called by optimizer before the scan.
+	Equality and IN() on key columns become report_key_filter_t, rows with other keys are not merged into snapshot at all.
+
+	@details
+	Never takes the condition over, it is returned as is, and mysql checks all rows we return,
+	so anything we can't handle exactly (OR, collations, non-literal values) is just not pushed.
+	Can be called multiple times on the same statement, conditions are AND-ed in that case.
+*/
+const COND* pinba_handler_t::cond_push(const COND *cond)
+{
+	DBUG_ENTER(__PRETTY_FUNCTION__);
+
+	pinba_view_conf_ptr vcf;
+	{
+		std::unique_lock<std::mutex> lk_(P_CTX_->lock);
+		vcf = share_->view_conf;
+	}
+
+	if (!vcf)
+		DBUG_RETURN(cond);
+
+	switch (vcf->kind)
+	{
+		case pinba_view_kind::report_by_request_data:
+		case pinba_view_kind::report_by_timer_data:
+		case pinba_view_kind::report_by_timer_series:
+		case pinba_view_kind::report_by_request_exemplars:
+		case pinba_view_kind::report_rollup:
+		case pinba_view_kind::packet_capture:
+			cond_collect_key_filter(current_table(), vcf.get(), const_cast<COND*>(cond), &pushed_key_filter_);
+		break;
+
+		default:
+		break;
+	}
+
+	LOG_DEBUG(P_L_, "{0}; table: {1}, key filter parts: {2}", __func__, share_->mysql_name, pushed_key_filter_.parts.size());
+
+	DBUG_RETURN(cond);
+}
+
+void pinba_handler_t::cond_pop()
+{
+	DBUG_ENTER(__PRETTY_FUNCTION__);
+
+	// don't track which parts came from which push, filtering less is always safe
+	pushed_key_filter_ = {};
+
+	DBUG_VOID_RETURN;
+}
+
 /**
   @brief
   This create a lock on the table. If you are implementing a storage engine
@@ -1539,6 +3287,19 @@ int pinba_handler_t::external_lock(THD*, int lock_type)
 	DBUG_RETURN(r);
 }
 
+/**
+	@brief
+	Called at the start of each statement instead of external_lock(), when tables are locked with 'lock tables'.
+*/
+int pinba_handler_t::start_stmt(THD*, thr_lock_type lock_type)
+{
+	DBUG_ENTER(__PRETTY_FUNCTION__);
+
+	int const r = pinba_view_->start_stmt(this);
+
+	DBUG_RETURN(r);
+}
+
 
 /*
   Called by the database to lock the table. Keep in mind that this
@@ -1575,6 +3336,16 @@ int pinba_handler_t::rename_table(const char *from, const char *to)
 	share->mysql_name = to;
 	open_shares.emplace(share->mysql_name, share);
 
+	// table config is keyed by mysql table name
+	if (share->report_needs_engine && share->report_active)
+	{
+		share_table_conf_remove(from);
+
+		pinba_error_t const err = share_table_conf_save(share.get());
+		if (err)
+			LOG_WARN(P_L_, "{0}; table: {1}, can't save table config: {2}", __func__, share->mysql_name, err.what());
+	}
+
 	LOG_DEBUG(P_L_, "{0}; renamed mysql table '{1}' -> '{2}', internal report_name: '{3}'",
 		__func__, from, to, share->report_name);
 
@@ -1613,6 +3384,8 @@ int pinba_handler_t::delete_table(const char *table_name)
 		}
 	}
 
+	share_table_conf_remove(share->mysql_name);
+
 	LOG_DEBUG(P_L_, "{0}; dropped table '{1}', report '{2}'", __func__, share->mysql_name, share->report_name);
 
 	DBUG_RETURN(0);
@@ -4,12 +4,34 @@
 #include "mysql_engine/pinba_mysql.h"
 #include "mysql_engine/view_conf.h"
 
+#include "pinba/report_by_packet.h"
+
 #ifdef PINBA_USE_MYSQL_SOURCE
 #include <sql/handler.h>
 #else
 #include <mysql/private/handler.h>
 #endif // PINBA_USE_MYSQL_SOURCE
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// simple conditions on key columns, pushed down from WHERE (see pinba_handler_t::cond_push())
+// values are kept as strings, word_ids are resolved when snapshot is taken (see report_key_filter_t)
+
+struct pinba_key_filter_conf_t
+{
+	struct part_t
+	{
+		uint32_t                  key_index;
+		std::vector<std::string>  values;     // empty = nothing matches
+	};
+
+	std::vector<part_t> parts;
+
+	bool empty() const
+	{
+		return parts.empty();
+	}
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // pinba_view_t
 // this object represents a table open in each thread (i.e. this object doesn't need locking)
@@ -32,12 +54,20 @@ struct pinba_view_t : private boost::noncopyable
 	virtual int  info(pinba_handler_t*, uint) const = 0;
 	virtual int  extra(pinba_handler_t*, enum ha_extra_function operation) = 0;
 	virtual int  external_lock(pinba_handler_t*, int) = 0;
+	virtual int  start_stmt(pinba_handler_t*) = 0; // instead of external_lock() under 'lock tables'
+
+	// exact key lookup, see pinba_handler_t::index_read_map()
+	virtual int  index_read(pinba_handler_t*, uchar *buf, const uchar *key, key_part_map keypart_map, enum ha_rkey_function find_flag) = 0;
 };
 using pinba_view_ptr = std::unique_ptr<pinba_view_t>;
 
 pinba_view_ptr      pinba_view_create(pinba_view_conf_t const& conf);
 pinba_report_ptr    pinba_view_report_create(pinba_view_conf_t const& conf);
 
+// creates reports for tables, saved to history_dir on previous runs, call once at plugin startup
+// so that reports collect data (and load history) right away, instead of on first table open
+void                pinba_reports_precreate();
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 // shared table descriptor structure
@@ -56,6 +86,9 @@ struct pinba_share_data_t // intentionally copyable
 	std::string            report_name;          // pinba engine report name (immune to mysql table renames)
 	bool                   report_active;        // has the report (above) been activated with pinba engine?
 	bool                   report_needs_engine;  // if this report exists in pinba engine
+
+	report_live___by_packet_ptr live___by_packet; // by_packet reports, selects read window totals here, see pinba_view___report_snapshot_t
+	report_live_estimates_ptr   live_estimates;   // row count for optimizer, see pinba_handler_t::info()
 };
 using pinba_share_data_ptr = std::unique_ptr<pinba_share_data_t>;
 
@@ -79,10 +112,17 @@ private:
 	pinba_share_ptr share_;      // current-table shared info
 	pinba_view_ptr  pinba_view_; // currently open pinba table wrapper
 
+	pinba_key_filter_conf_t pushed_key_filter_; // from cond_push(), until reset() or cond_pop()
+
 public:
 	pinba_share_ptr current_share() const;
 	TABLE*          current_table() const;
 
+	pinba_key_filter_conf_t const& pushed_key_filter() const;
+
+private:
+	int activate_report_if_needed(); // on first read/index init
+
 public:
 
 	pinba_handler_t(handlerton *hton, TABLE_SHARE *table_arg);
@@ -97,7 +137,7 @@ public:
 		The name of the index type that will be used for display.
 		Don't implement this method unless you really have indexes.
 	*/
-	// const char *index_type(uint inx) { return "HASH"; }
+	const char *index_type(uint inx) { return "HASH"; }
 
 	/** @brief
 		The file extensions.
@@ -115,7 +155,6 @@ public:
 	ulonglong table_flags() const
 	{
 		// HA_REC_NOT_IN_SEQ
-		// HA_FAST_KEY_READ
 		// HA_NO_BLOBS
 		// HA_REQUIRE_PRIMARY_KEY
 		// HA_BINLOG_ROW_CAPABLE
@@ -127,7 +166,12 @@ public:
 			  HA_NO_AUTO_INCREMENT
 			| HA_NO_TRANSACTIONS
 			| HA_REC_NOT_IN_SEQ // must have
+			| HA_FAST_KEY_READ  // rnd_pos() is cheap, makes filesort keep positions instead of full rows
+			                    // so that percentiles are only calculated for rows that get sent to client
 			| HA_BINLOG_STMT_CAPABLE
+#ifdef HA_CAN_TABLE_CONDITION_PUSHDOWN
+			| HA_CAN_TABLE_CONDITION_PUSHDOWN // ask for cond_push() regardless of optimizer_switch
+#endif
 			);
 	}
 
@@ -146,7 +190,8 @@ public:
 	*/
 	ulong index_flags(uint inx, uint part, bool all_parts) const
 	{
-		return 0;
+		// single unique hash index over all report key columns (see create()), exact lookups only
+		return HA_ONLY_WHOLE_INDEX | HA_KEY_SCAN_NOT_ROR;
 	}
 
 	// ulong index_flags(uint inx, uint part, bool all_parts) const
@@ -172,7 +217,7 @@ public:
 		There is no need to implement ..._key_... methods if your engine doesn't
 		support indexes.
 	*/
-	  // uint max_supported_keys()          const { return 2; /* FIXME: add a constant for this */ }
+	uint max_supported_keys()          const { return 1; }
 
 	/** @brief
 		unireg.cc will call this to make sure that the storage engine can handle
@@ -183,7 +228,7 @@ public:
 		There is no need to implement ..._key_... methods if your engine doesn't
 		support indexes.
 	*/
-	// uint max_supported_key_parts()     const { return 1; }
+	uint max_supported_key_parts()     const { return PINBA_LIMIT___MAX_KEY_PARTS; }
 
 	/** @brief
 		unireg.cc will call this to make sure that the storage engine can handle
@@ -194,7 +239,8 @@ public:
 		There is no need to implement ..._key_... methods if your engine doesn't
 		support indexes.
 	*/
-	// uint max_supported_key_length()    const { return 256; }
+	uint max_supported_key_length()      const { return MAX_KEY_LENGTH; }
+	uint max_supported_key_part_length() const { return MAX_KEY_LENGTH; }
 
 	/** @brief
 		Called in test_quick_select to determine if indexes should be used.
@@ -216,9 +262,11 @@ public:
 	// int update_row(const uchar *old_data, uchar *new_data);
 	// int delete_row(const uchar *buf);
 
-	// index stuff
-	// int index_read_map(uchar *buf, const uchar *key, key_part_map keypart_map, enum ha_rkey_function find_flag);
-	// int index_next(uchar *buf);
+	// index stuff, hash index over report keys, i.e. only exact lookups, and no more than one row per key
+	int index_init(uint idx, bool sorted);
+	int index_read_map(uchar *buf, const uchar *key, key_part_map keypart_map, enum ha_rkey_function find_flag);
+	int index_next(uchar *buf);
+	int index_next_same(uchar *buf, const uchar *key, uint keylen);
 	// int index_prev(uchar *buf);
 	// int index_first(uchar *buf);
 	// int index_last(uchar *buf);
@@ -239,10 +287,24 @@ public:
 
 	int info(uint);                                               ///< required
 	int extra(enum ha_extra_function operation);
+	int reset();
+
+	/** @brief
+		Key column equality and IN() conditions are used to skip non-matching rows on snapshot merge.
+		Conditions are never consumed, i.e. the whole one is returned and still checked by mysql for every row.
+	*/
+	const COND *cond_push(const COND *cond);
+	void cond_pop();
 	int external_lock(THD *thd, int lock_type);                   ///< required
+	int start_stmt(THD *thd, thr_lock_type lock_type);
 	// int delete_all_rows(void);
 	// int truncate();
-	// ha_rows records_in_range(uint inx, key_range *min_key, key_range *max_key);
+
+	/** @brief
+		Index is unique over the whole key, and only whole key lookups are supported (see index_flags()),
+		so any range the optimizer asks about is a single row at most.
+	*/
+	ha_rows records_in_range(uint inx, key_range *min_key, key_range *max_key);
 
 	int delete_table(const char *from);
 	int rename_table(const char * from, const char * to);
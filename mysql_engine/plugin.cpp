@@ -3,11 +3,16 @@
 #include "mysql_engine/plugin.h"
 #include "mysql_engine/handler.h"
 
+#include "pinba/block_allocator.h"
+#include "pinba/collector.h"
 #include "pinba/dictionary.h"
+#include "pinba/mem_governor.h"
 
 #include <time.h>   // localtime_r (non-portable include?)
 #include <stdio.h>  // stderr, just in case :-|
 
+#include <meow/str_ref_algo.hpp>
+#include <meow/convert/number_from_string.hpp>
 #include <meow/format/format.hpp>
 #include <meow/format/inserter/as_printf.hpp>
 #include <meow/format/sink/char_buffer.hpp>
@@ -58,52 +63,75 @@ pinba_status_variables_ptr pinba_collect_status_variables()
 
 	// udp
 
-	vars->udp_poll_total        = stats->udp.poll_total;
-	vars->udp_recv_total        = stats->udp.recv_total;
-	vars->udp_recv_eagain       = stats->udp.recv_eagain;
-	vars->udp_recv_bytes        = stats->udp.recv_bytes;
-	vars->udp_recv_packets      = stats->udp.recv_packets;
-	vars->udp_packet_decode_err = stats->udp.packet_decode_err;
-	vars->udp_batch_send_total  = stats->udp.batch_send_total;
-	vars->udp_batch_send_err    = stats->udp.batch_send_err;
-	vars->udp_packet_send_total = stats->udp.packet_send_total;
-	vars->udp_packet_send_err   = stats->udp.packet_send_err;
-
 	{
 		std::lock_guard<std::mutex> lk_(stats->mtx);
 
+		auto const udp = pinba_stats___udp(stats);
+		vars->udp_poll_total        = udp.poll_total;
+		vars->udp_recv_total        = udp.recv_total;
+		vars->udp_recv_eagain       = udp.recv_eagain;
+		vars->udp_recv_bytes        = udp.recv_bytes;
+		vars->udp_recv_packets      = udp.recv_packets;
+		vars->udp_packet_decode_err = udp.packet_decode_err;
+		vars->udp_batch_send_total  = udp.batch_send_total;
+		vars->udp_batch_send_err    = udp.batch_send_err;
+		vars->udp_packet_send_total = udp.packet_send_total;
+		vars->udp_packet_send_err   = udp.packet_send_err;
+		vars->udp_recv_kernel_drops = udp.recv_kernel_drops;
+		vars->udp_recv_gro_segments = udp.recv_gro_segments;
+		vars->mem_governor_packets_sampled = udp.packet_mem_sampled;
+
 		vars->udp_ru_utime = 0;
 		vars->udp_ru_stime = 0;
+		vars->udp_busy_poll_busy = 0;
+		vars->udp_busy_poll_idle = 0;
 
 		for (auto const& curr : stats->collector_threads)
 		{
 			vars->udp_ru_utime += timeval_to_double(curr.ru_utime);
 			vars->udp_ru_stime += timeval_to_double(curr.ru_stime);
+			vars->udp_busy_poll_busy += curr.busy_poll_busy;
+			vars->udp_busy_poll_idle += curr.busy_poll_idle;
 		}
 	}
 
 	// repacker
 
-	vars->repacker_poll_total          = stats->repacker.poll_total;
-	vars->repacker_recv_total          = stats->repacker.recv_total;
-	vars->repacker_recv_eagain         = stats->repacker.recv_eagain;
-	vars->repacker_recv_packets        = stats->repacker.recv_packets;
-	vars->repacker_packet_validate_err = stats->repacker.packet_validate_err;
-	vars->repacker_batch_send_total    = stats->repacker.batch_send_total;
-	vars->repacker_batch_send_by_timer = stats->repacker.batch_send_by_timer;
-	vars->repacker_batch_send_by_size  = stats->repacker.batch_send_by_size;
-
 	{
 		std::lock_guard<std::mutex> lk_(stats->mtx);
 
+		auto const repacker = pinba_stats___repacker(stats);
+		vars->repacker_poll_total          = repacker.poll_total;
+		vars->repacker_recv_total          = repacker.recv_total;
+		vars->repacker_recv_eagain         = repacker.recv_eagain;
+		vars->repacker_recv_packets        = repacker.recv_packets;
+		vars->repacker_packet_validate_err = repacker.packet_validate_err;
+		vars->repacker_packet_prefilter_drop = repacker.packet_prefilter_drop;
+		vars->repacker_packet_ingest_sampled = repacker.packet_ingest_sampled;
+		vars->repacker_packet_summaries = repacker.packet_summaries;
+		vars->repacker_packet_summary_requests = repacker.packet_summary_requests;
+		vars->repacker_batch_send_total    = repacker.batch_send_total;
+		vars->repacker_batch_send_by_timer = repacker.batch_send_by_timer;
+		vars->repacker_batch_send_by_size  = repacker.batch_send_by_size;
+
 		vars->repacker_ru_utime = 0;
 		vars->repacker_ru_stime = 0;
+		vars->repacker_batch_size    = 0;
+		vars->repacker_batch_timeout = 0;
+		vars->repacker_packet_rate   = 0;
 
 		for (auto const& curr : stats->repacker_threads)
 		{
 			vars->repacker_ru_utime += timeval_to_double(curr.ru_utime);
 			vars->repacker_ru_stime += timeval_to_double(curr.ru_stime);
+
+			vars->repacker_batch_size   += curr.batch_size;
+			vars->repacker_batch_timeout = std::max(vars->repacker_batch_timeout, timeval_to_double(timeval_from_duration(curr.batch_timeout)));
+			vars->repacker_packet_rate  += curr.packet_rate;
 		}
+
+		if (!stats->repacker_threads.empty())
+			vars->repacker_batch_size /= stats->repacker_threads.size();
 	}
 
 	// coordinator
@@ -112,6 +140,7 @@ pinba_status_variables_ptr pinba_collect_status_variables()
 	vars->coordinator_batch_send_total = stats->coordinator.batch_send_total;
 	vars->coordinator_batch_send_err   = stats->coordinator.batch_send_err;
 	vars->coordinator_control_requests = stats->coordinator.control_requests;
+	vars->coordinator_batch_send_skipped = stats->coordinator.batch_send_skipped;
 
 	{
 		std::lock_guard<std::mutex> lk_(stats->mtx);
@@ -120,6 +149,60 @@ pinba_status_variables_ptr pinba_collect_status_variables()
 		vars->coordinator_ru_stime = timeval_to_double(stats->coordinator.ru_stime);
 	}
 
+	// federation
+
+	vars->federation_ticks_sent      = stats->federation.ticks_sent;
+	vars->federation_ticks_send_err  = stats->federation.ticks_send_err;
+	vars->federation_ticks_received  = stats->federation.ticks_received;
+	vars->federation_ticks_merge_err = stats->federation.ticks_merge_err;
+
+	vars->packet_capture_packets = stats->packet_capture.packets_captured;
+
+	vars->datagram_capture_datagrams     = stats->datagram_capture.datagrams_captured;
+	vars->datagram_capture_dropped       = stats->datagram_capture.datagrams_dropped;
+	vars->datagram_capture_bytes         = stats->datagram_capture.bytes_written;
+	vars->datagram_capture_files_rotated = stats->datagram_capture.files_rotated;
+
+	vars->snapshot_prewarm_prepared    = stats->snapshot_prewarm.snapshots_prepared;
+	vars->snapshot_prewarm_skipped_mem = stats->snapshot_prewarm.skipped_mem;
+	vars->snapshot_prewarm_hot_reports = stats->snapshot_prewarm.hot_reports;
+	vars->snapshot_prewarm_mem_used    = stats->snapshot_prewarm.mem_used;
+
+	vars->reclaimer_objects_retired = stats->reclaimer.objects_retired;
+	vars->reclaimer_objects_freed   = stats->reclaimer.objects_freed;
+
+	vars->async_log_messages_written = stats->async_log.messages_written;
+	vars->async_log_messages_dropped = stats->async_log.messages_dropped;
+
+	// relay
+
+	vars->relay_batches_sent       = stats->packet_relay.batches_sent;
+	vars->relay_batches_send_err   = stats->packet_relay.batches_send_err;
+	vars->relay_bytes_sent         = stats->packet_relay.bytes_sent;
+	vars->relay_batches_received   = stats->packet_relay.batches_received;
+	vars->relay_batches_decode_err = stats->packet_relay.batches_decode_err;
+	vars->relay_packets_received   = stats->packet_relay.packets_received;
+
+	// nmpa blocks
+
+	{
+		block_allocator_stats_t const bstats = block_allocator___stats();
+		vars->nmpa_blocks_os_bytes          = bstats.os_bytes;
+		vars->nmpa_blocks_in_use_bytes      = bstats.in_use_bytes;
+		vars->nmpa_blocks_cached_bytes      = bstats.cached_bytes;
+		vars->nmpa_blocks_thread_cache_hits = bstats.thread_cache_hits;
+		vars->nmpa_blocks_depot_hits        = bstats.depot_hits;
+		vars->nmpa_blocks_os_allocs         = bstats.os_allocs;
+		vars->nmpa_blocks_hugetlb_fallbacks = bstats.hugetlb_fallbacks;
+	}
+
+	// memory governor (packets sampled are taken with udp stats above)
+
+	vars->mem_governor_stage          = stats->mem_governor.stage;
+	vars->mem_governor_mem_used       = stats->mem_governor.mem_used;
+	vars->mem_governor_stage_changes  = stats->mem_governor.stage_changes;
+	vars->mem_governor_words_rejected = P_G_->dictionary()->words_rejected();
+
 	// dictionary
 
 	{
@@ -133,6 +216,42 @@ pinba_status_variables_ptr pinba_collect_status_variables()
 		vars->dictionary_mem_strings = dmem.strings_bytes;
 	}
 
+	// transient memory
+
+	vars->inflight_mem_raw_batches    = stats->inflight_mem.raw_batches;
+	vars->inflight_mem_packet_batches = stats->inflight_mem.packet_batches;
+
+	{
+		std::lock_guard<std::mutex> lk_(stats->mtx);
+
+		vars->inflight_mem_repacker_dictionaries = 0;
+		for (auto const& curr : stats->repacker_threads)
+			vars->inflight_mem_repacker_dictionaries += curr.dictionary_mem_used;
+	}
+
+	// rates
+
+	{
+		double rates[PINBA_STATS_RATE__COUNT];
+		{
+			std::lock_guard<std::mutex> lk_(stats->mtx);
+			vars->rate_window_sec = stats->rates.rates(rates);
+		}
+
+		vars->udp_recv_packets_per_sec               = rates[PINBA_STATS_RATE__UDP_RECV_PACKETS];
+		vars->udp_recv_bytes_per_sec                 = rates[PINBA_STATS_RATE__UDP_RECV_BYTES];
+		vars->udp_recv_kernel_drops_per_sec          = rates[PINBA_STATS_RATE__UDP_RECV_KERNEL_DROPS];
+		vars->udp_packet_decode_err_per_sec          = rates[PINBA_STATS_RATE__UDP_PACKET_DECODE_ERR];
+		vars->udp_packet_send_err_per_sec            = rates[PINBA_STATS_RATE__UDP_PACKET_SEND_ERR];
+		vars->repacker_recv_packets_per_sec          = rates[PINBA_STATS_RATE__REPACKER_RECV_PACKETS];
+		vars->repacker_packet_validate_err_per_sec   = rates[PINBA_STATS_RATE__REPACKER_PACKET_VALIDATE_ERR];
+		vars->repacker_packet_prefilter_drop_per_sec = rates[PINBA_STATS_RATE__REPACKER_PACKET_PREFILTER_DROP];
+		vars->coordinator_batches_received_per_sec   = rates[PINBA_STATS_RATE__COORDINATOR_BATCHES_RECEIVED];
+		vars->coordinator_batch_send_err_per_sec     = rates[PINBA_STATS_RATE__COORDINATOR_BATCH_SEND_ERR];
+		vars->ru_utime_per_sec                       = rates[PINBA_STATS_RATE__RU_UTIME_USEC] / 1000000.0;
+		vars->ru_stime_per_sec                       = rates[PINBA_STATS_RATE__RU_STIME_USEC] / 1000000.0;
+	}
+
 	// extras
 	auto const extra_str = [&]()
 	{
@@ -147,6 +266,9 @@ pinba_status_variables_ptr pinba_collect_status_variables()
 		ff::fmt(result, "n_repacker_words: {0}, n_repacker_wordslices: {1}\n", (uint64_t)obj.n_repacker_dict_words, (uint64_t)obj.n_repacker_dict_ws);
 		ff::fmt(result, "n_report_snapshots: {0}, n_report_ticks: {1}\n", (uint64_t)obj.n_report_snapshots, (uint64_t)obj.n_report_ticks);
 		ff::fmt(result, "n_coord_requests: {0}\n", (uint64_t)obj.n_coord_requests);
+		ff::fmt(result, "raw_pool_hit: {0}, raw_pool_miss: {1}\n", (uint64_t)obj.raw_pool_hit, (uint64_t)obj.raw_pool_miss);
+		ff::fmt(result, "packet_pool_hit: {0}, packet_pool_miss: {1}\n", (uint64_t)obj.packet_pool_hit, (uint64_t)obj.packet_pool_miss);
+		ff::fmt(result, "tick_arena_pool_hit: {0}, tick_arena_pool_miss: {1}\n", (uint64_t)obj.tick_arena_pool_hit, (uint64_t)obj.tick_arena_pool_miss);
 
 		return result;
 	}();
@@ -164,6 +286,188 @@ pinba_status_variables_ptr pinba_collect_status_variables()
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+// comma separated list of packet fields, aka 'host,server,status' -> PINBA_PERMANENT_FIELD__* flags
+static uint32_t pinba_permanent_fields_from_str(str_ref fields_spec)
+{
+	uint32_t result = 0;
+
+	for (auto const& field_name : meow::split_ex(fields_spec, ","))
+	{
+		if (field_name.empty())
+			continue;
+
+		if (field_name == meow::ref_lit("host"))
+			result |= PINBA_PERMANENT_FIELD__HOST;
+		else if (field_name == meow::ref_lit("server"))
+			result |= PINBA_PERMANENT_FIELD__SERVER;
+		else if (field_name == meow::ref_lit("script"))
+			result |= PINBA_PERMANENT_FIELD__SCRIPT;
+		else if (field_name == meow::ref_lit("schema"))
+			result |= PINBA_PERMANENT_FIELD__SCHEMA;
+		else if (field_name == meow::ref_lit("status"))
+			result |= PINBA_PERMANENT_FIELD__STATUS;
+		else
+			throw std::runtime_error(ff::fmt_str("pinba_permanent_dictionary_fields: unknown field '{0}', expected host, server, script, schema or status", field_name));
+	}
+
+	return result;
+}
+
+// 'auto', 'recv', 'recvmmsg', 'io_uring' or 'af_xdp' -> PINBA_COLLECTOR_BACKEND__*
+static uint32_t pinba_udp_backend_from_str(str_ref backend_name)
+{
+	if (backend_name.empty() || backend_name == meow::ref_lit("auto"))
+		return PINBA_COLLECTOR_BACKEND__AUTO;
+	if (backend_name == meow::ref_lit("recv"))
+		return PINBA_COLLECTOR_BACKEND__RECV;
+	if (backend_name == meow::ref_lit("recvmmsg"))
+		return PINBA_COLLECTOR_BACKEND__RECVMMSG;
+	if (backend_name == meow::ref_lit("io_uring"))
+		return PINBA_COLLECTOR_BACKEND__IO_URING;
+	if (backend_name == meow::ref_lit("af_xdp"))
+		return PINBA_COLLECTOR_BACKEND__AF_XDP;
+
+	throw std::runtime_error(ff::fmt_str("pinba_udp_reader_backend: unknown backend '{0}', expected auto, recv, recvmmsg, io_uring or af_xdp", backend_name));
+}
+
+// 'malloc', 'cached', 'thp' or 'hugetlb' -> PINBA_BLOCK_ALLOCATOR__*
+static uint32_t pinba_block_allocator_from_str(str_ref allocator_name)
+{
+	if (allocator_name.empty() || allocator_name == meow::ref_lit("malloc"))
+		return PINBA_BLOCK_ALLOCATOR__MALLOC;
+	if (allocator_name == meow::ref_lit("cached"))
+		return PINBA_BLOCK_ALLOCATOR__CACHED;
+	if (allocator_name == meow::ref_lit("thp"))
+		return PINBA_BLOCK_ALLOCATOR__THP;
+	if (allocator_name == meow::ref_lit("hugetlb"))
+		return PINBA_BLOCK_ALLOCATOR__HUGETLB;
+
+	throw std::runtime_error(ff::fmt_str("pinba_nmpa_block_allocator: unknown allocator '{0}', expected malloc, cached, thp or hugetlb", allocator_name));
+}
+
+// cpu list in linux cpuset format, i.e. '0-3,8,10-11' -> cpu ids, empty = no affinity
+static pinba_cpu_list_t pinba_cpu_list_from_str(char const *var_name, char const *cpu_list_sz)
+{
+	pinba_cpu_list_t result;
+
+	if (!cpu_list_sz)
+		return result;
+
+	str_ref const cpu_list_spec = { cpu_list_sz, strlen(cpu_list_sz) };
+
+	for (auto const& item : meow::split_ex(cpu_list_spec, ","))
+	{
+		if (item.empty())
+			continue;
+
+		auto const range_v = meow::split_ex(item, "-");
+		if (range_v.size() > 2)
+			throw std::runtime_error(ff::fmt_str("pinba_{0}: bad cpu range '{1}', expected <cpu> or <from>-<to>", var_name, item));
+
+		uint32_t cpu_from;
+		if (!meow::number_from_string(&cpu_from, range_v[0]))
+			throw std::runtime_error(ff::fmt_str("pinba_{0}: can't parse cpu id from '{1}'", var_name, item));
+
+		uint32_t cpu_to = cpu_from;
+		if ((range_v.size() == 2) && !meow::number_from_string(&cpu_to, range_v[1]))
+			throw std::runtime_error(ff::fmt_str("pinba_{0}: can't parse cpu id from '{1}'", var_name, item));
+
+		if (cpu_from > cpu_to || cpu_to >= 4096)
+			throw std::runtime_error(ff::fmt_str("pinba_{0}: bad cpu range '{1}', expected from <= to < 4096", var_name, item));
+
+		for (uint32_t cpu = cpu_from; cpu <= cpu_to; cpu++)
+			result.push_back(cpu);
+	}
+
+	return result;
+}
+
+// '' = inherit, 'nice:<-20..19>', 'fifo:<1..99>' or 'rr:<1..99>'
+static pinba_thread_sched_t pinba_thread_sched_from_str(char const *var_name, char const *sched_sz)
+{
+	pinba_thread_sched_t result;
+
+	if (!sched_sz || !*sched_sz)
+		return result;
+
+	str_ref const sched_spec = { sched_sz, strlen(sched_sz) };
+
+	auto const v = meow::split_ex(sched_spec, ":");
+	if (v.size() != 2)
+		throw std::runtime_error(ff::fmt_str("pinba_{0}: bad value '{1}', expected nice:<prio>, fifo:<prio> or rr:<prio>", var_name, sched_spec));
+
+	int min_prio, max_prio;
+
+	if (v[0] == meow::ref_lit("nice"))
+	{
+		result.policy = PINBA_THREAD_SCHED__NICE;
+		min_prio = -20;
+		max_prio = 19;
+	}
+	else if (v[0] == meow::ref_lit("fifo"))
+	{
+		result.policy = PINBA_THREAD_SCHED__FIFO;
+		min_prio = 1;
+		max_prio = 99;
+	}
+	else if (v[0] == meow::ref_lit("rr"))
+	{
+		result.policy = PINBA_THREAD_SCHED__RR;
+		min_prio = 1;
+		max_prio = 99;
+	}
+	else
+	{
+		throw std::runtime_error(ff::fmt_str("pinba_{0}: unknown policy '{1}', expected nice, fifo or rr", var_name, v[0]));
+	}
+
+	if (!meow::number_from_string(&result.priority, v[1]))
+		throw std::runtime_error(ff::fmt_str("pinba_{0}: can't parse priority from '{1}'", var_name, v[1]));
+
+	if (result.priority < min_prio || result.priority > max_prio)
+		throw std::runtime_error(ff::fmt_str("pinba_{0}: {1} priority must be in [{2}, {3}], got {4}", var_name, v[0], min_prio, max_prio, result.priority));
+
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// SHOW ENGINE PINBA STATUS, the way innodb does it, a single row with human readable text
+
+static bool pinba_show_status(handlerton *hton, THD *thd, stat_print_fn *print, enum ha_stat_type stat_type)
+{
+	if (stat_type != HA_ENGINE_STATUS)
+		return false;
+
+	auto const vars = pinba_collect_status_variables();
+
+	std::string result;
+	ff::fmt(result, "memory in flight (read from network, not aggregated yet)\n");
+	ff::fmt(result, "  raw_batches: {0}\n", vars->inflight_mem_raw_batches);
+	ff::fmt(result, "  packet_batches: {0}\n", vars->inflight_mem_packet_batches);
+	ff::fmt(result, "  repacker_dictionaries: {0}\n", vars->inflight_mem_repacker_dictionaries);
+	ff::fmt(result, "  total: {0}\n", vars->inflight_mem_raw_batches + vars->inflight_mem_packet_batches + vars->inflight_mem_repacker_dictionaries);
+	ff::fmt(result, "memory governor (stage: {0})\n", mem_governor___stage_name(vars->mem_governor_stage));
+	ff::fmt(result, "  used: {0}, limit: {1}, stage_changes: {2}\n",
+		vars->mem_governor_mem_used, P_G_->options()->mem_governor_max, vars->mem_governor_stage_changes);
+	ff::fmt(result, "  packets_sampled: {0}, words_rejected: {1}\n",
+		vars->mem_governor_packets_sampled, vars->mem_governor_words_rejected);
+	ff::fmt(result, "nmpa blocks ({0})\n", block_allocator___mode_name(block_allocator___stats().mode));
+	ff::fmt(result, "  os: {0}, in_use: {1}, cached: {2}\n",
+		vars->nmpa_blocks_os_bytes, vars->nmpa_blocks_in_use_bytes, vars->nmpa_blocks_cached_bytes);
+	ff::fmt(result, "  thread_cache_hits: {0}, depot_hits: {1}, os_allocs: {2}, hugetlb_fallbacks: {3}\n",
+		vars->nmpa_blocks_thread_cache_hits, vars->nmpa_blocks_depot_hits, vars->nmpa_blocks_os_allocs, vars->nmpa_blocks_hugetlb_fallbacks);
+	ff::fmt(result, "dictionary\n");
+	ff::fmt(result, "  words: {0}, hash: {1}, list: {2}, strings: {3}\n",
+		vars->dictionary_size, vars->dictionary_mem_hash, vars->dictionary_mem_list, vars->dictionary_mem_strings);
+	ff::fmt(result, "objects\n");
+	result.append(vars->extra);
+
+	str_ref const type = meow::ref_lit("pinba");
+	return print(thd, type.data(), type.size(), "", 0, result.c_str(), result.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
 static int pinba_engine_init(void *p)
 {
 	DBUG_ENTER(__func__);
@@ -266,6 +570,15 @@ static int pinba_engine_init(void *p)
 
 	try
 	{
+		char const *permanent_fields_sz = pinba_variables()->permanent_dictionary_fields;
+		str_ref const permanent_fields_spec = (permanent_fields_sz) ? str_ref { permanent_fields_sz, strlen(permanent_fields_sz) } : str_ref {};
+
+		char const *udp_backend_sz = pinba_variables()->udp_reader_backend;
+		str_ref const udp_backend_name = (udp_backend_sz) ? str_ref { udp_backend_sz, strlen(udp_backend_sz) } : str_ref {};
+
+		char const *block_allocator_sz = pinba_variables()->nmpa_block_allocator;
+		str_ref const block_allocator_name = (block_allocator_sz) ? str_ref { block_allocator_sz, strlen(block_allocator_sz) } : str_ref {};
+
 		// TODO: take more values from global mysql config (aka pinba_variables)
 		static pinba_options_t options = {
 			.net_address              = pinba_variables()->address,
@@ -287,6 +600,84 @@ static int pinba_engine_init(void *p)
 
 			.packet_debug             = (bool)pinba_variables()->packet_debug,
 			.packet_debug_fraction    = pinba_variables()->packet_debug_fraction,
+
+			.snapshot_merge_threads   = pinba_variables()->snapshot_merge_threads,
+			.tick_finalize_threads    = pinba_variables()->tick_finalize_threads,
+
+			.permanent_dictionary_fields = pinba_permanent_fields_from_str(permanent_fields_spec),
+			.dictionary_shards        = pinba_variables()->dictionary_shards,
+
+			.udp_backend              = pinba_udp_backend_from_str(udp_backend_name),
+			.udp_xdp_interface        = (pinba_variables()->udp_reader_xdp_interface) ? pinba_variables()->udp_reader_xdp_interface : "",
+			.packet_wire_decoder      = (bool)pinba_variables()->packet_wire_decoder,
+
+			.udp_cpus                 = pinba_cpu_list_from_str("udp_reader_cpus", pinba_variables()->udp_reader_cpus),
+			.repacker_cpus            = pinba_cpu_list_from_str("repacker_cpus", pinba_variables()->repacker_cpus),
+			.relay_cpus               = pinba_cpu_list_from_str("relay_cpus", pinba_variables()->relay_cpus),
+			.report_cpus              = pinba_cpu_list_from_str("report_cpus", pinba_variables()->report_cpus),
+			.udp_cpu_steering         = (bool)pinba_variables()->udp_reader_cpu_steering,
+
+			.udp_rcvbuf_traffic_mb    = pinba_variables()->udp_reader_rcvbuf_traffic_mb,
+			.udp_rcvbuf_time          = pinba_variables()->udp_reader_rcvbuf_time_ms * d_millisecond,
+
+			.pipeline_rings           = (bool)pinba_variables()->pipeline_rings,
+
+			.udp_busy_poll_spins      = pinba_variables()->udp_reader_busy_poll_spins,
+			.udp_busy_poll_usec       = pinba_variables()->udp_reader_busy_poll_usec,
+			.udp_gro                  = (bool)pinba_variables()->udp_reader_gro,
+
+			.repacker_dictionary_reap_words = pinba_variables()->repacker_dictionary_reap_words,
+			.repacker_dictionary_prefetch   = pinba_variables()->repacker_dictionary_prefetch,
+			.repacker_columnar_batches      = (bool)pinba_variables()->repacker_columnar_batches,
+
+			.report_fuse_max          = pinba_variables()->report_fuse_max,
+			.report_executor_threads  = pinba_variables()->report_executor_threads,
+			.relay_threads            = pinba_variables()->relay_threads,
+			.report_tick_stagger      = pinba_variables()->report_tick_stagger_ms * d_millisecond,
+			.report_overload_lag      = pinba_variables()->report_overload_lag_ms * d_millisecond,
+			.report_max_mem_total     = uint64_t(pinba_variables()->report_max_mem_total_mb) * 1024 * 1024,
+			.mem_governor_max         = uint64_t(pinba_variables()->mem_governor_max_mb) * 1024 * 1024,
+
+			.export_socket_path       = (pinba_variables()->export_socket) ? pinba_variables()->export_socket : "",
+			.export_address           = (pinba_variables()->export_address) ? pinba_variables()->export_address : "",
+			.export_port              = (pinba_variables()->export_port > 0) ? ff::write_str(pinba_variables()->export_port) : "",
+			.gather_nodes             = (pinba_variables()->gather_nodes) ? pinba_variables()->gather_nodes : "",
+			.metrics_address          = (pinba_variables()->metrics_address) ? pinba_variables()->metrics_address : "",
+			.metrics_port             = (pinba_variables()->metrics_port > 0) ? ff::write_str(pinba_variables()->metrics_port) : "",
+
+			.repacker_batch_latency_target = pinba_variables()->repacker_batch_latency_target_ms * d_millisecond,
+			.repacker_batch_fill_target    = pinba_variables()->repacker_batch_fill_target_pct / 100.0,
+
+			.history_dir              = (pinba_variables()->history_dir) ? pinba_variables()->history_dir : "",
+
+			.federation_upstream      = (pinba_variables()->federation_upstream) ? pinba_variables()->federation_upstream : "",
+			.federation_listen        = (pinba_variables()->federation_listen) ? pinba_variables()->federation_listen : "",
+
+			.relay_upstream           = (pinba_variables()->relay_upstream) ? pinba_variables()->relay_upstream : "",
+			.relay_listen             = (pinba_variables()->relay_listen) ? pinba_variables()->relay_listen : "",
+
+			.nmpa_block_allocator      = pinba_block_allocator_from_str(block_allocator_name),
+			.nmpa_block_allocator_numa = (bool)pinba_variables()->nmpa_block_allocator_numa,
+
+			.sample_rate_tag          = (pinba_variables()->sample_rate_tag) ? pinba_variables()->sample_rate_tag : "",
+			.ingest_budget            = pinba_variables()->ingest_budget,
+
+			.packet_capture_size      = pinba_variables()->packet_capture_size,
+			.packet_capture_sample    = pinba_variables()->packet_capture_sample,
+
+			.datagram_capture_path      = (pinba_variables()->datagram_capture_path) ? pinba_variables()->datagram_capture_path : "",
+			.datagram_capture_file_size = uint64_t(pinba_variables()->datagram_capture_file_mb) * 1024 * 1024,
+
+			.snapshot_prewarm_min_qpm = pinba_variables()->snapshot_prewarm_min_qpm,
+			.snapshot_prewarm_max_mem = uint64_t(pinba_variables()->snapshot_prewarm_max_mem_mb) * 1024 * 1024,
+
+			.reclaim_thread           = (bool)pinba_variables()->reclaim_thread,
+
+			.udp_sched                = pinba_thread_sched_from_str("udp_reader_sched", pinba_variables()->udp_reader_sched),
+			.repacker_sched           = pinba_thread_sched_from_str("repacker_sched", pinba_variables()->repacker_sched),
+			.relay_sched              = pinba_thread_sched_from_str("relay_sched", pinba_variables()->relay_sched),
+			.report_sched             = pinba_thread_sched_from_str("report_sched", pinba_variables()->report_sched),
+			.snapshot_merge_sched     = pinba_thread_sched_from_str("snapshot_merge_sched", pinba_variables()->snapshot_merge_sched),
 		};
 
 		pinba_MYSQL__instance = [&]()
@@ -306,6 +697,8 @@ static int pinba_engine_init(void *p)
 		}();
 
 		LOG_NOTICE(logger, "engine initialized on {0}:{1}", options.net_address, options.net_port);
+
+		pinba_reports_precreate();
 	}
 	catch (std::exception const& e)
 	{
@@ -319,6 +712,7 @@ static int pinba_engine_init(void *p)
 	h->create = [](handlerton *hton, TABLE_SHARE *table, MEM_ROOT *mem_root) -> handler* {
 		return new (mem_root) pinba_handler_t(hton, table);
 	};
+	h->show_status = pinba_show_status;
 
 	DBUG_RETURN(0);
 }
@@ -410,21 +804,131 @@ static MYSQL_SYSVAR_UINT(default_history_time_sec,
 
 static MYSQL_SYSVAR_UINT(udp_reader_threads,
 	pinba_variables()->udp_reader_threads,
-	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
-	"Number of UDP reader threads, default (2) is usually enough here, max 16",
-	NULL,
+	PLUGIN_VAR_RQCMDARG,
+	"Number of UDP reader threads, default (2) is usually enough here, max 16, can be changed at runtime",
 	NULL,
+	[](MYSQL_THD thd, struct st_mysql_sys_var *var, void *out_to_mysql, const void *saved_from_update) // update
+	{
+		unsigned const saved_val = *(unsigned*)saved_from_update;
+
+		// old value stays, if the engine can't do it
+		pinba_error_t const err = P_E_->set_udp_reader_threads(saved_val);
+		if (err)
+		{
+			LOG_WARN(P_L_, "can't set udp_reader_threads to {0}: {1}", saved_val, err.what());
+			return;
+		}
+
+		*static_cast<unsigned*>(out_to_mysql) = saved_val;
+	},
 	2,
 	1,
 	16,
 	0);
 
-static MYSQL_SYSVAR_UINT(repacker_threads,
-	pinba_variables()->repacker_threads,
+static MYSQL_SYSVAR_STR(udp_reader_backend,
+	pinba_variables()->udp_reader_backend,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"How UDP reader threads receive packets: auto, recv, recvmmsg, io_uring or af_xdp (falls back to auto if unavailable), default: 'auto'",
+	NULL,
+	NULL,
+	"auto");
+
+static MYSQL_SYSVAR_STR(udp_reader_xdp_interface,
+	pinba_variables()->udp_reader_xdp_interface,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Network interface for af_xdp UDP reader backend, reader thread N takes rx queue N, default: ''",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_UINT(udp_reader_rcvbuf_traffic_mb,
+	pinba_variables()->udp_reader_rcvbuf_traffic_mb,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Expected UDP traffic (MB/sec) to size socket receive buffers for, 0 = keep system default",
+	NULL,
+	NULL,
+	0,
+	0,
+	10 * 1024,
+	0);
+
+static MYSQL_SYSVAR_UINT(udp_reader_rcvbuf_time_ms,
+	pinba_variables()->udp_reader_rcvbuf_time_ms,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Socket receive buffers should be able to hold this much traffic (milliseconds), see udp_reader_rcvbuf_traffic_mb",
+	NULL,
+	NULL,
+	500,
+	10,
+	10 * 1000,
+	0);
+
+static MYSQL_SYSVAR_UINT(udp_reader_busy_poll_spins,
+	pinba_variables()->udp_reader_busy_poll_spins,
 	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
-	"Number of internal packet-repack threads, try tunning higher if stats udp_batches_lost is > 0, max: 32",
+	"Low latency mode for recvmmsg UDP readers: empty non-blocking reads to spin for before going back to poll(), 0 = off",
 	NULL,
 	NULL,
+	0,
+	0,
+	1000 * 1000,
+	0);
+
+static MYSQL_SYSVAR_UINT(udp_reader_busy_poll_usec,
+	pinba_variables()->udp_reader_busy_poll_usec,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"SO_BUSY_POLL (microseconds) for UDP sockets in low latency mode, see udp_reader_busy_poll_spins, 0 = don't set",
+	NULL,
+	NULL,
+	50,
+	0,
+	1000 * 1000,
+	0);
+
+static MYSQL_SYSVAR_BOOL(udp_reader_gro,
+	pinba_variables()->udp_reader_gro,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Let kernel coalesce same-size UDP datagrams (UDP_GRO) for recvmmsg readers, and split them back in user space",
+	NULL,
+	NULL,
+	1);
+
+static MYSQL_SYSVAR_BOOL(packet_wire_decoder,
+	pinba_variables()->packet_wire_decoder,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Decode packets straight from protobuf wire format in repacker threads, instead of unpacking them with protobuf-c in UDP reader threads",
+	NULL,
+	NULL,
+	0);
+
+static MYSQL_SYSVAR_BOOL(pipeline_rings,
+	pinba_variables()->pipeline_rings,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Pass messages between UDP reader, repacker and packet relay threads through lock-free rings, instead of nanomsg inproc sockets",
+	NULL,
+	NULL,
+	1);
+
+static MYSQL_SYSVAR_UINT(repacker_threads,
+	pinba_variables()->repacker_threads,
+	PLUGIN_VAR_RQCMDARG,
+	"Number of internal packet-repack threads, try tunning higher if stats udp_batches_lost is > 0, max: 32, can be changed at runtime",
+	NULL,
+	[](MYSQL_THD thd, struct st_mysql_sys_var *var, void *out_to_mysql, const void *saved_from_update) // update
+	{
+		unsigned const saved_val = *(unsigned*)saved_from_update;
+
+		// old value stays, if the engine can't do it
+		pinba_error_t const err = P_E_->set_repacker_threads(saved_val);
+		if (err)
+		{
+			LOG_WARN(P_L_, "can't set repacker_threads to {0}: {1}", saved_val, err.what());
+			return;
+		}
+
+		*static_cast<unsigned*>(out_to_mysql) = saved_val;
+	},
 	2,
 	1,
 	32,
@@ -463,6 +967,58 @@ static MYSQL_SYSVAR_UINT(repacker_batch_timeout_ms,
 	1000,
 	0);
 
+static MYSQL_SYSVAR_UINT(repacker_batch_latency_target_ms,
+	pinba_variables()->repacker_batch_latency_target_ms,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Adaptive batching: packet-repack threads size batches by their packet rate to send them about this often (in milliseconds!), 0 = static batches",
+	NULL,
+	NULL,
+	0,
+	0,
+	1000,
+	0);
+
+static MYSQL_SYSVAR_UINT(repacker_batch_fill_target_pct,
+	pinba_variables()->repacker_batch_fill_target_pct,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Adaptive batching: how full (in percent) batches should be, when sent by timer at steady packet rate",
+	NULL,
+	NULL,
+	80,
+	1,
+	100,
+	0);
+
+static MYSQL_SYSVAR_UINT(repacker_dictionary_reap_words,
+	pinba_variables()->repacker_dictionary_reap_words,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Max dictionary words packet-repack thread releases per poll iteration, when reaping unused words, 0 = no limit",
+	NULL,
+	NULL,
+	4096,
+	0,
+	1024 * 1024,
+	0);
+
+static MYSQL_SYSVAR_UINT(repacker_dictionary_prefetch,
+	pinba_variables()->repacker_dictionary_prefetch,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Packet-repack threads fetch dictionary words for this many requests at once, locking every dictionary shard once, 0 = word by word",
+	NULL,
+	NULL,
+	64,
+	0,
+	1024,
+	0);
+
+static MYSQL_SYSVAR_BOOL(repacker_columnar_batches,
+	pinba_variables()->repacker_columnar_batches,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Add columnar copy of packet fields to every packet-repack batch, for reports that scan columns instead of packets",
+	NULL,
+	NULL,
+	0);
+
 static MYSQL_SYSVAR_UINT(coordinator_input_buffer,
 	pinba_variables()->coordinator_input_buffer,
 	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
@@ -485,6 +1041,83 @@ static MYSQL_SYSVAR_UINT(report_input_buffer,
 	8 * 1024,
 	0);
 
+static MYSQL_SYSVAR_UINT(report_fuse_max,
+	pinba_variables()->report_fuse_max,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Aggregate up to this many compatible reports (same kind, tick interval and filters) in one thread, 0 or 1 = thread per report",
+	NULL,
+	NULL,
+	0,
+	0,
+	1024,
+	0);
+
+static MYSQL_SYSVAR_UINT(report_executor_threads,
+	pinba_variables()->report_executor_threads,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Run reports as tasks on this many shared threads (work stealing), instead of a thread per report, 0 = thread per report",
+	NULL,
+	NULL,
+	0,
+	0,
+	1024,
+	0);
+
+static MYSQL_SYSVAR_UINT(relay_threads,
+	pinba_variables()->relay_threads,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Packet relay threads, reports are split between them (each batch is still received by one of them), 0 or 1 = one relay thread",
+	NULL,
+	NULL,
+	0,
+	0,
+	64,
+	0);
+
+static MYSQL_SYSVAR_UINT(report_tick_stagger_ms,
+	pinba_variables()->report_tick_stagger_ms,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Spread ticks of reports with the same tick interval over this many milliseconds (at most half the interval), 0 = all reports tick at once",
+	NULL,
+	NULL,
+	0,
+	0,
+	60000,
+	0);
+
+static MYSQL_SYSVAR_UINT(report_overload_lag_ms,
+	pinba_variables()->report_overload_lag_ms,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Reports that get batches later than this many milliseconds aggregate only some of them, with sample rate scaled to match, 0 = off",
+	NULL,
+	NULL,
+	0,
+	0,
+	600000,
+	0);
+
+static MYSQL_SYSVAR_UINT(report_max_mem_total_mb,
+	pinba_variables()->report_max_mem_total_mb,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Soft limit on memory used by all timer reports (MB), over it reports stop creating new keys and trim older history, 0 = no limit",
+	NULL,
+	NULL,
+	0,
+	0,
+	1024 * 1024, // 1TB
+	0);
+
+static MYSQL_SYSVAR_UINT(mem_governor_max_mb,
+	pinba_variables()->mem_governor_max_mb,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Engine-wide memory budget (MB), approaching it samples incoming packets, then rejects new dictionary words, then stops new report keys, 0 = off",
+	NULL,
+	NULL,
+	0,
+	0,
+	1024 * 1024, // 1TB
+	0);
+
 static MYSQL_SYSVAR_BOOL(packet_debug,
 	pinba_variables()->packet_debug,
 	PLUGIN_VAR_RQCMDARG,
@@ -533,20 +1166,398 @@ static MYSQL_SYSVAR_DOUBLE(packet_debug_fraction,
 	1.0,
 	0);
 
+static MYSQL_SYSVAR_UINT(snapshot_merge_threads,
+	pinba_variables()->snapshot_merge_threads,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Number of extra threads used to merge large report snapshots in parallel (0 = merge in the selecting thread only)",
+	NULL,
+	NULL,
+	0,
+	0,
+	32,
+	0);
+
+static MYSQL_SYSVAR_UINT(tick_finalize_threads,
+	pinba_variables()->tick_finalize_threads,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Number of threads merging report ticks into history, while report threads go on aggregating (0 = merge in report threads)",
+	NULL,
+	NULL,
+	0,
+	0,
+	32,
+	0);
+
+static MYSQL_SYSVAR_STR(permanent_dictionary_fields,
+	pinba_variables()->permanent_dictionary_fields,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Comma separated packet fields to keep in lock-free permanent dictionary (low-cardinality only!), any of: host, server, script, schema, status",
+	NULL,
+	NULL,
+	"status");
+
+static MYSQL_SYSVAR_UINT(dictionary_shards,
+	pinba_variables()->dictionary_shards,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Number of dictionary shards (power of 2), each with a lock of its own, more shards = less contention between repacker threads",
+	NULL,
+	NULL,
+	32,
+	1,
+	256,
+	0);
+
+static MYSQL_SYSVAR_STR(udp_reader_cpus,
+	pinba_variables()->udp_reader_cpus,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"CPUs to run UDP reader threads on, list like '0-3,8', default: '' (no affinity)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_BOOL(udp_reader_cpu_steering,
+	pinba_variables()->udp_reader_cpu_steering,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Pin every UDP reader thread to its own cpu (from udp_reader_cpus, or cpu N for reader N), and steer datagrams to the reader on the cpu that received them",
+	NULL,
+	NULL,
+	0);
+
+static MYSQL_SYSVAR_STR(repacker_cpus,
+	pinba_variables()->repacker_cpus,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"CPUs to run repacker threads on, list like '0-3,8', default: '' (no affinity)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_STR(relay_cpus,
+	pinba_variables()->relay_cpus,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"CPUs to run packet relay thread on, list like '0-3,8', default: '' (no affinity)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_STR(report_cpus,
+	pinba_variables()->report_cpus,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"CPUs to run report threads on, list like '0-3,8', default: '' (no affinity)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_STR(udp_reader_sched,
+	pinba_variables()->udp_reader_sched,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Scheduling for UDP reader threads, nice:<-20..19>, fifo:<1..99> or rr:<1..99>, default: '' (inherit)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_STR(repacker_sched,
+	pinba_variables()->repacker_sched,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Scheduling for repacker threads, nice:<-20..19>, fifo:<1..99> or rr:<1..99>, default: '' (inherit)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_STR(relay_sched,
+	pinba_variables()->relay_sched,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Scheduling for packet relay threads, nice:<-20..19>, fifo:<1..99> or rr:<1..99>, default: '' (inherit)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_STR(report_sched,
+	pinba_variables()->report_sched,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Scheduling for report threads, nice:<-20..19>, fifo:<1..99> or rr:<1..99>, default: '' (inherit)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_STR(snapshot_merge_sched,
+	pinba_variables()->snapshot_merge_sched,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Scheduling for snapshot merge and prewarm threads, nice:<-20..19>, fifo:<1..99> or rr:<1..99>, default: '' (inherit)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_STR(export_socket,
+	pinba_variables()->export_socket,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Unix socket path to export binary report snapshots on (send report name + newline, get snapshot), default: '' (disabled)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_STR(export_address,
+	pinba_variables()->export_address,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"IP address to export binary report snapshots on, for other nodes to gather from (use * for all IPs), default: 127.0.0.1",
+	NULL,
+	NULL,
+	"127.0.0.1");
+
+static MYSQL_SYSVAR_INT(export_port,
+	pinba_variables()->export_port,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"TCP port to export binary report snapshots on (same protocol as export_socket), default: 0 (disabled)",
+	NULL,
+	NULL,
+	0,     // def
+	0,     // min
+	65535, // max
+	0);
+
+static MYSQL_SYSVAR_STR(gather_nodes,
+	pinba_variables()->gather_nodes,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Comma-separated nodes (host:port or unix:/path) to merge sharded reports from, on 'gather:<name>' export requests, default: '' (disabled)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_STR(metrics_address,
+	pinba_variables()->metrics_address,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"IP address to serve prometheus /metrics on (use * for all IPs), default: 127.0.0.1",
+	NULL,
+	NULL,
+	"127.0.0.1");
+
+static MYSQL_SYSVAR_INT(metrics_port,
+	pinba_variables()->metrics_port,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"TCP port to serve prometheus /metrics on (reports with 'metrics' aggregation option), default: 0 (disabled)",
+	NULL,
+	NULL,
+	0,     // def
+	0,     // min
+	65535, // max
+	0);
+
+static MYSQL_SYSVAR_STR(history_dir,
+	pinba_variables()->history_dir,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Directory to save report history to on shutdown (and load from, when report is created), default: '' (disabled)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_STR(federation_upstream,
+	pinba_variables()->federation_upstream,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Edge mode: send report ticks to central pinba at this nanomsg endpoint (i.e. tcp://central:3003), default: '' (disabled)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_STR(federation_listen,
+	pinba_variables()->federation_listen,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Central mode: receive report ticks from edge pinbas on this nanomsg endpoint (i.e. tcp://*:3003), default: '' (disabled)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_STR(relay_upstream,
+	pinba_variables()->relay_upstream,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Relay-only mode: send repacked packet batches to aggregator pinba at this nanomsg endpoint (i.e. tcp://aggregator:3004), default: '' (disabled)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_STR(relay_listen,
+	pinba_variables()->relay_listen,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Aggregator mode: receive repacked packet batches from relay pinbas on this nanomsg endpoint (i.e. tcp://*:3004), default: '' (disabled)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_STR(nmpa_block_allocator,
+	pinba_variables()->nmpa_block_allocator,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Where nmpa memory blocks come from: malloc, cached (malloc + thread caches), thp (transparent huge page chunks) or hugetlb (MAP_HUGETLB chunks), default: malloc",
+	NULL,
+	NULL,
+	"malloc");
+
+static MYSQL_SYSVAR_BOOL(nmpa_block_allocator_numa,
+	pinba_variables()->nmpa_block_allocator_numa,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Keep freed nmpa blocks per numa node and bind huge page chunks to it, default: off",
+	NULL,
+	NULL,
+	0);
+
+static MYSQL_SYSVAR_STR(sample_rate_tag,
+	pinba_variables()->sample_rate_tag,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Request tag with client sample rate (N for 1-in-N sampling), packets with it count as N requests in all reports, default: '' (disabled)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_UINT(ingest_budget,
+	pinba_variables()->ingest_budget,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Packets per second to aggregate, over it repackers keep 1-in-N requests per script and count them as N, 0 = off",
+	NULL,
+	NULL,
+	0,
+	0,
+	INT_MAX,
+	0);
+
+static MYSQL_SYSVAR_UINT(packet_capture_size,
+	pinba_variables()->packet_capture_size,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Recent raw packets to keep for selects from 'v2/capture' tables (about 700 bytes each), 0 = off",
+	NULL,
+	NULL,
+	0,
+	0,
+	16 * 1024 * 1024,
+	0);
+
+static MYSQL_SYSVAR_UINT(packet_capture_sample,
+	pinba_variables()->packet_capture_sample,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Capture every N-th packet, default: 1",
+	NULL,
+	NULL,
+	1,
+	1,
+	INT_MAX,
+	0);
+
+static MYSQL_SYSVAR_STR(datagram_capture_path,
+	pinba_variables()->datagram_capture_path,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Record raw udp datagrams into this file (for bench/pinba_bench --replay), default: '' (disabled)",
+	NULL,
+	NULL,
+	"");
+
+static MYSQL_SYSVAR_UINT(datagram_capture_file_mb,
+	pinba_variables()->datagram_capture_file_mb,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Max datagram capture file size in megabytes, full file is renamed to <path>.1 and a new one is started, default: 1024",
+	NULL,
+	NULL,
+	1024,
+	8,
+	1024 * 1024,
+	0);
+
+static MYSQL_SYSVAR_BOOL(reclaim_thread,
+	pinba_variables()->reclaim_thread,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Free expired report history ticks in a background thread, instead of report threads, default: on",
+	NULL,
+	NULL,
+	1);
+
+static MYSQL_SYSVAR_UINT(snapshot_prewarm_min_qpm,
+	pinba_variables()->snapshot_prewarm_min_qpm,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Reports selected at least this many times per minute get their snapshots prepared in background right after every tick, default: 0 (disabled)",
+	NULL,
+	NULL,
+	0,
+	0,
+	INT_MAX,
+	0);
+
+static MYSQL_SYSVAR_UINT(snapshot_prewarm_max_mem_mb,
+	pinba_variables()->snapshot_prewarm_max_mem_mb,
+	PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+	"Max memory for snapshots prepared in background (megabytes, estimated), hottest reports first, 0 = no limit, default: 512",
+	NULL,
+	NULL,
+	512,
+	0,
+	INT_MAX,
+	0);
+
 static struct st_mysql_sys_var* system_variables[]= {
 	MYSQL_SYSVAR(port),
 	MYSQL_SYSVAR(address),
 	MYSQL_SYSVAR(log_level),
 	MYSQL_SYSVAR(default_history_time_sec),
 	MYSQL_SYSVAR(udp_reader_threads),
+	MYSQL_SYSVAR(udp_reader_backend),
+	MYSQL_SYSVAR(udp_reader_xdp_interface),
+	MYSQL_SYSVAR(udp_reader_rcvbuf_traffic_mb),
+	MYSQL_SYSVAR(udp_reader_rcvbuf_time_ms),
+	MYSQL_SYSVAR(udp_reader_busy_poll_spins),
+	MYSQL_SYSVAR(udp_reader_busy_poll_usec),
+	MYSQL_SYSVAR(udp_reader_gro),
+	MYSQL_SYSVAR(packet_wire_decoder),
+	MYSQL_SYSVAR(pipeline_rings),
 	MYSQL_SYSVAR(repacker_threads),
 	MYSQL_SYSVAR(repacker_input_buffer),
 	MYSQL_SYSVAR(repacker_batch_messages),
 	MYSQL_SYSVAR(repacker_batch_timeout_ms),
+	MYSQL_SYSVAR(repacker_batch_latency_target_ms),
+	MYSQL_SYSVAR(repacker_batch_fill_target_pct),
+	MYSQL_SYSVAR(repacker_dictionary_reap_words),
+	MYSQL_SYSVAR(repacker_dictionary_prefetch),
+	MYSQL_SYSVAR(repacker_columnar_batches),
 	MYSQL_SYSVAR(coordinator_input_buffer),
 	MYSQL_SYSVAR(report_input_buffer),
+	MYSQL_SYSVAR(report_fuse_max),
+	MYSQL_SYSVAR(report_executor_threads),
+	MYSQL_SYSVAR(relay_threads),
+	MYSQL_SYSVAR(report_tick_stagger_ms),
+	MYSQL_SYSVAR(report_overload_lag_ms),
+	MYSQL_SYSVAR(report_max_mem_total_mb),
+	MYSQL_SYSVAR(mem_governor_max_mb),
+	MYSQL_SYSVAR(export_socket),
+	MYSQL_SYSVAR(export_address),
+	MYSQL_SYSVAR(export_port),
+	MYSQL_SYSVAR(gather_nodes),
+	MYSQL_SYSVAR(metrics_address),
+	MYSQL_SYSVAR(metrics_port),
+	MYSQL_SYSVAR(history_dir),
+	MYSQL_SYSVAR(federation_upstream),
+	MYSQL_SYSVAR(federation_listen),
+	MYSQL_SYSVAR(relay_upstream),
+	MYSQL_SYSVAR(relay_listen),
+	MYSQL_SYSVAR(nmpa_block_allocator),
+	MYSQL_SYSVAR(nmpa_block_allocator_numa),
+	MYSQL_SYSVAR(sample_rate_tag),
+	MYSQL_SYSVAR(ingest_budget),
+	MYSQL_SYSVAR(packet_capture_size),
+	MYSQL_SYSVAR(packet_capture_sample),
+	MYSQL_SYSVAR(datagram_capture_path),
+	MYSQL_SYSVAR(datagram_capture_file_mb),
+	MYSQL_SYSVAR(snapshot_prewarm_min_qpm),
+	MYSQL_SYSVAR(snapshot_prewarm_max_mem_mb),
+	MYSQL_SYSVAR(reclaim_thread),
 	MYSQL_SYSVAR(packet_debug),
 	MYSQL_SYSVAR(packet_debug_fraction),
+	MYSQL_SYSVAR(snapshot_merge_threads),
+	MYSQL_SYSVAR(tick_finalize_threads),
+	MYSQL_SYSVAR(permanent_dictionary_fields),
+	MYSQL_SYSVAR(dictionary_shards),
+	MYSQL_SYSVAR(udp_reader_cpus),
+	MYSQL_SYSVAR(repacker_cpus),
+	MYSQL_SYSVAR(relay_cpus),
+	MYSQL_SYSVAR(report_cpus),
+	MYSQL_SYSVAR(udp_reader_cpu_steering),
+	MYSQL_SYSVAR(udp_reader_sched),
+	MYSQL_SYSVAR(repacker_sched),
+	MYSQL_SYSVAR(relay_sched),
+	MYSQL_SYSVAR(report_sched),
+	MYSQL_SYSVAR(snapshot_merge_sched),
 	NULL
 };
 
@@ -572,31 +1583,86 @@ static void status_variables_show_func(THD*, SHOW_VAR *var, char *buf)
 		SVAR(udp_batch_send_err,                SHOW_LONGLONG)
 		SVAR(udp_packet_send_total,             SHOW_LONGLONG)
 		SVAR(udp_packet_send_err,               SHOW_LONGLONG)
+		SVAR(udp_recv_kernel_drops,             SHOW_LONGLONG)
 		SVAR(udp_ru_utime,                      SHOW_DOUBLE)
 		SVAR(udp_ru_stime,                      SHOW_DOUBLE)
+		SVAR(udp_busy_poll_busy,                SHOW_LONGLONG)
+		SVAR(udp_busy_poll_idle,                SHOW_LONGLONG)
+		SVAR(udp_recv_gro_segments,             SHOW_LONGLONG)
 		SVAR(repacker_poll_total,               SHOW_LONGLONG)
 		SVAR(repacker_recv_total,               SHOW_LONGLONG)
 		SVAR(repacker_recv_eagain,              SHOW_LONGLONG)
 		SVAR(repacker_recv_packets,             SHOW_LONGLONG)
 		SVAR(repacker_packet_validate_err,      SHOW_LONGLONG)
+		SVAR(repacker_packet_prefilter_drop,    SHOW_LONGLONG)
 		SVAR(repacker_batch_send_total,         SHOW_LONGLONG)
 		SVAR(repacker_batch_send_by_timer,      SHOW_LONGLONG)
 		SVAR(repacker_batch_send_by_size,       SHOW_LONGLONG)
 		SVAR(repacker_ru_utime,                 SHOW_DOUBLE)
 		SVAR(repacker_ru_stime,                 SHOW_DOUBLE)
+		SVAR(repacker_batch_size,               SHOW_LONGLONG)
+		SVAR(repacker_batch_timeout,            SHOW_DOUBLE)
+		SVAR(repacker_packet_rate,              SHOW_DOUBLE)
 		SVAR(coordinator_batches_received,      SHOW_LONGLONG)
 		SVAR(coordinator_batch_send_total,      SHOW_LONGLONG)
 		SVAR(coordinator_batch_send_err,        SHOW_LONGLONG)
+		SVAR(coordinator_batch_send_skipped,    SHOW_LONGLONG)
 		SVAR(coordinator_control_requests,      SHOW_LONGLONG)
 		SVAR(coordinator_ru_utime,              SHOW_DOUBLE)
 		SVAR(coordinator_ru_stime,              SHOW_DOUBLE)
+		SVAR(federation_ticks_sent,             SHOW_LONGLONG)
+		SVAR(federation_ticks_send_err,         SHOW_LONGLONG)
+		SVAR(federation_ticks_received,         SHOW_LONGLONG)
+		SVAR(federation_ticks_merge_err,        SHOW_LONGLONG)
+		SVAR(packet_capture_packets,            SHOW_LONGLONG)
+		SVAR(datagram_capture_datagrams,        SHOW_LONGLONG)
+		SVAR(datagram_capture_dropped,          SHOW_LONGLONG)
+		SVAR(datagram_capture_bytes,            SHOW_LONGLONG)
+		SVAR(datagram_capture_files_rotated,    SHOW_LONGLONG)
+		SVAR(snapshot_prewarm_prepared,         SHOW_LONGLONG)
+		SVAR(snapshot_prewarm_skipped_mem,      SHOW_LONGLONG)
+		SVAR(snapshot_prewarm_hot_reports,      SHOW_LONGLONG)
+		SVAR(snapshot_prewarm_mem_used,         SHOW_LONGLONG)
+		SVAR(reclaimer_objects_retired,         SHOW_LONGLONG)
+		SVAR(reclaimer_objects_freed,           SHOW_LONGLONG)
+		SVAR(async_log_messages_written,        SHOW_LONGLONG)
+		SVAR(async_log_messages_dropped,        SHOW_LONGLONG)
+		SVAR(relay_batches_sent,                SHOW_LONGLONG)
+		SVAR(relay_batches_send_err,            SHOW_LONGLONG)
+		SVAR(relay_bytes_sent,                  SHOW_LONGLONG)
+		SVAR(relay_batches_received,            SHOW_LONGLONG)
+		SVAR(relay_batches_decode_err,          SHOW_LONGLONG)
+		SVAR(relay_packets_received,            SHOW_LONGLONG)
+		SVAR(nmpa_blocks_os_bytes,              SHOW_LONGLONG)
+		SVAR(nmpa_blocks_in_use_bytes,          SHOW_LONGLONG)
+		SVAR(nmpa_blocks_cached_bytes,          SHOW_LONGLONG)
+		SVAR(nmpa_blocks_thread_cache_hits,     SHOW_LONGLONG)
+		SVAR(nmpa_blocks_depot_hits,            SHOW_LONGLONG)
+		SVAR(nmpa_blocks_os_allocs,             SHOW_LONGLONG)
+		SVAR(nmpa_blocks_hugetlb_fallbacks,     SHOW_LONGLONG)
+		SVAR(mem_governor_stage,                SHOW_LONGLONG)
+		SVAR(mem_governor_mem_used,             SHOW_LONGLONG)
+		SVAR(mem_governor_stage_changes,        SHOW_LONGLONG)
+		SVAR(mem_governor_packets_sampled,      SHOW_LONGLONG)
+		SVAR(mem_governor_words_rejected,       SHOW_LONGLONG)
+		SVAR(repacker_packet_ingest_sampled,    SHOW_LONGLONG)
+		SVAR(repacker_packet_summaries,         SHOW_LONGLONG)
+		SVAR(repacker_packet_summary_requests,  SHOW_LONGLONG)
 		SVAR(dictionary_size,                   SHOW_LONGLONG)
 		SVAR(dictionary_mem_hash,               SHOW_LONGLONG)
 		SVAR(dictionary_mem_list,               SHOW_LONGLONG)
 		SVAR(dictionary_mem_strings,            SHOW_LONGLONG)
+		SVAR(inflight_mem_raw_batches,          SHOW_LONGLONG)
+		SVAR(inflight_mem_packet_batches,       SHOW_LONGLONG)
+		SVAR(inflight_mem_repacker_dictionaries, SHOW_LONGLONG)
 		SVAR(extra,                             SHOW_CHAR)
 		SVAR(version_info,                      SHOW_CHAR)
 		SVAR(build_string,                      SHOW_CHAR)
+		SVAR(rate_window_sec,                   SHOW_DOUBLE)
+		SVAR(udp_recv_packets_per_sec,          SHOW_DOUBLE)
+		SVAR(udp_recv_bytes_per_sec,            SHOW_DOUBLE)
+		SVAR(ru_utime_per_sec,                  SHOW_DOUBLE)
+		SVAR(ru_stime_per_sec,                  SHOW_DOUBLE)
 
 	#undef SVAR
 		{ NullS, NullS, SHOW_LONG }
@@ -21,14 +21,71 @@ struct pinba_variables_t
 	char      *log_level                = nullptr;
 	unsigned  default_history_time_sec  = 0;
 	unsigned  udp_reader_threads        = 0;
+	char      *udp_reader_backend       = nullptr;
+	char      *udp_reader_xdp_interface = nullptr;
+	unsigned  udp_reader_rcvbuf_traffic_mb = 0;
+	unsigned  udp_reader_rcvbuf_time_ms = 0;
+	unsigned  udp_reader_busy_poll_spins = 0;
+	unsigned  udp_reader_busy_poll_usec = 0;
+	char      udp_reader_gro            = 0;
+	char      packet_wire_decoder       = 0;
+	char      pipeline_rings            = 0;
 	unsigned  repacker_threads          = 0;
 	unsigned  repacker_input_buffer     = 0;
 	unsigned  repacker_batch_messages   = 0;
 	unsigned  repacker_batch_timeout_ms = 0;
+	unsigned  repacker_batch_latency_target_ms = 0;
+	unsigned  repacker_batch_fill_target_pct   = 0;
+	unsigned  repacker_dictionary_reap_words = 0;
+	unsigned  repacker_dictionary_prefetch   = 0;
+	char      repacker_columnar_batches = 0;
 	unsigned  coordinator_input_buffer  = 0;
 	unsigned  report_input_buffer       = 0;
+	unsigned  report_fuse_max           = 0;
+	unsigned  report_executor_threads   = 0;
+	unsigned  relay_threads             = 0;
+	unsigned  report_tick_stagger_ms    = 0;
+	unsigned  report_overload_lag_ms    = 0;
+	unsigned  report_max_mem_total_mb   = 0;
+	unsigned  mem_governor_max_mb       = 0;
+	char      *export_socket            = nullptr;
+	char      *export_address           = nullptr;
+	int       export_port               = 0;
+	char      *gather_nodes             = nullptr;
+	char      *metrics_address          = nullptr;
+	int       metrics_port              = 0;
+	char      *history_dir              = nullptr;
+	char      *federation_upstream      = nullptr;
+	char      *federation_listen        = nullptr;
+	char      *relay_upstream           = nullptr;
+	char      *relay_listen             = nullptr;
+	char      *nmpa_block_allocator     = nullptr;
+	char      nmpa_block_allocator_numa = 0;
+	char      *sample_rate_tag          = nullptr;
+	unsigned  ingest_budget             = 0;
+	unsigned  packet_capture_size       = 0;
+	unsigned  packet_capture_sample     = 1;
+	char      *datagram_capture_path    = nullptr;
+	unsigned  datagram_capture_file_mb  = 1024;
+	unsigned  snapshot_prewarm_min_qpm    = 0;
+	unsigned  snapshot_prewarm_max_mem_mb = 512;
+	char      reclaim_thread            = 1;
 	char      packet_debug              = 0;
 	double    packet_debug_fraction     = 0.01;
+	unsigned  snapshot_merge_threads    = 0;
+	unsigned  tick_finalize_threads     = 0;
+	char      *permanent_dictionary_fields = nullptr;
+	unsigned  dictionary_shards         = 0;
+	char      *udp_reader_cpus          = nullptr;
+	char      *repacker_cpus            = nullptr;
+	char      *relay_cpus               = nullptr;
+	char      *report_cpus              = nullptr;
+	char      udp_reader_cpu_steering   = 0;
+	char      *udp_reader_sched         = nullptr;
+	char      *repacker_sched           = nullptr;
+	char      *relay_sched              = nullptr;
+	char      *report_sched             = nullptr;
+	char      *snapshot_merge_sched     = nullptr;
 };
 
 pinba_variables_t* pinba_variables();
@@ -68,6 +125,9 @@ struct pinba_status_variables_t
 	unsigned long long  repacker_batch_send_by_size;
 	double              repacker_ru_utime;
 	double              repacker_ru_stime;
+	unsigned long long  repacker_batch_size;        // current, averaged over threads (see repacker_conf_t::batch_latency_target)
+	double              repacker_batch_timeout;     // current, seconds, max over threads
+	double              repacker_packet_rate;       // packets/sec, smoothed, all threads
 
 	unsigned long long  coordinator_batches_received;
 	unsigned long long  coordinator_batch_send_total;
@@ -81,10 +141,98 @@ struct pinba_status_variables_t
 	unsigned long long  dictionary_mem_list;
 	unsigned long long  dictionary_mem_strings;
 
+	// transient memory, read from the network, but not aggregated yet (see pinba_stats_t::inflight_mem)
+	unsigned long long  inflight_mem_raw_batches;
+	unsigned long long  inflight_mem_packet_batches;
+	unsigned long long  inflight_mem_repacker_dictionaries; // thread local caches, all repacker threads
+
 	char                extra[1024];
 
 	char                version_info[1024];
 	char                build_string[1024];
+
+	unsigned long long  udp_recv_kernel_drops; // appended to keep stats table columns compatible
+	unsigned long long  repacker_packet_prefilter_drop;
+	unsigned long long  coordinator_batch_send_skipped;
+
+	unsigned long long  udp_busy_poll_busy;
+	unsigned long long  udp_busy_poll_idle;
+	unsigned long long  udp_recv_gro_segments;
+
+	// see pinba_stats_t::federation
+	unsigned long long  federation_ticks_sent;
+	unsigned long long  federation_ticks_send_err;
+	unsigned long long  federation_ticks_received;
+	unsigned long long  federation_ticks_merge_err;
+
+	// see packet_capture.h
+	unsigned long long  packet_capture_packets;
+
+	// see datagram_capture.h
+	unsigned long long  datagram_capture_datagrams;
+	unsigned long long  datagram_capture_dropped;
+	unsigned long long  datagram_capture_bytes;
+	unsigned long long  datagram_capture_files_rotated;
+
+	// see pinba_stats_t::snapshot_prewarm
+	unsigned long long  snapshot_prewarm_prepared;
+	unsigned long long  snapshot_prewarm_skipped_mem;
+	unsigned long long  snapshot_prewarm_hot_reports;
+	unsigned long long  snapshot_prewarm_mem_used;
+
+	// see reclaimer.h
+	unsigned long long  reclaimer_objects_retired;
+	unsigned long long  reclaimer_objects_freed;
+
+	// see async_log.h
+	unsigned long long  async_log_messages_written;
+	unsigned long long  async_log_messages_dropped;
+
+	// see pinba_stats_t::packet_relay
+	unsigned long long  relay_batches_sent;
+	unsigned long long  relay_batches_send_err;
+	unsigned long long  relay_bytes_sent;
+	unsigned long long  relay_batches_received;
+	unsigned long long  relay_batches_decode_err;
+	unsigned long long  relay_packets_received;
+
+	// see block_allocator_stats_t
+	unsigned long long  nmpa_blocks_os_bytes;
+	unsigned long long  nmpa_blocks_in_use_bytes;
+	unsigned long long  nmpa_blocks_cached_bytes;
+	unsigned long long  nmpa_blocks_thread_cache_hits;
+	unsigned long long  nmpa_blocks_depot_hits;
+	unsigned long long  nmpa_blocks_os_allocs;
+	unsigned long long  nmpa_blocks_hugetlb_fallbacks;
+
+	// see mem_governor.h
+	unsigned long long  mem_governor_stage;
+	unsigned long long  mem_governor_mem_used;
+	unsigned long long  mem_governor_stage_changes;
+	unsigned long long  mem_governor_packets_sampled;
+	unsigned long long  mem_governor_words_rejected;
+
+	// see repacker_conf_t::ingest_budget
+	unsigned long long  repacker_packet_ingest_sampled;
+
+	// pre-aggregated summaries from local agents, see pinba_summary_to_packets()
+	unsigned long long  repacker_packet_summaries;
+	unsigned long long  repacker_packet_summary_requests;
+
+	// per second, over last rate_window_sec seconds (0 = not enough samples yet), see pinba_stats_t::rates
+	double              rate_window_sec;
+	double              udp_recv_packets_per_sec;
+	double              udp_recv_bytes_per_sec;
+	double              udp_recv_kernel_drops_per_sec;
+	double              udp_packet_decode_err_per_sec;
+	double              udp_packet_send_err_per_sec;
+	double              repacker_recv_packets_per_sec;
+	double              repacker_packet_validate_err_per_sec;
+	double              repacker_packet_prefilter_drop_per_sec;
+	double              coordinator_batches_received_per_sec;
+	double              coordinator_batch_send_err_per_sec;
+	double              ru_utime_per_sec;
+	double              ru_stime_per_sec;
 };
 using pinba_status_variables_ptr = std::unique_ptr<pinba_status_variables_t>;
 
@@ -1,11 +1,16 @@
 #include "mysql_engine/pinba_mysql.h"
 #include "mysql_engine/view_conf.h"
 
+#include <algorithm>
+#include <cctype>
+#include <regex>
+
 #include <meow/str_ref_algo.hpp>
 #include <meow/convert/number_from_string.hpp>
 
 #include "pinba/globals.h"
 #include "pinba/dictionary.h"
+#include "pinba/histogram.h"
 #include "pinba/report_by_request.h"
 #include "pinba/report_by_timer.h"
 #include "pinba/report_by_packet.h"
@@ -64,6 +69,334 @@ namespace { namespace aux {
 			vcf->tick_count  = time_window; // i.e. ticks are always 1 second wide
 		}
 
+		vcf->agg_threads    = 1;
+		vcf->hashtable_kind = REPORT_HASHTABLE__ROBIN_MAP;
+		vcf->tick_storage   = REPORT_TICK_STORAGE__FLAT;
+		vcf->hv_kind        = HISTOGRAM_KIND__FLAT;
+		vcf->hv_summary_points = 0;
+		vcf->hv_idle_d      = {0};
+		vcf->history_partitions    = 0;
+		vcf->history_partition_key = 0;
+		vcf->topk_size      = 0;
+		vcf->topk_metric    = REPORT_TOPK_METRIC__REQ_COUNT;
+		vcf->max_mem        = 0;
+		vcf->distinct_key   = {};
+		vcf->distinct_exact = false;
+		vcf->exemplars_count = 0;
+		vcf->order_metric   = PINBA_VIEW_ORDER__NONE;
+		vcf->order_limit    = 0;
+		vcf->stream_partitions = 0;
+		vcf->metrics_prefix = {};
+		vcf->data_skip      = 0;
+
+		// optional extra settings, after time window
+		for (size_t i = 1; i < time_window_v.size(); i++)
+		{
+			auto const kv = meow::split_ex(time_window_v[i], "=");
+			if (kv.size() != 2)
+				return ff::fmt_err("bad aggregation option: '{0}', expected <name>=<value>", time_window_v[i]);
+
+			if (kv[0] == "agg_threads")
+			{
+				static constexpr uint32_t max_agg_threads = 32;
+
+				if (!meow::number_from_string(&vcf->agg_threads, kv[1]))
+					return ff::fmt_err("bad agg_threads: '{0}', expected integer number", kv[1]);
+
+				if (vcf->agg_threads == 0 || vcf->agg_threads > max_agg_threads)
+					return ff::fmt_err("bad agg_threads: {0}, expected value in range [1, {1}]", vcf->agg_threads, max_agg_threads);
+
+				continue;
+			}
+
+			if (kv[0] == "hashtable")
+			{
+				if (kv[1] == "robin_map")
+					vcf->hashtable_kind = REPORT_HASHTABLE__ROBIN_MAP;
+				else if (kv[1] == "swiss_map")
+					vcf->hashtable_kind = REPORT_HASHTABLE__SWISS_MAP;
+				else
+					return ff::fmt_err("bad hashtable: '{0}', expected one of 'robin_map', 'swiss_map'", kv[1]);
+
+				continue;
+			}
+
+			if (kv[0] == "tick_storage")
+			{
+				if (kv[1] == "flat")
+					vcf->tick_storage = REPORT_TICK_STORAGE__FLAT;
+				else if (kv[1] == "compressed")
+					vcf->tick_storage = REPORT_TICK_STORAGE__COMPRESSED;
+				else
+					return ff::fmt_err("bad tick_storage: '{0}', expected one of 'flat', 'compressed'", kv[1]);
+
+				continue;
+			}
+
+			if (kv[0] == "hv_storage")
+			{
+				if (kv[1] == "flat")
+					vcf->hv_kind = HISTOGRAM_KIND__FLAT;
+				else if (kv[1] == "hdr")
+					vcf->hv_kind = HISTOGRAM_KIND__HDR;
+				else
+					return ff::fmt_err("bad hv_storage: '{0}', expected one of 'flat', 'hdr'", kv[1]);
+
+				continue;
+			}
+
+			if (kv[0] == "hv_summary")
+			{
+				static constexpr uint32_t min_summary_points = 10;   // percentiles off by <= 5 points
+				static constexpr uint32_t max_summary_points = 5000; // <= 0.01 point, that's more than most histograms have anyway
+
+				if (!meow::number_from_string(&vcf->hv_summary_points, kv[1]))
+					return ff::fmt_err("bad hv_summary: '{0}', expected integer number of points", kv[1]);
+
+				if (vcf->hv_summary_points < min_summary_points || vcf->hv_summary_points > max_summary_points)
+					return ff::fmt_err("bad hv_summary: {0}, expected value in range [{1}, {2}]", vcf->hv_summary_points, min_summary_points, max_summary_points);
+
+				continue;
+			}
+
+			if (kv[0] == "hv_idle")
+			{
+				static constexpr uint32_t min_idle_sec = 60;
+
+				uint32_t idle_sec;
+				if (!meow::number_from_string(&idle_sec, kv[1]))
+					return ff::fmt_err("bad hv_idle: '{0}', expected integer number of seconds", kv[1]);
+
+				if (idle_sec < min_idle_sec)
+					return ff::fmt_err("bad hv_idle: {0}, expected at least {1} seconds", idle_sec, min_idle_sec);
+
+				vcf->hv_idle_d = idle_sec * d_second;
+				continue;
+			}
+
+			if (kv[0] == "partitions")
+			{
+				static constexpr uint32_t min_partitions = 2;
+				static constexpr uint32_t max_partitions = 256;
+
+				auto const pv = meow::split_ex(kv[1], ":");
+				if (pv.size() > 2)
+					return ff::fmt_err("bad partitions: '{0}', expected <N>[:<key part number>]", kv[1]);
+
+				if (!meow::number_from_string(&vcf->history_partitions, pv[0]))
+					return ff::fmt_err("bad partitions: '{0}', expected integer number of partitions", kv[1]);
+
+				if (vcf->history_partitions < min_partitions || vcf->history_partitions > max_partitions)
+					return ff::fmt_err("bad partitions: {0}, expected value in range [{1}, {2}]", vcf->history_partitions, min_partitions, max_partitions);
+
+				uint32_t key_number = 1;
+				if (pv.size() == 2)
+				{
+					if (!meow::number_from_string(&key_number, pv[1]) || key_number == 0)
+						return ff::fmt_err("bad partitions: '{0}', expected key part number starting from 1", kv[1]);
+				}
+
+				vcf->history_partition_key = key_number - 1; // checked against key count when translating
+				continue;
+			}
+
+			if (kv[0] == "rollup")
+			{
+				uint64_t ticks_per_coarsest = 1;
+
+				vcf->rollup_factors.clear();
+
+				for (auto const& factor_s : meow::split_ex(kv[1], ":"))
+				{
+					uint32_t factor;
+					if (!meow::number_from_string(&factor, factor_s))
+						return ff::fmt_err("bad rollup: '{0}', expected <N>[:<N>...] integer numbers of ticks", kv[1]);
+
+					if (factor < 2)
+						return ff::fmt_err("bad rollup: '{0}', every factor must be >= 2", kv[1]);
+
+					vcf->rollup_factors.push_back(factor);
+					ticks_per_coarsest *= factor;
+				}
+
+				if (ticks_per_coarsest >= vcf->tick_count)
+					return ff::fmt_err("bad rollup: '{0}', coarsest tick ({1} ticks) must be shorter than time window ({2} ticks)",
+						kv[1], ticks_per_coarsest, vcf->tick_count);
+
+				continue;
+			}
+
+			if (kv[0] == "exemplars")
+			{
+				static constexpr uint32_t max_exemplars_count = 64;
+
+				if (!meow::number_from_string(&vcf->exemplars_count, kv[1]))
+					return ff::fmt_err("bad exemplars: '{0}', expected integer number of requests", kv[1]);
+
+				if (vcf->exemplars_count == 0 || vcf->exemplars_count > max_exemplars_count)
+					return ff::fmt_err("bad exemplars: {0}, expected value in range [1, {1}]", vcf->exemplars_count, max_exemplars_count);
+
+				continue;
+			}
+
+			if (kv[0] == "topk")
+			{
+				static constexpr uint32_t max_topk_size = 1 << 24;
+
+				auto const topk_v = meow::split_ex(kv[1], ":");
+				if (topk_v.size() > 2)
+					return ff::fmt_err("bad topk: '{0}', expected <N>[:<req_count|hit_count|time_total>]", kv[1]);
+
+				if (!meow::number_from_string(&vcf->topk_size, topk_v[0]))
+					return ff::fmt_err("bad topk: '{0}', expected integer number of keys", topk_v[0]);
+
+				if (vcf->topk_size == 0 || vcf->topk_size > max_topk_size)
+					return ff::fmt_err("bad topk: {0}, expected value in range [1, {1}]", vcf->topk_size, max_topk_size);
+
+				if (topk_v.size() > 1)
+				{
+					if (topk_v[1] == "req_count")
+						vcf->topk_metric = REPORT_TOPK_METRIC__REQ_COUNT;
+					else if (topk_v[1] == "hit_count")
+						vcf->topk_metric = REPORT_TOPK_METRIC__HIT_COUNT;
+					else if (topk_v[1] == "time_total")
+						vcf->topk_metric = REPORT_TOPK_METRIC__TIME_TOTAL;
+					else
+						return ff::fmt_err("bad topk metric: '{0}', expected one of 'req_count', 'hit_count', 'time_total'", topk_v[1]);
+				}
+
+				continue;
+			}
+
+			if (kv[0] == "max_mem")
+			{
+				str_ref const mem_s = kv[1];
+				if (mem_s.empty())
+					return ff::fmt_err("bad max_mem: '', expected <N>[k|m|g] bytes");
+
+				uint64_t multiplier = 1;
+				switch (mem_s.data()[mem_s.size() - 1])
+				{
+					case 'k': case 'K': multiplier = uint64_t(1) << 10; break;
+					case 'm': case 'M': multiplier = uint64_t(1) << 20; break;
+					case 'g': case 'G': multiplier = uint64_t(1) << 30; break;
+				}
+
+				str_ref const number_s = (multiplier > 1) ? meow::sub_str_ref(mem_s, 0, mem_s.size() - 1) : mem_s;
+
+				uint64_t max_mem;
+				if (!meow::number_from_string(&max_mem, number_s) || (max_mem == 0))
+					return ff::fmt_err("bad max_mem: '{0}', expected <N>[k|m|g] bytes, N > 0", mem_s);
+
+				vcf->max_mem = max_mem * multiplier;
+				continue;
+			}
+
+			if ((kv[0] == "distinct") || (kv[0] == "distinct_exact"))
+			{
+				// validated when translating, same syntax as in key_spec
+				if (kv[1].empty())
+					return ff::fmt_err("bad {0}: '', expected request field or request tag name, i.e. '~host' or '+tag'", kv[0]);
+
+				vcf->distinct_key   = kv[1];
+				vcf->distinct_exact = (kv[0] == "distinct_exact");
+				continue;
+			}
+
+			if (kv[0] == "order")
+			{
+				static constexpr uint32_t max_order_limit = 1 << 24;
+
+				auto const order_v = meow::split_ex(kv[1], ":");
+				if (order_v.size() > 2)
+					return ff::fmt_err("bad order: '{0}', expected <metric>[:<N>]", kv[1]);
+
+				if (order_v[0] == "req_count")
+					vcf->order_metric = PINBA_VIEW_ORDER__REQ_COUNT;
+				else if (order_v[0] == "hit_count")
+					vcf->order_metric = PINBA_VIEW_ORDER__HIT_COUNT;
+				else if (order_v[0] == "time_total")
+					vcf->order_metric = PINBA_VIEW_ORDER__TIME_TOTAL;
+				else if (order_v[0] == "ru_utime")
+					vcf->order_metric = PINBA_VIEW_ORDER__RU_UTIME;
+				else if (order_v[0] == "ru_stime")
+					vcf->order_metric = PINBA_VIEW_ORDER__RU_STIME;
+				else if (order_v[0] == "traffic")
+					vcf->order_metric = PINBA_VIEW_ORDER__TRAFFIC;
+				else if (order_v[0] == "mem_used")
+					vcf->order_metric = PINBA_VIEW_ORDER__MEM_USED;
+				else
+					return ff::fmt_err("bad order metric: '{0}', expected one of 'req_count', 'hit_count', 'time_total', 'ru_utime', 'ru_stime', 'traffic', 'mem_used'", order_v[0]);
+
+				if (order_v.size() > 1)
+				{
+					if (!meow::number_from_string(&vcf->order_limit, order_v[1]))
+						return ff::fmt_err("bad order: '{0}', expected integer number of rows", order_v[1]);
+
+					if (vcf->order_limit == 0 || vcf->order_limit > max_order_limit)
+						return ff::fmt_err("bad order: {0}, expected row limit in range [1, {1}]", vcf->order_limit, max_order_limit);
+				}
+
+				continue;
+			}
+
+			if (kv[0] == "stream")
+			{
+				static constexpr uint32_t min_partitions = 2;
+				static constexpr uint32_t max_partitions = 256;
+
+				if (!meow::number_from_string(&vcf->stream_partitions, kv[1]))
+					return ff::fmt_err("bad stream: '{0}', expected integer number of partitions", kv[1]);
+
+				if (vcf->stream_partitions < min_partitions || vcf->stream_partitions > max_partitions)
+					return ff::fmt_err("bad stream: {0}, expected value in range [{1}, {2}]", vcf->stream_partitions, min_partitions, max_partitions);
+
+				continue;
+			}
+
+			if (kv[0] == "metrics")
+			{
+				// prometheus metric name, [a-zA-Z_:][a-zA-Z0-9_:]*
+				str_ref const prefix = kv[1];
+
+				bool valid = !prefix.empty() && !isdigit((unsigned char)prefix[0]);
+				for (size_t j = 0; valid && (j < prefix.size()); j++)
+				{
+					char const c = prefix[j];
+					valid = isalnum((unsigned char)c) || (c == '_') || (c == ':');
+				}
+
+				if (!valid)
+					return ff::fmt_err("bad metrics: '{0}', expected metric name prefix, i.e. [a-zA-Z_:][a-zA-Z0-9_:]*", prefix);
+
+				vcf->metrics_prefix = prefix;
+				continue;
+			}
+
+			if (kv[0] == "skip_data")
+			{
+				for (auto const& column_s : meow::split_ex(kv[1], "|"))
+				{
+					if (column_s == "rusage")
+						vcf->data_skip |= REPORT_DATA_SKIP__RUSAGE;
+					else if (column_s == "traffic")
+						vcf->data_skip |= REPORT_DATA_SKIP__TRAFFIC;
+					else if (column_s == "mem_used")
+						vcf->data_skip |= REPORT_DATA_SKIP__MEM_USED;
+					else
+						return ff::fmt_err("bad skip_data: '{0}', expected '|' separated 'rusage', 'traffic', 'mem_used'", column_s);
+				}
+
+				continue;
+			}
+
+			return ff::fmt_err("unknown aggregation option: '{0}'", kv[0]);
+		}
+
+		// ordered rows come from the whole report at once
+		if ((vcf->stream_partitions > 0) && (vcf->order_metric != PINBA_VIEW_ORDER__NONE))
+			return ff::fmt_err("stream and order options can't be used together");
+
 		return {};
 	}
 
@@ -138,6 +471,47 @@ namespace { namespace aux {
 				vcf->hv_bucket_d     = (hv_upper_ms - hv_lower_ms) * d_millisecond / hv_bucket_count;
 				vcf->hv_min_value    = hv_lower_ms * d_millisecond;
 			}
+			else if (meow::prefix_compare(pct_s, "dd=")) // 3 chars
+			{
+				auto const dd_s        = meow::sub_str_ref(pct_s, 3, pct_s.size());
+				auto const dd_values_v = meow::split_ex(dd_s, ":");
+
+				if (dd_values_v.size() > 2)
+					return ff::fmt_err("dd=<relative_accuracy_percent>[:<max_time_ms>] expected, got '{0}'", pct_s);
+
+				// dd=<relative_accuracy_percent>[:<max_time_ms>]
+				double accuracy_pct;
+				if (!meow::number_from_string(&accuracy_pct, dd_values_v[0]))
+					return ff::fmt_err("can't parse relative_accuracy_percent from '{0}'", pct_s);
+
+				if (accuracy_pct < 0.1 || accuracy_pct > 10)
+					return ff::fmt_err("histogram_spec: relative_accuracy_percent must be in range [0.1, 10], in '{0}'", pct_s);
+
+				uint32_t max_ms = 3600 * 1000; // an hour should be enough for everyone
+				if (dd_values_v.size() > 1)
+				{
+					if (!meow::number_from_string(&max_ms, dd_values_v[1]) || (max_ms == 0))
+						return ff::fmt_err("can't parse max_time_ms from '{0}'", pct_s);
+				}
+
+				// log-scale buckets, see histogram_conf_t::rel_accuracy
+				// 1 microsecond units, hdr then needs every bucket id to be a separate counter, that's 14 bits max
+				static constexpr uint32_t max_dd_bucket_count = (1 << 15) - 1;
+
+				double const   rel_accuracy = accuracy_pct / 100;
+				uint32_t const bucket_count = histogram___dd_bucket_count(rel_accuracy, double(max_ms) * 1000);
+
+				if (bucket_count > max_dd_bucket_count)
+					return ff::fmt_err("histogram_spec: '{0}' needs {1} buckets, max is {2}, lower the accuracy or max_time_ms",
+						pct_s, bucket_count, max_dd_bucket_count);
+
+				hv_present = true;
+
+				vcf->hv_bucket_count = bucket_count;
+				vcf->hv_bucket_d     = d_microsecond;
+				vcf->hv_min_value    = {0};
+				vcf->hv_rel_accuracy = rel_accuracy;
+			}
 			else if (meow::prefix_compare(pct_s, "percentiles=")) // 12 chars
 			{
 				auto const pct_spec      = meow::sub_str_ref(pct_s, 12, pct_s.size());
@@ -170,7 +544,7 @@ namespace { namespace aux {
 
 		// TODO: should make histogram setup optional (i.e. have sensible defaults)
 		if (!hv_present)
-			return ff::fmt_err("hv=<time_lower>:<time_upper>:<n_buckets> must be present");
+			return ff::fmt_err("hv=<time_lower>:<time_upper>:<n_buckets> or dd=<relative_accuracy_percent> must be present");
 
 		if (vcf->hv_bucket_count > PINBA_LIMIT___MAX_HISTOGRAM_SIZE)
 			return ff::fmt_err("we support maximum of {0} histogram buckets (this is a tunable compile-time constant)", PINBA_LIMIT___MAX_HISTOGRAM_SIZE);
@@ -184,6 +558,34 @@ namespace { namespace aux {
 	}
 
 
+	// a|b|c -> {a, b, c}, '\|' is a literal '|' inside a value, other backslashes are left as is (i.e. for regexes)
+	static std::vector<std::string> split_filter_values(str_ref value)
+	{
+		std::vector<std::string> result(1);
+
+		for (size_t i = 0; i < value.size(); i++)
+		{
+			char const c = value[i];
+
+			if ((c == '\\') && (i + 1 < value.size()) && (value[i + 1] == '|'))
+			{
+				result.back().push_back('|');
+				i++;
+				continue;
+			}
+
+			if (c == '|')
+			{
+				result.emplace_back();
+				continue;
+			}
+
+			result.back().push_back(c);
+		}
+
+		return result;
+	}
+
 	static pinba_error_t parse_filters(pinba_view_conf_t *vcf, str_ref filters_spec)
 	{
 		if (filters_spec == "no_filters")
@@ -220,7 +622,7 @@ namespace { namespace aux {
 			}
 
 			// key=value pair for field/rtag/timertag filtering
-			vcf->filters.push_back({ key_s, value_s});
+			vcf->filters.push_back({ key_s, value_s, split_filter_values(value_s) });
 		}
 
 		return {};
@@ -253,6 +655,79 @@ namespace { namespace aux {
 			return result;
 		}
 
+		if (report_type == "latency")
+		{
+			result->kind = pinba_view_kind::pipeline_latency;
+			return result;
+		}
+
+		if (report_type == "capture")
+		{
+			result->kind = pinba_view_kind::packet_capture;
+
+			// first columns (hostname, server_name, script_name) act as keys, for condition pushdown, see PACKET_CAPTURE_FIELD__*
+			pinba_error_t const err = parse_keys(result.get(), meow::ref_lit("~host,~server,~script"));
+			if (err)
+				throw std::runtime_error(ff::fmt_str("capture keys: {0}", err));
+
+			return result;
+		}
+
+		if (report_type == "series")
+		{
+			if (parts.size() != 4)
+				throw std::runtime_error("'series' options are: <timer_report_table>/<key_spec>");
+
+			result->kind          = pinba_view_kind::report_by_timer_series;
+			result->source_report = parts[2];
+
+			if (result->source_report.empty())
+				throw std::runtime_error("'series' needs a timer report table name");
+
+			pinba_error_t const err = parse_keys(result.get(), parts[3]);
+			if (err)
+				throw std::runtime_error(ff::fmt_str("bad key_spec: {0}", err));
+
+			return result;
+		}
+
+		if (report_type == "exemplars")
+		{
+			if (parts.size() != 4)
+				throw std::runtime_error("'exemplars' options are: <request_report_table>/<key_spec>");
+
+			result->kind          = pinba_view_kind::report_by_request_exemplars;
+			result->source_report = parts[2];
+
+			if (result->source_report.empty())
+				throw std::runtime_error("'exemplars' needs a request report table name");
+
+			pinba_error_t const err = parse_keys(result.get(), parts[3]);
+			if (err)
+				throw std::runtime_error(ff::fmt_str("bad key_spec: {0}", err));
+
+			return result;
+		}
+
+		// same rows as report table, re-aggregated by some of its keys, data and percentile columns are the same as report has
+		if (report_type == "rollup")
+		{
+			if (parts.size() != 4)
+				throw std::runtime_error("'rollup' options are: <report_table>/<key_spec>");
+
+			result->kind          = pinba_view_kind::report_rollup;
+			result->source_report = parts[2];
+
+			if (result->source_report.empty())
+				throw std::runtime_error("'rollup' needs a request or timer report table name");
+
+			pinba_error_t const err = parse_keys(result.get(), parts[3]);
+			if (err)
+				throw std::runtime_error(ff::fmt_str("bad key_spec: {0}", err));
+
+			return result;
+		}
+
 		if (report_type == "packet" || report_type == "info") // support 'info' here for 'compatibility' with pinba_engine
 		{
 			result->kind = pinba_view_kind::report_by_packet_data;
@@ -271,6 +746,27 @@ namespace { namespace aux {
 			if (err)
 				throw std::runtime_error(ff::fmt_str("bad aggregation_spec: {0}", err));
 
+			if (!result->distinct_key.empty())
+				throw std::runtime_error("bad aggregation_spec: distinct is only supported for 'request' reports");
+
+			if (result->exemplars_count > 0)
+				throw std::runtime_error("bad aggregation_spec: exemplars are only supported for 'request' reports");
+
+			if (result->order_metric != PINBA_VIEW_ORDER__NONE)
+				throw std::runtime_error("bad aggregation_spec: order is only supported for 'request' and 'timer' reports");
+
+			if (result->hv_summary_points > 0)
+				throw std::runtime_error("bad aggregation_spec: hv_summary is only supported for 'request' and 'timer' reports");
+
+			if (result->hv_idle_d.nsec > 0)
+				throw std::runtime_error("bad aggregation_spec: hv_idle is only supported for 'request' and 'timer' reports");
+
+			if (result->history_partitions > 0)
+				throw std::runtime_error("bad aggregation_spec: partitions are only supported for 'timer' reports");
+
+			if (result->stream_partitions > 0)
+				throw std::runtime_error("bad aggregation_spec: stream is only supported for 'request' and 'timer' reports");
+
 			if (key_spec != "no_keys")
 				throw std::runtime_error("key_spec must be 'no_keys' for 'packet' data reports");
 
@@ -303,6 +799,12 @@ namespace { namespace aux {
 			if (err)
 				throw std::runtime_error(ff::fmt_str("bad aggregation_spec: {0}", err));
 
+			if (result->order_metric == PINBA_VIEW_ORDER__HIT_COUNT)
+				throw std::runtime_error("bad aggregation_spec: order by hit_count is only supported for 'timer' reports");
+
+			if (result->history_partitions > 0)
+				throw std::runtime_error("bad aggregation_spec: partitions are only supported for 'timer' reports");
+
 			err = parse_keys(result.get(), key_spec);
 			if (err)
 				throw std::runtime_error(ff::fmt_str("bad key_spec: {0}", err));
@@ -336,6 +838,15 @@ namespace { namespace aux {
 			if (err)
 				throw std::runtime_error(ff::fmt_str("bad aggregation_spec: {0}", err));
 
+			if (!result->distinct_key.empty())
+				throw std::runtime_error("bad aggregation_spec: distinct is only supported for 'request' reports");
+
+			if (result->exemplars_count > 0)
+				throw std::runtime_error("bad aggregation_spec: exemplars are only supported for 'request' reports");
+
+			if ((result->order_metric == PINBA_VIEW_ORDER__TRAFFIC) || (result->order_metric == PINBA_VIEW_ORDER__MEM_USED))
+				throw std::runtime_error("bad aggregation_spec: order by traffic or mem_used is only supported for 'request' reports");
+
 			err = parse_keys(result.get(), key_spec);
 			if (err)
 				throw std::runtime_error(ff::fmt_str("bad key_spec: {0}", err));
@@ -438,6 +949,138 @@ namespace { namespace aux {
 		}
 	}
 
+	// filter value with alternatives (a|b|c, see split_filter_values()) or patterns, each alternative is one of
+	//  - exact value
+	//  - prefix*    - words starting with prefix
+	//  - re:<regex> - words matching (std::regex_search, ecmascript) regex
+	//  - num:A..B   - integer tag values in [A, B] (see dictionary_int_words_t), tags only
+	// *out is left empty for single exact value, caller should use plain *_EQ filter then
+	// get_id - gets word id for exact values (fields and tags have different ones)
+	// with_patterns - false for things that aren't words (status), patterns are an error then
+	// with_ints - tag values, that might be sent as integers, numeric exact values then match both string and integer
+	template<class GetWordId>
+	static pinba_error_t make_filter_word_set(packet_filter_word_set_ptr *out, pinba_view_conf_t::filter_spec_t const& filter, bool with_patterns, bool with_ints, GetWordId const& get_id)
+	{
+		struct pattern_t
+		{
+			std::string                 prefix;
+			std::shared_ptr<std::regex> re;     // prefix is unused when set
+		};
+
+		std::vector<uint32_t>  word_ids;
+		std::vector<pattern_t> patterns;
+		std::vector<packet_filter_word_set_t::int_range_t> int_ranges;
+
+		auto const parse_int = [](str_ref s, uint32_t *v) -> bool
+		{
+			uint64_t result = 0;
+			for (char const c : s)
+			{
+				if (c < '0' || c > '9')
+					return false;
+
+				result = result * 10 + (c - '0');
+				if (result > dictionary_int_words_t::value_max)
+					return false;
+			}
+
+			*v = uint32_t(result);
+			return !s.empty();
+		};
+
+		for (str_ref const value : filter.values)
+		{
+			if (value.empty())
+				return ff::fmt_err("filter {0}: empty value in '{1}'", filter.key, filter.value);
+
+			if (meow::prefix_compare(value, "num:"))
+			{
+				if (!with_ints)
+					return ff::fmt_err("filter {0}: numeric ranges are only supported for tags", filter.key);
+
+				auto const range_s = meow::sub_str_ref(value, 4, value.size());
+				auto const dots    = range_s.str().find("..");
+
+				uint32_t from, to;
+				if (dots == std::string::npos
+					|| !parse_int(meow::sub_str_ref(range_s, 0, dots), &from)
+					|| !parse_int(meow::sub_str_ref(range_s, dots + 2, range_s.size()), &to)
+					|| from > to)
+					return ff::fmt_err("filter {0}: bad numeric range '{1}', expected num:A..B, with 0 <= A <= B <= {2}", filter.key, value, dictionary_int_words_t::value_max);
+
+				int_ranges.emplace_back(dictionary_int_words_t::id_from_value(from), dictionary_int_words_t::id_from_value(to));
+				continue;
+			}
+
+			if (meow::prefix_compare(value, "re:"))
+			{
+				try {
+					auto const re_s = meow::sub_str_ref(value, 3, value.size());
+					patterns.push_back({ {}, std::make_shared<std::regex>(re_s.data(), re_s.size(), std::regex::ECMAScript | std::regex::optimize) });
+				} catch (std::regex_error const& e) {
+					return ff::fmt_err("filter {0}: bad regex '{1}': {2}", filter.key, value, e.what());
+				}
+				continue;
+			}
+
+			if (value[value.size() - 1] == '*')
+			{
+				patterns.push_back({ meow::sub_str_ref(value, 0, value.size() - 1).str(), {} });
+				continue;
+			}
+
+			word_ids.push_back(get_id(value));
+
+			// '200' might come as a string or as an integer, depending on client, match both
+			if (with_ints)
+			{
+				uint32_t const int_id = dictionary_int_words_t::id_from_str(value);
+				if (int_id != 0)
+					word_ids.push_back(int_id);
+			}
+		}
+
+		if (!patterns.empty() && !with_patterns)
+			return ff::fmt_err("filter {0}: patterns are not supported for this field, use exact values", filter.key);
+
+		if (patterns.empty() && int_ranges.empty() && (word_ids.size() == 1))
+		{
+			out->reset();
+			return {};
+		}
+
+		auto ws = std::make_shared<packet_filter_word_set_t>();
+		ws->spec       = filter.value.str();
+		ws->word_ids   = std::move(word_ids);
+		ws->int_ranges = std::move(int_ranges);
+		std::sort(ws->word_ids.begin(), ws->word_ids.end());
+
+		if (!patterns.empty())
+		{
+			try {
+				// XXX: try to avoid modifying global state here
+				ws->matcher = P_G_->dictionary()->add_word_matcher([patterns](str_ref word) -> bool
+				{
+					for (auto const& p : patterns)
+					{
+						bool const matched = (p.re)
+								? std::regex_search(word.begin(), word.end(), *p.re)
+								: meow::prefix_compare(word, str_ref { p.prefix });
+
+						if (matched)
+							return true;
+					}
+					return false;
+				});
+			} catch (std::exception const& e) {
+				return ff::fmt_err("filter {0}: {1}", filter.key, e.what());
+			}
+		}
+
+		*out = std::move(ws);
+		return {};
+	}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 	pinba_error_t pinba_view_conf___translate(report_conf___by_packet_t *conf, pinba_view_conf_t const& vcf)
@@ -447,9 +1090,14 @@ namespace { namespace aux {
 		conf->name            = vcf.name;
 		conf->time_window     = vcf.time_window;
 		conf->tick_count      = vcf.tick_count;
+		conf->agg_threads     = vcf.agg_threads;
 		conf->hv_bucket_count = vcf.hv_bucket_count;
 		conf->hv_bucket_d     = vcf.hv_bucket_d;
 		conf->hv_min_value    = vcf.hv_min_value;
+		conf->hv_rel_accuracy = vcf.hv_rel_accuracy;
+
+		if (vcf.data_skip != 0)
+			return ff::fmt_err("skip_data is not supported for 'packet' reports");
 
 		if (vcf.min_time.nsec)
 			conf->filters.push_back(report_conf___by_packet_t::make_filter___by_min_time(vcf.min_time));
@@ -469,16 +1117,46 @@ namespace { namespace aux {
 			{
 				case RKD_REQUEST_FIELD:
 				{
+					packet_filter_word_set_ptr word_set;
+					pinba_error_t const ws_err = make_filter_word_set(&word_set, filter, (kd.request_field != &packet_t::status), false, [&](str_ref value)
+					{
+						// XXX: try to avoid modifying global state here
+						return P_G_->dictionary()->get_or_add___field(packet_field___permanent_flag(kd.request_field), value);
+					});
+					if (ws_err)
+						return ws_err;
+
+					if (word_set)
+					{
+						conf->filters.push_back(report_conf___by_packet_t::make_filter___by_request_field_in(kd.request_field, word_set));
+						break;
+					}
+
 					// XXX: try to avoid modifying global state here
-					uint32_t const value_id = P_G_->dictionary()->get_or_add(filter.value);
+					uint32_t const value_id = P_G_->dictionary()->get_or_add___field(packet_field___permanent_flag(kd.request_field), filter.values[0]);
 					conf->filters.push_back(report_conf___by_packet_t::make_filter___by_request_field(kd.request_field, value_id));
 				}
 				break;
 
 				case RKD_REQUEST_TAG:
 				{
+					packet_filter_word_set_ptr word_set;
+					pinba_error_t const ws_err = make_filter_word_set(&word_set, filter, true, true, [&](str_ref value)
+					{
+						// XXX: try to avoid modifying global state here
+						return P_G_->dictionary()->get_or_add(value);
+					});
+					if (ws_err)
+						return ws_err;
+
+					if (word_set)
+					{
+						conf->filters.push_back(report_conf___by_packet_t::make_filter___by_request_tag_in(kd.request_tag, word_set));
+						break;
+					}
+
 					// XXX: try to avoid modifying global state here
-					uint32_t const value_id = P_G_->dictionary()->get_or_add(filter.value);
+					uint32_t const value_id = P_G_->dictionary()->get_or_add(filter.values[0]);
 					conf->filters.push_back(report_conf___by_packet_t::make_filter___by_request_tag(kd.request_tag, value_id));
 				}
 				break;
@@ -503,9 +1181,24 @@ namespace { namespace aux {
 		conf->name            = vcf.name;
 		conf->time_window     = vcf.time_window;
 		conf->tick_count      = vcf.tick_count;
+		conf->agg_threads     = vcf.agg_threads;
+		conf->hashtable_kind  = vcf.hashtable_kind;
 		conf->hv_bucket_count = vcf.hv_bucket_count;
 		conf->hv_bucket_d     = vcf.hv_bucket_d;
 		conf->hv_min_value    = vcf.hv_min_value;
+		conf->hv_rel_accuracy = vcf.hv_rel_accuracy;
+		conf->hv_kind         = vcf.hv_kind;
+		conf->hv_summary_points = vcf.hv_summary_points;
+		conf->hv_idle_d       = vcf.hv_idle_d;
+
+		if ((vcf.hv_summary_points > 0) && (vcf.hv_kind == HISTOGRAM_KIND__HDR))
+			return ff::fmt_err("hv_summary needs hv_storage=flat, hdr histograms are never summarized");
+
+		if ((vcf.hv_summary_points > 0) && vcf.percentiles.empty())
+			return ff::fmt_err("hv_summary needs percentiles, there are no histograms to summarize");
+
+		if ((vcf.hv_idle_d.nsec > 0) && vcf.percentiles.empty())
+			return ff::fmt_err("hv_idle needs percentiles, there are no histograms to suspend");
 
 		for (auto const& key_name : vcf.keys)
 		{
@@ -538,6 +1231,38 @@ namespace { namespace aux {
 			conf->keys.push_back(real_kd);
 		}
 
+		if (!vcf.distinct_key.empty())
+		{
+			key_descriptor_t kd;
+
+			pinba_error_t const err = key_descriptor_by_name(&kd, vcf.distinct_key);
+			if (err)
+				return err;
+
+			switch (kd.kind)
+			{
+				case RKD_REQUEST_FIELD:
+					conf->distinct_key = report_conf___by_request_t::key_descriptor_by_request_field(kd.name, kd.request_field);
+					break;
+
+				case RKD_REQUEST_TAG:
+					conf->distinct_key = report_conf___by_request_t::key_descriptor_by_request_tag(kd.name, kd.request_tag);
+					break;
+
+				case RKD_TIMER_TAG:
+					return ff::fmt_err("distinct: timer_tag are not allowed in 'request' reports, got '{0}'", vcf.distinct_key);
+
+				default:
+					assert(!"can't be reached");
+					break;
+			}
+
+			conf->distinct_exact = vcf.distinct_exact;
+		}
+
+		conf->exemplars_count = vcf.exemplars_count;
+		conf->data_skip       = vcf.data_skip;
+
 		if (vcf.min_time.nsec)
 			conf->filters.push_back(report_conf___by_request_t::make_filter___by_min_time(vcf.min_time));
 
@@ -556,16 +1281,46 @@ namespace { namespace aux {
 			{
 				case RKD_REQUEST_FIELD:
 				{
+					packet_filter_word_set_ptr word_set;
+					pinba_error_t const ws_err = make_filter_word_set(&word_set, filter, (kd.request_field != &packet_t::status), false, [&](str_ref value)
+					{
+						// XXX: try to avoid modifying global state here
+						return P_G_->dictionary()->get_or_add___field(packet_field___permanent_flag(kd.request_field), value);
+					});
+					if (ws_err)
+						return ws_err;
+
+					if (word_set)
+					{
+						conf->filters.push_back(report_conf___by_request_t::make_filter___by_request_field_in(kd.request_field, word_set));
+						break;
+					}
+
 					// XXX: try to avoid modifying global state here
-					uint32_t const value_id = P_G_->dictionary()->get_or_add(filter.value);
+					uint32_t const value_id = P_G_->dictionary()->get_or_add___field(packet_field___permanent_flag(kd.request_field), filter.values[0]);
 					conf->filters.push_back(report_conf___by_request_t::make_filter___by_request_field(kd.request_field, value_id));
 				}
 				break;
 
 				case RKD_REQUEST_TAG:
 				{
+					packet_filter_word_set_ptr word_set;
+					pinba_error_t const ws_err = make_filter_word_set(&word_set, filter, true, true, [&](str_ref value)
+					{
+						// XXX: try to avoid modifying global state here
+						return P_G_->dictionary()->get_or_add(value);
+					});
+					if (ws_err)
+						return ws_err;
+
+					if (word_set)
+					{
+						conf->filters.push_back(report_conf___by_request_t::make_filter___by_request_tag_in(kd.request_tag, word_set));
+						break;
+					}
+
 					// XXX: try to avoid modifying global state here
-					uint32_t const value_id = P_G_->dictionary()->get_or_add(filter.value);
+					uint32_t const value_id = P_G_->dictionary()->get_or_add(filter.values[0]);
 					conf->filters.push_back(report_conf___by_request_t::make_filter___by_request_tag(kd.request_tag, value_id));
 				}
 				break;
@@ -591,9 +1346,46 @@ namespace { namespace aux {
 		conf->name            = vcf.name;
 		conf->time_window     = vcf.time_window;
 		conf->tick_count      = vcf.tick_count;
+		conf->agg_threads     = vcf.agg_threads;
+		conf->hashtable_kind  = vcf.hashtable_kind;
+		conf->tick_storage    = vcf.tick_storage;
+		conf->rollup_factors  = vcf.rollup_factors;
+		conf->topk_size       = vcf.topk_size;
+		conf->topk_metric     = vcf.topk_metric;
+		conf->max_mem         = vcf.max_mem;
+		conf->data_skip       = vcf.data_skip;
+
+		if (vcf.data_skip & ~REPORT_DATA_SKIP__RUSAGE)
+			return ff::fmt_err("skip_data: timer reports have no traffic and mem_used, only 'rusage' can be skipped");
 		conf->hv_bucket_count = vcf.hv_bucket_count;
 		conf->hv_bucket_d     = vcf.hv_bucket_d;
 		conf->hv_min_value    = vcf.hv_min_value;
+		conf->hv_rel_accuracy = vcf.hv_rel_accuracy;
+		conf->hv_summary_points = vcf.hv_summary_points;
+		conf->hv_idle_d       = vcf.hv_idle_d;
+
+		if ((vcf.hv_summary_points > 0) && vcf.percentiles.empty())
+			return ff::fmt_err("hv_summary needs percentiles, there are no histograms to summarize");
+
+		if ((vcf.hv_idle_d.nsec > 0) && vcf.percentiles.empty())
+			return ff::fmt_err("hv_idle needs percentiles, there are no histograms to suspend");
+
+		conf->history_partitions    = vcf.history_partitions;
+		conf->history_partition_key = vcf.history_partition_key;
+
+		if (vcf.history_partitions > 0)
+		{
+			if (vcf.history_partition_key >= vcf.keys.size())
+				return ff::fmt_err("partitions: key part {0} is out of range, report has {1} key parts", vcf.history_partition_key + 1, vcf.keys.size());
+
+			// compressed ticks are sorted by key and decoded sequentially, there are no row ranges to skip
+			if (vcf.tick_storage == REPORT_TICK_STORAGE__COMPRESSED)
+				return ff::fmt_err("partitions are not supported with tick_storage=compressed");
+		}
+
+		// timer history has several tick formats (compressed, rollup tiers), all of those keep flat histograms
+		if (vcf.hv_kind == HISTOGRAM_KIND__HDR)
+			return ff::fmt_err("hv_storage=hdr is not supported for 'timer' reports");
 
 		for (auto const& key_name : vcf.keys)
 		{
@@ -645,24 +1437,103 @@ namespace { namespace aux {
 			{
 				case RKD_REQUEST_FIELD:
 				{
+					packet_filter_word_set_ptr word_set;
+					pinba_error_t const ws_err = make_filter_word_set(&word_set, filter, (kd.request_field != &packet_t::status), false, [&](str_ref value)
+					{
+						// XXX: try to avoid modifying global state here
+						return P_G_->dictionary()->get_or_add___field(packet_field___permanent_flag(kd.request_field), value);
+					});
+					if (ws_err)
+						return ws_err;
+
+					if (word_set)
+					{
+						conf->filters.push_back(report_conf___by_timer_t::make_filter___by_request_field_in(kd.request_field, word_set));
+						break;
+					}
+
 					// XXX: try to avoid modifying global state here
-					uint32_t const value_id = P_G_->dictionary()->get_or_add(filter.value);
+					uint32_t const value_id = P_G_->dictionary()->get_or_add___field(packet_field___permanent_flag(kd.request_field), filter.values[0]);
 					conf->filters.push_back(report_conf___by_timer_t::make_filter___by_request_field(kd.request_field, value_id));
 				}
 				break;
 
 				case RKD_REQUEST_TAG:
 				{
+					packet_filter_word_set_ptr word_set;
+					pinba_error_t const ws_err = make_filter_word_set(&word_set, filter, true, true, [&](str_ref value)
+					{
+						// XXX: try to avoid modifying global state here
+						return P_G_->dictionary()->get_or_add(value);
+					});
+					if (ws_err)
+						return ws_err;
+
+					if (word_set)
+					{
+						conf->filters.push_back(report_conf___by_timer_t::make_filter___by_request_tag_in(kd.request_tag, word_set));
+						break;
+					}
+
 					// XXX: try to avoid modifying global state here
-					uint32_t const value_id = P_G_->dictionary()->get_or_add(filter.value);
+					uint32_t const value_id = P_G_->dictionary()->get_or_add(filter.values[0]);
 					conf->filters.push_back(report_conf___by_timer_t::make_filter___by_request_tag(kd.request_tag, value_id));
 				}
 				break;
 
 				case RKD_TIMER_TAG:
 				{
+					// @tag=a|b|c - timer tag has any of these values
+					// @tag=db_*|re:^cache[0-9]+$ - or matches any of these patterns
+					// @tag=200|num:500..599 - numeric values match integer values too, see make_filter_word_set()
+					auto const& values = filter.values;
+
+					bool const needs_word_set = std::any_of(values.begin(), values.end(), [](str_ref v)
+					{
+						return meow::prefix_compare(v, "re:") || meow::prefix_compare(v, "num:")
+							|| (!v.empty() && (v[v.size() - 1] == '*'))
+							|| (dictionary_int_words_t::id_from_str(v) != 0);
+					});
+
+					if (needs_word_set)
+					{
+						packet_filter_word_set_ptr word_set;
+						pinba_error_t const ws_err = make_filter_word_set(&word_set, filter, true, true, [&](str_ref value)
+						{
+							// XXX: try to avoid modifying global state here
+							return P_G_->dictionary()->get_or_add(value);
+						});
+						if (ws_err)
+							return ws_err;
+
+						LOG_DEBUG(P_L_, "{0}; report: {1}, adding timertag_filter: {2}:{3} -> {4}",
+							__func__, conf->name, filter.key, kd.timer_tag, filter.value);
+
+						conf->timertag_filters.push_back(report_conf___by_timer_t::make_timertag_filter_in(kd.timer_tag, word_set));
+						break;
+					}
+
+					if (values.size() > 1)
+					{
+						std::vector<uint32_t> value_ids;
+						for (auto const& value : values)
+						{
+							if (value.empty())
+								return ff::fmt_err("filter {0}: empty value in '{1}'", filter.key, filter.value);
+
+							// XXX: try to avoid modifying global state here
+							value_ids.push_back(P_G_->dictionary()->get_or_add(value));
+						}
+
+						LOG_DEBUG(P_L_, "{0}; report: {1}, adding timertag_filter: {2}:{3} -> {4}:{5}",
+							__func__, conf->name, filter.key, kd.timer_tag, filter.value, value_ids.size());
+
+						conf->timertag_filters.push_back(report_conf___by_timer_t::make_timertag_filter_any(kd.timer_tag, value_ids));
+						break;
+					}
+
 					// XXX: try to avoid modifying global state here
-					uint32_t const value_id = P_G_->dictionary()->get_or_add(filter.value);
+					uint32_t const value_id = P_G_->dictionary()->get_or_add(filter.values[0]);
 
 					LOG_DEBUG(P_L_, "{0}; report: {1}, adding timertag_filter: {2}:{3} -> {4}:{5}",
 						__func__, conf->name, filter.key, kd.timer_tag, filter.value, value_id);
@@ -686,6 +1557,11 @@ namespace { namespace aux {
 		{
 			case pinba_view_kind::stats:
 			case pinba_view_kind::active_reports:
+			case pinba_view_kind::pipeline_latency:
+			case pinba_view_kind::report_by_timer_series:
+			case pinba_view_kind::report_by_request_exemplars:
+			case pinba_view_kind::report_rollup:
+			case pinba_view_kind::packet_capture:
 				return {};
 
 			case pinba_view_kind::report_by_request_data:
@@ -716,6 +1592,14 @@ namespace { namespace aux {
 		if (vcf.min_time.nsec != 0 && vcf.max_time.nsec != 0 && vcf.min_time > vcf.max_time)
 			return ff::fmt_err("min_time should be < max_time");
 
+		bool const order_by_rusage = (vcf.order_metric == PINBA_VIEW_ORDER__RU_UTIME) || (vcf.order_metric == PINBA_VIEW_ORDER__RU_STIME);
+		if ((order_by_rusage && (vcf.data_skip & REPORT_DATA_SKIP__RUSAGE))
+			|| ((vcf.order_metric == PINBA_VIEW_ORDER__TRAFFIC) && (vcf.data_skip & REPORT_DATA_SKIP__TRAFFIC))
+			|| ((vcf.order_metric == PINBA_VIEW_ORDER__MEM_USED) && (vcf.data_skip & REPORT_DATA_SKIP__MEM_USED)))
+		{
+			return ff::fmt_err("order: can't order by a column from skip_data");
+		}
+
 		return {};
 	}
 
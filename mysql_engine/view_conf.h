@@ -18,11 +18,26 @@ struct report_conf___by_timer_t;
 MEOW_DEFINE_SMART_ENUM_STRUCT(pinba_view_kind,
 								((stats,                   "stats"))
 								((active_reports,          "active_reports"))
+								((pipeline_latency,        "pipeline_latency"))
 								((report_by_request_data,  "report_by_request_data"))
 								((report_by_timer_data,    "report_by_timer_data"))
 								((report_by_packet_data,   "report_by_packet_data"))
+								((report_by_timer_series,  "report_by_timer_series"))
+								((report_by_request_exemplars, "report_by_request_exemplars"))
+								((report_rollup,           "report_rollup"))
+								((packet_capture,          "packet_capture"))
 								);
 
+// rows order in selects (see 'order' aggregation option), descending by given metric
+#define PINBA_VIEW_ORDER__NONE        0 // hashtable order
+#define PINBA_VIEW_ORDER__REQ_COUNT   1
+#define PINBA_VIEW_ORDER__HIT_COUNT   2 // timer reports only
+#define PINBA_VIEW_ORDER__TIME_TOTAL  3
+#define PINBA_VIEW_ORDER__RU_UTIME    4
+#define PINBA_VIEW_ORDER__RU_STIME    5
+#define PINBA_VIEW_ORDER__TRAFFIC     6 // request reports only
+#define PINBA_VIEW_ORDER__MEM_USED    7 // request reports only
+
 struct pinba_view_conf_t : private boost::noncopyable
 {
 	std::string                 orig_comment;
@@ -31,6 +46,27 @@ struct pinba_view_conf_t : private boost::noncopyable
 	pinba_view_kind_t           kind;
 	duration_t                  time_window;
 	uint32_t                    tick_count;
+	uint32_t                    agg_threads;
+	int                         hashtable_kind; // REPORT_HASHTABLE__*
+	int                         tick_storage;   // REPORT_TICK_STORAGE__*
+	int                         hv_kind;        // HISTOGRAM_KIND__*, how history keeps histograms
+	uint32_t                    hv_summary_points; // history keeps quantile summaries of histograms, 0 = full histograms
+	duration_t                  hv_idle_d;      // histograms are not collected after this long without percentile selects, 0 = always
+	uint32_t                    history_partitions;    // 'timer' reports only, history ticks are split by history_partition_key hash, 0 = not split
+	uint32_t                    history_partition_key; // key part index (0 based)
+	std::vector<uint32_t>       rollup_factors; // history tiers, see report_history_tiered_ringbuffer_t
+	uint32_t                    topk_size;      // keep ~N heaviest keys only, 0 = all keys
+	int                         topk_metric;    // REPORT_TOPK_METRIC__*
+	uint64_t                    max_mem;        // bytes, 0 = no limit
+	str_ref                     distinct_key;   // 'request' reports only, empty = no distinct_count column
+	bool                        distinct_exact; // distinct_key values are counted exactly (bitmaps), not estimated
+	int                         order_metric;   // PINBA_VIEW_ORDER__*, selects get rows sorted by this
+	uint32_t                    order_limit;    // selects get only this many top rows, 0 = all rows
+	uint32_t                    stream_partitions; // unordered scans merge and return rows one key hash partition at a time, 0 = merge everything first
+	str_ref                     metrics_prefix; // serve report on /metrics with this family name prefix, empty = don't
+	str_ref                     source_report;  // 'series', 'exemplars' and 'rollup' views only, table name of the report to read
+	uint32_t                    exemplars_count; // 'request' reports only, keep N slowest requests per row per tick, 0 = none
+	uint32_t                    data_skip;      // REPORT_DATA_SKIP__* bits, data columns report doesn't aggregate
 
 	std::vector<str_ref>        keys;
 
@@ -38,12 +74,14 @@ struct pinba_view_conf_t : private boost::noncopyable
 	{
 		str_ref key;
 		str_ref value;
+		std::vector<std::string> values; // value split on '|' into alternatives, '\|' is a literal '|' (not a split)
 	};
 	std::vector<filter_spec_t>  filters;
 
 	uint32_t                    hv_bucket_count;
 	duration_t                  hv_bucket_d;
 	duration_t                  hv_min_value;
+	double                      hv_rel_accuracy; // > 0 for log-scale buckets (dd=...), see histogram_conf_t
 	std::vector<double>         percentiles;
 
 	duration_t                  min_time;    // 0 if unset
@@ -47,6 +47,9 @@ size_t pinba__request__get_packed_size
   const size_t tag_value__tag_size = 2;
   const size_t timer_ru_utime__tag_size = 2;
   const size_t timer_ru_stime__tag_size = 2;
+  const size_t summary_count__tag_size = 2;
+  const size_t summary_hist_us__tag_size = 2;
+  const size_t summary_hist_count__tag_size = 2;
   sz += hostname__tag_size;
   sz += bytes_size(message->hostname);
   sz += server_name__tag_size;
@@ -156,6 +159,26 @@ size_t pinba__request__get_packed_size
     rv = 4 * message->n_timer_ru_stime;
     sz += rv;
   }
+  if (message->has_summary_count) {
+    sz += summary_count__tag_size;
+    sz += uint32_size(message->summary_count);
+  }
+  if (message->n_summary_hist_us > 0) {
+    sz += summary_hist_us__tag_size * message->n_summary_hist_us;
+    rv = 0;
+    for (i = 0; i < message->n_summary_hist_us; i++) {
+      rv += uint32_size(message->summary_hist_us[i]);
+    }
+    sz += rv;
+  }
+  if (message->n_summary_hist_count > 0) {
+    sz += summary_hist_count__tag_size * message->n_summary_hist_count;
+    rv = 0;
+    for (i = 0; i < message->n_summary_hist_count; i++) {
+      rv += uint32_size(message->summary_hist_count[i]);
+    }
+    sz += rv;
+  }
   for (i = 0; i < message->base.n_unknown_fields; i++) {
     const ProtobufCMessageUnknownField *unknown = message->base.unknown_fields + i;
     sz += get_tag_size(unknown->tag) + unknown->len;
@@ -256,6 +279,18 @@ size_t pinba__request__pack
     *p++ = '\xbd'; *p++ = '\x1';
     p += fixed32_pack_p(&message->timer_ru_stime[i], p);
   }
+  if (message->has_summary_count) {
+    *p++ = '\xc0'; *p++ = '\x1';
+    p += uint32_pack(message->summary_count, p);
+  }
+  for (i = 0; i < message->n_summary_hist_us; i++) {
+    *p++ = '\xc8'; *p++ = '\x1';
+    p += uint32_pack(message->summary_hist_us[i], p);
+  }
+  for (i = 0; i < message->n_summary_hist_count; i++) {
+    *p++ = '\xd0'; *p++ = '\x1';
+    p += uint32_pack(message->summary_hist_count[i], p);
+  }
   for (i = 0; i < message->base.n_unknown_fields; i++) {
     const ProtobufCMessageUnknownField *unknown = message->base.unknown_fields + i;
     uint32_t wire_type_and_tag = (unknown->tag << 3) + unknown->wire_type;
@@ -398,6 +433,24 @@ size_t pinba__request__pack_to_buffer
     rv = 2 + fixed32_pack_p(&message->timer_ru_stime[i], scratch + 2);
     buffer->append(buffer, rv, scratch); sz += rv;
   }
+  if (message->has_summary_count) {
+    scratch[0] = '\xc0';
+    scratch[1] = '\x1';
+    rv = 2 + uint32_pack(message->summary_count, scratch + 2);
+    buffer->append(buffer, rv, scratch); sz += rv;
+  }
+  for (i = 0; i < message->n_summary_hist_us; i++) {
+    scratch[0] = '\xc8';
+    scratch[1] = '\x1';
+    rv = 2 + uint32_pack(message->summary_hist_us[i], scratch + 2);
+    buffer->append(buffer, rv, scratch); sz += rv;
+  }
+  for (i = 0; i < message->n_summary_hist_count; i++) {
+    scratch[0] = '\xd0';
+    scratch[1] = '\x1';
+    rv = 2 + uint32_pack(message->summary_hist_count[i], scratch + 2);
+    buffer->append(buffer, rv, scratch); sz += rv;
+  }
   for (i = 0; i < message->base.n_unknown_fields; i++) {
     const ProtobufCMessageUnknownField *unknown = message->base.unknown_fields + i;
     uint32_t wire_type_and_tag = (unknown->tag << 3) + unknown->wire_type;
@@ -870,6 +923,110 @@ int pinba__request__unpack_merge
         buffer += length;
         message->n_dictionary++;
         continue;
+      case 0xc0:
+        if (buffer + 1 >= buffer_end) return PROTOBUF_C__WRONG_MESSAGE;
+        switch (buffer[1]) {
+          case 0x1:
+            buffer += 2;
+            if ((buffer=read_uint32(&message->summary_count, buffer, buffer_end)) == NULL) return PROTOBUF_C__WRONG_MESSAGE;
+            message->has_summary_count = 1;
+            continue;
+          default:
+          {
+            int ret = unknown_field(&message->base, allocator, &buffer, buffer_end);
+            if (0 > ret) return ret;
+            continue;
+          }
+        }
+        continue;
+      case 0xc8:
+        if (buffer + 1 >= buffer_end) return PROTOBUF_C__WRONG_MESSAGE;
+        switch (buffer[1]) {
+          case 0x1:
+            buffer += 2;
+            if (0 > memory_vector_extend_by_one((void **) &message->summary_hist_us, message->n_summary_hist_us, sizeof(uint32_t), allocator)) {
+              return PROTOBUF_C__NOT_ENOUGH_MEMORY;
+            }
+            if ((buffer=read_uint32(&message->summary_hist_us[message->n_summary_hist_us], buffer, buffer_end)) == NULL) return PROTOBUF_C__WRONG_MESSAGE;
+            message->n_summary_hist_us++;
+            continue;
+          default:
+          {
+            int ret = unknown_field(&message->base, allocator, &buffer, buffer_end);
+            if (0 > ret) return ret;
+            continue;
+          }
+        }
+        continue;
+      case 0xca:
+        if (buffer + 1 >= buffer_end) return PROTOBUF_C__WRONG_MESSAGE;
+        switch (buffer[1]) {
+          case 0x1:
+            buffer += 2;
+            if ((buffer=read_int32(&t, buffer, buffer_end)) == NULL) return PROTOBUF_C__WRONG_MESSAGE;
+            tmp_buffer_pointer = buffer+t;
+            if (tmp_buffer_pointer > buffer_end) return PROTOBUF_C__WRONG_MESSAGE;
+            while (buffer < tmp_buffer_pointer) {
+              if (0 > memory_vector_extend_by_one((void **) &message->summary_hist_us, message->n_summary_hist_us, sizeof(uint32_t), allocator)) {
+                return PROTOBUF_C__NOT_ENOUGH_MEMORY;
+              }
+              if ((buffer=read_uint32(&message->summary_hist_us[message->n_summary_hist_us], buffer, buffer_end)) == NULL) return PROTOBUF_C__WRONG_MESSAGE;
+              message->n_summary_hist_us++;
+            }
+            if (buffer > tmp_buffer_pointer) return PROTOBUF_C__WRONG_MESSAGE;
+            continue;
+          default:
+          {
+            int ret = unknown_field(&message->base, allocator, &buffer, buffer_end);
+            if (0 > ret) return ret;
+            continue;
+          }
+        }
+        continue;
+      case 0xd0:
+        if (buffer + 1 >= buffer_end) return PROTOBUF_C__WRONG_MESSAGE;
+        switch (buffer[1]) {
+          case 0x1:
+            buffer += 2;
+            if (0 > memory_vector_extend_by_one((void **) &message->summary_hist_count, message->n_summary_hist_count, sizeof(uint32_t), allocator)) {
+              return PROTOBUF_C__NOT_ENOUGH_MEMORY;
+            }
+            if ((buffer=read_uint32(&message->summary_hist_count[message->n_summary_hist_count], buffer, buffer_end)) == NULL) return PROTOBUF_C__WRONG_MESSAGE;
+            message->n_summary_hist_count++;
+            continue;
+          default:
+          {
+            int ret = unknown_field(&message->base, allocator, &buffer, buffer_end);
+            if (0 > ret) return ret;
+            continue;
+          }
+        }
+        continue;
+      case 0xd2:
+        if (buffer + 1 >= buffer_end) return PROTOBUF_C__WRONG_MESSAGE;
+        switch (buffer[1]) {
+          case 0x1:
+            buffer += 2;
+            if ((buffer=read_int32(&t, buffer, buffer_end)) == NULL) return PROTOBUF_C__WRONG_MESSAGE;
+            tmp_buffer_pointer = buffer+t;
+            if (tmp_buffer_pointer > buffer_end) return PROTOBUF_C__WRONG_MESSAGE;
+            while (buffer < tmp_buffer_pointer) {
+              if (0 > memory_vector_extend_by_one((void **) &message->summary_hist_count, message->n_summary_hist_count, sizeof(uint32_t), allocator)) {
+                return PROTOBUF_C__NOT_ENOUGH_MEMORY;
+              }
+              if ((buffer=read_uint32(&message->summary_hist_count[message->n_summary_hist_count], buffer, buffer_end)) == NULL) return PROTOBUF_C__WRONG_MESSAGE;
+              message->n_summary_hist_count++;
+            }
+            if (buffer > tmp_buffer_pointer) return PROTOBUF_C__WRONG_MESSAGE;
+            continue;
+          default:
+          {
+            int ret = unknown_field(&message->base, allocator, &buffer, buffer_end);
+            if (0 > ret) return ret;
+            continue;
+          }
+        }
+        continue;
       default:
       {
         int ret = unknown_field(&message->base, allocator, &buffer, buffer_end);
@@ -927,6 +1084,8 @@ void pinba__request__free_unpacked
   memory_free(message->tag_value, allocator);
   memory_free(message->timer_ru_utime, allocator);
   memory_free(message->timer_ru_stime, allocator);
+  memory_free(message->summary_hist_us, allocator);
+  memory_free(message->summary_hist_count, allocator);
   for (i = 0; i < message->base.n_unknown_fields; i++) {
     ProtobufCMessageUnknownField *unknown = message->base.unknown_fields + i;
     memory_free(unknown->data, allocator);
@@ -963,11 +1122,13 @@ protobuf_c_boolean pinba__request__check
   if (message->n_tag_value > 0 && message->tag_value == NULL) return 0;
   if (message->n_timer_ru_utime > 0 && message->timer_ru_utime == NULL) return 0;
   if (message->n_timer_ru_stime > 0 && message->timer_ru_stime == NULL) return 0;
+  if (message->n_summary_hist_us > 0 && message->summary_hist_us == NULL) return 0;
+  if (message->n_summary_hist_count > 0 && message->summary_hist_count == NULL) return 0;
   return 1;
 }
 
 // @@protoc_insertion_point(pinba__request)
-static const ProtobufCFieldDescriptor pinba__request__field_descriptors[23] =
+static const ProtobufCFieldDescriptor pinba__request__field_descriptors[26] =
 {
   {
     "hostname",
@@ -1245,6 +1406,42 @@ static const ProtobufCFieldDescriptor pinba__request__field_descriptors[23] =
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "summary_count",
+    24,
+    PROTOBUF_C_LABEL_OPTIONAL,
+    PROTOBUF_C_TYPE_UINT32,
+    offsetof(Pinba__Request, has_summary_count),
+    offsetof(Pinba__Request, summary_count),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "summary_hist_us",
+    25,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_UINT32,
+    offsetof(Pinba__Request, n_summary_hist_us),
+    offsetof(Pinba__Request, summary_hist_us),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "summary_hist_count",
+    26,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_UINT32,
+    offsetof(Pinba__Request, n_summary_hist_count),
+    offsetof(Pinba__Request, summary_hist_count),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned pinba__request__field_indices_by_name[] = {
   14,   /* field[14] = dictionary */
@@ -1261,6 +1458,9 @@ static const unsigned pinba__request__field_indices_by_name[] = {
   2,   /* field[2] = script_name */
   1,   /* field[1] = server_name */
   15,   /* field[15] = status */
+  23,   /* field[23] = summary_count */
+  25,   /* field[25] = summary_hist_count */
+  24,   /* field[24] = summary_hist_us */
   19,   /* field[19] = tag_name */
   20,   /* field[20] = tag_value */
   9,   /* field[9] = timer_hit_count */
@@ -1274,7 +1474,7 @@ static const unsigned pinba__request__field_indices_by_name[] = {
 static const ProtobufCIntRange pinba__request__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 23 }
+  { 0, 26 }
 };
 const ProtobufCMessageDescriptor pinba__request__descriptor =
 {
@@ -1284,7 +1484,7 @@ const ProtobufCMessageDescriptor pinba__request__descriptor =
   "Pinba__Request",
   "Pinba",
   sizeof(Pinba__Request),
-  23,
+  26,
   pinba__request__field_descriptors,
   pinba__request__field_indices_by_name,
   1,  pinba__request__number_ranges,
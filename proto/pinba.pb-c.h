@@ -63,10 +63,16 @@ struct  _Pinba__Request
   float *timer_ru_utime;
   size_t n_timer_ru_stime;
   float *timer_ru_stime;
+  protobuf_c_boolean has_summary_count;
+  uint32_t summary_count;
+  size_t n_summary_hist_us;
+  uint32_t *summary_hist_us;
+  size_t n_summary_hist_count;
+  uint32_t *summary_hist_count;
 };
 #define PINBA__REQUEST__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&pinba__request__descriptor) \
-    , {0,NULL}, {0,NULL}, {0,NULL}, 0, 0, 0, 0, 0, 0, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,0, 0,0, 0,NULL, 0,{0,NULL}, 0,NULL, 0,NULL, 0,NULL, 0,NULL }
+    , {0,NULL}, {0,NULL}, {0,NULL}, 0, 0, 0, 0, 0, 0, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,0, 0,0, 0,NULL, 0,{0,NULL}, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,0, 0,NULL, 0,NULL }
 
 
 /* Pinba__Request methods */
@@ -27,5 +27,29 @@ CREATE TABLE IF NOT EXISTS `pinba`.`active` (
   `ru_stime` double NOT NULL,
   `last_tick_time` double NOT NULL,
   `last_tick_prepare_duration` double NOT NULL,
-  `last_snapshot_merge_duration` double NOT NULL
+  `last_snapshot_merge_duration` double NOT NULL,
+  `packets_bloom_false_positive` bigint(20) unsigned NOT NULL,
+  `rows_evicted` bigint(20) unsigned NOT NULL,
+  `keys_folded` bigint(20) unsigned NOT NULL,
+  `snapshot_cache_hits` bigint(20) unsigned NOT NULL,
+  `snapshot_cache_misses` bigint(20) unsigned NOT NULL,
+  `rate_window_sec` double NOT NULL,
+  `packets_received_per_sec` double NOT NULL,
+  `packets_lost_per_sec` double NOT NULL,
+  `packets_aggregated_per_sec` double NOT NULL,
+  `timers_scanned_per_sec` double NOT NULL,
+  `timers_aggregated_per_sec` double NOT NULL,
+  `rows_evicted_per_sec` double NOT NULL,
+  `ru_utime_per_sec` double NOT NULL,
+  `ru_stime_per_sec` double NOT NULL,
+  `overload_sample_shift` int(10) unsigned NOT NULL,
+  `overload_transitions` bigint(20) unsigned NOT NULL,
+  `overload_batches_skipped` bigint(20) unsigned NOT NULL,
+  `cycles_add` bigint(20) unsigned NOT NULL,
+  `cycles_tick` bigint(20) unsigned NOT NULL,
+  `cycles_merge` bigint(20) unsigned NOT NULL,
+  `cycles_prepare` bigint(20) unsigned NOT NULL,
+  `hv_suspended` tinyint(1) unsigned NOT NULL,
+  `hv_suspensions` bigint(20) unsigned NOT NULL,
+  `hv_warming_up` tinyint(1) unsigned NOT NULL
 ) ENGINE=PINBA DEFAULT CHARSET=latin1 COMMENT='v2/active';
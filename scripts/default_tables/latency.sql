@@ -0,0 +1,8 @@
+CREATE TABLE IF NOT EXISTS `pinba`.`latency` (
+  `stage` varchar(64) NOT NULL,
+  `source` varchar(128) DEFAULT NULL,
+  `batch_count` bigint(20) unsigned NOT NULL,
+  `p50` double NOT NULL,
+  `p99` double NOT NULL,
+  `max` double NOT NULL
+) ENGINE=PINBA DEFAULT CHARSET=latin1 COMMENT='v2/latency';
@@ -35,5 +35,27 @@ CREATE TABLE IF NOT EXISTS `pinba`.`stats` (
   `dictionary_mem_list` bigint(20) unsigned NOT NULL,
   `dictionary_mem_strings` bigint(20) unsigned NOT NULL,
   `version_info` text NOT NULL,
-  `build_string` text NOT NULL
+  `build_string` text NOT NULL,
+  `udp_recv_kernel_drops` bigint(20) unsigned NOT NULL,
+  `repacker_packet_prefilter_drop` bigint(20) unsigned NOT NULL,
+  `coordinator_batch_send_skipped` bigint(20) unsigned NOT NULL,
+  `rate_window_sec` double NOT NULL,
+  `udp_recv_packets_per_sec` double NOT NULL,
+  `udp_recv_bytes_per_sec` double NOT NULL,
+  `udp_recv_kernel_drops_per_sec` double NOT NULL,
+  `udp_packet_decode_err_per_sec` double NOT NULL,
+  `udp_packet_send_err_per_sec` double NOT NULL,
+  `repacker_recv_packets_per_sec` double NOT NULL,
+  `repacker_packet_validate_err_per_sec` double NOT NULL,
+  `repacker_packet_prefilter_drop_per_sec` double NOT NULL,
+  `coordinator_batches_received_per_sec` double NOT NULL,
+  `coordinator_batch_send_err_per_sec` double NOT NULL,
+  `ru_utime_per_sec` double NOT NULL,
+  `ru_stime_per_sec` double NOT NULL,
+  `repacker_batch_size` bigint(20) unsigned NOT NULL,
+  `repacker_batch_timeout` double NOT NULL,
+  `repacker_packet_rate` double NOT NULL,
+  `inflight_mem_raw_batches` bigint(20) unsigned NOT NULL,
+  `inflight_mem_packet_batches` bigint(20) unsigned NOT NULL,
+  `inflight_mem_repacker_dictionaries` bigint(20) unsigned NOT NULL
 ) ENGINE=PINBA DEFAULT CHARSET=latin1 COMMENT='v2/stats';
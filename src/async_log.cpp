@@ -0,0 +1,124 @@
+#include "pinba_config.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <meow/defer.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/os_symbols.h"
+#include "pinba/async_log.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct async_log_impl_t : public async_log_t
+	{
+		// producers don't wake the thread up, messages wait for the next round at most this long
+		static constexpr uint32_t const drain_interval_ms = 10;
+
+		async_log_impl_t(pinba_globals_t *globals)
+			: globals_(globals)
+		{
+			t_ = std::thread([this]() { this->writer_thread(); });
+		}
+
+		~async_log_impl_t()
+		{
+			{
+				std::lock_guard<std::mutex> lk_(mtx_);
+				stop_ = true;
+			}
+			cv_.notify_one();
+
+			t_.join();
+		}
+
+		virtual ring_ptr create_ring() override
+		{
+			auto ring = std::make_shared<ring_t>();
+
+			std::lock_guard<std::mutex> lk_(mtx_);
+			rings_.push_back(ring);
+
+			return ring;
+		}
+
+	private:
+
+		void writer_thread()
+		{
+			PINBA___OS_CALL(globals_, set_thread_name, "async_log");
+
+			MEOW_DEFER(
+				LOG_DEBUG(globals_->logger(), "async_log; exiting");
+			);
+
+			std::vector<ring_ptr> rings;
+
+			for (;;)
+			{
+				bool stop;
+				{
+					std::unique_lock<std::mutex> lk_(mtx_);
+					cv_.wait_for(lk_, std::chrono::milliseconds(drain_interval_ms), [this]() { return stop_; });
+
+					stop = stop_;
+
+					// writer is gone and everything it wrote is out, no copies are held outside of rings_ here
+					rings_.erase(
+						std::remove_if(rings_.begin(), rings_.end(), [](ring_ptr const& r) { return (r.use_count() == 1) && r->empty(); }),
+						rings_.end());
+
+					rings = rings_;
+				}
+
+				for (auto const& ring : rings)
+					this->drain_ring(ring.get());
+
+				rings.clear();
+
+				if (stop)
+					break;
+			}
+		}
+
+		void drain_ring(ring_t *ring)
+		{
+			auto& stats = globals_->stats()->async_log;
+
+			ring->drain([&](int64_t, uint32_t tag, str_ref message)
+			{
+				auto sink = meow::logging::logger_as_sink(*globals_->logger(), level_t(tag), meow::line_mode::prefix);
+				ff::fmt(sink, "{0}", message);
+
+				stats.messages_written.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			});
+		}
+
+	private:
+		pinba_globals_t          *globals_;
+
+		std::mutex                mtx_;
+		std::condition_variable   cv_;
+		std::vector<ring_ptr>     rings_; // protected by mtx_
+		bool                      stop_ = false;
+
+		std::thread               t_;
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+async_log_ptr create_async_log(pinba_globals_t *globals)
+{
+	return meow::make_unique<aux::async_log_impl_t>(globals);
+}
@@ -0,0 +1,443 @@
+#include "pinba_config.h"
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include <meow/format/format.hpp>
+
+#include "misc/nmpa.h"
+
+#include "pinba/globals.h"
+#include "pinba/block_allocator.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+const struct nmpa_block_allocator_s *nmpa_block_allocator = nullptr;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	constexpr unsigned const min_class_shift = 10; // 1KB
+	constexpr unsigned const max_class_shift = 19; // 512KB, a quarter of a chunk
+	constexpr unsigned const n_classes       = max_class_shift - min_class_shift + 1;
+	constexpr unsigned const max_nodes       = 8;  // more nodes share depots, modulo
+	constexpr size_t   const chunk_size      = 2 * 1024 * 1024;
+
+	constexpr int const mpol_preferred = 1; // MPOL_PREFERRED from <numaif.h>, don't want libnuma just for that
+
+	inline int size_class(size_t sz)
+	{
+		if (sz > (size_t(1) << max_class_shift))
+			return -1;
+
+		unsigned shift = min_class_shift;
+		while ((size_t(1) << shift) < sz)
+			shift++;
+
+		return shift - min_class_shift;
+	}
+
+	inline size_t class_size(unsigned cls)
+	{
+		return size_t(1) << (cls + min_class_shift);
+	}
+
+	inline unsigned current_numa_node()
+	{
+#ifdef SYS_getcpu
+		unsigned cpu = 0, node = 0;
+		if (0 == syscall(SYS_getcpu, &cpu, &node, nullptr))
+			return node % max_nodes;
+#endif
+		return 0;
+	}
+
+	inline void bind_to_numa_node(void *p, size_t sz, unsigned node)
+	{
+#ifdef SYS_mbind
+		// best effort, fails on non-numa kernels and that's fine
+		unsigned long nodemask = 1UL << node;
+		syscall(SYS_mbind, p, sz, mpol_preferred, &nodemask, sizeof(nodemask) * 8, 0);
+#endif
+	}
+
+	// free blocks are linked through their first word
+	struct free_list_t
+	{
+		struct item_t { item_t *next; };
+
+		item_t   *head  = nullptr;
+		uint32_t  count = 0;
+
+		void push(void *p)
+		{
+			item_t *item = static_cast<item_t*>(p);
+			item->next = head;
+			head = item;
+			count++;
+		}
+
+		void* pop()
+		{
+			item_t *item = head;
+			if (item)
+			{
+				head = item->next;
+				count--;
+			}
+			return item;
+		}
+
+		// move up to n items from the head of this list to the other one
+		uint32_t move_to(free_list_t *other, uint32_t n)
+		{
+			uint32_t moved = 0;
+			for (; moved < n && head != nullptr; moved++)
+				other->push(this->pop());
+			return moved;
+		}
+	};
+
+	struct depot_t
+	{
+		std::mutex   mtx;
+		free_list_t  free;
+
+		// not yet carved part of the last chunk (THP, HUGETLB)
+		char        *carve_pos = nullptr;
+		char        *carve_end = nullptr;
+
+		char         padding_[64]; // depots are locked from different threads, keep them on separate cache lines
+	};
+
+	struct block_allocator_impl_t;
+
+	struct thread_cache_t
+	{
+		block_allocator_impl_t  *owner = nullptr;
+		unsigned                 node  = 0;
+		free_list_t              lists[n_classes];
+
+		~thread_cache_t();
+	};
+
+	thread_local thread_cache_t tcache;
+
+	struct block_allocator_impl_t
+	{
+		nmpa_block_allocator_s        hooks;
+		block_allocator_conf_t const  conf;
+
+		depot_t                       depots[max_nodes][n_classes];
+
+		struct {
+			std::atomic<uint64_t> os_bytes          = {0};
+			std::atomic<uint64_t> in_use_bytes      = {0};
+			std::atomic<uint64_t> thread_cache_hits = {0};
+			std::atomic<uint64_t> depot_hits        = {0};
+			std::atomic<uint64_t> os_allocs         = {0};
+			std::atomic<uint64_t> hugetlb_fallbacks = {0};
+		} stats;
+
+	public:
+
+		block_allocator_impl_t(block_allocator_conf_t const& conf)
+			: conf(conf)
+		{
+			hooks.alloc = [](void *ctx, size_t sz) { return static_cast<block_allocator_impl_t*>(ctx)->alloc(sz); };
+			hooks.free  = [](void *ctx, void *p, size_t sz) { static_cast<block_allocator_impl_t*>(ctx)->free(p, sz); };
+			hooks.ctx   = this;
+		}
+
+		void* alloc(size_t sz)
+		{
+			int const cls = size_class(sz);
+			if (cls < 0)
+				return this->big_alloc(sz);
+
+			thread_cache_t *tc = this->thread_cache();
+
+			void *p = tc->lists[cls].pop();
+			if (p)
+				stats.thread_cache_hits.fetch_add(1, std::memory_order_relaxed);
+			else
+				p = this->refill(tc->node, cls, &tc->lists[cls]);
+
+			if (p)
+				stats.in_use_bytes.fetch_add(class_size(cls), std::memory_order_relaxed);
+
+			return p;
+		}
+
+		void free(void *p, size_t sz)
+		{
+			int const cls = size_class(sz);
+			if (cls < 0)
+				return this->big_free(p, sz);
+
+			stats.in_use_bytes.fetch_sub(class_size(cls), std::memory_order_relaxed);
+
+			thread_cache_t *tc = this->thread_cache();
+			free_list_t    *fl = &tc->lists[cls];
+
+			fl->push(p);
+
+			if (fl->count > this->thread_cache_max(cls))
+				this->depot_put(tc->node, cls, fl, fl->count / 2);
+		}
+
+		void flush_thread_cache(thread_cache_t *tc)
+		{
+			for (unsigned cls = 0; cls < n_classes; cls++)
+				this->depot_put(tc->node, cls, &tc->lists[cls], tc->lists[cls].count);
+		}
+
+		block_allocator_stats_t get_stats() const
+		{
+			block_allocator_stats_t result = {};
+			result.mode              = conf.mode;
+			result.os_bytes          = stats.os_bytes.load(std::memory_order_relaxed);
+			result.in_use_bytes      = stats.in_use_bytes.load(std::memory_order_relaxed);
+			result.cached_bytes      = (result.os_bytes > result.in_use_bytes) ? result.os_bytes - result.in_use_bytes : 0;
+			result.thread_cache_hits = stats.thread_cache_hits.load(std::memory_order_relaxed);
+			result.depot_hits        = stats.depot_hits.load(std::memory_order_relaxed);
+			result.os_allocs         = stats.os_allocs.load(std::memory_order_relaxed);
+			result.hugetlb_fallbacks = stats.hugetlb_fallbacks.load(std::memory_order_relaxed);
+			return result;
+		}
+
+	private:
+
+		thread_cache_t* thread_cache()
+		{
+			thread_cache_t *tc = &tcache;
+			if (__builtin_expect(tc->owner == nullptr, 0))
+			{
+				tc->owner = this;
+				tc->node  = (conf.numa_local) ? current_numa_node() : 0;
+			}
+			return tc;
+		}
+
+		uint32_t thread_cache_max(unsigned cls) const
+		{
+			return std::max<uint32_t>(2, conf.thread_cache_bytes / class_size(cls));
+		}
+
+		void* refill(unsigned node, unsigned cls, free_list_t *fl)
+		{
+			size_t const   class_sz = class_size(cls);
+			uint32_t const batch    = this->thread_cache_max(cls) / 2;
+
+			depot_t& d = depots[node][cls];
+			std::unique_lock<std::mutex> lk_(d.mtx);
+
+			if (d.free.count > 0)
+			{
+				stats.depot_hits.fetch_add(1, std::memory_order_relaxed);
+				d.free.move_to(fl, batch);
+				return fl->pop();
+			}
+
+			if (conf.mode == PINBA_BLOCK_ALLOCATOR__CACHED)
+			{
+				lk_.unlock();
+
+				void *p = malloc(class_sz);
+				if (p)
+				{
+					stats.os_bytes.fetch_add(class_sz, std::memory_order_relaxed);
+					stats.os_allocs.fetch_add(1, std::memory_order_relaxed);
+				}
+				return p;
+			}
+
+			if (d.carve_pos == d.carve_end)
+			{
+				char *chunk = static_cast<char*>(this->chunk_alloc(node));
+				if (!chunk)
+					return nullptr;
+
+				d.carve_pos = chunk;
+				d.carve_end = chunk + chunk_size;
+			}
+
+			// carve a batch at once, same as taking from depot, to take the lock less often
+			void *result = d.carve_pos;
+			d.carve_pos += class_sz;
+
+			for (uint32_t i = 1; i < batch && d.carve_pos != d.carve_end; i++)
+			{
+				fl->push(d.carve_pos);
+				d.carve_pos += class_sz;
+			}
+
+			return result;
+		}
+
+		void depot_put(unsigned node, unsigned cls, free_list_t *fl, uint32_t n)
+		{
+			if (n == 0)
+				return;
+
+			size_t const class_sz = class_size(cls);
+			free_list_t  to_free;
+
+			{
+				depot_t& d = depots[node][cls];
+				std::lock_guard<std::mutex> lk_(d.mtx);
+
+				fl->move_to(&d.free, n);
+
+				if (conf.mode == PINBA_BLOCK_ALLOCATOR__CACHED)
+				{
+					uint64_t const max_count = conf.depot_max_bytes / class_sz;
+					if (d.free.count > max_count)
+						d.free.move_to(&to_free, d.free.count - max_count);
+				}
+			}
+
+			if (to_free.count > 0)
+			{
+				stats.os_bytes.fetch_sub(to_free.count * class_sz, std::memory_order_relaxed);
+				while (void *p = to_free.pop())
+					::free(p);
+			}
+		}
+
+		void* chunk_alloc(unsigned node)
+		{
+			void *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+			if (conf.mode == PINBA_BLOCK_ALLOCATOR__HUGETLB)
+			{
+				p = mmap(nullptr, chunk_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+				if (p == MAP_FAILED)
+					stats.hugetlb_fallbacks.fetch_add(1, std::memory_order_relaxed);
+			}
+#endif
+
+			if (p == MAP_FAILED)
+			{
+				// map twice the size and trim, to get chunk_size alignment, so that a single huge page can back the whole chunk
+				size_t const map_size = chunk_size * 2;
+
+				char *raw = static_cast<char*>(mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+				if (raw == MAP_FAILED)
+					return nullptr;
+
+				char *aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(raw) + chunk_size - 1) & ~uintptr_t(chunk_size - 1));
+				char *end     = aligned + chunk_size;
+
+				if (aligned != raw)
+					munmap(raw, aligned - raw);
+				if (end != raw + map_size)
+					munmap(end, (raw + map_size) - end);
+
+#ifdef MADV_HUGEPAGE
+				madvise(aligned, chunk_size, MADV_HUGEPAGE);
+#endif
+				p = aligned;
+			}
+
+			if (conf.numa_local)
+				bind_to_numa_node(p, chunk_size, node);
+
+			stats.os_bytes.fetch_add(chunk_size, std::memory_order_relaxed);
+			stats.os_allocs.fetch_add(1, std::memory_order_relaxed);
+			return p;
+		}
+
+		void* big_alloc(size_t sz)
+		{
+			void *p = malloc(sz);
+			if (p)
+			{
+				stats.os_bytes.fetch_add(sz, std::memory_order_relaxed);
+				stats.in_use_bytes.fetch_add(sz, std::memory_order_relaxed);
+				stats.os_allocs.fetch_add(1, std::memory_order_relaxed);
+			}
+			return p;
+		}
+
+		void big_free(void *p, size_t sz)
+		{
+			stats.os_bytes.fetch_sub(sz, std::memory_order_relaxed);
+			stats.in_use_bytes.fetch_sub(sz, std::memory_order_relaxed);
+			::free(p);
+		}
+	};
+
+	thread_cache_t::~thread_cache_t()
+	{
+		if (owner)
+			owner->flush_thread_cache(this);
+	}
+
+	std::mutex               install_mtx;
+	block_allocator_impl_t  *installed = nullptr; // never destroyed, see header
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+pinba_error_t block_allocator___install(pinba_globals_t *globals, block_allocator_conf_t const& conf)
+{
+	if (conf.mode == PINBA_BLOCK_ALLOCATOR__MALLOC)
+		return {};
+
+	if (conf.mode > PINBA_BLOCK_ALLOCATOR__HUGETLB)
+		return ff::fmt_err("unknown block allocator mode: {0}", conf.mode);
+
+	std::lock_guard<std::mutex> lk_(aux::install_mtx);
+
+	if (aux::installed)
+	{
+		block_allocator_conf_t const& old_conf = aux::installed->conf;
+
+		if (old_conf.mode != conf.mode || old_conf.numa_local != conf.numa_local)
+		{
+			LOG_WARN(globals->logger(), "nmpa block allocator is already installed as {0} (numa: {1}), ignoring {2} (numa: {3})",
+				block_allocator___mode_name(old_conf.mode), old_conf.numa_local,
+				block_allocator___mode_name(conf.mode), conf.numa_local);
+		}
+		return {};
+	}
+
+	// threads using nmpa are not started yet, so plain store is enough
+	aux::installed = new aux::block_allocator_impl_t(conf);
+	nmpa_block_allocator = &aux::installed->hooks;
+
+	return {};
+}
+
+block_allocator_stats_t block_allocator___stats()
+{
+	std::lock_guard<std::mutex> lk_(aux::install_mtx);
+
+	if (!aux::installed)
+		return block_allocator_stats_t {};
+
+	return aux::installed->get_stats();
+}
+
+char const* block_allocator___mode_name(uint32_t mode)
+{
+	switch (mode)
+	{
+		case PINBA_BLOCK_ALLOCATOR__MALLOC:  return "malloc";
+		case PINBA_BLOCK_ALLOCATOR__CACHED:  return "cached";
+		case PINBA_BLOCK_ALLOCATOR__THP:     return "thp";
+		case PINBA_BLOCK_ALLOCATOR__HUGETLB: return "hugetlb";
+	}
+	return "unknown";
+}
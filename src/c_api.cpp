@@ -0,0 +1,470 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <meow/std_unique_ptr.hpp>
+#include <meow/str_ref_algo.hpp>
+
+#include "pinba/c_api.h"
+#include "pinba/globals.h"
+#include "pinba/dictionary.h"
+#include "pinba/engine.h"
+#include "pinba/snapshot_dictionary.h"
+#include "pinba/report_by_request.h"
+#include "pinba/report_by_timer.h"
+#include "pinba/report_by_packet.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct pinba2_engine
+{
+	pinba_options_t   options;  // engine keeps a pointer to these
+	pinba_engine_ptr  engine;
+};
+
+struct pinba2_snapshot
+{
+	report_snapshot_ptr                     snapshot;
+	std::unique_ptr<snapshot_dictionary_t>  snapshot_d;  // ours, snapshot is shared with other readers
+	report_snapshot_t::position_t           pos;
+	report_snapshot_t::row_batch_t          batch;       // read_rows() page, reused
+};
+
+struct pinba2_tick_subscription
+{
+	report_tick_subscription_ptr  subscription;
+	report_tick_data_ptr          last;  // given out by pinba2_tick_next()
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	static thread_local std::string last_error;
+
+	template<class Function>
+	static int call_with_error(Function const& func)
+	{
+		try
+		{
+			pinba_error_t const err = func();
+			if (err)
+			{
+				last_error = err.what();
+				return -1;
+			}
+			return 0;
+		}
+		catch (std::exception const& e)
+		{
+			last_error = e.what();
+			return -1;
+		}
+	}
+
+	static str_ref str_or_empty(char const *s)
+	{
+		return (s) ? str_ref { s, strlen(s) } : str_ref {};
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// keys, same syntax as in mysql table comments, see mysql_engine/view_conf.cpp
+
+	struct key_spec_t
+	{
+		int                 kind;           // RKD_*
+		str_ref             name;
+		uint32_t packet_t::* request_field;
+		uint32_t            tag_id;
+	};
+
+	static pinba_error_t parse_key(pinba_globals_t *globals, str_ref key_spec, key_spec_t *out)
+	{
+		if (key_spec.size() < 2)
+			return ff::fmt_err("bad key: '{0}'", key_spec);
+
+		out->name = meow::sub_str_ref(key_spec, 1, key_spec.size());
+
+		switch (key_spec[0])
+		{
+			case '~':
+				out->kind = RKD_REQUEST_FIELD;
+
+				if (out->name == "host")        out->request_field = &packet_t::host_id;
+				else if (out->name == "script") out->request_field = &packet_t::script_id;
+				else if (out->name == "server") out->request_field = &packet_t::server_id;
+				else if (out->name == "schema") out->request_field = &packet_t::schema_id;
+				else if (out->name == "status") out->request_field = &packet_t::status;
+				else
+					return ff::fmt_err("request_field '{0}' not known (should be one of host, script, server, schema, status)", key_spec);
+
+				return {};
+
+			case '+':
+				out->kind   = RKD_REQUEST_TAG;
+				out->tag_id = globals->dictionary()->add_nameword(out->name).id;
+				return {};
+
+			case '@':
+				out->kind   = RKD_TIMER_TAG;
+				out->tag_id = globals->dictionary()->add_nameword(out->name).id;
+				return {};
+
+			default:
+				return ff::fmt_err("bad key: '{0}', expected ~field, +request_tag or @timer_tag", key_spec);
+		}
+	}
+
+	template<class ConfT>
+	static void conf_init_common(ConfT *conf, pinba2_report_conf_t const *c_conf)
+	{
+		conf->name            = str_or_empty(c_conf->name).str();
+		conf->time_window     = duration_t { int64_t(c_conf->time_window_ms) * 1000 * 1000 };
+		conf->tick_count      = c_conf->tick_count;
+		conf->hv_bucket_count = c_conf->hv_bucket_count;
+		conf->hv_bucket_d     = duration_t { int64_t(c_conf->hv_bucket_ns) };
+		conf->hv_min_value    = duration_t { int64_t(c_conf->hv_min_ns) };
+	}
+
+	static pinba_error_t report_create(pinba_globals_t *globals, pinba2_report_conf_t const *c_conf, report_ptr *out)
+	{
+		if (str_or_empty(c_conf->name).empty())
+			return ff::fmt_err("report name must not be empty");
+
+		if (c_conf->time_window_ms == 0 || c_conf->tick_count == 0)
+			return ff::fmt_err("time_window_ms and tick_count must be > 0");
+
+		if (c_conf->n_keys > PINBA_LIMIT___MAX_KEY_PARTS)
+			return ff::fmt_err("we suport maximum of {0} keys (this is a tunable compile-time constant)", PINBA_LIMIT___MAX_KEY_PARTS);
+
+		std::vector<key_spec_t> keys(c_conf->n_keys);
+		for (uint32_t i = 0; i < c_conf->n_keys; i++)
+		{
+			pinba_error_t const err = parse_key(globals, str_or_empty(c_conf->keys[i]), &keys[i]);
+			if (err)
+				return err;
+		}
+
+		switch (c_conf->kind)
+		{
+			case PINBA2_REPORT_KIND__REQUEST:
+			{
+				report_conf___by_request_t conf = {};
+				conf_init_common(&conf, c_conf);
+				conf.hv_kind = HISTOGRAM_KIND__FLAT;
+
+				for (auto const& k : keys)
+				{
+					if (k.kind == RKD_REQUEST_FIELD)
+						conf.keys.push_back(report_conf___by_request_t::key_descriptor_by_request_field(k.name, k.request_field));
+					else if (k.kind == RKD_REQUEST_TAG)
+						conf.keys.push_back(report_conf___by_request_t::key_descriptor_by_request_tag(k.name, k.tag_id));
+					else
+						return ff::fmt_err("timer_tag are not allowed in 'request' reports, got '@{0}'", k.name);
+				}
+
+				*out = create_report_by_request(globals, conf);
+				return {};
+			}
+
+			case PINBA2_REPORT_KIND__TIMER:
+			{
+				report_conf___by_timer_t conf = {};
+				conf_init_common(&conf, c_conf);
+
+				for (auto const& k : keys)
+				{
+					if (k.kind == RKD_REQUEST_FIELD)
+						conf.keys.push_back(report_conf___by_timer_t::key_descriptor_by_request_field(k.name, k.request_field));
+					else if (k.kind == RKD_REQUEST_TAG)
+						conf.keys.push_back(report_conf___by_timer_t::key_descriptor_by_request_tag(k.name, k.tag_id));
+					else
+						conf.keys.push_back(report_conf___by_timer_t::key_descriptor_by_timer_tag(k.name, k.tag_id));
+				}
+
+				*out = create_report_by_timer(globals, conf);
+				return {};
+			}
+
+			case PINBA2_REPORT_KIND__PACKET:
+			{
+				if (!keys.empty())
+					return ff::fmt_err("'packet' reports have no keys");
+
+				report_conf___by_packet_t conf = {};
+				conf_init_common(&conf, c_conf);
+
+				*out = create_report_by_packet(globals, conf);
+				return {};
+			}
+
+			default:
+				return ff::fmt_err("unknown report kind: {0}", c_conf->kind);
+		}
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// row pages
+
+	template<class RowT, class DataT, class Fill>
+	static size_t read_rows(pinba2_snapshot_t *s, uint32_t *key_ids, void *rows, size_t max_rows, Fill const& fill)
+	{
+		report_snapshot_t *snapshot = s->snapshot.get();
+		uint32_t const n_key_parts  = snapshot->report_info()->n_key_parts;
+		auto const pos_end          = snapshot->pos_last();
+
+		RowT *out = static_cast<RowT*>(rows);
+
+		// caller's page might be huge, fetch in chunks, batch vectors stay small
+		size_t n = 0;
+		while (n < max_rows)
+		{
+			uint32_t const chunk = uint32_t(std::min<size_t>(max_rows - n, 1024));
+			uint32_t const n_got = snapshot->fetch_rows(&s->pos, pos_end, chunk, &s->batch, false);
+			if (n_got == 0)
+				break;
+
+			for (uint32_t row = 0; row < n_got; row++, n++)
+			{
+				report_key_t const& key = s->batch.keys[row];
+				for (uint32_t i = 0; i < n_key_parts; i++)
+					key_ids[n * n_key_parts + i] = key[i];
+
+				fill(&out[n], *static_cast<DataT const*>(s->batch.data[row]));
+			}
+		}
+
+		return n;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+char const* pinba2_last_error(void)
+{
+	return aux::last_error.c_str();
+}
+
+pinba2_engine_t* pinba2_engine_start(pinba2_options_t const *c_options)
+{
+	try
+	{
+		pinba2_options_t const defaults = {};
+		if (c_options == nullptr)
+			c_options = &defaults;
+
+		auto e = meow::make_unique<pinba2_engine_t>();
+
+		e->options = pinba_options_t {
+			.net_address              = (c_options->net_address) ? c_options->net_address : "0.0.0.0",
+			.net_port                 = (c_options->net_port) ? c_options->net_port : "30002",
+
+			.udp_threads              = (c_options->udp_threads) ? c_options->udp_threads : 4,
+			.udp_batch_messages       = 256,
+			.udp_batch_timeout        = 10 * d_millisecond,
+
+			.repacker_threads         = (c_options->repacker_threads) ? c_options->repacker_threads : 4,
+			.repacker_input_buffer    = 16 * 1024,
+			.repacker_batch_messages  = 1024,
+			.repacker_batch_timeout   = 100 * d_millisecond,
+
+			.coordinator_input_buffer = 128,
+			.report_input_buffer      = 32,
+
+			.logger                   = {},
+		};
+
+		e->engine = pinba_engine_init(&e->options);
+		e->engine->startup();
+
+		return e.release();
+	}
+	catch (std::exception const& e)
+	{
+		aux::last_error = e.what();
+		return nullptr;
+	}
+}
+
+void pinba2_engine_stop(pinba2_engine_t *e)
+{
+	if (e == nullptr)
+		return;
+
+	try
+	{
+		e->engine->shutdown();
+	}
+	catch (std::exception const& ex)
+	{
+		aux::last_error = ex.what();
+	}
+
+	delete e;
+}
+
+int pinba2_report_add(pinba2_engine_t *e, pinba2_report_conf_t const *conf)
+{
+	return aux::call_with_error([&]() -> pinba_error_t
+	{
+		report_ptr report;
+
+		pinba_error_t const err = aux::report_create(e->engine->globals(), conf, &report);
+		if (err)
+			return err;
+
+		return e->engine->add_report(std::move(report));
+	});
+}
+
+int pinba2_report_delete(pinba2_engine_t *e, char const *name)
+{
+	return aux::call_with_error([&]() -> pinba_error_t
+	{
+		return e->engine->delete_report(aux::str_or_empty(name));
+	});
+}
+
+pinba2_snapshot_t* pinba2_snapshot_get(pinba2_engine_t *e, char const *report_name)
+{
+	try
+	{
+		auto s = meow::make_unique<pinba2_snapshot_t>();
+
+		s->snapshot   = e->engine->get_prepared_report_snapshot(aux::str_or_empty(report_name), report_snapshot_t::merge_flags::none);
+		uint32_t const snapshot_d_hint = snapshot_dictionary_t::size_hint_for(s->snapshot->row_count(), s->snapshot->report_info()->n_key_parts);
+		s->snapshot_d = meow::make_unique<snapshot_dictionary_t>(s->snapshot->dictionary(), snapshot_d_hint);
+		s->pos        = s->snapshot->pos_first();
+
+		return s.release();
+	}
+	catch (std::exception const& ex)
+	{
+		aux::last_error = ex.what();
+		return nullptr;
+	}
+}
+
+void pinba2_snapshot_free(pinba2_snapshot_t *s)
+{
+	delete s;
+}
+
+int pinba2_snapshot_info(pinba2_snapshot_t *s, pinba2_snapshot_info_t *info)
+{
+	report_info_t const *rinfo = s->snapshot->report_info();
+
+	info->kind           = rinfo->kind;
+	info->n_key_parts    = rinfo->n_key_parts;
+	info->n_rows         = s->snapshot->row_count();
+	info->time_window_ns = uint64_t(rinfo->time_window.nsec);
+	info->tick_count     = rinfo->tick_count;
+	info->time_window_covered_ns = uint64_t(s->snapshot->time_window_covered().nsec);
+
+	return 0;
+}
+
+size_t pinba2_snapshot_read(pinba2_snapshot_t *s, uint32_t *key_ids, void *rows, size_t max_rows)
+{
+	switch (s->snapshot->data_kind())
+	{
+		case REPORT_KIND__BY_REQUEST_DATA:
+			return aux::read_rows<pinba2_row___by_request_t, report_row_data___by_request_t>(s, key_ids, rows, max_rows,
+				[](pinba2_row___by_request_t *to, report_row_data___by_request_t const& from)
+				{
+					to->req_count      = from.req_count;
+					to->distinct_count = from.distinct_count;
+					to->time_total_ns  = from.time_total.nsec;
+					to->ru_utime_ns    = from.ru_utime.nsec;
+					to->ru_stime_ns    = from.ru_stime.nsec;
+					to->traffic        = from.traffic;
+					to->mem_used       = from.mem_used;
+				});
+
+		case REPORT_KIND__BY_TIMER_DATA:
+			return aux::read_rows<pinba2_row___by_timer_t, report_row_data___by_timer_t>(s, key_ids, rows, max_rows,
+				[](pinba2_row___by_timer_t *to, report_row_data___by_timer_t const& from)
+				{
+					to->req_count      = from.req_count;
+					to->hit_count      = from.hit_count;
+					to->time_total_ns  = from.time_total.nsec;
+					to->ru_utime_ns    = from.ru_utime.nsec;
+					to->ru_stime_ns    = from.ru_stime.nsec;
+				});
+
+		case REPORT_KIND__BY_PACKET_DATA:
+			return aux::read_rows<pinba2_row___by_packet_t, report_row_data___by_packet_t>(s, key_ids, rows, max_rows,
+				[](pinba2_row___by_packet_t *to, report_row_data___by_packet_t const& from)
+				{
+					to->req_count      = from.req_count;
+					to->timer_count    = from.timer_count;
+					to->time_total_ns  = from.time_total.nsec;
+					to->ru_utime_ns    = from.ru_utime.nsec;
+					to->ru_stime_ns    = from.ru_stime.nsec;
+					to->traffic        = from.traffic;
+					to->mem_used       = from.mem_used;
+				});
+
+		default:
+			assert(!"must not be reached");
+			return 0;
+	}
+}
+
+void pinba2_snapshot_rewind(pinba2_snapshot_t *s)
+{
+	s->pos = s->snapshot->pos_first();
+}
+
+void pinba2_snapshot_resolve(pinba2_snapshot_t *s, uint32_t const *word_ids, size_t n, pinba2_str_t *out)
+{
+	// words are kept alive by snapshot ticks (see snapshot_dictionary_t::get_word()), no need to copy
+	for (size_t i = 0; i < n; i++)
+	{
+		str_ref const word = s->snapshot_d->get_word(word_ids[i]);
+		out[i] = pinba2_str_t { word.data(), word.size() };
+	}
+}
+
+pinba2_tick_subscription_t* pinba2_tick_subscribe(pinba2_engine_t *e, char const *report_name, uint32_t max_queued)
+{
+	try
+	{
+		auto sub = meow::make_unique<pinba2_tick_subscription_t>();
+		sub->subscription = create_report_tick_subscription(max_queued);
+
+		pinba_error_t const err = e->engine->subscribe_to_ticks(aux::str_or_empty(report_name), sub->subscription);
+		if (err)
+			throw std::runtime_error(err.what());
+
+		return sub.release();
+	}
+	catch (std::exception const& ex)
+	{
+		aux::last_error = ex.what();
+		return nullptr;
+	}
+}
+
+void pinba2_tick_unsubscribe(pinba2_tick_subscription_t *sub)
+{
+	sub->subscription->unsubscribe();
+	delete sub;
+}
+
+int pinba2_tick_next(pinba2_tick_subscription_t *sub, uint32_t timeout_ms, pinba2_str_t *tick)
+{
+	sub->last = sub->subscription->pop(duration_t { int64_t(timeout_ms) * 1000 * 1000 });
+
+	if (sub->last)
+	{
+		*tick = pinba2_str_t { sub->last->data(), sub->last->size() };
+		return 1;
+	}
+
+	return (sub->subscription->is_closed()) ? -1 : 0;
+}
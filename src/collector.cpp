@@ -3,7 +3,13 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h> // setsockopt
+#include <netinet/udp.h>  // UDP_GRO
+#include <sys/mman.h>   // io_uring rings, AF_XDP umem and rings
+#include <linux/filter.h> // reuseport cpu steering
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
 #include <stdexcept>
 #include <thread>
 #include <vector>
@@ -21,8 +27,12 @@
 #include "pinba/globals.h"
 #include "pinba/os_symbols.h"
 #include "pinba/collector.h"
+#include "pinba/datagram_capture.h"
+#include "pinba/mem_governor.h"
+#include "pinba/nmpa_block_sizer.h"
 #include "pinba/nmsg_socket.h"
 #include "pinba/nmsg_poller.h"
+#include "pinba/probes.h"
 
 #include "proto/pinba.pb-c.h"
 
@@ -33,6 +43,13 @@
 #include <lz4.h>
 #endif
 
+#ifdef PINBA_HAVE_AF_XDP
+#include <arpa/inet.h>      // htons
+#include <net/if.h>         // if_nametoindex
+#include <netinet/in.h>
+#include <linux/if_ether.h>
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 namespace ff = meow::format;
@@ -127,18 +144,128 @@ namespace { namespace aux {
 			uint16_t const data_len = uint16_t(bytes[2]) | bytes[3];
 
 			return net_datagram_t {
-				.version = 1,
-				.flags   = uint32_t(bytes[0] & 0x0f) | bytes[1],
-				.data    = str_ref { bytes.begin() + 4, bytes.end() },
+				.version       = 1,
+				.flags         = uint32_t(bytes[0] & 0x0f) | bytes[1],
+				.data          = str_ref { bytes.begin() + 4, bytes.end() },
+				.request_count = 1,
+			};
+		}
+
+		// v2 - same header layout, but last 16 bits are request count
+		// v0 datagram can't start with 0x2X, since that would be field 4+, and fields 1-3 are required (and serialized first)
+		if ((v == 2) && (bytes.size() >= 4))
+		{
+			uint8_t const *h = (uint8_t const*)bytes.data();
+
+			return net_datagram_t {
+				.version       = 2,
+				.flags         = (uint32_t(h[0] & 0x0f) << 8) | h[1],
+				.data          = str_ref { bytes.begin() + 4, bytes.end() },
+				.request_count = (uint32_t(h[2]) << 8) | h[3],
 			};
 		}
 
 		// otherwise, let's try with v0 format
 		return net_datagram_t {
-			.version = 0,
-			.flags   = 0,
-			.data    = bytes,
+			.version       = 0,
+			.flags         = 0,
+			.data          = bytes,
+			.request_count = 1,
+		};
+	}
+
+	// call func(str_ref) for each request bytes in (decompressed) datagram
+	//  returns
+	//    - true on success
+	//    - false if v2 payload framing is malformed (func might've been called for some requests already)
+	template<class Function>
+	bool for_each_network_datagram_request(net_datagram_t const& dgram, Function const& func)
+	{
+		if (dgram.version != 2)
+		{
+			func(dgram.data);
+			return true;
+		}
+
+		str_ref tail = dgram.data;
+
+		for (uint32_t i = 0; i < dgram.request_count; i++)
+		{
+			if (tail.size() < 2)
+				return false;
+
+			uint8_t const *h = (uint8_t const*)tail.data();
+			size_t const len = (size_t(h[0]) << 8) | h[1];
+
+			if ((len == 0) || (len > tail.size() - 2))
+				return false;
+
+			func(str_ref { tail.data() + 2, len });
+			tail = str_ref { tail.data() + 2 + len, tail.end() };
+		}
+
+		// trailing garbage is an error as well, might be a sign of sender bug
+		return tail.empty();
+	}
+
+	// size of lz4 block contents, without decompressing anything, just walking sequence headers and skipping literals
+	//  returns
+	//    - decompressed size on success
+	//    - 0 if block is malformed, or decompresses to more than max_size
+	size_t lz4_block_decompressed_size(str_ref const block, size_t const max_size)
+	{
+		uint8_t const *p   = (uint8_t const*)block.data();
+		uint8_t const *end = p + block.size();
+
+		// 4 bit length in token, 15 = more length bytes follow, 255 = and more after that
+		auto const read_length = [&](size_t len, size_t *result) -> bool
+		{
+			if (len == 15)
+			{
+				uint8_t b;
+				do {
+					if (p >= end)
+						return false;
+					b = *p++;
+					len += b;
+				} while ((b == 255) && (len <= max_size));
+			}
+			*result = len;
+			return true;
 		};
+
+		size_t total = 0;
+
+		while (p < end)
+		{
+			uint8_t const token = *p++;
+
+			size_t literals;
+			if (!read_length(token >> 4, &literals) || (literals > size_t(end - p)))
+				return 0;
+
+			p     += literals;
+			total += literals;
+
+			// last sequence is literals only
+			if (p == end)
+				break;
+
+			if (end - p < 2) // match offset
+				return 0;
+			p += 2;
+
+			size_t match;
+			if (!read_length(token & 0x0f, &match))
+				return 0;
+
+			total += match + 4; // min match
+
+			if (total > max_size)
+				return 0;
+		}
+
+		return (total <= max_size) ? total : 0;
 	}
 
 	// decompress_network_datagram, decompresses `dgram->data` into `dst_buf`
@@ -167,263 +294,1480 @@ namespace { namespace aux {
 #endif
 	}
 
-////////////////////////////////////////////////////////////////////////////////////////////////
+	// get cumulative socket drop counter from received message ancillary data (see SO_RXQ_OVFL)
+	// returns false if there is none, kernel only sends it after the socket dropped something
+	bool get_kernel_drop_counter(struct msghdr *msg, uint32_t *drops_total)
+	{
+#ifdef SO_RXQ_OVFL
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+		{
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+			{
+				memcpy(drops_total, CMSG_DATA(cmsg), sizeof(*drops_total));
+				return true;
+			}
+		}
+#endif
+		return false;
+	}
 
-	struct collector_impl_t : public collector_t
+	// segment size of coalesced datagram from received message ancillary data (see UDP_GRO)
+	// returns false if there is none, i.e. message is a single datagram
+	bool get_gro_segment_size(struct msghdr *msg, uint32_t *segment_size)
 	{
-		collector_impl_t(pinba_globals_t *globals, collector_conf_t *conf)
-			: globals_(globals)
-			, stats_(globals->stats())
-			, conf_(conf)
+#ifdef UDP_GRO
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
 		{
-			if (conf_->n_threads == 0 || conf_->n_threads > 1024)
-				throw std::runtime_error(ff::fmt_str("collector_conf_t::n_threads must be within [1, 1023]"));
+			if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+			{
+				int value;
+				memcpy(&value, CMSG_DATA(cmsg), sizeof(value));
+				if (value <= 0)
+					return false;
 
-			out_sock_
-				.open(AF_SP, NN_PUSH)
-				.bind(conf_->nn_output);
+				*segment_size = uint32_t(value);
+				return true;
+			}
+		}
+#endif
+		return false;
+	}
 
-			shutdown_sock_
-				.open(AF_SP, NN_PULL)
-				.bind(conf_->nn_shutdown);
+	// read single integer value from /proc/sys file, returns false on failure
+	bool read_sysctl_value(char const *path, uint64_t *value)
+	{
+		FILE *f = fopen(path, "r");
+		if (f == NULL)
+			return false;
+		MEOW_DEFER(
+			fclose(f);
+		);
 
-			shutdown_cli_sock_
-				.open(AF_SP, NN_PUSH)
-				.connect(conf_->nn_shutdown);
+		unsigned long long v;
+		if (fscanf(f, "%llu", &v) != 1)
+			return false;
 
-			this->try_resolve_listen_addr_port();
+		*value = v;
+		return true;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef PINBA_HAVE_IO_URING_RECV_MULTISHOT
+
+	// minimal io_uring wrapper (no liburing), just enough for multishot recvmsg on udp sockets
+	// datagrams land in provided buffer ring, and completions are read from shared memory
+	// so in steady state the only syscall per wakeup is poll() on ring fd (that's readable while cq is not empty)
+	struct udp_uring_t : private boost::noncopyable
+	{
+		udp_uring_t(pinba_os_symbols_t *os, uint32_t n_sockets, uint32_t n_buffers, uint32_t buffer_size)
+			: os_(os)
+			, n_buffers_(n_buffers)
+			, buffer_size_(buffer_size)
+		{
+			// dtor is not called if ctor throws, cleanup manually
+			try
+			{
+				this->init(n_sockets);
+			}
+			catch (...)
+			{
+				this->release();
+				throw;
+			}
 		}
 
-		~collector_impl_t()
+		~udp_uring_t()
 		{
-			this->shutdown();
+			this->release();
 		}
 
-		virtual void startup() override
+		int fd() const
 		{
-			if (!threads_.empty())
-				throw std::logic_error("collector_t::startup(): already started");
+			return fd_;
+		}
 
-			stats_->collector_threads.resize(conf_->n_threads);
+		void init(uint32_t n_sockets)
+		{
+			assert((n_buffers_ > 0) && ((n_buffers_ & (n_buffers_ - 1)) == 0) && (n_buffers_ <= 32768));
 
-			for (uint32_t i = 0; i < conf_->n_threads; i++)
-			{
-				std::vector<fd_handle_t> fds;
+			// every completion takes one buffer, so cq should fit all of them (+ some slack for errors)
+			struct io_uring_params params = {};
+			params.flags      = IORING_SETUP_CQSIZE;
+			params.cq_entries = n_buffers_ * 2;
 
-				// per-thread SO_REUSEPORT bind
-				MEOW_UNIX_ADDRINFO_LIST_FOR_EACH(curr_ai, ai_list_)
-				{
-					auto fd_h = this->try_bind_to_addr(curr_ai);
-					fds.push_back(std::move(fd_h));
-				}
+			fd_ = os_->io_uring_setup(std::max<uint32_t>(8, n_sockets * 2), &params);
+			if (fd_ < 0)
+				throw std::runtime_error(ff::fmt_str("io_uring_setup() failed: {0}:{1}", errno, strerror(errno)));
 
-				// TODO(antoxa): replace passing i, with proper thread contexts
-				std::thread t([this, i, fds = std::move(fds)]()
-				{
-					std::string const thr_name = ff::fmt_str("udp_reader/{0}", i);
+			sq_entries_ = params.sq_entries;
 
-					PINBA___OS_CALL(globals_, set_thread_name, thr_name);
+			// sq + cq rings, single mmap if kernel supports it
+			sq_ring_sz_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+			cq_ring_sz_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
 
-					MEOW_DEFER(
-						LOG_DEBUG(globals_->logger(), "{0}; exiting", thr_name);
-					);
+			if (params.features & IORING_FEAT_SINGLE_MMAP)
+				sq_ring_sz_ = cq_ring_sz_ = std::max(sq_ring_sz_, cq_ring_sz_);
 
-					this->eat_udp(i, fds);
-				});
+			sq_ring_ = this->mmap_ring(sq_ring_sz_, IORING_OFF_SQ_RING);
+			cq_ring_ = (params.features & IORING_FEAT_SINGLE_MMAP)
+						? sq_ring_
+						: this->mmap_ring(cq_ring_sz_, IORING_OFF_CQ_RING);
 
-				threads_.push_back(move(t));
-			}
+			sqes_sz_ = params.sq_entries * sizeof(struct io_uring_sqe);
+			sqes_    = (struct io_uring_sqe*)this->mmap_ring(sqes_sz_, IORING_OFF_SQES);
+
+			char *sq = (char*)sq_ring_;
+			sq_head_  = (uint32_t*)(sq + params.sq_off.head);
+			sq_tail_  = (uint32_t*)(sq + params.sq_off.tail);
+			sq_mask_  = *(uint32_t*)(sq + params.sq_off.ring_mask);
+			sq_array_ = (uint32_t*)(sq + params.sq_off.array);
+
+			char *cq = (char*)cq_ring_;
+			cq_head_  = (uint32_t*)(cq + params.cq_off.head);
+			cq_tail_  = (uint32_t*)(cq + params.cq_off.tail);
+			cq_mask_  = *(uint32_t*)(cq + params.cq_off.ring_mask);
+			cqes_     = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+			// provided buffers, group 0
+			br_sz_ = n_buffers_ * sizeof(struct io_uring_buf);
+			br_ = mmap(NULL, br_sz_, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+			if (br_ == MAP_FAILED)
+				throw std::runtime_error(ff::fmt_str("mmap(buffer ring) failed: {0}:{1}", errno, strerror(errno)));
+
+			struct io_uring_buf_reg reg = {};
+			reg.ring_addr    = (uint64_t)br_;
+			reg.ring_entries = n_buffers_;
+			reg.bgid         = buffer_group;
+
+			if (os_->io_uring_register(fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+				throw std::runtime_error(ff::fmt_str("IORING_REGISTER_PBUF_RING failed: {0}:{1}", errno, strerror(errno)));
+
+			buffers_.reset(new char[size_t(n_buffers_) * buffer_size_]);
+			memset(buffers_.get(), 0, size_t(n_buffers_) * buffer_size_); // touch all network memory in advance
+
+			for (uint32_t i = 0; i < n_buffers_; i++)
+				this->recycle_buffer(i);
+			this->commit_buffers();
+
+			// no source address, no control messages
+			memset(&msg_, 0, sizeof(msg_));
 		}
 
-		virtual void shutdown() override
+		void release()
 		{
-			if (threads_.empty())
-				return;
+			if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+				munmap(cq_ring_, cq_ring_sz_);
 
-			{
-				std::unique_lock<std::mutex> lk_(shutdown_mtx_);
-				shutdown_cli_sock_.send(1); // there is no need to send multiple times, threads exit on poll signal
-			}
+			if (sq_ring_ != MAP_FAILED)
+				munmap(sq_ring_, sq_ring_sz_);
 
-			for (auto&& thr : threads_)
-			{
-				thr.join();
-			}
+			if (sqes_ != MAP_FAILED)
+				munmap(sqes_, sqes_sz_);
 
-			threads_.clear();
+			if (fd_ >= 0)
+				close(fd_); // unregisters buffer ring as well
+
+			if (br_ != MAP_FAILED)
+				munmap(br_, br_sz_);
+
+			cq_ring_ = sq_ring_ = br_ = MAP_FAILED;
+			sqes_    = (struct io_uring_sqe*)MAP_FAILED;
+			fd_      = -1;
 		}
 
-	private:
+		// queue multishot recvmsg on socket, needs submit()
+		// user_data is given back in every completion
+		void arm_recvmsg(int sock_fd, uint64_t user_data)
+		{
+			uint32_t const tail = *sq_tail_;
+			uint32_t const head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+			assert((tail - head) < sq_entries_ && "sq is sized to fit recvmsg for all sockets");
+
+			uint32_t const index = tail & sq_mask_;
+
+			struct io_uring_sqe *sqe = &sqes_[index];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode    = IORING_OP_RECVMSG;
+			sqe->fd        = sock_fd;
+			sqe->addr      = (uint64_t)&msg_;
+			sqe->len       = 1;
+			sqe->flags     = IOSQE_BUFFER_SELECT;
+			sqe->ioprio    = IORING_RECV_MULTISHOT;
+			sqe->buf_group = buffer_group;
+			sqe->user_data = user_data;
+
+			sq_array_[index] = index;
+			__atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+			++to_submit_;
+		}
 
-		void try_resolve_listen_addr_port()
+		// submit queued sqes, if any
+		int submit()
 		{
-			os_addrinfo_list_ptr ai_list = os_unix::getaddrinfo_ex(conf_->address.c_str(), conf_->port.c_str(), AF_UNSPEC, SOCK_DGRAM, 0);
-			MEOW_UNIX_ADDRINFO_LIST_FOR_EACH(curr_addr, ai_list)
+			while (to_submit_ > 0)
 			{
-				LOG_INFO(globals_->logger(), "udp_reader; resolved {0}:{1} -> {2}", conf_->address, conf_->port, curr_addr->ai_addr);
-			}
+				int const r = os_->io_uring_enter(fd_, to_submit_, 0, 0);
+				if (r < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					return r;
+				}
 
-			os_addrinfo_t *ai = ai_list.get(); // take 1st item for now
+				to_submit_ -= r;
+			}
 
-			// commit if everything is ok
-			ai_list_ = std::move(ai_list);
+			return 0;
 		}
 
-		fd_handle_t try_bind_to_addr(os_addrinfo_t *ai)
+		// calls func(cqe) for every available completion, without syscalls
+		// func returns false to stop, completions after the one it stopped on are left in the queue
+		template<class Function>
+		uint32_t for_each_completion(Function const& func)
 		{
-			fd_handle_t fd { os_unix::socket_ex(ai->ai_family, ai->ai_socktype, ai->ai_protocol) };
-			os_unix::setsockopt_ex(*fd, SOL_SOCKET, SO_REUSEADDR, 1);
-			os_unix::setsockopt_ex(*fd, SOL_SOCKET, SO_REUSEPORT, 1);
-			if (ai->ai_family == AF_INET6)
-				os_unix::setsockopt_ex(*fd, IPPROTO_IPV6, IPV6_V6ONLY, 1);
-			os_unix::bind_ex(*fd, ai->ai_addr, ai->ai_addrlen);
+			uint32_t       head = *cq_head_;
+			uint32_t const tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
 
-			return fd;
-		}
+			uint32_t n_completions = 0;
 
-	private: // per-thread stuff
+			while (head != tail)
+			{
+				bool const keep_going = func(&cqes_[head & cq_mask_]);
 
-		void send_current_batch(uint32_t thread_id, raw_request_ptr& req)
-		{
-			stats_->udp.batch_send_total++;
-			stats_->udp.packet_send_total += req->request_count;
+				++head;
+				++n_completions;
 
-			bool const success = out_sock_.send_message(req, NN_DONTWAIT);
-			if (!success)
-			{
-				stats_->udp.batch_send_err++;
-				stats_->udp.packet_send_err += req->request_count;
+				if (!keep_going)
+					break;
 			}
 
-			req.reset(); // signal the need to reinit
+			__atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+			return n_completions;
 		}
 
-		void eat_udp(uint32_t const thread_id, std::vector<fd_handle_t> const& fds)
+		// datagram bytes for recvmsg completion, cqe must have IORING_CQE_F_BUFFER
+		str_ref recvmsg_payload(struct io_uring_cqe const *cqe) const
 		{
-			if (globals_->os_symbols()->has_recvmmsg())
-				this->eat_udp_recvmmsg(thread_id, fds);
-			else
-				this->eat_udp_recv(thread_id, fds);
+			uint32_t const buffer_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+			char const *buf = buffers_.get() + size_t(buffer_id) * buffer_size_;
+			auto const *out = (struct io_uring_recvmsg_out const*)buf;
+
+			size_t const header_sz = sizeof(*out) + msg_.msg_namelen + msg_.msg_controllen;
+			if ((size_t)cqe->res < header_sz)
+				return {};
+
+			size_t const payload_sz = std::min<size_t>(out->payloadlen, cqe->res - header_sz);
+			return str_ref { buf + header_sz, payload_sz };
 		}
 
-		void eat_udp_recv(uint32_t const thread_id, std::vector<fd_handle_t> const& fds)
+		// give buffer back to the kernel, needs commit_buffers()
+		void recycle_buffer(uint32_t buffer_id)
 		{
-			static constexpr size_t const read_buffer_size = 64 * 1024; // max udp message size
-			char buf[read_buffer_size];
+			auto *br = (struct io_uring_buf_ring*)br_;
 
-			raw_request_ptr req;
+			struct io_uring_buf *b = &br->bufs[br_tail_ & (n_buffers_ - 1)];
+			b->addr = (uint64_t)(buffers_.get() + size_t(buffer_id) * buffer_size_);
+			b->len  = buffer_size_;
+			b->bid  = buffer_id;
 
-			ProtobufCAllocator request_unpack_pba = {
-				.alloc = nmpa___pba_alloc,
-				.free = nmpa___pba_free,
-				.allocator_data = NULL, // changed in progress
-			};
+			++br_tail_;
+		}
 
-			nmsg_poller_t poller;
+		void commit_buffers()
+		{
+			auto *br = (struct io_uring_buf_ring*)br_;
+			__atomic_store_n(&br->tail, br_tail_, __ATOMIC_RELEASE);
+		}
 
-			// extra stats
-			poller.before_poll([this](timeval_t now, duration_t wait_for)
-			{
-				++stats_->udp.poll_total;
-			});
+	private:
 
-			// periodic rusage
-			poller.ticker(1 * d_second, [&](timeval_t now)
-			{
-				os_rusage_t const ru = os_unix::getrusage_ex(RUSAGE_THREAD);
+		void* mmap_ring(size_t sz, off_t offset)
+		{
+			void *ptr = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+			if (ptr == MAP_FAILED)
+				throw std::runtime_error(ff::fmt_str("mmap(io_uring, {0}) failed: {1}:{2}", offset, errno, strerror(errno)));
+			return ptr;
+		}
 
-				std::lock_guard<std::mutex> lk_(stats_->mtx);
-				stats_->collector_threads[thread_id].ru_utime = timeval_from_os_timeval(ru.ru_utime);
-				stats_->collector_threads[thread_id].ru_stime = timeval_from_os_timeval(ru.ru_stime);
-			});
+	private:
+		static constexpr uint16_t const buffer_group = 0;
+
+		pinba_os_symbols_t   *os_;
+		int                  fd_         = -1;
+		uint32_t             sq_entries_ = 0;
+		uint32_t             to_submit_  = 0;
+
+		void                 *sq_ring_   = MAP_FAILED;
+		size_t               sq_ring_sz_ = 0;
+		uint32_t             *sq_head_   = nullptr;
+		uint32_t             *sq_tail_   = nullptr;
+		uint32_t             sq_mask_    = 0;
+		uint32_t             *sq_array_  = nullptr;
+
+		void                 *cq_ring_   = MAP_FAILED;
+		size_t               cq_ring_sz_ = 0;
+		uint32_t             *cq_head_   = nullptr;
+		uint32_t             *cq_tail_   = nullptr;
+		uint32_t             cq_mask_    = 0;
+		struct io_uring_cqe  *cqes_      = nullptr;
+
+		struct io_uring_sqe  *sqes_      = (struct io_uring_sqe*)MAP_FAILED;
+		size_t               sqes_sz_    = 0;
+
+		void                 *br_        = MAP_FAILED;
+		size_t               br_sz_      = 0;
+		uint16_t             br_tail_    = 0;
+
+		uint32_t const          n_buffers_;
+		uint32_t const          buffer_size_;
+		std::unique_ptr<char[]> buffers_;
+
+		struct msghdr        msg_;
+	};
 
-			// shutdown
-			poller.read_nn_socket(shutdown_sock_, [&](timeval_t)
-			{
-				LOG_DEBUG(globals_->logger(), "udp_reader/{0}; received shutdown request", thread_id);
-				poller.set_shutdown_flag();
-			});
-#if 0
-			// resetable periodic event, to 'idly' send batch at regular intervals
-			auto batch_send_tick = poller.ticker_with_reset(conf_->batch_timeout, [&](timeval_t now)
-			{
-				if (!req || req->request_count == 0)
-					return;
+#endif // PINBA_HAVE_IO_URING_RECV_MULTISHOT
 
-				this->send_current_batch(thread_id, req);
-			});
-#endif
-			// process udp packets from the network
-			for (auto const& fd : fds)
-			{
-				poller.read_plain_fd(*fd, [&](timeval_t now)
-				{
-					char decompress_buf[read_buffer_size]; // re-used buffer for decompression
+////////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef PINBA_HAVE_AF_XDP
 
-					// try receiving as much as possible without blocking
-					while (true)
-					{
-						++stats_->udp.recv_total;
+	// fd owned by the struct holding it
+	struct xdp_fd_t : private boost::noncopyable
+	{
+		int fd = -1;
 
-						int const n = recv(*fd, buf, sizeof(buf), MSG_DONTWAIT);
-						if (n > 0)
-						{
-							++stats_->udp.recv_packets;
-							stats_->udp.recv_bytes += uint64_t(n);
+		~xdp_fd_t()
+		{
+			if (fd >= 0)
+				close(fd);
+		}
+	};
 
-							// parse incoming bytes, and maybe decompress them
-							net_datagram_t dgram = parse_network_datagram(str_ref{ buf, size_t(n) });
-							if (dgram.version == 1)
-							{
-								if ((dgram.flags & PINBA_NET_DATAGRAM_FLAG___COMPRESSED_LZ4) != 0)
-								{
-									bool const ok = decompress_network_datagram(&dgram, decompress_buf, sizeof(decompress_buf));
-									if (!ok)
-									{
-										// TODO: ++stats_->udp.packet_decompress_err;
-										++stats_->udp.packet_decode_err;
-										continue;
-									}
-								}
-							}
+	// minimal ebpf assembler, just enough for the redirect program below (no libbpf, no clang at build time)
+	struct bpf_asm_t
+	{
+		std::vector<struct bpf_insn>       insns;
+		std::vector<std::pair<size_t, int>> fixups;  // (jump insn, label)
+		std::vector<int>                   labels;   // label -> insn, -1 = not bound yet
 
-							// unpack protobuf and push packet into batch
-							if (!req)
-							{
-								constexpr size_t nmpa_block_size = 16 * 1024;
-								req = meow::make_intrusive<raw_request_t>(conf_->batch_size, nmpa_block_size);
-								request_unpack_pba.allocator_data = &req->nmpa;
-							}
+		int new_label()
+		{
+			labels.push_back(-1);
+			return int(labels.size() - 1);
+		}
 
-							Pinba__Request *request = pinba__request__unpack(&request_unpack_pba, dgram.data.c_length(), (uint8_t*)dgram.data.data());
-							if (request == NULL) {
-								++stats_->udp.packet_decode_err;
-								continue;
-							}
+		void bind(int label)
+		{
+			labels[label] = int(insns.size());
+		}
 
-							req->requests[req->request_count] = request;
-							req->request_count++;
+		void emit(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+		{
+			struct bpf_insn i = {};
+			i.code    = code;
+			i.dst_reg = dst;
+			i.src_reg = src;
+			i.off     = off;
+			i.imm     = imm;
+			insns.push_back(i);
+		}
 
-							if (req->request_count >= conf_->batch_size)
-							{
-								this->send_current_batch(thread_id, req);
-								// poller.reset_ticker(batch_send_tick, now);
-							}
+		void mov_reg(uint8_t dst, uint8_t src)                { emit(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0); }
+		void mov_imm(uint8_t dst, int32_t imm)                { emit(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm); }
+		void add_imm(uint8_t dst, int32_t imm)                { emit(BPF_ALU64 | BPF_ADD | BPF_K, dst, 0, 0, imm); }
+		void and_imm(uint8_t dst, int32_t imm)                { emit(BPF_ALU64 | BPF_AND | BPF_K, dst, 0, 0, imm); }
+		void load(uint8_t size, uint8_t dst, uint8_t src, int16_t off) { emit(BPF_LDX | BPF_MEM | size, dst, src, off, 0); }
+		void call(int32_t helper)                             { emit(BPF_JMP | BPF_CALL, 0, 0, 0, helper); }
+		void exit()                                           { emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0); }
 
-							continue;
-						}
+		// 64bit load of map fd, kernel replaces it with map pointer
+		void load_map_fd(uint8_t dst, int map_fd)
+		{
+			emit(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, map_fd);
+			emit(0, 0, 0, 0, 0);
+		}
 
-						if (n < 0) {
-							if (errno == EINTR)
-								continue;
+		void jump(uint8_t op, uint8_t dst, uint8_t src_or_0, bool is_reg, int32_t imm, int label)
+		{
+			fixups.emplace_back(insns.size(), label);
+			emit(BPF_JMP | op | (is_reg ? BPF_X : BPF_K), dst, src_or_0, 0, imm);
+		}
 
-							if (errno == EAGAIN)
-							{
-								++stats_->udp.recv_eagain;
+		void jmp(int label)                                   { jump(BPF_JA, 0, 0, false, 0, label); }
+		void jgt_reg(uint8_t dst, uint8_t src, int label)     { jump(BPF_JGT, dst, src, true, 0, label); }
+		void jeq_imm(uint8_t dst, int32_t imm, int label)     { jump(BPF_JEQ, dst, 0, false, imm, label); }
+		void jne_imm(uint8_t dst, int32_t imm, int label)     { jump(BPF_JNE, dst, 0, false, imm, label); }
 
-								// need to send current batch if we've got anything
-								if (req && req->request_count > 0)
-								{
+		std::vector<struct bpf_insn>& finish()
+		{
+			for (auto const& f : fixups)
+			{
+				assert(labels[f.second] >= 0);
+				insns[f.first].off = int16_t(labels[f.second] - int(f.first) - 1);
+			}
+			fixups.clear();
+			return insns;
+		}
+	};
+
+	// xdp program on the interface, that redirects udp datagrams for our port to AF_XDP sockets (one per rx queue)
+	// everything else (and fragmented ipv4, ipv6 with extension headers, vlans) passes to the kernel stack as usual
+	// attached with bpf link, i.e. it's detached when link fd is closed (or the process dies), nothing to clean up
+	struct xdp_program_t : private boost::noncopyable
+	{
+		xdp_program_t(pinba_os_symbols_t *os, std::string const& ifname, uint16_t port, uint32_t n_queues)
+			: os_(os)
+		{
+			ifindex_ = if_nametoindex(ifname.c_str());
+			if (ifindex_ == 0)
+				throw std::runtime_error(ff::fmt_str("interface '{0}' not found: {1}:{2}", ifname, errno, strerror(errno)));
+
+			{
+				union bpf_attr attr = {};
+				attr.map_type    = BPF_MAP_TYPE_XSKMAP;
+				attr.key_size    = sizeof(uint32_t);
+				attr.value_size  = sizeof(uint32_t);
+				attr.max_entries = n_queues;
+
+				map_.fd = os_->bpf(BPF_MAP_CREATE, &attr, sizeof(attr));
+				if (map_.fd < 0)
+					throw std::runtime_error(ff::fmt_str("BPF_MAP_CREATE(xskmap) failed: {0}:{1}", errno, strerror(errno)));
+			}
+
+			std::vector<struct bpf_insn>& insns = this->assemble(port);
+
+			{
+				static char const license[] = "Dual BSD/GPL";
+				char log_buf[4096] = {};
+
+				union bpf_attr attr = {};
+				attr.prog_type = BPF_PROG_TYPE_XDP;
+				attr.insns     = (uint64_t)insns.data();
+				attr.insn_cnt  = insns.size();
+				attr.license   = (uint64_t)license;
+				attr.log_buf   = (uint64_t)log_buf;
+				attr.log_size  = sizeof(log_buf);
+				attr.log_level = 1;
+
+				prog_.fd = os_->bpf(BPF_PROG_LOAD, &attr, sizeof(attr));
+				if (prog_.fd < 0)
+					throw std::runtime_error(ff::fmt_str("BPF_PROG_LOAD(xdp) failed: {0}:{1}, verifier: {2}", errno, strerror(errno), log_buf));
+			}
+
+			// native mode if driver supports it, generic otherwise
+			{
+				union bpf_attr attr = {};
+				attr.link_create.prog_fd        = prog_.fd;
+				attr.link_create.target_ifindex = ifindex_;
+				attr.link_create.attach_type    = BPF_XDP;
+
+				link_.fd = os_->bpf(BPF_LINK_CREATE, &attr, sizeof(attr));
+				if (link_.fd < 0)
+					throw std::runtime_error(ff::fmt_str("BPF_LINK_CREATE(xdp, {0}) failed: {1}:{2}", ifname, errno, strerror(errno)));
+			}
+		}
+
+		uint32_t ifindex() const
+		{
+			return ifindex_;
+		}
+
+		// datagrams from rx queue go to socket from now on
+		void set_queue_socket(uint32_t queue_id, int xsk_fd)
+		{
+			union bpf_attr attr = {};
+			attr.map_fd = map_.fd;
+			attr.key    = (uint64_t)&queue_id;
+			attr.value  = (uint64_t)&xsk_fd;
+			attr.flags  = BPF_ANY;
+
+			if (os_->bpf(BPF_MAP_UPDATE_ELEM, &attr, sizeof(attr)) < 0)
+				throw std::runtime_error(ff::fmt_str("BPF_MAP_UPDATE_ELEM(xskmap, {0}) failed: {1}:{2}", queue_id, errno, strerror(errno)));
+		}
+
+	private:
+
+		std::vector<struct bpf_insn>& assemble(uint16_t port)
+		{
+			// r1 = ctx, r2 = data, r3 = data_end, r4 = bounds check, r5 = scratch, r6 = saved ctx
+			// 16bit fields are compared to network order constants, loads don't swap bytes
+			constexpr int32_t eth_sz  = 14;
+			constexpr int32_t ip4_sz  = 20; // no options, anything else goes to the kernel
+			constexpr int32_t ip6_sz  = 40;
+			constexpr int32_t udp_sz  = 8;
+
+			bpf_asm_t& a = asm_;
+
+			int const l_ipv4     = a.new_label();
+			int const l_ipv6     = a.new_label();
+			int const l_redirect = a.new_label();
+			int const l_pass     = a.new_label();
+
+			a.mov_reg(BPF_REG_6, BPF_REG_1);
+			a.load(BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, data));
+			a.load(BPF_W, BPF_REG_3, BPF_REG_6, offsetof(struct xdp_md, data_end));
+
+			a.mov_reg(BPF_REG_4, BPF_REG_2);
+			a.add_imm(BPF_REG_4, eth_sz);
+			a.jgt_reg(BPF_REG_4, BPF_REG_3, l_pass);
+
+			a.load(BPF_H, BPF_REG_5, BPF_REG_2, 12); // ethertype
+			a.jeq_imm(BPF_REG_5, htons(ETH_P_IP), l_ipv4);
+			a.jeq_imm(BPF_REG_5, htons(ETH_P_IPV6), l_ipv6);
+			a.jmp(l_pass);
+
+			a.bind(l_ipv4);
+			a.mov_reg(BPF_REG_4, BPF_REG_2);
+			a.add_imm(BPF_REG_4, eth_sz + ip4_sz + udp_sz);
+			a.jgt_reg(BPF_REG_4, BPF_REG_3, l_pass);
+			a.load(BPF_B, BPF_REG_5, BPF_REG_2, eth_sz);      // version + ihl
+			a.jne_imm(BPF_REG_5, 0x45, l_pass);
+			a.load(BPF_B, BPF_REG_5, BPF_REG_2, eth_sz + 9);  // protocol
+			a.jne_imm(BPF_REG_5, IPPROTO_UDP, l_pass);
+			a.load(BPF_H, BPF_REG_5, BPF_REG_2, eth_sz + 6);  // flags + fragment offset, MF or offset = fragment
+			a.and_imm(BPF_REG_5, htons(0x3fff));
+			a.jne_imm(BPF_REG_5, 0, l_pass);
+			a.load(BPF_H, BPF_REG_5, BPF_REG_2, eth_sz + ip4_sz + 2); // udp dst port
+			a.jne_imm(BPF_REG_5, htons(port), l_pass);
+			a.jmp(l_redirect);
+
+			a.bind(l_ipv6);
+			a.mov_reg(BPF_REG_4, BPF_REG_2);
+			a.add_imm(BPF_REG_4, eth_sz + ip6_sz + udp_sz);
+			a.jgt_reg(BPF_REG_4, BPF_REG_3, l_pass);
+			a.load(BPF_B, BPF_REG_5, BPF_REG_2, eth_sz + 6);  // next header
+			a.jne_imm(BPF_REG_5, IPPROTO_UDP, l_pass);
+			a.load(BPF_H, BPF_REG_5, BPF_REG_2, eth_sz + ip6_sz + 2);
+			a.jne_imm(BPF_REG_5, htons(port), l_pass);
+
+			// bpf_redirect_map(xskmap, rx_queue_index, XDP_PASS), i.e. pass if there is no socket for this queue
+			a.bind(l_redirect);
+			a.load(BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index));
+			a.load_map_fd(BPF_REG_1, map_.fd);
+			a.mov_imm(BPF_REG_3, XDP_PASS);
+			a.call(BPF_FUNC_redirect_map);
+			a.exit();
+
+			a.bind(l_pass);
+			a.mov_imm(BPF_REG_0, XDP_PASS);
+			a.exit();
+
+			return a.finish();
+		}
+
+	private:
+		pinba_os_symbols_t  *os_;
+		uint32_t            ifindex_ = 0;
+		bpf_asm_t           asm_;
+		xdp_fd_t            map_;
+		xdp_fd_t            prog_;
+		xdp_fd_t            link_;
+	};
+
+	// AF_XDP socket bound to one rx queue, with umem of its own (rx only, completion ring is required, but never used)
+	// kernel writes frames to umem, and gives them to us through rx ring, we give them back through fill ring
+	// as with io_uring, in steady state the only syscall per wakeup is poll() on the socket
+	struct xdp_socket_t : private boost::noncopyable
+	{
+		static constexpr uint32_t const frame_size = 4096;
+
+		xdp_socket_t(uint32_t ifindex, uint32_t queue_id, uint32_t n_frames)
+			: n_frames_(n_frames)
+		{
+			// dtor is not called if ctor throws, cleanup manually
+			try
+			{
+				this->init(ifindex, queue_id);
+			}
+			catch (...)
+			{
+				this->release();
+				throw;
+			}
+		}
+
+		~xdp_socket_t()
+		{
+			this->release();
+		}
+
+		int fd() const
+		{
+			return fd_;
+		}
+
+		void init(uint32_t ifindex, uint32_t queue_id)
+		{
+			assert((n_frames_ > 0) && ((n_frames_ & (n_frames_ - 1)) == 0));
+
+			fd_ = socket(AF_XDP, SOCK_RAW, 0);
+			if (fd_ < 0)
+				throw std::runtime_error(ff::fmt_str("socket(AF_XDP) failed: {0}:{1}", errno, strerror(errno)));
+
+			umem_sz_ = size_t(n_frames_) * frame_size;
+			umem_    = mmap(NULL, umem_sz_, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_POPULATE, -1, 0);
+			if (umem_ == MAP_FAILED)
+				throw std::runtime_error(ff::fmt_str("mmap(umem) failed: {0}:{1}", errno, strerror(errno)));
+
+			struct xdp_umem_reg reg = {};
+			reg.addr       = (uint64_t)umem_;
+			reg.len        = umem_sz_;
+			reg.chunk_size = frame_size;
+			reg.headroom   = 0;
+			this->setsockopt_or_throw(XDP_UMEM_REG, &reg, sizeof(reg), "XDP_UMEM_REG");
+
+			int const ring_sz = (int)n_frames_;
+			this->setsockopt_or_throw(XDP_UMEM_FILL_RING, &ring_sz, sizeof(ring_sz), "XDP_UMEM_FILL_RING");
+			this->setsockopt_or_throw(XDP_UMEM_COMPLETION_RING, &ring_sz, sizeof(ring_sz), "XDP_UMEM_COMPLETION_RING");
+			this->setsockopt_or_throw(XDP_RX_RING, &ring_sz, sizeof(ring_sz), "XDP_RX_RING");
+
+			struct xdp_mmap_offsets off = {};
+			socklen_t off_len = sizeof(off);
+			if (0 != getsockopt(fd_, SOL_XDP, XDP_MMAP_OFFSETS, &off, &off_len))
+				throw std::runtime_error(ff::fmt_str("getsockopt(XDP_MMAP_OFFSETS) failed: {0}:{1}", errno, strerror(errno)));
+
+			fill_.map(fd_, off.fr, n_frames_ * sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING);
+			comp_.map(fd_, off.cr, n_frames_ * sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING);
+			rx_.map(fd_, off.rx, n_frames_ * sizeof(struct xdp_desc), XDP_PGOFF_RX_RING);
+
+			// all frames are kernel's to begin with
+			for (uint32_t i = 0; i < n_frames_; i++)
+				this->recycle_frame(uint64_t(i) * frame_size);
+			this->commit_frames();
+
+			struct sockaddr_xdp sxdp = {};
+			sxdp.sxdp_family   = AF_XDP;
+			sxdp.sxdp_ifindex  = ifindex;
+			sxdp.sxdp_queue_id = queue_id;
+			sxdp.sxdp_flags    = XDP_USE_NEED_WAKEUP;
+
+			if (0 != bind(fd_, (struct sockaddr*)&sxdp, sizeof(sxdp)))
+				throw std::runtime_error(ff::fmt_str("bind(AF_XDP, queue {0}) failed: {1}:{2}", queue_id, errno, strerror(errno)));
+		}
+
+		void release()
+		{
+			rx_.unmap();
+			comp_.unmap();
+			fill_.unmap();
+
+			if (fd_ >= 0)
+				close(fd_); // removes socket from xskmap as well
+
+			if (umem_ != MAP_FAILED)
+				munmap(umem_, umem_sz_);
+
+			fd_   = -1;
+			umem_ = MAP_FAILED;
+		}
+
+		// calls func(frame bytes) for every received frame, without syscalls
+		// frames go back to the fill ring right after func returns, so func must copy everything it needs
+		template<class Function>
+		uint32_t for_each_frame(Function const& func)
+		{
+			uint32_t       cons = *rx_.consumer;
+			uint32_t const prod = __atomic_load_n(rx_.producer, __ATOMIC_ACQUIRE);
+
+			uint32_t const n_frames = prod - cons;
+
+			for (; cons != prod; ++cons)
+			{
+				auto const *desc = &((struct xdp_desc const*)rx_.ring)[cons & rx_.mask];
+
+				func(str_ref { (char const*)umem_ + desc->addr, desc->len });
+				this->recycle_frame(desc->addr & ~uint64_t(frame_size - 1));
+			}
+
+			__atomic_store_n(rx_.consumer, cons, __ATOMIC_RELEASE);
+
+			if (n_frames > 0)
+				this->commit_frames();
+
+			return n_frames;
+		}
+
+		// kernel has run out of fill ring entries at some point and needs a kick to look at it again
+		void wakeup_if_needed()
+		{
+			if (__atomic_load_n(fill_.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP)
+				recvfrom(fd_, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+		}
+
+		// frames dropped by the kernel, since socket creation (rx ring full, fill ring empty, or invalid descriptors)
+		uint64_t drops_total() const
+		{
+			struct xdp_statistics st = {};
+			socklen_t st_len = sizeof(st);
+			if (0 != getsockopt(fd_, SOL_XDP, XDP_STATISTICS, &st, &st_len))
+				return 0;
+
+			return st.rx_dropped + st.rx_invalid_descs + st.rx_ring_full;
+		}
+
+	private:
+
+		// fill ring never overflows, it's sized to fit all frames, and every frame is either there, in rx ring or being processed
+		void recycle_frame(uint64_t addr)
+		{
+			((uint64_t*)fill_.ring)[fill_tail_ & fill_.mask] = addr;
+			++fill_tail_;
+		}
+
+		void commit_frames()
+		{
+			__atomic_store_n(fill_.producer, fill_tail_, __ATOMIC_RELEASE);
+		}
+
+		void setsockopt_or_throw(int opt, void const *value, socklen_t len, char const *name)
+		{
+			if (0 != setsockopt(fd_, SOL_XDP, opt, value, len))
+				throw std::runtime_error(ff::fmt_str("setsockopt({0}) failed: {1}:{2}", name, errno, strerror(errno)));
+		}
+
+	private:
+
+		struct ring_t
+		{
+			void      *mmap_ptr = MAP_FAILED;
+			size_t    mmap_sz   = 0;
+			uint32_t  *producer = nullptr;
+			uint32_t  *consumer = nullptr;
+			uint32_t  *flags    = nullptr;
+			void      *ring     = nullptr;
+			uint32_t  mask      = 0;
+
+			void map(int fd, struct xdp_ring_offset const& off, size_t ring_sz, off_t pgoff)
+			{
+				mmap_sz  = off.desc + ring_sz;
+				mmap_ptr = mmap(NULL, mmap_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+				if (mmap_ptr == MAP_FAILED)
+					throw std::runtime_error(ff::fmt_str("mmap(AF_XDP ring, {0}) failed: {1}:{2}", pgoff, errno, strerror(errno)));
+
+				char *p = (char*)mmap_ptr;
+				producer = (uint32_t*)(p + off.producer);
+				consumer = (uint32_t*)(p + off.consumer);
+				flags    = (uint32_t*)(p + off.flags);
+				ring     = p + off.desc;
+			}
+
+			void unmap()
+			{
+				if (mmap_ptr != MAP_FAILED)
+					munmap(mmap_ptr, mmap_sz);
+				mmap_ptr = MAP_FAILED;
+			}
+		};
+
+		uint32_t const  n_frames_;
+		int             fd_        = -1;
+		void            *umem_     = MAP_FAILED;
+		size_t          umem_sz_   = 0;
+
+		ring_t          fill_;
+		ring_t          comp_;
+		ring_t          rx_;
+		uint32_t        fill_tail_ = 0;
+	};
+
+	// udp payload of ethernet frame, redirected by xdp_program_t (so headers have been checked there already)
+	inline str_ref xdp_frame_udp_payload(str_ref const frame)
+	{
+		uint8_t const *p   = (uint8_t const*)frame.data();
+		size_t const   len = frame.size();
+
+		if (len < 14)
+			return {};
+
+		uint16_t const ethertype = (uint16_t(p[12]) << 8) | p[13];
+
+		size_t udp_off;
+		if (ethertype == ETH_P_IP)
+			udp_off = 14 + size_t(p[14] & 0x0f) * 4;
+		else if (ethertype == ETH_P_IPV6)
+			udp_off = 14 + 40;
+		else
+			return {};
+
+		if (len < udp_off + 8)
+			return {};
+
+		size_t const udp_len = (size_t(p[udp_off + 4]) << 8) | p[udp_off + 5];
+		if ((udp_len < 8) || (udp_off + udp_len > len)) // frames can have ethernet padding at the end, udp length is what counts
+			return {};
+
+		return str_ref { frame.data() + udp_off + 8, udp_len - 8 };
+	}
+
+#endif // PINBA_HAVE_AF_XDP
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	constexpr uint32_t const collector_max_threads         = 1024;
+	constexpr uint32_t const thread_stop_check_interval_ms = 100; // see collector_impl_t::set_thread_count()
+
+	struct collector_impl_t : public collector_t
+	{
+		collector_impl_t(pinba_globals_t *globals, collector_conf_t *conf)
+			: globals_(globals)
+			, stats_(globals->stats())
+			, conf_(conf)
+		{
+			if (conf_->n_threads == 0 || conf_->n_threads > collector_max_threads)
+				throw std::runtime_error(ff::fmt_str("collector_conf_t::n_threads must be within [1, {0}]", collector_max_threads));
+
+			thread_stop_.reset(new std::atomic<bool>[collector_max_threads]);
+			for (uint32_t i = 0; i < collector_max_threads; i++)
+				thread_stop_[i].store(false, std::memory_order_relaxed);
+
+			if (!conf_->out_ring)
+			{
+				out_sock_
+					.open(AF_SP, NN_PUSH)
+					.bind(conf_->nn_output);
+			}
+
+			shutdown_sock_
+				.open(AF_SP, NN_PULL)
+				.bind(conf_->nn_shutdown);
+
+			shutdown_cli_sock_
+				.open(AF_SP, NN_PUSH)
+				.connect(conf_->nn_shutdown);
+
+			this->try_resolve_listen_addr_port();
+
+			// kernel silently caps SO_RCVBUF at rmem_max, so warn about it in advance
+			if (conf_->socket_rcvbuf_size > 0)
+			{
+				uint64_t rmem_max = 0;
+				if (read_sysctl_value("/proc/sys/net/core/rmem_max", &rmem_max) && (rmem_max < conf_->socket_rcvbuf_size))
+				{
+					LOG_WARN(globals_->logger(), "udp socket buffer size {0} is over net.core.rmem_max = {1}, will try SO_RCVBUFFORCE, but that needs CAP_NET_ADMIN",
+						conf_->socket_rcvbuf_size, rmem_max);
+				}
+			}
+
+			// batches come back to the pool when repacker is done with them
+			// bounded, since most of them should be in flight within the repacker input queue
+			raw_request_pool_ = create_object_pool<raw_request_t>(conf_->n_threads * 64, &stats_->objects.raw_pool_hit, &stats_->objects.raw_pool_miss);
+		}
+
+		~collector_impl_t()
+		{
+			this->shutdown();
+		}
+
+		virtual void startup() override
+		{
+			std::lock_guard<std::mutex> lk_(threads_mtx_);
+
+			if (!threads_.empty())
+				throw std::logic_error("collector_t::startup(): already started");
+
+			this->grow_thread_stats(conf_->n_threads);
+
+			if (conf_->backend == PINBA_COLLECTOR_BACKEND__AF_XDP)
+				this->try_attach_xdp_program();
+
+			for (uint32_t i = 0; i < conf_->n_threads; i++)
+				this->start_thread(i);
+		}
+
+		virtual void shutdown() override
+		{
+			std::lock_guard<std::mutex> lk_(threads_mtx_);
+
+			if (threads_.empty())
+				return;
+
+			{
+				std::unique_lock<std::mutex> lk_(shutdown_mtx_);
+				shutdown_cli_sock_.send(1); // there is no need to send multiple times, threads exit on poll signal
+			}
+
+			for (auto&& thr : threads_)
+			{
+				thr.join();
+			}
+
+			threads_.clear();
+
+#ifdef PINBA_HAVE_AF_XDP
+			xdp_program_.reset(); // detach, after all sockets are gone
+#endif
+		}
+
+		virtual pinba_error_t set_thread_count(uint32_t n_threads) override
+		{
+			if (n_threads == 0 || n_threads > collector_max_threads)
+				return ff::fmt_err("udp_reader; thread count must be within [1, {0}], got {1}", collector_max_threads, n_threads);
+
+			// steering program and AF_XDP queues are set up for startup thread count
+			if (conf_->cpu_steering)
+				return ff::fmt_err("udp_reader; can't change thread count with cpu steering on, restart is needed");
+
+			if (conf_->backend == PINBA_COLLECTOR_BACKEND__AF_XDP)
+				return ff::fmt_err("udp_reader; can't change thread count with AF_XDP backend, restart is needed");
+
+			std::lock_guard<std::mutex> lk_(threads_mtx_);
+
+			if (threads_.empty())
+				return ff::fmt_err("udp_reader; not started");
+
+			uint32_t const n_before = threads_.size();
+
+			this->grow_thread_stats(n_threads);
+
+			while (threads_.size() < n_threads)
+				this->start_thread(threads_.size());
+
+			// stop all extra threads at once, they notice within thread_stop_check_interval_ms
+			for (uint32_t i = n_threads; i < threads_.size(); i++)
+				thread_stop_[i].store(true, std::memory_order_relaxed);
+
+			while (threads_.size() > n_threads)
+			{
+				threads_.back().join();
+				threads_.pop_back();
+				thread_stop_[threads_.size()].store(false, std::memory_order_relaxed);
+			}
+
+			LOG_INFO(globals_->logger(), "udp_reader; thread count changed {0} -> {1}", n_before, n_threads);
+			return {};
+		}
+
+		virtual uint32_t thread_count() const override
+		{
+			std::lock_guard<std::mutex> lk_(threads_mtx_);
+			return threads_.size();
+		}
+
+	private:
+
+		bool thread_stop_requested(uint32_t thread_id) const
+		{
+			return thread_stop_[thread_id].load(std::memory_order_relaxed);
+		}
+
+		// per-thread stats are never removed, stopped threads keep theirs until they start again
+		void grow_thread_stats(uint32_t n_threads)
+		{
+			std::lock_guard<std::mutex> lk_(stats_->mtx);
+
+			if (stats_->collector_threads.size() < n_threads)
+				stats_->collector_threads.resize(n_threads);
+
+			while (stats_->udp_threads.size() < n_threads)
+				stats_->udp_threads.emplace_back();
+		}
+
+		// under threads_mtx_, thread_id == threads_.size()
+		void start_thread(uint32_t i)
+		{
+			std::vector<fd_handle_t> fds;
+
+			// per-thread SO_REUSEPORT bind
+			// thread i sockets are i-th in their reuseport groups, as long as nobody else is bound to our port, that's what cpu steering relies on
+			MEOW_UNIX_ADDRINFO_LIST_FOR_EACH(curr_ai, ai_list_)
+			{
+				auto fd_h = this->try_bind_to_addr(curr_ai);
+				fds.push_back(std::move(fd_h));
+			}
+
+			// program is per reuseport group, attaching to any socket in the group will do, take the first one
+			if (conf_->cpu_steering && (i == 0))
+			{
+				for (auto const& fd : fds)
+					this->set_socket_cpu_steering(*fd);
+			}
+
+			// TODO(antoxa): replace passing i, with proper thread contexts
+			std::thread t([this, i, fds = std::move(fds)]()
+			{
+				std::string const thr_name = ff::fmt_str("udp_reader/{0}", i);
+
+				PINBA___OS_CALL(globals_, set_thread_name, thr_name);
+
+				if (conf_->cpu_steering)
+					pinba_set_thread_cpus(globals_, { collector_conf___steering_cpu(conf_, i) }, thr_name);
+				else
+					pinba_set_thread_cpus(globals_, conf_->cpus, thr_name);
+
+				pinba_set_thread_sched(globals_, conf_->sched, thr_name);
+
+				MEOW_DEFER(
+					LOG_DEBUG(globals_->logger(), "{0}; exiting", thr_name);
+				);
+
+				this->eat_udp(i, fds);
+			});
+
+			threads_.push_back(move(t));
+		}
+
+		void try_resolve_listen_addr_port()
+		{
+			os_addrinfo_list_ptr ai_list = os_unix::getaddrinfo_ex(conf_->address.c_str(), conf_->port.c_str(), AF_UNSPEC, SOCK_DGRAM, 0);
+			MEOW_UNIX_ADDRINFO_LIST_FOR_EACH(curr_addr, ai_list)
+			{
+				LOG_INFO(globals_->logger(), "udp_reader; resolved {0}:{1} -> {2}", conf_->address, conf_->port, curr_addr->ai_addr);
+			}
+
+			os_addrinfo_t *ai = ai_list.get(); // take 1st item for now
+
+			// commit if everything is ok
+			ai_list_ = std::move(ai_list);
+		}
+
+		// shared by all reader threads, failure is not fatal, readers fall back to regular sockets
+		void try_attach_xdp_program()
+		{
+#ifdef PINBA_HAVE_AF_XDP
+			if (conf_->xdp_interface.empty())
+			{
+				LOG_WARN(globals_->logger(), "udp_reader; AF_XDP backend requested, but no interface set, falling back");
+				return;
+			}
+
+			os_addrinfo_t const *ai = ai_list_.get();
+			uint16_t const port = (ai->ai_family == AF_INET6)
+				? ntohs(((struct sockaddr_in6 const*)ai->ai_addr)->sin6_port)
+				: ntohs(((struct sockaddr_in const*)ai->ai_addr)->sin_port);
+
+			try
+			{
+				xdp_program_ = meow::make_unique<xdp_program_t>(globals_->os_symbols(), conf_->xdp_interface, port, conf_->n_threads);
+				LOG_INFO(globals_->logger(), "udp_reader; xdp program attached to {0}, redirecting udp port {1} to AF_XDP sockets", conf_->xdp_interface, port);
+			}
+			catch (std::exception const& e)
+			{
+				LOG_WARN(globals_->logger(), "udp_reader; AF_XDP init failed, falling back: {0}", e.what());
+			}
+#else
+			LOG_WARN(globals_->logger(), "udp_reader; AF_XDP backend requested, but not supported by this build, falling back");
+#endif // PINBA_HAVE_AF_XDP
+		}
+
+		fd_handle_t try_bind_to_addr(os_addrinfo_t *ai)
+		{
+			fd_handle_t fd { os_unix::socket_ex(ai->ai_family, ai->ai_socktype, ai->ai_protocol) };
+			os_unix::setsockopt_ex(*fd, SOL_SOCKET, SO_REUSEADDR, 1);
+			os_unix::setsockopt_ex(*fd, SOL_SOCKET, SO_REUSEPORT, 1);
+			if (ai->ai_family == AF_INET6)
+				os_unix::setsockopt_ex(*fd, IPPROTO_IPV6, IPV6_V6ONLY, 1);
+#ifdef SO_RXQ_OVFL
+			os_unix::setsockopt_ex(*fd, SOL_SOCKET, SO_RXQ_OVFL, 1);
+#endif
+			if (conf_->socket_rcvbuf_size > 0)
+				this->set_socket_rcvbuf(*fd, conf_->socket_rcvbuf_size);
+			if (conf_->busy_poll_spins > 0 && conf_->busy_poll_usec > 0)
+				this->set_socket_busy_poll(*fd, conf_->busy_poll_usec);
+			os_unix::bind_ex(*fd, ai->ai_addr, ai->ai_addrlen);
+
+			return fd;
+		}
+
+		// can't go over net.core.rmem_max without CAP_NET_ADMIN, so try SO_RCVBUFFORCE first
+		// then see what we've actually got (kernel reports doubled value, accounting for its own overhead)
+		void set_socket_rcvbuf(int fd, size_t rcvbuf_size)
+		{
+			int const value = (int)std::min<size_t>(rcvbuf_size, INT_MAX / 2);
+
+			int r = setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &value, sizeof(value));
+			if (r != 0)
+				os_unix::setsockopt_ex(fd, SOL_SOCKET, SO_RCVBUF, value);
+
+			int       actual_value = 0;
+			socklen_t actual_len   = sizeof(actual_value);
+			r = getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &actual_value, &actual_len);
+			if (r != 0)
+				return;
+
+			if (size_t(actual_value / 2) < size_t(value))
+			{
+				LOG_WARN(globals_->logger(), "udp socket SO_RCVBUF is {0} bytes, wanted {1}, increase net.core.rmem_max to get more",
+					actual_value / 2, value);
+			}
+		}
+
+		// values above net.core.busy_read need CAP_NET_ADMIN, spinning still works without kernel busy polling, so just warn
+		void set_socket_busy_poll(int fd, uint32_t busy_poll_usec)
+		{
+#ifdef SO_BUSY_POLL
+			int const value = (int)std::min<uint32_t>(busy_poll_usec, INT_MAX);
+
+			if (0 != setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)))
+			{
+				LOG_WARN(globals_->logger(), "udp socket SO_BUSY_POLL {0} failed: {1}:{2}, spinning without kernel busy polling",
+					value, errno, strerror(errno));
+				return;
+			}
+
+#ifdef SO_PREFER_BUSY_POLL
+			int const prefer = 1;
+			if (0 != setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)))
+				LOG_WARN(globals_->logger(), "udp socket SO_PREFER_BUSY_POLL failed: {0}:{1}", errno, strerror(errno));
+#endif // SO_PREFER_BUSY_POLL
+
+#else
+			LOG_WARN(globals_->logger(), "udp socket SO_BUSY_POLL is not supported, spinning without kernel busy polling");
+#endif // SO_BUSY_POLL
+		}
+
+		// failure is not fatal, kernel just doesn't coalesce anything for this socket
+		void set_socket_gro(int fd, uint32_t thread_id)
+		{
+#ifdef UDP_GRO
+			int const value = 1;
+			if (0 != setsockopt(fd, SOL_UDP, UDP_GRO, &value, sizeof(value)))
+				LOG_WARN(globals_->logger(), "udp_reader/{0}; udp socket UDP_GRO failed: {1}:{2}", thread_id, errno, strerror(errno));
+#else
+			LOG_WARN(globals_->logger(), "udp_reader/{0}; udp socket UDP_GRO is not supported", thread_id);
+#endif // UDP_GRO
+		}
+
+		// reuseport group picks socket of the reader thread, that runs on the cpu datagram has been received on
+		// i.e. return index of thread pinned to current cpu, cpu % n_threads for cpus that no reader is pinned to
+		// failure is not fatal, flows are hashed over sockets, as without steering
+		void set_socket_cpu_steering(int fd)
+		{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+			std::vector<struct sock_filter> code;
+
+			code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU)));
+
+			if (!conf_->cpus.empty())
+			{
+				for (uint32_t i = 0; i < conf_->n_threads; i++)
+				{
+					code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, collector_conf___steering_cpu(conf_, i), 0, 1));
+					code.push_back(BPF_STMT(BPF_RET | BPF_K, i));
+				}
+			}
+
+			code.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, conf_->n_threads));
+			code.push_back(BPF_STMT(BPF_RET | BPF_A, 0));
+
+			struct sock_fprog prog = {};
+			prog.len    = (unsigned short)code.size();
+			prog.filter = code.data();
+
+			if (0 != setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)))
+			{
+				LOG_WARN(globals_->logger(), "udp socket SO_ATTACH_REUSEPORT_CBPF failed: {0}:{1}, datagrams are spread over reader threads by flow hash",
+					errno, strerror(errno));
+				return;
+			}
+
+			LOG_INFO(globals_->logger(), "udp_reader; steering datagrams to reader threads by receiving cpu, {0} threads", conf_->n_threads);
+#else
+			LOG_WARN(globals_->logger(), "udp socket SO_ATTACH_REUSEPORT_CBPF is not supported, datagrams are spread over reader threads by flow hash");
+#endif // SO_ATTACH_REUSEPORT_CBPF
+		}
+
+	private: // per-thread stuff
+
+		// batch nmpa block size, follows what this thread batches take (16KB to start with)
+		static nmpa_block_sizer_t& batch_nmpa_sizer()
+		{
+			static thread_local nmpa_block_sizer_t sizer { 16 * 1024, 4 * 1024, 512 * 1024 };
+			return sizer;
+		}
+
+		void send_current_batch(uint32_t thread_id, raw_request_ptr& req)
+		{
+			auto& udp_stats = stats_->udp_threads[thread_id];
+
+			udp_stats.batch_send_total++;
+			udp_stats.packet_send_total += req->request_count;
+
+			batch_nmpa_sizer().observe(nmpa_mem_requested(&req->nmpa));
+			req->charge_mem();
+
+			bool const success = (conf_->out_ring)
+				? conf_->out_ring->send_message(req, NN_DONTWAIT)
+				: out_sock_.send_message(req, NN_DONTWAIT);
+			if (!success)
+			{
+				udp_stats.batch_send_err++;
+				udp_stats.packet_send_err += req->request_count;
+			}
+
+			PINBA_PROBE3(udp_batch_send, thread_id, req->request_count, success);
+
+			req.reset(); // signal the need to reinit
+		}
+
+		void start_batch_if_needed(raw_request_ptr& req, ProtobufCAllocator *request_unpack_pba)
+		{
+			if (req)
+				return;
+
+			size_t const nmpa_block_size = batch_nmpa_sizer().block_size();
+			req = raw_request_pool_->get(conf_->batch_size, nmpa_block_size, conf_->defer_decode);
+			req->set_nmpa_block_size(nmpa_block_size);
+			req->created_tv = os_unix::clock_monotonic_now();
+			request_unpack_pba->allocator_data = &req->nmpa;
+		}
+
+		// append request bytes to current batch (creating it if needed), either unpacked or as is
+		// see collector_conf_t::defer_decode, returns false if request can't be unpacked
+		// data_in_batch = data is in batch nmpa already (decompressed there), reference it instead of copying
+		bool append_to_batch(raw_request_ptr& req, ProtobufCAllocator *request_unpack_pba, str_ref const data, bool data_in_batch = false)
+		{
+			this->start_batch_if_needed(req, request_unpack_pba);
+
+			if (conf_->defer_decode)
+			{
+				if (data_in_batch)
+				{
+					req->datagrams[req->request_count] = data;
+				}
+				else
+				{
+					char *bytes = (char*)nmpa_alloc(&req->nmpa, data.size());
+					memcpy(bytes, data.data(), data.size());
+
+					req->datagrams[req->request_count] = str_ref { bytes, data.size() };
+				}
+			}
+			else
+			{
+				Pinba__Request *request = pinba__request__unpack(request_unpack_pba, data.c_length(), (uint8_t*)data.data());
+				if (request == NULL)
+					return false;
+
+				req->requests[req->request_count] = request;
+			}
+
+			req->request_count++;
+			return true;
+		}
+
+		// parse network datagram, maybe decompress it, and append all requests it carries to current batch
+		// sends current batch whenever it gets full, returns true if that happened (callers might want to reset their timers)
+		bool append_datagram_to_batch(uint32_t thread_id, raw_request_ptr& req, ProtobufCAllocator *request_unpack_pba, str_ref const network_bytes, char *decompress_buf, int decompress_buf_capacity)
+		{
+			auto& udp_stats = stats_->udp_threads[thread_id];
+
+			if (network_bytes.empty())
+			{
+				++udp_stats.packet_decode_err;
+				return false;
+			}
+
+			// as received, before governor sampling and everything else, see datagram_capture.h
+			if (datagram_capture_t *capture = globals_->datagram_capture())
+				capture->push(thread_id, network_bytes);
+
+			// memory governor backpressure, keep every n-th datagram only, before spending anything on it
+			if (__builtin_expect(mem_governor___stage(stats_) >= PINBA_MEM_STAGE__SAMPLE, 0))
+			{
+				static thread_local uint32_t sample_counter = 0;
+
+				if ((sample_counter++ % PINBA_MEM_GOVERNOR___SAMPLE_KEEP_EVERY) != 0)
+				{
+					++udp_stats.packet_mem_sampled;
+					return false;
+				}
+			}
+
+			net_datagram_t dgram = parse_network_datagram(network_bytes);
+
+			// batch, that has decompressed requests in its nmpa, if any (until it's sent)
+			raw_request_t const *decompressed_into = nullptr;
+
+			// maybe decompress, use thread-local tmp buffer as destination
+			// unless requests are kept as is (defer_decode), then decompress straight into batch memory, and reference requests there
+			// protobuf-c copies every string and array it unpacks anyway, so it's fine to let it read from tmp buffer
+			if ((dgram.version != 0) && ((dgram.flags & PINBA_NET_DATAGRAM_FLAG___COMPRESSED_LZ4) != 0))
+			{
+				char *dst_buf      = decompress_buf;
+				int   dst_capacity = decompress_buf_capacity;
+
+				if (conf_->defer_decode)
+				{
+					size_t const decompressed_size = lz4_block_decompressed_size(dgram.data, decompress_buf_capacity);
+					if (decompressed_size == 0)
+					{
+						++udp_stats.packet_decode_err;
+						return false;
+					}
+
+					this->start_batch_if_needed(req, request_unpack_pba);
+
+					dst_buf           = (char*)nmpa_alloc(&req->nmpa, decompressed_size);
+					dst_capacity      = int(decompressed_size);
+					decompressed_into = req.get();
+				}
+
+				bool const ok = decompress_network_datagram(&dgram, dst_buf, dst_capacity);
+				if (!ok)
+				{
+					// TODO: ++udp_stats.packet_decompress_err;
+					++udp_stats.packet_decode_err;
+					return false;
+				}
+			}
+
+			bool batch_sent = false;
+
+			// unpack protobuf into current batch's nmpa and push parsed request
+			// both unpack and raw copy take everything they need, so network and decompress buffers can be reused right after
+			// requests decompressed into batch memory are referenced, until the batch gets full, copied into the next one after that
+			bool const framing_ok = for_each_network_datagram_request(dgram, [&](str_ref const request_bytes)
+			{
+				if (!this->append_to_batch(req, request_unpack_pba, request_bytes, (decompressed_into != nullptr)))
+				{
+					++udp_stats.packet_decode_err;
+					return;
+				}
+
+				if (req->request_count >= conf_->batch_size)
+				{
+					this->send_current_batch(thread_id, req);
+					batch_sent = true;
+					decompressed_into = nullptr; // might come back from the pool as the next batch, with its memory reused
+				}
+			});
+
+			if (!framing_ok)
+				++udp_stats.packet_decode_err;
+
+			return batch_sent;
+		}
+
+		void eat_udp(uint32_t const thread_id, std::vector<fd_handle_t> const& fds)
+		{
+			auto *os = globals_->os_symbols();
+
+			if (conf_->backend == PINBA_COLLECTOR_BACKEND__AF_XDP)
+			{
+				if (this->eat_udp_af_xdp(thread_id, fds))
+					return;
+			}
+
+			if (conf_->backend == PINBA_COLLECTOR_BACKEND__IO_URING)
+			{
+				if (os->has_io_uring())
+				{
+					if (this->eat_udp_io_uring(thread_id, fds))
+						return;
+				}
+				else
+				{
+					LOG_WARN(globals_->logger(), "udp_reader/{0}; io_uring backend requested, but not available, falling back", thread_id);
+				}
+			}
+
+			if ((conf_->backend == PINBA_COLLECTOR_BACKEND__RECV) || !os->has_recvmmsg())
+				this->eat_udp_recv(thread_id, fds);
+			else
+				this->eat_udp_recvmmsg(thread_id, fds);
+		}
+
+		void eat_udp_recv(uint32_t const thread_id, std::vector<fd_handle_t> const& fds)
+		{
+			auto& udp_stats = stats_->udp_threads[thread_id]; // this thread only, see pinba_counter_t
+
+			static constexpr size_t const read_buffer_size = 64 * 1024; // max udp message size
+			char buf[read_buffer_size];
+
+			// re-used buffer for decompression
+			size_t const decompress_buf_size = PINBA_NET_DATAGRAM_MAX_DECOMPRESSED_SIZE;
+			std::unique_ptr<char[]> decompress_buf { new char[decompress_buf_size] };
+
+			raw_request_ptr req;
+
+			ProtobufCAllocator request_unpack_pba = {
+				.alloc = nmpa___pba_alloc,
+				.free = nmpa___pba_free,
+				.allocator_data = NULL, // changed in progress
+			};
+
+			nmsg_poller_t poller;
+
+			// extra stats
+			poller.before_poll([&udp_stats](timeval_t now, duration_t wait_for)
+			{
+				++udp_stats.poll_total;
+			});
+
+			// periodic rusage
+			poller.ticker(1 * d_second, [&](timeval_t now)
+			{
+				os_rusage_t const ru = os_unix::getrusage_ex(RUSAGE_THREAD);
+
+				std::lock_guard<std::mutex> lk_(stats_->mtx);
+				stats_->collector_threads[thread_id].ru_utime = timeval_from_os_timeval(ru.ru_utime);
+				stats_->collector_threads[thread_id].ru_stime = timeval_from_os_timeval(ru.ru_stime);
+			});
+
+			// shutdown
+			poller.read_nn_socket(shutdown_sock_, [&](timeval_t)
+			{
+				LOG_DEBUG(globals_->logger(), "udp_reader/{0}; received shutdown request", thread_id);
+				poller.set_shutdown_flag();
+			});
+
+			// stopped by set_thread_count(), what's been received is sent, datagrams left in socket buffers are lost
+			poller.ticker(thread_stop_check_interval_ms * d_millisecond, [&](timeval_t)
+			{
+				if (!this->thread_stop_requested(thread_id))
+					return;
+
+				if (req && req->request_count > 0)
+					this->send_current_batch(thread_id, req);
+
+				poller.set_shutdown_flag();
+			});
+#if 0
+			// resetable periodic event, to 'idly' send batch at regular intervals
+			auto batch_send_tick = poller.ticker_with_reset(conf_->batch_timeout, [&](timeval_t now)
+			{
+				if (!req || req->request_count == 0)
+					return;
+
+				this->send_current_batch(thread_id, req);
+			});
+#endif
+			// process udp packets from the network
+			for (auto const& fd : fds)
+			{
+				poller.read_plain_fd(*fd, [&](timeval_t now)
+				{
+					// try receiving as much as possible without blocking
+					while (true)
+					{
+						++udp_stats.recv_total;
+
+						int const n = recv(*fd, buf, sizeof(buf), MSG_DONTWAIT);
+						if (n > 0)
+						{
+							++udp_stats.recv_packets;
+							udp_stats.recv_bytes += uint64_t(n);
+
+							// parse incoming bytes, maybe decompress them, and push requests into batch
+							// no need to reset batch_send_tick when batch gets sent, since it's disabled above
+							this->append_datagram_to_batch(thread_id, req, &request_unpack_pba, str_ref{ buf, size_t(n) }, decompress_buf.get(), decompress_buf_size);
+
+							continue;
+						}
+
+						if (n < 0) {
+							if (errno == EINTR)
+								continue;
+
+							if (errno == EAGAIN)
+							{
+								++udp_stats.recv_eagain;
+
+								// need to send current batch if we've got anything
+								if (req && req->request_count > 0)
+								{
 									this->send_current_batch(thread_id, req);
 									// poller.reset_ticker(batch_send_tick, now);
 								}
@@ -460,6 +1804,8 @@ namespace { namespace aux {
 
 		void eat_udp_recvmmsg(uint32_t const thread_id, std::vector<fd_handle_t> const& fds)
 		{
+			auto& udp_stats = stats_->udp_threads[thread_id]; // this thread only, see pinba_counter_t
+
 			size_t const max_message_size   = 64 * 1024; // max udp message size
 			size_t const max_dgrams_to_recv = conf_->batch_size; // FIXME: make a special setting for this
 
@@ -469,7 +1815,17 @@ namespace { namespace aux {
 			std::unique_ptr<struct iovec[]> iov_p { new struct iovec[max_dgrams_to_recv] };
 			struct iovec *iov = iov_p.get();
 
-			std::unique_ptr<char[]> recv_buffer_p { new char[max_dgrams_to_recv * max_message_size] };
+			std::unique_ptr<char[]> recv_buffer_p { new char[max_dgrams_to_recv * max_message_size] };
+
+			// ancillary data, kernel puts socket drop counter here (see SO_RXQ_OVFL in try_bind_to_addr())
+			// and gro segment size, for coalesced datagrams
+			size_t const control_size = CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(int));
+			std::unique_ptr<char[]> control_buffer_p { new char[max_dgrams_to_recv * control_size] };
+			char *control_buffer = control_buffer_p.get();
+
+			// re-used buffer for decompression
+			size_t const decompress_buf_size = PINBA_NET_DATAGRAM_MAX_DECOMPRESSED_SIZE;
+			std::unique_ptr<char[]> decompress_buf { new char[decompress_buf_size] };
 			char *recv_buffer = recv_buffer_p.get();
 
 			// touch all network memory in advance
@@ -484,8 +1840,24 @@ namespace { namespace aux {
 
 				hdr[i].msg_hdr.msg_iov    = &iov[i];
 				hdr[i].msg_hdr.msg_iovlen = 1;
+				hdr[i].msg_hdr.msg_control = control_buffer + i * control_size;
+			}
+
+			// last seen kernel drop counter, per socket, counters are cumulative
+			std::vector<uint32_t> kernel_drops_seen(fds.size(), 0);
+
+			// this reader splits coalesced datagrams (others don't get segment size), so opt in here, not on bind
+			if (conf_->gro)
+			{
+				for (auto const& fd : fds)
+					this->set_socket_gro(*fd, thread_id);
 			}
 
+			// busy poll mode, local counters are published with rusage
+			uint32_t const busy_poll_spins = conf_->busy_poll_spins;
+			uint64_t busy_poll_busy = 0;
+			uint64_t busy_poll_idle = 0;
+
 			raw_request_ptr req;
 
 			ProtobufCAllocator request_unpack_pba = {
@@ -497,9 +1869,9 @@ namespace { namespace aux {
 			nmsg_poller_t poller;
 
 			// extra stats
-			poller.before_poll([this](timeval_t now, duration_t wait_for)
+			poller.before_poll([&udp_stats](timeval_t now, duration_t wait_for)
 			{
-				++stats_->udp.poll_total;
+				++udp_stats.poll_total;
 			});
 
 			// periodic rusage
@@ -510,6 +1882,8 @@ namespace { namespace aux {
 				std::lock_guard<std::mutex> lk_(stats_->mtx);
 				stats_->collector_threads[thread_id].ru_utime = timeval_from_os_timeval(ru.ru_utime);
 				stats_->collector_threads[thread_id].ru_stime = timeval_from_os_timeval(ru.ru_stime);
+				stats_->collector_threads[thread_id].busy_poll_busy = busy_poll_busy;
+				stats_->collector_threads[thread_id].busy_poll_idle = busy_poll_idle;
 			});
 
 			// shutdown
@@ -519,6 +1893,18 @@ namespace { namespace aux {
 				poller.set_shutdown_flag();
 			});
 
+			// stopped by set_thread_count(), what's been received is sent, datagrams left in socket buffers are lost
+			poller.ticker(thread_stop_check_interval_ms * d_millisecond, [&](timeval_t)
+			{
+				if (!this->thread_stop_requested(thread_id))
+					return;
+
+				if (req && req->request_count > 0)
+					this->send_current_batch(thread_id, req);
+
+				poller.set_shutdown_flag();
+			});
+
 			// resetable periodic event, to 'idly' send batch at regular intervals
 			auto batch_send_tick = poller.ticker_with_reset(conf_->batch_timeout, [&](timeval_t now)
 			{
@@ -528,68 +1914,75 @@ namespace { namespace aux {
 				this->send_current_batch(thread_id, req);
 			});
 
-			for (auto const& fd : fds)
+			auto const process_datagram = [&](str_ref const network_bytes, timeval_t now)
 			{
-				poller.read_plain_fd(*fd, [&](timeval_t now)
+				bool const batch_sent = this->append_datagram_to_batch(thread_id, req, &request_unpack_pba, network_bytes, decompress_buf.get(), decompress_buf_size);
+				if (batch_sent)
+					poller.reset_ticker(batch_send_tick, now);
+			};
+
+			for (size_t fd_i = 0; fd_i < fds.size(); fd_i++)
+			{
+				auto const& fd = fds[fd_i];
+
+				poller.read_plain_fd(*fd, [&, fd_i](timeval_t now)
 				{
-					char decompress_buf[max_message_size]; // re-used buffer for decompression
+					// empty recvmmsg() calls left before going back to poll(), busy poll mode only
+					uint32_t spins_left = busy_poll_spins;
 
 					// recv as much as possible without blocking
 					// but see comments in EAGAIN handling on sleep() and saving syscalls
 					while (true)
 					{
-						++stats_->udp.recv_total;
+						++udp_stats.recv_total;
+
+						// kernel overwrites this on return
+						for (unsigned i = 0; i < max_dgrams_to_recv; i++)
+							hdr[i].msg_hdr.msg_controllen = control_size;
 
 						int const n = globals_->os_symbols()->recvmmsg(*fd, hdr, max_dgrams_to_recv, MSG_DONTWAIT, NULL);
 						if (n > 0)
 						{
-							stats_->udp.recv_packets += uint64_t(n);
+							udp_stats.recv_packets += uint64_t(n);
 
-							for (int i = 0; i < n; i++)
+							if (busy_poll_spins > 0)
 							{
-								str_ref const network_bytes = { (char*)iov[i].iov_base, (size_t)hdr[i].msg_len };
+								busy_poll_busy += (spins_left < busy_poll_spins); // got here by spinning
+								spins_left = busy_poll_spins;
+							}
 
-								stats_->udp.recv_bytes += network_bytes.size();
+							// drop counter only comes with datagrams received after some drops, latest one is the most precise
+							for (int i = n - 1; i >= 0; i--)
+							{
+								uint32_t drops_total;
+								if (!get_kernel_drop_counter(&hdr[i].msg_hdr, &drops_total))
+									continue;
 
-								net_datagram_t dgram = parse_network_datagram(network_bytes);
+								udp_stats.recv_kernel_drops += uint32_t(drops_total - kernel_drops_seen[fd_i]);
+								kernel_drops_seen[fd_i] = drops_total;
+								break;
+							}
 
-								// maybe decompress, use thread-local tmp buffer as destination
-								if (dgram.version == 1)
-								{
-									if ((dgram.flags & PINBA_NET_DATAGRAM_FLAG___COMPRESSED_LZ4) != 0)
-									{
-										bool const ok = decompress_network_datagram(&dgram, decompress_buf, sizeof(decompress_buf));
-										if (!ok)
-										{
-											// TODO: ++stats_->udp.packet_decompress_err;
-											++stats_->udp.packet_decode_err;
-											continue;
-										}
-									}
-								}
+							for (int i = 0; i < n; i++)
+							{
+								str_ref const network_bytes = { (char*)iov[i].iov_base, (size_t)hdr[i].msg_len };
 
-								// unpack protobuf into current batch's nmpa and push parsed request
-								if (!req)
-								{
-									constexpr size_t nmpa_block_size = 16 * 1024;
-									req = meow::make_intrusive<raw_request_t>(conf_->batch_size, nmpa_block_size);
-									request_unpack_pba.allocator_data = &req->nmpa;
-								}
+								udp_stats.recv_bytes += network_bytes.size();
 
-								Pinba__Request *request = pinba__request__unpack(&request_unpack_pba, dgram.data.c_length(), (uint8_t*)dgram.data.data());
-								if (request == NULL) {
-									++stats_->udp.packet_decode_err;
+								// gro message is a bunch of datagrams of segment_size each, last one might be shorter
+								uint32_t segment_size = 0;
+								if (!get_gro_segment_size(&hdr[i].msg_hdr, &segment_size) || (segment_size >= network_bytes.size()))
+								{
+									process_datagram(network_bytes, now);
 									continue;
 								}
 
-								req->requests[req->request_count] = request;
-								req->request_count++;
+								uint32_t n_segments = 0;
+								for (size_t off = 0; off < network_bytes.size(); off += segment_size, n_segments++)
+									process_datagram(str_ref { network_bytes.data() + off, std::min<size_t>(segment_size, network_bytes.size() - off) }, now);
 
-								if (req->request_count >= conf_->batch_size)
-								{
-									this->send_current_batch(thread_id, req);
-									poller.reset_ticker(batch_send_tick, now);
-								}
+								udp_stats.recv_packets      += n_segments - 1; // the message itself is counted above
+								udp_stats.recv_gro_segments += n_segments;
 							}
 
 							continue;
@@ -602,7 +1995,7 @@ namespace { namespace aux {
 
 							if (errno == EAGAIN)
 							{
-								++stats_->udp.recv_eagain;
+								++udp_stats.recv_eagain;
 
 								// need to send current batch if we've got anything
 								if (req && req->request_count > 0)
@@ -611,6 +2004,21 @@ namespace { namespace aux {
 									poller.reset_ticker(batch_send_tick, now);
 								}
 
+								// busy poll mode, trade cpu for wakeup latency, keep trying while budget lasts
+								// and go straight back to poll() after that, no sleeping
+								if (busy_poll_spins > 0)
+								{
+									if (spins_left > 0)
+									{
+										--spins_left;
+										++busy_poll_idle;
+										nmsg_ring___cpu_relax();
+										continue;
+									}
+
+									return;
+								}
+
 								// sleep for at least 1ms, before polling again, to let more packets arrive
 								// and save a ton on system calls
 								constexpr struct timespec const sleep_for = {
@@ -641,6 +2049,377 @@ namespace { namespace aux {
 			poller.loop();
 		}
 
+		// returns false if io_uring turned out to be unusable, before receiving anything
+		// caller should fallback to other methods in that case
+		bool eat_udp_io_uring(uint32_t const thread_id, std::vector<fd_handle_t> const& fds)
+		{
+			auto& udp_stats = stats_->udp_threads[thread_id]; // this thread only, see pinba_counter_t
+
+#ifdef PINBA_HAVE_IO_URING_RECV_MULTISHOT
+			size_t const max_message_size = 64 * 1024; // max udp message size
+
+			// buffer count must be a power of 2, have at least a batch worth of them
+			uint32_t const n_buffers = [&]()
+			{
+				uint32_t n = 64;
+				while (n < conf_->batch_size && n < 32768)
+					n *= 2;
+				return n;
+			}();
+
+			std::unique_ptr<udp_uring_t> ring;
+			try
+			{
+				ring = meow::make_unique<udp_uring_t>(globals_->os_symbols(), fds.size(), n_buffers, max_message_size);
+
+				for (uint32_t i = 0; i < fds.size(); i++)
+					ring->arm_recvmsg(*fds[i], i);
+
+				if (ring->submit() < 0)
+					throw std::runtime_error(ff::fmt_str("io_uring_enter() failed: {0}:{1}", errno, strerror(errno)));
+			}
+			catch (std::exception const& e)
+			{
+				LOG_WARN(globals_->logger(), "udp_reader/{0}; io_uring init failed, falling back: {1}", thread_id, e.what());
+				return false;
+			}
+
+			LOG_INFO(globals_->logger(), "udp_reader/{0}; using io_uring, {1} buffers", thread_id, n_buffers);
+
+			raw_request_ptr req;
+
+			ProtobufCAllocator request_unpack_pba = {
+				.alloc = nmpa___pba_alloc,
+				.free = nmpa___pba_free,
+				.allocator_data = NULL, // changed in progress
+			};
+
+			nmsg_poller_t poller;
+
+			// extra stats
+			poller.before_poll([&udp_stats](timeval_t now, duration_t wait_for)
+			{
+				++udp_stats.poll_total;
+			});
+
+			// periodic rusage
+			poller.ticker(1 * d_second, [&](timeval_t now)
+			{
+				os_rusage_t const ru = os_unix::getrusage_ex(RUSAGE_THREAD);
+
+				std::lock_guard<std::mutex> lk_(stats_->mtx);
+				stats_->collector_threads[thread_id].ru_utime = timeval_from_os_timeval(ru.ru_utime);
+				stats_->collector_threads[thread_id].ru_stime = timeval_from_os_timeval(ru.ru_stime);
+			});
+
+			// shutdown
+			poller.read_nn_socket(shutdown_sock_, [&](timeval_t)
+			{
+				LOG_INFO(globals_->logger(), "udp_reader/{0}; received shutdown request", thread_id);
+				poller.set_shutdown_flag();
+			});
+
+			// stopped by set_thread_count(), what's been received is sent, datagrams left in socket buffers are lost
+			poller.ticker(thread_stop_check_interval_ms * d_millisecond, [&](timeval_t)
+			{
+				if (!this->thread_stop_requested(thread_id))
+					return;
+
+				if (req && req->request_count > 0)
+					this->send_current_batch(thread_id, req);
+
+				poller.set_shutdown_flag();
+			});
+
+			// resetable periodic event, to 'idly' send batch at regular intervals
+			auto batch_send_tick = poller.ticker_with_reset(conf_->batch_timeout, [&](timeval_t now)
+			{
+				if (!req || req->request_count == 0)
+					return;
+
+				this->send_current_batch(thread_id, req);
+			});
+
+			// multishot recvmsg support can only be detected by trying, kernels before 6.0 fail it with EINVAL
+			bool got_datagrams  = false;
+			bool need_fallback  = false;
+
+			// re-used buffer for decompression
+			size_t const decompress_buf_size = PINBA_NET_DATAGRAM_MAX_DECOMPRESSED_SIZE;
+			std::unique_ptr<char[]> decompress_buf { new char[decompress_buf_size] };
+
+			auto const process_datagram = [&](str_ref const network_bytes, timeval_t now)
+			{
+				udp_stats.recv_packets += 1;
+				udp_stats.recv_bytes   += network_bytes.size();
+
+				// requests are copied out of the network buffer, so it can be recycled right after
+				bool const batch_sent = this->append_datagram_to_batch(thread_id, req, &request_unpack_pba, network_bytes, decompress_buf.get(), decompress_buf_size);
+				if (batch_sent)
+					poller.reset_ticker(batch_send_tick, now);
+			};
+
+			poller.read_plain_fd(ring->fd(), [&](timeval_t now)
+			{
+				++udp_stats.recv_total;
+
+				// stop handling completions on fallback or fatal error, ring is not re-armed or submitted after that
+				bool stopped = false;
+
+				ring->for_each_completion([&](struct io_uring_cqe const *cqe) -> bool
+				{
+					uint32_t const fd_i = (uint32_t)cqe->user_data;
+
+					if (cqe->flags & IORING_CQE_F_BUFFER)
+					{
+						got_datagrams = true;
+
+						process_datagram(ring->recvmsg_payload(cqe), now);
+						ring->recycle_buffer(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+					}
+					else if (cqe->res < 0)
+					{
+						// out of buffers, kernel has stopped multishot, just rearm below after recycling
+						if (cqe->res == -ENOBUFS)
+						{
+							++udp_stats.recv_eagain;
+						}
+						else if ((cqe->res == -EINVAL) && !got_datagrams)
+						{
+							LOG_WARN(globals_->logger(), "udp_reader/{0}; io_uring multishot recvmsg is not supported, falling back", thread_id);
+							need_fallback = true;
+							stopped = true;
+							poller.set_shutdown_flag();
+							return false;
+						}
+						else
+						{
+							LOG_ERROR(globals_->logger(), "udp_reader/{0}; io_uring recvmsg failed, exiting: {1}:{2}", thread_id, -cqe->res, strerror(-cqe->res));
+							stopped = true;
+							poller.set_shutdown_flag();
+							return false;
+						}
+					}
+
+					// multishot request has terminated, rearm
+					if (!(cqe->flags & IORING_CQE_F_MORE))
+						ring->arm_recvmsg(*fds[fd_i], fd_i);
+
+					return true;
+				});
+
+				if (stopped)
+				{
+					// what's been received is sent, same as when stopped by set_thread_count()
+					if (req && req->request_count > 0)
+						this->send_current_batch(thread_id, req);
+					return;
+				}
+
+				ring->commit_buffers();
+
+				if (ring->submit() < 0)
+				{
+					LOG_ERROR(globals_->logger(), "udp_reader/{0}; io_uring_enter() failed, exiting: {1}:{2}", thread_id, errno, strerror(errno));
+					poller.set_shutdown_flag();
+					return;
+				}
+
+				// send current batch if we've got anything, same as recvmmsg() does on EAGAIN
+				if (req && req->request_count > 0)
+				{
+					this->send_current_batch(thread_id, req);
+					poller.reset_ticker(batch_send_tick, now);
+				}
+
+				// sleep for at least 1ms, before polling again, to let more packets arrive
+				// and save a ton on system calls
+				constexpr struct timespec const sleep_for = {
+					.tv_sec = 0,
+					.tv_nsec = 1 * 1000 * 1000,
+				};
+				nanosleep(&sleep_for, NULL);
+			});
+
+			poller.loop();
+
+			return !need_fallback;
+#else
+			return false;
+#endif // PINBA_HAVE_IO_URING_RECV_MULTISHOT
+		}
+
+		// AF_XDP socket for thread's rx queue (queue id = thread id), plus kernel sockets for whatever xdp program passes
+		// returns false if AF_XDP turned out to be unusable, before receiving anything
+		// caller should fallback to other methods in that case
+		bool eat_udp_af_xdp(uint32_t const thread_id, std::vector<fd_handle_t> const& fds)
+		{
+			auto& udp_stats = stats_->udp_threads[thread_id]; // this thread only, see pinba_counter_t
+
+#ifdef PINBA_HAVE_AF_XDP
+			if (!xdp_program_)
+				return false; // already logged on startup
+
+			// frame count must be a power of 2, have at least a couple of batches worth of them
+			uint32_t const n_frames = [&]()
+			{
+				uint32_t n = 2048;
+				while (n < conf_->batch_size * 2 && n < 65536)
+					n *= 2;
+				return n;
+			}();
+
+			std::unique_ptr<xdp_socket_t> xsk;
+			try
+			{
+				xsk = meow::make_unique<xdp_socket_t>(xdp_program_->ifindex(), thread_id, n_frames);
+				xdp_program_->set_queue_socket(thread_id, xsk->fd());
+			}
+			catch (std::exception const& e)
+			{
+				LOG_WARN(globals_->logger(), "udp_reader/{0}; AF_XDP init failed, falling back: {1}", thread_id, e.what());
+				return false;
+			}
+
+			LOG_INFO(globals_->logger(), "udp_reader/{0}; using AF_XDP on {1}, rx queue {0}, {2} frames", thread_id, conf_->xdp_interface, n_frames);
+
+			raw_request_ptr req;
+
+			ProtobufCAllocator request_unpack_pba = {
+				.alloc = nmpa___pba_alloc,
+				.free = nmpa___pba_free,
+				.allocator_data = NULL, // changed in progress
+			};
+
+			nmsg_poller_t poller;
+
+			// extra stats
+			poller.before_poll([&udp_stats](timeval_t now, duration_t wait_for)
+			{
+				++udp_stats.poll_total;
+			});
+
+			// periodic rusage and kernel drops
+			uint64_t xsk_drops_seen = 0;
+
+			poller.ticker(1 * d_second, [&](timeval_t now)
+			{
+				uint64_t const drops = xsk->drops_total();
+				udp_stats.recv_kernel_drops += drops - xsk_drops_seen;
+				xsk_drops_seen = drops;
+
+				os_rusage_t const ru = os_unix::getrusage_ex(RUSAGE_THREAD);
+
+				std::lock_guard<std::mutex> lk_(stats_->mtx);
+				stats_->collector_threads[thread_id].ru_utime = timeval_from_os_timeval(ru.ru_utime);
+				stats_->collector_threads[thread_id].ru_stime = timeval_from_os_timeval(ru.ru_stime);
+			});
+
+			// shutdown
+			poller.read_nn_socket(shutdown_sock_, [&](timeval_t)
+			{
+				LOG_INFO(globals_->logger(), "udp_reader/{0}; received shutdown request", thread_id);
+				poller.set_shutdown_flag();
+			});
+
+			// resetable periodic event, to 'idly' send batch at regular intervals
+			auto batch_send_tick = poller.ticker_with_reset(conf_->batch_timeout, [&](timeval_t now)
+			{
+				if (!req || req->request_count == 0)
+					return;
+
+				this->send_current_batch(thread_id, req);
+			});
+
+			// re-used buffer for decompression
+			size_t const decompress_buf_size = PINBA_NET_DATAGRAM_MAX_DECOMPRESSED_SIZE;
+			std::unique_ptr<char[]> decompress_buf { new char[decompress_buf_size] };
+
+			auto const process_datagram = [&](str_ref const network_bytes, timeval_t now)
+			{
+				udp_stats.recv_packets += 1;
+				udp_stats.recv_bytes   += network_bytes.size();
+
+				// requests are copied out of the network buffer, so it can be recycled right after
+				bool const batch_sent = this->append_datagram_to_batch(thread_id, req, &request_unpack_pba, network_bytes, decompress_buf.get(), decompress_buf_size);
+				if (batch_sent)
+					poller.reset_ticker(batch_send_tick, now);
+			};
+
+			auto const flush_and_sleep = [&](timeval_t now)
+			{
+				// send current batch if we've got anything, same as recvmmsg() does on EAGAIN
+				if (req && req->request_count > 0)
+				{
+					this->send_current_batch(thread_id, req);
+					poller.reset_ticker(batch_send_tick, now);
+				}
+
+				// sleep for at least 1ms, before polling again, to let more packets arrive
+				// and save a ton on system calls
+				constexpr struct timespec const sleep_for = {
+					.tv_sec = 0,
+					.tv_nsec = 1 * 1000 * 1000,
+				};
+				nanosleep(&sleep_for, NULL);
+			};
+
+			poller.read_plain_fd(xsk->fd(), [&](timeval_t now)
+			{
+				++udp_stats.recv_total;
+
+				xsk->for_each_frame([&](str_ref const frame)
+				{
+					process_datagram(xdp_frame_udp_payload(frame), now);
+				});
+				xsk->wakeup_if_needed();
+
+				flush_and_sleep(now);
+			});
+
+			// fragmented datagrams, other rx queues and whatever else xdp program passes, come through regular sockets
+			static constexpr size_t const read_buffer_size = 64 * 1024; // max udp message size
+			std::unique_ptr<char[]> read_buf { new char[read_buffer_size] };
+
+			for (auto const& fd : fds)
+			{
+				poller.read_plain_fd(*fd, [&](timeval_t now)
+				{
+					while (true)
+					{
+						++udp_stats.recv_total;
+
+						int const n = recv(*fd, read_buf.get(), read_buffer_size, MSG_DONTWAIT);
+						if (n >= 0)
+						{
+							process_datagram(str_ref { read_buf.get(), size_t(n) }, now);
+							continue;
+						}
+
+						if (errno == EINTR)
+							continue;
+
+						if (errno == EAGAIN)
+						{
+							++udp_stats.recv_eagain;
+							return;
+						}
+
+						LOG_ERROR(globals_->logger(), "udp_reader/{0}; recv() failed, exiting: {1}:{2}", thread_id, errno, strerror(errno));
+						poller.set_shutdown_flag();
+						return;
+					}
+				});
+			}
+
+			poller.loop();
+
+			return true;
+#else
+			return false;
+#endif // PINBA_HAVE_AF_XDP
+		}
+
 	private:
 		os_addrinfo_list_ptr  ai_list_;
 
@@ -654,7 +2433,16 @@ namespace { namespace aux {
 		pinba_stats_t         *stats_;
 		collector_conf_t      *conf_;
 
-		std::vector<std::thread> threads_;
+		object_pool_ptr<raw_request_t> raw_request_pool_;
+
+#ifdef PINBA_HAVE_AF_XDP
+		std::unique_ptr<xdp_program_t> xdp_program_; // set on startup, if AF_XDP backend is requested and usable
+#endif
+
+		mutable std::mutex       threads_mtx_; // startup/shutdown/set_thread_count()
+		std::vector<std::thread> threads_;     // thread_id = index
+
+		std::unique_ptr<std::atomic<bool>[]> thread_stop_; // collector_max_threads, see set_thread_count()
 	};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
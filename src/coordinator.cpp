@@ -1,8 +1,19 @@
 #include "pinba_config.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <unistd.h> // access
 
 #include <nanomsg/pipeline.h>
 #include <nanomsg/pubsub.h>
@@ -14,10 +25,21 @@
 #include "pinba/os_symbols.h"
 #include "pinba/repacker.h"
 #include "pinba/coordinator.h"
+#include "pinba/mem_governor.h"
 #include "pinba/report.h"
+#include "pinba/report_by_packet.h"
+#include "pinba/report_by_request.h"
+#include "pinba/report_by_timer.h"
+#include "pinba/report_executor.h"
+#include "pinba/report_persist.h"
+#include "pinba/report_ticker.h"
+#include "pinba/thread_pool.h"
+#include "pinba/packet_capture.h"
 
 #include "pinba/nmsg_socket.h"
 #include "pinba/nmsg_poller.h"
+#include "pinba/pipeline_latency.h"
+#include "pinba/probes.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 namespace { namespace aux {
@@ -35,6 +57,31 @@ namespace { namespace aux {
 
 		std::string nn_packets;         // get packet_batch_ptr from this endpoint as fast as possible (SUB, pair to coodinator PUB)
 		size_t      nn_packets_buffer;  // NN_RCVBUF on nn_packets
+
+		pinba_cpu_list_t cpus;          // host and aggregator threads affinity, empty = anywhere
+		pinba_thread_sched_t sched;     // host and aggregator threads scheduling
+
+		nmsg_broadcast_ring_t<packet_batch_t> *packets_ring; // read batches from here instead of nn_packets, if set
+
+		report_ticker_t *ticker;        // report ticks come from here
+	};
+
+	// relay side of a thread aggregating packets, one per report, or one for a few fused reports
+	struct report_host_input_t
+	{
+		virtual ~report_host_input_t() {}
+
+		virtual bool process_batch(packet_batch_ptr) = 0;
+
+		// false if thread can't use any packet from batch (see packet_batch_filter_t), any thread
+		virtual bool might_use_batch(packet_batch_t const*) const = 0;
+
+		// start/stop reading from report_host_conf_t::packets_ring, relay thread only
+		virtual void subscribe_to_packets() = 0;
+		virtual void unsubscribe_from_packets() = 0;
+
+		// false = relay should call process_batch() even in packets_ring mode
+		virtual bool reads_packets_ring() const { return true; }
 	};
 
 	struct report_host_t;
@@ -48,12 +95,22 @@ namespace { namespace aux {
 
 		virtual uint32_t           id() const = 0;
 		virtual report_t*          report() const = 0;
+		virtual report_ptr         shared_report() const = 0;
 		virtual report_agg_t*      report_agg() const = 0;
 		virtual report_history_t*  report_history() const = 0;
 		virtual report_stats_t*    stats() = 0;
 
-		virtual bool process_batch(packet_batch_ptr) = 0;
 		virtual void execute_in_thread(report_host_call_func_t const&) = 0;
+
+		// execute_in_thread() in two halves, to have funcs run in several hosts at the same time
+		// control lock is held in between, finish must always follow start
+		virtual std::unique_lock<std::mutex> execute_in_thread_start(report_host_call_func_t const&) = 0;
+		virtual void execute_in_thread_finish(std::unique_lock<std::mutex>) = 0;
+
+		// stop processing anything (batches, ticks, control requests) until resume(), caller can use the host directly meanwhile
+		// only hosts without threads of their own can do this (see report_host___pooled_t), false returned otherwise
+		virtual bool pause() { return false; }
+		virtual void resume() {}
 	};
 	typedef std::unique_ptr<report_host_t> report_host_ptr;
 
@@ -73,16 +130,130 @@ namespace { namespace aux {
 	{};
 	typedef boost::intrusive_ptr<report_host_result_t> report_host_result_ptr;
 
-	struct report_host___new_thread_t : public report_host_t
+	// overload degradation for report hosts, see pinba_options_t::report_overload_lag
+	// when batches get to report later than threshold, aggregate only every (1 << shift)-th batch, with sample rate scaled to match
+	// shift goes up a step per second while still lagging, and back down after calm_seconds of lag staying under threshold / 4
+	struct report_overload_t
+	{
+		static constexpr uint32_t const max_shift    = 6;  // at most 1 of 64 batches skipped
+		static constexpr uint32_t const calm_seconds = 10;
+
+		pinba_globals_t    *globals_;
+		report_stats_t     *stats_;
+		str_ref             name_;
+		duration_t          threshold_;
+
+		uint32_t            shift_     = 0;
+		uint32_t            calm_secs_ = 0;
+		uint64_t            batch_no_  = 0;
+		duration_t          max_lag_   = {0};  // since last update()
+
+		report_overload_t(pinba_globals_t *globals, report_stats_t *stats, str_ref name)
+			: globals_(globals)
+			, stats_(stats)
+			, name_(name)
+			, threshold_(globals->options()->report_overload_lag)
+		{
+		}
+
+		// false = skip the batch
+		bool on_batch(timeval_t now, timeval_t relayed_tv)
+		{
+			if (threshold_.nsec == 0)
+				return true;
+
+			duration_t const lag = duration_from_timeval(now - relayed_tv);
+			if (lag.nsec > max_lag_.nsec)
+				max_lag_ = lag;
+
+			if (shift_ == 0)
+				return true;
+
+			uint64_t const mask = (uint64_t(1) << shift_) - 1;
+			if ((batch_no_++ & mask) == 0)
+				return true;
+
+			stats_->overload_batches_skipped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		// once a second, same thread as on_batch()
+		void update(report_agg_t *agg)
+		{
+			if (threshold_.nsec == 0)
+				return;
+
+			duration_t const lag = max_lag_;
+			max_lag_ = {0};
+
+			uint32_t new_shift = shift_;
+
+			if (lag.nsec > threshold_.nsec)
+			{
+				calm_secs_ = 0;
+				if (new_shift < max_shift)
+					new_shift++;
+			}
+			else if (lag.nsec < threshold_.nsec / 4)
+			{
+				if (new_shift > 0 && ++calm_secs_ >= calm_seconds)
+				{
+					calm_secs_ = 0;
+					new_shift--;
+				}
+			}
+			else
+			{
+				calm_secs_ = 0;
+			}
+
+			if (new_shift == shift_)
+				return;
+
+			LOG_WARN(globals_->logger(), "{0}; {1} overload, batch lag {2}s, aggregating 1 of {3} batches",
+				name_, (new_shift > shift_) ? "entering" : "leaving", timeval_to_double(timeval_from_duration(lag)), (1u << new_shift));
+
+			shift_    = new_shift;
+			batch_no_ = 0;
+			agg->set_sample_scale(1u << shift_);
+
+			stats_->overload_sample_shift.store(shift_, std::memory_order_relaxed);
+			stats_->overload_transitions.fetch_add(1, std::memory_order_relaxed);
+		}
+	};
+
+	// aggregator + history estimates for report_stats___publish(), report host thread only
+	// history might be merging a tick in background (see tick_finalize_pool), so its live estimates are used when there are any
+	inline report_estimates_t report_host___estimates(report_host_t *rhost)
+	{
+		auto const live  = rhost->report()->live_estimates();
+		auto const a_est = rhost->report_agg()->get_estimates();
+		auto const h_est = (live) ? live->load() : rhost->report_history()->get_estimates();
+
+		report_estimates_t result;
+		result.row_count = h_est.row_count ? h_est.row_count : a_est.row_count;
+		result.mem_used  = h_est.mem_used + a_est.mem_used;
+		return result;
+	}
+
+	struct report_host___new_thread_t : public report_host_t, public report_host_input_t
 	{
 		pinba_globals_t        *globals_;
 		report_host_conf_t     conf_;
 
 		std::thread            t_;
 
+		static constexpr size_t max_batches_per_poll_iteration = 16; // packets_ring mode, don't starve control requests
+
 		nmsg_socket_t          packets_send_sock_;
 		nmsg_socket_t          packets_recv_sock_;
 
+		using packets_reader_t = nmsg_broadcast_reader_t<packet_batch_t>;
+		std::unique_ptr<packets_reader_t> packets_reader_; // packets_ring mode only
+
+		nmsg_channel_ptr<timeval_t>                 tick_chan_; // from conf_.ticker
+		report_ticker_t::subscription_id_t          tick_sub_ = 0;
+
 		// *_cli_sock_ + *_mtx_ are required for
 		// dirty workaround for https://github.com/nanomsg/nanomsg/issues/575
 
@@ -95,26 +266,62 @@ namespace { namespace aux {
 		std::mutex             shutdown_mtx_;
 
 		report_ptr             report_;
+		packet_batch_filter_t const *batch_filter_ = nullptr; // owned by report_
 		report_agg_ptr         report_agg_;
 		report_history_ptr     report_history_;
 		report_stats_t         stats_;
 
 		repacker_state_ptr     repacker_state_;
 
+		pipeline_latency_recorder_ptr latency_; // host thread only
+		report_thread_counters_t     *counters_ = nullptr; // host thread only
+		std::unique_ptr<report_overload_t> overload_; // host thread only, shards are not degraded
+
+		// tick being merged into history in globals tick_finalize_pool(), host thread only
+		// history is only touched by one thread at a time, pool task or host thread after history_wait()
+		std::future<void>            history_merge_;
+
+		// extra aggregator threads, for reports with agg_threads > 1
+		// every shard pulls batches from the same nn_packets endpoint as host thread (PUSH balances between them)
+		// and aggregates into its own report_agg_t, host thread grabs ticks from all shards on tick and merges those into history
+		struct agg_shard_t
+		{
+			std::thread            t;
+
+			nmsg_socket_t          packets_recv_sock;
+			std::unique_ptr<packets_reader_t> packets_reader; // packets_ring mode only
+
+			nmsg_socket_t          shutdown_sock;
+			nmsg_socket_t          shutdown_cli_sock;
+
+			std::mutex             mtx; // protects agg and repacker_state, host thread takes it on tick
+			report_agg_ptr         agg;
+			repacker_state_ptr     repacker_state;
+
+			pipeline_latency_recorder_ptr latency; // shard thread only
+			report_thread_counters_t     *counters = nullptr; // shard thread only
+		};
+		using agg_shard_ptr = std::unique_ptr<agg_shard_t>;
+
+		std::vector<agg_shard_ptr> agg_shards_;
+
 	public:
 
 		report_host___new_thread_t(pinba_globals_t *globals, report_host_conf_t const& conf)
 			: globals_(globals)
 			, conf_(conf)
 		{
-			packets_send_sock_
-				.open(AF_SP, NN_PUSH)
-				.bind(conf_.nn_packets);
-
-			packets_recv_sock_
-				.open(AF_SP, NN_PULL)
-				.set_option(NN_SOL_SOCKET, NN_RCVBUF, sizeof(packet_batch_ptr) * conf_.nn_packets_buffer, ff::fmt_str("{0}/in_sock", conf_.name))
-				.connect(conf_.nn_packets);
+			if (!conf_.packets_ring)
+			{
+				packets_send_sock_
+					.open(AF_SP, NN_PUSH)
+					.bind(conf_.nn_packets);
+
+				packets_recv_sock_
+					.open(AF_SP, NN_PULL)
+					.set_option(NN_SOL_SOCKET, NN_RCVBUF, sizeof(packet_batch_ptr) * conf_.nn_packets_buffer, ff::fmt_str("{0}/in_sock", conf_.name))
+					.connect(conf_.nn_packets);
+			}
 
 			control_sock_
 				.open(AF_SP, NN_REP)
@@ -144,6 +351,7 @@ namespace { namespace aux {
 				throw std::logic_error(ff::fmt_str("report handler {0} is already started", conf_.name));
 
 			report_ = incoming_report;
+			batch_filter_ = report_->batch_filter();
 
 			//
 
@@ -158,11 +366,144 @@ namespace { namespace aux {
 			report_history_ = report_->create_history();
 			report_history_->stats_init(&stats_);
 
+			latency_  = globals_->pipeline_latency()->create_recorder(PINBA_PIPELINE_STAGE__REPORT, conf_.name);
+			counters_ = report_stats___add_thread(&stats_);
+			overload_ = meow::make_unique<report_overload_t>(globals_, &stats_, conf_.name);
+
+			// with packets_ring, every aggregating thread reads every agg_threads-th batch
+			if (conf_.packets_ring)
+				packets_reader_ = meow::make_unique<packets_reader_t>(rinfo->agg_threads, 0);
+
+			// host thread is aggregating as well, so just the extra ones here
+			for (uint32_t i = 1; i < rinfo->agg_threads; i++)
+			{
+				auto shard = meow::make_unique<agg_shard_t>();
+
+				if (conf_.packets_ring)
+				{
+					shard->packets_reader = meow::make_unique<packets_reader_t>(rinfo->agg_threads, i);
+				}
+				else
+				{
+					shard->packets_recv_sock
+						.open(AF_SP, NN_PULL)
+						.set_option(NN_SOL_SOCKET, NN_RCVBUF, sizeof(packet_batch_ptr) * conf_.nn_packets_buffer, ff::fmt_str("{0}/in_sock/{1}", conf_.name, i))
+						.connect(conf_.nn_packets);
+				}
+
+				std::string const nn_shutdown = ff::fmt_str("{0}/{1}", conf_.nn_shutdown, i);
+
+				shard->shutdown_sock
+					.open(AF_SP, NN_REP)
+					.bind(nn_shutdown);
+
+				shard->shutdown_cli_sock
+					.open(AF_SP, NN_REQ)
+					.connect(nn_shutdown);
+
+				shard->agg = report_->create_aggregator();
+				shard->agg->stats_init(&stats_);
+
+				shard->latency  = globals_->pipeline_latency()->create_recorder(PINBA_PIPELINE_STAGE__REPORT, conf_.name);
+				shard->counters = report_stats___add_thread(&stats_);
+
+				agg_shards_.push_back(move(shard));
+			}
+
 			std::atomic_thread_fence(std::memory_order_seq_cst);
 
-			std::thread t([this, tick_interval]()
+			for (uint32_t i = 0; i < agg_shards_.size(); i++)
+			{
+				agg_shard_t *shard = agg_shards_[i].get();
+
+				std::thread t([this, shard, i]()
+				{
+					std::string const thread_name = ff::fmt_str("{0}/{1}", conf_.thread_name, i + 1);
+
+					PINBA___OS_CALL(globals_, set_thread_name, thread_name);
+					pinba_set_thread_cpus(globals_, conf_.cpus, thread_name);
+					pinba_set_thread_sched(globals_, conf_.sched, thread_name);
+
+					MEOW_DEFER(
+						LOG_DEBUG(globals_->logger(), "{0}; exiting", thread_name);
+					);
+
+					auto const process_batch = [this, shard](timeval_t now, packet_batch_ptr const& batch)
+					{
+						shard->latency->record(now, batch->relayed_tv);
+
+						shard->counters->batches_recv_total += 1;
+						shard->counters->packets_recv_total += batch->packet_count;
+
+						// ring is shared by all reports, so relay can't skip batches for us, do it here
+						if (!this->might_use_batch(batch.get()))
+						{
+							++globals_->stats()->coordinator.batch_send_skipped;
+							return;
+						}
+
+						std::lock_guard<std::mutex> lk_(shard->mtx);
+
+						repacker_state___merge_to_from(shard->repacker_state, batch->repacker_state);
+
+						uint64_t const cycles_start = pinba_cycles_now();
+
+						if (batch->columns)
+							shard->agg->add_batch(batch->columns, batch->packets);
+						else
+							shard->agg->add_multi(batch->packets, batch->packet_count);
+
+						shard->counters->cycles_add += pinba_cycles_now() - cycles_start;
+					};
+
+					nmsg_poller_t poller;
+
+					if (shard->packets_reader)
+					{
+						poller.read_nmsg_broadcast(*shard->packets_reader, [shard, &process_batch](timeval_t now)
+						{
+							for (size_t i = 0; i < max_batches_per_poll_iteration; ++i)
+							{
+								auto const batch = shard->packets_reader->recv_dontwait();
+								if (!batch)
+									break;
+
+								process_batch(now, batch);
+							}
+						});
+					}
+					else
+					{
+						poller.read_nn_socket(shard->packets_recv_sock, [shard, &process_batch](timeval_t now)
+						{
+							process_batch(now, shard->packets_recv_sock.recv<packet_batch_ptr>());
+						});
+					}
+
+					poller
+						.read_nn_socket(shard->shutdown_sock, [shard, &poller](timeval_t)
+						{
+							shard->shutdown_sock.recv<int>();
+							poller.set_shutdown_flag(); // exit loop() after this iteration
+							shard->shutdown_sock.send(1);
+						})
+						.loop();
+				});
+
+				shard->t = move(t);
+			}
+
+			tick_chan_ = nmsg_channel_create<timeval_t>(ff::fmt_str("{0}/ticks", conf_.name));
+			tick_sub_  = conf_.ticker->subscribe(tick_interval, [chan = tick_chan_](timeval_t tick_tv)
+			{
+				chan->send_dontwait(tick_tv); // thread is busy for longer than a few ticks, skip those
+			});
+
+			std::thread t([this]()
 			{
 				PINBA___OS_CALL(globals_, set_thread_name, conf_.thread_name);
+				pinba_set_thread_cpus(globals_, conf_.cpus, conf_.thread_name);
+				pinba_set_thread_sched(globals_, conf_.sched, conf_.thread_name);
 
 				MEOW_DEFER(
 					LOG_DEBUG(globals_->logger(), "{0}; exiting", conf_.thread_name);
@@ -171,72 +512,184 @@ namespace { namespace aux {
 				//
 
 				nmsg_poller_t poller;
+
+				auto const process_batch = [this](timeval_t now, packet_batch_ptr const& batch)
+				{
+					latency_->record(now, batch->relayed_tv);
+
+					counters_->batches_recv_total += 1;
+					counters_->packets_recv_total += batch->packet_count;
+
+					if (!this->might_use_batch(batch.get()))
+					{
+						++globals_->stats()->coordinator.batch_send_skipped;
+						return;
+					}
+
+					if (!overload_->on_batch(now, batch->relayed_tv))
+						return;
+
+					repacker_state___merge_to_from(repacker_state_, batch->repacker_state);
+
+					uint64_t const cycles_start = pinba_cycles_now();
+
+					if (batch->columns)
+						report_agg_->add_batch(batch->columns, batch->packets);
+					else
+						report_agg_->add_multi(batch->packets, batch->packet_count);
+
+					counters_->cycles_add += pinba_cycles_now() - cycles_start;
+				};
+
+				if (packets_reader_)
+				{
+					poller.read_nmsg_broadcast(*packets_reader_, [this, &process_batch](timeval_t now)
+					{
+						for (size_t i = 0; i < max_batches_per_poll_iteration; ++i)
+						{
+							auto const batch = packets_reader_->recv_dontwait();
+							if (!batch)
+								break;
+
+							process_batch(now, batch);
+						}
+					});
+				}
+				else
+				{
+					poller.read_nn_socket(packets_recv_sock_, [this, &process_batch](timeval_t now)
+					{
+						process_batch(now, packets_recv_sock_.recv<packet_batch_ptr>());
+					});
+				}
+
 				poller
-					.ticker(tick_interval, [this](timeval_t now)
+					.read_nn_channel(*tick_chan_, [this](nmsg_channel_t<timeval_t>& chan, timeval_t)
 					{
+						timeval_t const now = chan.recv(); // tick time, same for all reports with this interval
+						PINBA_PROBE1(report_tick_start, conf_.name.c_str());
+
+						std::vector<report_tick_ptr> ticks;
+						ticks.reserve(1 + agg_shards_.size());
+
+						uint64_t const cycles_start = pinba_cycles_now();
+
 						report_tick_ptr tick = report_agg_->tick_now(now);
 						tick->repacker_state = std::move(repacker_state_);
+						ticks.push_back(std::move(tick));
 
-						report_history_->merge_tick(tick);
+						// history is sized to hold ticks from all shards, snapshot merges them as usual
+						for (auto& shard : agg_shards_)
+						{
+							std::lock_guard<std::mutex> lk_(shard->mtx);
 
-						timeval_t const curr_tv    = os_unix::clock_monotonic_now();
-						timeval_t const curr_rt_tv = os_unix::clock_gettime_ex(CLOCK_REALTIME);
+							report_tick_ptr shard_tick = shard->agg->tick_now(now);
+							shard_tick->repacker_state = std::move(shard->repacker_state);
+							ticks.push_back(std::move(shard_tick));
+						}
 
-						std::unique_lock<std::mutex> lk_(stats_.lock);
-						stats_.last_tick_tv        = curr_rt_tv;
-						stats_.last_tick_prepare_d = duration_from_timeval(curr_tv - now);
+						counters_->cycles_tick += pinba_cycles_now() - cycles_start;
+
+						// aggregators are on fresh ticks already, history merge can go on in background
+						this->history_wait();
+
+						auto const merge = [this, now, ticks = std::move(ticks)]()
+						{
+							uint64_t const cycles_start = pinba_cycles_now();
+
+							for (auto const& t : ticks)
+								report_history_->merge_tick(t);
+
+							counters_->cycles_merge += pinba_cycles_now() - cycles_start;
+
+							timeval_t const curr_tv    = os_unix::clock_monotonic_now();
+							timeval_t const curr_rt_tv = os_unix::clock_gettime_ex(CLOCK_REALTIME);
+							PINBA_PROBE2(report_tick_end, conf_.name.c_str(), duration_from_timeval(curr_tv - now).nsec);
+
+							std::unique_lock<std::mutex> lk_(stats_.lock);
+							stats_.last_tick_tv        = curr_rt_tv;
+							stats_.last_tick_prepare_d = duration_from_timeval(curr_tv - now);
+						};
+
+						thread_pool_t *pool = globals_->tick_finalize_pool();
+						if (!pool)
+						{
+							merge();
+							return;
+						}
+
+						auto task = std::make_shared<std::packaged_task<void()>>(merge);
+						history_merge_ = task->get_future();
+						pool->enqueue([task]() { (*task)(); });
 					})
 					.ticker(1 * d_second, [this](timeval_t now)
 					{
+						overload_->update(report_agg_.get());
+
 						os_rusage_t ru = os_unix::getrusage_ex(RUSAGE_THREAD);
 
 						std::unique_lock<std::mutex> lk_(stats_.lock);
 						stats_.ru_utime = timeval_from_os_timeval(ru.ru_utime);
 						stats_.ru_stime = timeval_from_os_timeval(ru.ru_stime);
-					})
-					.read_nn_socket(packets_recv_sock_, [this](timeval_t now)
-					{
-						auto const batch = packets_recv_sock_.recv<packet_batch_ptr>();
 
-						stats_.batches_recv_total += 1;
-						stats_.packets_recv_total += batch->packet_count;
-
-						repacker_state___merge_to_from(repacker_state_, batch->repacker_state);
-
-						report_agg_->add_multi(batch->packets, batch->packet_count);
+						report_stats___sample_rates(&stats_, now);
+						report_stats___publish(&stats_, report_host___estimates(this));
 					})
 					.read_nn_socket(control_sock_, [this](timeval_t now)
 					{
 						auto const req = control_sock_.recv<report_host_req_ptr>();
+						this->history_wait(); // requests expect history to have every tick
 						req->func(this);
 						control_sock_.send(meow::make_intrusive<report_host_result_t>());
 					})
 					.read_nn_socket(shutdown_sock_, [this, &poller](timeval_t)
 					{
 						shutdown_sock_.recv<int>();
+						this->history_wait();
 						poller.set_shutdown_flag(); // exit loop() after this iteration
 						shutdown_sock_.send(1);
 					})
 					.loop();
+
+				this->history_wait(); // tick might have come in the same iteration as shutdown
 			});
 
 			t_ = move(t);
 		}
 
+	private:
+
+		// host thread only, waits for tick being merged into history in tick_finalize_pool (if any)
+		void history_wait()
+		{
+			if (history_merge_.valid())
+				history_merge_.get();
+		}
+
+	public:
+
 		virtual bool process_batch(packet_batch_ptr batch) override
 		{
-			stats_.batches_send_total += 1;
-			stats_.packets_send_total += batch->packet_count;
+			stats_.relay.batches_send_total += 1;
+			stats_.relay.packets_send_total += batch->packet_count;
 
 			bool const success = packets_send_sock_.send_message(batch, NN_DONTWAIT);
 			if (!success)
 			{
-				stats_.batches_send_err += 1;
-				stats_.packets_send_err += batch->packet_count;
+				stats_.relay.batches_send_err += 1;
+				stats_.relay.packets_send_err += batch->packet_count;
 			}
 			return success;
 		}
 
+		virtual bool might_use_batch(packet_batch_t const *batch) const override
+		{
+			if (!batch_filter_)
+				return true;
+
+			return batch_filter_->might_match(batch->summary);
+		}
+
 		virtual uint32_t id() const override
 		{
 			return conf_.id;
@@ -247,6 +700,11 @@ namespace { namespace aux {
 			return report_.get();
 		}
 
+		virtual report_ptr shared_report() const override
+		{
+			return report_;
+		}
+
 		virtual report_agg_t* report_agg() const override
 		{
 			return report_agg_.get();
@@ -259,10 +717,33 @@ namespace { namespace aux {
 
 		virtual report_stats_t* stats() override
 		{
+			// packets_ring mode, relay doesn't count anything per report, gather from readers instead
+			if (packets_reader_)
+			{
+				uint64_t batches_dropped = packets_reader_->dropped_messages();
+				uint64_t packets_dropped = packets_reader_->dropped_weight();
+
+				for (auto const& shard : agg_shards_)
+				{
+					batches_dropped += shard->packets_reader->dropped_messages();
+					packets_dropped += shard->packets_reader->dropped_weight();
+				}
+
+				stats_.relay.batches_send_total = packets_reader_->published_messages();
+				stats_.relay.packets_send_total = packets_reader_->published_weight();
+				stats_.relay.batches_send_err   = batches_dropped;
+				stats_.relay.packets_send_err   = packets_dropped;
+			}
+
 			return &stats_;
 		}
 
 		virtual void execute_in_thread(report_host_call_func_t const& func) override
+		{
+			this->execute_in_thread_finish(this->execute_in_thread_start(func));
+		}
+
+		virtual std::unique_lock<std::mutex> execute_in_thread_start(report_host_call_func_t const& func) override
 		{
 			// lock, so that multiple clients do not step on each other's toes
 			// we have is just one client currently, but keep same pattern as in other places
@@ -270,11 +751,34 @@ namespace { namespace aux {
 			std::unique_lock<std::mutex> lk_(control_mtx_);
 
 			control_cli_sock_.send_message(meow::make_intrusive<report_host_req_t>(func));
+			return lk_;
+		}
+
+		virtual void execute_in_thread_finish(std::unique_lock<std::mutex> lk_) override
+		{
+			assert(lk_.owns_lock());
 			control_cli_sock_.recv<report_host_result_ptr>();
 		}
 
+		virtual void subscribe_to_packets() override
+		{
+			conf_.packets_ring->subscribe(packets_reader_.get());
+
+			for (auto& shard : agg_shards_)
+				conf_.packets_ring->subscribe(shard->packets_reader.get());
+		}
+
+		virtual void unsubscribe_from_packets() override
+		{
+			conf_.packets_ring->unsubscribe(packets_reader_.get());
+
+			for (auto& shard : agg_shards_)
+				conf_.packets_ring->unsubscribe(shard->packets_reader.get());
+		}
+
 		virtual void shutdown() override
 		{
+			conf_.ticker->unsubscribe(tick_sub_);
 
 			{
 				std::unique_lock<std::mutex> lk_(shutdown_mtx_);
@@ -284,357 +788,2560 @@ namespace { namespace aux {
 			}
 
 			t_.join();
+
+			for (auto& shard : agg_shards_)
+			{
+				shard->shutdown_cli_sock.send(1);
+				shard->shutdown_cli_sock.recv<int>();
+
+				shard->t.join();
+			}
+			agg_shards_.clear();
 		}
 	};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
+// reports running on shared report_executor_t, see coordinator_conf_t::report_executor_threads
+//
+// no thread and no sockets of its own, relay posts batches straight to report strand (even in packets_ring mode),
+// ticks are posted by coordinator ticker, control requests pause the strand and run in the calling thread
+// single aggregator only, reports with agg_threads > 1 get a thread of their own anyway
 
-	struct relay_worker_t : private boost::noncopyable
+	struct report_host___pooled_t : public report_host_t, public report_host_input_t
 	{
-		relay_worker_t(pinba_globals_t *globals, coordinator_conf_t *conf)
-			: globals_(globals)
-			, stats_(globals->stats())
-			, conf_(conf)
-		{
-			in_sock_ = nmsg_socket(AF_SP, NN_PULL);
-			if (conf_->nn_input_buffer > 0)
-				in_sock_.set_option(NN_SOL_SOCKET, NN_RCVBUF, conf_->nn_input_buffer * sizeof(packet_batch_ptr), conf_->nn_input);
+		pinba_globals_t        *globals_;
+		report_host_conf_t     conf_;
+		report_executor_t      *executor_;
 
-			control_sock_
-				.open(AF_SP, NN_REP)
-				.bind(conf_->nn_control);
+		report_strand_ptr      strand_;
+		std::vector<report_executor_t::timer_id_t> timers_;
 
-			control_cli_sock_
-				.open(AF_SP, NN_REQ)
-				.connect(conf_->nn_control);
-		}
+		report_ticker_t::subscription_id_t tick_sub_ = 0;
+		std::atomic<bool>      tick_pending_;  // posted to strand, but hasn't run yet (don't pile up ticks for slow reports)
 
-		~relay_worker_t()
-		{
-			this->shutdown();
-		}
+		std::mutex             control_mtx_;
 
-		void startup()
-		{
-			in_sock_.connect(conf_->nn_input);
+		// batches posted, but not aggregated yet, drop instead of queueing more than nn_packets_buffer of them
+		std::atomic<size_t>    batches_queued_;
 
-			std::thread t([this]()
-			{
-				this->worker_thread();
-			});
-			thread_ = move(t);
-		}
+		report_ptr             report_;
+		packet_batch_filter_t const *batch_filter_ = nullptr; // owned by report_
+		report_agg_ptr         report_agg_;
+		report_history_ptr     report_history_;
+		report_stats_t         stats_;
 
-		void shutdown()
-		{
-			if (!thread_.joinable()) // has actually started and not shut down yet
-				return;
+		repacker_state_ptr     repacker_state_;
 
-			// tell relay to stop operation
-			auto const err = this->execute_in_thread([this]()
-			{
-				poller_.set_shutdown_flag();
-			});
+		pipeline_latency_recorder_ptr latency_; // strand tasks only
+		report_thread_counters_t     *counters_ = nullptr; // strand tasks only
+		std::unique_ptr<report_overload_t> overload_; // strand tasks only
 
-			if (err)
-			{
-				LOG_ALERT(globals_->logger(), "couldn't stop relay thread: {0}, aborting", err);
-			}
+	public:
 
-			thread_.join();
+		report_host___pooled_t(pinba_globals_t *globals, report_host_conf_t const& conf, report_executor_t *executor)
+			: globals_(globals)
+			, conf_(conf)
+			, executor_(executor)
+			, strand_(executor->create_strand())
+			, tick_pending_(false)
+			, batches_queued_(0)
+		{
+			stats_.created_tv          = os_unix::clock_gettime_ex(CLOCK_MONOTONIC);
+			stats_.created_realtime_tv = os_unix::clock_gettime_ex(CLOCK_REALTIME);
 		}
 
 	public:
 
-		using request_func_t = std::function<void()>;
-
+		virtual void startup(report_ptr incoming_report) override
+		{
+			if (report_)
+				throw std::logic_error(ff::fmt_str("report handler {0} is already started", conf_.name));
+
+			report_ = incoming_report;
+			batch_filter_ = report_->batch_filter();
+
+			auto const *rinfo        = report_->info();
+			auto const tick_interval = rinfo->time_window / rinfo->tick_count;
+
+			if (rinfo->agg_threads > 1)
+				throw std::logic_error(ff::fmt_str("report handler {0}: can't run agg_threads > 1 on report executor", conf_.name));
+
+			report_agg_ = report_->create_aggregator();
+			report_agg_->stats_init(&stats_);
+
+			report_history_ = report_->create_history();
+			report_history_->stats_init(&stats_);
+
+			latency_  = globals_->pipeline_latency()->create_recorder(PINBA_PIPELINE_STAGE__REPORT, conf_.name);
+			counters_ = report_stats___add_thread(&stats_);
+			overload_ = meow::make_unique<report_overload_t>(globals_, &stats_, conf_.name);
+
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			tick_sub_ = conf_.ticker->subscribe(tick_interval, [this](timeval_t now)
+			{
+				if (tick_pending_.exchange(true))
+					return;
+
+				executor_->post(strand_.get(), [this, now]()
+				{
+					tick_pending_ = false;
+					PINBA_PROBE1(report_tick_start, conf_.name.c_str());
+
+					uint64_t const cycles_start = pinba_cycles_now();
+
+					report_tick_ptr tick = report_agg_->tick_now(now);
+					tick->repacker_state = std::move(repacker_state_);
+
+					uint64_t const cycles_ticked = pinba_cycles_now();
+
+					report_history_->merge_tick(tick);
+
+					counters_->cycles_tick  += cycles_ticked - cycles_start;
+					counters_->cycles_merge += pinba_cycles_now() - cycles_ticked;
+
+					timeval_t const curr_tv    = os_unix::clock_monotonic_now();
+					timeval_t const curr_rt_tv = os_unix::clock_gettime_ex(CLOCK_REALTIME);
+					PINBA_PROBE2(report_tick_end, conf_.name.c_str(), duration_from_timeval(curr_tv - now).nsec);
+
+					std::unique_lock<std::mutex> lk_(stats_.lock);
+					stats_.last_tick_tv        = curr_rt_tv;
+					stats_.last_tick_prepare_d = duration_from_timeval(curr_tv - now);
+				});
+			});
+
+			timers_.push_back(executor_->add_timer(strand_.get(), 1 * d_second, [this](timeval_t now)
+			{
+				overload_->update(report_agg_.get());
+
+				// no thread to getrusage() for, executor measures cpu time of our tasks (user and system together)
+				duration_t const cpu_time = executor_->cpu_time(strand_.get());
+
+				std::unique_lock<std::mutex> lk_(stats_.lock);
+				stats_.ru_utime = timeval_from_duration(cpu_time);
+				stats_.ru_stime = {};
+
+				report_stats___sample_rates(&stats_, now);
+				report_stats___publish(&stats_, report_host___estimates(this));
+			}));
+		}
+
+		virtual bool process_batch(packet_batch_ptr batch) override
+		{
+			stats_.relay.batches_send_total += 1;
+			stats_.relay.packets_send_total += batch->packet_count;
+
+			if (batches_queued_.fetch_add(1) >= conf_.nn_packets_buffer)
+			{
+				batches_queued_.fetch_sub(1);
+
+				stats_.relay.batches_send_err += 1;
+				stats_.relay.packets_send_err += batch->packet_count;
+				return false;
+			}
+
+			executor_->post(strand_.get(), [this, batch]()
+			{
+				batches_queued_.fetch_sub(1);
+
+				timeval_t const now = os_unix::clock_monotonic_now();
+				latency_->record(now, batch->relayed_tv);
+
+				counters_->batches_recv_total += 1;
+				counters_->packets_recv_total += batch->packet_count;
+
+				if (!overload_->on_batch(now, batch->relayed_tv))
+					return;
+
+				repacker_state___merge_to_from(repacker_state_, batch->repacker_state);
+
+				uint64_t const cycles_start = pinba_cycles_now();
+
+				if (batch->columns)
+					report_agg_->add_batch(batch->columns, batch->packets);
+				else
+					report_agg_->add_multi(batch->packets, batch->packet_count);
+
+				counters_->cycles_add += pinba_cycles_now() - cycles_start;
+			});
+
+			return true;
+		}
+
+		virtual bool might_use_batch(packet_batch_t const *batch) const override
+		{
+			if (!batch_filter_)
+				return true;
+
+			return batch_filter_->might_match(batch->summary);
+		}
+
+		virtual void subscribe_to_packets() override
+		{
+		}
+
+		virtual void unsubscribe_from_packets() override
+		{
+		}
+
+		virtual bool reads_packets_ring() const override
+		{
+			return false;
+		}
+
+		virtual uint32_t id() const override
+		{
+			return conf_.id;
+		}
+
+		virtual report_t* report() const override
+		{
+			return report_.get();
+		}
+
+		virtual report_ptr shared_report() const override
+		{
+			return report_;
+		}
+
+		virtual report_agg_t* report_agg() const override
+		{
+			return report_agg_.get();
+		}
+
+		virtual report_history_t* report_history() const override
+		{
+			return report_history_.get();
+		}
+
+		virtual report_stats_t* stats() override
+		{
+			return &stats_;
+		}
+
+		virtual void execute_in_thread(report_host_call_func_t const& func) override
+		{
+			this->execute_in_thread_finish(this->execute_in_thread_start(func));
+		}
+
+		// strand is paused, so func runs right here, nothing else touches the report meanwhile
+		virtual std::unique_lock<std::mutex> execute_in_thread_start(report_host_call_func_t const& func) override
+		{
+			std::unique_lock<std::mutex> lk_(control_mtx_);
+
+			executor_->pause(strand_.get());
+			MEOW_DEFER(
+				executor_->resume(strand_.get());
+			);
+
+			func(this);
+			return lk_;
+		}
+
+		virtual void execute_in_thread_finish(std::unique_lock<std::mutex> lk_) override
+		{
+			assert(lk_.owns_lock());
+		}
+
+		virtual bool pause() override
+		{
+			executor_->pause(strand_.get());
+			return true;
+		}
+
+		virtual void resume() override
+		{
+			executor_->resume(strand_.get());
+		}
+
+		virtual void shutdown() override
+		{
+			conf_.ticker->unsubscribe(tick_sub_);
+
+			for (auto const timer_id : timers_)
+				executor_->cancel_timer(timer_id);
+			timers_.clear();
+
+			// relay has forgotten about us already, nothing is going to be posted, drop whatever is queued
+			executor_->pause(strand_.get());
+			executor_->clear(strand_.get());
+		}
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// fused reports, see coordinator_conf_t::report_fuse_max
+//
+// many reports of the same kind usually share filters and only differ in keys,
+// a thread per report means every one of them walks every packet (timers, tags, blooms) on its own
+// fused host runs aggregators of such reports in one thread instead, feeding every batch to all of them
+// in small chunks of packets, so that a chunk is still in cache, when the next report walks it
+//
+// compatible reports = same kind, tick interval and batch filter, single aggregator thread each
+// relay sees just one host (and skips batches for all members at once),
+// members are added and removed while running, always in host thread
+//
+// members with the same report_t::agg_signature() (i.e. same report with different windows) go further and share aggregation,
+// only the first one aggregates, its ticks are merged into histories of the rest (see add_member())
+
+	struct report_host___fused_t;
+
+	struct report_host___fused_member_t : public report_host_t
+	{
+		report_host___fused_t  *host_;
+		uint32_t               id_;
+
+		report_ptr             report_;
+		report_agg_ptr         report_agg_;
+		report_history_ptr     report_history_;
+		report_stats_t         stats_;
+
+		repacker_state_ptr     repacker_state_; // host thread only
+		report_thread_counters_t *counters_ = nullptr; // host thread only
+
+		// host thread only, either agg_source_ is set (our aggregator is idle, history gets its ticks)
+		// or agg_followers_ might be non-empty (histories getting our ticks)
+		report_host___fused_member_t              *agg_source_ = nullptr;
+		std::vector<report_host___fused_member_t*> agg_followers_;
+
+	public:
+
+		report_host___fused_member_t(report_host___fused_t *host, uint32_t id)
+			: host_(host)
+			, id_(id)
+		{
+			stats_.created_tv          = os_unix::clock_gettime_ex(CLOCK_MONOTONIC);
+			stats_.created_realtime_tv = os_unix::clock_gettime_ex(CLOCK_REALTIME);
+		}
+
+		virtual void startup(report_ptr incoming_report) override
+		{
+			if (report_)
+				throw std::logic_error(ff::fmt_str("fused report handler {0} is already started", id_));
+
+			report_ = incoming_report;
+
+			// create objects here, to avoid exceptions inside host thread
+			report_agg_ = report_->create_aggregator();
+			report_agg_->stats_init(&stats_);
+
+			report_history_ = report_->create_history();
+			report_history_->stats_init(&stats_);
+
+			counters_ = report_stats___add_thread(&stats_);
+		}
+
+		virtual void shutdown() override; // leaves host, defined below
+
+		virtual uint32_t id() const override
+		{
+			return id_;
+		}
+
+		virtual report_t* report() const override
+		{
+			return report_.get();
+		}
+
+		virtual report_ptr shared_report() const override
+		{
+			return report_;
+		}
+
+		virtual report_agg_t* report_agg() const override
+		{
+			return report_agg_.get();
+		}
+
+		virtual report_history_t* report_history() const override
+		{
+			return report_history_.get();
+		}
+
+		virtual report_stats_t* stats() override; // defined below
+
+		virtual void execute_in_thread(report_host_call_func_t const& func) override; // defined below
+
+		virtual std::unique_lock<std::mutex> execute_in_thread_start(report_host_call_func_t const& func) override; // defined below
+		virtual void execute_in_thread_finish(std::unique_lock<std::mutex> lk_) override; // defined below
+	};
+
+	struct report_host___fused_t : public report_host_input_t
+	{
+		pinba_globals_t        *globals_;
+		report_host_conf_t     conf_;
+
+		std::thread            t_;
+
+		static constexpr size_t   max_batches_per_poll_iteration = 16; // packets_ring mode, don't starve control requests
+		static constexpr uint32_t chunk_packets = 64; // packets fed to every member at once, keep small enough to stay in L2
+
+		nmsg_socket_t          packets_send_sock_;
+		nmsg_socket_t          packets_recv_sock_;
+
+		using packets_reader_t = nmsg_broadcast_reader_t<packet_batch_t>;
+		std::unique_ptr<packets_reader_t> packets_reader_; // packets_ring mode only
+
+		nmsg_channel_ptr<timeval_t>                 tick_chan_; // from conf_.ticker
+		report_ticker_t::subscription_id_t          tick_sub_ = 0;
+
+		// same nanomsg workaround as in report_host___new_thread_t
+		nmsg_socket_t          control_sock_;
+		nmsg_socket_t          control_cli_sock_;
+		std::mutex             control_mtx_;
+
+		nmsg_socket_t          shutdown_sock_;
+		nmsg_socket_t          shutdown_cli_sock_;
+		std::mutex             shutdown_mtx_;
+
+		// compatibility, taken from the first report, never changes
+		report_ptr             first_report_;                 // keeps batch_filter_ alive, even if that report is gone
+		packet_batch_filter_t const *batch_filter_ = nullptr;
+		int                    kind_;
+		duration_t             tick_interval_;
+
+		std::vector<report_host___fused_member_t*> members_;     // host thread only
+		std::vector<report_host___fused_member_t*> aggregators_; // host thread only, members without agg_source_
+
+		pipeline_latency_recorder_ptr latency_; // host thread only, one for all members
+
+	public:
+
+		uint32_t               n_members = 0; // coordinator only, under its lock
+		std::unordered_multiset<std::string> agg_signatures; // coordinator only, of members, that have one
+
 		struct request_t : public nmsg_message_t
 		{
-			request_func_t func;
+			std::function<void()> func;
 		};
 		using request_ptr = boost::intrusive_ptr<request_t>;
 
-		struct response_t : public nmsg_message_t
+	public:
+
+		static duration_t tick_interval_for(report_t const *report)
 		{
-			pinba_error_t err;
-		};
-		using response_ptr = boost::intrusive_ptr<response_t>;
+			auto const *rinfo = report->info();
+			return rinfo->time_window / rinfo->tick_count;
+		}
+
+		// reports with extra aggregator threads need a host of their own
+		static bool can_fuse(report_t const *report)
+		{
+			return (report->info()->agg_threads <= 1);
+		}
+
+		bool is_compatible(report_t const *report) const
+		{
+			if (!can_fuse(report))
+				return false;
+
+			if (report->info()->kind != kind_ || tick_interval_for(report) != tick_interval_)
+				return false;
+
+			packet_batch_filter_t const *filter = report->batch_filter();
+
+			if (!filter || !batch_filter_)
+				return (filter == batch_filter_);
+
+			return (*filter == *batch_filter_);
+		}
+
+		report_host___fused_t(pinba_globals_t *globals, report_host_conf_t const& conf, report_ptr first_report)
+			: globals_(globals)
+			, conf_(conf)
+			, first_report_(first_report)
+			, batch_filter_(first_report->batch_filter())
+			, kind_(first_report->info()->kind)
+			, tick_interval_(tick_interval_for(first_report.get()))
+			, latency_(globals->pipeline_latency()->create_recorder(PINBA_PIPELINE_STAGE__REPORT, conf_.name))
+		{
+			if (conf_.packets_ring)
+			{
+				packets_reader_ = meow::make_unique<packets_reader_t>(1, 0);
+			}
+			else
+			{
+				packets_send_sock_
+					.open(AF_SP, NN_PUSH)
+					.bind(conf_.nn_packets);
+
+				packets_recv_sock_
+					.open(AF_SP, NN_PULL)
+					.set_option(NN_SOL_SOCKET, NN_RCVBUF, sizeof(packet_batch_ptr) * conf_.nn_packets_buffer, ff::fmt_str("{0}/in_sock", conf_.name))
+					.connect(conf_.nn_packets);
+			}
+
+			control_sock_
+				.open(AF_SP, NN_REP)
+				.bind(conf_.nn_control);
+
+			control_cli_sock_
+				.open(AF_SP, NN_REQ)
+				.connect(conf_.nn_control);
+
+			shutdown_sock_
+				.open(AF_SP, NN_REP)
+				.bind(conf_.nn_shutdown);
+
+			shutdown_cli_sock_
+				.open(AF_SP, NN_REQ)
+				.connect(conf_.nn_shutdown);
+		}
+
+	public:
+
+		void startup()
+		{
+			tick_chan_ = nmsg_channel_create<timeval_t>(ff::fmt_str("{0}/ticks", conf_.name));
+			tick_sub_  = conf_.ticker->subscribe(tick_interval_, [chan = tick_chan_](timeval_t tick_tv)
+			{
+				chan->send_dontwait(tick_tv);
+			});
+
+			std::thread t([this]()
+			{
+				PINBA___OS_CALL(globals_, set_thread_name, conf_.thread_name);
+				pinba_set_thread_cpus(globals_, conf_.cpus, conf_.thread_name);
+				pinba_set_thread_sched(globals_, conf_.sched, conf_.thread_name);
+
+				MEOW_DEFER(
+					LOG_DEBUG(globals_->logger(), "{0}; exiting", conf_.thread_name);
+				);
+
+				//
+
+				nmsg_poller_t poller;
+
+				auto const process_batch = [this](timeval_t now, packet_batch_ptr const& batch)
+				{
+					latency_->record(now, batch->relayed_tv);
+
+					for (auto *member : members_)
+					{
+						member->counters_->batches_recv_total += 1;
+						member->counters_->packets_recv_total += batch->packet_count;
+					}
+
+					if (!this->might_use_batch(batch.get()))
+					{
+						globals_->stats()->coordinator.batch_send_skipped += members_.size();
+						return;
+					}
+
+					for (auto *member : aggregators_)
+						repacker_state___merge_to_from(member->repacker_state_, batch->repacker_state);
+
+					for (uint32_t offset = 0; offset < batch->packet_count; offset += chunk_packets)
+					{
+						uint32_t const   n_packets = std::min(uint32_t(chunk_packets), batch->packet_count - offset);
+						packet_t **const packets   = batch->packets + offset;
+
+						// one shared timestamp between members, each gets the cycles of its own call
+						uint64_t cycles_prev = pinba_cycles_now();
+
+						if (batch->columns)
+						{
+							packet_columns_t const columns = packet_columns___slice(*batch->columns, offset, n_packets);
+
+							for (auto *member : aggregators_)
+							{
+								member->report_agg_->add_batch(&columns, packets);
+
+								uint64_t const cycles_now = pinba_cycles_now();
+								member->counters_->cycles_add += cycles_now - cycles_prev;
+								cycles_prev = cycles_now;
+							}
+						}
+						else
+						{
+							for (auto *member : aggregators_)
+							{
+								member->report_agg_->add_multi(packets, n_packets);
+
+								uint64_t const cycles_now = pinba_cycles_now();
+								member->counters_->cycles_add += cycles_now - cycles_prev;
+								cycles_prev = cycles_now;
+							}
+						}
+					}
+				};
+
+				if (packets_reader_)
+				{
+					poller.read_nmsg_broadcast(*packets_reader_, [this, &process_batch](timeval_t now)
+					{
+						for (size_t i = 0; i < max_batches_per_poll_iteration; ++i)
+						{
+							auto const batch = packets_reader_->recv_dontwait();
+							if (!batch)
+								break;
+
+							process_batch(now, batch);
+						}
+					});
+				}
+				else
+				{
+					poller.read_nn_socket(packets_recv_sock_, [this, &process_batch](timeval_t now)
+					{
+						process_batch(now, packets_recv_sock_.recv<packet_batch_ptr>());
+					});
+				}
+
+				poller
+					// members that joined mid-interval get their first tick a bit short, same as after a restart
+					.read_nn_channel(*tick_chan_, [this](nmsg_channel_t<timeval_t>& chan, timeval_t)
+					{
+						timeval_t const now = chan.recv();
+						PINBA_PROBE1(report_tick_start, conf_.name.c_str());
+
+						for (auto *member : aggregators_)
+						{
+							uint64_t const cycles_start = pinba_cycles_now();
+
+							report_tick_ptr tick = member->report_agg_->tick_now(now);
+							tick->repacker_state = std::move(member->repacker_state_);
+
+							uint64_t cycles_prev = pinba_cycles_now();
+							member->counters_->cycles_tick += cycles_prev - cycles_start;
+
+							member->report_history_->merge_tick(tick);
+
+							uint64_t cycles_now = pinba_cycles_now();
+							member->counters_->cycles_merge += cycles_now - cycles_prev;
+
+							// histories sharing aggregation don't consume ticks (see report_t::agg_signature())
+							// their merges are theirs, aggregation cycles stay with the member that did it
+							for (auto *follower : member->agg_followers_)
+							{
+								cycles_prev = cycles_now;
+
+								follower->report_history_->merge_tick(tick);
+
+								cycles_now = pinba_cycles_now();
+								follower->counters_->cycles_merge += cycles_now - cycles_prev;
+							}
+						}
+
+						timeval_t const curr_tv    = os_unix::clock_monotonic_now();
+						timeval_t const curr_rt_tv = os_unix::clock_gettime_ex(CLOCK_REALTIME);
+						PINBA_PROBE2(report_tick_end, conf_.name.c_str(), duration_from_timeval(curr_tv - now).nsec);
+
+						for (auto *member : members_)
+						{
+							std::unique_lock<std::mutex> lk_(member->stats_.lock);
+							member->stats_.last_tick_tv        = curr_rt_tv;
+							member->stats_.last_tick_prepare_d = duration_from_timeval(curr_tv - now);
+						}
+					})
+					.ticker(1 * d_second, [this](timeval_t now)
+					{
+						// thread is shared, so is its rusage
+						os_rusage_t ru = os_unix::getrusage_ex(RUSAGE_THREAD);
+
+						for (auto *member : members_)
+						{
+							std::unique_lock<std::mutex> lk_(member->stats_.lock);
+							member->stats_.ru_utime = timeval_from_os_timeval(ru.ru_utime);
+							member->stats_.ru_stime = timeval_from_os_timeval(ru.ru_stime);
+
+							report_stats___sample_rates(&member->stats_, now);
+							report_stats___publish(&member->stats_, report_host___estimates(member));
+						}
+					})
+					.read_nn_socket(control_sock_, [this](timeval_t now)
+					{
+						auto const req = control_sock_.recv<request_ptr>();
+						req->func();
+						control_sock_.send(meow::make_intrusive<report_host_result_t>());
+					})
+					.read_nn_socket(shutdown_sock_, [this, &poller](timeval_t)
+					{
+						shutdown_sock_.recv<int>();
+						poller.set_shutdown_flag(); // exit loop() after this iteration
+						shutdown_sock_.send(1);
+					})
+					.loop();
+			});
+
+			t_ = move(t);
+		}
+
+		void shutdown()
+		{
+			conf_.ticker->unsubscribe(tick_sub_);
+
+			{
+				std::unique_lock<std::mutex> lk_(shutdown_mtx_);
+
+				shutdown_cli_sock_.send(1);
+				shutdown_cli_sock_.recv<int>();
+			}
+
+			t_.join();
+		}
+
+		void execute_in_thread(std::function<void()> const& func)
+		{
+			this->execute_in_thread_finish(this->execute_in_thread_start(func));
+		}
+
+		// same as report_host_t::execute_in_thread_start(), one request for all members
+		std::unique_lock<std::mutex> execute_in_thread_start(std::function<void()> const& func)
+		{
+			auto req = meow::make_intrusive<request_t>();
+			req->func = func;
+
+			std::unique_lock<std::mutex> lk_(control_mtx_);
+
+			control_cli_sock_.send_message(req);
+			return lk_;
+		}
+
+		void execute_in_thread_finish(std::unique_lock<std::mutex> lk_)
+		{
+			assert(lk_.owns_lock());
+			control_cli_sock_.recv<report_host_result_ptr>();
+		}
+
+		// member has been started already
+		void add_member(report_host___fused_member_t *member)
+		{
+			this->execute_in_thread([this, member]()
+			{
+				members_.push_back(member);
+
+				// first member with the same signature aggregates for us
+				// joining mid-interval, our first tick gets (a bit) more than we've been here for, that's fine
+				std::string const& signature = member->report_->agg_signature();
+				if (!signature.empty())
+				{
+					for (auto *other : aggregators_)
+					{
+						if (other->report_->agg_signature() != signature)
+							continue;
+
+						member->agg_source_ = other;
+						other->agg_followers_.push_back(member);
+						return;
+					}
+				}
+
+				aggregators_.push_back(member);
+			});
+		}
+
+		void remove_member(report_host___fused_member_t *member)
+		{
+			this->execute_in_thread([this, member]()
+			{
+				auto const it = std::find(members_.begin(), members_.end(), member);
+				assert((it != members_.end()) && "BUG: removing member, that has never been added");
+
+				members_.erase(it);
+
+				if (member->agg_source_)
+				{
+					auto& followers = member->agg_source_->agg_followers_;
+					followers.erase(std::find(followers.begin(), followers.end(), member));
+
+					member->agg_source_ = nullptr;
+					return;
+				}
+
+				auto const agg_it = std::find(aggregators_.begin(), aggregators_.end(), member);
+				assert((agg_it != aggregators_.end()) && "BUG: member has no agg source, but does not aggregate");
+
+				if (member->agg_followers_.empty())
+				{
+					aggregators_.erase(agg_it);
+					return;
+				}
+
+				// first follower takes over, its aggregator has been idle, so its next tick is short
+				auto *leader = member->agg_followers_.front();
+				leader->agg_source_    = nullptr;
+				leader->agg_followers_.assign(member->agg_followers_.begin() + 1, member->agg_followers_.end());
+
+				for (auto *follower : leader->agg_followers_)
+					follower->agg_source_ = leader;
+
+				member->agg_followers_.clear();
+				*agg_it = leader;
+			});
+		}
+
+		// packets_ring mode, same as report_host___new_thread_t::stats(), all members see the same numbers
+		void fill_ring_stats(report_stats_t *stats) const
+		{
+			if (!packets_reader_)
+				return;
+
+			stats->relay.batches_send_total = packets_reader_->published_messages();
+			stats->relay.packets_send_total = packets_reader_->published_weight();
+			stats->relay.batches_send_err   = packets_reader_->dropped_messages();
+			stats->relay.packets_send_err   = packets_reader_->dropped_weight();
+		}
+
+	public: // report_host_input_t
+
+		virtual bool process_batch(packet_batch_ptr batch) override
+		{
+			// no per report send counters here, members belong to host thread (relay counts errors anyway)
+			return packets_send_sock_.send_message(batch, NN_DONTWAIT);
+		}
+
+		virtual bool might_use_batch(packet_batch_t const *batch) const override
+		{
+			if (!batch_filter_)
+				return true;
+
+			return batch_filter_->might_match(batch->summary);
+		}
+
+		virtual void subscribe_to_packets() override
+		{
+			conf_.packets_ring->subscribe(packets_reader_.get());
+		}
+
+		virtual void unsubscribe_from_packets() override
+		{
+			conf_.packets_ring->unsubscribe(packets_reader_.get());
+		}
+	};
+
+	void report_host___fused_member_t::shutdown()
+	{
+		host_->remove_member(this);
+	}
+
+	report_stats_t* report_host___fused_member_t::stats()
+	{
+		host_->fill_ring_stats(&stats_);
+		return &stats_;
+	}
+
+	void report_host___fused_member_t::execute_in_thread(report_host_call_func_t const& func)
+	{
+		host_->execute_in_thread([this, &func]()
+		{
+			func(this);
+		});
+	}
+
+	std::unique_lock<std::mutex> report_host___fused_member_t::execute_in_thread_start(report_host_call_func_t const& func)
+	{
+		// func is called after we return, must be copied
+		return host_->execute_in_thread_start([this, func]()
+		{
+			func(this);
+		});
+	}
+
+	void report_host___fused_member_t::execute_in_thread_finish(std::unique_lock<std::mutex> lk_)
+	{
+		host_->execute_in_thread_finish(std::move(lk_));
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// extra relay thread, sends batches to its share of report hosts, see coordinator_conf_t::relay_threads
+	// relay passes every batch once per fanout (not once per report) and fanouts call process_batch() for their hosts
+	// host list is published rcu-style: fanout takes a reference to current list per batch,
+	// writer (relay thread) replaces the list and waits for old one to be released, before host can be destroyed
+	struct relay_fanout_t : private boost::noncopyable
+	{
+		using hosts_t   = std::vector<report_host_input_t*>;
+		using hosts_ptr = std::shared_ptr<hosts_t const>;
+
+		relay_fanout_t(pinba_globals_t *globals, coordinator_conf_t *conf, uint32_t id, size_t ring_size)
+			: globals_(globals)
+			, stats_(globals->stats())
+			, conf_(conf)
+			, id_(id)
+			, ring_(nmsg_ring_create<packet_batch_t>(ring_size, ff::fmt_str("relay-fanout/{0}", id)))
+			, hosts_(std::make_shared<hosts_t>())
+		{
+		}
+
+		~relay_fanout_t()
+		{
+			this->shutdown();
+		}
+
+		void startup()
+		{
+			std::thread t([this]()
+			{
+				this->worker_thread();
+			});
+			thread_ = move(t);
+		}
+
+		void shutdown()
+		{
+			if (!thread_.joinable())
+				return;
+
+			stop_.store(true, std::memory_order_relaxed);
+			thread_.join();
+		}
+
+		// relay thread only
+		void relay_batch(packet_batch_ptr const& batch)
+		{
+			size_t const n_hosts = n_hosts_;
+			if (n_hosts == 0)
+				return;
+
+			// fanout is too slow, all of its hosts lose this batch
+			if (!ring_->send_message(batch, NN_DONTWAIT))
+			{
+				stats_->coordinator.batch_send_total += n_hosts;
+				stats_->coordinator.batch_send_err   += n_hosts;
+			}
+		}
+
+		size_t n_hosts() const
+		{
+			return n_hosts_;
+		}
+
+		// relay thread only
+		void add_host(report_host_input_t *host)
+		{
+			auto hosts = std::make_shared<hosts_t>(*std::atomic_load(&hosts_));
+			hosts->push_back(host);
+
+			this->publish_hosts(std::move(hosts));
+		}
+
+		// relay thread only, host is never used by fanout after this returns
+		bool remove_host(report_host_input_t *host)
+		{
+			auto hosts = std::make_shared<hosts_t>(*std::atomic_load(&hosts_));
+
+			auto const it = std::find(hosts->begin(), hosts->end(), host);
+			if (it == hosts->end())
+				return false;
+
+			hosts->erase(it);
+
+			hosts_ptr old_hosts = this->publish_hosts(std::move(hosts));
+
+			// fanout holds old list only while sending one batch
+			while (old_hosts.use_count() > 1)
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+			return true;
+		}
+
+	private:
+
+		hosts_ptr publish_hosts(std::shared_ptr<hosts_t> hosts)
+		{
+			n_hosts_ = hosts->size();
+
+			hosts_ptr new_hosts = std::move(hosts);
+			return std::atomic_exchange(&hosts_, new_hosts);
+		}
+
+		void worker_thread()
+		{
+			std::string const thr_name = ff::fmt_str("packet-relay/{0}", id_);
+
+			PINBA___OS_CALL(globals_, set_thread_name, thr_name);
+			pinba_set_thread_cpus(globals_, conf_->relay_cpus, thr_name);
+			pinba_set_thread_sched(globals_, conf_->relay_sched, thr_name);
+
+			MEOW_DEFER(
+				LOG_DEBUG(globals_->logger(), "{0}; exiting", thr_name);
+			);
+
+			nmsg_poller_t poller;
+			poller
+				.read_nmsg_ring(*ring_, [this](timeval_t now)
+				{
+					constexpr size_t const max_batches_per_poll_iteration = 16;
+
+					for (size_t i = 0; i < max_batches_per_poll_iteration; ++i)
+					{
+						auto const batch = ring_->recv_dontwait();
+						if (!batch)
+							break;
+
+						hosts_ptr const hosts = std::atomic_load(&hosts_);
+						for (auto *report_host : *hosts)
+							this->send_batch(report_host, batch);
+					}
+				})
+				.ticker(100 * d_millisecond, [this, &poller](timeval_t now)
+				{
+					if (stop_.load(std::memory_order_relaxed))
+						poller.set_shutdown_flag();
+				})
+				.loop();
+		}
+
+		void send_batch(report_host_input_t *report_host, packet_batch_ptr const& batch)
+		{
+			if (!report_host->might_use_batch(batch.get()))
+			{
+				++stats_->coordinator.batch_send_skipped;
+				return;
+			}
+
+			++stats_->coordinator.batch_send_total;
+			if (!report_host->process_batch(batch))
+				++stats_->coordinator.batch_send_err;
+		}
+
+	private:
+		pinba_globals_t               *globals_;
+		pinba_stats_t                 *stats_;
+		coordinator_conf_t            *conf_;
+		uint32_t const                id_;
+
+		nmsg_ring_ptr<packet_batch_t> ring_;      // relay -> fanout
+		hosts_ptr                     hosts_;     // std::atomic_load() / std::atomic_exchange() only
+		size_t                        n_hosts_ = 0; // relay thread only
+
+		std::atomic<bool>             stop_ = {false};
+		std::thread                   thread_;
+	};
+	using relay_fanout_ptr = std::unique_ptr<relay_fanout_t>;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct relay_worker_t : private boost::noncopyable
+	{
+		relay_worker_t(pinba_globals_t *globals, coordinator_conf_t *conf)
+			: globals_(globals)
+			, stats_(globals->stats())
+			, conf_(conf)
+			, latency_(globals->pipeline_latency()->create_recorder(PINBA_PIPELINE_STAGE__REPACKER, "packet-relay"))
+		{
+			if (conf_->report_ring_size > 0)
+				packets_ring_ = meow::make_unique<nmsg_broadcast_ring_t<packet_batch_t>>(conf_->report_ring_size);
+
+			if (!conf_->in_ring)
+			{
+				in_sock_ = nmsg_socket(AF_SP, NN_PULL);
+				if (conf_->nn_input_buffer > 0)
+					in_sock_.set_option(NN_SOL_SOCKET, NN_RCVBUF, conf_->nn_input_buffer * sizeof(packet_batch_ptr), conf_->nn_input);
+			}
+
+			control_sock_
+				.open(AF_SP, NN_REP)
+				.bind(conf_->nn_control);
+
+			control_cli_sock_
+				.open(AF_SP, NN_REQ)
+				.connect(conf_->nn_control);
+
+			// relay thread itself is one of relay_threads
+			size_t const fanout_ring_size = std::max<size_t>(64, conf_->report_ring_size);
+			for (uint32_t i = 1; i < conf_->relay_threads; i++)
+				fanouts_.push_back(meow::make_unique<relay_fanout_t>(globals_, conf_, i, fanout_ring_size));
+		}
+
+		~relay_worker_t()
+		{
+			this->shutdown();
+		}
+
+		void startup()
+		{
+			if (!conf_->in_ring)
+				in_sock_.connect(conf_->nn_input);
+
+			for (auto& fanout : fanouts_)
+				fanout->startup();
+
+			std::thread t([this]()
+			{
+				this->worker_thread();
+			});
+			thread_ = move(t);
+		}
+
+		void shutdown()
+		{
+			if (!thread_.joinable()) // has actually started and not shut down yet
+				return;
+
+			for (auto& fanout : fanouts_)
+				fanout->shutdown();
+
+			// tell relay to stop operation
+			auto const err = this->execute_in_thread([this]()
+			{
+				poller_.set_shutdown_flag();
+			});
+
+			if (err)
+			{
+				LOG_ALERT(globals_->logger(), "couldn't stop relay thread: {0}, aborting", err);
+			}
+
+			thread_.join();
+		}
+
+	public:
+
+		using request_func_t = std::function<void()>;
+
+		struct request_t : public nmsg_message_t
+		{
+			request_func_t func;
+		};
+		using request_ptr = boost::intrusive_ptr<request_t>;
+
+		struct response_t : public nmsg_message_t
+		{
+			pinba_error_t err;
+		};
+		using response_ptr = boost::intrusive_ptr<response_t>;
+
+
+		pinba_error_t execute_in_thread(request_func_t const& func)
+		{
+			auto req = meow::make_intrusive<request_t>();
+			req->func = func;
+
+			response_ptr response;
+			{
+				std::unique_lock<std::mutex> lk_(control_mtx_);
+
+				control_cli_sock_.send_message(req);
+				response = control_cli_sock_.recv<response_ptr>();
+			}
+
+			return std::move(response->err);
+		}
+
+	private:
+
+		void relay_batch(timeval_t now, packet_batch_ptr const& batch)
+		{
+			++stats_->coordinator.batches_received;
+
+			// nobody else has seen the batch yet, reports measure their queue latency from here
+			latency_->record(now, batch->created_tv);
+			batch->relayed_tv = now;
+
+			if (packet_capture_t *capture = globals_->packet_capture())
+				capture->capture_batch(batch.get());
+
+			// publish once, report hosts read from the ring at their own pace (and lose old batches if too slow)
+			// pooled ones don't read from the ring, they get their batches directly
+			if (packets_ring_)
+			{
+				size_t const n_ring_hosts = rhosts_.size() - direct_rhosts_.size();
+				if (n_ring_hosts > 0)
+				{
+					stats_->coordinator.batch_send_total += n_ring_hosts;
+					stats_->coordinator.batch_send_err   += packets_ring_->publish(batch, batch->packet_count);
+				}
+
+				for (auto& fanout : fanouts_)
+					fanout->relay_batch(batch);
+
+				for (auto *report_host : direct_rhosts_)
+					this->send_batch(report_host, batch);
+
+				return;
+			}
+
+			// FIXME
+			// special counter for batches that were dropped, because no recepients were active
+			// if (rhosts_.empty())
+			// 	++stats_->coordinator.batches_send_dropped;
+
+			// relay the batch to all reports,
+			// TODO(antoxa): maybe move this to a separate thread?
+			// NOTE:
+			// this is fundamentally broken and can't be implemented with nanomsg PUB/SUB sadly
+			// since we have no idea if the report handler is slow, and in that case messages will be dropped
+			// and ref counts will not be decremented and memory will leak and we won't have any stats about that either
+			// (we also have no need for the pub/sub routing part at the moment and probably won't need it ever)
+			for (auto& fanout : fanouts_)
+				fanout->relay_batch(batch);
+
+			for (auto *report_host : direct_rhosts_)
+				this->send_batch(report_host, batch);
+		}
+
+		void send_batch(report_host_input_t *report_host, packet_batch_ptr const& batch)
+		{
+			if (!report_host->might_use_batch(batch.get()))
+			{
+				++stats_->coordinator.batch_send_skipped;
+				return;
+			}
+
+			++stats_->coordinator.batch_send_total;
+			bool const success = report_host->process_batch(batch);
+			if (!success)
+			{
+				++stats_->coordinator.batch_send_err;
+				// TODO: add packet counter here
+			}
+		}
+
+	public:
+
+		// add/remove host, relay thread only
+		void add_rhost(std::string const& name, report_host_input_t *report_host)
+		{
+			rhosts_.emplace(name, report_host);
+
+			if (packets_ring_ && report_host->reads_packets_ring())
+			{
+				report_host->subscribe_to_packets();
+				return;
+			}
+
+			// to whoever has the least hosts, relay thread itself included
+			relay_fanout_t *target = nullptr;
+			size_t          target_hosts = direct_rhosts_.size();
+
+			for (auto& fanout : fanouts_)
+			{
+				if (fanout->n_hosts() < target_hosts)
+				{
+					target       = fanout.get();
+					target_hosts = fanout->n_hosts();
+				}
+			}
+
+			if (target)
+				target->add_host(report_host);
+			else
+				direct_rhosts_.push_back(report_host);
+		}
+
+		size_t remove_rhost(std::string const& name)
+		{
+			auto const it = rhosts_.find(name);
+			if (it == rhosts_.end())
+				return 0;
+
+			report_host_input_t *report_host = it->second;
+
+			if (packets_ring_ && report_host->reads_packets_ring())
+			{
+				report_host->unsubscribe_from_packets();
+			}
+			else
+			{
+				direct_rhosts_.erase(std::remove(direct_rhosts_.begin(), direct_rhosts_.end(), report_host), direct_rhosts_.end());
+
+				for (auto& fanout : fanouts_)
+				{
+					if (fanout->remove_host(report_host))
+						break;
+				}
+			}
+
+			rhosts_.erase(it);
+			return 1;
+		}
+
+	private:
+
+		void worker_thread()
+		{
+			std::string const thr_name = ff::fmt_str("packet-relay");
+
+			PINBA___OS_CALL(globals_, set_thread_name, thr_name);
+			pinba_set_thread_cpus(globals_, conf_->relay_cpus, thr_name);
+			pinba_set_thread_sched(globals_, conf_->relay_sched, thr_name);
+
+			MEOW_DEFER(
+				LOG_DEBUG(globals_->logger(), "{0}; exiting", thr_name);
+			);
+
+			if (conf_->in_ring)
+			{
+				poller_.read_nmsg_ring(*conf_->in_ring, [this](timeval_t now)
+				{
+					// drain a few, but don't starve control requests
+					constexpr size_t const max_batches_per_poll_iteration = 16;
+
+					for (size_t i = 0; i < max_batches_per_poll_iteration; ++i)
+					{
+						auto const batch = conf_->in_ring->recv_dontwait();
+						if (!batch)
+							break;
+
+						this->relay_batch(now, batch);
+					}
+				});
+			}
+			else
+			{
+				poller_.read_nn_socket(in_sock_, [this](timeval_t now)
+				{
+					auto const batch = in_sock_.recv<packet_batch_ptr>();
+					this->relay_batch(now, batch);
+				});
+			}
+
+			poller_
+				.ticker(1000 * d_millisecond, [this](timeval_t now)
+				{
+					// FIXME: rename stats
+
+					// takes dictionary and stats locks itself
+					mem_governor___update(globals_);
+
+					// update accumulated rusage
+					os_rusage_t const ru = os_unix::getrusage_ex(RUSAGE_THREAD);
+
+					// process rusage for stats rates, before taking the lock
+					os_rusage_t const self_ru = os_unix::getrusage_ex(RUSAGE_SELF);
+
+					std::lock_guard<std::mutex> lk_(stats_->mtx);
+					stats_->coordinator.ru_utime = timeval_from_os_timeval(ru.ru_utime);
+					stats_->coordinator.ru_stime = timeval_from_os_timeval(ru.ru_stime);
+
+					auto const udp      = pinba_stats___udp(stats_);
+					auto const repacker = pinba_stats___repacker(stats_);
+
+					uint64_t values[PINBA_STATS_RATE__COUNT];
+					values[PINBA_STATS_RATE__UDP_RECV_PACKETS]               = udp.recv_packets;
+					values[PINBA_STATS_RATE__UDP_RECV_BYTES]                 = udp.recv_bytes;
+					values[PINBA_STATS_RATE__UDP_RECV_KERNEL_DROPS]          = udp.recv_kernel_drops;
+					values[PINBA_STATS_RATE__UDP_PACKET_DECODE_ERR]          = udp.packet_decode_err;
+					values[PINBA_STATS_RATE__UDP_PACKET_SEND_ERR]            = udp.packet_send_err;
+					values[PINBA_STATS_RATE__REPACKER_RECV_PACKETS]          = repacker.recv_packets;
+					values[PINBA_STATS_RATE__REPACKER_PACKET_VALIDATE_ERR]   = repacker.packet_validate_err;
+					values[PINBA_STATS_RATE__REPACKER_PACKET_PREFILTER_DROP] = repacker.packet_prefilter_drop;
+					values[PINBA_STATS_RATE__COORDINATOR_BATCHES_RECEIVED]   = stats_->coordinator.batches_received;
+					values[PINBA_STATS_RATE__COORDINATOR_BATCH_SEND_ERR]     = stats_->coordinator.batch_send_err;
+					values[PINBA_STATS_RATE__RU_UTIME_USEC]                  = uint64_t(duration_from_timeval(timeval_from_os_timeval(self_ru.ru_utime)).nsec / 1000);
+					values[PINBA_STATS_RATE__RU_STIME_USEC]                  = uint64_t(duration_from_timeval(timeval_from_os_timeval(self_ru.ru_stime)).nsec / 1000);
+
+					stats_->rates.add(now, values);
+				})
+				.read_nn_socket(control_sock_, [this](timeval_t now)
+				{
+					auto const req = this->control_sock_.recv<request_ptr>();
+
+					auto const result = meow::make_intrusive<response_t>();
+
+					try
+					{
+						auto *r = static_cast<request_t*>(req.get());
+						r->func();
+					}
+					catch (std::exception const& e)
+					{
+						result->err = ff::fmt_err("packet_relay::call: {0}", e.what());
+					}
+
+					control_sock_.send_message(result);
+				})
+				.loop();
+		}
+
+	public:
+		pinba_globals_t     *globals_;
+		pinba_stats_t       *stats_;
+		coordinator_conf_t  *conf_;
+
+		// report_name (or fused host name) -> report_host_input*
+		using rhost_map_t = std::unordered_map<std::string, report_host_input_t*>;
+		rhost_map_t         rhosts_;
+
+		// hosts relay thread calls process_batch() for itself, all of them, except the ones on fanouts_
+		// in packets_ring mode, only hosts that want process_batch() anyway (see report_host_input_t::reads_packets_ring())
+		std::vector<report_host_input_t*> direct_rhosts_;
+
+		// extra relay threads, with their shares of hosts that get process_batch(), see coordinator_conf_t::relay_threads
+		std::vector<relay_fanout_ptr>     fanouts_;
+
+		nmsg_poller_t       poller_;
+		pipeline_latency_recorder_ptr latency_; // relay thread only, how long batches took to get here from repacker
+
+		nmsg_socket_t       in_sock_;
+
+		// relay -> report hosts, instead of per report sockets, see coordinator_conf_t::report_ring_size
+		std::unique_ptr<nmsg_broadcast_ring_t<packet_batch_t>> packets_ring_;
+
+		nmsg_socket_t       control_sock_;
+		nmsg_socket_t       control_cli_sock_;
+		std::mutex          control_mtx_;
+
+		std::thread         thread_;
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// prepared snapshots, shared by selects coming between two ticks of the same report
+	struct shared_snapshot_t : private boost::noncopyable
+	{
+		report_snapshot_ptr               snapshot;      // prepared, never changes after that (histograms aside, see below)
+		report_snapshot_t::merge_flags_t  flags;         // has been prepared with these
+		timeval_t                         last_tick_tv;  // report_stats_t::last_tick_tv, as it was when snapshot was taken
+		uint64_t                          mem_estimate;  // see shared_snapshot___mem_estimate()
+
+		// histograms might be gathered lazily on first read, and cached in snapshot rows
+		std::mutex                        hv_mtx;
+	};
+	using shared_snapshot_ptr = std::shared_ptr<shared_snapshot_t>;
+
+	// rough memory taken by prepared snapshot, keys and row data only (histograms are not counted)
+	// that's what prewarm budget is checked against, see coordinator_conf_t::snapshot_prewarm_max_mem
+	inline uint64_t shared_snapshot___mem_estimate(report_snapshot_t *snapshot)
+	{
+		uint64_t row_size = sizeof(report_key_t) + sizeof(void*);
+
+		switch (snapshot->data_kind())
+		{
+			case REPORT_KIND__BY_REQUEST_DATA: row_size += sizeof(report_row_data___by_request_t); break;
+			case REPORT_KIND__BY_TIMER_DATA:   row_size += sizeof(report_row_data___by_timer_t); break;
+			case REPORT_KIND__BY_PACKET_DATA:  row_size += sizeof(report_row_data___by_packet_t); break;
+		}
+
+		return snapshot->row_count() * row_size;
+	}
+
+	// what every select gets, forwards to shared one
+	struct report_snapshot___shared_t : public report_snapshot_t
+	{
+		shared_snapshot_ptr  shared_;
+		report_snapshot_t    *s_;
+
+		explicit report_snapshot___shared_t(shared_snapshot_ptr shared)
+			: shared_(std::move(shared))
+			, s_(shared_->snapshot.get())
+		{
+		}
+
+	private:
+
+		virtual report_info_t const*         report_info() const override         { return s_->report_info(); }
+		virtual histogram_conf_t const*      histogram_conf() const override      { return s_->histogram_conf(); }
+		virtual duration_t                   time_window_covered() const override { return s_->time_window_covered(); }
+		virtual dictionary_t const*          dictionary() const override          { return s_->dictionary(); }
+		virtual snapshot_dictionary_t const* snapshot_dictionary() const override { return s_->snapshot_dictionary(); }
+
+		virtual void prepare(merge_flags_t flags) override
+		{
+			assert(((shared_->flags & flags) == flags) && "shared snapshot must've been prepared with all the flags requested");
+		}
+
+		virtual void set_key_filter(report_key_filter_t const&) override
+		{
+			assert(!"shared snapshot is prepared already, get a fresh one to filter");
+		}
+
+		virtual bool       is_prepared() const override                                            { return s_->is_prepared(); }
+		virtual size_t     row_count() const override                                              { return s_->row_count(); }
+		virtual position_t pos_first() override                                                    { return s_->pos_first(); }
+		virtual position_t pos_last() override                                                     { return s_->pos_last(); }
+		virtual position_t pos_next(position_t const& pos) override                                { return s_->pos_next(pos); }
+		virtual bool       pos_equal(position_t const& l, position_t const& r) const override      { return s_->pos_equal(l, r); }
+		virtual position_t pos_find(report_key_t const& key) override                              { return s_->pos_find(key); }
+		virtual std::vector<position_t> pos_split(uint32_t n_ranges) override                      { return s_->pos_split(n_ranges); }
+
+		// histograms are taken once per page, instead of once per row
+		virtual uint32_t fetch_rows(position_t *cursor, position_t const& end, uint32_t max_rows, row_batch_t *batch, bool with_histograms) override
+		{
+			if (!with_histograms)
+				return s_->fetch_rows(cursor, end, max_rows, batch, false);
+
+			std::lock_guard<std::mutex> lk_(shared_->hv_mtx);
+			return s_->fetch_rows(cursor, end, max_rows, batch, true);
+		}
+
+		virtual report_key_t     get_key(position_t const& pos) const override     { return s_->get_key(pos); }
+		virtual report_key_str_t get_key_str(position_t const& pos) const override { return s_->get_key_str(pos); }
+
+		virtual int   data_kind() const override                  { return s_->data_kind(); }
+		virtual void* get_data(position_t const& pos) override    { return s_->get_data(pos); }
+		virtual void* get_data_totals() const override            { return s_->get_data_totals(); }
+
+		virtual int   histogram_kind() const override             { return s_->histogram_kind(); }
+
+		virtual void* get_histogram(position_t const& pos) override
+		{
+			std::lock_guard<std::mutex> lk_(shared_->hv_mtx);
+			return s_->get_histogram(pos);
+		}
+	};
+
+	// everybody waits for everybody else to arrive, see coordinator_t::get_report_snapshots()
+	struct thread_barrier_t : private boost::noncopyable
+	{
+		std::mutex               mtx;
+		std::condition_variable  cv;
+		size_t                   n_left;
+
+		explicit thread_barrier_t(size_t n)
+			: n_left(n)
+		{
+		}
+
+		void arrive_and_wait()
+		{
+			std::unique_lock<std::mutex> lk_(mtx);
+
+			if (n_left > 0)
+				n_left--;
+
+			if (n_left == 0)
+				cv.notify_all();
+			else
+				cv.wait(lk_, [this]() { return (n_left == 0); });
+		}
+
+		// let everybody go, somebody is not going to arrive
+		void cancel()
+		{
+			std::unique_lock<std::mutex> lk_(mtx);
+			n_left = 0;
+			cv.notify_all();
+		}
+	};
+
+	struct report_snapshot_cache_t : private boost::noncopyable
+	{
+		std::mutex           mtx;      // held while merging, so that concurrent selects wait for one merge, instead of doing their own
+		shared_snapshot_ptr  current;  // last prepared snapshot, keeps its ticks and merged data alive until replaced
+
+		// select frequency, see coordinator_conf_t::snapshot_prewarm_min_qpm
+		std::atomic<uint64_t>                          n_selects     = {0}; // since last rate update
+		std::atomic<report_snapshot_t::merge_flags_t>  flags_seen    = {0}; // requested by selects since last rate update
+		double                                         select_qpm    = 0;   // decayed, prewarm thread only
+		report_snapshot_t::merge_flags_t               prewarm_flags = 0;   // prewarm thread only, flags_seen of the last second with selects
+	};
+	using report_snapshot_cache_ptr = std::shared_ptr<report_snapshot_cache_t>;
+
+	// snapshot requests for one report queue here, instead of on coordinator lock
+	// so that selects from different reports go to their host threads in parallel
+	struct report_request_lane_t : private boost::noncopyable
+	{
+		std::mutex      mtx;   // held while snapshot is being taken
+		report_host_t  *host;  // nullptr once report is deleted, waiters must check under mtx
+	};
+	using report_request_lane_ptr = std::shared_ptr<report_request_lane_t>;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct coordinator_impl_t : public coordinator_t
+	{
+		coordinator_impl_t(pinba_globals_t *globals, coordinator_conf_t *conf)
+			: globals_(globals)
+			, stats_(globals->stats())
+			, conf_(conf)
+			, next_report_id_(0)
+			, relay_(globals, conf)
+		{
+		}
+
+		~coordinator_impl_t()
+		{
+			this->shutdown();
+		}
+
+	private:
+
+		virtual void startup() override
+		{
+			report_ticker_conf_t const ticker_conf = {
+				.name    = "report-ticker",
+				.stagger = conf_->report_tick_stagger,
+			};
+			report_ticker_ = create_report_ticker(globals_, ticker_conf);
+			report_ticker_->startup();
+
+			if (conf_->report_executor_threads > 0)
+			{
+				report_executor_conf_t const executor_conf = {
+					.name      = "rx",
+					.n_threads = conf_->report_executor_threads,
+					.cpus      = conf_->report_cpus,
+					.sched     = conf_->report_sched,
+				};
+				report_executor_ = create_report_executor(globals_, executor_conf);
+			}
+
+			{
+				thread_pool_conf_t const pool_conf = {
+					.name      = "snap_req",
+					.n_threads = snapshot_request_threads,
+					.sched     = conf_->snapshot_merge_sched,
+				};
+				snapshot_request_pool_ = create_thread_pool(globals_, pool_conf);
+			}
+
+			if (conf_->snapshot_prewarm_min_qpm > 0)
+			{
+				thread_pool_conf_t const pool_conf = {
+					.name      = "snap_prewarm",
+					.n_threads = 1,
+					.sched     = conf_->snapshot_merge_sched,
+				};
+				prewarm_pool_ = create_thread_pool(globals_, pool_conf);
+
+				// scan is queued once, ticker doesn't pile them up when prewarm thread is busy merging
+				prewarm_sub_ = report_ticker_->subscribe(prewarm_scan_interval_ms * d_millisecond, [this](timeval_t)
+				{
+					if (prewarm_pending_.exchange(true))
+						return;
+
+					prewarm_pool_->enqueue([this]()
+					{
+						this->snapshot_prewarm_scan();
+						prewarm_pending_.store(false);
+					});
+				});
+			}
+
+			relay_.startup();
+
+			std::unique_lock<std::mutex> lk_(mtx_);
+			this->update_packet_prefilter();
+		}
+
+		virtual void shutdown() override
+		{
+			// no more prewarm scans, the last one (if any) is finished before pool goes away
+			if (prewarm_sub_)
+			{
+				report_ticker_->unsubscribe(prewarm_sub_);
+				prewarm_sub_ = 0;
+			}
+			prewarm_pool_.reset();
+
+			// queued snapshot requests are run to completion, reports are all still here
+			snapshot_request_pool_.reset();
+
+			// tell relay to stop operation
+			relay_.shutdown();
+
+			// no more packets, save what reports have
+			for (auto& report_host : report_hosts_)
+				this->history_save(report_host.second.get());
+
+			// drop cached snapshots first, so that their ticks go away before reports do
+			snapshot_caches_.clear();
+
+			for (auto& lane_it : request_lanes_)
+			{
+				std::unique_lock<std::mutex> lane_lk_(lane_it.second->mtx);
+				lane_it.second->host = nullptr;
+			}
+			request_lanes_.clear();
+
+			// shutdown all reports, fused ones leave their hosts here
+			for (auto& report_host : report_hosts_)
+				report_host.second->shutdown();
+
+			report_hosts_.clear();
+			fused_by_report_.clear();
+
+			for (auto& fhost : fused_hosts_)
+				fhost->shutdown();
+
+			fused_hosts_.clear();
+
+			// all strands are gone
+			report_executor_.reset();
+
+			// and all subscribers
+			report_ticker_.reset();
+		}
+
+		virtual pinba_error_t add_report(report_ptr report) override
+		{
+			std::unique_lock<std::mutex> lk_(mtx_);
+
+			report_host_t *rh = nullptr;
+
+			auto const err = this->add_report_locked(report, &rh);
+			if (err)
+				return err;
+
+			this->update_packet_prefilter();
+			this->history_load(rh);
+			return {};
+		}
+
+		virtual std::vector<pinba_error_t> add_reports(std::vector<report_ptr> const& reports) override
+		{
+			std::unique_lock<std::mutex> lk_(mtx_);
+
+			std::vector<pinba_error_t> result(reports.size());
+			std::vector<report_host_t*> created;
+			created.reserve(reports.size());
+
+			for (size_t i = 0; i < reports.size(); i++)
+			{
+				report_host_t *rh = nullptr;
+
+				result[i] = this->add_report_locked(reports[i], &rh);
+				if (!result[i])
+					created.push_back(rh);
+			}
+
+			// once for all reports, instead of once per report
+			this->update_packet_prefilter();
+
+			// hosts (threads) load their history at the same time, fused members share a thread, so those go one by one
+			std::vector<report_host_t*>               loading;
+			std::vector<std::unique_lock<std::mutex>> started;
+			std::vector<pinba_error_t>                load_errors(created.size());
+
+			std::string const& history_dir = globals_->options()->history_dir;
+
+			auto const finish_started = [&]()
+			{
+				for (size_t i = 0; i < started.size(); i++)
+					loading[i]->execute_in_thread_finish(std::move(started[i]));
+			};
+
+			try
+			{
+				for (size_t i = 0; i < created.size() && !history_dir.empty(); i++)
+				{
+					report_host_t *rh = created[i];
+
+					if (fused_by_report_.count(rh->report()->name().str()) > 0)
+					{
+						this->history_load(rh);
+						continue;
+					}
+
+					std::string const path = report_persist___file_path(history_dir, rh->report()->name(), ".history");
+					if (access(path.c_str(), F_OK) != 0)
+						continue;
+
+					pinba_error_t *err = &load_errors[i];
+					started.emplace_back(rh->execute_in_thread_start([err, path](report_host_t *rhost)
+					{
+						*err = rhost->report_history()->persist_load(path);
+					}));
+					loading.push_back(rh);
+				}
+			}
+			catch (...)
+			{
+				finish_started();
+				throw;
+			}
+
+			finish_started();
+
+			for (size_t i = 0; i < created.size(); i++)
+			{
+				if (load_errors[i])
+					LOG_WARN(globals_->logger(), "report {0}: history not loaded: {1}", created[i]->report()->name(), load_errors[i].what());
+			}
+
+			return result;
+		}
+
+		// creates report host and adds it to relay, *result_rh is set on success, mtx_ must be held
+		// caller must update_packet_prefilter() and history_load() after
+		pinba_error_t add_report_locked(report_ptr report, report_host_t **result_rh)
+		{
+			std::string const report_name = report->name().str();
+
+			auto const it = report_hosts_.find(report_name);
+			if (it != report_hosts_.end())
+				return ff::fmt_err("report already exists: {0}", report_name);
+
+
+			LOG_DEBUG(globals_->logger(), "creating report {0}", report_name);
+
+			if ((conf_->report_fuse_max > 1) && report_host___fused_t::can_fuse(report.get()))
+				return this->add_fused_report(report, result_rh);
+
+			auto const thread_id   = next_report_id_++;
+			auto const thr_name    = ff::fmt_str("rh/{0}", thread_id);
+			auto const rh_name     = ff::fmt_str("rh/{0}/{1}", thread_id, report_name);
+
+			report_host_conf_t const rh_conf = {
+				.id                = thread_id,
+				.name              = rh_name,
+				.thread_name       = thr_name,
+				.nn_control        = ff::fmt_str("inproc://{0}/control", rh_name),
+				.nn_shutdown       = ff::fmt_str("inproc://{0}/shutdown", rh_name),
+				.nn_packets        = ff::fmt_str("inproc://{0}/packets", rh_name),
+				.nn_packets_buffer = conf_->nn_report_input_buffer,
+				.cpus              = conf_->report_cpus,
+				.sched             = conf_->report_sched,
+				.packets_ring      = relay_.packets_ring_.get(),
+				.ticker            = report_ticker_.get(),
+			};
+
+			// pooled hosts can't have extra aggregator threads
+			report_host_ptr      rh;
+			report_host_input_t *rh_input; // save pointer to pass to relay_call()
+
+			if (report_executor_ && (report->info()->agg_threads <= 1))
+			{
+				auto h = meow::make_unique<report_host___pooled_t>(globals_, rh_conf, report_executor_.get());
+				rh_input = h.get();
+				rh = move(h);
+			}
+			else
+			{
+				auto h = meow::make_unique<report_host___new_thread_t>(globals_, rh_conf);
+				rh_input = h.get();
+				rh = move(h);
+			}
+
+			rh->startup(report);
+
+			// add report to relay thread
+			{
+				auto const err = relay_.execute_in_thread([this, report_name, rh_input]()
+				{
+					relay_.add_rhost(report_name, rh_input);
+				});
+
+				if (err)
+					return err;
+			}
+
+			// add report to our hash as well
+			*result_rh = rh.get();
+			report_hosts_.emplace(report_name, move(rh));
+
+			return {};
+		}
+
+		virtual pinba_error_t delete_report(std::string const& report_name) override
+		{
+			std::unique_lock<std::mutex> lk_(mtx_);
+
+
+			auto const it = report_hosts_.find(report_name);
+			if (it == report_hosts_.end())
+				return ff::fmt_err("unknown report: {0}", report_name);
+
+			LOG_DEBUG(globals_->logger(), "removing report {0}", report_name);
+
+			// selects still holding cached snapshot keep it alive, until they're done
+			snapshot_caches_.erase(report_name);
+
+			// wait for in-flight snapshot request to finish, queued ones will see the report is gone
+			auto const lane_it = request_lanes_.find(report_name);
+			if (lane_it != request_lanes_.end())
+			{
+				std::unique_lock<std::mutex> lane_lk_(lane_it->second->mtx);
+				lane_it->second->host = nullptr;
+				lane_lk_.unlock();
+
+				request_lanes_.erase(lane_it);
+			}
+
+			auto const fused_it = fused_by_report_.find(report_name);
+			if (fused_it != fused_by_report_.end())
+			{
+				report_host___fused_t *fhost = fused_it->second;
+
+				std::string const& signature = it->second->report()->agg_signature();
+				if (!signature.empty())
+					fhost->agg_signatures.erase(fhost->agg_signatures.find(signature));
+
+				this->history_save(it->second.get());
+				it->second->shutdown(); // leaves fused host thread
+				report_hosts_.erase(it);
+				fused_by_report_.erase(fused_it);
+
+				if (--fhost->n_members == 0)
+				{
+					auto const err = this->delete_fused_host(fhost);
+					if (err)
+						return err;
+				}
+
+				this->update_packet_prefilter();
+				return {};
+			}
+
+			// remove report from relay thread
+			{
+				auto const err = relay_.execute_in_thread([this, &report_name]()
+				{
+					auto const n_erased = relay_.remove_rhost(report_name);
+					assert ((n_erased == 1) && "BUG: report found by coordinator, but not found by relay thread");
+				});
+
+				if (err)
+					return err;
+			}
+
+			// can shutdown and remove the report now
+			report_host_t *host = it->second.get();
+			this->history_save(host);
+			host->shutdown(); // waits for host to completely shut itself down
+
+			auto const n_erased = report_hosts_.erase(report_name);
+			assert((n_erased == 1) && "BUG: report found initially, but nonexistent on erase");
+
+			this->update_packet_prefilter();
+			return {};
+		}
+
+		virtual pinba_error_t merge_remote_tick(std::string const& report_name, std::string tick_data) override
+		{
+			std::unique_lock<std::mutex> lk_(mtx_);
+
+			auto const it = report_hosts_.find(report_name);
+			if (it == report_hosts_.end())
+				return ff::fmt_err("unknown report: {0}", report_name);
+
+			pinba_error_t err;
+			it->second->execute_in_thread([&](report_host_t *rhost)
+			{
+				err = rhost->report_history()->federation_merge(std::move(tick_data));
+			});
+
+			return err;
+		}
+
+		virtual pinba_error_t subscribe_to_ticks(std::string const& report_name, report_tick_subscription_ptr subscription) override
+		{
+			std::unique_lock<std::mutex> lk_(mtx_);
+
+			auto const it = report_hosts_.find(report_name);
+			if (it == report_hosts_.end())
+				return ff::fmt_err("unknown report: {0}", report_name);
+
+			pinba_error_t err;
+			it->second->execute_in_thread([&](report_host_t *rhost)
+			{
+				err = rhost->report_history()->tick_subscribe(std::move(subscription));
+			});
+
+			return err;
+		}
+
+		virtual report_snapshot_ptr get_report_snapshot(std::string const& report_name) override
+		{
+			return this->take_report_snapshot(report_name, nullptr);
+		}
+
+		virtual std::future<report_snapshot_ptr> get_report_snapshot_async(std::string const& report_name) override
+		{
+			auto task = std::make_shared<std::packaged_task<report_snapshot_ptr()>>([this, report_name]()
+			{
+				return this->get_report_snapshot(report_name);
+			});
+			auto result = task->get_future();
+
+			// not started or shut down, nothing to queue on
+			if (!snapshot_request_pool_)
+			{
+				(*task)();
+				return result;
+			}
+
+			snapshot_request_pool_->enqueue([task]() { (*task)(); });
+			return result;
+		}
+
+		virtual std::vector<report_snapshot_ptr> get_report_snapshots(std::vector<std::string> const& report_names) override
+		{
+			std::unique_lock<std::mutex> lk_(mtx_);
+
+			// one request per host thread, fused reports share one
+			// (two requests to the same thread would deadlock on its control lock anyway)
+			struct thread_req_t
+			{
+				report_host___fused_t       *fhost;    // fused host, nullptr for a report with thread of its own
+				std::vector<report_host_t*>  hosts;
+				std::vector<size_t>          indexes;  // into report_names, same order as hosts
+			};
+			std::vector<thread_req_t> reqs;
+			std::unordered_map<void const*, size_t> req_by_thread;
+
+			for (size_t i = 0; i < report_names.size(); i++)
+			{
+				auto const it = report_hosts_.find(report_names[i]);
+				if (it == report_hosts_.end())
+					throw std::runtime_error(ff::fmt_str("unknown report: {0}", report_names[i]));
+
+				report_host_t *host = it->second.get();
+
+				auto const fused_it = fused_by_report_.find(report_names[i]);
+				report_host___fused_t *fhost = (fused_it != fused_by_report_.end()) ? fused_it->second : nullptr;
+
+				void const *thread_key = (fhost) ? (void const*)fhost : (void const*)host;
+
+				auto const inserted = req_by_thread.emplace(thread_key, reqs.size());
+				if (inserted.second)
+					reqs.push_back(thread_req_t { .fhost = fhost, .hosts = {}, .indexes = {} });
+
+				thread_req_t& req = reqs[inserted.first->second];
+				req.hosts.push_back(host);
+				req.indexes.push_back(i);
+			}
+
+			// pooled hosts have no threads to stop, pause them instead, their snapshots are taken here
+			std::vector<size_t> paused;
+			MEOW_DEFER(
+				for (auto const i : paused)
+					reqs[i].hosts[0]->resume();
+			);
+
+			std::vector<size_t> threaded;
+			threaded.reserve(reqs.size());
+
+			for (size_t i = 0; i < reqs.size(); i++)
+			{
+				if (!reqs[i].fhost && reqs[i].hosts[0]->pause())
+					paused.push_back(i);
+				else
+					threaded.push_back(i);
+			}
+
+			// all host threads stop at the barrier (and this one as well), snapshots are taken once all of them are there
+			// so that no report can tick in between, and all snapshots are cut at the same moment
+			std::vector<report_snapshot_ptr> result(report_names.size());
+			thread_barrier_t barrier(threaded.size() + 1);
+
+			auto const take_snapshots = [&result](thread_req_t const& req)
+			{
+				for (size_t i = 0; i < req.hosts.size(); i++)
+					result[req.indexes[i]] = req.hosts[i]->report_history()->get_snapshot();
+			};
+
+			std::vector<std::unique_lock<std::mutex>> started;
+			started.reserve(threaded.size());
+
+			auto const finish_started = [&]()
+			{
+				for (size_t i = 0; i < started.size(); i++)
+				{
+					thread_req_t const& req = reqs[threaded[i]];
+
+					if (req.fhost)
+						req.fhost->execute_in_thread_finish(std::move(started[i]));
+					else
+						req.hosts[0]->execute_in_thread_finish(std::move(started[i]));
+				}
+			};
+
+			try
+			{
+				for (auto const i : threaded)
+				{
+					thread_req_t const *r = &reqs[i];
+
+					auto const func = [&barrier, &take_snapshots, r]()
+					{
+						barrier.arrive_and_wait();
+						take_snapshots(*r);
+					};
+
+					if (r->fhost)
+						started.emplace_back(r->fhost->execute_in_thread_start(func));
+					else
+						started.emplace_back(r->hosts[0]->execute_in_thread_start([func](report_host_t*) { func(); }));
+				}
+			}
+			catch (...)
+			{
+				// hosts that got the request are waiting at the barrier, release them
+				barrier.cancel();
+				finish_started();
+				throw;
+			}
+
+			barrier.arrive_and_wait();
+
+			for (auto const i : paused)
+				take_snapshots(reqs[i]);
+
+			finish_started();
+			return result;
+		}
+
+		virtual report_snapshot_ptr get_prepared_report_snapshot(std::string const& report_name, report_snapshot_t::merge_flags_t flags) override
+		{
+			report_snapshot_cache_ptr cache = [&]()
+			{
+				std::unique_lock<std::mutex> lk_(mtx_);
+
+				if (report_hosts_.find(report_name) == report_hosts_.end())
+					throw std::runtime_error(ff::fmt_str("unknown report: {0}", report_name));
+
+				auto& c = snapshot_caches_[report_name];
+				if (!c)
+					c = std::make_shared<report_snapshot_cache_t>();
+				return c;
+			}();
+
+			cache->n_selects.fetch_add(1, std::memory_order_relaxed);
+			cache->flags_seen.fetch_or(flags, std::memory_order_relaxed);
+
+			std::unique_lock<std::mutex> cache_lk_(cache->mtx);
 
+			shared_snapshot_ptr shared = this->snapshot_cache_get_fresh(report_name, cache.get(), flags, true);
+			if (!shared)
+				shared = this->snapshot_cache_refresh(report_name, cache.get(), flags);
 
-		pinba_error_t execute_in_thread(request_func_t const& func)
+			return meow::make_unique<report_snapshot___shared_t>(std::move(shared));
+		}
+
+		// cached snapshot, if it's been prepared with flags and has everything up to the last tick, nullptr otherwise
+		// cache->mtx must be held, throws if report has been deleted
+		shared_snapshot_ptr snapshot_cache_get_fresh(std::string const& report_name, report_snapshot_cache_t *cache, report_snapshot_t::merge_flags_t flags, bool count_stats)
 		{
-			auto req = meow::make_intrusive<request_t>();
-			req->func = func;
+			std::unique_lock<std::mutex> lk_(mtx_);
 
-			response_ptr response;
+			// report might have been deleted, while we've been waiting for some other select to finish
+			auto const it = report_hosts_.find(report_name);
+			if (it == report_hosts_.end())
+				throw std::runtime_error(ff::fmt_str("unknown report: {0}", report_name));
+
+			report_host_t  *host  = it->second.get();
+			report_stats_t *stats = host->stats();
+
+			shared_snapshot_t const *curr = cache->current.get();
+			if (curr && ((curr->flags & flags) == flags))
 			{
-				std::unique_lock<std::mutex> lk_(control_mtx_);
+				std::unique_lock<std::mutex> stats_lk_(stats->lock);
 
-				control_cli_sock_.send_message(req);
-				response = control_cli_sock_.recv<response_ptr>();
+				// cached snapshot has everything up to the last tick, reuse
+				if (!(curr->last_tick_tv < stats->last_tick_tv))
+				{
+					if (count_stats)
+						stats->snapshot_cache_hits++;
+					return cache->current;
+				}
 			}
 
-			return std::move(response->err);
-		}
+			if (count_stats)
+				stats->snapshot_cache_misses++;
 
-	private:
+			return {};
+		}
 
-		void worker_thread()
+		// take and prepare a new snapshot, replacing cached one
+		// cache->mtx must be held, throws if report has been deleted
+		shared_snapshot_ptr snapshot_cache_refresh(std::string const& report_name, report_snapshot_cache_t *cache, report_snapshot_t::merge_flags_t flags)
 		{
-			std::string const thr_name = ff::fmt_str("packet-relay");
+			timeval_t last_tick_tv;
+			report_snapshot_ptr snapshot = this->take_report_snapshot(report_name, &last_tick_tv);
 
-			PINBA___OS_CALL(globals_, set_thread_name, thr_name);
+			// merge without holding coordinator lock, other reports are not affected
+			uint64_t const cycles_start = pinba_cycles_now();
+			snapshot->prepare(flags);
+			uint64_t const cycles_prepare = pinba_cycles_now() - cycles_start;
 
-			MEOW_DEFER(
-				LOG_DEBUG(globals_->logger(), "{0}; exiting", thr_name);
-			);
+			{
+				std::unique_lock<std::mutex> lk_(mtx_);
 
-			poller_
-				.ticker(1000 * d_millisecond, [this](timeval_t now)
-				{
-					// FIXME: rename stats
+				// report might have been deleted while we've been merging, nobody to account cycles to then
+				auto const it = report_hosts_.find(report_name);
+				if (it != report_hosts_.end())
+					it->second->stats()->cycles_prepare.fetch_add(cycles_prepare, std::memory_order_relaxed);
+			}
 
-					// update accumulated rusage
-					os_rusage_t const ru = os_unix::getrusage_ex(RUSAGE_THREAD);
+			auto shared = std::make_shared<shared_snapshot_t>();
+			shared->mem_estimate = shared_snapshot___mem_estimate(snapshot.get());
+			shared->snapshot     = std::move(snapshot);
+			shared->flags        = flags;
+			shared->last_tick_tv = last_tick_tv;
 
-					std::lock_guard<std::mutex> lk_(stats_->mtx);
-					stats_->coordinator.ru_utime = timeval_from_os_timeval(ru.ru_utime);
-					stats_->coordinator.ru_stime = timeval_from_os_timeval(ru.ru_stime);
-				})
-				.read_nn_socket(in_sock_, [this](timeval_t now)
-				{
-					auto batch = in_sock_.recv<packet_batch_ptr>();
+			cache->current = shared;
+			return shared;
+		}
+
+		// runs in prewarm thread, every prewarm_scan_interval_ms
+		// updates select rates and prepares fresh snapshots for hot reports that have ticked since their last one
+		// hottest reports go first, the ones that don't fit snapshot_prewarm_max_mem are left for selects to merge
+		void snapshot_prewarm_scan()
+		{
+			struct hot_report_t
+			{
+				std::string                       name;
+				report_snapshot_cache_ptr         cache;
+				double                            qpm;
+				report_snapshot_t::merge_flags_t  flags;
+			};
+			std::vector<hot_report_t> hot;
+
+			bool const update_rates = ((++prewarm_scans_ % prewarm_scans_per_rate_update) == 0);
 
-					++stats_->coordinator.batches_received;
+			{
+				std::unique_lock<std::mutex> lk_(mtx_);
 
-					// FIXME
-					// special counter for batches that were dropped, because no recepients were active
-					// if (rhosts_.empty())
-					// 	++stats_->coordinator.batches_send_dropped;
+				for (auto const& cache_it : snapshot_caches_)
+				{
+					report_snapshot_cache_t *cache = cache_it.second.get();
 
-					// relay the batch to all reports,
-					// TODO(antoxa): maybe move this to a separate thread?
-					// NOTE:
-					// this is fundamentally broken and can't be implemented with nanomsg PUB/SUB sadly
-					// since we have no idea if the report handler is slow, and in that case messages will be dropped
-					// and ref counts will not be decremented and memory will leak and we won't have any stats about that either
-					// (we also have no need for the pub/sub routing part at the moment and probably won't need it ever)
-					for (auto& report_host : rhosts_)
+					// selects per second, decayed over about a minute, times 60
+					if (update_rates)
 					{
-						++stats_->coordinator.batch_send_total;
-						bool const success = report_host.second->process_batch(batch);
-						if (!success)
-						{
-							++stats_->coordinator.batch_send_err;
-							// TODO: add packet counter here
-						}
+						uint64_t const n_selects = cache->n_selects.exchange(0, std::memory_order_relaxed);
+						cache->select_qpm = cache->select_qpm * (1 - prewarm_rate_alpha) + double(n_selects) * 60 * prewarm_rate_alpha;
+
+						report_snapshot_t::merge_flags_t const flags = cache->flags_seen.exchange(0, std::memory_order_relaxed);
+						if (n_selects > 0)
+							cache->prewarm_flags = flags;
 					}
-				})
-				.read_nn_socket(control_sock_, [this](timeval_t now)
-				{
-					auto const req = this->control_sock_.recv<request_ptr>();
 
-					auto const result = meow::make_intrusive<response_t>();
+					if (cache->select_qpm < conf_->snapshot_prewarm_min_qpm)
+						continue;
 
-					try
+					hot.push_back(hot_report_t { cache_it.first, cache_it.second, cache->select_qpm, cache->prewarm_flags });
+				}
+			}
+
+			std::sort(hot.begin(), hot.end(), [](hot_report_t const& l, hot_report_t const& r) { return l.qpm > r.qpm; });
+
+			auto& prewarm_stats = stats_->snapshot_prewarm;
+
+			uint64_t mem_total = 0;
+			uint64_t n_hot     = 0;
+
+			for (auto const& r : hot)
+			{
+				// select is merging this one right now, it'll be fresh anyway
+				std::unique_lock<std::mutex> cache_lk_(r.cache->mtx, std::try_to_lock);
+				if (!cache_lk_.owns_lock())
+					continue;
+
+				try
+				{
+					// next snapshot is about the same size as the last one
+					uint64_t const mem = (r.cache->current) ? r.cache->current->mem_estimate : 0;
+
+					if ((conf_->snapshot_prewarm_max_mem > 0) && (mem_total + mem > conf_->snapshot_prewarm_max_mem))
 					{
-						auto *r = static_cast<request_t*>(req.get());
-						r->func();
+						// stale snapshot is of no use to anyone, don't keep it around over budget
+						if (!this->snapshot_cache_get_fresh(r.name, r.cache.get(), r.flags, false))
+							r.cache->current.reset();
+
+						prewarm_stats.skipped_mem.fetch_add(1, std::memory_order_relaxed);
+						continue;
 					}
-					catch (std::exception const& e)
+
+					if (!this->snapshot_cache_get_fresh(r.name, r.cache.get(), r.flags, false))
 					{
-						result->err = ff::fmt_err("packet_relay::call: {0}", e.what());
+						this->snapshot_cache_refresh(r.name, r.cache.get(), r.flags);
+						prewarm_stats.snapshots_prepared.fetch_add(1, std::memory_order_relaxed);
 					}
 
-					control_sock_.send_message(result);
-				})
-				.loop();
-		}
+					mem_total += r.cache->current->mem_estimate;
+					n_hot++;
+				}
+				catch (std::exception const& e)
+				{
+					// report has been deleted most likely, it's going to be gone from the list on next scan
+					LOG_DEBUG(globals_->logger(), "snapshot prewarm; {0}: {1}", r.name, e.what());
+				}
+			}
 
-	public:
-		pinba_globals_t     *globals_;
-		pinba_stats_t       *stats_;
-		coordinator_conf_t  *conf_;
+			prewarm_stats.hot_reports.store(n_hot, std::memory_order_relaxed);
+			prewarm_stats.mem_used.store(mem_total, std::memory_order_relaxed);
+		}
 
-		// report_name -> report_host*
-		using rhost_map_t = std::unordered_map<std::string, report_host_t*>;
-		rhost_map_t         rhosts_;
+		// snapshot from tick list published by report history, if there is one, report thread is not stopped then
+		// otherwise snapshot is taken in report thread, as before
+		// *last_tick_tv (when not nullptr) is never newer than ticks in the snapshot, cache can't mistake it for a fresh one
+		report_snapshot_ptr take_report_snapshot(std::string const& report_name, timeval_t *last_tick_tv)
+		{
+			report_snapshot_ptr snapshot;
 
-		nmsg_poller_t       poller_;
+			this->with_report_lane(report_name, [&](report_host_t *host)
+			{
+				// history publishes on tick merge, stats are updated after that, so read stats first
+				if (last_tick_tv)
+				{
+					std::unique_lock<std::mutex> stats_lk_(host->stats()->lock);
+					*last_tick_tv = host->stats()->last_tick_tv;
+				}
 
-		nmsg_socket_t       in_sock_;
-		nmsg_socket_t       control_sock_;
-		nmsg_socket_t       control_cli_sock_;
-		std::mutex          control_mtx_;
+				snapshot = host->report_history()->get_published_snapshot();
+				if (snapshot)
+					return;
 
-		std::thread         thread_;
-	};
+				// take tick time in report thread, to be exactly in sync with ticks in history
+				host->execute_in_thread([&](report_host_t *rhost)
+				{
+					snapshot = rhost->report_history()->get_snapshot();
 
-////////////////////////////////////////////////////////////////////////////////////////////////
+					if (last_tick_tv)
+					{
+						std::unique_lock<std::mutex> stats_lk_(rhost->stats()->lock);
+						*last_tick_tv = rhost->stats()->last_tick_tv;
+					}
+				});
+			});
 
-	struct coordinator_impl_t : public coordinator_t
-	{
-		coordinator_impl_t(pinba_globals_t *globals, coordinator_conf_t *conf)
-			: globals_(globals)
-			, stats_(globals->stats())
-			, conf_(conf)
-			, next_report_id_(0)
-			, relay_(globals, conf)
-		{
+			return snapshot;
 		}
 
-		~coordinator_impl_t()
+		// runs func(host) in this thread, holding report lane instead of coordinator lock
+		// throws if report doesn't exist, or has been deleted while we've been waiting in the lane
+		template<class Function>
+		void with_report_lane(std::string const& report_name, Function const& func)
 		{
-			this->shutdown();
-		}
+			report_request_lane_ptr lane = [&]()
+			{
+				std::unique_lock<std::mutex> lk_(mtx_);
 
-	private:
+				auto const it = report_hosts_.find(report_name);
+				if (it == report_hosts_.end())
+					throw std::runtime_error(ff::fmt_str("unknown report: {0}", report_name));
 
-		virtual void startup() override
-		{
-			relay_.startup();
-		}
+				auto& l = request_lanes_[report_name];
+				if (!l)
+				{
+					l = std::make_shared<report_request_lane_t>();
+					l->host = it->second.get();
+				}
+				return l;
+			}();
 
-		virtual void shutdown() override
-		{
-			// tell relay to stop operation
-			relay_.shutdown();
+			std::unique_lock<std::mutex> lane_lk_(lane->mtx);
 
-			// shutdown all reports
-			for (auto& report_host : report_hosts_)
-				report_host.second->shutdown();
+			if (!lane->host)
+				throw std::runtime_error(ff::fmt_str("unknown report: {0}", report_name));
 
-			report_hosts_.clear();
+			func(lane->host);
 		}
 
-		virtual pinba_error_t add_report(report_ptr report) override
+		virtual void report_hv_wanted(std::string const& report_name) override
 		{
 			std::unique_lock<std::mutex> lk_(mtx_);
 
-
-			std::string const report_name = report->name().str();
-
 			auto const it = report_hosts_.find(report_name);
-			if (it != report_hosts_.end())
-				return ff::fmt_err("report already exists: {0}", report_name);
+			if (it == report_hosts_.end())
+				throw std::runtime_error(ff::fmt_str("unknown report: {0}", report_name));
 
+			int64_t const now_ns = duration_from_timeval(os_unix::clock_monotonic_now()).nsec;
+			it->second->stats()->hv_wanted_ns.store(now_ns, std::memory_order_relaxed);
+		}
 
-			LOG_DEBUG(globals_->logger(), "creating report {0}", report_name);
+		virtual report_state_ptr get_report_state(std::string const& report_name) override
+		{
+			std::unique_lock<std::mutex> lk_(mtx_);
 
-			auto const thread_id   = next_report_id_++;
-			auto const thr_name    = ff::fmt_str("rh/{0}", thread_id);
-			auto const rh_name     = ff::fmt_str("rh/{0}/{1}", thread_id, report_name);
 
-			report_host_conf_t const rh_conf = {
-				.id                = thread_id,
-				.name              = rh_name,
-				.thread_name       = thr_name,
-				.nn_control        = ff::fmt_str("inproc://{0}/control", rh_name),
-				.nn_shutdown       = ff::fmt_str("inproc://{0}/shutdown", rh_name),
-				.nn_packets        = ff::fmt_str("inproc://{0}/packets", rh_name),
-				.nn_packets_buffer = conf_->nn_report_input_buffer,
-			};
+			auto const it = report_hosts_.find(report_name);
+			if (it == report_hosts_.end())
+				throw std::runtime_error(ff::fmt_str("unknown report: {0}", report_name));
 
-			auto  rh = meow::make_unique<report_host___new_thread_t>(globals_, rh_conf);
-			auto *rh_ptr = rh.get(); // save pointer to pass to relay_call()
+			report_host_t *host = it->second.get();
 
-			rh->startup(report);
+			auto state = meow::make_unique<report_state_t>();
+			state->id    = host->id();
+			state->stats = host->stats();
+			state->info  = *host->report()->info(); // immutable after startup
 
-			// add report to relay thread
+			// reports younger than a second haven't published anything yet, get it from report thread this once
+			// publishing from there keeps single writer, control requests run where stats ticker does
+			if (state->stats->published.version() == 0)
 			{
-				auto const err = relay_.execute_in_thread([this, report_name, rh_ptr]()
+				host->execute_in_thread([&](report_host_t *rhost)
 				{
-					relay_.rhosts_.emplace(report_name, rh_ptr);
+					std::unique_lock<std::mutex> stats_lk_(rhost->stats()->lock);
+					report_stats___publish(rhost->stats(), report_host___estimates(rhost));
 				});
-
-				if (err)
-					return err;
 			}
 
-			// add report to our hash as well
-			report_hosts_.emplace(report_name, move(rh));
-			return {};
+			state->published = state->stats->published.load();
+			state->estimates = state->published.estimates;
+
+			return state;
 		}
 
-		virtual pinba_error_t delete_report(std::string const& report_name) override
+	private:
+
+		// joins the first compatible fused host with some room left, or starts a new one, mtx_ must be held
+		pinba_error_t add_fused_report(report_ptr report, report_host_t **result_rh)
 		{
-			std::unique_lock<std::mutex> lk_(mtx_);
+			std::string const report_name = report->name().str();
 
+			std::string const& signature = report->agg_signature();
 
-			auto const it = report_hosts_.find(report_name);
-			if (it == report_hosts_.end())
-				return ff::fmt_err("unknown report: {0}", report_name);
+			// prefer the host that has a report we can share aggregation with
+			report_host___fused_t *fhost = nullptr;
+			for (auto const& h : fused_hosts_)
+			{
+				if ((h->n_members < conf_->report_fuse_max) && h->is_compatible(report.get()))
+				{
+					bool const shares = !signature.empty() && (h->agg_signatures.count(signature) > 0);
 
-			LOG_DEBUG(globals_->logger(), "removing report {0}", report_name);
+					if (!fhost || shares)
+						fhost = h.get();
 
-			// remove report from relay thread
+					if (shares)
+						break;
+				}
+			}
+
+			if (!fhost)
 			{
-				auto const err = relay_.execute_in_thread([this, &report_name]()
+				auto const thread_id = next_report_id_++;
+				auto const thr_name  = ff::fmt_str("rf/{0}", thread_id);
+
+				report_host_conf_t const rh_conf = {
+					.id                = thread_id,
+					.name              = thr_name,
+					.thread_name       = thr_name,
+					.nn_control        = ff::fmt_str("inproc://{0}/control", thr_name),
+					.nn_shutdown       = ff::fmt_str("inproc://{0}/shutdown", thr_name),
+					.nn_packets        = ff::fmt_str("inproc://{0}/packets", thr_name),
+					.nn_packets_buffer = conf_->nn_report_input_buffer,
+					.cpus              = conf_->report_cpus,
+					.sched             = conf_->report_sched,
+					.packets_ring      = relay_.packets_ring_.get(),
+					.ticker            = report_ticker_.get(),
+				};
+
+				auto h = meow::make_unique<report_host___fused_t>(globals_, rh_conf, report);
+				h->startup();
+
+				fhost = h.get();
+
+				auto const err = relay_.execute_in_thread([this, fhost]()
 				{
-					auto const n_erased = relay_.rhosts_.erase(report_name);
-					assert ((n_erased == 1) && "BUG: report found by coordinator, but not found by relay thread");
+					relay_.add_rhost(fhost->conf_.name, fhost);
 				});
 
 				if (err)
+				{
+					fhost->shutdown();
 					return err;
+				}
+
+				LOG_DEBUG(globals_->logger(), "started fused report host {0}", fhost->conf_.name);
+
+				fused_hosts_.emplace_back(move(h));
 			}
 
-			// can shutdown and remove the report now
-			report_host_t *host = it->second.get();
-			host->shutdown(); // waits for host to completely shut itself down
+			auto rh = meow::make_unique<report_host___fused_member_t>(fhost, next_report_id_++);
+			rh->startup(report);
 
-			auto const n_erased = report_hosts_.erase(report_name);
-			assert((n_erased == 1) && "BUG: report found initially, but nonexistent on erase");
+			fhost->add_member(rh.get());
+			fhost->n_members += 1;
+
+			if (!signature.empty())
+				fhost->agg_signatures.insert(signature);
+
+			LOG_DEBUG(globals_->logger(), "report {0} fused into {1}, members: {2}", report_name, fhost->conf_.name, fhost->n_members);
+
+			*result_rh = rh.get();
+			fused_by_report_.emplace(report_name, fhost);
+			report_hosts_.emplace(report_name, move(rh));
 
 			return {};
 		}
 
-		virtual report_snapshot_ptr get_report_snapshot(std::string const& report_name) override
+		// report history files, in pinba_options_t::history_dir, errors are logged and otherwise ignored
+		// both run in report host thread, load must be called right after host startup (or rather, before the first tick)
+		void history_load(report_host_t *rh)
 		{
-			std::unique_lock<std::mutex> lk_(mtx_);
+			std::string const& history_dir = globals_->options()->history_dir;
+			if (history_dir.empty())
+				return;
 
+			str_ref const report_name = rh->report()->name();
+			std::string const path    = report_persist___file_path(history_dir, report_name, ".history");
 
-			auto const it = report_hosts_.find(report_name);
-			if (it == report_hosts_.end())
-				throw std::runtime_error(ff::fmt_str("unknown report: {0}", report_name));
+			if (access(path.c_str(), F_OK) != 0)
+				return; // never saved
 
-			report_host_t *host = it->second.get();
+			timeval_t const start_tv = os_unix::clock_monotonic_now();
 
-			report_snapshot_ptr snapshot;
-			host->execute_in_thread([&](report_host_t *rhost)
+			pinba_error_t err;
+			rh->execute_in_thread([&](report_host_t *rhost)
 			{
-				snapshot = rhost->report_history()->get_snapshot();
+				err = rhost->report_history()->persist_load(path);
 			});
 
-			return snapshot;
+			if (err)
+			{
+				LOG_WARN(globals_->logger(), "report {0}: history not loaded from {1}: {2}", report_name, path, err.what());
+				return;
+			}
+
+			LOG_INFO(globals_->logger(), "report {0}: history loaded from {1} in {2}s", report_name, path, timeval_to_double(os_unix::clock_monotonic_now() - start_tv));
 		}
 
-		virtual report_state_ptr get_report_state(std::string const& report_name) override
+		void history_save(report_host_t *rh)
 		{
-			std::unique_lock<std::mutex> lk_(mtx_);
+			std::string const& history_dir = globals_->options()->history_dir;
+			if (history_dir.empty())
+				return;
 
+			str_ref const report_name = rh->report()->name();
+			std::string const path    = report_persist___file_path(history_dir, report_name, ".history");
 
-			auto const it = report_hosts_.find(report_name);
-			if (it == report_hosts_.end())
-				throw std::runtime_error(ff::fmt_str("unknown report: {0}", report_name));
+			pinba_error_t err;
+			rh->execute_in_thread([&](report_host_t *rhost)
+			{
+				err = rhost->report_history()->persist_save(path);
+			});
 
-			report_host_t *host = it->second.get();
+			if (err)
+				LOG_WARN(globals_->logger(), "report {0}: history not saved to {1}: {2}", report_name, path, err.what());
+		}
 
-			auto state = meow::make_unique<report_state_t>();
-			host->execute_in_thread([&](report_host_t *rhost)
+		// host has no members left, mtx_ must be held
+		pinba_error_t delete_fused_host(report_host___fused_t *fhost)
+		{
+			auto const err = relay_.execute_in_thread([this, fhost]()
 			{
-				state->id        = rhost->id();
-				state->stats     = rhost->stats();
-				state->info      = *rhost->report()->info();
+				auto const n_erased = relay_.remove_rhost(fhost->conf_.name);
+				assert ((n_erased == 1) && "BUG: fused host found by coordinator, but not found by relay thread");
+			});
 
-				auto const a_est = rhost->report_agg()->get_estimates();
-				auto const h_est = rhost->report_history()->get_estimates();
+			if (err)
+				return err;
 
-				state->estimates.row_count = h_est.row_count ? h_est.row_count : a_est.row_count;
-				state->estimates.mem_used = h_est.mem_used + a_est.mem_used;
-			});
+			LOG_DEBUG(globals_->logger(), "stopping fused report host {0}", fhost->conf_.name);
 
-			return state;
+			fhost->shutdown();
+
+			auto const it = std::find_if(fused_hosts_.begin(), fused_hosts_.end(), [fhost](fused_host_ptr const& h) { return h.get() == fhost; });
+			assert((it != fused_hosts_.end()) && "BUG: fused host not found on erase");
+			fused_hosts_.erase(it);
+
+			return {};
+		}
+
+		// rebuild repacker prefilter from all current reports, mtx_ must be held
+		void update_packet_prefilter()
+		{
+			if (!conf_->on_packet_prefilter)
+				return;
+
+			auto prefilter = std::make_shared<packet_prefilter_t>();
+
+			for (auto const& rh_pair : report_hosts_)
+			{
+				report_ptr report = rh_pair.second->shared_report();
+
+				timertag_bloom_t const *bloom = report->packet_bloom();
+				if (!bloom)
+				{
+					// this report might want any packet, no need to look at others
+					prefilter->pass_all = true;
+					prefilter->reports.clear();
+					prefilter->blooms.clear();
+					break;
+				}
+
+				prefilter->reports.emplace_back(std::move(report));
+				prefilter->blooms.emplace_back(bloom);
+			}
+
+			LOG_DEBUG(globals_->logger(), "packet prefilter updated; reports: {0}, pass_all: {1}", report_hosts_.size(), prefilter->pass_all);
+
+			conf_->on_packet_prefilter(std::move(prefilter));
 		}
 
 	private:
@@ -644,11 +3351,46 @@ namespace { namespace aux {
 
 		std::mutex          mtx_;
 
+		// report ticks for all hosts, see report_ticker_t
+		report_ticker_ptr   report_ticker_;
+
+		// runs pooled report hosts, see coordinator_conf_t::report_executor_threads, nullptr = thread per report
+		report_executor_ptr report_executor_;
+
 		// report_name -> report_host
 		using rhost_map_t = std::unordered_map<std::string, report_host_ptr>;
 		rhost_map_t         report_hosts_;
 		uint32_t            next_report_id_;
 
+		// fused hosts (see report_host___fused_t), their members are in report_hosts_ as well
+		using fused_host_ptr = std::unique_ptr<report_host___fused_t>;
+		std::vector<fused_host_ptr> fused_hosts_;
+
+		// report_name -> fused host it runs in
+		std::unordered_map<std::string, report_host___fused_t*> fused_by_report_;
+
+		// report_name -> last prepared snapshot, see get_prepared_report_snapshot()
+		std::unordered_map<std::string, report_snapshot_cache_ptr> snapshot_caches_;
+
+		// snapshots of hot reports are prepared here after every tick, see coordinator_conf_t::snapshot_prewarm_min_qpm
+		// own thread, since prepare() uses snapshot_merge_pool() and must not wait for itself
+		static constexpr uint32_t const prewarm_scan_interval_ms      = 100;
+		static constexpr uint32_t const prewarm_scans_per_rate_update = 1000 / prewarm_scan_interval_ms; // rates are per second
+		static constexpr double   const prewarm_rate_alpha            = 1.0 / 60;
+
+		thread_pool_ptr                     prewarm_pool_;
+		report_ticker_t::subscription_id_t  prewarm_sub_     = 0;
+		std::atomic<bool>                   prewarm_pending_ = {false};
+		uint64_t                            prewarm_scans_   = 0; // prewarm thread only
+
+		// report_name -> snapshot request lane, see with_report_lane()
+		std::unordered_map<std::string, report_request_lane_ptr> request_lanes_;
+
+		// get_report_snapshot_async() requests are run here, instead of a thread per request
+		// requests mostly wait for their report host, so a few threads are enough to keep reports from waiting for each other
+		static constexpr uint32_t const snapshot_request_threads = 4;
+		thread_pool_ptr                 snapshot_request_pool_;
+
 		relay_worker_t      relay_;
 	};
 
@@ -0,0 +1,230 @@
+#include "pinba_config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <meow/defer.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+#include <meow/unix/time.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/byte_ring.h"
+#include "pinba/os_symbols.h"
+#include "pinba/datagram_capture.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	using ring_t = byte_ring_t<datagram_capture_t::ring_size>;
+
+	struct datagram_capture_impl_t : public datagram_capture_t
+	{
+		static constexpr uint32_t const drain_interval_ms = 10;
+
+		datagram_capture_impl_t(pinba_globals_t *globals, std::string const& path, uint64_t max_file_size)
+			: globals_(globals)
+			, path_(path)
+			, max_file_size_(max_file_size)
+		{
+			if (max_file_size_ < 2 * ring_size)
+				throw std::runtime_error(ff::fmt_str("datagram_capture: max file size must be at least {0} bytes, got {1}", 2 * ring_size, max_file_size_));
+
+			for (auto& r : rings_)
+				r.store(nullptr, std::memory_order_relaxed);
+
+			if (auto const err = this->file_open())
+				throw std::runtime_error(ff::fmt_str("datagram_capture: {0}", err.what()));
+
+			t_ = std::thread([this]() { this->writer_thread(); });
+		}
+
+		~datagram_capture_impl_t()
+		{
+			stop_.store(true);
+			t_.join();
+
+			for (auto& r : rings_)
+				delete r.load(std::memory_order_relaxed);
+		}
+
+		virtual void push(uint32_t thread_id, str_ref datagram) override
+		{
+			if (failed_.load(std::memory_order_relaxed))
+				return;
+
+			ring_t *ring = rings_[thread_id % max_threads].load(std::memory_order_acquire);
+			if (!ring)
+			{
+				ring = new ring_t;
+				rings_[thread_id % max_threads].store(ring, std::memory_order_release);
+			}
+
+			int64_t const ts = duration_from_timeval(os_unix::clock_gettime_ex(CLOCK_REALTIME)).nsec;
+
+			if (!ring->push(ts, 0, datagram))
+				globals_->stats()->datagram_capture.datagrams_dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+
+	private:
+
+		void writer_thread()
+		{
+			PINBA___OS_CALL(globals_, set_thread_name, "dgram_capture");
+
+			MEOW_DEFER(
+				LOG_DEBUG(globals_->logger(), "dgram_capture; exiting");
+			);
+
+			while (!stop_.load())
+			{
+				this->drain_rings();
+				std::this_thread::sleep_for(std::chrono::milliseconds(drain_interval_ms));
+			}
+
+			this->drain_rings();
+			this->file_close();
+		}
+
+		void drain_rings()
+		{
+			if (failed_.load(std::memory_order_relaxed))
+				return;
+
+			for (auto& r : rings_)
+			{
+				ring_t *ring = r.load(std::memory_order_acquire);
+				if (!ring)
+					continue;
+
+				ring->drain([this](int64_t ts, uint32_t, str_ref bytes)
+				{
+					return this->file_append(ts, bytes);
+				});
+
+				if (failed_.load(std::memory_order_relaxed))
+					return;
+			}
+		}
+
+		bool file_append(int64_t ts, str_ref const bytes)
+		{
+			uint32_t const len  = bytes.size();
+			uint64_t const need = sizeof(ts) + sizeof(len) + len;
+
+			if (file_pos_ + need > max_file_size_)
+			{
+				this->file_close();
+
+				if (auto const err = this->file_open())
+				{
+					LOG_ERROR(globals_->logger(), "dgram_capture; {0}, capture is stopped", err.what());
+					failed_.store(true);
+					return false;
+				}
+
+				++globals_->stats()->datagram_capture.files_rotated;
+			}
+
+			char *p = map_ptr_ + file_pos_;
+			memcpy(p, &ts, sizeof(ts));
+			memcpy(p + sizeof(ts), &len, sizeof(len));
+			memcpy(p + sizeof(ts) + sizeof(len), bytes.data(), len);
+			file_pos_ += need;
+
+			auto& stats = globals_->stats()->datagram_capture;
+			stats.datagrams_captured.fetch_add(1, std::memory_order_relaxed);
+			stats.bytes_written.fetch_add(need, std::memory_order_relaxed);
+			return true;
+		}
+
+		// previous file (if any) is renamed to <path>.1, new one is preallocated and mapped
+		pinba_error_t file_open()
+		{
+			std::string const old_path = path_ + ".1";
+
+			if ((rename(path_.c_str(), old_path.c_str()) < 0) && (errno != ENOENT))
+				return ff::fmt_err("rename({0}, {1}) failed: {2}:{3}", path_, old_path, errno, strerror(errno));
+
+			int const fd = ::open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if (fd < 0)
+				return ff::fmt_err("open({0}) failed: {1}:{2}", path_, errno, strerror(errno));
+
+			bool close_fd = true;
+			MEOW_DEFER(
+				if (close_fd)
+					close(fd);
+			);
+
+			if (ftruncate(fd, max_file_size_) < 0)
+				return ff::fmt_err("ftruncate({0}, {1}) failed: {2}:{3}", path_, max_file_size_, errno, strerror(errno));
+
+			void *ptr = mmap(NULL, max_file_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (ptr == MAP_FAILED)
+				return ff::fmt_err("mmap({0}) failed: {1}:{2}", path_, errno, strerror(errno));
+
+			fd_       = fd;
+			close_fd  = false;
+			map_ptr_  = (char*)ptr;
+			file_pos_ = 0;
+
+			uint32_t const header[2] = { PINBA_DATAGRAM_CAPTURE_MAGIC, PINBA_DATAGRAM_CAPTURE_VERSION };
+			memcpy(map_ptr_, header, sizeof(header));
+			file_pos_ = sizeof(header);
+
+			return {};
+		}
+
+		// cut the file to what's been written, unmapping doesn't lose anything, it's a shared mapping
+		void file_close()
+		{
+			if (fd_ < 0)
+				return;
+
+			munmap(map_ptr_, max_file_size_);
+			map_ptr_ = nullptr;
+
+			if (ftruncate(fd_, file_pos_) < 0)
+				LOG_WARN(globals_->logger(), "dgram_capture; ftruncate({0}, {1}) failed: {2}:{3}", path_, file_pos_, errno, strerror(errno));
+
+			close(fd_);
+			fd_ = -1;
+		}
+
+	private:
+		pinba_globals_t          *globals_;
+		std::string               path_;
+		uint64_t                  max_file_size_;
+
+		std::atomic<ring_t*>      rings_[max_threads]; // by collector thread id, created by that thread
+		std::atomic<bool>         failed_ = {false};   // file error, nothing is captured anymore
+		std::atomic<bool>         stop_   = {false};
+		std::thread               t_;
+
+		// writer thread only (and constructor, before it starts)
+		int                       fd_       = -1;
+		char                     *map_ptr_  = nullptr;
+		uint64_t                  file_pos_ = 0;
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+datagram_capture_ptr create_datagram_capture(pinba_globals_t *globals, std::string const& path, uint64_t max_file_size)
+{
+	return meow::make_unique<aux::datagram_capture_impl_t>(globals, path, max_file_size);
+}
@@ -0,0 +1,399 @@
+#include "pinba_config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <meow/defer.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/dictionary.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define PINBA_DICTIONARY_IMAGE_MAGIC    0x31444250 // "PBD1"
+#define PINBA_DICTIONARY_IMAGE_VERSION  1
+
+namespace { namespace aux {
+
+	struct image_header_t
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t shard_count;
+		uint32_t reserved;
+	};
+	static_assert(sizeof(image_header_t) == 16, "image_header_t must have no padding");
+
+	template<class T>
+	inline void image_put(std::string& out, T const& value)
+	{
+		out.append((char const*)&value, sizeof(value));
+	}
+
+	struct image_cursor_t
+	{
+		uint8_t const *cursor;
+		uint8_t const *end;
+
+		template<class T>
+		bool take(T *value)
+		{
+			if ((size_t)(end - cursor) < sizeof(*value))
+				return false;
+
+			memcpy(value, cursor, sizeof(*value));
+			cursor += sizeof(*value);
+			return true;
+		}
+
+		bool take_str(str_ref *value, uint32_t len)
+		{
+			if ((size_t)(end - cursor) < len)
+				return false;
+
+			*value = str_ref { (char const*)cursor, len };
+			cursor += len;
+			return true;
+		}
+	};
+
+	struct image_word_t
+	{
+		uint32_t  offset;
+		str_ref   str;     // points into mapped file
+		uint64_t  hash;
+	};
+
+}} // namespace { namespace aux {
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+pinba_error_t dictionary_t::image_save(std::string const& path) const
+{
+	std::string out;
+
+	aux::image_put(out, aux::image_header_t {
+		.magic       = PINBA_DICTIONARY_IMAGE_MAGIC,
+		.version     = PINBA_DICTIONARY_IMAGE_VERSION,
+		.shard_count = shard_count_,
+		.reserved    = 0,
+	});
+
+	for (auto const& shard : this->shards())
+	{
+		scoped_read_lock_t lock_(shard.mtx);
+
+		uint32_t const n_slots = shard.words.size();
+		uint32_t const n_words = shard.hash.size();
+
+		aux::image_put(out, n_slots);
+		aux::image_put(out, n_words);
+
+		out.reserve(out.size() + n_words * 8 + shard.strings.mem_used());
+
+		// freelist words have no str
+		for (uint32_t offset = 0; offset < n_slots; offset++)
+		{
+			word_t const& w = shard.words[offset];
+			if (!w.str_p)
+				continue;
+
+			aux::image_put(out, offset);
+			aux::image_put(out, w.str_len);
+			out.append(w.str_p, w.str_len);
+		}
+	}
+
+	aux::image_put(out, uint64_t(t1ha0(out.data(), out.size(), 0)));
+
+	// write + rename, so that readers never see partial files
+	std::string const tmp_path = path + ".tmp";
+
+	int const fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return ff::fmt_err("open({0}) failed: {1}:{2}", tmp_path, errno, strerror(errno));
+
+	bool unlink_tmp = true;
+	MEOW_DEFER(
+		if (unlink_tmp)
+			unlink(tmp_path.c_str());
+	);
+
+	{
+		MEOW_DEFER(
+			close(fd);
+		);
+
+		size_t written = 0;
+		while (written < out.size())
+		{
+			ssize_t const n = ::write(fd, out.data() + written, out.size() - written);
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				return ff::fmt_err("write({0}) failed: {1}:{2}", tmp_path, errno, strerror(errno));
+			}
+			written += n;
+		}
+
+		if (fsync(fd) < 0)
+			return ff::fmt_err("fsync({0}) failed: {1}:{2}", tmp_path, errno, strerror(errno));
+	}
+
+	if (rename(tmp_path.c_str(), path.c_str()) < 0)
+		return ff::fmt_err("rename({0}, {1}) failed: {2}:{3}", tmp_path, path, errno, strerror(errno));
+
+	unlink_tmp = false;
+	return {};
+}
+
+pinba_error_t dictionary_t::image_load(std::string const& path, duration_t hold_time, uint32_t *n_words_loaded)
+{
+	*n_words_loaded = 0;
+
+	int const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return ff::fmt_err("open({0}) failed: {1}:{2}", path, errno, strerror(errno));
+
+	MEOW_DEFER(
+		close(fd);
+	);
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		return ff::fmt_err("fstat({0}) failed: {1}:{2}", path, errno, strerror(errno));
+
+	if ((size_t)st.st_size < sizeof(aux::image_header_t) + sizeof(uint64_t))
+		return ff::fmt_err("{0}: file is too short: {1}", path, st.st_size);
+
+	size_t const map_size = st.st_size;
+	void *map_ptr = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	if (map_ptr == MAP_FAILED)
+		return ff::fmt_err("mmap({0}) failed: {1}:{2}", path, errno, strerror(errno));
+
+	MEOW_DEFER(
+		munmap(map_ptr, map_size);
+	);
+
+	madvise(map_ptr, map_size, MADV_SEQUENTIAL);
+
+	uint8_t const *begin = (uint8_t const*)map_ptr;
+	aux::image_cursor_t c = { begin, begin + map_size - sizeof(uint64_t) };
+
+	uint64_t checksum;
+	memcpy(&checksum, c.end, sizeof(checksum));
+
+	if (checksum != t1ha0(begin, c.end - begin, 0))
+		return ff::fmt_err("{0}: checksum mismatch", path);
+
+	aux::image_header_t header;
+	c.take(&header);
+
+	if (header.magic != PINBA_DICTIONARY_IMAGE_MAGIC || header.version != PINBA_DICTIONARY_IMAGE_VERSION)
+		return ff::fmt_err("{0}: bad magic or unsupported version {1}", path, header.version);
+
+	// word ids have shard id in them, so image can't be resharded (see pinba_dictionary_shards)
+	if (header.shard_count != shard_count_)
+		return ff::fmt_err("{0}: shard count mismatch, file: {1}, ours: {2}", path, header.shard_count, shard_count_);
+
+	// parse and validate everything first, dictionary is only touched if the whole image is fine
+	struct shard_image_t
+	{
+		uint32_t                        n_slots;
+		std::vector<aux::image_word_t>  words;
+	};
+	std::vector<shard_image_t> images(shard_count_);
+
+	for (uint32_t shard_id = 0; shard_id < shard_count_; shard_id++)
+	{
+		shard_image_t& si = images[shard_id];
+
+		uint32_t n_words;
+		if (!c.take(&si.n_slots) || !c.take(&n_words))
+			return ff::fmt_err("{0}: image is truncated", path);
+
+		if (n_words > si.n_slots || si.n_slots > word_id_mask_)
+			return ff::fmt_err("{0}: shard {1}: bad word count {2}/{3}", path, shard_id, n_words, si.n_slots);
+
+		si.words.reserve(n_words);
+
+		for (uint32_t i = 0; i < n_words; i++)
+		{
+			aux::image_word_t iw;
+
+			uint32_t len;
+			if (!c.take(&iw.offset) || !c.take(&len) || !c.take_str(&iw.str, len))
+				return ff::fmt_err("{0}: image is truncated", path);
+
+			if (iw.offset >= si.n_slots || iw.str.empty())
+				return ff::fmt_err("{0}: shard {1}: bad word at offset {2}", path, shard_id, iw.offset);
+
+			// words must land into the same shard, or their ids would change (i.e. hash function has changed)
+			iw.hash = hash_dictionary_word(iw.str);
+			if (get_shard_for_word_hash(iw.hash) != &shards_[shard_id])
+				return ff::fmt_err("{0}: word hash doesn't match shard, image is from an incompatible version", path);
+
+			si.words.push_back(iw);
+		}
+	}
+
+	for (auto const& shard : this->shards())
+	{
+		scoped_read_lock_t lock_(shard.mtx);
+
+		if (shard.words.size() != 0)
+			return ff::fmt_err("{0}: dictionary is not empty, image must be loaded before any words are added", path);
+	}
+
+	// bulk insert, hashtables are sized once, word slots are filled in place (to keep ids) and holes go to freelist
+	std::vector<uint32_t> word_ids;
+	hashtable_t retired_tmp; // never used, hash is reserved upfront
+
+	for (uint32_t shard_id = 0; shard_id < shard_count_; shard_id++)
+	{
+		shard_image_t const& si = images[shard_id];
+		shard_t *shard = &shards_[shard_id];
+
+		scoped_write_lock_t lock_(shard->mtx);
+
+		shard->hash.reserve(si.words.size());
+
+		for (uint32_t offset = 0; offset < si.n_slots; offset++)
+			shard->words.emplace_back();
+
+		for (auto const& iw : si.words)
+		{
+			word_t *w = &shard->words[iw.offset];
+
+			w->refcount = 1; // image reference, see image_release()
+			w->id       = (iw.offset + 1) | (shard->id << shard_id_shift_);
+			w->hash     = iw.hash;
+			w->str_p    = shard->strings.alloc(iw.str);
+			w->str_len  = uint32_t(iw.str.size());
+
+			if (!w->str_p)
+				throw std::bad_alloc();
+
+			w->match_bits.store(matchers_.match(iw.str), std::memory_order_relaxed);
+
+			auto const inserted = shard->hash.emplace_hash(w->hash, w->str(), w, &retired_tmp);
+			if (!inserted.second)
+				return ff::fmt_err("{0}: duplicate word in image", path); // can't really happen, checksum is fine
+
+			word_ids.push_back(w->id);
+		}
+
+		// link holes into freelist, lower offsets are reused first
+		for (uint32_t offset = si.n_slots; offset > 0; offset--)
+		{
+			word_t *w = &shard->words[offset - 1];
+			if (w->id != 0)
+				continue;
+
+			w->next_freelist_offset = shard->freelist_head;
+			shard->freelist_head    = offset;
+		}
+	}
+
+	*n_words_loaded = word_ids.size();
+
+	image_word_ids_   = std::move(word_ids);
+	image_release_tv_ = os_unix::clock_monotonic_now() + hold_time;
+	image_pending_.store(true, std::memory_order_release);
+
+	return {};
+}
+
+void dictionary_t::image_release()
+{
+	if (!image_pending_.exchange(false))
+		return;
+
+	this->erase_words___ref(image_word_ids_.data(), image_word_ids_.size());
+
+	image_word_ids_.clear();
+	image_word_ids_.shrink_to_fit();
+}
+
+dictionary_word_matcher_ptr dictionary_t::add_word_matcher(dictionary_word_match_func_t func)
+{
+	std::lock_guard<std::mutex> lk_(matchers_mtx_);
+
+	uint32_t const free_bits = ~matchers_.active.load(std::memory_order_relaxed);
+	if (free_bits == 0)
+		throw std::runtime_error(ff::fmt_str("dictionary: too many word matchers, max: {0}", dictionary_word_matchers_t::max_matchers));
+
+	uint32_t const bit  = __builtin_ctz(free_bits);
+	uint32_t const mask = uint32_t(1) << bit;
+
+	// words added from now on are tested by writers
+	matchers_.funcs[bit] = std::move(func);
+	matchers_.active.fetch_or(mask, std::memory_order_release);
+
+	auto result = std::make_shared<dictionary_word_matcher_t>(this, bit);
+
+	// and existing ones here, writer lock keeps words from being added or freed under us
+	dictionary_word_match_func_t const& match = matchers_.funcs[bit];
+
+	for (uint32_t i = 0; i < shard_count_; ++i)
+	{
+		shard_t *shard = &shards_[i];
+		scoped_write_lock_t lk_(shard->mtx);
+
+		for (uint32_t offset = 0, n = shard->words.size(); offset < n; offset++)
+		{
+			word_t& w = shard->words[offset];
+			if ((w.id != 0) && match(w.str()))
+				w.match_bits.fetch_or(mask, std::memory_order_relaxed);
+		}
+	}
+
+	permanent_.for_each_word___writers_locked([&](permanent_dictionary_t::word_t& w)
+	{
+		if (match(str_ref { w.str }))
+			w.match_bits.fetch_or(mask, std::memory_order_relaxed);
+	});
+
+	return result;
+}
+
+void dictionary_t::remove_word_matcher(uint32_t bit)
+{
+	std::lock_guard<std::mutex> lk_(matchers_mtx_);
+
+	uint32_t const mask = uint32_t(1) << bit;
+
+	// writers taking locks below after this, will not set the bit anymore
+	matchers_.active.fetch_and(~mask, std::memory_order_release);
+
+	for (uint32_t i = 0; i < shard_count_; ++i)
+	{
+		shard_t *shard = &shards_[i];
+		scoped_write_lock_t lk_(shard->mtx);
+
+		for (uint32_t offset = 0, n = shard->words.size(); offset < n; offset++)
+			shard->words[offset].match_bits.fetch_and(~mask, std::memory_order_relaxed);
+	}
+
+	permanent_.for_each_word___writers_locked([&](permanent_dictionary_t::word_t& w)
+	{
+		w.match_bits.fetch_and(~mask, std::memory_order_relaxed);
+	});
+
+	// no writers can be calling it now, all of them have either seen active bit cleared, or finished before we took their lock
+	matchers_.funcs[bit] = {};
+}
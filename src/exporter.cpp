@@ -0,0 +1,958 @@
+#include "pinba_config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <nanomsg/nn.h>
+#include <nanomsg/pipeline.h>
+
+#include <meow/defer.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+#include <meow/str_ref_algo.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/os_symbols.h"
+#include "pinba/exporter.h"
+#include "pinba/nmsg_socket.h"
+#include "pinba/nmsg_poller.h"
+#include "pinba/histogram.h"
+#include "pinba/report.h"
+#include "pinba/report_by_packet.h"
+#include "pinba/report_by_request.h"
+#include "pinba/report_by_timer.h"
+#include "pinba/snapshot_dictionary.h"
+#include "pinba/thread_pool.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace ff = meow::format;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	inline void put_u8(std::string *out, uint8_t v)
+	{
+		out->push_back(char(v));
+	}
+
+	inline void put_u32(std::string *out, uint32_t v)
+	{
+		char const b[4] = { char(v), char(v >> 8), char(v >> 16), char(v >> 24) };
+		out->append(b, sizeof(b));
+	}
+
+	inline void put_u64(std::string *out, uint64_t v)
+	{
+		put_u32(out, uint32_t(v));
+		put_u32(out, uint32_t(v >> 32));
+	}
+
+	inline void put_bytes(std::string *out, str_ref s)
+	{
+		out->append(s.data(), s.size());
+	}
+
+	// rows per report_snapshot_t::fetch_rows() page
+	constexpr uint32_t const export_fetch_rows = 256;
+
+	struct export_column_t
+	{
+		char const            *name;
+		uint8_t               type;   // PINBA_EXPORT_COLUMN__*
+		std::vector<uint64_t> values;
+	};
+
+	// column names match the ones in mysql tables, where there is a match
+	inline std::vector<export_column_t> export_columns_for_kind(int kind)
+	{
+		switch (kind)
+		{
+			case REPORT_KIND__BY_REQUEST_DATA:
+				return {
+					{ "req_count",      PINBA_EXPORT_COLUMN__COUNT,       {} },
+					{ "time_total",     PINBA_EXPORT_COLUMN__DURATION_NS, {} },
+					{ "ru_utime_total", PINBA_EXPORT_COLUMN__DURATION_NS, {} },
+					{ "ru_stime_total", PINBA_EXPORT_COLUMN__DURATION_NS, {} },
+					{ "traffic_total",  PINBA_EXPORT_COLUMN__COUNT,       {} },
+					{ "memory_footprint_total", PINBA_EXPORT_COLUMN__COUNT, {} },
+					{ "distinct_count", PINBA_EXPORT_COLUMN__COUNT,       {} },
+				};
+
+			case REPORT_KIND__BY_TIMER_DATA:
+				return {
+					{ "req_count",      PINBA_EXPORT_COLUMN__COUNT,       {} },
+					{ "hit_count",      PINBA_EXPORT_COLUMN__COUNT,       {} },
+					{ "time_total",     PINBA_EXPORT_COLUMN__DURATION_NS, {} },
+					{ "ru_utime_total", PINBA_EXPORT_COLUMN__DURATION_NS, {} },
+					{ "ru_stime_total", PINBA_EXPORT_COLUMN__DURATION_NS, {} },
+				};
+
+			case REPORT_KIND__BY_PACKET_DATA:
+				return {
+					{ "req_count",      PINBA_EXPORT_COLUMN__COUNT,       {} },
+					{ "timer_count",    PINBA_EXPORT_COLUMN__COUNT,       {} },
+					{ "time_total",     PINBA_EXPORT_COLUMN__DURATION_NS, {} },
+					{ "ru_utime_total", PINBA_EXPORT_COLUMN__DURATION_NS, {} },
+					{ "ru_stime_total", PINBA_EXPORT_COLUMN__DURATION_NS, {} },
+					{ "traffic_total",  PINBA_EXPORT_COLUMN__COUNT,       {} },
+					{ "memory_footprint_total", PINBA_EXPORT_COLUMN__COUNT, {} },
+				};
+		}
+
+		throw std::logic_error(ff::fmt_str("unknown report kind: {0}", kind));
+	}
+
+	inline void export_row_values(std::vector<export_column_t>& columns, int kind, void const *data)
+	{
+		switch (kind)
+		{
+			case REPORT_KIND__BY_REQUEST_DATA:
+			{
+				auto const *row = static_cast<report_row_data___by_request_t const*>(data);
+				columns[0].values.push_back(row->req_count);
+				columns[1].values.push_back(row->time_total.nsec);
+				columns[2].values.push_back(row->ru_utime.nsec);
+				columns[3].values.push_back(row->ru_stime.nsec);
+				columns[4].values.push_back(row->traffic);
+				columns[5].values.push_back(row->mem_used);
+				columns[6].values.push_back(row->distinct_count);
+			}
+			break;
+
+			case REPORT_KIND__BY_TIMER_DATA:
+			{
+				auto const *row = static_cast<report_row_data___by_timer_t const*>(data);
+				columns[0].values.push_back(row->req_count);
+				columns[1].values.push_back(row->hit_count);
+				columns[2].values.push_back(row->time_total.nsec);
+				columns[3].values.push_back(row->ru_utime.nsec);
+				columns[4].values.push_back(row->ru_stime.nsec);
+			}
+			break;
+
+			case REPORT_KIND__BY_PACKET_DATA:
+			{
+				auto const *row = static_cast<report_row_data___by_packet_t const*>(data);
+				columns[0].values.push_back(row->req_count);
+				columns[1].values.push_back(row->timer_count);
+				columns[2].values.push_back(row->time_total.nsec);
+				columns[3].values.push_back(row->ru_utime.nsec);
+				columns[4].values.push_back(row->ru_stime.nsec);
+				columns[5].values.push_back(row->traffic);
+				columns[6].values.push_back(row->mem_used);
+			}
+			break;
+		}
+	}
+
+	inline void export_error(std::string *out, str_ref message)
+	{
+		put_u32(out, PINBA_EXPORT_MAGIC_ERROR);
+		put_u32(out, uint32_t(message.size()));
+		put_bytes(out, message);
+	}
+
+	// blocking, client socket has SO_SNDTIMEO set
+	inline bool send_all(int fd, str_ref data)
+	{
+		while (!data.empty())
+		{
+			ssize_t const n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				return false;
+			}
+
+			data = str_ref { data.begin() + n, data.end() };
+		}
+
+		return true;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// prometheus label values, backslash, double-quote and line feed must be escaped
+	inline void append_label_value(std::string *out, str_ref value)
+	{
+		for (size_t i = 0; i < value.size(); i++)
+		{
+			char const c = value[i];
+			switch (c)
+			{
+				case '\\': out->append("\\\\", 2); break;
+				case '"':  out->append("\\\"", 2); break;
+				case '\n': out->append("\\n", 2);  break;
+				default:   out->push_back(c);      break;
+			}
+		}
+	}
+
+	inline void append_uint(std::string *out, uint64_t v)
+	{
+		char buf[24];
+		int const n = snprintf(buf, sizeof(buf), "%" PRIu64, v);
+		out->append(buf, n);
+	}
+
+	inline void append_seconds(std::string *out, duration_t d)
+	{
+		char buf[64];
+		int const n = snprintf(buf, sizeof(buf), "%.9f", duration_seconds_as_double(d));
+		out->append(buf, n);
+	}
+
+	struct metric_family_t
+	{
+		char const *name;
+		char const *help;
+		bool        is_duration;
+		uint64_t    (*as_uint)(void const*);
+		duration_t  (*as_duration)(void const*);
+	};
+
+#define METRIC_UINT(Row, name, help, expr) \
+	{ name, help, false, [](void const *p) -> uint64_t { auto const *row = static_cast<Row const*>(p); return (expr); }, nullptr }
+#define METRIC_DURATION(Row, name, help, expr) \
+	{ name, help, true, nullptr, [](void const *p) -> duration_t { auto const *row = static_cast<Row const*>(p); return (expr); } }
+/**/
+
+	inline std::vector<metric_family_t> metric_families_for_kind(int kind)
+	{
+		using request_row_t = report_row_data___by_request_t;
+		using timer_row_t   = report_row_data___by_timer_t;
+		using packet_row_t  = report_row_data___by_packet_t;
+
+		switch (kind)
+		{
+			case REPORT_KIND__BY_REQUEST_DATA:
+				return {
+					METRIC_UINT    (request_row_t, "req_count",              "requests in report time window", row->req_count),
+					METRIC_DURATION(request_row_t, "time_total_seconds",     "total request time", row->time_total),
+					METRIC_DURATION(request_row_t, "ru_utime_seconds",       "total request rusage user time", row->ru_utime),
+					METRIC_DURATION(request_row_t, "ru_stime_seconds",       "total request rusage system time", row->ru_stime),
+					METRIC_UINT    (request_row_t, "traffic_bytes",          "total request traffic", row->traffic),
+					METRIC_UINT    (request_row_t, "memory_footprint_bytes", "total request memory footprint", row->mem_used),
+				};
+
+			case REPORT_KIND__BY_TIMER_DATA:
+				return {
+					METRIC_UINT    (timer_row_t, "req_count",          "requests with the timer in report time window", row->req_count),
+					METRIC_UINT    (timer_row_t, "hit_count",          "timer hits", row->hit_count),
+					METRIC_DURATION(timer_row_t, "time_total_seconds", "total timer time", row->time_total),
+					METRIC_DURATION(timer_row_t, "ru_utime_seconds",   "total timer rusage user time", row->ru_utime),
+					METRIC_DURATION(timer_row_t, "ru_stime_seconds",   "total timer rusage system time", row->ru_stime),
+				};
+
+			case REPORT_KIND__BY_PACKET_DATA:
+				return {
+					METRIC_UINT    (packet_row_t, "req_count",              "requests in report time window", row->req_count),
+					METRIC_UINT    (packet_row_t, "timer_count",            "timers in requests", row->timer_count),
+					METRIC_DURATION(packet_row_t, "time_total_seconds",     "total request time", row->time_total),
+					METRIC_DURATION(packet_row_t, "ru_utime_seconds",       "total request rusage user time", row->ru_utime),
+					METRIC_DURATION(packet_row_t, "ru_stime_seconds",       "total request rusage system time", row->ru_stime),
+					METRIC_UINT    (packet_row_t, "traffic_bytes",          "total request traffic", row->traffic),
+					METRIC_UINT    (packet_row_t, "memory_footprint_bytes", "total request memory footprint", row->mem_used),
+				};
+		}
+
+		throw std::logic_error(ff::fmt_str("unknown report kind: {0}", kind));
+	}
+
+#undef METRIC_UINT
+#undef METRIC_DURATION
+
+	inline void append_family_header(std::string *out, str_ref name, char const *help)
+	{
+		ff::fmt(*out, "# HELP {0} {1}\n", name, help);
+		ff::fmt(*out, "# TYPE {0} gauge\n", name);
+	}
+
+	// <name>{<labels>[,<extra_label>]}, braces only if there are any labels at all
+	inline void append_sample_name(std::string *out, str_ref name, str_ref labels, str_ref extra_label)
+	{
+		out->append(name.data(), name.size());
+
+		if (labels.empty() && extra_label.empty())
+			return;
+
+		out->push_back('{');
+		out->append(labels.data(), labels.size());
+		if (!labels.empty() && !extra_label.empty())
+			out->push_back(',');
+		out->append(extra_label.data(), extra_label.size());
+		out->push_back('}');
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct exporter_impl_t : public exporter_t
+	{
+		// requests are tiny, snapshots can be slow to send to slow clients, don't stall others forever
+		static constexpr size_t   max_request_size = 4096;
+		static constexpr size_t   max_http_request_size = 16 * 1024;
+		static constexpr unsigned socket_timeout_sec = 10;
+
+		exporter_impl_t(pinba_globals_t *globals, exporter_conf_t *conf)
+			: globals_(globals)
+			, conf_(conf)
+			, unix_fd_(-1)
+			, tcp_fd_(-1)
+			, http_fd_(-1)
+		{
+			if (conf_->unix_socket_path.empty() && conf_->tcp_port.empty() && conf_->metrics_port.empty())
+				throw std::runtime_error("exporter_conf_t: at least one of unix_socket_path, tcp_port, metrics_port must be set");
+
+			if (!conf_->get_snapshot)
+				throw std::runtime_error("exporter_conf_t::get_snapshot must be set");
+
+			if (!conf_->metrics_port.empty() && !conf_->get_metrics_confs)
+				throw std::runtime_error("exporter_conf_t::get_metrics_confs must be set, when metrics_port is");
+
+			shutdown_sock_
+				.open(AF_SP, NN_PULL)
+				.bind(conf_->nn_shutdown);
+
+			shutdown_cli_sock_
+				.open(AF_SP, NN_PUSH)
+				.connect(conf_->nn_shutdown);
+		}
+
+		~exporter_impl_t()
+		{
+			this->shutdown();
+		}
+
+		virtual void startup() override
+		{
+			if (thread_.joinable())
+				throw std::logic_error("exporter_t::startup(): already started");
+
+			if (!conf_->unix_socket_path.empty())
+				this->listen_unix_socket();
+
+			if (!conf_->tcp_port.empty())
+			{
+				tcp_fd_ = this->listen_tcp_socket("export", conf_->tcp_address, conf_->tcp_port);
+				LOG_INFO(globals_->logger(), "exporter; serving binary snapshots on {0}:{1}", conf_->tcp_address, conf_->tcp_port);
+			}
+
+			if (!conf_->metrics_port.empty())
+			{
+				http_fd_ = this->listen_tcp_socket("metrics", conf_->metrics_address, conf_->metrics_port);
+				LOG_INFO(globals_->logger(), "exporter; serving /metrics on {0}:{1}", conf_->metrics_address, conf_->metrics_port);
+			}
+
+			thread_ = std::thread([this]()
+			{
+				std::string const thr_name = "exporter";
+
+				PINBA___OS_CALL(globals_, set_thread_name, thr_name);
+
+				MEOW_DEFER(
+					LOG_DEBUG(globals_->logger(), "{0}; exiting", thr_name);
+				);
+
+				this->serve();
+			});
+		}
+
+		virtual void shutdown() override
+		{
+			if (thread_.joinable())
+			{
+				{
+					std::unique_lock<std::mutex> lk_(shutdown_mtx_);
+					shutdown_cli_sock_.send(1);
+				}
+
+				thread_.join();
+			}
+
+			if (unix_fd_ >= 0)
+			{
+				close(unix_fd_);
+				unix_fd_ = -1;
+
+				unlink(conf_->unix_socket_path.c_str());
+			}
+
+			if (tcp_fd_ >= 0)
+			{
+				close(tcp_fd_);
+				tcp_fd_ = -1;
+			}
+
+			if (http_fd_ >= 0)
+			{
+				close(http_fd_);
+				http_fd_ = -1;
+			}
+		}
+
+	private:
+
+		void listen_unix_socket()
+		{
+			struct sockaddr_un addr = {};
+			addr.sun_family = AF_UNIX;
+
+			if (conf_->unix_socket_path.size() >= sizeof(addr.sun_path))
+				throw std::runtime_error(ff::fmt_str("export socket path is too long (max {0}): {1}", sizeof(addr.sun_path) - 1, conf_->unix_socket_path));
+
+			memcpy(addr.sun_path, conf_->unix_socket_path.c_str(), conf_->unix_socket_path.size());
+
+			int const fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+			if (fd < 0)
+				throw std::runtime_error(ff::fmt_str("export socket() failed: {0}:{1}", errno, strerror(errno)));
+
+			bool success = false;
+			MEOW_DEFER(
+				if (!success)
+					close(fd);
+			);
+
+			// leftover from previous run, would fail bind() otherwise
+			unlink(conf_->unix_socket_path.c_str());
+
+			if (::bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+				throw std::runtime_error(ff::fmt_str("export socket bind({0}) failed: {1}:{2}", conf_->unix_socket_path, errno, strerror(errno)));
+
+			if (::listen(fd, 16) < 0)
+				throw std::runtime_error(ff::fmt_str("export socket listen({0}) failed: {1}:{2}", conf_->unix_socket_path, errno, strerror(errno)));
+
+			LOG_INFO(globals_->logger(), "exporter; listening on {0}", conf_->unix_socket_path);
+
+			unix_fd_ = fd;
+			success = true;
+		}
+
+		// what is just for error messages
+		int listen_tcp_socket(char const *what, std::string const& address_str, std::string const& port)
+		{
+			char const *address = (address_str.empty() || address_str == "*") ? nullptr : address_str.c_str();
+
+			struct addrinfo hints = {};
+			hints.ai_family   = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			hints.ai_flags    = AI_PASSIVE;
+
+			struct addrinfo *ai_list = nullptr;
+			int const gai_err = ::getaddrinfo(address, port.c_str(), &hints, &ai_list);
+			if (gai_err != 0)
+				throw std::runtime_error(ff::fmt_str("{0} getaddrinfo({1}, {2}) failed: {3}", what, address_str, port, gai_strerror(gai_err)));
+
+			MEOW_DEFER(
+				freeaddrinfo(ai_list);
+			);
+
+			// first address only, these are scrape endpoints, not public services
+			struct addrinfo const *ai = ai_list;
+
+			int const fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+			if (fd < 0)
+				throw std::runtime_error(ff::fmt_str("{0} socket() failed: {1}:{2}", what, errno, strerror(errno)));
+
+			bool success = false;
+			MEOW_DEFER(
+				if (!success)
+					close(fd);
+			);
+
+			int const one = 1;
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+			if (::bind(fd, ai->ai_addr, ai->ai_addrlen) < 0)
+				throw std::runtime_error(ff::fmt_str("{0} socket bind({1}:{2}) failed: {3}:{4}", what, address_str, port, errno, strerror(errno)));
+
+			if (::listen(fd, 16) < 0)
+				throw std::runtime_error(ff::fmt_str("{0} socket listen({1}:{2}) failed: {3}:{4}", what, address_str, port, errno, strerror(errno)));
+
+			success = true;
+			return fd;
+		}
+
+		template<class Function>
+		void accept_all(int listen_fd, Function const& func)
+		{
+			while (true)
+			{
+				int const client_fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+				if (client_fd < 0)
+				{
+					if (errno == EINTR)
+						continue;
+
+					if (errno != EAGAIN && errno != EWOULDBLOCK)
+						LOG_WARN(globals_->logger(), "exporter; accept() failed: {0}:{1}", errno, strerror(errno));
+					break;
+				}
+
+				MEOW_DEFER(
+					close(client_fd);
+				);
+
+				struct timeval const tv = { .tv_sec = socket_timeout_sec, .tv_usec = 0 };
+				setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+				setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+				func(client_fd);
+			}
+		}
+
+		// read until terminator is seen, false on eof, error, timeout or request being too large
+		bool read_request(int fd, std::string *request, str_ref terminator, size_t max_size)
+		{
+			request->clear();
+
+			while (request->find(terminator.data(), 0, terminator.size()) == std::string::npos)
+			{
+				if (request->size() >= max_size)
+				{
+					LOG_WARN(globals_->logger(), "exporter; request too long, dropping client");
+					return false;
+				}
+
+				char buf[512];
+				ssize_t const n = ::recv(fd, buf, sizeof(buf), 0);
+				if (n < 0 && errno == EINTR)
+					continue;
+
+				if (n <= 0)
+					return false;
+
+				request->append(buf, n);
+			}
+
+			return true;
+		}
+
+		void serve()
+		{
+			nmsg_poller_t poller;
+
+			poller.read_nn_socket(shutdown_sock_, [&](timeval_t)
+			{
+				LOG_DEBUG(globals_->logger(), "exporter; received shutdown request");
+				poller.set_shutdown_flag();
+			});
+
+			// clients are served one at a time, the only slow part is preparing the snapshot
+			// and those are shared between selects and exports within a tick anyway
+			if (unix_fd_ >= 0)
+			{
+				poller.read_plain_fd(unix_fd_, [&](timeval_t)
+				{
+					this->accept_all(unix_fd_, [this](int fd) { this->serve_binary_client(fd); });
+				});
+			}
+
+			if (tcp_fd_ >= 0)
+			{
+				poller.read_plain_fd(tcp_fd_, [&](timeval_t)
+				{
+					this->accept_all(tcp_fd_, [this](int fd) { this->serve_binary_client(fd); });
+				});
+			}
+
+			if (http_fd_ >= 0)
+			{
+				poller.read_plain_fd(http_fd_, [&](timeval_t)
+				{
+					this->accept_all(http_fd_, [this](int fd) { this->serve_http_client(fd); });
+				});
+			}
+
+			poller.loop();
+		}
+
+		void serve_binary_client(int fd)
+		{
+			// read report name
+			std::string request;
+			if (!this->read_request(fd, &request, meow::ref_lit("\n"), max_request_size))
+				return;
+
+			std::string const report_name = request.substr(0, request.find('\n'));
+
+			out_buf_.clear();
+			try
+			{
+				// nodes are asked in parallel, but other clients wait for the slowest one, gathers are expected to be rare
+				str_ref const report_name_ref = report_name;
+				if (meow::prefix_compare(report_name_ref, "gather:"))
+				{
+					if (conf_->gather.nodes.empty())
+						throw std::runtime_error("gather nodes are not configured");
+
+					pinba_error_t const err = snapshot_gather(globals_, conf_->gather, report_name.substr(7), &out_buf_);
+					if (err)
+						throw std::runtime_error(err.what());
+				}
+				else
+				{
+					report_snapshot_ptr snapshot = conf_->get_snapshot(report_name, report_snapshot_t::merge_flags::with_totals);
+					report_snapshot_export_binary(snapshot.get(), &out_buf_, globals_->snapshot_merge_pool());
+				}
+			}
+			catch (std::exception const& e)
+			{
+				LOG_DEBUG(globals_->logger(), "exporter; export of '{0}' failed: {1}", report_name, e.what());
+
+				out_buf_.clear();
+				export_error(&out_buf_, str_ref { e.what(), strlen(e.what()) });
+			}
+
+			if (!send_all(fd, out_buf_))
+				LOG_DEBUG(globals_->logger(), "exporter; send() of '{0}' failed: {1}:{2}", report_name, errno, strerror(errno));
+		}
+
+		void serve_http_client(int fd)
+		{
+			std::string request;
+			if (!this->read_request(fd, &request, meow::ref_lit("\r\n\r\n"), max_http_request_size))
+				return;
+
+			str_ref const request_ref = request;
+			bool const is_metrics = meow::prefix_compare(request_ref, "GET /metrics ") || meow::prefix_compare(request_ref, "GET /metrics?");
+
+			if (!is_metrics)
+			{
+				static char const not_found[] = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+				send_all(fd, meow::ref_lit(not_found));
+				return;
+			}
+
+			// body goes to the reusable buffer, after space reserved for headers
+			out_buf_.clear();
+
+			for (auto const& mconf : conf_->get_metrics_confs())
+			{
+				report_snapshot_t::merge_flags_t flags = report_snapshot_t::merge_flags::with_totals;
+				if (!mconf->percentiles.empty())
+					flags |= report_snapshot_t::merge_flags::with_histograms;
+
+				try
+				{
+					report_snapshot_ptr snapshot = conf_->get_snapshot(mconf->report_name, flags);
+					report_snapshot_export_prometheus(snapshot.get(), *mconf, &out_buf_, &metrics_scratch_);
+				}
+				catch (std::exception const& e)
+				{
+					// report might have been deleted meanwhile, skip it
+					LOG_DEBUG(globals_->logger(), "exporter; metrics for '{0}' failed: {1}", mconf->report_name, e.what());
+				}
+			}
+
+			header_buf_.clear();
+			ff::fmt(header_buf_,
+				"HTTP/1.0 200 OK\r\n"
+				"Content-Type: text/plain; version=0.0.4\r\n"
+				"Content-Length: {0}\r\n"
+				"Connection: close\r\n"
+				"\r\n", out_buf_.size());
+
+			if (!send_all(fd, header_buf_) || !send_all(fd, out_buf_))
+				LOG_DEBUG(globals_->logger(), "exporter; send() of /metrics failed: {0}:{1}", errno, strerror(errno));
+		}
+
+	private:
+		pinba_globals_t          *globals_;
+		exporter_conf_t          *conf_;
+
+		int                      unix_fd_;
+		int                      tcp_fd_;
+		int                      http_fd_;
+
+		nmsg_socket_t            shutdown_sock_;
+		nmsg_socket_t            shutdown_cli_sock_;
+		std::mutex               shutdown_mtx_;
+
+		std::thread              thread_;
+
+		// reused between clients, i.e. after a few scrapes nothing is allocated anymore
+		std::string               out_buf_;
+		std::string               header_buf_;
+		report_metrics_scratch_t  metrics_scratch_;
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void report_snapshot_export_binary(report_snapshot_t *snapshot, std::string *out, thread_pool_t *pool)
+{
+	auto const *rinfo = snapshot->report_info();
+
+	int const      kind        = snapshot->data_kind();
+	uint32_t const n_key_parts = rinfo->n_key_parts;
+
+	// single pass over the snapshot, columns are gathered here and written after that
+	// with a pool, every range gathers its own columns, which are then appended in range order
+	struct gathered_t
+	{
+		std::vector<aux::export_column_t>   columns;
+		std::vector<std::vector<uint32_t>>  key_columns;
+		uint64_t                            n_rows = 0;
+	};
+
+	constexpr size_t const parallel_min_rows = 64 * 1024; // below that threads cost more than they save
+
+	size_t const n_rows_hint = snapshot->row_count();
+	uint32_t const n_ranges  = (pool && n_rows_hint >= parallel_min_rows) ? pool->thread_count() + 1 : 1;
+
+	std::vector<report_snapshot_t::position_t> const bounds = snapshot->pos_split(n_ranges);
+	std::vector<gathered_t> ranges(bounds.size() - 1);
+
+	auto const gather_range = [&](size_t range_id)
+	{
+		gathered_t& g = ranges[range_id];
+		g.columns = aux::export_columns_for_kind(kind);
+		g.key_columns.resize(n_key_parts);
+
+		size_t const reserve_rows = n_rows_hint / ranges.size() + 1;
+		for (auto& c : g.columns)
+			c.values.reserve(reserve_rows);
+		for (auto& kc : g.key_columns)
+			kc.reserve(reserve_rows);
+
+		report_snapshot_t::row_batch_t batch;
+
+		auto pos = bounds[range_id];
+		while (uint32_t const n = snapshot->fetch_rows(&pos, bounds[range_id + 1], aux::export_fetch_rows, &batch, false))
+		{
+			for (uint32_t row = 0; row < n; row++)
+			{
+				report_key_t const& key = batch.keys[row];
+				for (uint32_t i = 0; i < n_key_parts; i++)
+					g.key_columns[i].push_back(key[i]);
+
+				aux::export_row_values(g.columns, kind, batch.data[row]);
+			}
+			g.n_rows += n;
+		}
+	};
+
+	if (ranges.size() == 1)
+	{
+		gather_range(0);
+	}
+	else
+	{
+		std::vector<thread_pool_t::task_t> tasks;
+		tasks.reserve(ranges.size());
+		for (size_t i = 0; i < ranges.size(); i++)
+			tasks.push_back([&gather_range, i]() { gather_range(i); });
+
+		thread_pool___run_and_wait(pool, tasks);
+
+		// append the rest to the first range
+		gathered_t& first = ranges[0];
+		for (size_t r = 1; r < ranges.size(); r++)
+		{
+			gathered_t& g = ranges[r];
+
+			for (size_t i = 0; i < first.columns.size(); i++)
+				first.columns[i].values.insert(first.columns[i].values.end(), g.columns[i].values.begin(), g.columns[i].values.end());
+			for (uint32_t i = 0; i < n_key_parts; i++)
+				first.key_columns[i].insert(first.key_columns[i].end(), g.key_columns[i].begin(), g.key_columns[i].end());
+
+			first.n_rows += g.n_rows;
+			g = gathered_t {};
+		}
+	}
+
+	std::vector<aux::export_column_t>&  columns     = ranges[0].columns;
+	std::vector<std::vector<uint32_t>>& key_columns = ranges[0].key_columns;
+	uint64_t const                      n_rows      = ranges[0].n_rows;
+
+	// string table, each word once
+	std::vector<uint32_t> word_ids;
+	for (auto const& kc : key_columns)
+		word_ids.insert(word_ids.end(), kc.begin(), kc.end());
+
+	std::sort(word_ids.begin(), word_ids.end());
+	word_ids.erase(std::unique(word_ids.begin(), word_ids.end()), word_ids.end());
+	if (!word_ids.empty() && word_ids[0] == 0)
+		word_ids.erase(word_ids.begin());
+
+	// header
+	aux::put_u32(out, PINBA_EXPORT_MAGIC);
+	aux::put_u32(out, PINBA_EXPORT_VERSION);
+	aux::put_u32(out, uint32_t(kind));
+	aux::put_u64(out, uint64_t(rinfo->time_window.nsec));
+	aux::put_u32(out, n_key_parts);
+	aux::put_u32(out, uint32_t(columns.size()));
+	aux::put_u64(out, n_rows);
+	aux::put_u32(out, uint32_t(word_ids.size()));
+
+	// words come from snapshot ticks and are alive as long as the snapshot is
+	auto const *d = snapshot->dictionary();
+	for (uint32_t const word_id : word_ids)
+	{
+		str_ref const word = d->get_word(word_id);
+		aux::put_u32(out, word_id);
+		aux::put_u32(out, uint32_t(word.size()));
+		aux::put_bytes(out, word);
+	}
+
+	out->reserve(out->size() + n_rows * (n_key_parts * sizeof(uint32_t) + columns.size() * sizeof(uint64_t)));
+
+	for (auto const& kc : key_columns)
+	{
+		for (uint32_t const word_id : kc)
+			aux::put_u32(out, word_id);
+	}
+
+	for (auto const& c : columns)
+	{
+		size_t const name_len = strlen(c.name);
+
+		aux::put_u8(out, uint8_t(name_len));
+		aux::put_bytes(out, str_ref { c.name, name_len });
+		aux::put_u8(out, c.type);
+
+		for (uint64_t const v : c.values)
+			aux::put_u64(out, v);
+	}
+}
+
+void report_snapshot_export_prometheus(report_snapshot_t *snapshot, report_metrics_conf_t const& mconf, std::string *out, report_metrics_scratch_t *scratch)
+{
+	auto const *rinfo = snapshot->report_info();
+
+	int const      kind        = snapshot->data_kind();
+	uint32_t const n_key_parts = std::min<uint32_t>(rinfo->n_key_parts, mconf.key_names.size());
+
+	// label sets are rendered once per row and reused by every family
+	scratch->labels.clear();
+	scratch->label_offsets.clear();
+	scratch->positions.clear();
+
+	// snapshot own snapshot_dictionary() might be used by other readers, words are alive as long as snapshot is
+	snapshot_dictionary_t const snap_d { snapshot->dictionary(), snapshot_dictionary_t::size_hint_for(snapshot->row_count(), rinfo->n_key_parts) };
+
+	auto pos = snapshot->pos_first();
+	while (uint32_t const n = snapshot->fetch_rows(&pos, snapshot->pos_last(), aux::export_fetch_rows, &scratch->batch, false))
+	{
+		scratch->key_words.resize(size_t(n) * rinfo->n_key_parts);
+		snap_d.get_key_words(scratch->batch.keys.data(), n, rinfo->n_key_parts, scratch->key_words.data());
+
+		for (uint32_t row = 0; row < n; row++)
+		{
+			scratch->positions.push_back(scratch->batch.pos[row]);
+			scratch->label_offsets.push_back(scratch->labels.size());
+
+			str_ref const *words = &scratch->key_words[size_t(row) * rinfo->n_key_parts];
+			for (uint32_t i = 0; i < n_key_parts; i++)
+			{
+				if (i > 0)
+					scratch->labels.push_back(',');
+
+				scratch->labels.append(mconf.key_names[i]);
+				scratch->labels.append("=\"", 2);
+				aux::append_label_value(&scratch->labels, words[i]);
+				scratch->labels.push_back('"');
+			}
+		}
+	}
+	scratch->label_offsets.push_back(scratch->labels.size());
+
+	auto const labels_at = [&](size_t row_i) -> str_ref
+	{
+		char const *base = scratch->labels.data();
+		return str_ref { base + scratch->label_offsets[row_i], base + scratch->label_offsets[row_i + 1] };
+	};
+
+	std::string family_name;
+
+	for (auto const& family : aux::metric_families_for_kind(kind))
+	{
+		family_name.assign(mconf.prefix);
+		family_name.push_back('_');
+		family_name.append(family.name);
+
+		aux::append_family_header(out, family_name, family.help);
+
+		for (size_t row_i = 0; row_i < scratch->positions.size(); row_i++)
+		{
+			void const *data = snapshot->get_data(scratch->positions[row_i]);
+
+			aux::append_sample_name(out, family_name, labels_at(row_i), {});
+			out->push_back(' ');
+
+			if (family.is_duration)
+				aux::append_seconds(out, family.as_duration(data));
+			else
+				aux::append_uint(out, family.as_uint(data));
+
+			out->push_back('\n');
+		}
+	}
+
+	if (mconf.percentiles.empty())
+		return;
+
+	family_name.assign(mconf.prefix);
+	family_name.append("_time_seconds");
+
+	aux::append_family_header(out, family_name, "time percentiles, quantile label is percentile / 100");
+
+	auto const *hv_conf = snapshot->histogram_conf();
+
+	std::vector<std::string> quantile_labels;
+	for (double const percentile : mconf.percentiles)
+	{
+		char buf[64];
+		int const n = snprintf(buf, sizeof(buf), "quantile=\"%g\"", percentile / 100.0);
+		quantile_labels.emplace_back(buf, n);
+	}
+
+	size_t const n_percentiles = mconf.percentiles.size();
+	duration_t   values[n_percentiles];
+
+	for (size_t row_i = 0; row_i < scratch->positions.size(); row_i++)
+	{
+		// might be gathered lazily for shared snapshots, so once per row
+		void const *histogram = snapshot->get_histogram(scratch->positions[row_i]);
+		if (histogram == nullptr)
+			continue;
+
+		// all percentiles in one histogram scan
+		if (HISTOGRAM_KIND__FLAT == rinfo->hv_kind)
+			get_percentiles(*static_cast<flat_histogram_t const*>(histogram), *hv_conf, mconf.percentiles.data(), n_percentiles, values);
+		else if (HISTOGRAM_KIND__HDR == rinfo->hv_kind)
+			get_percentiles(*static_cast<hdr_histogram_t const*>(histogram), *hv_conf, mconf.percentiles.data(), n_percentiles, values);
+		else
+			continue;
+
+		for (size_t pct_i = 0; pct_i < n_percentiles; pct_i++)
+		{
+			aux::append_sample_name(out, family_name, labels_at(row_i), quantile_labels[pct_i]);
+			out->push_back(' ');
+			aux::append_seconds(out, values[pct_i]);
+			out->push_back('\n');
+		}
+	}
+}
+
+exporter_ptr create_exporter(pinba_globals_t *globals, exporter_conf_t *conf)
+{
+	return meow::make_unique<aux::exporter_impl_t>(globals, conf);
+}
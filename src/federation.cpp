@@ -0,0 +1,255 @@
+#include "pinba_config.h"
+
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <nanomsg/nn.h>
+#include <nanomsg/pipeline.h>
+
+#include <meow/defer.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/os_symbols.h"
+#include "pinba/federation.h"
+#include "pinba/nmsg_socket.h"
+#include "pinba/nmsg_poller.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct federation_sender_impl_t : public federation_sender_t
+	{
+		// ticks are sent once a tick interval, in a burst from all reports
+		static constexpr int socket_sndbuf = 16 * 1024 * 1024;
+
+		federation_sender_impl_t(pinba_globals_t *globals, std::string const& upstream)
+			: globals_(globals)
+		{
+			// connect is async, nanomsg reconnects by itself when upstream goes away
+			sock_
+				.open(AF_SP, NN_PUSH)
+				.set_option(NN_SOL_SOCKET, NN_SNDBUF, socket_sndbuf, "federation")
+				.connect(upstream);
+		}
+
+		virtual void send_tick(str_ref report_name, std::string const& tick_data) override
+		{
+			uint32_t const magic    = PINBA_FEDERATION_MAGIC;
+			uint32_t const name_len = report_name.size();
+
+			std::string msg;
+			msg.reserve(sizeof(magic) + sizeof(name_len) + name_len + tick_data.size());
+			msg.append((char const*)&magic, sizeof(magic));
+			msg.append((char const*)&name_len, sizeof(name_len));
+			msg.append(report_name.data(), report_name.size());
+			msg.append(tick_data);
+
+			int const n = nn_send(*sock_, msg.data(), msg.size(), NN_DONTWAIT);
+			if (n < 0)
+			{
+				++globals_->stats()->federation.ticks_send_err;
+				return;
+			}
+
+			++globals_->stats()->federation.ticks_sent;
+		}
+
+	private:
+		pinba_globals_t  *globals_;
+		nmsg_socket_t    sock_;
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct federation_receiver_impl_t : public federation_receiver_t
+	{
+		static constexpr size_t max_messages_per_poll_iteration = 64;
+
+		federation_receiver_impl_t(pinba_globals_t *globals, federation_receiver_conf_t *conf)
+			: globals_(globals)
+			, conf_(conf)
+		{
+			if (!conf_->merge_tick)
+				throw std::runtime_error("federation_receiver_conf_t::merge_tick must be set");
+
+			shutdown_sock_
+				.open(AF_SP, NN_PULL)
+				.bind(conf_->nn_shutdown);
+
+			shutdown_cli_sock_
+				.open(AF_SP, NN_PUSH)
+				.connect(conf_->nn_shutdown);
+		}
+
+		~federation_receiver_impl_t()
+		{
+			this->shutdown();
+		}
+
+		virtual void startup() override
+		{
+			if (thread_.joinable())
+				throw std::logic_error("federation_receiver_t::startup(): already started");
+
+			// ticks of large reports are way over default max message size (1mb)
+			sock_
+				.open(AF_SP, NN_PULL)
+				.set_option(NN_SOL_SOCKET, NN_RCVMAXSIZE, -1, "federation")
+				.bind(conf_->listen);
+
+			thread_ = std::thread([this]()
+			{
+				std::string const thr_name = "federation";
+
+				PINBA___OS_CALL(globals_, set_thread_name, thr_name);
+
+				MEOW_DEFER(
+					LOG_DEBUG(globals_->logger(), "{0}; exiting", thr_name);
+				);
+
+				this->serve();
+			});
+		}
+
+		virtual void shutdown() override
+		{
+			if (thread_.joinable())
+			{
+				{
+					std::unique_lock<std::mutex> lk_(shutdown_mtx_);
+					shutdown_cli_sock_.send(1);
+				}
+
+				thread_.join();
+			}
+
+			sock_.close();
+		}
+
+	private:
+
+		void serve()
+		{
+			nmsg_poller_t poller;
+
+			poller.read_nn_socket(shutdown_sock_, [&](timeval_t)
+			{
+				LOG_DEBUG(globals_->logger(), "federation; received shutdown request");
+				poller.set_shutdown_flag();
+			});
+
+			poller.read_nn_socket(sock_, [&](timeval_t)
+			{
+				for (size_t i = 0; i < max_messages_per_poll_iteration; i++)
+				{
+					if (!this->recv_one())
+						break;
+				}
+			});
+
+			poller.loop();
+		}
+
+		bool recv_one()
+		{
+			void *buf = nullptr;
+
+			int const n = nn_recv(*sock_, &buf, NN_MSG, NN_DONTWAIT);
+			if (n < 0)
+			{
+				int const err = nn_errno();
+				if (err != EAGAIN)
+					LOG_WARN(globals_->logger(), "federation; nn_recv() failed: {0}:{1}", err, nn_strerror(err));
+				return false;
+			}
+
+			MEOW_DEFER(
+				nn_freemsg(buf);
+			);
+
+			++globals_->stats()->federation.ticks_received;
+
+			str_ref const msg = { (char const*)buf, size_t(n) };
+
+			uint32_t magic, name_len;
+			if ((msg.size() < sizeof(magic) + sizeof(name_len)))
+			{
+				this->merge_failed({}, "message is too short");
+				return true;
+			}
+
+			memcpy(&magic, msg.data(), sizeof(magic));
+			memcpy(&name_len, msg.data() + sizeof(magic), sizeof(name_len));
+
+			size_t const name_offset = sizeof(magic) + sizeof(name_len);
+
+			if (magic != PINBA_FEDERATION_MAGIC || (msg.size() - name_offset) < name_len)
+			{
+				this->merge_failed({}, "bad magic or truncated message");
+				return true;
+			}
+
+			std::string const report_name = { msg.data() + name_offset, name_len };
+			std::string       tick_data   = { msg.data() + name_offset + name_len, msg.size() - name_offset - name_len };
+
+			try
+			{
+				pinba_error_t const err = conf_->merge_tick(report_name, std::move(tick_data));
+				if (err)
+					this->merge_failed(report_name, err.what());
+			}
+			catch (std::exception const& e)
+			{
+				this->merge_failed(report_name, e.what());
+			}
+
+			return true;
+		}
+
+		void merge_failed(str_ref report_name, str_ref error)
+		{
+			++globals_->stats()->federation.ticks_merge_err;
+
+			// edges keep sending every tick, don't flood the log
+			timeval_t const now = os_unix::clock_monotonic_now();
+			if (now < next_warn_tv_)
+				return;
+
+			next_warn_tv_ = now + timeval_from_duration(10 * d_second);
+			LOG_WARN(globals_->logger(), "federation; remote tick for report '{0}' dropped: {1}", report_name, error);
+		}
+
+	private:
+		pinba_globals_t             *globals_;
+		federation_receiver_conf_t  *conf_;
+
+		nmsg_socket_t               sock_;
+
+		nmsg_socket_t               shutdown_sock_;
+		nmsg_socket_t               shutdown_cli_sock_;
+		std::mutex                  shutdown_mtx_;
+
+		std::thread                 thread_;
+
+		timeval_t                   next_warn_tv_ = {0,0};
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+federation_sender_ptr create_federation_sender(pinba_globals_t *globals, std::string const& upstream)
+{
+	return meow::make_unique<aux::federation_sender_impl_t>(globals, upstream);
+}
+
+federation_receiver_ptr create_federation_receiver(pinba_globals_t *globals, federation_receiver_conf_t *conf)
+{
+	return meow::make_unique<aux::federation_receiver_impl_t>(globals, conf);
+}
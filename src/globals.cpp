@@ -1,6 +1,12 @@
 #include "pinba_config.h"
 
+#include <unistd.h> // access
+
+#include <algorithm>
+#include <map>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <nanomsg/pipeline.h>
 #include <nanomsg/pubsub.h>
@@ -8,14 +14,24 @@
 
 #define MEOW_FORMAT_FD_SINK_NO_WRITEV 1
 #include <meow/logging/fd_logger.hpp>
+#include <meow/stopwatch.hpp>
 
 #include "pinba/globals.h"
 #include "pinba/os_symbols.h"
+#include "pinba/block_allocator.h"
 #include "pinba/engine.h"
 #include "pinba/dictionary.h"
 #include "pinba/coordinator.h"
 #include "pinba/collector.h"
+#include "pinba/exporter.h"
+#include "pinba/federation.h"
 #include "pinba/repacker.h"
+#include "pinba/thread_pool.h"
+#include "pinba/pipeline_latency.h"
+#include "pinba/packet_capture.h"
+#include "pinba/datagram_capture.h"
+#include "pinba/reclaimer.h"
+#include "pinba/async_log.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 namespace { namespace aux {
@@ -30,13 +46,63 @@ namespace { namespace aux {
 					? options->logger
 					: std::make_shared<meow::logging::fd_logger_t<meow::logging::empty_prefix_t>>(STDERR_FILENO);
 
+			// before anything else, so that all nmpa-s get blocks from it
+			{
+				block_allocator_conf_t const balloc_conf = {
+					.mode               = options->nmpa_block_allocator,
+					.numa_local         = options->nmpa_block_allocator_numa,
+					.thread_cache_bytes = 4 * 1024 * 1024,
+					.depot_max_bytes    = 256 * 1024 * 1024,
+				};
+
+				pinba_error_t const err = block_allocator___install(this, balloc_conf);
+				if (err)
+					throw std::runtime_error(ff::fmt_str("nmpa block allocator: {0}", err.what()));
+			}
+
 			// ticker_     = meow::make_unique<nmsg_ticker___single_thread_t>();
-			dictionary_ = meow::make_unique<dictionary_t>();
+			dictionary_ = meow::make_unique<dictionary_t>(options->permanent_dictionary_fields, options->dictionary_shards);
 
 			// NOTE: passing not fully constructed this ptr is fine here
 			//       but it's a fine line to walk, mon
 			os_symbols_ = pinba_os_symbols___init(this);
 
+			async_log_ = create_async_log(this);
+
+			if (options->snapshot_merge_threads > 0)
+			{
+				thread_pool_conf_t const pool_conf = {
+					.name      = "snapshot_merge",
+					.n_threads = options->snapshot_merge_threads,
+					.sched     = options->snapshot_merge_sched,
+				};
+				snapshot_merge_pool_ = create_thread_pool(this, pool_conf);
+			}
+
+			if (options->tick_finalize_threads > 0)
+			{
+				thread_pool_conf_t const pool_conf = {
+					.name      = "tick_finalize",
+					.n_threads = options->tick_finalize_threads,
+					.sched     = options->report_sched,
+				};
+				tick_finalize_pool_ = create_thread_pool(this, pool_conf);
+			}
+
+			pipeline_latency_ = create_pipeline_latency(this);
+
+			if (!options->federation_upstream.empty())
+				federation_sender_ = create_federation_sender(this, options->federation_upstream);
+
+			if (options->packet_capture_size > 0)
+				packet_capture_ = create_packet_capture(this, options->packet_capture_size, options->packet_capture_sample);
+
+			if (!options->datagram_capture_path.empty())
+				datagram_capture_ = create_datagram_capture(this, options->datagram_capture_path, options->datagram_capture_file_size);
+
+			if (options->reclaim_thread)
+				reclaimer_ = create_reclaimer(this);
+
 			stats_.start_tv          = os_unix::clock_monotonic_now();
 			stats_.start_realtime_tv = os_unix::clock_gettime_ex(CLOCK_REALTIME);
 		}
@@ -79,6 +145,46 @@ namespace { namespace aux {
 			return os_symbols_.get();
 		}
 
+		virtual thread_pool_t*         snapshot_merge_pool() const override
+		{
+			return snapshot_merge_pool_.get();
+		}
+
+		virtual thread_pool_t*         tick_finalize_pool() const override
+		{
+			return tick_finalize_pool_.get();
+		}
+
+		virtual pipeline_latency_t*    pipeline_latency() const override
+		{
+			return pipeline_latency_.get();
+		}
+
+		virtual federation_sender_t*   federation_sender() const override
+		{
+			return federation_sender_.get();
+		}
+
+		virtual packet_capture_t*      packet_capture() const override
+		{
+			return packet_capture_.get();
+		}
+
+		virtual datagram_capture_t*    datagram_capture() const override
+		{
+			return datagram_capture_.get();
+		}
+
+		virtual reclaimer_t*           reclaimer() const override
+		{
+			return reclaimer_.get();
+		}
+
+		virtual async_log_t*           async_log() const override
+		{
+			return async_log_.get();
+		}
+
 	private:
 		pinba_options_t                *options_;
 
@@ -86,6 +192,14 @@ namespace { namespace aux {
 		pinba_stats_t                  stats_;
 		std::unique_ptr<dictionary_t>  dictionary_;
 		pinba_os_symbols_ptr           os_symbols_;
+		async_log_ptr                  async_log_;
+		thread_pool_ptr                snapshot_merge_pool_;
+		thread_pool_ptr                tick_finalize_pool_;
+		pipeline_latency_ptr           pipeline_latency_;
+		federation_sender_ptr          federation_sender_;
+		packet_capture_ptr             packet_capture_;
+		datagram_capture_ptr           datagram_capture_;
+		reclaimer_ptr                  reclaimer_;        // last, things it frees might need anything above
 	};
 
 
@@ -113,6 +227,24 @@ namespace { namespace aux {
 		{
 			auto const *options = this->options();
 
+			// before any traffic, words get their previous ids back (see dictionary_t::image_load())
+			if (!options->history_dir.empty())
+				this->dictionary_image_load();
+
+			// traffic is spread over per-thread SO_REUSEPORT sockets
+			double const udp_rcvbuf_total = double(options->udp_rcvbuf_traffic_mb) * 1024 * 1024 * duration_seconds_as_double(options->udp_rcvbuf_time);
+			size_t const udp_socket_rcvbuf_size = size_t(udp_rcvbuf_total / std::max<uint32_t>(1, options->udp_threads));
+
+			// in-process rings between stages, or nanomsg inproc sockets (when rings are empty)
+			nmsg_ring_ptr<raw_request_t>  raw_request_ring;
+			nmsg_ring_ptr<packet_batch_t> packet_batch_ring;
+
+			if (options->pipeline_rings)
+			{
+				raw_request_ring  = nmsg_ring_create<raw_request_t>(std::max<uint32_t>(64, options->repacker_input_buffer), "udp-collector");
+				packet_batch_ring = nmsg_ring_create<packet_batch_t>(std::max<uint32_t>(64, options->coordinator_input_buffer), "repacker");
+			}
+
 			static collector_conf_t collector_conf = {
 				.address       = options->net_address,
 				.port          = options->net_port,
@@ -121,9 +253,31 @@ namespace { namespace aux {
 				.n_threads     = options->udp_threads,
 				.batch_size    = options->udp_batch_messages,
 				.batch_timeout = options->udp_batch_timeout,
+				.backend       = options->udp_backend,
+				.xdp_interface = options->udp_xdp_interface,
+				.defer_decode  = options->packet_wire_decoder,
+				.cpus          = options->udp_cpus,
+				.sched         = options->udp_sched,
+				.cpu_steering  = options->udp_cpu_steering,
+				.socket_rcvbuf_size = udp_socket_rcvbuf_size,
+				.out_ring      = raw_request_ring,
+				.busy_poll_spins = options->udp_busy_poll_spins,
+				.busy_poll_usec  = options->udp_busy_poll_usec,
+				.gro             = options->udp_gro,
 			};
 			collector_ = create_collector(this->globals(), &collector_conf);
 
+			// with cpu steering, repackers stay on reader cpus (and their numa node), unless placed explicitly
+			pinba_cpu_list_t repacker_cpus = options->repacker_cpus;
+			if (options->udp_cpu_steering && repacker_cpus.empty())
+			{
+				for (uint32_t i = 0; i < collector_conf.n_threads; i++)
+					repacker_cpus.push_back(collector_conf___steering_cpu(&collector_conf, i));
+
+				std::sort(repacker_cpus.begin(), repacker_cpus.end());
+				repacker_cpus.erase(std::unique(repacker_cpus.begin(), repacker_cpus.end()), repacker_cpus.end());
+			}
+
 			static repacker_conf_t repacker_conf = {
 				.nn_input        = collector_conf.nn_output,
 				.nn_output       = "inproc://repacker",
@@ -132,6 +286,19 @@ namespace { namespace aux {
 				.n_threads       = options->repacker_threads,
 				.batch_size      = options->repacker_batch_messages,
 				.batch_timeout   = options->repacker_batch_timeout,
+				.cpus            = repacker_cpus,
+				.sched           = options->repacker_sched,
+				.in_ring         = raw_request_ring,
+				.out_ring        = packet_batch_ring,
+				.dictionary_reap_words = options->repacker_dictionary_reap_words,
+				.dictionary_prefetch   = options->repacker_dictionary_prefetch,
+				.columnar_batches      = options->repacker_columnar_batches,
+				.batch_latency_target  = options->repacker_batch_latency_target,
+				.batch_fill_target     = (options->repacker_batch_fill_target > 0) ? std::min(options->repacker_batch_fill_target, 1.0) : 1.0,
+				.relay_upstream        = options->relay_upstream,
+				.relay_listen          = options->relay_listen,
+				.sample_rate_tag       = options->sample_rate_tag,
+				.ingest_budget         = options->ingest_budget,
 			};
 			repacker_ = create_repacker(this->globals(), &repacker_conf);
 
@@ -140,21 +307,137 @@ namespace { namespace aux {
 				.nn_input_buffer        = options->coordinator_input_buffer,
 				.nn_control             = "inproc://coordinator/control",
 				.nn_report_input_buffer = options->report_input_buffer,
+				.relay_cpus             = options->relay_cpus,
+				.relay_sched            = options->relay_sched,
+				.relay_threads          = options->relay_threads,
+				.report_cpus            = options->report_cpus,
+				.report_sched           = options->report_sched,
+				.snapshot_merge_sched   = options->snapshot_merge_sched,
+				.on_packet_prefilter    = [this](packet_prefilter_ptr prefilter)
+				{
+					// relay-only, packets are for upstream reports, local ones (if any) get nothing anyway
+					if (!globals_->options()->relay_upstream.empty())
+						return;
+
+					repacker_->set_packet_prefilter(std::move(prefilter));
+				},
+				.in_ring                = packet_batch_ring,
+				.report_ring_size       = (options->pipeline_rings) ? std::max<uint32_t>(64, options->report_input_buffer) : 0,
+				.report_fuse_max        = options->report_fuse_max,
+				.report_executor_threads = options->report_executor_threads,
+				.report_tick_stagger    = options->report_tick_stagger,
+				.snapshot_prewarm_min_qpm = options->snapshot_prewarm_min_qpm,
+				.snapshot_prewarm_max_mem = options->snapshot_prewarm_max_mem,
 			};
 			coordinator_ = create_coordinator(this->globals(), &coordinator_conf);
 
 			coordinator_->startup();
 			repacker_->startup();
 			collector_->startup();
+
+			if (!options->export_socket_path.empty() || !options->export_port.empty() || !options->metrics_port.empty())
+			{
+				static exporter_conf_t exporter_conf = {
+					.unix_socket_path = options->export_socket_path,
+					.tcp_address      = options->export_address,
+					.tcp_port         = options->export_port,
+					.metrics_address  = options->metrics_address,
+					.metrics_port     = options->metrics_port,
+					.nn_shutdown      = "inproc://exporter/shutdown",
+					.get_snapshot     = [this](std::string const& name, report_snapshot_t::merge_flags_t flags)
+					{
+						// exports are selects of sorts, share prepared snapshots with them
+						return coordinator_->get_prepared_report_snapshot(name, flags);
+					},
+					.get_metrics_confs = [this]()
+					{
+						std::vector<report_metrics_conf_ptr> result;
+
+						std::lock_guard<std::mutex> lk_(metrics_mtx_);
+						for (auto const& pair : metrics_confs_)
+							result.push_back(pair.second);
+
+						return result;
+					},
+					.gather = {
+						.nodes   = snapshot_gather___parse_nodes(options->gather_nodes),
+						.timeout = 10 * d_second,
+					},
+				};
+				exporter_ = create_exporter(this->globals(), &exporter_conf);
+				exporter_->startup();
+			}
+
+			if (!options->federation_listen.empty())
+			{
+				static federation_receiver_conf_t federation_conf = {
+					.listen      = options->federation_listen,
+					.nn_shutdown = "inproc://federation/shutdown",
+					.merge_tick  = [this](std::string const& report_name, std::string tick_data)
+					{
+						return coordinator_->merge_remote_tick(report_name, std::move(tick_data));
+					},
+				};
+				federation_receiver_ = create_federation_receiver(this->globals(), &federation_conf);
+				federation_receiver_->startup();
+			}
 		}
 
 		virtual void shutdown() override
 		{
+			federation_receiver_.reset();
+			exporter_.reset();
 			collector_.reset();
 			repacker_.reset();
+
+			// no new words from now on, reports still hold theirs (and save history on coordinator shutdown)
+			if (!this->options()->history_dir.empty())
+				this->dictionary_image_save();
+
 			coordinator_.reset();
 		}
 
+		std::string dictionary_image_path() const
+		{
+			std::string result = this->options()->history_dir;
+			if (result.back() != '/')
+				result += '/';
+
+			return result + "dictionary.image";
+		}
+
+		void dictionary_image_load()
+		{
+			std::string const path = this->dictionary_image_path();
+
+			if (access(path.c_str(), F_OK) != 0)
+				return; // never saved
+
+			// reports are created lazily (on table open), give those some time to load history and grab their words
+			duration_t const hold_time = 300 * d_second;
+
+			meow::stopwatch_t sw;
+			uint32_t n_words = 0;
+
+			auto const err = globals_->dictionary()->image_load(path, hold_time, &n_words);
+			if (err)
+			{
+				LOG_WARN(globals_->logger(), "dictionary image not loaded from {0}: {1}", path, err.what());
+				return;
+			}
+
+			LOG_INFO(globals_->logger(), "dictionary image loaded from {0}: {1} words in {2}", path, n_words, sw.stamp());
+		}
+
+		void dictionary_image_save()
+		{
+			std::string const path = this->dictionary_image_path();
+
+			auto const err = globals_->dictionary()->image_save(path);
+			if (err)
+				LOG_WARN(globals_->logger(), "dictionary image not saved to {0}: {1}", path, err.what());
+		}
+
 		virtual pinba_globals_t* globals() const override
 		{
 			return globals_;
@@ -175,8 +458,18 @@ namespace { namespace aux {
 			return coordinator_->add_report(report);
 		}
 
+		virtual std::vector<pinba_error_t> add_reports(std::vector<report_ptr> const& reports) override
+		{
+			return coordinator_->add_reports(reports);
+		}
+
 		virtual pinba_error_t delete_report(str_ref name) override
 		{
+			{
+				std::lock_guard<std::mutex> lk_(metrics_mtx_);
+				metrics_confs_.erase(name.str());
+			}
+
 			return coordinator_->delete_report(name.str());
 		}
 
@@ -190,10 +483,68 @@ namespace { namespace aux {
 			return coordinator_->get_report_snapshot(name.str());
 		}
 
+		virtual std::future<report_snapshot_ptr> get_report_snapshot_async(str_ref name) override
+		{
+			return coordinator_->get_report_snapshot_async(name.str());
+		}
+
+		virtual std::vector<report_snapshot_ptr> get_report_snapshots(std::vector<std::string> const& names) override
+		{
+			return coordinator_->get_report_snapshots(names);
+		}
+
+		virtual report_snapshot_ptr get_prepared_report_snapshot(str_ref name, report_snapshot_t::merge_flags_t flags) override
+		{
+			return coordinator_->get_prepared_report_snapshot(name.str(), flags);
+		}
+
+		virtual void report_hv_wanted(str_ref name) override
+		{
+			coordinator_->report_hv_wanted(name.str());
+		}
+
+		virtual pinba_error_t subscribe_to_ticks(str_ref name, report_tick_subscription_ptr subscription) override
+		{
+			return coordinator_->subscribe_to_ticks(name.str(), std::move(subscription));
+		}
+
+		virtual void set_report_metrics(report_metrics_conf_ptr mconf) override
+		{
+			std::lock_guard<std::mutex> lk_(metrics_mtx_);
+			metrics_confs_[mconf->report_name] = std::move(mconf);
+		}
+
+		virtual pinba_error_t set_udp_reader_threads(uint32_t n_threads) override
+		{
+			if (!collector_)
+				return ff::fmt_err("engine is not started");
+
+			pinba_error_t err = collector_->set_thread_count(n_threads);
+			if (!err)
+				this->options_mutable()->udp_threads = n_threads;
+			return err;
+		}
+
+		virtual pinba_error_t set_repacker_threads(uint32_t n_threads) override
+		{
+			if (!repacker_)
+				return ff::fmt_err("engine is not started");
+
+			pinba_error_t err = repacker_->set_thread_count(n_threads);
+			if (!err)
+				this->options_mutable()->repacker_threads = n_threads;
+			return err;
+		}
+
 	private:
 		// std::unique_ptr<pinba_globals_t>  globals_;
 		pinba_globals_t                   *globals_;
 		std::unique_ptr<collector_t>      collector_;
+		std::unique_ptr<exporter_t>       exporter_;
+		federation_receiver_ptr           federation_receiver_;
+
+		std::mutex                                     metrics_mtx_;
+		std::map<std::string, report_metrics_conf_ptr> metrics_confs_; // by report name
 		std::unique_ptr<repacker_t>       repacker_;
 		std::unique_ptr<coordinator_t>    coordinator_;
 	};
@@ -0,0 +1,95 @@
+#include "pinba_config.h"
+
+#include "pinba/globals.h"
+#include "pinba/dictionary.h"
+#include "pinba/mem_governor.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	uint32_t stage_for(uint64_t mem_used, uint64_t max_mem, uint32_t prev_stage)
+	{
+		double const fill = double(mem_used) / double(max_mem);
+
+		uint32_t stage = PINBA_MEM_STAGE__NORMAL;
+		for (uint32_t i = PINBA_MEM_STAGE__NO_NEW_KEYS; i > PINBA_MEM_STAGE__NORMAL; i--)
+		{
+			// stages we're in already are left only when usage drops below the threshold by hysteresis step
+			double const threshold = (i <= prev_stage)
+					? mem_governor___stage_threshold[i] - mem_governor___hysteresis
+					: mem_governor___stage_threshold[i];
+
+			if (fill >= threshold)
+			{
+				stage = i;
+				break;
+			}
+		}
+
+		return stage;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint64_t mem_governor___mem_used(pinba_globals_t *globals)
+{
+	pinba_stats_t *stats = globals->stats();
+
+	dictionary_memory_t const dmem = globals->dictionary()->memory_used();
+
+	uint64_t result = dmem.hash_bytes + dmem.wordlist_bytes + dmem.freelist_bytes + dmem.strings_bytes;
+
+	result += stats->reports.mem_used.load(std::memory_order_relaxed);
+	result += stats->inflight_mem.raw_batches.load(std::memory_order_relaxed);
+	result += stats->inflight_mem.packet_batches.load(std::memory_order_relaxed);
+
+	{
+		std::lock_guard<std::mutex> lk_(stats->mtx);
+
+		for (auto const& curr : stats->repacker_threads)
+			result += curr.dictionary_mem_used;
+	}
+
+	return result;
+}
+
+void mem_governor___update(pinba_globals_t *globals)
+{
+	if (!mem_governor___is_enabled(globals))
+		return;
+
+	pinba_stats_t *stats = globals->stats();
+
+	uint64_t const max_mem    = globals->options()->mem_governor_max;
+	uint64_t const mem_used   = mem_governor___mem_used(globals);
+	uint32_t const prev_stage = mem_governor___stage(stats);
+	uint32_t const stage      = aux::stage_for(mem_used, max_mem, prev_stage);
+
+	stats->mem_governor.mem_used.store(mem_used, std::memory_order_relaxed);
+
+	if (stage == prev_stage)
+		return;
+
+	stats->mem_governor.stage.store(stage, std::memory_order_relaxed);
+	stats->mem_governor.stage_changes.fetch_add(1, std::memory_order_relaxed);
+
+	globals->dictionary()->set_reject_new_words(stage >= PINBA_MEM_STAGE__NO_NEW_WORDS);
+
+	LOG_WARN(globals->logger(), "mem_governor; stage {0} -> {1}, memory used: {2} of {3}",
+		mem_governor___stage_name(prev_stage), mem_governor___stage_name(stage), mem_used, max_mem);
+}
+
+char const* mem_governor___stage_name(uint32_t stage)
+{
+	switch (stage)
+	{
+		case PINBA_MEM_STAGE__NORMAL:       return "normal";
+		case PINBA_MEM_STAGE__SAMPLE:       return "sample";
+		case PINBA_MEM_STAGE__NO_NEW_WORDS: return "no_new_words";
+		case PINBA_MEM_STAGE__NO_NEW_KEYS:  return "no_new_keys";
+	}
+	return "unknown";
+}
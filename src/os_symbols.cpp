@@ -1,6 +1,16 @@
 #include "pinba_config.h"
 
+#include <algorithm>
+
 #include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include <meow/defer.hpp>
 
 #include "pinba/globals.h"
 #include "pinba/os_symbols.h"
@@ -69,6 +79,42 @@ namespace { namespace aux {
 			return fp_pthread_setaffinity_np_(pthread_self(), cpusetsize, cpuset);
 		}
 
+		virtual int set_thread_sched(pinba_thread_sched_t const& sched) override
+		{
+			switch (sched.policy)
+			{
+				case PINBA_THREAD_SCHED__DEFAULT:
+					return 0;
+
+				// nice is per thread on linux, when given a thread id, not pid
+				case PINBA_THREAD_SCHED__NICE:
+				{
+					struct sched_param param = {};
+					param.sched_priority = 0;
+
+					int const err = pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+					if (err != 0)
+						return err;
+
+					if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), sched.priority) < 0)
+						return errno;
+
+					return 0;
+				}
+
+				case PINBA_THREAD_SCHED__FIFO:
+				case PINBA_THREAD_SCHED__RR:
+				{
+					struct sched_param param = {};
+					param.sched_priority = sched.priority;
+
+					return pthread_setschedparam(pthread_self(), (sched.policy == PINBA_THREAD_SCHED__FIFO) ? SCHED_FIFO : SCHED_RR, &param);
+				}
+			}
+
+			return EINVAL;
+		}
+
 		virtual int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, const struct timespec *timeout) override
 		{
 			assert(fp_recvmmsg_ != NULL);
@@ -80,6 +126,59 @@ namespace { namespace aux {
 			return (fp_recvmmsg_ != NULL);
 		}
 
+#ifdef PINBA_HAVE_IO_URING_RECV_MULTISHOT
+		virtual int io_uring_setup(unsigned entries, struct io_uring_params *p) override
+		{
+			return (int)syscall(__NR_io_uring_setup, entries, p);
+		}
+
+		virtual int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) override
+		{
+			return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+		}
+
+		virtual int io_uring_register(int ring_fd, unsigned opcode, void *arg, unsigned nr_args) override
+		{
+			return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+		}
+#else
+		virtual int io_uring_setup(unsigned entries, struct io_uring_params *p) override
+		{
+			errno = ENOSYS;
+			return -1;
+		}
+
+		virtual int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) override
+		{
+			errno = ENOSYS;
+			return -1;
+		}
+
+		virtual int io_uring_register(int ring_fd, unsigned opcode, void *arg, unsigned nr_args) override
+		{
+			errno = ENOSYS;
+			return -1;
+		}
+#endif
+
+		virtual bool has_io_uring() const override
+		{
+			return has_io_uring_;
+		}
+
+#ifdef PINBA_HAVE_AF_XDP
+		virtual int bpf(int cmd, union bpf_attr *attr, unsigned size) override
+		{
+			return (int)syscall(__NR_bpf, cmd, attr, size);
+		}
+#else
+		virtual int bpf(int cmd, union bpf_attr *attr, unsigned size) override
+		{
+			errno = ENOSYS;
+			return -1;
+		}
+#endif
+
 	private:
 
 		void resolve_builtin_symbols()
@@ -101,6 +200,78 @@ namespace { namespace aux {
 			#else
 				fp_recvmmsg_               = (funcp___recvmmsg_t)this->resolve("recvmmsg");
 			#endif
+
+			has_io_uring_ = this->probe_io_uring();
+		}
+
+		bool probe_io_uring()
+		{
+		#ifdef PINBA_HAVE_IO_URING_RECV_MULTISHOT
+			struct io_uring_params params = {};
+
+			int const ring_fd = this->io_uring_setup(4, &params);
+			if (ring_fd < 0)
+			{
+				LOG_INFO(globals_->logger(), "io_uring is not available, io_uring_setup() failed: {0}:{1}", errno, strerror(errno));
+				return false;
+			}
+			MEOW_DEFER(
+				close(ring_fd);
+			);
+
+			// recvmsg op is supported
+			{
+				size_t const probe_sz = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+				std::unique_ptr<char[]> probe_buf { new char[probe_sz]() };
+				auto *probe = reinterpret_cast<struct io_uring_probe*>(probe_buf.get());
+
+				int const r = this->io_uring_register(ring_fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST);
+				if (r < 0)
+				{
+					LOG_INFO(globals_->logger(), "io_uring is not available, IORING_REGISTER_PROBE failed: {0}:{1}", errno, strerror(errno));
+					return false;
+				}
+
+				if ((probe->last_op < IORING_OP_RECVMSG) || !(probe->ops[IORING_OP_RECVMSG].flags & IO_URING_OP_SUPPORTED))
+				{
+					LOG_INFO(globals_->logger(), "io_uring is not available, IORING_OP_RECVMSG is not supported");
+					return false;
+				}
+			}
+
+			// provided buffer rings are supported (linux 5.19+)
+			{
+				size_t const br_sz = 8 * sizeof(struct io_uring_buf);
+
+				void *br = mmap(NULL, br_sz, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+				if (br == MAP_FAILED)
+					return false;
+				MEOW_DEFER(
+					munmap(br, br_sz);
+				);
+
+				struct io_uring_buf_reg reg = {};
+				reg.ring_addr    = (uint64_t)br;
+				reg.ring_entries = 8;
+				reg.bgid         = 0;
+
+				int const r = this->io_uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1);
+				if (r < 0)
+				{
+					LOG_INFO(globals_->logger(), "io_uring is not available, IORING_REGISTER_PBUF_RING failed: {0}:{1}", errno, strerror(errno));
+					return false;
+				}
+
+				struct io_uring_buf_reg unreg = {};
+				unreg.bgid = 0;
+				this->io_uring_register(ring_fd, IORING_UNREGISTER_PBUF_RING, &unreg, 1);
+			}
+
+			LOG_INFO(globals_->logger(), "io_uring is available");
+			return true;
+		#else
+			return false;
+		#endif
 		}
 
 	private:
@@ -111,6 +282,7 @@ namespace { namespace aux {
 		funcp___pthread_setname_np_t      fp_pthread_setname_np_;
 		funcp___pthread_setaffinity_np_t  fp_pthread_setaffinity_np_;
 		funcp___recvmmsg_t                fp_recvmmsg_;
+		bool                              has_io_uring_ = false;
 	};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -126,3 +298,51 @@ catch (std::exception const& e)
 {
 	throw std::runtime_error(ff::fmt_str("{0}; {1}", __func__, e.what()));
 }
+
+void pinba_set_thread_cpus(pinba_globals_t *globals, pinba_cpu_list_t const& cpus, str_ref thread_name)
+{
+	if (cpus.empty())
+		return;
+
+	uint32_t const max_cpu = *std::max_element(cpus.begin(), cpus.end());
+
+	cpu_set_t *cpuset = CPU_ALLOC(max_cpu + 1);
+	if (cpuset == NULL)
+	{
+		LOG_WARN(globals->logger(), "{0}; can't set cpu affinity, CPU_ALLOC({1}) failed", thread_name, max_cpu + 1);
+		return;
+	}
+	MEOW_DEFER(
+		CPU_FREE(cpuset);
+	);
+
+	size_t const cpuset_size = CPU_ALLOC_SIZE(max_cpu + 1);
+	CPU_ZERO_S(cpuset_size, cpuset);
+
+	for (uint32_t const cpu : cpus)
+		CPU_SET_S(cpu, cpuset_size, cpuset);
+
+	int const err = PINBA___OS_CALL(globals, set_thread_affinity, cpuset_size, cpuset);
+	if (err != 0)
+	{
+		LOG_WARN(globals->logger(), "{0}; set_thread_affinity failed: {1}:{2}", thread_name, err, strerror(err));
+		return;
+	}
+
+	LOG_DEBUG(globals->logger(), "{0}; pinned to {1} cpus, max cpu id {2}", thread_name, cpus.size(), max_cpu);
+}
+
+void pinba_set_thread_sched(pinba_globals_t *globals, pinba_thread_sched_t const& sched, str_ref thread_name)
+{
+	if (sched.policy == PINBA_THREAD_SCHED__DEFAULT)
+		return;
+
+	int const err = PINBA___OS_CALL(globals, set_thread_sched, sched);
+	if (err != 0)
+	{
+		LOG_WARN(globals->logger(), "{0}; set_thread_sched({1}, {2}) failed: {3}:{4}", thread_name, sched.policy, sched.priority, err, strerror(err));
+		return;
+	}
+
+	LOG_DEBUG(globals->logger(), "{0}; scheduling policy {1}, priority {2}", thread_name, sched.policy, sched.priority);
+}
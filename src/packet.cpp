@@ -1,131 +1,486 @@
 #include <cmath>
+#include <cstring>
 
 #include "pinba/globals.h"
 #include "pinba/limits.h"
 #include "pinba/dictionary.h"
 #include "pinba/packet.h"
+#include "pinba/packet_wire.h"
+#include "pinba/packet_simd.h"
 #include "pinba/bloom.h"
 
 #include "proto/pinba.pb-c.h"
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-request_validate_result_t pinba_validate_request(Pinba__Request *r)
-{
-	if (r->status >= PINBA_INTERNAL___STATUS_MAX)
-		return request_validate_result::status_is_too_large;
+	// R = Pinba__Request or pinba_wire_request_t, field names are the same
+	template<class R>
+	request_validate_result_t validate_request(R *r)
+	{
+		if (r->status >= PINBA_INTERNAL___STATUS_MAX)
+			return request_validate_result::status_is_too_large;
 
-	if (r->n_timer_value != r->n_timer_hit_count) // all timers have hit counts
-		return request_validate_result::bad_hit_count;
+		if (r->n_timer_value != r->n_timer_hit_count) // all timers have hit counts
+			return request_validate_result::bad_hit_count;
 
-	if (r->n_timer_value != r->n_timer_tag_count) // all timers have tag counts
-		return request_validate_result::bad_tag_count;
+		if (r->n_timer_value != r->n_timer_tag_count) // all timers have tag counts
+			return request_validate_result::bad_tag_count;
 
-	// NOTE(antoxa): some clients don't send rusage at all, let them
+		// NOTE(antoxa): some clients don't send rusage at all, let them
 
-	// if (r->n_timer_value != r->n_timer_ru_utime)
-	// 	return request_validate_result::bad_timer_ru_utime_count;
+		// if (r->n_timer_value != r->n_timer_ru_utime)
+		// 	return request_validate_result::bad_timer_ru_utime_count;
 
-	// if (r->n_timer_value != r->n_timer_ru_stime)
-	// 	return request_validate_result::bad_timer_ru_stime_count;
+		// if (r->n_timer_value != r->n_timer_ru_stime)
+		// 	return request_validate_result::bad_timer_ru_stime_count;
 
-	// all timer hit counts are > 0
-	for (unsigned i = 0; i < r->n_timer_hit_count; i++) {
-		if (r->timer_hit_count[i] <= 0)
-			return request_validate_result::bad_timer_hit_count;
-	}
+		// all timer hit counts are > 0
+		for (unsigned i = 0; i < r->n_timer_hit_count; i++) {
+			if (r->timer_hit_count[i] <= 0)
+				return request_validate_result::bad_timer_hit_count;
+		}
 
-	auto const total_tag_count = [&]()
-	{
-		size_t result = 0;
-		for (unsigned i = 0; i < r->n_timer_tag_count; i++) {
-			result += r->timer_tag_count[i];
+		auto const total_tag_count = [&]()
+		{
+			size_t result = 0;
+			for (unsigned i = 0; i < r->n_timer_tag_count; i++) {
+				result += r->timer_tag_count[i];
+			}
+			return result;
+		}();
+
+		if (total_tag_count != r->n_timer_tag_name) // all tags have names
+			return request_validate_result::not_enough_tag_names;
+
+		if (total_tag_count != r->n_timer_tag_value) // all tags have values
+			return request_validate_result::not_enough_tag_values;
+
+		if (r->n_tag_value < r->n_tag_name) // all request tags have values
+			return request_validate_result::not_enough_tag_values;
+
+		// summaries become packets weighted by summary_count, one per histogram bucket, see pinba_summary_to_packets()
+		{
+			if (r->summary_count > PINBA_LIMIT___MAX_SAMPLE_RATE)
+				return request_validate_result::summary_count_too_large;
+
+			if (r->n_summary_hist_us != r->n_summary_hist_count)
+				return request_validate_result::summary_bad_histogram;
+
+			if (r->n_summary_hist_us > 0)
+			{
+				if (r->summary_count == 0 || r->n_summary_hist_us > PINBA_LIMIT___MAX_SUMMARY_BUCKETS)
+					return request_validate_result::summary_bad_histogram;
+
+				uint64_t hist_total = 0;
+				for (unsigned i = 0; i < r->n_summary_hist_count; i++)
+					hist_total += r->summary_hist_count[i];
+
+				if (hist_total != r->summary_count)
+					return request_validate_result::summary_bad_histogram;
+			}
 		}
-		return result;
-	}();
 
-	if (total_tag_count != r->n_timer_tag_name) // all tags have names
-		return request_validate_result::not_enough_tag_names;
+		// tag names and values are offsets in r->dictionary, pinba_request_to_packet() relies on them being valid
+		// values might also be integers instead (PINBA_INTERNAL___INT_TAG_VALUE_BIT), those must fit dictionary_int_words_t ids
+		{
+			auto const offsets_valid = [&](uint32_t const *offsets, size_t n_offsets)
+			{
+				for (size_t i = 0; i < n_offsets; i++) {
+					if (offsets[i] >= r->n_dictionary)
+						return false;
+				}
+				return true;
+			};
 
-	if (total_tag_count != r->n_timer_tag_value) // all tags have values
-		return request_validate_result::not_enough_tag_values;
+			auto const values_valid = [&](uint32_t const *offsets, size_t n_offsets)
+			{
+				for (size_t i = 0; i < n_offsets; i++) {
+					if (offsets[i] & PINBA_INTERNAL___INT_TAG_VALUE_BIT) {
+						if ((offsets[i] & ~PINBA_INTERNAL___INT_TAG_VALUE_BIT) > dictionary_int_words_t::value_max)
+							return request_validate_result::int_tag_value_too_large;
+					} else if (offsets[i] >= r->n_dictionary) {
+						return request_validate_result::bad_dictionary_offset;
+					}
+				}
+				return request_validate_result::okay;
+			};
 
+			if (!offsets_valid(r->timer_tag_name, r->n_timer_tag_name) || !offsets_valid(r->tag_name, r->n_tag_name))
+				return request_validate_result::bad_dictionary_offset;
 
+			auto const timer_values_result = values_valid(r->timer_tag_value, r->n_timer_tag_value);
+			if (timer_values_result != request_validate_result::okay)
+				return timer_values_result;
 
-	// request_time should be > 0, reset to 0 when < 0
-	{
-		switch (std::fpclassify(r->request_time))
+			auto const values_result = values_valid(r->tag_value, r->n_tag_name);
+			if (values_result != request_validate_result::okay)
+				return values_result;
+		}
+
+
+		// request_time should be > 0, reset to 0 when < 0
 		{
-			case FP_ZERO:    break;
-			case FP_NORMAL:	 break;
-			default:         return request_validate_result::bad_float_request_time;
+			switch (std::fpclassify(r->request_time))
+			{
+				case FP_ZERO:    break;
+				case FP_NORMAL:	 break;
+				default:         return request_validate_result::bad_float_request_time;
+			}
+			if (std::signbit(r->request_time))
+				r->request_time = 0;
+		}
+
+		// NOTE(antoxa): this should not happen, but happens A LOT
+		//               so just reset them to zero if negative
+		{
+			switch (std::fpclassify(r->ru_utime))
+			{
+				case FP_ZERO:    break;
+				case FP_NORMAL:	 break;
+				default:         return request_validate_result::bad_float_ru_utime;
+			}
+			if (std::signbit(r->ru_utime))
+				r->ru_utime = 0;
 		}
-		if (std::signbit(r->request_time))
-			r->request_time = 0;
-	}
 
-	// NOTE(antoxa): this should not happen, but happens A LOT
-	//               so just reset them to zero if negative
-	{
-		switch (std::fpclassify(r->ru_utime))
 		{
-			case FP_ZERO:    break;
-			case FP_NORMAL:	 break;
-			default:         return request_validate_result::bad_float_ru_utime;
+			switch (std::fpclassify(r->ru_stime))
+			{
+				case FP_ZERO:    break;
+				case FP_NORMAL:	 break;
+				default:         return request_validate_result::bad_float_ru_stime;
+			}
+			if (std::signbit(r->ru_stime))
+				r->ru_stime = 0;
 		}
-		if (std::signbit(r->ru_utime))
-			r->ru_utime = 0;
+
+		// timer values must be >= 0
+		// checked in bulk, see packet_simd.h, the first value that is not ok tells which error it is
+		{
+			size_t const i = packet_simd___find_not_ok(r->timer_value, r->n_timer_value);
+			if (i < r->n_timer_value)
+			{
+				switch (std::fpclassify(r->timer_value[i]))
+				{
+					case FP_ZERO:    break;
+					case FP_NORMAL:	 break;
+					default:         return request_validate_result::bad_float_timer_value;
+				}
+				return request_validate_result::negative_float_timer_value;
+			}
+		}
+
+		// NOTE(antoxa): same as r->ru_utime, r->ru_stime
+		//               negative values happen, just make them zero
+		if (packet_simd___zero_negatives_find_bad(r->timer_ru_utime, r->n_timer_ru_utime) < r->n_timer_ru_utime)
+			return request_validate_result::bad_float_timer_ru_utime;
+
+		if (packet_simd___zero_negatives_find_bad(r->timer_ru_stime, r->n_timer_ru_stime) < r->n_timer_ru_stime)
+			return request_validate_result::bad_float_timer_ru_stime;
+
+		return request_validate_result::okay;
 	}
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// wire format decoding primitives, see https://developers.google.com/protocol-buffers/docs/encoding
+
+	enum : uint32_t
+	{
+		wire_type___varint  = 0,
+		wire_type___fixed64 = 1,
+		wire_type___bytes   = 2,
+		wire_type___fixed32 = 5,
+	};
+
+	struct wire_reader_t
 	{
-		switch (std::fpclassify(r->ru_stime))
+		uint8_t const *p;
+		uint8_t const *end;
+
+		bool eof() const
 		{
-			case FP_ZERO:    break;
-			case FP_NORMAL:	 break;
-			default:         return request_validate_result::bad_float_ru_stime;
+			return p >= end;
 		}
-		if (std::signbit(r->ru_stime))
-			r->ru_stime = 0;
-	}
 
-	// timer values must be >= 0
-	for (unsigned i = 0; i < r->n_timer_value; i++)
+		bool read_varint(uint64_t *result)
+		{
+			uint64_t value = 0;
+
+			for (uint32_t shift = 0; shift < 64; shift += 7)
+			{
+				if (p >= end)
+					return false;
+
+				uint8_t const b = *p++;
+				value |= uint64_t(b & 0x7f) << shift;
+
+				if ((b & 0x80) == 0)
+				{
+					*result = value;
+					return true;
+				}
+			}
+
+			return false; // too long
+		}
+
+		// uint32 fields are encoded as varints, upper bits are just truncated (same as protobuf-c does)
+		bool read_uint32(uint32_t *result)
+		{
+			uint64_t v;
+			if (!read_varint(&v))
+				return false;
+
+			*result = uint32_t(v);
+			return true;
+		}
+
+		bool read_float(float *result)
+		{
+			if ((end - p) < 4)
+				return false;
+
+			memcpy(result, p, sizeof(*result)); // little-endian on wire, same as x86
+			p += 4;
+			return true;
+		}
+
+		bool read_bytes(str_ref *result)
+		{
+			uint64_t len;
+			if (!read_varint(&len) || (len > uint64_t(end - p)))
+				return false;
+
+			*result = str_ref { (char const*)p, size_t(len) };
+			p += len;
+			return true;
+		}
+
+		bool skip(uint32_t wire_type)
+		{
+			switch (wire_type)
+			{
+				case wire_type___varint:
+				{
+					uint64_t v;
+					return read_varint(&v);
+				}
+
+				case wire_type___fixed64:
+					if ((end - p) < 8)
+						return false;
+					p += 8;
+					return true;
+
+				case wire_type___bytes:
+				{
+					str_ref v;
+					return read_bytes(&v);
+				}
+
+				case wire_type___fixed32:
+					if ((end - p) < 4)
+						return false;
+					p += 4;
+					return true;
+
+				default: // groups are not used in pinba.proto
+					return false;
+			}
+		}
+	};
+
+	// repeated uint32, either packed or not (proto2 default is not packed, but accept both like protobuf does)
+	inline bool read_repeated_uint32(wire_reader_t *r, uint32_t wire_type, std::vector<uint32_t> *to)
 	{
-		switch (std::fpclassify(r->timer_value[i]))
+		if (wire_type == wire_type___varint)
+		{
+			uint32_t v;
+			if (!r->read_uint32(&v))
+				return false;
+
+			to->push_back(v);
+			return true;
+		}
+
+		if (wire_type == wire_type___bytes)
 		{
-			case FP_ZERO:    break;
-			case FP_NORMAL:	 break;
-			default:         return request_validate_result::bad_float_timer_value;
+			str_ref packed;
+			if (!r->read_bytes(&packed))
+				return false;
+
+			wire_reader_t pr = { (uint8_t const*)packed.begin(), (uint8_t const*)packed.end() };
+			while (!pr.eof())
+			{
+				uint32_t v;
+				if (!pr.read_uint32(&v))
+					return false;
+
+				to->push_back(v);
+			}
+			return true;
 		}
-		if (std::signbit(r->timer_value[i]))
-			return request_validate_result::negative_float_timer_value;
+
+		return false;
 	}
 
-	// NOTE(antoxa): same as r->ru_utime, r->ru_stime
-	//               negative values happen, just make them zero
-	for (unsigned i = 0; i < r->n_timer_ru_utime; i++)
+	// repeated float, either packed or not
+	inline bool read_repeated_float(wire_reader_t *r, uint32_t wire_type, std::vector<float> *to)
 	{
-		switch (std::fpclassify(r->timer_ru_utime[i]))
+		if (wire_type == wire_type___fixed32)
 		{
-			case FP_ZERO:    break;
-			case FP_NORMAL:	 break;
-			default:         return request_validate_result::bad_float_timer_ru_utime;
+			float v;
+			if (!r->read_float(&v))
+				return false;
+
+			to->push_back(v);
+			return true;
 		}
-		if (std::signbit(r->timer_ru_utime[i]))
-			r->timer_ru_utime[i] = 0;
+
+		if (wire_type == wire_type___bytes)
+		{
+			str_ref packed;
+			if (!r->read_bytes(&packed) || (packed.size() % sizeof(float)) != 0)
+				return false;
+
+			size_t const old_size = to->size();
+			to->resize(old_size + packed.size() / sizeof(float));
+			memcpy(to->data() + old_size, packed.data(), packed.size());
+			return true;
+		}
+
+		return false;
 	}
 
-	for (unsigned i = 0; i < r->n_timer_ru_stime; i++)
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+request_validate_result_t pinba_validate_request(Pinba__Request *r)
+{
+	return aux::validate_request(r);
+}
+
+request_validate_result_t pinba_validate_request(pinba_wire_request_t *r)
+{
+	return aux::validate_request(r);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+request_validate_result_t pinba_wire_decoder_t::decode(str_ref wire)
+{
+	using namespace aux;
+
+	req_ = {};
+
+	timer_hit_count_.clear();
+	timer_value_.clear();
+	timer_tag_count_.clear();
+	timer_tag_name_.clear();
+	timer_tag_value_.clear();
+	dictionary_.clear();
+	tag_name_.clear();
+	tag_value_.clear();
+	timer_ru_utime_.clear();
+	timer_ru_stime_.clear();
+	summary_hist_us_.clear();
+	summary_hist_count_.clear();
+
+	// required fields 1..9 must be present, same as protobuf-c checks on unpack
+	constexpr uint32_t const required_mask = 0x3FE; // bits 1..9
+	uint32_t seen_mask = 0;
+
+	wire_reader_t r = { (uint8_t const*)wire.begin(), (uint8_t const*)wire.end() };
+
+	while (!r.eof())
 	{
-		switch (std::fpclassify(r->timer_ru_stime[i]))
+		uint64_t key;
+		if (!r.read_varint(&key))
+			return request_validate_result::wire_format_error;
+
+		uint32_t const field_id  = uint32_t(key >> 3);
+		uint32_t const wire_type = uint32_t(key & 0x7);
+
+		if (field_id < 32)
+			seen_mask |= (1u << field_id);
+
+		bool const ok = [&]()
 		{
-			case FP_ZERO:    break;
-			case FP_NORMAL:	 break;
-			default:         return request_validate_result::bad_float_timer_ru_stime;
-		}
-		if (std::signbit(r->timer_ru_stime[i]))
-			r->timer_ru_stime[i] = 0;
+			switch (field_id)
+			{
+				case 1:  return (wire_type == wire_type___bytes)   && r.read_bytes(&req_.hostname);
+				case 2:  return (wire_type == wire_type___bytes)   && r.read_bytes(&req_.server_name);
+				case 3:  return (wire_type == wire_type___bytes)   && r.read_bytes(&req_.script_name);
+				case 4:  return (wire_type == wire_type___varint)  && r.read_uint32(&req_.request_count);
+				case 5:  return (wire_type == wire_type___varint)  && r.read_uint32(&req_.document_size);
+				case 6:  return (wire_type == wire_type___varint)  && r.read_uint32(&req_.memory_peak);
+				case 7:  return (wire_type == wire_type___fixed32) && r.read_float(&req_.request_time);
+				case 8:  return (wire_type == wire_type___fixed32) && r.read_float(&req_.ru_utime);
+				case 9:  return (wire_type == wire_type___fixed32) && r.read_float(&req_.ru_stime);
+				case 10: return read_repeated_uint32(&r, wire_type, &timer_hit_count_);
+				case 11: return read_repeated_float(&r, wire_type, &timer_value_);
+				case 12: return read_repeated_uint32(&r, wire_type, &timer_tag_count_);
+				case 13: return read_repeated_uint32(&r, wire_type, &timer_tag_name_);
+				case 14: return read_repeated_uint32(&r, wire_type, &timer_tag_value_);
+				case 15:
+				{
+					str_ref word;
+					if ((wire_type != wire_type___bytes) || !r.read_bytes(&word))
+						return false;
+
+					dictionary_.push_back(word);
+					return true;
+				}
+				case 16: return (wire_type == wire_type___varint)  && r.read_uint32(&req_.status);
+				case 17: return (wire_type == wire_type___varint)  && r.read_uint32(&req_.memory_footprint);
+				case 19: return (wire_type == wire_type___bytes)   && r.read_bytes(&req_.schema);
+				case 20: return read_repeated_uint32(&r, wire_type, &tag_name_);
+				case 21: return read_repeated_uint32(&r, wire_type, &tag_value_);
+				case 22: return read_repeated_float(&r, wire_type, &timer_ru_utime_);
+				case 23: return read_repeated_float(&r, wire_type, &timer_ru_stime_);
+				case 24: return (wire_type == wire_type___varint)  && r.read_uint32(&req_.summary_count);
+				case 25: return read_repeated_uint32(&r, wire_type, &summary_hist_us_);
+				case 26: return read_repeated_uint32(&r, wire_type, &summary_hist_count_);
+
+				default: // nested requests (18) and unknown fields
+					return r.skip(wire_type);
+			}
+		}();
+
+		if (!ok)
+			return request_validate_result::wire_format_error;
 	}
 
-	return request_validate_result::okay;
+	if ((seen_mask & required_mask) != required_mask)
+		return request_validate_result::wire_format_error;
+
+	req_.n_timer_hit_count = timer_hit_count_.size();
+	req_.timer_hit_count   = timer_hit_count_.data();
+	req_.n_timer_value     = timer_value_.size();
+	req_.timer_value       = timer_value_.data();
+	req_.n_timer_tag_count = timer_tag_count_.size();
+	req_.timer_tag_count   = timer_tag_count_.data();
+	req_.n_timer_tag_name  = timer_tag_name_.size();
+	req_.timer_tag_name    = timer_tag_name_.data();
+	req_.n_timer_tag_value = timer_tag_value_.size();
+	req_.timer_tag_value   = timer_tag_value_.data();
+	req_.n_dictionary      = dictionary_.size();
+	req_.dictionary        = dictionary_.data();
+	req_.n_tag_name        = tag_name_.size();
+	req_.tag_name          = tag_name_.data();
+	req_.n_tag_value       = tag_value_.size();
+	req_.tag_value         = tag_value_.data();
+	req_.n_timer_ru_utime  = timer_ru_utime_.size();
+	req_.timer_ru_utime    = timer_ru_utime_.data();
+	req_.n_timer_ru_stime  = timer_ru_stime_.size();
+	req_.timer_ru_stime    = timer_ru_stime_.data();
+	req_.n_summary_hist_us    = summary_hist_us_.size();
+	req_.summary_hist_us      = summary_hist_us_.data();
+	req_.n_summary_hist_count = summary_hist_count_.size();
+	req_.summary_hist_count   = summary_hist_count_.data();
+
+	return aux::validate_request(&req_);
 }
@@ -0,0 +1,166 @@
+#include "pinba_config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pinba/globals.h"
+#include "pinba/dictionary.h"
+#include "pinba/packet.h"
+#include "pinba/packet_capture.h"
+#include "pinba/repacker.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	template<size_t N>
+	inline void copy_word(char (&dst)[N], str_ref const src)
+	{
+		size_t const n = std::min(src.size(), N - 1);
+		memcpy(dst, src.data(), n);
+		dst[n] = '\0';
+	}
+
+	inline bool filter_matches(packet_capture_filter_t const& filter, captured_packet_t const& p)
+	{
+		for (auto const& part : filter.parts)
+		{
+			char const *value = (part.field == PACKET_CAPTURE_FIELD__HOST)   ? p.host
+			                  : (part.field == PACKET_CAPTURE_FIELD__SERVER) ? p.server
+			                  : p.script;
+
+			bool const found = std::any_of(part.values.begin(), part.values.end(), [value](std::string const& v) { return v == value; });
+			if (!found)
+				return false;
+		}
+		return true;
+	}
+
+	struct packet_capture_impl_t : public packet_capture_t
+	{
+		// seq is odd while slot is being written, readers copy data and check seq didn't change
+		struct slot_t
+		{
+			std::atomic<uint64_t>  seq = {0};
+			captured_packet_t      data;
+		};
+
+		packet_capture_impl_t(pinba_globals_t *globals, uint32_t capacity, uint32_t sample_every)
+			: globals_(globals)
+			, capacity_(capacity)
+			, sample_every_(std::max(sample_every, 1u))
+			, slots_(new slot_t[capacity])
+		{
+			if (capacity_ == 0)
+				throw std::runtime_error("packet_capture: capacity must be > 0");
+		}
+
+		virtual void capture_batch(packet_batch_t const *batch) override
+		{
+			dictionary_t const *d = globals_->dictionary();
+			timeval_t const now   = os_unix::clock_gettime_ex(CLOCK_REALTIME);
+
+			// every sample_every_-th packet, counting across batches
+			uint32_t i = skip_;
+			for (; i < batch->packet_count; i += sample_every_)
+				this->write_packet(d, now, batch->packets[i]);
+
+			skip_ = i - batch->packet_count;
+		}
+
+		virtual std::vector<captured_packet_t> read(packet_capture_filter_t const& filter) const override
+		{
+			std::vector<captured_packet_t> result;
+
+			uint64_t const end   = written_.load(std::memory_order_acquire);
+			uint64_t const begin = (end > capacity_) ? end - capacity_ : 0;
+
+			result.reserve(end - begin);
+
+			captured_packet_t tmp;
+
+			for (uint64_t pos = begin; pos < end; pos++)
+			{
+				slot_t const& slot = slots_[pos % capacity_];
+
+				uint64_t const seq_before = slot.seq.load(std::memory_order_acquire);
+				if (seq_before & 1)
+					continue;
+
+				memcpy(&tmp, &slot.data, sizeof(tmp));
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (slot.seq.load(std::memory_order_relaxed) != seq_before)
+					continue; // overwritten while we were copying, it's newer than what we're after anyway
+
+				if (!filter_matches(filter, tmp))
+					continue;
+
+				result.push_back(tmp);
+			}
+
+			return result;
+		}
+
+	private:
+
+		void write_packet(dictionary_t const *d, timeval_t now, packet_t const *packet)
+		{
+			slot_t& slot = slots_[write_pos_ % capacity_];
+
+			uint64_t const seq = slot.seq.load(std::memory_order_relaxed);
+			slot.seq.store(seq + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			captured_packet_t& p = slot.data;
+			p.captured_tv  = now;
+			p.request_time = packet->request_time;
+			p.ru_utime     = packet->ru_utime;
+			p.ru_stime     = packet->ru_stime;
+			p.status       = packet->status;
+			p.traffic      = packet->traffic;
+			p.mem_used     = packet->mem_used;
+			p.sample_rate  = packet->sample_rate;
+
+			copy_word(p.host,   d->get_word(packet->host_id));
+			copy_word(p.server, d->get_word(packet->server_id));
+			copy_word(p.script, d->get_word(packet->script_id));
+
+			p.tag_count = std::min<uint32_t>(packet->tag_count, captured_packet_t::max_tags);
+			for (uint32_t i = 0; i < p.tag_count; i++)
+			{
+				copy_word(p.tags[i].name,  d->get_word(packet->tag_name_ids[i]));
+				copy_word(p.tags[i].value, d->get_word(packet->tag_value_ids()[i]));
+			}
+
+			slot.seq.store(seq + 2, std::memory_order_release);
+
+			write_pos_++;
+			written_.store(write_pos_, std::memory_order_release);
+
+			globals_->stats()->packet_capture.packets_captured.fetch_add(1, std::memory_order_relaxed);
+		}
+
+	private:
+		pinba_globals_t             *globals_;
+		uint32_t                    capacity_;
+		uint32_t                    sample_every_;
+		std::unique_ptr<slot_t[]>   slots_;
+
+		uint64_t                    write_pos_ = 0;  // writer only
+		uint32_t                    skip_      = 0;  // writer only, packets to skip in the next batch
+		std::atomic<uint64_t>       written_   = {0}; // slots written, ever
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+packet_capture_ptr create_packet_capture(pinba_globals_t *globals, uint32_t capacity, uint32_t sample_every)
+{
+	return meow::make_unique<aux::packet_capture_impl_t>(globals, capacity, sample_every);
+}
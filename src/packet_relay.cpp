@@ -0,0 +1,543 @@
+#include "pinba_config.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <tsl/robin_map.h>
+
+#ifdef PINBA_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include <meow/std_unique_ptr.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/dictionary.h"
+#include "pinba/packet.h"
+#include "pinba/packet_relay.h"
+#include "pinba/repacker_dictionary.h"
+#include "pinba/varint.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct packet_relay_encoder_t::impl_t
+{
+	dictionary_t const                  *d;
+
+	tsl::robin_map<uint32_t, uint32_t>  word_index;  // word_id -> string table index, 1-based
+	std::vector<uint32_t>               word_ids;    // string table index - 1 -> word_id
+
+	std::vector<uint8_t>                payload;
+	std::vector<uint8_t>                packets;
+
+	uint32_t index_of(uint32_t word_id)
+	{
+		if (word_id == 0)
+			return 0;
+
+		auto const inserted_pair = word_index.emplace(word_id, uint32_t(word_ids.size() + 1));
+		if (inserted_pair.second)
+			word_ids.push_back(word_id);
+
+		return inserted_pair.first->second;
+	}
+
+	// integer values go as is, never as words, low bit tells which one it is
+	uint32_t tag_value_of(uint32_t word_id)
+	{
+		if (dictionary_int_words_t::is_int_id(word_id))
+			return (dictionary_int_words_t::value_from_id(word_id) << 1) | 1;
+
+		return this->index_of(word_id) << 1;
+	}
+
+	void append_tags(uint32_t const *names, uint32_t const *values, uint32_t count)
+	{
+		for (uint32_t i = 0; i < count; i++)
+		{
+			varint___append(&packets, this->index_of(names[i]));
+			varint___append(&packets, this->tag_value_of(values[i]));
+		}
+	}
+
+	void append_packet(packet_t const *p)
+	{
+		varint___append(&packets, this->index_of(p->host_id));
+		varint___append(&packets, this->index_of(p->server_id));
+		varint___append(&packets, this->index_of(p->script_id));
+		varint___append(&packets, this->index_of(p->schema_id));
+		varint___append(&packets, this->index_of(p->status));
+		varint___append(&packets, p->traffic);
+		varint___append(&packets, p->mem_used);
+		varint___append(&packets, p->sample_rate);
+		varint___append(&packets, varint___zigzag(p->request_time.nsec));
+		varint___append(&packets, varint___zigzag(p->ru_utime.nsec));
+		varint___append(&packets, varint___zigzag(p->ru_stime.nsec));
+		varint___append(&packets, p->tag_count);
+		varint___append(&packets, p->timer_count);
+
+		this->append_tags(p->tag_name_ids, p->tag_value_ids(), p->tag_count);
+
+		for (uint32_t i = 0; i < p->timer_count; i++)
+		{
+			packed_timer_t const& t = p->timers[i];
+
+			varint___append(&packets, t.hit_count);
+			varint___append(&packets, t.value_us);
+			varint___append(&packets, t.ru_utime_us);
+			varint___append(&packets, t.ru_stime_us);
+			varint___append(&packets, t.tag_count);
+
+			this->append_tags(t.tag_name_ids, t.tag_value_ids(), t.tag_count);
+		}
+	}
+};
+
+packet_relay_encoder_t::packet_relay_encoder_t(dictionary_t const *d)
+	: impl_(meow::make_unique<impl_t>())
+{
+	impl_->d = d;
+}
+
+packet_relay_encoder_t::~packet_relay_encoder_t()
+{
+}
+
+void packet_relay_encoder_t::encode(packet_t const* const *packets, uint32_t n_packets, std::string *out)
+{
+	impl_t& I = *impl_;
+
+	I.word_index.clear();
+	I.word_ids.clear();
+	I.packets.clear();
+	I.payload.clear();
+
+	for (uint32_t i = 0; i < n_packets; i++)
+		I.append_packet(packets[i]);
+
+	// string table goes first, so that decoder knows all words before it gets to packets
+	varint___append(&I.payload, I.word_ids.size());
+	for (uint32_t const word_id : I.word_ids)
+	{
+		str_ref const word = I.d->get_word(word_id);
+
+		varint___append(&I.payload, word.size());
+		I.payload.insert(I.payload.end(), (uint8_t const*)word.data(), (uint8_t const*)word.data() + word.size());
+	}
+	I.payload.insert(I.payload.end(), I.packets.begin(), I.packets.end());
+
+	packet_relay_header_t hdr = {};
+	hdr.magic     = PINBA_RELAY_MAGIC;
+	hdr.version   = PINBA_RELAY_VERSION;
+	hdr.flags     = 0;
+	hdr.raw_size  = I.payload.size();
+	hdr.n_packets = n_packets;
+
+#ifdef PINBA_HAVE_LZ4
+	{
+		int const bound = LZ4_compressBound(I.payload.size());
+
+		out->resize(sizeof(hdr) + bound);
+
+		int const compressed_size = LZ4_compress_default((char const*)I.payload.data(), &(*out)[sizeof(hdr)], I.payload.size(), bound);
+
+		// incompressible payloads go as is
+		if (compressed_size > 0 && size_t(compressed_size) < I.payload.size())
+		{
+			hdr.flags |= PINBA_RELAY_FLAG__LZ4;
+			out->resize(sizeof(hdr) + compressed_size);
+			memcpy(&(*out)[0], &hdr, sizeof(hdr));
+			return;
+		}
+	}
+#endif
+
+	out->resize(sizeof(hdr) + I.payload.size());
+	memcpy(&(*out)[0], &hdr, sizeof(hdr));
+	memcpy(&(*out)[sizeof(hdr)], I.payload.data(), I.payload.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct packet_relay_decoder_t::impl_t
+{
+	// payload is way over any sane batch otherwise, don't let a broken header make us allocate that
+	static constexpr uint32_t max_raw_size = 256 * 1024 * 1024;
+
+	struct word_t
+	{
+		enum : uint8_t { not_checked = 0, not_found = 1, ok = 2 };
+
+		str_ref   str          = {};
+		uint64_t  hash         = 0;  // 0 = not calculated yet
+		uint8_t   name_status  = not_checked;
+		uint8_t   value_status = not_checked;
+		uint32_t  name_id      = 0;
+		uint64_t  name_id_hash = 0;
+		uint32_t  value_id     = 0;
+		uint32_t  field_flag   = 0;  // field_id has been looked up for (words might be different kinds of fields), 0 = none
+		uint32_t  field_id     = 0;  // fields might go to permanent dictionary, so not the same as value_id
+	};
+
+	repacker_dictionary_t  *d;
+
+	std::string            payload;
+	uint8_t const          *pos;
+	uint8_t const          *end;
+
+	std::vector<word_t>    words;     // index 0 is the empty word
+	uint32_t               n_packets_left;
+
+	pinba_error_t          err;
+
+	bool read(uint64_t *v)
+	{
+		uint64_t result = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7)
+		{
+			if (pos == end)
+				return false;
+
+			uint8_t const b = *pos++;
+			result |= uint64_t(b & 0x7f) << shift;
+
+			if (!(b & 0x80))
+			{
+				*v = result;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool read_u32(uint32_t *v)
+	{
+		uint64_t tmp;
+		if (!this->read(&tmp) || tmp > UINT32_MAX)
+			return false;
+
+		*v = uint32_t(tmp);
+		return true;
+	}
+
+	// every element count must be backed by at least a byte per element, so that alloc sizes stay sane
+	bool read_count(uint32_t *v, uint32_t bytes_per_element, uint32_t max)
+	{
+		if (!this->read_u32(v) || *v > max)
+			return false;
+
+		return (uint64_t(*v) * bytes_per_element) <= uint64_t(end - pos);
+	}
+
+	bool read_word(word_t **w)
+	{
+		uint32_t idx;
+		if (!this->read_u32(&idx) || idx >= words.size())
+			return false;
+
+		*w = &words[idx];
+		return true;
+	}
+
+	uint64_t word_hash(word_t *w)
+	{
+		if (w->hash == 0)
+			w->hash = dictionary_word_hasher_t()(w->str);
+		return w->hash;
+	}
+
+	word_t* name(word_t *w)
+	{
+		if (w->name_status == word_t::not_checked)
+		{
+			dictionary_t::nameword_t const nw = (w->str.empty())
+					? dictionary_t::nameword_t{}
+					: d->get_nameword(w->str, this->word_hash(w));
+
+			w->name_status  = (nw.id != 0) ? word_t::ok : word_t::not_found;
+			w->name_id      = nw.id;
+			w->name_id_hash = nw.id_hash;
+		}
+
+		return w;
+	}
+
+	uint32_t value(word_t *w)
+	{
+		if (w->value_status == word_t::not_checked)
+		{
+			w->value_status = word_t::ok;
+			w->value_id     = d->get_or_add(w->str, this->word_hash(w));
+		}
+
+		return w->value_id;
+	}
+
+	uint32_t field(word_t *w, uint32_t field_flag)
+	{
+		// fields are rarely anything but themselves, so a single slot cache is enough
+		if (w->field_flag != field_flag)
+		{
+			w->field_flag = field_flag;
+			w->field_id   = d->get_or_add___field(field_flag, w->str);
+		}
+
+		return w->field_id;
+	}
+
+	// reads count x { name, value } into names and values, skipping names that are not in the dictionary
+	// bloom(name_id_hash) is called for every tag that is kept
+	template<class BloomF>
+	bool read_tags(uint32_t count, uint32_t *names, uint32_t *values, uint32_t *out_count, BloomF const& bloom)
+	{
+		uint32_t n = 0;
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			word_t *name_w;
+			uint32_t value_v;
+			if (!this->read_word(&name_w) || !this->read_u32(&value_v))
+				return false;
+
+			// see packet_relay_encoder_t::impl_t::tag_value_of()
+			bool const is_int = (value_v & 1);
+			value_v >>= 1;
+
+			if (is_int ? (value_v > dictionary_int_words_t::value_max) : (value_v >= words.size()))
+				return false;
+
+			// same as repacker, unknown names are skipped with their values
+			if (this->name(name_w)->name_status != word_t::ok)
+				continue;
+
+			names[n]  = name_w->name_id;
+			values[n] = (is_int) ? dictionary_int_words_t::id_from_value(value_v) : this->value(&words[value_v]);
+			bloom(name_w->name_id_hash);
+			n++;
+		}
+
+		*out_count = n;
+		return true;
+	}
+
+	packet_t* read_packet(struct nmpa_s *nmpa, timer_tagset_interner_t *tagsets)
+	{
+		auto *p = (packet_t*)nmpa_calloc(nmpa, sizeof(packet_t)); // NOTE: no ctor is called here!
+
+		word_t *host_w, *server_w, *script_w, *schema_w, *status_w;
+		if (!this->read_word(&host_w) || !this->read_word(&server_w) || !this->read_word(&script_w)
+			|| !this->read_word(&schema_w) || !this->read_word(&status_w))
+		{
+			return nullptr;
+		}
+
+		p->host_id   = this->field(host_w, PINBA_PERMANENT_FIELD__HOST);
+		p->server_id = this->field(server_w, PINBA_PERMANENT_FIELD__SERVER);
+		p->script_id = this->field(script_w, PINBA_PERMANENT_FIELD__SCRIPT);
+		p->schema_id = this->field(schema_w, PINBA_PERMANENT_FIELD__SCHEMA);
+		p->status    = this->field(status_w, PINBA_PERMANENT_FIELD__STATUS);
+
+		uint64_t request_time, ru_utime, ru_stime;
+		uint32_t tag_count, timer_count;
+		if (!this->read_u32(&p->traffic) || !this->read_u32(&p->mem_used) || !this->read_u32(&p->sample_rate)
+			|| !this->read(&request_time) || !this->read(&ru_utime) || !this->read(&ru_stime)
+			|| !this->read_count(&tag_count, 2, UINT16_MAX) || !this->read_count(&timer_count, 5, UINT16_MAX))
+		{
+			return nullptr;
+		}
+
+		p->request_time = duration_t{varint___unzigzag(request_time)};
+		p->ru_utime     = duration_t{varint___unzigzag(ru_utime)};
+		p->ru_stime     = duration_t{varint___unzigzag(ru_stime)};
+
+		if (p->sample_rate == 0 || p->sample_rate > PINBA_LIMIT___MAX_SAMPLE_RATE)
+			return nullptr;
+
+		// request tags
+		if (tag_count > 0)
+		{
+			p->tag_name_ids = (uint32_t*)nmpa_alloc(nmpa, sizeof(uint32_t) * tag_count * 2);
+			uint32_t *tag_value_ids = p->tag_name_ids + tag_count;
+
+			uint32_t n_tags;
+			if (!this->read_tags(tag_count, p->tag_name_ids, tag_value_ids, &n_tags, [](uint64_t) {}))
+				return nullptr;
+
+			p->tag_count = n_tags;
+			if (n_tags < tag_count)
+				memmove(p->tag_value_ids(), tag_value_ids, sizeof(uint32_t) * n_tags);
+
+			p->tagset_id = (tagsets && n_tags > 0) ? tagsets->intern(p->tag_name_ids, n_tags) : 0;
+		}
+
+		// timers
+		p->timer_count = timer_count;
+		if (timer_count > 0)
+		{
+			p->timers_blooms = (timer_bloom_t*)nmpa_calloc(nmpa, sizeof(timer_bloom_t) * timer_count);
+			p->timers        = (packed_timer_t*)nmpa_alloc(nmpa, sizeof(packed_timer_t) * timer_count);
+
+			for (uint32_t timer_i = 0; timer_i < timer_count; timer_i++)
+			{
+				packed_timer_t *t = &p->timers[timer_i];
+
+				uint32_t src_tag_count;
+				if (!this->read_u32(&t->hit_count) || !this->read_u32(&t->value_us)
+					|| !this->read_u32(&t->ru_utime_us) || !this->read_u32(&t->ru_stime_us)
+					|| !this->read_count(&src_tag_count, 2, UINT16_MAX))
+				{
+					return nullptr;
+				}
+
+				t->tag_count    = 0;
+				t->tagset_id    = 0;
+				t->tag_name_ids = (src_tag_count > 0) ? (uint32_t*)nmpa_alloc(nmpa, sizeof(uint32_t) * src_tag_count * 2) : nullptr;
+
+				if (src_tag_count > 0)
+				{
+					uint32_t *tag_value_ids = t->tag_name_ids + src_tag_count;
+
+					auto const add_to_blooms = [&](uint64_t name_id_hash)
+					{
+						p->timers_blooms[timer_i].add_hashed(name_id_hash);
+						p->bloom.add_hashed(name_id_hash);
+					};
+
+					if (!this->read_tags(src_tag_count, t->tag_name_ids, tag_value_ids, &t->tag_count, add_to_blooms))
+						return nullptr;
+
+					if (t->tag_count < src_tag_count)
+						memmove(t->tag_value_ids(), tag_value_ids, sizeof(uint32_t) * t->tag_count);
+				}
+
+				t->tagset_id = (tagsets) ? tagsets->intern(t->tag_name_ids, t->tag_count) : 0;
+			}
+		}
+
+		return p;
+	}
+};
+
+packet_relay_decoder_t::packet_relay_decoder_t(repacker_dictionary_t *d)
+	: impl_(meow::make_unique<impl_t>())
+{
+	impl_->d              = d;
+	impl_->pos            = nullptr;
+	impl_->end            = nullptr;
+	impl_->n_packets_left = 0;
+}
+
+packet_relay_decoder_t::~packet_relay_decoder_t()
+{
+}
+
+pinba_error_t packet_relay_decoder_t::open(str_ref message)
+{
+	impl_t& I = *impl_;
+
+	I.words.clear();
+	I.n_packets_left = 0;
+	I.err = {};
+
+	packet_relay_header_t hdr;
+	if (message.size() < sizeof(hdr))
+		return ff::fmt_err("message is too short: {0}", message.size());
+
+	memcpy(&hdr, message.data(), sizeof(hdr));
+
+	if (hdr.magic != PINBA_RELAY_MAGIC)
+		return ff::fmt_err("bad magic: {0}", hdr.magic);
+
+	if (hdr.version != PINBA_RELAY_VERSION)
+		return ff::fmt_err("unsupported version: {0}, expected {1}", hdr.version, PINBA_RELAY_VERSION);
+
+	if (hdr.raw_size > I.max_raw_size)
+		return ff::fmt_err("payload is too large: {0}", hdr.raw_size);
+
+	str_ref const data = { message.data() + sizeof(hdr), message.size() - sizeof(hdr) };
+
+	if (hdr.flags & PINBA_RELAY_FLAG__LZ4)
+	{
+#ifdef PINBA_HAVE_LZ4
+		I.payload.resize(hdr.raw_size);
+
+		int const decompressed_size = LZ4_decompress_safe(data.data(), &I.payload[0], data.size(), hdr.raw_size);
+		if (decompressed_size < 0 || uint32_t(decompressed_size) != hdr.raw_size)
+			return ff::fmt_err("lz4 decompression failed, payload is malformed");
+#else
+		return ff::fmt_err("payload is lz4 compressed, but pinba is built without lz4 support");
+#endif
+	}
+	else
+	{
+		if (data.size() != hdr.raw_size)
+			return ff::fmt_err("payload size mismatch: {0}, expected {1}", data.size(), hdr.raw_size);
+
+		I.payload.assign(data.data(), data.size());
+	}
+
+	I.pos = (uint8_t const*)I.payload.data();
+	I.end = I.pos + I.payload.size();
+
+	uint32_t n_words;
+	if (!I.read_count(&n_words, 1, UINT32_MAX - 1))
+		return ff::fmt_err("string table is truncated");
+
+	I.words.assign(n_words + 1, impl_t::word_t{});
+
+	for (uint32_t i = 1; i <= n_words; i++)
+	{
+		uint32_t len;
+		if (!I.read_count(&len, 1, UINT32_MAX))
+			return ff::fmt_err("string table is truncated");
+
+		I.words[i].str = str_ref { (char const*)I.pos, len };
+		I.pos += len;
+	}
+
+	I.n_packets_left = hdr.n_packets;
+	return {};
+}
+
+uint32_t packet_relay_decoder_t::packets_left() const
+{
+	return impl_->n_packets_left;
+}
+
+packet_t* packet_relay_decoder_t::next_packet(struct nmpa_s *nmpa, timer_tagset_interner_t *tagsets)
+{
+	impl_t& I = *impl_;
+
+	if (I.n_packets_left == 0)
+		return nullptr;
+
+	packet_t *p = I.read_packet(nmpa, tagsets);
+	if (!p)
+	{
+		I.err = ff::fmt_err("packet data is malformed, {0} packets left", I.n_packets_left);
+		I.n_packets_left = 0;
+		return nullptr;
+	}
+
+	I.n_packets_left--;
+	return p;
+}
+
+pinba_error_t const& packet_relay_decoder_t::error() const
+{
+	return impl_->err;
+}
+
+void packet_relay_decoder_t::forget_words()
+{
+	for (auto& w : impl_->words)
+	{
+		w.name_status  = impl_t::word_t::not_checked;
+		w.value_status = impl_t::word_t::not_checked;
+		w.field_flag   = 0;
+	}
+}
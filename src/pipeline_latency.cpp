@@ -0,0 +1,134 @@
+#include "pinba_config.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "pinba/globals.h"
+#include "pinba/histogram.h"
+#include "pinba/pipeline_latency.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct pipeline_latency_impl_t : public pipeline_latency_t
+	{
+		using histogram_t = pipeline_latency_recorder_t::histogram_t;
+
+		pipeline_latency_impl_t(pinba_globals_t *globals)
+			: globals_(globals)
+		{
+			// 1us .. 60s, ~1% precision, anything longer than that is 'a disaster' anyway
+			hv_conf_ = histogram_conf_t {
+				.min_value      = {0},
+				.max_value      = 60 * d_second,
+				.unit_size      = d_microsecond,
+				.precision_bits = 7,
+				.bucket_d       = d_microsecond,
+				.hdr            = {},
+			};
+
+			auto const err = hdr_histogram_configure(&hv_conf_.hdr, hv_conf_);
+			if (err)
+				throw std::runtime_error(ff::fmt_str("bad pipeline latency histogram config: {0}", err));
+		}
+
+		virtual pipeline_latency_recorder_ptr create_recorder(int stage, std::string const& source) override
+		{
+			assert((stage >= 0) && (stage < PINBA_PIPELINE_STAGE__COUNT));
+
+			// publish once a second, same as most other stats get sampled
+			auto recorder = std::make_shared<pipeline_latency_recorder_t>(stage, source, &hv_conf_, 1 * d_second);
+
+			std::lock_guard<std::mutex> lk_(mtx_);
+
+			// reports come and go, don't keep dead ones forever if nobody selects
+			recorders_.erase(std::remove_if(recorders_.begin(), recorders_.end(), [](auto const& weak) { return weak.expired(); }), recorders_.end());
+			recorders_.push_back(recorder);
+
+			return recorder;
+		}
+
+		virtual std::vector<pipeline_latency_row_t> get_rows() override
+		{
+			timeval_t const now = os_unix::clock_monotonic_now();
+
+			// grab live recorders, forget dead ones
+			std::vector<pipeline_latency_recorder_ptr> live;
+			{
+				std::lock_guard<std::mutex> lk_(mtx_);
+
+				for (auto const& weak : recorders_)
+				{
+					if (auto r = weak.lock())
+						live.push_back(std::move(r));
+				}
+
+				recorders_.assign(live.begin(), live.end());
+			}
+
+			// threads of the same report host record separately (i.e. agg_threads > 1), merge them here
+			using source_key_t = std::pair<int, std::string>;
+			std::map<source_key_t, std::unique_ptr<histogram_t>> by_source;
+			std::unique_ptr<histogram_t> by_stage[PINBA_PIPELINE_STAGE__COUNT];
+
+			for (auto const& r : live)
+			{
+				auto& stage_hv = by_stage[r->stage];
+				if (!stage_hv)
+					stage_hv = meow::make_unique<histogram_t>(hv_conf_);
+
+				auto& source_hv = by_source[source_key_t{r->stage, r->source}];
+				if (!source_hv)
+					source_hv = meow::make_unique<histogram_t>(hv_conf_);
+
+				r->merge_published_to(stage_hv.get(), now);
+				r->merge_published_to(source_hv.get(), now);
+			}
+
+			auto const make_row = [this](int stage, std::string const& source, histogram_t const& h)
+			{
+				return pipeline_latency_row_t {
+					.stage  = stage,
+					.source = source,
+					.count  = h.hv.total_count(),
+					.p50    = get_percentile(h.hv, hv_conf_, 50),
+					.p99    = get_percentile(h.hv, hv_conf_, 99),
+					.max    = h.max_value,
+				};
+			};
+
+			std::vector<pipeline_latency_row_t> result;
+			result.reserve(PINBA_PIPELINE_STAGE__COUNT + by_source.size());
+
+			for (int stage = 0; stage < PINBA_PIPELINE_STAGE__COUNT; stage++)
+			{
+				if (by_stage[stage])
+					result.push_back(make_row(stage, {}, *by_stage[stage]));
+			}
+
+			for (auto const& source_pair : by_source)
+				result.push_back(make_row(source_pair.first.first, source_pair.first.second, *source_pair.second));
+
+			return result;
+		}
+
+	private:
+		pinba_globals_t   *globals_;
+		histogram_conf_t  hv_conf_;
+
+		std::mutex        mtx_;
+		std::vector<std::weak_ptr<pipeline_latency_recorder_t>> recorders_;
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+pipeline_latency_ptr create_pipeline_latency(pinba_globals_t *globals)
+{
+	return meow::make_unique<aux::pipeline_latency_impl_t>(globals);
+}
@@ -0,0 +1,106 @@
+#include "pinba_config.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <meow/defer.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/os_symbols.h"
+#include "pinba/reclaimer.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct reclaimer_impl_t : public reclaimer_t
+	{
+		// producers don't wake the thread up, retired objects wait for the next round at most this long
+		static constexpr uint32_t const reclaim_interval_ms = 10;
+
+		reclaimer_impl_t(pinba_globals_t *globals)
+			: globals_(globals)
+		{
+			t_ = std::thread([this]() { this->reclaim_thread(); });
+		}
+
+		~reclaimer_impl_t()
+		{
+			{
+				std::lock_guard<std::mutex> lk_(mtx_);
+				stop_ = true;
+			}
+			cv_.notify_one();
+
+			t_.join();
+		}
+
+		virtual void retire_erased(std::shared_ptr<void> obj) override
+		{
+			{
+				std::lock_guard<std::mutex> lk_(mtx_);
+				queue_.push_back(std::move(obj));
+			}
+
+			globals_->stats()->reclaimer.objects_retired.fetch_add(1, std::memory_order_relaxed);
+		}
+
+	private:
+
+		void reclaim_thread()
+		{
+			PINBA___OS_CALL(globals_, set_thread_name, "reclaimer");
+
+			MEOW_DEFER(
+				LOG_DEBUG(globals_->logger(), "reclaimer; exiting");
+			);
+
+			std::vector<std::shared_ptr<void>> batch;
+
+			for (;;)
+			{
+				bool stop;
+				{
+					std::unique_lock<std::mutex> lk_(mtx_);
+					cv_.wait_for(lk_, std::chrono::milliseconds(reclaim_interval_ms), [this]() { return stop_; });
+
+					stop = stop_;
+					batch.swap(queue_);
+				}
+
+				// destructors run here, without holding the lock
+				size_t const n_objects = batch.size();
+				batch.clear();
+
+				if (n_objects > 0)
+					globals_->stats()->reclaimer.objects_freed.fetch_add(n_objects, std::memory_order_relaxed);
+
+				if (stop)
+					break;
+			}
+		}
+
+	private:
+		pinba_globals_t                     *globals_;
+
+		std::mutex                           mtx_;
+		std::condition_variable              cv_;
+		std::vector<std::shared_ptr<void>>   queue_; // protected by mtx_
+		bool                                 stop_ = false;
+
+		std::thread                          t_;
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+reclaimer_ptr create_reclaimer(pinba_globals_t *globals)
+{
+	return meow::make_unique<aux::reclaimer_impl_t>(globals);
+}
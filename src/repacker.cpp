@@ -1,5 +1,6 @@
 #include "pinba_config.h"
 
+#include <cmath>
 #include <thread>
 // #include <vector>
 
@@ -10,16 +11,22 @@
 #include <meow/unix/resource.hpp> // getrusage_ex
 
 #include "pinba/globals.h"
+#include "pinba/async_log.h"
 #include "pinba/os_symbols.h"
 #include "pinba/dictionary.h"
 #include "pinba/repacker_dictionary.h"
 #include "pinba/collector.h"
 #include "pinba/repacker.h"
+#include "pinba/nmpa_block_sizer.h"
 #include "pinba/packet.h"
 #include "pinba/packet_impl.h"
+#include "pinba/packet_wire.h"
+#include "pinba/packet_relay.h"
 
 #include "pinba/nmsg_socket.h"
 #include "pinba/nmsg_poller.h"
+#include "pinba/pipeline_latency.h"
+#include "pinba/probes.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 namespace { namespace aux {
@@ -259,6 +266,9 @@ namespace { namespace aux {
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+	constexpr uint32_t const repacker_max_threads          = 1024;
+	constexpr uint32_t const thread_stop_check_interval_ms = 100; // see repacker_impl_t::set_thread_count()
+
 	struct repacker_impl_t : public repacker_t
 	{
 	public:
@@ -268,6 +278,15 @@ namespace { namespace aux {
 			, stats_(globals->stats())
 			, conf_(conf)
 		{
+			if (conf_->n_threads == 0 || conf_->n_threads > repacker_max_threads)
+				throw std::runtime_error(ff::fmt_str("repacker_conf_t::n_threads must be within [1, {0}]", repacker_max_threads));
+
+			thread_stop_.reset(new std::atomic<bool>[repacker_max_threads]);
+			for (uint32_t i = 0; i < repacker_max_threads; i++)
+				thread_stop_[i].store(false, std::memory_order_relaxed);
+
+			// batches come back to the pool when the last report is done with them
+			packet_batch_pool_ = create_object_pool<packet_batch_t>(conf_->n_threads * 64, &stats_->objects.packet_pool_hit, &stats_->objects.packet_pool_miss);
 		}
 
 		~repacker_impl_t()
@@ -277,9 +296,12 @@ namespace { namespace aux {
 
 		virtual void startup() override
 		{
-			out_sock_
-				.open(AF_SP, NN_PUSH)
-				.bind(conf_->nn_output);
+			if (!conf_->out_ring)
+			{
+				out_sock_
+					.open(AF_SP, NN_PUSH)
+					.bind(conf_->nn_output);
+			}
 
 			shutdown_sock_
 				.open(AF_SP, NN_PULL)
@@ -289,33 +311,44 @@ namespace { namespace aux {
 				.open(AF_SP, NN_PUSH)
 				.connect(conf_->nn_shutdown);
 
+			// shared by all threads, connect is async, nanomsg reconnects by itself when upstream goes away
+			if (!conf_->relay_upstream.empty())
+			{
+				relay_out_sock_
+					.open(AF_SP, NN_PUSH)
+					.set_option(NN_SOL_SOCKET, NN_SNDBUF, relay_socket_sndbuf, conf_->relay_upstream)
+					.connect(conf_->relay_upstream);
+			}
 
-			stats_->repacker_threads.resize(conf_->n_threads);
-
-			for (uint32_t i = 0; i < conf_->n_threads; i++)
+			// batches are way over default max message size (1mb), when there are a lot of timers
+			if (!conf_->relay_listen.empty())
 			{
-				// open and connect to producer in main thread, to make exceptions catch-able easily
-				nmsg_socket_t input_sock;
-				input_sock
+				relay_in_sock_
 					.open(AF_SP, NN_PULL)
-					.connect(conf_->nn_input.c_str());
+					.set_option(NN_SOL_SOCKET, NN_RCVMAXSIZE, -1, conf_->relay_listen)
+					.bind(conf_->relay_listen);
+			}
 
-				if (conf_->nn_input_buffer > 0)
-					input_sock.set_option(NN_SOL_SOCKET, NN_RCVBUF, sizeof(raw_request_t) * conf_->nn_input_buffer, conf_->nn_input);
+			std::lock_guard<std::mutex> lk_(threads_mtx_);
 
-				// start worker threads
-				std::thread t([this, i, input_sock = std::move(input_sock)]() mutable
+			this->grow_thread_stats(conf_->n_threads);
+
+			for (uint32_t i = 0; i < conf_->n_threads; i++)
+				this->start_thread(i);
+
+			if (!conf_->relay_listen.empty())
+			{
+				relay_thread_ = std::thread([this]()
 				{
-					this->worker_thread(i, input_sock);
+					this->relay_thread();
 				});
-
-				// t.detach();
-				threads_.push_back(std::move(t));
 			}
 		}
 
 		virtual void shutdown() override
 		{
+			std::lock_guard<std::mutex> lk_(threads_mtx_);
+
 			if (threads_.empty())
 				return;
 
@@ -330,38 +363,232 @@ namespace { namespace aux {
 			}
 
 			threads_.clear();
+			n_threads_.store(0, std::memory_order_relaxed);
+
+			if (relay_thread_.joinable())
+				relay_thread_.join();
+		}
+
+		virtual pinba_error_t set_thread_count(uint32_t n_threads) override
+		{
+			if (n_threads == 0 || n_threads > repacker_max_threads)
+				return ff::fmt_err("repacker; thread count must be within [1, {0}], got {1}", repacker_max_threads, n_threads);
+
+			std::lock_guard<std::mutex> lk_(threads_mtx_);
+
+			if (threads_.empty())
+				return ff::fmt_err("repacker; not started");
+
+			uint32_t const n_before = threads_.size();
+
+			this->grow_thread_stats(n_threads);
+
+			while (threads_.size() < n_threads)
+				this->start_thread(threads_.size());
+
+			// stop all extra threads at once, they notice within thread_stop_check_interval_ms
+			for (uint32_t i = n_threads; i < threads_.size(); i++)
+				thread_stop_[i].store(true, std::memory_order_relaxed);
+
+			while (threads_.size() > n_threads)
+			{
+				threads_.back().join();
+				threads_.pop_back();
+				thread_stop_[threads_.size()].store(false, std::memory_order_relaxed);
+			}
+
+			n_threads_.store(n_threads, std::memory_order_relaxed);
+
+			LOG_INFO(globals_->logger(), "repacker; thread count changed {0} -> {1}", n_before, n_threads);
+			return {};
+		}
+
+		virtual uint32_t thread_count() const override
+		{
+			std::lock_guard<std::mutex> lk_(threads_mtx_);
+			return threads_.size();
+		}
+
+		virtual void set_packet_prefilter(packet_prefilter_ptr prefilter) override
+		{
+			std::atomic_store(&packet_prefilter_, std::move(prefilter));
 		}
 
 	private:
 
+		// relay sends all batches of a tick interval in bursts, about 1 sec of traffic fits
+		static constexpr int relay_socket_sndbuf = 32 * 1024 * 1024;
+
+		bool thread_stop_requested(uint32_t thread_id) const
+		{
+			return thread_stop_[thread_id].load(std::memory_order_relaxed);
+		}
+
+		// per-thread stats are never removed, stopped threads keep theirs until they start again
+		void grow_thread_stats(uint32_t n_threads)
+		{
+			std::lock_guard<std::mutex> lk_(stats_->mtx);
+
+			if (stats_->repacker_threads.size() < n_threads)
+				stats_->repacker_threads.resize(n_threads);
+
+			while (stats_->repacker_counter_threads.size() < n_threads)
+				stats_->repacker_counter_threads.emplace_back();
+		}
+
+		// under threads_mtx_, thread_id == threads_.size()
+		void start_thread(uint32_t i)
+		{
+			// open and connect to producer in main thread, to make exceptions catch-able easily
+			// (not needed when reading from in_ring, all threads share it)
+			nmsg_socket_t input_sock;
+			if (!conf_->in_ring)
+			{
+				input_sock
+					.open(AF_SP, NN_PULL)
+					.connect(conf_->nn_input.c_str());
+
+				if (conf_->nn_input_buffer > 0)
+					input_sock.set_option(NN_SOL_SOCKET, NN_RCVBUF, sizeof(raw_request_t) * conf_->nn_input_buffer, conf_->nn_input);
+			}
+
+			// start worker threads
+			std::thread t([this, i, input_sock = std::move(input_sock)]() mutable
+			{
+				this->worker_thread(i, input_sock);
+			});
+
+			threads_.push_back(std::move(t));
+			n_threads_.store(threads_.size(), std::memory_order_relaxed);
+		}
+
+		// batch nmpa block size, follows what this thread batches take (64KB to start with)
+		static nmpa_block_sizer_t& batch_nmpa_sizer()
+		{
+			static thread_local nmpa_block_sizer_t sizer { 64 * 1024, 4 * 1024, 512 * 1024 };
+			return sizer;
+		}
+
+		packet_batch_ptr create_batch(repacker_dictionary_t& r_dictionary)
+		{
+			size_t const nmpa_block_size = batch_nmpa_sizer().block_size();
+			auto batch = packet_batch_pool_->get(conf_->batch_size, nmpa_block_size);
+			batch->set_nmpa_block_size(nmpa_block_size);
+			batch->repacker_state = std::make_shared<repacker_state_impl_t>(r_dictionary.current_wordslice());
+			return batch;
+		}
+
+		void send_batch(packet_batch_ptr& batch, repacker_dictionary_t& r_dictionary)
+		{
+			r_dictionary.start_new_wordslice(); // make sure batch has only one wordslice
+
+			if (conf_->columnar_batches)
+				batch->build_columns();
+
+			batch_nmpa_sizer().observe(nmpa_mem_requested(&batch->nmpa));
+			batch->charge_mem();
+
+			if (conf_->out_ring)
+				conf_->out_ring->send_message(batch);
+			else
+				out_sock_.send_message(batch);
+		}
+
+		// never blocks, relay would rather drop batches than stop reading udp
+		void relay_send_batch(packet_batch_t const& batch, packet_relay_encoder_t *encoder, std::string *buf)
+		{
+			encoder->encode(batch.packets, batch.packet_count, buf);
+
+			int const n = nn_send(*relay_out_sock_, buf->data(), buf->size(), NN_DONTWAIT);
+			if (n < 0)
+			{
+				++stats_->packet_relay.batches_send_err;
+				return;
+			}
+
+			++stats_->packet_relay.batches_sent;
+			stats_->packet_relay.bytes_sent += buf->size();
+		}
+
 		void worker_thread(uint32_t thread_id, nmsg_socket_t& input_sock)
 		{
 			std::string const thr_name = ff::fmt_str("repacker/{0}", thread_id);
 
 			PINBA___OS_CALL(globals_, set_thread_name, thr_name);
+			pinba_set_thread_cpus(globals_, conf_->cpus, thr_name);
+			pinba_set_thread_sched(globals_, conf_->sched, thr_name);
 
 			MEOW_DEFER(
 				LOG_DEBUG(globals_->logger(), "{0}; exiting", thr_name);
 			);
 
-			// thread-local cache for global shared dictionary
-			repacker_dictionary_t r_dictionary { globals_->dictionary() };
+			// thread-local cache for global shared dictionary, handed over to other threads, if this one is stopped
+			std::unique_ptr<repacker_dictionary_t> r_dictionary_p = meow::make_unique<repacker_dictionary_t>(globals_->dictionary());
+			repacker_dictionary_t& r_dictionary = *r_dictionary_p;
+
+			// this thread only, see pinba_counter_t
+			auto& r_stats = stats_->repacker_counter_threads[thread_id];
+
+			// packet_debug dumps, logger is written to from async log thread
+			async_log_writer_t log_writer { globals_ };
+			double             debug_fraction = 1.0; // to start dumping immediately
+
+			// requests repacked together, after their dictionary words are prefetched, see repacker_conf_t::dictionary_prefetch
+			// wire decoders (for raw requests from collector) reuse their memory between windows
+			uint32_t const prefetch_window = std::max(conf_->dictionary_prefetch, 1u);
+			std::unique_ptr<pinba_wire_decoder_t[]> wire_decoders { new pinba_wire_decoder_t[prefetch_window] };
+			std::vector<Pinba__Request*>            pb_window(prefetch_window);
+
+			// how long raw batches took to get here from collector
+			pipeline_latency_recorder_ptr const latency = globals_->pipeline_latency()->create_recorder(PINBA_PIPELINE_STAGE__COLLECTOR, thr_name);
+
+			// adaptive batching, see repacker_conf_t::batch_latency_target
+			// batches are always allocated to hold conf_->batch_size packets, only the send threshold changes
+			bool const adaptive      = (conf_->batch_latency_target.nsec > 0);
+			uint32_t   batch_size    = conf_->batch_size;
+			duration_t batch_timeout = (adaptive && (conf_->batch_latency_target.nsec < conf_->batch_timeout.nsec))
+									? conf_->batch_latency_target // no packet waits longer than that, even when idle
+									: conf_->batch_timeout;
+			double     packet_rate   = 0;   // smoothed, packets/sec
+			uint64_t   packets_since_adjust = 0;
+			timeval_t  last_adjust_tv = os_unix::clock_monotonic_now();
+
+			// ingest budget sampling, see repacker_conf_t::ingest_budget
+			// rate is measured before sampling (packet_rate above is after), budget is split evenly between threads
+			// (thread count might change, see set_thread_count())
+			double     ingest_budget    = 0;
+			double     ingest_rate      = 0;
+			uint64_t   ingested_since_adjust = 0;
+			uint32_t   ingest_keep_every = 1; // 1-in-N requests are kept
+			uint64_t   ingest_seq        = 0;
+
+			str_ref const sample_rate_tag = str_ref { conf_->sample_rate_tag };
+
+			// relay-only mode, batches go upstream and are not used here at all
+			std::unique_ptr<packet_relay_encoder_t> relay_encoder;
+			std::string                             relay_buf;
+			if (!conf_->relay_upstream.empty())
+				relay_encoder = meow::make_unique<packet_relay_encoder_t>(globals_->dictionary());
 
 			// batch state
 			auto const create_batch = [&]()
 			{
-				constexpr size_t nmpa_block_size = 64 * 1024;
-				auto batch = meow::make_intrusive<packet_batch_t>(conf_->batch_size, nmpa_block_size);
-				batch->repacker_state = std::make_shared<repacker_state_impl_t>(r_dictionary.current_wordslice());
-				return batch;
+				return this->create_batch(r_dictionary);
 			};
 
 			auto const try_send_batch = [&](packet_batch_ptr& batch)
 			{
-				r_dictionary.start_new_wordslice(); // make sure batch has only one wordslice
+				++r_stats.batch_send_total;
+				PINBA_PROBE2(repacker_batch_send, thread_id, batch->packet_count);
 
-				++stats_->repacker.batch_send_total;
-				out_sock_.send_message(batch);
+				if (relay_encoder)
+				{
+					this->relay_send_batch(*batch, relay_encoder.get(), &relay_buf);
+					r_dictionary.start_new_wordslice(); // words are released with the batch, as usual
+					return;
+				}
+
+				this->send_batch(batch, r_dictionary);
 			};
 
 			packet_batch_ptr batch = create_batch();
@@ -370,41 +597,103 @@ namespace { namespace aux {
 			nmsg_poller_t poller;
 
 			// extra stats
-			poller.before_poll([this](timeval_t now, duration_t wait_for)
+			poller.before_poll([&r_stats](timeval_t now, duration_t wait_for)
 			{
-				++stats_->repacker.poll_total;
+				++r_stats.poll_total;
 			});
 
 			// resetable periodic event, to 'idly' send batch at regular intervals
-			auto batch_send_tick = poller.ticker_with_reset(conf_->batch_timeout, [&](timeval_t now)
+			auto batch_send_tick = poller.ticker_with_reset(batch_timeout, [&](timeval_t now)
 			{
 				if (!batch || batch->packet_count == 0)
 					return;
 
-				++stats_->repacker.batch_send_by_timer;
+				++r_stats.batch_send_by_timer;
 
 				try_send_batch(batch);
 				batch = create_batch();
 			});
 
+			// measure packet rate, and pick batch size for it (rate is measured even with static batching, for stats)
+			// small enough interval to react to traffic spikes quickly, smoothed to not jump around on every burst
+			poller.ticker(100 * d_millisecond, [&](timeval_t now)
+			{
+				double const elapsed_sec = timeval_to_double(now - last_adjust_tv);
+				if (elapsed_sec <= 0)
+					return;
+
+				double const curr_rate = double(packets_since_adjust) / elapsed_sec;
+				packet_rate = (packet_rate == 0) ? curr_rate : (0.7 * packet_rate + 0.3 * curr_rate);
+
+				packets_since_adjust = 0;
+				last_adjust_tv       = now;
+
+				ingest_budget = double(conf_->ingest_budget) / std::max(n_threads_.load(std::memory_order_relaxed), 1u);
+				if (ingest_budget > 0)
+				{
+					double const curr_ingest_rate = double(ingested_since_adjust) / elapsed_sec;
+					ingest_rate = (ingest_rate == 0) ? curr_ingest_rate : (0.7 * ingest_rate + 0.3 * curr_ingest_rate);
+					ingested_since_adjust = 0;
+
+					ingest_keep_every = (ingest_rate > ingest_budget)
+							? uint32_t(std::min(std::ceil(ingest_rate / ingest_budget), double(PINBA_LIMIT___MAX_SAMPLE_RATE)))
+							: 1;
+				}
+
+				if (!adaptive)
+					return;
+
+				constexpr uint32_t const min_batch_size = 16;
+
+				double const latency_sec = timeval_to_double(timeval_from_duration(conf_->batch_latency_target));
+				double const want_size   = packet_rate * latency_sec / conf_->batch_fill_target;
+
+				batch_size = (want_size >= conf_->batch_size)
+						? conf_->batch_size
+						: std::max(std::min(min_batch_size, conf_->batch_size), uint32_t(want_size));
+
+				// current batch might be over the new threshold already, send it right away
+				if (batch && (batch->packet_count >= batch_size))
+				{
+					++r_stats.batch_send_by_size;
+
+					try_send_batch(batch);
+					batch = create_batch();
+
+					poller.reset_ticker(batch_send_tick, now);
+				}
+			});
+
 			// periodically get rusage
-			poller.ticker(1 * d_second, [this, thread_id](timeval_t now)
+			poller.ticker(1 * d_second, [&, this, thread_id](timeval_t now)
 			{
 				os_rusage_t const ru = os_unix::getrusage_ex(RUSAGE_THREAD);
 
 				std::lock_guard<std::mutex> lk_(stats_->mtx);
-				stats_->repacker_threads[thread_id].ru_utime = timeval_from_os_timeval(ru.ru_utime);
-				stats_->repacker_threads[thread_id].ru_stime = timeval_from_os_timeval(ru.ru_stime);
+				auto& thread_stats = stats_->repacker_threads[thread_id];
+				thread_stats.ru_utime      = timeval_from_os_timeval(ru.ru_utime);
+				thread_stats.ru_stime      = timeval_from_os_timeval(ru.ru_stime);
+				thread_stats.batch_size    = batch_size;
+				thread_stats.batch_timeout = batch_timeout;
+				thread_stats.packet_rate   = packet_rate;
+				thread_stats.dictionary_mem_used = r_dictionary.mem_used();
 			});
 
 			// reap old dictionary wordslices periodically
 			// 250ms is hand-tuned with a synthetic test at ~400k random 32byte strings/sec
 			// might be made tunable, but no need for now
+			// this only finds unused slices and starts reaping them, rest is done bit by bit after processing input (see on_input)
 			poller.ticker(250 * d_millisecond, [&](timeval_t now)
 			{
 				meow::stopwatch_t sw;
 
-				auto const reap_stats = r_dictionary.reap_unused_wordslices();
+				auto const reap_stats = r_dictionary.reap_unused_wordslices(conf_->dictionary_reap_words);
+
+				// same for threads that are gone, whoever comes first does it
+				this->reap_retired_dictionaries();
+
+				// words loaded from dictionary image are no longer held after a while, whoever comes first does it
+				globals_->dictionary()->image_release_if_expired(now);
 
 				// LOG_DEBUG(globals_->logger(),
 				// 	"{0}; reaping old dictionary wordslices; time: {1}, slices: {2}, words_local: {3}, words_global: {4}",
@@ -419,64 +708,209 @@ namespace { namespace aux {
 			});
 
 			// process incoming packets
-			poller.read_nn_socket(input_sock, [&](timeval_t now)
+			auto const recv_raw_request = [&]() -> raw_request_ptr
 			{
-				constexpr size_t const max_batches_per_poll_iteration = 4;
+				return (conf_->in_ring)
+					? conf_->in_ring->recv_dontwait()
+					: input_sock.recv<raw_request_ptr>(thr_name, NN_DONTWAIT);
+			};
 
-				for (size_t i = 0; i < max_batches_per_poll_iteration; ++i)
+			auto const on_raw_request = [&](raw_request_ptr const& req, timeval_t now)
+			{
+				latency->record(now, req->created_tv);
+				PINBA_PROBE2(repacker_batch_recv, thread_id, req->request_count);
+
+				// one load per raw batch, reports come and go rarely
+				packet_prefilter_ptr const prefilter = std::atomic_load(&packet_prefilter_);
+
+				// R = Pinba__Request or pinba_wire_request_t, validated
+				auto const prefilter_pass = [&](auto const *r) -> bool
 				{
-					++stats_->repacker.recv_total;
+					// packet debug wants to see everything, even with no reports
+					if (!prefilter || prefilter->pass_all || globals_->options()->packet_debug)
+						return true;
 
-					// receive in a loop with NN_DONTWAIT to avoid hanging here when we're out of incoming data
-					auto const req = input_sock.recv<raw_request_ptr>(thr_name, NN_DONTWAIT);
-					if (!req) { // EAGAIN
-						++stats_->repacker.recv_eagain;
-						break;
-					}
+					timertag_bloom_t bloom;
+					pinba_request_to_timertag_bloom(r, &r_dictionary, &bloom);
 
-					for (uint32_t i = 0; i < req->request_count; i++)
-					{
-						++stats_->repacker.recv_packets;
+					if (prefilter->pass(bloom))
+						return true;
+
+					++r_stats.packet_prefilter_drop;
+					return false;
+				};
+
+				// ingest budget sampling, same requests of a script are not dropped every time, as the sequence number is mixed in
+				auto const ingest_pass = [&](auto const *r) -> bool
+				{
+					if (ingest_keep_every <= 1)
+						return true;
+
+					uint64_t const script_hash = dictionary_word_hasher_t()(pb_string_as_str_ref(r->script_name));
+					if ((pinba::hash_mix64(script_hash ^ ingest_seq++) % ingest_keep_every) == 0)
+						return true;
+
+					++r_stats.packet_ingest_sampled;
+					return false;
+				};
+
+				// kept requests stand for the ones sampled out
+				auto const ingest_scale = [&](packet_t *packet) -> packet_t*
+				{
+					if (packet && ingest_keep_every > 1)
+						packet->sample_rate = uint32_t(std::min(uint64_t(packet->sample_rate) * ingest_keep_every, uint64_t(PINBA_LIMIT___MAX_SAMPLE_RATE)));
+					return packet;
+				};
+
+				// two-phase, a window of requests at a time, see repacker_conf_t::dictionary_prefetch
+				//  1. decode, validate and filter, dictionary words of requests that pass are prefetched
+				//  2. repack requests that passed, all dictionary lookups are local hits now
+				auto const window_pass = [&](auto const *r) -> bool
+				{
+					if (!ingest_pass(r) || !prefilter_pass(r))
+						return false;
+
+					if (conf_->dictionary_prefetch > 0)
+						pinba_request_prefetch_words(r, &r_dictionary);
 
-						 // non-const, since pinba_validate_request() might change the packet
-						auto *pb_req = req->requests[i];
+					return true;
+				};
+
+				for (uint32_t window_begin = 0; window_begin < req->request_count; window_begin += prefetch_window)
+				{
+					uint32_t const window_end = std::min(req->request_count, window_begin + prefetch_window);
+					uint32_t       n_window   = 0;
+
+					for (uint32_t i = window_begin; i < window_end; i++)
+					{
+						++r_stats.recv_packets;
+						++ingested_since_adjust;
 
 						// validation should not fail, generally.
 						// pinba is expected to be mostly receiving traffic from trusted sources (your code, mon!)
-						auto const vr = pinba_validate_request(pb_req);
-						if (vr != request_validate_result::okay)
+						// raw requests are decoded and validated in one go, see collector_conf_t::defer_decode
+						bool const passed = [&]() -> bool
 						{
-							++stats_->repacker.packet_validate_err;
-							LOG_DEBUG(globals_->logger(), "request validation failed: {0}: {1}", vr, enum_as_str_ref(vr));
-							continue;
-						}
+							if (req->datagrams)
+							{
+								pinba_wire_decoder_t& wire_decoder = wire_decoders[n_window];
+
+								auto const vr = wire_decoder.decode(req->datagrams[i]);
+								if (vr != request_validate_result::okay)
+								{
+									++r_stats.packet_validate_err;
+									PINBA_PROBE2(repacker_packet_invalid, thread_id, int(vr));
+									LOG_DEBUG(globals_->logger(), "request decode failed: {0}: {1}", vr, enum_as_str_ref(vr));
+									return false;
+								}
+
+								return window_pass(wire_decoder.request());
+							}
 
-						packet_t *packet = pinba_request_to_packet(pb_req, &r_dictionary, &batch->nmpa);
+							// non-const, since pinba_validate_request() might change the packet
+							auto *pb_req = req->requests[i];
 
-						if (globals_->options()->packet_debug)
-						{
-							static double curr_fraction = 1.0; // to start dumping immediately
+							auto const vr = pinba_validate_request(pb_req);
+							if (vr != request_validate_result::okay)
+							{
+								++r_stats.packet_validate_err;
+								PINBA_PROBE2(repacker_packet_invalid, thread_id, int(vr));
+								LOG_DEBUG(globals_->logger(), "request validation failed: {0}: {1}", vr, enum_as_str_ref(vr));
+								return false;
+							}
+
+							pb_window[n_window] = pb_req;
+							return window_pass(pb_req);
+						}();
+
+						if (passed)
+							n_window++;
+					}
 
-							if (curr_fraction >= 1.0)
+					r_dictionary.prefetch_commit();
+
+					for (uint32_t window_i = 0; window_i < n_window; window_i++)
+					{
+						// summaries might become more than one packet, see pinba_summary_to_packets()
+						// those are allocated from batch nmpa, so all of them must fit the same batch
+						// (PINBA_LIMIT___MAX_SUMMARY_BUCKETS is below repacker_batch_messages min)
+						packet_t *packets[PINBA_LIMIT___MAX_SUMMARY_BUCKETS];
+						uint32_t  n_packets = 0;
+
+						auto const repack = [&](auto const *r)
+						{
+							if (r->summary_count > 0)
 							{
-								auto sink = meow::logging::logger_as_sink(*globals_->logger(), meow::logging::log_level::info, meow::line_mode::prefix);
-								debug_dump_packet(sink, packet, globals_->dictionary(), &batch->nmpa);
+								uint32_t const max_packets = std::max<uint32_t>(1, r->n_summary_hist_count);
+								if (batch->packet_count > 0 && (batch->packet_count + max_packets > conf_->batch_size))
+								{
+									++r_stats.batch_send_by_size;
+
+									try_send_batch(batch);
+									batch = create_batch();
 
-								curr_fraction = globals_->options()->packet_debug_fraction;
+									poller.reset_ticker(batch_send_tick, now);
+								}
 							}
-							else
+
+							packet_t *packet = pinba_request_to_packet(r, &r_dictionary, &batch->nmpa, &batch->tagsets, sample_rate_tag);
+							if (!packet)
+								return;
+
+							if (r->summary_count == 0)
 							{
-								curr_fraction += globals_->options()->packet_debug_fraction;
+								packets[n_packets++] = packet;
+								return;
 							}
-						}
 
-						// append to current batch
-						batch->packets[batch->packet_count] = packet;
-						batch->packet_count++;
+							n_packets = pinba_summary_to_packets(r, packet, &batch->nmpa, packets);
 
-						if (batch->packet_count >= conf_->batch_size)
+							++r_stats.packet_summaries;
+							r_stats.packet_summary_requests += r->summary_count;
+						};
+
+						if (req->datagrams)
+							repack(wire_decoders[window_i].request());
+						else
+							repack(pb_window[window_i]);
+
+						if (n_packets == 0)
+							continue;
+
+						for (uint32_t packet_i = 0; packet_i < n_packets; packet_i++)
 						{
-							++stats_->repacker.batch_send_by_size;
+							packet_t *packet = ingest_scale(packets[packet_i]);
+
+							if (globals_->options()->packet_debug)
+							{
+								if (debug_fraction >= 1.0)
+								{
+									std::string& dump = log_writer.scratch();
+									debug_dump_packet(dump, packet, globals_->dictionary(), &batch->nmpa);
+									log_writer.write(meow::logging::log_level::info, dump);
+
+									debug_fraction = globals_->options()->packet_debug_fraction;
+								}
+								else
+								{
+									debug_fraction += globals_->options()->packet_debug_fraction;
+								}
+							}
+
+							// append to current batch
+							if (batch->packet_count == 0)
+								batch->created_tv = now;
+
+							batch->packets[batch->packet_count] = packet;
+							batch->packet_count++;
+							batch->summary.add_packet(packet);
+
+							packets_since_adjust++;
+						}
+
+						if (batch->packet_count >= batch_size)
+						{
+							++r_stats.batch_send_by_size;
 
 							try_send_batch(batch);
 							batch = create_batch();
@@ -487,16 +921,236 @@ namespace { namespace aux {
 						}
 					}
 				}
+			};
+
+			auto const on_input = [&](timeval_t now)
+			{
+				constexpr size_t const max_batches_per_poll_iteration = 4;
+
+				for (size_t i = 0; i < max_batches_per_poll_iteration; ++i)
+				{
+					++r_stats.recv_total;
+
+					// receive in a loop with NN_DONTWAIT to avoid hanging here when we're out of incoming data
+					auto const req = recv_raw_request();
+					if (!req) { // EAGAIN
+						++r_stats.recv_eagain;
+						break;
+					}
+
+					on_raw_request(req, now);
+				}
+
+				// continue reaping dictionary, a small chunk per iteration, to avoid stalling packet processing
+				if (r_dictionary.has_unreaped_wordslices())
+					r_dictionary.reap_unused_wordslices(conf_->dictionary_reap_words);
+			};
+
+			// stopped by set_thread_count(), raw requests already queued to our socket are repacked first, batch is sent
+			// (with in_ring there is nothing to do, other threads read it as well)
+			bool stopped = false;
+			poller.ticker(thread_stop_check_interval_ms * d_millisecond, [&](timeval_t now)
+			{
+				if (!this->thread_stop_requested(thread_id))
+					return;
+
+				// bounded, collector keeps sending to us until the socket is closed
+				if (!conf_->in_ring)
+				{
+					for (size_t i = 0, n_max = std::max<size_t>(conf_->nn_input_buffer, 64); i < n_max; i++)
+					{
+						auto const req = recv_raw_request();
+						if (!req)
+							break;
+
+						on_raw_request(req, now);
+					}
+				}
+
+				if (batch && batch->packet_count > 0)
+					try_send_batch(batch);
+
+				stopped = true;
+				poller.set_shutdown_flag();
 			});
 
+			if (conf_->in_ring)
+				poller.read_nmsg_ring(*conf_->in_ring, on_input);
+			else
+				poller.read_nn_socket(input_sock, on_input);
+
 			poller.loop();
 
+			// batch references current wordslice, must be gone before dictionary is given away
+			if (stopped)
+			{
+				batch.reset();
+				this->retire_dictionary(std::move(r_dictionary_p));
+			}
+
 			// thread exits here
 		}
 
+		// dictionary of a stopped thread still holds words, that reports might be using
+		// any thread that's running takes care of releasing them, as usual, see reap_retired_dictionaries()
+		void retire_dictionary(std::unique_ptr<repacker_dictionary_t> r_dictionary)
+		{
+			r_dictionary->retire();
+
+			std::lock_guard<std::mutex> lk_(retired_mtx_);
+			retired_dictionaries_.push_back(std::move(r_dictionary));
+		}
+
+		void reap_retired_dictionaries()
+		{
+			std::unique_lock<std::mutex> lk_(retired_mtx_, std::try_to_lock);
+			if (!lk_.owns_lock())
+				return;
+
+			for (auto it = retired_dictionaries_.begin(); it != retired_dictionaries_.end(); )
+			{
+				(*it)->reap_unused_wordslices(conf_->dictionary_reap_words);
+
+				if ((*it)->empty())
+					it = retired_dictionaries_.erase(it);
+				else
+					++it;
+			}
+		}
+
+		// batches from relays (see packet_relay.h), one incoming batch becomes one local batch
+		// (or a few, if relay has larger repacker_batch_messages than we do)
+		void relay_thread()
+		{
+			std::string const thr_name = "repacker/relay";
+
+			PINBA___OS_CALL(globals_, set_thread_name, thr_name);
+			pinba_set_thread_cpus(globals_, conf_->cpus, thr_name);
+			pinba_set_thread_sched(globals_, conf_->sched, thr_name);
+
+			MEOW_DEFER(
+				LOG_DEBUG(globals_->logger(), "{0}; exiting", thr_name);
+			);
+
+			repacker_dictionary_t  r_dictionary { globals_->dictionary() };
+			packet_relay_decoder_t decoder { &r_dictionary };
+
+			packet_batch_ptr batch = this->create_batch(r_dictionary);
+
+			// malformed batches come from the same misconfigured relay over and over, don't flood the log
+			timeval_t next_warn_tv = {0,0};
+			auto const decode_failed = [&](timeval_t now, pinba_error_t const& err)
+			{
+				++stats_->packet_relay.batches_decode_err;
+
+				if (now < next_warn_tv)
+					return;
+
+				next_warn_tv = now + timeval_from_duration(10 * d_second);
+				LOG_WARN(globals_->logger(), "{0}; relayed batch dropped: {1}", thr_name, err.what());
+			};
+
+			auto const send_batch = [&]()
+			{
+				this->send_batch(batch, r_dictionary);
+				batch = this->create_batch(r_dictionary);
+				decoder.forget_words(); // words must be in the new wordslice as well
+			};
+
+			auto const recv_one = [&](timeval_t now) -> bool
+			{
+				void *buf = nullptr;
+
+				int const n = nn_recv(*relay_in_sock_, &buf, NN_MSG, NN_DONTWAIT);
+				if (n < 0)
+				{
+					int const err = nn_errno();
+					if (err != EAGAIN)
+						LOG_WARN(globals_->logger(), "{0}; nn_recv() failed: {1}:{2}", thr_name, err, nn_strerror(err));
+					return false;
+				}
+
+				MEOW_DEFER(
+					nn_freemsg(buf);
+				);
+
+				++stats_->packet_relay.batches_received;
+
+				pinba_error_t const err = decoder.open(str_ref { (char const*)buf, size_t(n) });
+				if (err)
+				{
+					decode_failed(now, err);
+					return true;
+				}
+
+				// one load per relayed batch, relay does not know what reports we have
+				packet_prefilter_ptr const prefilter = std::atomic_load(&packet_prefilter_);
+
+				while (packet_t *packet = decoder.next_packet(&batch->nmpa, &batch->tagsets))
+				{
+					++stats_->packet_relay.packets_received;
+
+					// packet memory is wasted until the batch is recycled, but the bloom is only known after decode
+					if (prefilter && !prefilter->pass_all && !prefilter->pass(packet->bloom))
+						continue;
+
+					if (batch->packet_count == 0)
+						batch->created_tv = now;
+
+					batch->packets[batch->packet_count] = packet;
+					batch->packet_count++;
+					batch->summary.add_packet(packet);
+
+					if (batch->packet_count >= conf_->batch_size)
+						send_batch();
+				}
+
+				if (decoder.error())
+					decode_failed(now, decoder.error());
+
+				if (batch->packet_count > 0)
+					send_batch();
+
+				return true;
+			};
+
+			nmsg_poller_t poller;
+
+			// same as repacker threads, see worker_thread()
+			poller.ticker(250 * d_millisecond, [&](timeval_t now)
+			{
+				r_dictionary.reap_unused_wordslices(conf_->dictionary_reap_words);
+			});
+
+			poller.read_nn_socket(shutdown_sock_, [&](timeval_t now)
+			{
+				LOG_DEBUG(globals_->logger(), "{0}; got shutdown signal", thr_name);
+				poller.set_shutdown_flag();
+			});
+
+			poller.read_nn_socket(relay_in_sock_, [&](timeval_t now)
+			{
+				constexpr size_t const max_batches_per_poll_iteration = 4;
+
+				for (size_t i = 0; i < max_batches_per_poll_iteration; ++i)
+				{
+					if (!recv_one(now))
+						break;
+				}
+
+				if (r_dictionary.has_unreaped_wordslices())
+					r_dictionary.reap_unused_wordslices(conf_->dictionary_reap_words);
+			});
+
+			poller.loop();
+		}
+
 	private:
 		nmsg_socket_t    out_sock_;
 
+		nmsg_socket_t    relay_out_sock_;
+		nmsg_socket_t    relay_in_sock_;
+
 		nmsg_socket_t    shutdown_sock_;
 		nmsg_socket_t    shutdown_cli_sock_;
 		std::mutex       shutdown_mtx_;
@@ -505,7 +1159,18 @@ namespace { namespace aux {
 		pinba_stats_t    *stats_;
 		repacker_conf_t  *conf_;
 
-		std::vector<std::thread> threads_;
+		object_pool_ptr<packet_batch_t> packet_batch_pool_;
+		packet_prefilter_ptr            packet_prefilter_; // atomic_load/atomic_store only
+
+		mutable std::mutex              threads_mtx_;  // startup/shutdown/set_thread_count()
+		std::vector<std::thread>        threads_;      // thread_id = index
+		std::thread                     relay_thread_; // see repacker_conf_t::relay_listen
+		std::atomic<uint32_t>           n_threads_ = { 0 }; // threads_.size(), for threads to read
+
+		std::unique_ptr<std::atomic<bool>[]> thread_stop_; // repacker_max_threads, see set_thread_count()
+
+		std::mutex                                          retired_mtx_;
+		std::deque<std::unique_ptr<repacker_dictionary_t>> retired_dictionaries_; // see retire_dictionary()
 	};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1,4 +1,5 @@
 #include <array>
+#include <atomic>
 #include <utility>
 
 #include <meow/defer.hpp>
@@ -51,18 +52,20 @@ namespace { namespace aux {
 
 		void tick___data_increment(tick_t *tick, packet_t *packet)
 		{
-			tick->data.req_count   += 1;
-			tick->data.timer_count += packet->timer_count;
-			tick->data.time_total  += packet->request_time;
-			tick->data.ru_utime    += packet->ru_utime;
-			tick->data.ru_stime    += packet->ru_stime;
-			tick->data.traffic     += packet->traffic;
-			tick->data.mem_used    += packet->mem_used;
+			uint32_t const sample_rate = packet->sample_rate * sample_scale_;
+
+			tick->data.req_count   += sample_rate;
+			tick->data.timer_count += uint32_t(packet->timer_count) * sample_rate;
+			tick->data.time_total  += packet___scaled(packet->request_time, sample_rate);
+			tick->data.ru_utime    += packet___scaled(packet->ru_utime, sample_rate);
+			tick->data.ru_stime    += packet___scaled(packet->ru_stime, sample_rate);
+			tick->data.traffic     += uint64_t(packet->traffic) * sample_rate;
+			tick->data.mem_used    += uint64_t(packet->mem_used) * sample_rate;
 		}
 
 		void tick___hv_increment(tick_t *tick, packet_t *packet, histogram_conf_t const& hv_conf)
 		{
-			tick->hv->increment(hv_conf, packet->request_time);
+			tick->hv->increment(hv_conf, packet->request_time, packet->sample_rate * sample_scale_);
 		}
 
 	public:
@@ -70,28 +73,28 @@ namespace { namespace aux {
 		report_agg___by_packet_t(pinba_globals_t *globals, report_conf___by_packet_t const& conf, report_info_t const& rinfo)
 			: globals_(globals)
 			, stats_(nullptr)
+			, counters_(nullptr)
 			, conf_(conf)
 			, hv_conf_(histogram___configure_with_rinfo(rinfo))
 		{
+			filter_program_.compile(conf_.filters);
+
 			this->tick_now({});
 		}
 
 		virtual void stats_init(report_stats_t *stats) override
 		{
 			stats_ = stats;
+			counters_ = report_stats___add_thread(stats);
 		}
 
 		virtual void add(packet_t *packet) override
 		{
 			// run all filters and check if packet is 'interesting to us'
-			for (size_t i = 0, i_end = conf_.filters.size(); i < i_end; ++i)
+			if (!filter_program_.run(packet))
 			{
-				auto const& filter = conf_.filters[i];
-				if (!filter.func(packet))
-				{
-					stats_->packets_dropped_by_filters++;
-					return;
-				}
+				counters_->packets_dropped_by_filters++;
+				return;
 			}
 
 			// apply packet data
@@ -102,13 +105,73 @@ namespace { namespace aux {
 				tick___hv_increment(tick_.get(), packet, hv_conf_);
 			}
 
-			stats_->packets_aggregated++;
+			counters_->packets_aggregated++;
 		}
 
 		virtual void add_multi(packet_t **packets, uint32_t packet_count) override
 		{
-			for (uint32_t i = 0; i < packet_count; ++i)
-				this->add(packets[i]);
+			packet_t *batch[report_agg___batch_size];
+
+			for (uint32_t offset = 0; offset < packet_count; offset += report_agg___batch_size)
+			{
+				uint32_t const chunk_size = std::min(report_agg___batch_size, packet_count - offset);
+				std::copy(packets + offset, packets + offset + chunk_size, batch);
+
+				uint32_t const n_passed = filter_program_.run_batch(batch, chunk_size);
+				counters_->packets_dropped_by_filters += (chunk_size - n_passed);
+
+				// single row report, just a few fields touched per packet, and update stats once per chunk
+				for (uint32_t i = 0; i < n_passed; ++i)
+				{
+					tick___data_increment(tick_.get(), batch[i]);
+
+					if (conf_.hv_bucket_count > 0)
+						tick___hv_increment(tick_.get(), batch[i], hv_conf_);
+				}
+
+				counters_->packets_aggregated += n_passed;
+			}
+		}
+
+		// same as add_multi(), but scans columns sequentially, packets are only touched by custom filters
+		virtual void add_batch(packet_columns_t const *columns, packet_t **packets) override
+		{
+			packet_columns_t const& c = *columns;
+			uint32_t sel[report_agg___batch_size];
+
+			for (uint32_t offset = 0; offset < c.count; offset += report_agg___batch_size)
+			{
+				uint32_t const chunk_size = std::min(report_agg___batch_size, c.count - offset);
+				for (uint32_t i = 0; i < chunk_size; ++i)
+					sel[i] = offset + i;
+
+				uint32_t const n_passed = filter_program_.run_columns(c, packets, sel, chunk_size);
+				counters_->packets_dropped_by_filters += (chunk_size - n_passed);
+
+				tick_t *tick = tick_.get();
+
+				for (uint32_t i = 0; i < n_passed; ++i)
+				{
+					uint32_t const k           = sel[i];
+					uint32_t const sample_rate = c.sample_rate[k] * sample_scale_;
+
+					tick->data.req_count   += sample_rate;
+					tick->data.timer_count += (c.timer_offset[k + 1] - c.timer_offset[k]) * sample_rate;
+					tick->data.time_total  += packet___scaled(c.request_time[k], sample_rate);
+					tick->data.ru_utime    += packet___scaled(c.ru_utime[k], sample_rate);
+					tick->data.ru_stime    += packet___scaled(c.ru_stime[k], sample_rate);
+					tick->data.traffic     += uint64_t(c.traffic[k]) * sample_rate;
+					tick->data.mem_used    += uint64_t(c.mem_used[k]) * sample_rate;
+				}
+
+				if (conf_.hv_bucket_count > 0)
+				{
+					for (uint32_t i = 0; i < n_passed; ++i)
+						tick->hv->increment(hv_conf_, c.request_time[sel[i]], c.sample_rate[sel[i]] * sample_scale_);
+				}
+
+				counters_->packets_aggregated += n_passed;
+			}
 		}
 
 		virtual report_tick_ptr tick_now(timeval_t curr_tv) override
@@ -130,15 +193,186 @@ namespace { namespace aux {
 			return result;
 		}
 
+		// see report_agg_t::set_sample_scale()
+		virtual void set_sample_scale(uint32_t scale) override
+		{
+			sample_scale_ = scale;
+		}
+
 	private:
 		pinba_globals_t            *globals_;
 		report_stats_t             *stats_;
+		report_thread_counters_t   *counters_;
 		report_conf___by_packet_t  conf_;
+		uint32_t                   sample_scale_ = 1;
 		histogram_conf_t           hv_conf_;
+		packet_filter_program_t    filter_program_;
 
 		tick_ptr                   tick_;
 	};
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct report_live___by_packet_impl_t
+		: public report_live___by_packet_t
+		, public std::enable_shared_from_this<report_live___by_packet_impl_t>
+	{
+		report_live___by_packet_impl_t(pinba_globals_t *globals, report_info_t const& rinfo)
+			: globals_(globals)
+			, rinfo_(rinfo)
+			, hv_conf_(histogram___configure_with_rinfo(rinfo))
+			, seq_(0)
+			, covered_ticks_(0)
+		{
+			for (auto& v : values_)
+				v.store(0, std::memory_order_relaxed);
+		}
+
+		// history only, added went into the window, evicted has just gone out of it, any of them can be nullptr
+		void tick_merged(report_row_data___by_packet_t const *added, report_row_data___by_packet_t const *evicted, uint32_t covered_ticks)
+		{
+			int64_t add[n_values] = {};
+			int64_t sub[n_values] = {};
+
+			if (added)
+				to_values(*added, add);
+			if (evicted)
+				to_values(*evicted, sub);
+
+			// seq is odd while values are being changed
+			uint64_t const seq = seq_.load(std::memory_order_relaxed);
+			seq_.store(seq + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			for (unsigned i = 0; i < n_values; i++)
+				values_[i].store(values_[i].load(std::memory_order_relaxed) + add[i] - sub[i], std::memory_order_relaxed);
+
+			covered_ticks_.store(covered_ticks, std::memory_order_relaxed);
+
+			seq_.store(seq + 2, std::memory_order_release);
+		}
+
+		virtual void read(report_row_data___by_packet_t *data, duration_t *time_window_covered) const override
+		{
+			int64_t  values[n_values];
+			uint32_t covered_ticks;
+
+			for (;;)
+			{
+				uint64_t const seq_before = seq_.load(std::memory_order_acquire);
+				if (seq_before & 1)
+					continue; // writer is in the middle of a few stores, just wait it out
+
+				for (unsigned i = 0; i < n_values; i++)
+					values[i] = values_[i].load(std::memory_order_relaxed);
+
+				covered_ticks = covered_ticks_.load(std::memory_order_relaxed);
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (seq_.load(std::memory_order_relaxed) == seq_before)
+					break;
+			}
+
+			data->req_count   = (uint32_t)values[value__req_count];
+			data->timer_count = (uint32_t)values[value__timer_count];
+			data->time_total  = duration_t { values[value__time_total] };
+			data->ru_utime    = duration_t { values[value__ru_utime] };
+			data->ru_stime    = duration_t { values[value__ru_stime] };
+			data->traffic     = (uint64_t)values[value__traffic];
+			data->mem_used    = (uint64_t)values[value__mem_used];
+
+			*time_window_covered = report_history___covered_time(rinfo_, covered_ticks);
+		}
+
+		virtual report_snapshot_ptr get_snapshot() const override;
+
+		pinba_globals_t*        globals() const { return globals_; }
+		report_info_t const&    rinfo() const   { return rinfo_; }
+		histogram_conf_t const& hv_conf() const { return hv_conf_; }
+
+	private:
+
+		enum : unsigned
+		{
+			value__req_count = 0,
+			value__timer_count,
+			value__time_total,
+			value__ru_utime,
+			value__ru_stime,
+			value__traffic,
+			value__mem_used,
+			n_values,
+		};
+
+		static void to_values(report_row_data___by_packet_t const& row, int64_t *values)
+		{
+			values[value__req_count]   = row.req_count;
+			values[value__timer_count] = row.timer_count;
+			values[value__time_total]  = row.time_total.nsec;
+			values[value__ru_utime]    = row.ru_utime.nsec;
+			values[value__ru_stime]    = row.ru_stime.nsec;
+			values[value__traffic]     = (int64_t)row.traffic;
+			values[value__mem_used]    = (int64_t)row.mem_used;
+		}
+
+	private:
+		pinba_globals_t          *globals_;
+		report_info_t            rinfo_;
+		histogram_conf_t         hv_conf_;
+
+		std::atomic<uint64_t>    seq_;
+		std::atomic<int64_t>     values_[n_values];  // sums over ticks in history ring
+		std::atomic<uint32_t>    covered_ticks_;
+	};
+	using report_live___by_packet_impl_ptr = std::shared_ptr<report_live___by_packet_impl_t>;
+
+	// the only row is totals as well, position is row number
+	struct report_snapshot___by_packet_live_t : public report_snapshot_t
+	{
+		report_snapshot___by_packet_live_t(std::shared_ptr<report_live___by_packet_impl_t const> live)
+			: live_(std::move(live))
+		{
+			live_->read(&data_, &time_window_covered_);
+		}
+
+		virtual report_info_t const*         report_info() const override         { return &live_->rinfo(); }
+		virtual histogram_conf_t const*      histogram_conf() const override      { return &live_->hv_conf(); }
+		virtual duration_t                   time_window_covered() const override { return time_window_covered_; }
+		virtual dictionary_t const*          dictionary() const override          { return live_->globals()->dictionary(); }
+		virtual snapshot_dictionary_t const* snapshot_dictionary() const override { return nullptr; } // no keys
+
+		virtual void prepare(merge_flags_t) override                    {}
+		virtual bool is_prepared() const override                       { return true; }
+		virtual void set_key_filter(report_key_filter_t const&) override {} // no keys
+
+		virtual size_t     row_count() const override                                       { return 1; }
+		virtual position_t pos_first() override                                             { return position_t { { 0 } }; }
+		virtual position_t pos_last() override                                              { return position_t { { 1 } }; }
+		virtual position_t pos_next(position_t const& pos) override                         { return position_t { { pos.dummy___[0] + 1 } }; }
+		virtual bool       pos_equal(position_t const& l, position_t const& r) const override { return l.dummy___[0] == r.dummy___[0]; }
+		virtual position_t pos_find(report_key_t const&) override                           { return this->pos_last(); }
+
+		virtual report_key_t     get_key(position_t const&) const override     { return {}; }
+		virtual report_key_str_t get_key_str(position_t const&) const override { return {}; }
+
+		virtual int   data_kind() const override                   { return live_->rinfo().kind; }
+		virtual void* get_data(position_t const&) override         { return &data_; }
+		virtual void* get_data_totals() const override             { return (void*)&data_; }
+
+		virtual int   histogram_kind() const override              { return live_->rinfo().hv_kind; }
+		virtual void* get_histogram(position_t const&) override    { return nullptr; }
+
+	private:
+		std::shared_ptr<report_live___by_packet_impl_t const> live_;
+		report_row_data___by_packet_t                         data_;
+		duration_t                                            time_window_covered_;
+	};
+
+	report_snapshot_ptr report_live___by_packet_impl_t::get_snapshot() const
+	{
+		return meow::make_unique<report_snapshot___by_packet_live_t>(this->shared_from_this());
+	}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 	struct report_history___by_packet_t : public report_history_t
@@ -148,12 +382,13 @@ namespace { namespace aux {
 
 	public:
 
-		report_history___by_packet_t(pinba_globals_t *globals, report_info_t const& rinfo)
+		report_history___by_packet_t(pinba_globals_t *globals, report_info_t const& rinfo, report_live___by_packet_impl_ptr live)
 			: globals_(globals)
 			, stats_(nullptr)
 			, rinfo_(rinfo)
 			, hv_conf_(histogram___configure_with_rinfo(rinfo))
-			, ring_(rinfo.tick_count)
+			, ring_(rinfo.tick_count * rinfo.agg_threads) // every aggregator thread produces its own tick
+			, live_(std::move(live))
 		{
 		}
 
@@ -164,7 +399,12 @@ namespace { namespace aux {
 
 		virtual void merge_tick(report_tick_ptr tick) override
 		{
-			ring_.append(std::move(tick));
+			auto const *added_data = (tick) ? &static_cast<report_tick___by_packet_t const&>(*tick).data : nullptr;
+
+			report_tick_ptr const evicted = ring_.append(tick);
+
+			auto const *evicted_data = (evicted) ? &static_cast<report_tick___by_packet_t const&>(*evicted).data : nullptr;
+			live_->tick_merged(added_data, evicted_data, ring_.covered_ticks());
 		}
 
 		virtual report_estimates_t get_estimates() override
@@ -180,9 +420,19 @@ namespace { namespace aux {
 				using src_ticks_t = ringbuffer_t;
 				using hashtable_t = std::array<report_row___by_packet_t, 1>; // array to get iterators 'for free'
 
+				// single row, nothing to partition
+				static constexpr bool can_merge_partitioned = false;
+
 				static report_key_t key_at_position(hashtable_t const&, hashtable_t::iterator const& it)    { return {}; }
 				static void*        value_at_position(hashtable_t const&, hashtable_t::iterator const& it)  { return (void*)it; }
 				static void*        hv_at_position(hashtable_t const&, hashtable_t::iterator const& it)     { return it->hv.get(); }
+				static hashtable_t::iterator find_key(hashtable_t& ht, report_key_t const&)                { return ht.end(); } // no keys
+
+				// single row, no hashtable to reserve
+				static uint32_t estimate_unique_rows(report_snapshot_ctx_t *snapshot_ctx, src_ticks_t const& ticks)
+				{
+					return 0;
+				}
 
 				static void calculate_raw_stats(report_snapshot_ctx_t *snapshot_ctx, src_ticks_t const& ticks, report_raw_stats_t *stats)
 				{
@@ -213,10 +463,13 @@ namespace { namespace aux {
 					  report_snapshot_ctx_t *snapshot_ctx
 					, src_ticks_t& ticks
 					, hashtable_t& to
-					, report_snapshot_t::merge_flags_t flags)
+					, report_snapshot_t::merge_flags_t flags
+					, report_snapshot_partition_t const& part)
 				{
 					bool const need_histograms = (snapshot_ctx->rinfo.hv_enabled && (flags & report_snapshot_t::merge_flags::with_histograms));
 
+					assert(part.count == 1);
+
 					for (auto const& tick : ticks)
 					{
 						if (!tick)
@@ -255,6 +508,7 @@ namespace { namespace aux {
 				.stats          = stats_,
 				.rinfo          = rinfo_,
 				.estimates      = this->get_estimates(),
+				.time_window_covered = report_history___covered_time(rinfo_, ring_.covered_ticks()),
 				.hv_conf        = hv_conf_,
 				.nmpa           = nmpa_autofree_t(64 * 1024),
 			};
@@ -269,6 +523,8 @@ namespace { namespace aux {
 		histogram_conf_t             hv_conf_;
 
 		report_history_ringbuffer_t  ring_;
+
+		report_live___by_packet_impl_ptr  live_;
 	};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -284,13 +540,19 @@ namespace { namespace aux {
 				.kind            = REPORT_KIND__BY_PACKET_DATA,
 				.time_window     = conf_.time_window,
 				.tick_count      = conf_.tick_count,
+				.agg_threads     = std::max<uint32_t>(1, conf_.agg_threads),
 				.n_key_parts     = 0,
 				.hv_enabled      = (conf_.hv_bucket_count > 0),
 				.hv_kind         = HISTOGRAM_KIND__HDR,
 				.hv_bucket_count = conf_.hv_bucket_count,
 				.hv_bucket_d     = conf_.hv_bucket_d,
 				.hv_min_value    = conf_.hv_min_value,
+				.hv_rel_accuracy = conf_.hv_rel_accuracy,
 			};
+
+			batch_filter_.add_filters(conf_.filters);
+
+			live_ = std::make_shared<report_live___by_packet_impl_t>(globals_, rinfo_);
 		}
 
 		virtual str_ref name() const override
@@ -310,13 +572,26 @@ namespace { namespace aux {
 
 		virtual report_history_ptr create_history() override
 		{
-			return std::make_shared<report_history___by_packet_t>(globals_, rinfo_);
+			return std::make_shared<report_history___by_packet_t>(globals_, rinfo_, live_);
+		}
+
+		report_live___by_packet_impl_ptr const& live() const
+		{
+			return live_;
+		}
+
+		virtual packet_batch_filter_t const* batch_filter() const override
+		{
+			return &batch_filter_;
 		}
 
 	private:
 		pinba_globals_t            *globals_;
 		report_info_t              rinfo_;
 		report_conf___by_packet_t  conf_;
+		packet_batch_filter_t      batch_filter_;
+
+		report_live___by_packet_impl_ptr  live_;  // shared with history
 	};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -327,3 +602,9 @@ report_ptr create_report_by_packet(pinba_globals_t *globals, report_conf___by_pa
 {
 	return std::make_shared<aux::report___by_packet_t>(globals, conf);
 }
+
+report_live___by_packet_ptr report_by_packet___get_live(report_t *report)
+{
+	auto const *r = dynamic_cast<aux::report___by_packet_t const*>(report);
+	return (r) ? r->live() : nullptr;
+}
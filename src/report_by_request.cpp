@@ -6,24 +6,55 @@
 #include <meow/utility/offsetof.hpp> // MEOW_SELF_FROM_MEMBER
 
 #include "pinba/globals.h"
+#include "pinba/hash.h"
 #include "pinba/histogram.h"
+#include "pinba/hyperloglog.h"
 #include "pinba/multi_merge.h"
 #include "pinba/packet.h"
+#include "pinba/reclaimer.h"
 #include "pinba/repacker.h"
 #include "pinba/report.h"
 #include "pinba/report_util.h"
 #include "pinba/report_by_request.h"
+#include "pinba/tag_lookup.h"
+#include "pinba/word_bitmap.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 namespace { namespace aux {
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-	template<size_t NKeys>
+	// HashtableP - report_hashtable___*_t, see report_util.h
+	template<size_t NKeys, class HashtableP>
 	struct report___by_request_t : public report_t
 	{
 		using key_t   = report_key_impl_t<NKeys>;
 		using data_t  = report_row_data___by_request_t;
 
+		using exemplar_t       = report_exemplar___by_request_t;
+		using exemplar_heap_t  = std::vector<exemplar_t>; // min-heap by request_time, see exemplar_heap___add()
+
+		static bool exemplar_heap___cmp(exemplar_t const& a, exemplar_t const& b)
+		{
+			return (a.request_time > b.request_time); // fastest on top
+		}
+
+		static void exemplar_heap___add(exemplar_heap_t& heap, exemplar_t const& e, uint32_t max_size)
+		{
+			if (heap.size() < max_size)
+			{
+				heap.push_back(e);
+				std::push_heap(heap.begin(), heap.end(), exemplar_heap___cmp);
+				return;
+			}
+
+			if (e.request_time <= heap.front().request_time)
+				return;
+
+			std::pop_heap(heap.begin(), heap.end(), exemplar_heap___cmp);
+			heap.back() = e;
+			std::push_heap(heap.begin(), heap.end(), exemplar_heap___cmp);
+		}
+
 		using this_report_t       = report___by_request_t;
 		using this_report_conf_t  = report_conf___by_request_t;
 
@@ -49,6 +80,10 @@ namespace { namespace aux {
 		{
 			std::deque<tick_item_t>      items;
 			std::deque<hdr_histogram_t>  hvs;
+			std::deque<hll_sketch_t>     distinct; // same offsets as items, only when distinct counting is enabled
+			std::deque<word_bitmap_t>    distinct_exact; // same, instead of distinct, see report_conf___by_request_t::distinct_exact
+			std::deque<exemplar_heap_t>  exemplars;      // same offsets as items, only when exemplars_count > 0
+			uint32_t                     exemplars_count = 0; // heap size limit, set on tick_now(), for snapshots to merge with
 
 			struct nmpa_s                hv_nmpa;
 
@@ -79,13 +114,7 @@ namespace { namespace aux {
 		{
 			// map: key -> offset in tick->items and tick->hvs
 			struct hashtable_t
-				: public tsl::robin_map<
-								  key_t
-								, uint32_t
-								, report_key_impl___hasher_t
-								, report_key_impl___equal_t
-								, std::allocator<std::pair<key_t, uint32_t>>
-								, /*StoreHash=*/ true>
+				: public HashtableP::template map_t<key_t, uint32_t>
 			{
 			};
 
@@ -111,6 +140,14 @@ namespace { namespace aux {
 				if (conf_.hv_bucket_count > 0)
 					tick_->hvs.emplace_back(&tick_->hv_nmpa, hv_conf_);
 
+				if (distinct_enabled_ && conf_.distinct_exact)
+					tick_->distinct_exact.emplace_back();
+				else if (distinct_enabled_)
+					tick_->distinct.emplace_back();
+
+				if (conf_.exemplars_count > 0)
+					tick_->exemplars.emplace_back();
+
 				assert(tick_->items.size() < size_t(INT_MAX));
 				uint32_t const new_off = static_cast<uint32_t>(tick_->items.size() - 1);
 
@@ -118,23 +155,56 @@ namespace { namespace aux {
 				return new_off;
 			}
 
+			// DataSkip - REPORT_DATA_SKIP__* bits, conf_.data_skip
+			template<uint32_t DataSkip>
 			void raw_item_increment(key_t const& k, packet_t const *packet)
 			{
 				uint32_t const offset = this->raw_item_offset_get(k);
 
 				tick_item_t& item = tick_->items[offset];
 
-				item.data.req_count  += 1;
-				item.data.time_total += packet->request_time;
-				item.data.ru_utime   += packet->ru_utime;
-				item.data.ru_stime   += packet->ru_stime;
-				item.data.traffic    += packet->traffic;
-				item.data.mem_used   += packet->mem_used;
+				uint32_t const sample_rate = packet->sample_rate * sample_scale_;
 
-				if (conf_.hv_bucket_count > 0)
+				item.data.req_count  += sample_rate;
+				item.data.time_total += packet___scaled(packet->request_time, sample_rate);
+
+				if (!(DataSkip & REPORT_DATA_SKIP__RUSAGE))
+				{
+					item.data.ru_utime   += packet___scaled(packet->ru_utime, sample_rate);
+					item.data.ru_stime   += packet___scaled(packet->ru_stime, sample_rate);
+				}
+
+				if (!(DataSkip & REPORT_DATA_SKIP__TRAFFIC))
+					item.data.traffic    += uint64_t(packet->traffic) * sample_rate;
+
+				if (!(DataSkip & REPORT_DATA_SKIP__MEM_USED))
+					item.data.mem_used   += uint64_t(packet->mem_used) * sample_rate;
+
+				if ((conf_.hv_bucket_count > 0) && hv_collect_)
 				{
 					auto& hv = tick_->hvs[offset];
-					hv.increment(hv_conf_, packet->request_time);
+					hv.increment(hv_conf_, packet->request_time, sample_rate);
+				}
+
+				if (distinct_enabled_)
+				{
+					report_conf___by_request_t::key_fetch_result_t const r = conf_.distinct_key.fetcher(packet);
+					if (r.found && conf_.distinct_exact)
+						tick_->distinct_exact[offset].add(r.key_value);
+					else if (r.found)
+						tick_->distinct[offset].add_hash(pinba::hash_mix64(r.key_value));
+				}
+
+				if (conf_.exemplars_count > 0)
+				{
+					exemplar_t const e = {
+						.request_time = packet->request_time,
+						.host_id      = packet->host_id,
+						.server_id    = packet->server_id,
+						.script_id    = packet->script_id,
+						.status       = packet->status,
+					};
+					exemplar_heap___add(tick_->exemplars[offset], e, conf_.exemplars_count);
 				}
 			}
 
@@ -143,28 +213,58 @@ namespace { namespace aux {
 			aggregator_t(pinba_globals_t *globals, report_conf___by_request_t const& conf, report_info_t const& rinfo)
 				: globals_(globals)
 				, stats_(nullptr)
+				, counters_(nullptr)
 				, conf_(conf)
 				, hv_conf_(histogram___configure_with_rinfo(rinfo))
+				, distinct_enabled_(!!conf.distinct_key.fetcher)
+				, has_rtag_keys_(std::any_of(conf.keys.begin(), conf.keys.end(), [](auto const& kd) { return kd.request_tag_id != 0; }))
+				, tagset_cache_()
+				, tagset_generation_(0)
+				, key_kernel_(key_kernel___select(conf))
+				, add_filtered_func_(add_filtered___select(key_kernel_, conf.data_skip))
 				, tick_(meow::make_intrusive<tick_t>())
 			{
+				filter_program_.compile(conf_.filters);
+
+				for (size_t i = 0; i < NKeys; ++i)
+					key_fields_[i] = conf_.keys[i].request_field;
 			}
 
 			virtual void stats_init(report_stats_t *stats) override
 			{
 				stats_ = stats;
+				counters_ = report_stats___add_thread(stats);
 			}
 
 			virtual report_tick_ptr tick_now(timeval_t curr_tv) override
 			{
+				tick_->exemplars_count = conf_.exemplars_count;
+
 				report_tick_ptr result = std::move(tick_);
 				tick_ = meow::make_intrusive<tick_t>();
 
+				// hvs are still there for every item (history expects them), just left empty
+				hv_collect_ = report_stats___hv_collect(stats_, conf_.hv_idle_d, curr_tv);
+
+				// keep hashtable sized for the last tick row count (next one is usually similar)
+				// shrink only when it's way too big, same as timer report tick arenas
+				size_t const n_rows = tick_ht_.size();
 				tick_ht_.clear();
-				tick_ht_.rehash(0); // shrinks the hashtable
+
+				if (tick_ht_.bucket_count() > n_rows * tick_ht_shrink_ratio)
+				{
+					tick_ht_.rehash(0);
+					tick_ht_.reserve(n_rows);
+				}
 
 				return result;
 			}
 
+			virtual void set_sample_scale(uint32_t scale) override
+			{
+				sample_scale_ = scale;
+			}
+
 			virtual report_estimates_t get_estimates() override
 			{
 				report_estimates_t result = {};
@@ -185,59 +285,252 @@ namespace { namespace aux {
 				result.mem_used += tick_->hvs.size() * sizeof(*tick_->hvs.begin());
 				result.mem_used += nmpa_mem_used(&tick_->hv_nmpa);
 
+				// distinct sketches
+				result.mem_used += tick_->distinct.size() * sizeof(*tick_->distinct.begin());
+
+				for (auto const& bitmap : tick_->distinct_exact)
+					result.mem_used += bitmap.mem_used();
+
+				// exemplars, heaps grow to exemplars_count quickly, don't bother walking them
+				result.mem_used += tick_->exemplars.size() * (sizeof(exemplar_heap_t) + conf_.exemplars_count * sizeof(exemplar_t));
+
 				return result;
 			}
 
 			virtual void add(packet_t *packet) override
 			{
 				// run all filters and check if packet is 'interesting to us'
-				for (size_t i = 0, i_end = conf_.filters.size(); i < i_end; ++i)
+				if (!filter_program_.run(packet))
+				{
+					counters_->packets_dropped_by_filters++;
+					return;
+				}
+
+				// single packets might come from any batch, so no tagset ids here
+				(this->*add_filtered_func_)(packet, false);
+			}
+
+			virtual void add_multi(packet_t **packets, uint32_t packet_count) override
+			{
+				// all packets are from the same batch, tagset_cache_ entries from previous batches are stale now
+				tagset_generation_++;
+
+				packet_t *batch[report_agg___batch_size];
+
+				for (uint32_t offset = 0; offset < packet_count; offset += report_agg___batch_size)
 				{
-					auto const& filter = conf_.filters[i];
-					if (!filter.func(packet))
+					uint32_t const chunk_size = std::min(report_agg___batch_size, packet_count - offset);
+					std::copy(packets + offset, packets + offset + chunk_size, batch);
+
+					// pass 1: filters over the whole chunk
+					uint32_t const n_passed = filter_program_.run_batch(batch, chunk_size);
+					counters_->packets_dropped_by_filters += (chunk_size - n_passed);
+
+					// pass 2: key fetchers are likely to scan request tags, start loading those
+					for (uint32_t i = 0; i < n_passed; ++i)
 					{
-						stats_->packets_dropped_by_filters++;
-						return;
+						__builtin_prefetch(batch[i]->tag_name_ids);
+						__builtin_prefetch(batch[i]->tag_value_ids());
 					}
+
+					// pass 3: key extraction and aggregation
+					for (uint32_t i = 0; i < n_passed; ++i)
+						(this->*add_filtered_func_)(batch[i], true);
 				}
+			}
 
-				// construct a key, by runinng all key fetchers
-				key_t k;
+		private:
 
+			// positions of request tag key parts in packet tag names, if packet has all of them
+			// depends on packet tag names only, so is the same for all packets with the same tagset_id
+			bool find_request_tag_positions(packet_t const *packet, uint32_t *positions) const
+			{
+				for (size_t i = 0, i_end = conf_.keys.size(); i < i_end; ++i)
+				{
+					uint32_t const name_id = conf_.keys[i].request_tag_id;
+					if (name_id == 0)
+						continue;
+
+					uint32_t const tag_i = tag_lookup___find(packet->tag_name_ids, packet->tag_count, name_id);
+					if (tag_i == packet->tag_count)
+						return false;
+
+					positions[i] = tag_i;
+				}
+
+				return true;
+			}
+
+			// key construction, picked once at report creation for the whole key spec, see add_filtered()
+			enum : int
+			{
+				key_kernel__generic      = 0, // runs conf_.keys fetchers one by one
+				key_kernel__fields       = 1, // request fields only, NKeys loads with nothing to check
+				key_kernel__fields_rtags = 2, // request fields and tags, tags are loads by tagset positions (generic without those)
+			};
+
+			using add_filtered_func_t = void (aggregator_t::*)(packet_t*, bool);
+
+			static int key_kernel___select(report_conf___by_request_t const& conf)
+			{
+				bool const all_fields = std::all_of(conf.keys.begin(), conf.keys.end(), [](auto const& kd) { return kd.request_field != nullptr; });
+				if (all_fields)
+					return key_kernel__fields;
+
+				bool const fields_rtags = std::all_of(conf.keys.begin(), conf.keys.end(), [](auto const& kd) { return (kd.request_field != nullptr) || (kd.request_tag_id != 0); });
+				if (fields_rtags)
+					return key_kernel__fields_rtags;
+
+				return key_kernel__generic;
+			}
+
+			template<int KeyKernel>
+			static add_filtered_func_t add_filtered___select(uint32_t data_skip)
+			{
+				switch (data_skip)
+				{
+					case 0: return &aggregator_t::add_filtered<KeyKernel, 0>;
+					case 1: return &aggregator_t::add_filtered<KeyKernel, 1>;
+					case 2: return &aggregator_t::add_filtered<KeyKernel, 2>;
+					case 3: return &aggregator_t::add_filtered<KeyKernel, 3>;
+					case 4: return &aggregator_t::add_filtered<KeyKernel, 4>;
+					case 5: return &aggregator_t::add_filtered<KeyKernel, 5>;
+					case 6: return &aggregator_t::add_filtered<KeyKernel, 6>;
+					default: return &aggregator_t::add_filtered<KeyKernel, 7>;
+				}
+			}
+
+			static add_filtered_func_t add_filtered___select(int key_kernel, uint32_t data_skip)
+			{
+				switch (key_kernel)
+				{
+					case key_kernel__fields:       return add_filtered___select<key_kernel__fields>(data_skip);
+					case key_kernel__fields_rtags: return add_filtered___select<key_kernel__fields_rtags>(data_skip);
+					default:                       return add_filtered___select<key_kernel__generic>(data_skip);
+				}
+			}
+
+			// request tag key positions for packet, nullptr if there are none (no tagset or no rtag keys)
+			// false = packet tagset doesn't have all key tags, packet is not for us
+			bool rtag_positions_get(packet_t const *packet, bool const use_tagsets, uint32_t const **result)
+			{
+				*result = nullptr;
+
+				if (!use_tagsets || !has_rtag_keys_ || packet->tagset_id == 0)
+					return true;
+
+				tagset_positions_t& tp = tagset_cache_[packet->tagset_id];
+
+				if (tp.generation != tagset_generation_)
+				{
+					tp.generation = tagset_generation_;
+					tp.found      = this->find_request_tag_positions(packet, tp.positions);
+				}
+
+				if (!tp.found)
+					return false;
+
+				*result = tp.positions;
+				return true;
+			}
+
+			// construct a key, by runinng all key fetchers
+			bool key_fetch___generic(packet_t *packet, uint32_t const *rtag_positions, key_t& k)
+			{
 				for (size_t i = 0, i_end = conf_.keys.size(); i < i_end; ++i)
 				{
 					auto const& key_descriptor = conf_.keys[i];
 
-					report_conf___by_request_t::key_fetch_result_t const r = key_descriptor.fetcher(packet);
-					if (!r.found)
+					if (rtag_positions && key_descriptor.request_tag_id != 0)
 					{
-						stats_->packets_dropped_by_rtag++;
-						return;
+						k[i] = packet->tag_value_ids()[rtag_positions[i]];
+						continue;
 					}
 
+					report_conf___by_request_t::key_fetch_result_t const r = key_descriptor.fetcher(packet);
+					if (!r.found)
+						return false;
+
 					k[i] = r.key_value;
 				}
 
-				// finally - find and update item
-				this->raw_item_increment(k, packet);
-
-				stats_->packets_aggregated++;
+				return true;
 			}
 
-			virtual void add_multi(packet_t **packets, uint32_t packet_count) override
+			// packet has passed filters, construct key and aggregate
+			// use_tagsets - packet_t::tagset_id values are from the batch tagset_cache_ has been filled with
+			// KeyKernel - key_kernel__*, DataSkip - REPORT_DATA_SKIP__* bits, see add_filtered___select()
+			template<int KeyKernel, uint32_t DataSkip>
+			void add_filtered(packet_t *packet, bool const use_tagsets)
 			{
-				for (uint32_t i = 0; i < packet_count; ++i)
-					this->add(packets[i]);
+				key_t k;
+
+				if (KeyKernel == key_kernel__fields)
+				{
+					// NKeys is known here, loop is unrolled
+					for (size_t i = 0; i < NKeys; ++i)
+						k[i] = packet->*key_fields_[i];
+				}
+				else
+				{
+					// request tag key parts are a single load each, when packet tag names have been seen in this batch
+					uint32_t const *rtag_positions = nullptr;
+
+					if (!this->rtag_positions_get(packet, use_tagsets, &rtag_positions))
+					{
+						counters_->packets_dropped_by_rtag++;
+						return;
+					}
+
+					if (KeyKernel == key_kernel__fields_rtags && rtag_positions)
+					{
+						for (size_t i = 0; i < NKeys; ++i)
+							k[i] = (key_fields_[i]) ? packet->*key_fields_[i] : packet->tag_value_ids()[rtag_positions[i]];
+					}
+					else if (!this->key_fetch___generic(packet, rtag_positions, k))
+					{
+						counters_->packets_dropped_by_rtag++;
+						return;
+					}
+				}
+
+				// finally - find and update item, with skipped columns compiled out
+				this->raw_item_increment<DataSkip>(k, packet);
+
+				counters_->packets_aggregated++;
 			}
 
 		private:
 			pinba_globals_t              *globals_;
 			report_stats_t               *stats_;
+			report_thread_counters_t     *counters_;
 			report_conf___by_request_t   conf_;
+			uint32_t                     sample_scale_ = 1; // see set_sample_scale()
+			bool                         hv_collect_   = true; // see report_stats___hv_collect(), updated on tick
 			histogram_conf_t             hv_conf_;
+			bool                         distinct_enabled_;
+			packet_filter_program_t      filter_program_;
+
+			// request tag key positions by packet_t::tagset_id, valid for current add_multi() batch only
+			struct tagset_positions_t
+			{
+				uint64_t  generation;  // filled for batch with this tagset_generation_, 0 = never
+				bool      found;       // false = packets with this tagset don't have all key tags
+				uint32_t  positions[NKeys];
+			};
+			bool                         has_rtag_keys_;
+			tagset_positions_t           tagset_cache_[timer_tagset_interner_t::max_ids + 1];
+			uint64_t                     tagset_generation_;
+
+			// see key_kernel___select()
+			int                          key_kernel_;
+			add_filtered_func_t          add_filtered_func_;
+			uint32_t packet_t::*         key_fields_[NKeys]; // conf_.keys request fields, nullptr for other key parts
 
 			boost::intrusive_ptr<tick_t> tick_;
 			hashtable_t                  tick_ht_;
+
+			static constexpr size_t      tick_ht_shrink_ratio = 8; // see tick_now()
 		};
 
 	public: // history
@@ -253,17 +546,37 @@ namespace { namespace aux {
 				uint64_t                       mem_used = 0;
 
 				std::deque<tick_item_t>        items; // should be the same as aggregator tick items, to move data
-				std::vector<flat_histogram_t>  hvs;   // keep this as vector, as we can preallocate (and need to copy anyway)
+				packed_flat_histograms_t       hvs;   // unpacked on access, see packed_flat_histograms_t
+				std::deque<hll_sketch_t>       distinct; // moved from aggregator tick as is, empty when distinct counting is off
+				std::deque<word_bitmap_t>      distinct_exact; // same, exact distinct counting
+				std::deque<exemplar_heap_t>    exemplars;      // same, empty when exemplars are off
+				uint32_t                       exemplars_count = 0;
+
+				// HISTOGRAM_KIND__HDR - aggregator tick is kept as is for its hvs (and nmpa they live in), hvs above are empty
+				// these are read only from now on, never increment or merge into them
+				boost::intrusive_ptr<tick_t>   hdr_tick;
+
+				report_tick_hash_index_t       hash_index; // only built when histograms are enabled, see hv_at_position()
+
+				report_key_sketch_ptr          key_sketch; // big ticks only, see estimate_unique_rows()
+
+			public:
+
+				hdr_histogram_t const& hdr_hv(size_t offset) const
+				{
+					return hdr_tick->hvs[offset];
+				}
 			};
 
 		public:
 
-			history_t(pinba_globals_t *globals, report_info_t const& rinfo)
+			history_t(pinba_globals_t *globals, report_info_t const& rinfo, report_live_estimates_ptr live_estimates)
 				: globals_(globals)
 				, stats_(nullptr)
 				, rinfo_(rinfo)
 				, hv_conf_(histogram___configure_with_rinfo(rinfo))
-				, ring_(rinfo.tick_count)
+				, ring_(rinfo.tick_count * rinfo.agg_threads) // every aggregator thread produces its own tick
+				, live_estimates_(std::move(live_estimates))
 			{
 			}
 
@@ -285,66 +598,72 @@ namespace { namespace aux {
 				h_tick->items = std::move(agg_tick->items);
 				h_tick->mem_used += h_tick->items.size() * sizeof(*h_tick->items.begin());
 
+				h_tick->key_sketch = report_key_sketch___build(h_tick->items.size(), [&](size_t i) { return h_tick->items[i].key_hash; });
+				if (h_tick->key_sketch)
+					h_tick->mem_used += sizeof(*h_tick->key_sketch);
+
+				h_tick->distinct = std::move(agg_tick->distinct);
+				h_tick->mem_used += h_tick->distinct.size() * sizeof(*h_tick->distinct.begin());
+
+				h_tick->distinct_exact = std::move(agg_tick->distinct_exact);
+				for (auto const& bitmap : h_tick->distinct_exact)
+					h_tick->mem_used += bitmap.mem_used();
+
+				h_tick->exemplars       = std::move(agg_tick->exemplars);
+				h_tick->exemplars_count = agg_tick->exemplars_count;
+				for (auto const& heap : h_tick->exemplars)
+					h_tick->mem_used += sizeof(heap) + heap.capacity() * sizeof(exemplar_t);
+
+				// keep hdr histograms in hdr form, dense counts are merged with plain array adds in snapshots
+				if (rinfo_.hv_enabled && (rinfo_.hv_kind == HISTOGRAM_KIND__HDR))
+				{
+					h_tick->mem_used += agg_tick->hvs.size() * sizeof(*agg_tick->hvs.begin());
+					h_tick->mem_used += nmpa_mem_used(&agg_tick->hv_nmpa);
+
+					h_tick->hdr_tick = agg_tick;
+
+					assert(h_tick->items.size() == agg_tick->hvs.size());
+
+					report_tick_hash_index___build(&h_tick->hash_index, h_tick->items);
+					h_tick->mem_used += h_tick->hash_index.capacity() * sizeof(*h_tick->hash_index.begin());
+				}
 				// migrate histograms, converting them from hashtable to flat
-				if (rinfo_.hv_enabled)
+				else if (rinfo_.hv_enabled)
 				{
 					h_tick->hvs.reserve(agg_tick->hvs.size()); // we know the size in advance, mon
-					h_tick->mem_used += h_tick->hvs.capacity() * sizeof(*h_tick->hvs.begin());
 
 					for (auto const& src_hv : agg_tick->hvs)
-					{
-						h_tick->hvs.emplace_back(std::move(histogram___convert_hdr_to_flat(src_hv, hv_conf_)));
+						h_tick->hvs.push_back(flat_histogram___summarize(histogram___convert_hdr_to_flat(src_hv, hv_conf_), rinfo_.hv_summary_points));
 
-						h_tick->mem_used += h_tick->hvs.back().values.capacity() * sizeof(*h_tick->hvs.back().values.begin());
-					}
+					h_tick->hvs.shrink_to_fit();
+					h_tick->mem_used += h_tick->hvs.mem_used();
 
 					// sanity
 					assert(h_tick->items.size() == agg_tick->hvs.size());
+
+					report_tick_hash_index___build(&h_tick->hash_index, h_tick->items);
+					h_tick->mem_used += h_tick->hash_index.capacity() * sizeof(*h_tick->hash_index.begin());
+				}
+
+				totals_.add(h_tick->items.size(), sizeof(*h_tick) + h_tick->mem_used);
+
+				report_tick_ptr const evicted = ring_.append(std::move(h_tick));
+				if (evicted)
+				{
+					auto const& tick = static_cast<history_tick_t const&>(*evicted);
+					totals_.subtract(tick.items.size(), sizeof(tick) + tick.mem_used);
 				}
 
-				ring_.append(std::move(h_tick));
+				repacker_states_.reset();
+				this->publish();
 			}
 
 			virtual report_estimates_t get_estimates() override
 			{
 				report_estimates_t result = {};
 
-				result.row_count = [&]() -> uint32_t
-				{
-					auto const& ringbuf = ring_.get_ringbuffer();
-					if (ringbuf.empty())
-						return 0;
-
-					uint32_t non_unique_rows = 0;
-
-					for (auto const& tick_base : ringbuf)
-					{
-						auto const& tick = static_cast<history_tick_t const&>(*tick_base);
-						non_unique_rows += tick.items.size();
-					}
-
-					// got stats from snapshot merge with exact values, adjust based uniq to total rows ratio
-					if (stats_->last_snapshot_src_rows && stats_->last_snapshot_uniq_rows)
-					{
-						double const uniq_to_raw_fraction = (double)stats_->last_snapshot_uniq_rows / stats_->last_snapshot_src_rows;
-						return non_unique_rows * uniq_to_raw_fraction;
-					}
-
-					// no stats from snapshot merge yet,
-					// use average tick size (aka lean low and assume, all values repeat every tick)
-					return (uint32_t)std::ceil((double)non_unique_rows / ringbuf.size());
-				}();
-
-				result.mem_used += sizeof(*this);
-
-				for (auto const& tick_base : ring_.get_ringbuffer())
-				{
-					auto const& tick = static_cast<history_tick_t const&>(*tick_base);
-
-					// tick
-					result.mem_used += sizeof(tick);
-					result.mem_used += tick.mem_used;
-				}
+				result.row_count = totals_.row_count_estimate(stats_);
+				result.mem_used  = sizeof(*this) + totals_.mem_used;
 
 				return result;
 			}
@@ -356,27 +675,59 @@ namespace { namespace aux {
 				using src_ticks_t = ringbuffer_t;
 				using totals_t    = report_row_data___by_request_t;
 
+				// rows are keyed by hash, can merge in parallel by splitting key space
+				static constexpr bool can_merge_partitioned = true;
+
 				struct row_t
 				{
 					data_t       data;
+					uint64_t     key_hash;  // carried from tick, for lazy histogram lookups (and never recalculated)
 
 					// list of saved hvs, we merge only when requested (i.e. in hv_at_position)
 					// please note that we're also saving pointers to flat_histogram_t::values
 					// and will restore full structs on merge
 					// this a 'limitation' of multi_merge() function
-					std::vector<histogram_values_t const*>  saved_hv;
+					// lists live in hashtable_t::scratch
+					nmpa_ptr_list_t<histogram_values_t>     saved_hv;
 					flat_histogram_t                        merged_hv;
+					bool                                    hv_merged;
+
+					// same for HISTOGRAM_KIND__HDR, merged_hdr points into hashtable_t::hdr_storage
+					nmpa_ptr_list_t<hdr_histogram_t>        saved_hdr;
+					hdr_histogram_t                         *merged_hdr;
+
+					uint32_t                                distinct_offset; // in merge-local sketch (or bitmap) storage, see merge_ticks_into_data()
 				};
 
 				struct hashtable_t
-					: public tsl::robin_map<
-									  key_t
-									, row_t
-									, report_key_impl___hasher_t
-									, report_key_impl___equal_t
-									, std::allocator<std::pair<key_t, row_t>>
-									, /*StoreHash=*/ true>
+					: public HashtableP::template map_t<key_t, row_t>
 				{
+					// set when histograms were not requested in merge flags,
+					// rows find their histograms in these ticks on first access instead
+					ringbuffer_t const *lazy_hv_ticks = nullptr;
+
+					// HISTOGRAM_KIND__HDR, merged histograms are allocated on first read
+					struct hdr_storage_t : private boost::noncopyable
+					{
+						struct nmpa_s                nmpa;
+						std::deque<hdr_histogram_t>  hvs;
+
+						hdr_storage_t()  { nmpa_init(&nmpa, 128 * 1024); }
+						~hdr_storage_t() { nmpa_free(&nmpa); }
+					};
+
+					int                                     hv_kind = HISTOGRAM_KIND__FLAT;
+					histogram_conf_t const                  *hv_conf = nullptr;
+					mutable std::unique_ptr<hdr_storage_t>  hdr_storage;
+
+					// HISTOGRAM_KIND__FLAT, histograms unpacked from ticks, row_t::saved_hv point here
+					mutable std::deque<flat_histogram_t>    unpacked_hvs;
+
+					// row_t::saved_hv and saved_hdr storage
+					report_snapshot_scratch_t               scratch;
+
+					// sums of rows skipped by report_snapshot_ctx_t::key_filter, for totals
+					totals_t                                filtered_out = {};
 				};
 
 			public:
@@ -386,77 +737,129 @@ namespace { namespace aux {
 					return report_key_t { it->first };
 				}
 
+				static typename hashtable_t::iterator find_key(hashtable_t& ht, report_key_t const& k)
+				{
+					if (k.size() != NKeys)
+						return ht.end();
+
+					key_t key;
+					for (size_t i = 0; i < NKeys; i++)
+						key[i] = k[i];
+
+					return ht.find(key);
+				}
+
 				static void* value_at_position(hashtable_t const&, typename hashtable_t::iterator const& it)
 				{
 					return (void*)&it->second.data;
 				}
 
-				static void* hv_at_position(hashtable_t const&, typename hashtable_t::iterator const& it)
+				static void* hv_at_position(hashtable_t const& ht, typename hashtable_t::iterator const& it)
 				{
+					if (ht.hv_kind == HISTOGRAM_KIND__HDR)
+						return hdr_hv_at_position(ht, it);
+
 					row_t *row = const_cast<row_t*>(&it->second);
 
-					if (row->saved_hv.empty()) // already merged
+					if (row->hv_merged)
 						return &row->merged_hv;
 
-					struct merger_t
+					// histograms were not gathered in merge, find this row in every tick now
+					// this way only rows that are actually read pay for histogram merge (think ORDER BY ... LIMIT)
+					if (row->saved_hv.empty() && ht.lazy_hv_ticks)
 					{
-						flat_histogram_t *to;
+						uint64_t const key_hash = row->key_hash;
+						size_t const   n_ticks  = ht.lazy_hv_ticks->size();
 
-						inline bool compare(histogram_value_t const& l, histogram_value_t const& r) const
+						for (auto const& tick_base : *ht.lazy_hv_ticks)
 						{
-							return l.bucket_id < r.bucket_id;
-						}
+							if (!tick_base)
+								continue;
 
-						inline bool equal(histogram_value_t const& l, histogram_value_t const& r) const
-						{
-							return l.bucket_id == r.bucket_id;
-						}
+							auto const& tick = static_cast<history_tick_t const&>(*tick_base);
 
-						inline void reserve(size_t const sz)
-						{
-							to->values.reserve(sz);
+							size_t const offset = report_tick_hash_index___find(tick.hash_index, tick.items, key_hash, it->first);
+							if (offset != tick.items.size())
+							{
+								ht.unpacked_hvs.emplace_back(tick.hvs.unpack(offset));
+								row->saved_hv.push_back(ht.scratch.nmpa(), n_ticks, &ht.unpacked_hvs.back().values);
+							}
 						}
+					}
 
-						inline void push_back(histogram_values_t const *seq, histogram_value_t const& v)
-						{
-							flat_histogram_t *src = MEOW_SELF_FROM_MEMBER(flat_histogram_t, values, seq);
+					// merge histogram values and totals
+					flat_histogram___merge_multi(&row->merged_hv, row->saved_hv.begin(), row->saved_hv.end());
 
-							bool const should_insert = [&]()
-							{
-								if (to->values.empty())
-									return true;
+					// clear source
+					row->saved_hv.clear();
+					row->hv_merged = true;
 
-								return !equal(to->values.back(), v);
-							}();
+					return &row->merged_hv;
+				}
 
-							if (should_insert)
-							{
-								to->values.emplace_back(v);
-							}
-							else
-							{
-								to->values.back().value += v.value;
-							}
-						}
-					};
+				static void* hdr_hv_at_position(hashtable_t const& ht, typename hashtable_t::iterator const& it)
+				{
+					row_t *row = const_cast<row_t*>(&it->second);
 
-					// merge histogram values
-					merger_t merger = { .to = &row->merged_hv };
-					pinba::multi_merge(&merger, row->saved_hv.begin(), row->saved_hv.end());
+					if (row->merged_hdr != nullptr)
+						return row->merged_hdr;
 
-					// merge histogram totals
-					for (auto const *src_hv_values : row->saved_hv)
+					// same as above, gather lazily if not done in merge
+					if (row->saved_hdr.empty() && ht.lazy_hv_ticks)
 					{
-						flat_histogram_t *src = MEOW_SELF_FROM_MEMBER(flat_histogram_t, values, src_hv_values);
-						row->merged_hv.total_count  += src->total_count;
-						row->merged_hv.negative_inf += src->negative_inf;
-						row->merged_hv.positive_inf += src->positive_inf;
+						uint64_t const key_hash = row->key_hash;
+						size_t const   n_ticks  = ht.lazy_hv_ticks->size();
+
+						for (auto const& tick_base : *ht.lazy_hv_ticks)
+						{
+							if (!tick_base)
+								continue;
+
+							auto const& tick = static_cast<history_tick_t const&>(*tick_base);
+
+							size_t const offset = report_tick_hash_index___find(tick.hash_index, tick.items, key_hash, it->first);
+							if (offset != tick.items.size())
+								row->saved_hdr.push_back(ht.scratch.nmpa(), n_ticks, &tick.hdr_hv(offset));
+						}
 					}
 
+					if (!ht.hdr_storage)
+						ht.hdr_storage = meow::make_unique<typename hashtable_t::hdr_storage_t>();
+
+					auto& storage = *ht.hdr_storage;
+					storage.hvs.emplace_back(&storage.nmpa, *ht.hv_conf);
+
+					row->merged_hdr = &storage.hvs.back();
+					row->merged_hdr->merge_multi_with_same_conf(row->saved_hdr.begin(), row->saved_hdr.end(), *ht.hv_conf);
+
 					// clear source
-					row->saved_hv.clear();
+					row->saved_hdr.clear();
 
-					return &row->merged_hv;
+					return row->merged_hdr;
+				}
+
+				static uint32_t estimate_unique_rows(report_snapshot_ctx_t *snapshot_ctx, src_ticks_t const& ticks)
+				{
+					report_unique_rows_estimator_t estimator;
+
+					for (auto const& tick_base : ticks)
+					{
+						if (!tick_base)
+							continue;
+
+						auto const& tick = static_cast<history_tick_t const&>(*tick_base);
+
+						if (tick.key_sketch)
+						{
+							estimator.add_sketch(*tick.key_sketch);
+							continue;
+						}
+
+						for (auto const& item : tick.items)
+							estimator.add_key_hash(item.key_hash);
+					}
+
+					return estimator.estimate();
 				}
 
 				static void calculate_raw_stats(report_snapshot_ctx_t *snapshot_ctx, src_ticks_t const& ticks, report_raw_stats_t *stats)
@@ -472,19 +875,22 @@ namespace { namespace aux {
 					}
 				}
 
+				static void add_to_totals(totals_t *totals, data_t const& row)
+				{
+					totals->req_count  += row.req_count;
+					totals->time_total += row.time_total;
+					totals->ru_utime   += row.ru_utime;
+					totals->ru_stime   += row.ru_stime;
+					totals->traffic    += row.traffic;
+					totals->mem_used   += row.mem_used;
+				}
+
 				static void calculate_totals(report_snapshot_ctx_t *snapshot_ctx, hashtable_t const& data, totals_t *totals)
 				{
+					add_to_totals(totals, data.filtered_out);
+
 					for (auto const& data_pair : data)
-					{
-						auto const& row = data_pair.second.data;
-
-						totals->req_count  += row.req_count;
-						totals->time_total += row.time_total;
-						totals->ru_utime   += row.ru_utime;
-						totals->ru_stime   += row.ru_stime;
-						totals->traffic    += row.traffic;
-						totals->mem_used   += row.mem_used;
-					}
+						add_to_totals(totals, data_pair.second.data);
 				}
 
 				// merge from src ringbuffer to snapshot data
@@ -492,23 +898,34 @@ namespace { namespace aux {
 					  report_snapshot_ctx_t *snapshot_ctx
 					, src_ticks_t& ticks
 					, hashtable_t& to
-					, report_snapshot_t::merge_flags_t flags)
+					, report_snapshot_t::merge_flags_t flags
+					, report_snapshot_partition_t const& part)
 				{
 					bool const need_histograms = (snapshot_ctx->rinfo.hv_enabled && (flags & report_snapshot_t::merge_flags::with_histograms));
 
-					// if we have result count estimate - try reserve the space in resulting hashtable
-					// this might get ugly, if we under-guess just slightly
-					// and face a giant rehash at the end of the merge
-					// but should save us some significant time on initial few rehashes
+					// unique row count from key sketches (see estimate_unique_rows()), with some headroom
+					// reserve once, instead of rehashing as we go (or a giant rehash at the end, if history guess was just slightly low)
 					if (snapshot_ctx->estimates.row_count > 0)
 					{
-						to.reserve(snapshot_ctx->estimates.row_count);
+						to.reserve(snapshot_ctx->estimates.row_count / part.count);
 					}
 
 					uint64_t n_ticks = 0;
 					uint64_t key_lookups = 0;
 					uint64_t hv_appends = 0;
 
+					// merged sketches (or bitmaps), only needed until counts are calculated
+					std::deque<hll_sketch_t>  distinct;
+					std::deque<word_bitmap_t> distinct_exact;
+
+					bool const hv_hdr = (snapshot_ctx->rinfo.hv_kind == HISTOGRAM_KIND__HDR);
+
+					report_key_filter_t const& key_filter = snapshot_ctx->key_filter;
+					bool const need_filter = !key_filter.empty();
+
+					to.hv_kind = snapshot_ctx->rinfo.hv_kind;
+					to.hv_conf = &snapshot_ctx->hv_conf;
+
 					for (auto const& tick_base : ticks)
 					{
 						if (!tick_base)
@@ -522,8 +939,18 @@ namespace { namespace aux {
 						{
 							tick_item_t const& src = tick.items[i];
 
+							if (!part.contains(src.key_hash))
+								continue;
+
+							if (need_filter && !key_filter.matches(src.key))
+							{
+								add_to_totals(&to.filtered_out, src.data);
+								continue;
+							}
+
 							auto inserted_pair = to.emplace_hash(src.key_hash, src.key, row_t{});
 							row_t&         dst = inserted_pair.first.value();
+							dst.key_hash = src.key_hash;
 
 							dst.data.req_count  += src.data.req_count;
 							dst.data.time_total += src.data.time_total;
@@ -532,31 +959,73 @@ namespace { namespace aux {
 							dst.data.traffic    += src.data.traffic;
 							dst.data.mem_used   += src.data.mem_used;
 
-							if (need_histograms)
+							if (!tick.distinct.empty())
 							{
-								flat_histogram_t const& src_hv = tick.hvs[i];
+								if (inserted_pair.second)
+								{
+									dst.distinct_offset = distinct.size();
+									distinct.emplace_back();
+								}
 
-								// try preallocate
-								if (dst.saved_hv.empty())
-									dst.saved_hv.reserve(ticks.size());
+								distinct[dst.distinct_offset].merge(tick.distinct[i]);
+							}
+							else if (!tick.distinct_exact.empty())
+							{
+								if (inserted_pair.second)
+								{
+									dst.distinct_offset = distinct_exact.size();
+									distinct_exact.emplace_back();
+								}
+
+								distinct_exact[dst.distinct_offset].merge(tick.distinct_exact[i]);
+							}
 
-								dst.saved_hv.push_back(&src_hv.values);
+							// key is in every tick at most once, so ticks.size() is all the space we'll need
+							if (need_histograms && hv_hdr)
+							{
+								dst.saved_hdr.push_back(to.scratch.nmpa(), ticks.size(), &tick.hdr_hv(i));
+							}
+							else if (need_histograms)
+							{
+								to.unpacked_hvs.emplace_back(tick.hvs.unpack(i));
+								dst.saved_hv.push_back(to.scratch.nmpa(), ticks.size(), &to.unpacked_hvs.back().values);
 							}
 						}
 
 						key_lookups += tick.items.size();
 
 						if (need_histograms)
-							hv_appends  += tick.hvs.size();
+							hv_appends  += (hv_hdr) ? tick.items.size() : tick.hvs.size();
 					}
 
-					LOG_DEBUG(snapshot_ctx->logger(), "prepare '{0}'; n_ticks: {1}, key_lookups: {2}, hv_appends: {3}",
-						snapshot_ctx->rinfo.name, n_ticks, key_lookups, hv_appends);
+					if (!distinct.empty())
+					{
+						for (auto it = to.begin(), it_end = to.end(); it != it_end; ++it)
+						{
+							row_t& row = it.value();
+							row.data.distinct_count = (uint32_t)distinct[row.distinct_offset].estimate();
+						}
+					}
+					else if (!distinct_exact.empty())
+					{
+						for (auto it = to.begin(), it_end = to.end(); it != it_end; ++it)
+						{
+							row_t& row = it.value();
+							row.data.distinct_count = (uint32_t)distinct_exact[row.distinct_offset].cardinality();
+						}
+					}
+
+					LOG_DEBUG(snapshot_ctx->logger(), "prepare '{0}'; n_ticks: {1}, key_lookups: {2}, hv_appends: {3}, distinct: {4}",
+						snapshot_ctx->rinfo.name, n_ticks, key_lookups, hv_appends, distinct.size() + distinct_exact.size());
 
-					// can clean ticks only if histograms were not merged
+					// can clean ticks only if histograms are disabled
 					// since histogram merger uses raw pointers to tick_data_t::hvs[]::values
 					// and those need to be alive while this snapshot is alive
-					if (!need_histograms)
+					// when histograms were not requested - they can still be gathered lazily from ticks
+					if (!need_histograms && snapshot_ctx->rinfo.hv_enabled)
+						to.lazy_hv_ticks = &ticks;
+
+					if (!snapshot_ctx->rinfo.hv_enabled && (part.count == 1))
 					{
 						ticks.clear();
 						ticks.shrink_to_fit();
@@ -564,6 +1033,70 @@ namespace { namespace aux {
 				}
 			};
 
+			// merges exemplars straight from the ticks, see report_snapshot_t::get_exemplars___by_request()
+			struct snapshot_t : public report_snapshot__impl_t<snapshot_traits>
+			{
+				using base_t = report_snapshot__impl_t<snapshot_traits>;
+				using base_t::base_t;
+
+				virtual pinba_error_t get_exemplars___by_request(std::vector<report_exemplar_row___by_request_t> *result) override
+				{
+					if (this->prepared_)
+						return ff::fmt_err("exemplars are read from ticks, snapshot must not be prepared");
+
+					report_key_filter_t const& key_filter = this->key_filter;
+					bool const need_filter = !key_filter.empty();
+
+					// report conf is not here, ticks know their heap size
+					uint32_t max_size = 0;
+					for (auto const& tick_base : this->ticks_)
+					{
+						if (tick_base)
+							max_size = std::max(max_size, static_cast<history_tick_t const&>(*tick_base).exemplars_count);
+					}
+
+					typename HashtableP::template map_t<key_t, uint32_t>  key_heaps;
+					std::vector<std::pair<key_t, exemplar_heap_t>>        heaps;
+
+					for (auto const& tick_base : this->ticks_)
+					{
+						if (!tick_base)
+							continue;
+
+						auto const& tick = static_cast<history_tick_t const&>(*tick_base);
+
+						for (size_t i = 0; i < tick.exemplars.size(); i++)
+						{
+							key_t const& key = tick.items[i].key;
+
+							if (need_filter && !key_filter.matches(key))
+								continue;
+
+							auto const inserted = key_heaps.emplace(key, (uint32_t)heaps.size());
+							if (inserted.second)
+								heaps.emplace_back(key, exemplar_heap_t{});
+
+							exemplar_heap_t& dst = heaps[inserted.first->second].second;
+
+							for (auto const& e : tick.exemplars[i])
+								exemplar_heap___add(dst, e, max_size);
+						}
+					}
+
+					result->clear();
+					for (auto& kh : heaps)
+					{
+						// sort_heap() with our (reverse) comparator gives slowest first
+						std::sort_heap(kh.second.begin(), kh.second.end(), exemplar_heap___cmp);
+
+						for (auto const& e : kh.second)
+							result->push_back(report_exemplar_row___by_request_t { report_key_t { kh.first }, e });
+					}
+
+					return {};
+				}
+			};
+
 			virtual report_snapshot_ptr get_snapshot() override
 			{
 				report_snapshot_ctx_t const sctx = {
@@ -571,13 +1104,58 @@ namespace { namespace aux {
 					.stats          = stats_,
 					.rinfo          = rinfo_,
 					.estimates      = this->get_estimates(),
+					.time_window_covered = report_history___covered_time(rinfo_, ring_.covered_ticks()),
 					.hv_conf        = hv_conf_,
+					.nmpa           = {},
+					.repacker_states = this->repacker_states(),
 				};
 
-				using snapshot_t = report_snapshot__impl_t<snapshot_traits>;
 				return meow::make_unique<snapshot_t>(sctx, ring_.get_ringbuffer());
 			}
 
+			// any thread, only immutable members and published version are touched here
+			virtual report_snapshot_ptr get_published_snapshot() override
+			{
+				auto const version = published_.current();
+				if (!version)
+					return {};
+
+				report_snapshot_ctx_t const sctx = {
+					.globals        = globals_,
+					.stats          = stats_,
+					.rinfo          = rinfo_,
+					.estimates      = version->estimates,
+					.time_window_covered = version->time_window_covered,
+					.hv_conf        = hv_conf_,
+					.nmpa           = {},
+					.repacker_states = version->repacker_states,
+				};
+
+				return meow::make_unique<snapshot_t>(sctx, version->src);
+			}
+
+		private:
+
+			void publish()
+			{
+				auto version = std::make_shared<published_t::version_t>();
+				version->src                 = ring_.get_ringbuffer();
+				version->estimates           = this->get_estimates();
+				version->time_window_covered = report_history___covered_time(rinfo_, ring_.covered_ticks());
+				version->repacker_states     = this->repacker_states();
+
+				live_estimates_->store(version->estimates);
+				pinba_reclaim(globals_, published_.publish(std::move(version)));
+			}
+
+			// built once per tick, shared by all snapshots until the next one
+			report_repacker_states_ptr repacker_states()
+			{
+				if (!repacker_states_)
+					repacker_states_ = report_repacker_states___from_ticks(ring_.get_ringbuffer());
+				return repacker_states_;
+			}
+
 		private:
 			pinba_globals_t              *globals_;
 			report_stats_t               *stats_;
@@ -585,6 +1163,13 @@ namespace { namespace aux {
 			histogram_conf_t             hv_conf_;
 
 			report_history_ringbuffer_t  ring_;
+			report_history_totals_t      totals_; // over ticks in ring_
+
+			using published_t = report_history_publisher_t<ringbuffer_t>;
+			published_t                  published_; // ring_ as of last merge_tick(), see get_published_snapshot()
+			report_live_estimates_ptr    live_estimates_; // shared with report, estimates of published_
+
+			report_repacker_states_ptr   repacker_states_;  // of ticks in ring_, see repacker_states()
 		};
 
 	public: // report_t
@@ -593,19 +1178,25 @@ namespace { namespace aux {
 			: globals_(globals)
 			, stats_(nullptr)
 			, conf_(conf)
+			, live_estimates_(std::make_shared<report_live_estimates_t>())
 		{
 			rinfo_ = report_info_t {
-				.name            = conf_.name,
-				.kind            = REPORT_KIND__BY_REQUEST_DATA,
-				.time_window     = conf_.time_window,
-				.tick_count      = conf_.tick_count,
-				.n_key_parts     = (uint32_t)conf_.keys.size(),
-				.hv_enabled      = (conf_.hv_bucket_count > 0),
-				.hv_kind         = HISTOGRAM_KIND__FLAT,
-				.hv_bucket_count = conf_.hv_bucket_count,
-				.hv_bucket_d     = conf_.hv_bucket_d,
-				.hv_min_value    = conf_.hv_min_value,
+				.name              = conf_.name,
+				.kind              = REPORT_KIND__BY_REQUEST_DATA,
+				.time_window       = conf_.time_window,
+				.tick_count        = conf_.tick_count,
+				.agg_threads       = std::max<uint32_t>(1, conf_.agg_threads),
+				.n_key_parts       = (uint32_t)conf_.keys.size(),
+				.hv_enabled        = (conf_.hv_bucket_count > 0),
+				.hv_kind           = (conf_.hv_kind == HISTOGRAM_KIND__HDR) ? HISTOGRAM_KIND__HDR : HISTOGRAM_KIND__FLAT,
+				.hv_bucket_count   = conf_.hv_bucket_count,
+				.hv_bucket_d       = conf_.hv_bucket_d,
+				.hv_min_value      = conf_.hv_min_value,
+				.hv_rel_accuracy   = conf_.hv_rel_accuracy,
+				.hv_summary_points = (conf_.hv_kind == HISTOGRAM_KIND__HDR) ? 0 : conf_.hv_summary_points, // flat only
 			};
+
+			batch_filter_.add_filters(conf_.filters);
 		}
 
 		virtual str_ref name() const override
@@ -625,7 +1216,17 @@ namespace { namespace aux {
 
 		virtual report_history_ptr create_history() override
 		{
-			return std::make_shared<history_t>(globals_, rinfo_);
+			return std::make_shared<history_t>(globals_, rinfo_, live_estimates_);
+		}
+
+		virtual report_live_estimates_ptr live_estimates() const override
+		{
+			return live_estimates_;
+		}
+
+		virtual packet_batch_filter_t const* batch_filter() const override
+		{
+			return &batch_filter_;
 		}
 
 	private:
@@ -634,8 +1235,20 @@ namespace { namespace aux {
 		report_info_t                rinfo_;
 
 		report_conf___by_request_t   conf_;
+		packet_batch_filter_t        batch_filter_;
+
+		report_live_estimates_ptr    live_estimates_;  // shared with history
 	};
 
+	template<size_t NKeys>
+	inline report_ptr create_report___by_request_n(pinba_globals_t *globals, report_conf___by_request_t const& conf)
+	{
+		if (conf.hashtable_kind == REPORT_HASHTABLE__SWISS_MAP)
+			return std::make_shared<report___by_request_t<NKeys, report_hashtable___swiss_map_t>>(globals, conf);
+
+		return std::make_shared<report___by_request_t<NKeys, report_hashtable___robin_map_t>>(globals, conf);
+	}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 }} // namespace { namespace aux {
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -653,7 +1266,7 @@ report_ptr create_report_by_request(pinba_globals_t *globals, report_conf___by_r
 			throw std::logic_error(ff::fmt_str("report_by_request supports up to {0} keys, {1} given", max_keys, n_keys));
 
 	#define CASE(z, N, unused) \
-		case N: return std::make_shared<aux::report___by_request_t<N>>(globals, conf); \
+		case N: return aux::create_report___by_request_n<N>(globals, conf); \
 	/**/
 
 	BOOST_PP_REPEAT_FROM_TO(1, BOOST_PP_ADD(PINBA_LIMIT___MAX_KEY_PARTS, 1), CASE, 0);
@@ -1,6 +1,9 @@
 // #include <wchar.h> // wmemcmp
 
+#include <algorithm>
+#include <deque>
 #include <functional>
+#include <memory>
 #include <utility>
 
 #include <boost/preprocessor/arithmetic/add.hpp>
@@ -8,24 +11,31 @@
 
 #include <meow/utility/offsetof.hpp> // MEOW_SELF_FROM_MEMBER
 
-#include <tsl/robin_map.h>
-
 #include "misc/nmpa.h"
 
 #include "pinba/globals.h"
 #include "pinba/bloom.h"
+#include "pinba/federation.h"
+#include "pinba/hash.h"
 #include "pinba/histogram.h"
+#include "pinba/mem_governor.h"
 #include "pinba/multi_merge.h"
+#include "pinba/object_pool.h"
 #include "pinba/packet.h"
+#include "pinba/reclaimer.h"
 #include "pinba/report.h"
 #include "pinba/report_util.h"
 #include "pinba/report_by_timer.h"
+#include "pinba/report_persist.h"
+#include "pinba/tag_lookup.h"
+#include "pinba/varint.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 namespace { namespace aux {
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-	template<size_t NKeys>
+	// HashtableP - report_hashtable___*_t, see report_util.h
+	template<size_t NKeys, class HashtableP>
 	struct report___by_timer_t : public report_t
 	{
 		typedef report_key_impl_t<NKeys>      key_t;
@@ -157,6 +167,15 @@ namespace { namespace aux {
 			{
 			}
 
+			// evicted item is taken for a new key, see aggregator_t::topk_evict()
+			void reset(uint64_t kh)
+			{
+				last_unique = 0;
+				key_hash    = kh;
+				data        = data_t();
+				hv.reset();
+			}
+
 			~tick_item_t()
 			{
 				// NOTE: this dtor is never called!
@@ -174,39 +193,74 @@ namespace { namespace aux {
 
 		// map: key -> pointer to item allocated in nmpa
 		struct agg_hashtable_t
-			: public tsl::robin_map<
-							  key_t
-							, tick_item_t*
-							, report_key_impl___hasher_t
-							, report_key_impl___equal_t
-							, std::allocator<std::pair<key_t, tick_item_t*>>
-							, /*StoreHash=*/ true>
+			: public HashtableP::template map_t<key_t, tick_item_t*>
 		{
 		};
 
-		struct tick_t : public report_tick_t
+		// hashtable and memory pools of a tick, expensive to build from scratch every tick
+		// returned to aggregator's pool, when the tick is destroyed (i.e. right after history_t::merge_tick())
+		struct tick_arena_t : public pooled_object_t<tick_arena_t>
 		{
 			agg_hashtable_t  ht;
 			struct nmpa_s    item_nmpa;
 			struct nmpa_s    hv_nmpa;
 
+			std::vector<tick_item_t*> free_items; // evicted from ht, reused for new keys (topk_size reports only)
+
 			static constexpr size_t item_nmpa_default_chunk_size = 128 * 1024;
 			static constexpr size_t hv_nmpa_default_chunk_size   = 128 * 1024;
 
+			// shrink hashtable, when a tick has used less than this fraction of buckets
+			static constexpr size_t ht_shrink_ratio = 8;
+
 		public:
 
-			tick_t()
+			tick_arena_t()
 			{
 				nmpa_init(&item_nmpa, item_nmpa_default_chunk_size);
 				nmpa_init(&hv_nmpa, hv_nmpa_default_chunk_size);
 			}
 
-			~tick_t()
+			~tick_arena_t()
 			{
 				nmpa_free(&hv_nmpa);
 				nmpa_free(&item_nmpa);
 			}
 
+			// object_pool_t support
+			// keep hashtable sized for the last tick row count (next one is usually similar) and nmpa blocks
+			// items are not destroyed, same as in nmpa_free(), see tick_item_t dtor
+			void pool_recycle()
+			{
+				size_t const n_rows = ht.size();
+
+				ht.clear();
+				free_items.clear();
+
+				if (ht.bucket_count() > n_rows * ht_shrink_ratio)
+				{
+					ht.rehash(0);
+					ht.reserve(n_rows);
+				}
+
+				nmpa_empty(&item_nmpa);
+				nmpa_empty(&hv_nmpa);
+			}
+		};
+		using tick_arena_ptr  = boost::intrusive_ptr<tick_arena_t>;
+		using tick_arena_pool = object_pool_ptr<tick_arena_t>;
+
+		struct tick_t : public report_tick_t
+		{
+			tick_arena_ptr  arena;
+
+		public:
+
+			explicit tick_t(tick_arena_ptr a)
+				: arena(std::move(a))
+			{
+			}
+
 		private: // not movable or copyable
 			tick_t(tick_t const&)            = delete;
 			tick_t(tick_t&&)                 = delete;
@@ -222,7 +276,31 @@ namespace { namespace aux {
 			{
 				uint64_t const key_hash = report_key_impl___hasher_t()(k);
 
-				auto inserted_pair = tick_->ht.emplace_hash(key_hash, k, nullptr);
+				// over memory budget, existing keys are updated as usual, new ones go to overflow row (all key parts empty)
+				if (__builtin_expect(over_mem_budget_, 0))
+				{
+					agg_hashtable_t const& ht = tick_->arena->ht;
+
+					auto const it = ht.find(k, key_hash);
+					if (it != ht.end())
+						return *it->second;
+
+					counters_->keys_folded++;
+					return this->raw_item_reference_hashed(overflow_key_, overflow_key_hash_);
+				}
+
+				return this->raw_item_reference_hashed(k, key_hash);
+			}
+
+			tick_item_t& raw_item_reference_hashed(key_t const& k, uint64_t key_hash)
+			{
+				tick_arena_t& arena = *tick_->arena;
+
+				// bounded report, make room before inserting, so that the new (and empty) row can't be evicted
+				if (__builtin_expect(topk_evict_at_ > 0, 0) && (arena.ht.size() >= topk_evict_at_))
+					this->topk_evict(topk_keep_);
+
+				auto inserted_pair = arena.ht.emplace_hash(key_hash, k, nullptr);
 				tick_item_t *& item_ptr = inserted_pair.first.value();
 
 				// mapping exists, item exists, just return
@@ -231,57 +309,185 @@ namespace { namespace aux {
 
 				// slowpath - create item and maybe hvs
 
-				tick_item_t *new_item = (tick_item_t*)nmpa_alloc(&tick_->item_nmpa, sizeof(tick_item_t));
+				if (mem_budget_ && (++new_keys_since_mem_check_ >= mem_check_interval))
+					this->mem_budget_check();
+
+				if (!arena.free_items.empty())
+				{
+					item_ptr = arena.free_items.back();
+					arena.free_items.pop_back();
+
+					item_ptr->reset(key_hash);
+					return *item_ptr;
+				}
+
+				tick_item_t *new_item = (tick_item_t*)nmpa_alloc(&arena.item_nmpa, sizeof(tick_item_t));
 				if (new_item == nullptr)
 					throw std::bad_alloc();
 
-				new (new_item) tick_item_t(key_hash, &tick_->hv_nmpa, hv_conf_);
+				new (new_item) tick_item_t(key_hash, &arena.hv_nmpa, hv_conf_);
 
 				item_ptr = new_item;
 				return *item_ptr;
 			}
 
-			void raw_item_increment(key_t const& k, packet_t const *packet, packed_timer_t const *timer)
+			void mem_budget_check()
+			{
+				over_mem_budget_          = mem_budget_->is_over_for_new_keys(this->get_estimates().mem_used);
+				new_keys_since_mem_check_ = 0;
+			}
+
+			uint64_t topk_weight(data_t const& data) const
+			{
+				switch (conf_.topk_metric)
+				{
+					case REPORT_TOPK_METRIC__HIT_COUNT:  return data.hit_count;
+					case REPORT_TOPK_METRIC__TIME_TOTAL: return data.time_total.nsec;
+					default:                             return data.req_count;
+				}
+			}
+
+			// keep n_keep heaviest rows of current tick and evict the rest
+			// evicted items go to arena free list, since nmpa can't free them
+			// this is a batched version of 'space saving' (without inheriting evicted counts, so numbers stay exact-or-less)
+			void topk_evict(size_t n_keep)
+			{
+				// pending increments point to items, that might be evicted and reused for other keys
+				this->hv_pending_flush();
+
+				tick_arena_t& arena = *tick_->arena;
+
+				if (arena.ht.size() <= n_keep)
+					return;
+
+				auto& rows = topk_rows_;
+				rows.clear();
+				rows.reserve(arena.ht.size());
+
+				for (auto const& ht_pair : arena.ht)
+					rows.push_back(topk_row_t { this->topk_weight(ht_pair.second->data), ht_pair.first, ht_pair.second });
+
+				std::nth_element(rows.begin(), rows.begin() + n_keep, rows.end(), [](topk_row_t const& l, topk_row_t const& r)
+				{
+					return l.weight > r.weight;
+				});
+
+				for (size_t i = n_keep; i < rows.size(); i++)
+				{
+					arena.ht.erase(rows[i].key);
+					arena.free_items.push_back(rows[i].item);
+				}
+
+				counters_->rows_evicted += (rows.size() - n_keep);
+			}
+
+			// defer_hv - histogram increment is queued, to be applied in bulk with hv_pending_flush()
+			// WithRusage - false for reports with REPORT_DATA_SKIP__RUSAGE
+			template<bool WithRusage>
+			void raw_item_increment(key_t const& k, packet_t const *packet, packed_timer_t const *timer, bool const defer_hv)
 			{
 				tick_item_t& item = this->raw_item_reference(k);
 
-				item.data.hit_count  += timer->hit_count;
-				item.data.time_total += timer->value;
-				item.data.ru_utime   += timer->ru_utime;
-				item.data.ru_stime   += timer->ru_stime;
+				uint32_t const sample_rate = packet->sample_rate * sample_scale_;
+
+				item.data.hit_count  += timer->hit_count * sample_rate;
+				item.data.time_total += packet___scaled(timer->value(), sample_rate);
+
+				if (WithRusage)
+				{
+					item.data.ru_utime   += packet___scaled(timer->ru_utime(), sample_rate);
+					item.data.ru_stime   += packet___scaled(timer->ru_stime(), sample_rate);
+				}
 
 				if (item.last_unique != packet_unqiue_)
 				{
-					item.data.req_count += 1;
+					item.data.req_count += sample_rate;
 					item.last_unique    = packet_unqiue_;
 				}
 
-				if (conf_.hv_bucket_count > 0)
+				if ((conf_.hv_bucket_count > 0) && hv_collect_)
 				{
 					hdr_histogram_t& hv = item.hv;
 
 					// optimize common case when hit_count == 1, and there is no need to divide
-					if (__builtin_expect(timer->hit_count == 1, 1))
+					duration_t const value        = (__builtin_expect(timer->hit_count == 1, 1)) ? timer->value() : (timer->value() / timer->hit_count);
+					uint32_t const   increment_by = timer->hit_count * sample_rate;
+
+					if (defer_hv)
 					{
-						hv.increment(hv_conf_, timer->value);
+						hv_pending_items_.push_back(&item);
+						hv_pending_values_.push_back(hdr_histogram_t::hdr_value_for(hv_conf_, value));
+						hv_pending_incr_.push_back(increment_by);
 					}
 					else
 					{
-						hv.increment(hv_conf_, (timer->value / timer->hit_count), timer->hit_count);
+						hv.increment(hv_conf_, value, increment_by);
 					}
 				}
 			}
 
+			// apply queued histogram increments, bucket indexes are computed in bulk
+			// then increments are sorted by (histogram, bucket), so that every counter is written once
+			void hv_pending_flush()
+			{
+				size_t const n = hv_pending_items_.size();
+				if (n == 0)
+					return;
+
+				hv_pending_indexes_.resize(n);
+				hdr_histogram_t::counts_index_for_multi(hv_conf_.hdr, hv_pending_values_.data(), n, hv_pending_indexes_.data());
+
+				hv_pending_runs_.clear();
+				for (size_t i = 0; i < n; i++)
+					hv_pending_runs_.push_back({ hv_pending_items_[i], hv_pending_indexes_[i], hv_pending_incr_[i] });
+
+				std::sort(hv_pending_runs_.begin(), hv_pending_runs_.end(), [](hv_pending_run_t const& l, hv_pending_run_t const& r)
+				{
+					return (l.item != r.item)
+							? (l.item < r.item)
+							: (l.counts_index < r.counts_index);
+				});
+
+				for (size_t i = 0; i < n; /**/)
+				{
+					hv_pending_run_t const& run = hv_pending_runs_[i];
+					uint32_t total_by = 0;
+
+					for (; (i < n) && (hv_pending_runs_[i].item == run.item) && (hv_pending_runs_[i].counts_index == run.counts_index); i++)
+						total_by += hv_pending_runs_[i].increment_by;
+
+					run.item->hv.increment_at_counts_index(run.counts_index, total_by);
+				}
+
+				hv_pending_items_.clear();
+				hv_pending_values_.clear();
+				hv_pending_incr_.clear();
+			}
+
 		public:
 
-			aggregator_t(pinba_globals_t *globals, report_conf___by_timer_t const& conf, report_info_t const& rinfo)
+			aggregator_t(pinba_globals_t *globals, report_conf___by_timer_t const& conf, report_info_t const& rinfo, report_mem_budget_ptr const& mem_budget)
 				: globals_(globals)
 				, stats_(nullptr)
+				, counters_(nullptr)
 				, conf_(conf)
 				, hv_conf_(histogram___configure_with_rinfo(rinfo))
 				, packet_unqiue_(1) // init this to 1, so it's different from 0 in default constructed data_t
-				, tick_(meow::make_intrusive<tick_t>())
+				, tagset_cache_()
+				, rtag_tagset_cache_()
+				, tagset_generation_(0)
+				, arena_pool_(create_object_pool<tick_arena_t>(arena_pool_capacity, &globals->stats()->objects.tick_arena_pool_hit, &globals->stats()->objects.tick_arena_pool_miss))
+				, tick_(meow::make_intrusive<tick_t>(arena_pool_->get()))
+				, topk_keep_(conf_.topk_size * 2)
+				, topk_evict_at_(conf_.topk_size * 4)
+				, mem_budget_(mem_budget->is_enabled() ? mem_budget : nullptr)
+				, over_mem_budget_(false)
+				, new_keys_since_mem_check_(0)
+				, overflow_key_()
+				, overflow_key_hash_(report_key_impl___hasher_t()(overflow_key_))
 			{
+				filter_program_.compile(conf_.filters);
+
 				// key info
 				ki_.from_config(conf);
 
@@ -307,12 +513,28 @@ namespace { namespace aux {
 			virtual void stats_init(report_stats_t *stats) override
 			{
 				stats_ = stats;
+				counters_ = report_stats___add_thread(stats);
 			}
 
 			virtual report_tick_ptr tick_now(timeval_t curr_tv) override
 			{
+				// history gets no more than topk_keep_ rows per tick
+				if (topk_keep_ > 0)
+					this->topk_evict(topk_keep_);
+
 				report_tick_ptr result = std::move(tick_);
-				tick_ = meow::make_intrusive<tick_t>();
+				tick_ = meow::make_intrusive<tick_t>(arena_pool_->get());
+
+				// rows of the new tick get no histograms, unless someone selects percentiles (empty ones are left in tick items)
+				hv_collect_ = report_stats___hv_collect(stats_, conf_.hv_idle_d, curr_tv);
+
+				// recycled arenas keep their hashtable sized, but a fresh one (pool miss) is empty
+				// size it for the last tick, so that first packets of this one don't pay for growing it from scratch
+				tick_->arena->ht.reserve(static_cast<tick_t const&>(*result).arena->ht.size());
+
+				// history has changed since last check (and new tick is empty)
+				if (mem_budget_)
+					this->mem_budget_check();
 
 				return result;
 			}
@@ -321,18 +543,20 @@ namespace { namespace aux {
 			{
 				report_estimates_t result = {};
 
-				result.row_count = tick_->ht.size();
+				tick_arena_t const& arena = *tick_->arena;
+
+				result.row_count = arena.ht.size();
 
 				// tick
 				result.mem_used += sizeof(*tick_);
+				result.mem_used += sizeof(arena);
 
 				// tick ht
-				result.mem_used += sizeof(tick_->ht);
-				result.mem_used += tick_->ht.bucket_count() * sizeof(*tick_->ht.begin());
+				result.mem_used += arena.ht.bucket_count() * sizeof(*arena.ht.begin());
 
 				// pools
-				result.mem_used += nmpa_mem_used(&tick_->item_nmpa);
-				result.mem_used += nmpa_mem_used(&tick_->hv_nmpa);
+				result.mem_used += nmpa_mem_used(&arena.item_nmpa);
+				result.mem_used += nmpa_mem_used(&arena.hv_nmpa);
 
 				return result;
 			}
@@ -344,20 +568,75 @@ namespace { namespace aux {
 				if (!packet->bloom.contains(this->packet_bloom_))
 				{
 					// LOG_DEBUG(globals_->logger(), "packet: {0} !< {1}", packet->timer_bloom->to_string(), packet_bloom_.to_string());
-					stats_->packets_dropped_by_bloom++;
+					counters_->packets_dropped_by_bloom++;
 					return;
 				}
 
 				// run all filters and check if packet is 'interesting to us'
-				for (size_t i = 0, i_end = conf_.filters.size(); i < i_end; ++i)
+				if (!filter_program_.run(packet))
+				{
+					counters_->packets_dropped_by_filters++;
+					return;
+				}
+
+				// single packets might come from any batch, so no tagset ids here
+				this->add_filtered(packet, false);
+			}
+
+			virtual void add_multi(packet_t **packets, uint32_t packet_count) override
+			{
+				packet_t *batch[report_agg___batch_size];
+
+				// all packets are from the same batch, tagset ids are comparable, forget ids from previous batch
+				tagset_generation_++;
+
+				for (uint32_t offset = 0; offset < packet_count; offset += report_agg___batch_size)
 				{
-					auto const& filter = conf_.filters[i];
-					if (!filter.func(packet))
+					packet_t     **chunk      = packets + offset;
+					uint32_t const chunk_size = std::min(report_agg___batch_size, packet_count - offset);
+
+					// pass 1: packet-level bloom over the whole chunk
+					// bloom is at the end of packet_t, prefetch it a few packets ahead
+					uint32_t n_packets = 0;
+					for (uint32_t i = 0; i < chunk_size; ++i)
 					{
-						stats_->packets_dropped_by_filters++;
-						return;
+						if (i + report_agg___prefetch_distance < chunk_size)
+							__builtin_prefetch(&chunk[i + report_agg___prefetch_distance]->bloom);
+
+						if (!chunk[i]->bloom.contains(this->packet_bloom_))
+							continue;
+
+						batch[n_packets++] = chunk[i];
+					}
+					counters_->packets_dropped_by_bloom += (chunk_size - n_packets);
+
+					// pass 2: filters, for packets that passed bloom only
+					uint32_t const n_passed = filter_program_.run_batch(batch, n_packets);
+					counters_->packets_dropped_by_filters += (n_packets - n_passed);
+
+					// pass 3: start loading timer data for survivors, it's going to be scanned next
+					for (uint32_t i = 0; i < n_passed; ++i)
+					{
+						__builtin_prefetch(batch[i]->timers_blooms);
+						__builtin_prefetch(batch[i]->timers);
 					}
+
+					// pass 4: key extraction and aggregation
+					for (uint32_t i = 0; i < n_passed; ++i)
+						this->add_filtered(batch[i], true);
+
+					// pass 5: histograms, everything the chunk has added
+					this->hv_pending_flush();
 				}
+			}
+
+		private:
+
+			// packet has passed bloom and filters, find keys and aggregate timers
+			// use_tagsets - packed_timer_t::tagset_id values are from the batch tagset_cache_ has been filled with
+			void add_filtered(packet_t *packet, bool const use_tagsets)
+			{
+				bool const with_rusage = !(conf_.data_skip & REPORT_DATA_SKIP__RUSAGE);
 
 				// check if timer is interesting (aka satisfies filters)
 				auto const filter_by_timer_tags = [&](packed_timer_t const *t) -> bool
@@ -373,8 +652,22 @@ namespace { namespace aux {
 
 							tag_exists = true;
 
-							if (t->tag_value_ids[tag_i] != tfd.value_id)
+							uint32_t const value_id = t->tag_value_ids()[tag_i];
+
+							if (tfd.word_set)
+							{
+								if (!tfd.word_set->contains(value_id))
+									return false;
+							}
+							else if (tfd.value_ids.empty())
+							{
+								if (value_id != tfd.value_id)
+									return false;
+							}
+							else if (std::find(tfd.value_ids.begin(), tfd.value_ids.end(), value_id) == tfd.value_ids.end())
+							{
 								return false;
+							}
 						}
 
 						if (!tag_exists)
@@ -383,29 +676,75 @@ namespace { namespace aux {
 					return true;
 				};
 
+				// find positions of key tags in timer tag names, if timer has all the parts
+				// depends on timer tag names only, so is the same for all timers with the same tagset_id
+				auto const find_timer_tag_positions = [&](key_info_t const& ki, uint32_t n_tags_required, packed_timer_t const *t, uint32_t *positions) -> bool
+				{
+					for (uint32_t i = 0; i < n_tags_required; ++i)
+					{
+						uint32_t const tag_i = tag_lookup___find(t->tag_name_ids, t->tag_count, ki.timer_tag_r[i].d.timer_tag);
+
+						// each lookup - must get us a tag
+						// so if it didn't -> just return false
+						if (tag_i == t->tag_count)
+							return false;
+
+						positions[i] = tag_i;
+					}
+
+					return true;
+				};
+
 				// put key data into out_range if timer has all the parts
 				auto const fetch_by_timer_tags = [&](key_info_t const& ki, key_subrange_t out_range, packed_timer_t const *t) -> bool
 				{
 					uint32_t const n_tags_required = out_range.size();
 
-					for (uint32_t i = 0; i < n_tags_required; ++i)
+					uint32_t  local_positions[NKeys];
+					uint32_t *positions = local_positions;
+
+					if (use_tagsets && t->tagset_id != 0)
 					{
-						bool tag_found = false;
+						tagset_positions_t& tp = tagset_cache_[t->tagset_id];
 
-						for (uint32_t tag_i = 0; tag_i < t->tag_count; ++tag_i)
+						if (tp.generation != tagset_generation_)
 						{
-							if (t->tag_name_ids[tag_i] != ki.timer_tag_r[i].d.timer_tag)
-								continue;
-
-							out_range[i] = t->tag_value_ids[tag_i];
-							tag_found = true;
-							break;
+							tp.generation = tagset_generation_;
+							tp.found      = find_timer_tag_positions(ki, n_tags_required, t, tp.positions);
 						}
 
-						// each full run of inner loop - must get us a tag
+						if (!tp.found)
+							return false;
+
+						positions = tp.positions;
+					}
+					else
+					{
+						if (!find_timer_tag_positions(ki, n_tags_required, t, positions))
+							return false;
+					}
+
+					uint32_t const *tag_value_ids = t->tag_value_ids();
+
+					for (uint32_t i = 0; i < n_tags_required; ++i)
+						out_range[i] = tag_value_ids[positions[i]];
+
+					return true;
+				};
+
+				// same as find_timer_tag_positions(), for request tags, depends on packet_t::tagset_id
+				auto const find_request_tag_positions = [&](key_info_t const& ki, uint32_t n_tags_required, uint32_t *positions) -> bool
+				{
+					for (uint32_t tag_i = 0; tag_i < n_tags_required; ++tag_i)
+					{
+						uint32_t const i = tag_lookup___find(packet->tag_name_ids, packet->tag_count, ki.request_tag_r[tag_i].d.request_tag);
+
+						// each lookup - must get us a tag
 						// so if it didn't -> just return false
-						if (!tag_found)
+						if (i == packet->tag_count)
 							return false;
+
+						positions[tag_i] = i;
 					}
 
 					return true;
@@ -416,27 +755,38 @@ namespace { namespace aux {
 					key_subrange_t out_range = ki_.rtag_key_subrange(*out_key);
 
 					uint32_t const n_tags_required = out_range.size();
+					if (n_tags_required == 0)
+						return true;
 
-					for (uint32_t tag_i = 0; tag_i < n_tags_required; ++tag_i)
+					uint32_t  local_positions[NKeys];
+					uint32_t *positions = local_positions;
+
+					if (use_tagsets && packet->tagset_id != 0)
 					{
-						bool tag_found = false;
+						tagset_positions_t& tp = rtag_tagset_cache_[packet->tagset_id];
 
-						for (uint16_t i = 0, i_end = packet->tag_count; i < i_end; ++i)
+						if (tp.generation != tagset_generation_)
 						{
-							if (packet->tag_name_ids[i] != ki.request_tag_r[tag_i].d.request_tag)
-								continue;
-
-							out_range[tag_i] = packet->tag_value_ids[i];
-							tag_found = true;
-							break;
+							tp.generation = tagset_generation_;
+							tp.found      = find_request_tag_positions(ki, n_tags_required, tp.positions);
 						}
 
-						// each full run of inner loop - must get us a tag
-						// so if it didn't -> just return false
-						if (!tag_found)
+						if (!tp.found)
+							return false;
+
+						positions = tp.positions;
+					}
+					else
+					{
+						if (!find_request_tag_positions(ki, n_tags_required, positions))
 							return false;
 					}
 
+					uint32_t const *tag_value_ids = packet->tag_value_ids();
+
+					for (uint32_t tag_i = 0; tag_i < n_tags_required; ++tag_i)
+						out_range[tag_i] = tag_value_ids[positions[tag_i]];
+
 					return true;
 				};
 
@@ -460,14 +810,14 @@ namespace { namespace aux {
 				bool const tags_found = find_request_tags(ki_, &key_inprogress);
 				if (!tags_found)
 				{
-					stats_->packets_dropped_by_rtag++;
+					counters_->packets_dropped_by_rtag++;
 					return;
 				}
 
 				bool const fields_found = find_request_fields(ki_, &key_inprogress);
 				if (!fields_found)
 				{
-					stats_->packets_dropped_by_rfield++;
+					counters_->packets_dropped_by_rfield++;
 					return;
 				}
 
@@ -483,86 +833,151 @@ namespace { namespace aux {
 
 					key_subrange_t const timer_key_range = ki_.timertag_key_subrange(key_inprogress);
 
-					for (uint16_t i = 0; i < packet->timer_count; ++i)
+					// test timer blooms 64 at a time, then only look at candidates
+					for (uint32_t base = 0; base < packet->timer_count; base += 64)
 					{
-						timer_bloom_t const *tbloom = &packet->timers_blooms[i];
-						packed_timer_t const *timer = &packet->timers[i];
+						uint32_t const n_timers = std::min<uint32_t>(64, packet->timer_count - base);
 
-						timers_scanned++;
+						uint64_t candidates = timer_bloom___contains_mask(&packet->timers_blooms[base], n_timers, this->timer_bloom_);
 
-						if (!tbloom->contains(this->timer_bloom_))
+						uint32_t const n_candidates = __builtin_popcountll(candidates);
+						timers_scanned          += n_timers;
+						timers_skipped_by_bloom += n_timers - n_candidates;
+
+						for (; candidates != 0; candidates &= (candidates - 1))
 						{
-							// LOG_DEBUG(globals_->logger(), "timer[{0}]: bloom {1} !< {2}", i, timer->bloom.to_string(), timer_bloom_.to_string());
-							timers_skipped_by_bloom++;
-							continue;
-						}
+							uint32_t const i = base + __builtin_ctzll(candidates);
+							packed_timer_t const *timer = &packet->timers[i];
 
-						bool const timer_ok = filter_by_timer_tags(timer);
-						if (!timer_ok) {
-							timers_skipped_by_filters++;
-							continue;
-						}
+							bool const timer_ok = filter_by_timer_tags(timer);
+							if (!timer_ok) {
+								timers_skipped_by_filters++;
+								continue;
+							}
 
-						bool const timer_found = fetch_by_timer_tags(ki_, timer_key_range, timer);
-						if (!timer_found) {
-							timers_skipped_by_tags++;
-							continue;
-						}
+							bool const timer_found = fetch_by_timer_tags(ki_, timer_key_range, timer);
+							if (!timer_found) {
+								timers_skipped_by_tags++;
+								continue;
+							}
 
-						timers_aggregated++;
+							timers_aggregated++;
 
-						// LOG_DEBUG(globals_->logger(), "found key '{0}'", key_to_string(key_inprogress));
+							// LOG_DEBUG(globals_->logger(), "found key '{0}'", key_to_string(key_inprogress));
 
-						// key_t const k = ki_.remap_key(key_inprogress);
-						key_t k = {};
-						ki_.remap_key_to_from(k, key_inprogress);
+							// key_t const k = ki_.remap_key(key_inprogress);
+							key_t k = {};
+							ki_.remap_key_to_from(k, key_inprogress);
 
-						// LOG_DEBUG(globals_->logger(), "remapped key '{0}'", key_to_string(k));
+							// LOG_DEBUG(globals_->logger(), "remapped key '{0}'", key_to_string(k));
 
-						// finally - find and update item
-						this->raw_item_increment(k, packet, timer);
+							// finally - find and update item
+							if (with_rusage)
+								this->raw_item_increment<true>(k, packet, timer, use_tagsets);
+							else
+								this->raw_item_increment<false>(k, packet, timer, use_tagsets);
+						}
 					}
 				}
 
-				stats_->timers_scanned            += timers_scanned;
-				stats_->timers_aggregated         += timers_aggregated;
-				stats_->timers_skipped_by_bloom   += timers_skipped_by_bloom;
-				stats_->timers_skipped_by_filters += timers_skipped_by_filters;
-				stats_->timers_skipped_by_tags    += timers_skipped_by_tags;
+				counters_->timers_scanned            += timers_scanned;
+				counters_->timers_aggregated         += timers_aggregated;
+				counters_->timers_skipped_by_bloom   += timers_skipped_by_bloom;
+				counters_->timers_skipped_by_filters += timers_skipped_by_filters;
+				counters_->timers_skipped_by_tags    += timers_skipped_by_tags;
 
 				if (!timers_aggregated)
-					stats_->packets_dropped_by_timertag++;
+				{
+					counters_->packets_dropped_by_timertag++;
+
+					// packet bloom said required tags are there, but no timer had them (and none was skipped by filter values)
+					if (!timers_skipped_by_filters)
+						counters_->packets_bloom_false_positive++;
+				}
 				else
-					stats_->packets_aggregated++;
+					counters_->packets_aggregated++;
 			}
 
-			virtual void add_multi(packet_t **packets, uint32_t packet_count) override
+		public:
+
+			virtual void set_sample_scale(uint32_t scale) override
 			{
-				for (uint32_t i = 0; i < packet_count; ++i)
-					this->add(packets[i]);
+				sample_scale_ = scale;
 			}
 
 		private:
 			pinba_globals_t              *globals_;
 			report_stats_t               *stats_;
+			report_thread_counters_t     *counters_;
 			report_conf___by_timer_t     conf_;
+			uint32_t                     sample_scale_ = 1; // see set_sample_scale()
+			bool                         hv_collect_   = true; // see report_stats___hv_collect(), updated on tick
 			histogram_conf_t             hv_conf_;
+			packet_filter_program_t      filter_program_;
 
 			uint64_t                     packet_unqiue_;
 
+			// timer key tag positions by packed_timer_t::tagset_id, valid for current add_multi() batch only
+			struct tagset_positions_t
+			{
+				uint64_t  generation;  // filled for batch with this tagset_generation_, 0 = never
+				bool      found;       // false = timers with this tagset don't have all key tags
+				uint32_t  positions[NKeys];
+			};
+			tagset_positions_t           tagset_cache_[timer_tagset_interner_t::max_ids + 1];
+			tagset_positions_t           rtag_tagset_cache_[timer_tagset_interner_t::max_ids + 1]; // same, request key tags by packet_t::tagset_id
+			uint64_t                     tagset_generation_;
+
 			key_info_t                   ki_;
 
 			timertag_bloom_t             packet_bloom_;
 			timer_bloom_t                timer_bloom_;
 
+			// current tick and the one being merged into history are alive at the same time, keep a few spare
+			static constexpr size_t      arena_pool_capacity = 4;
+			tick_arena_pool              arena_pool_;
+
 			boost::intrusive_ptr<tick_t> tick_;
+
+			// topk_size reports, 0 = unbounded
+			uint32_t                     topk_keep_;     // rows left in tick after eviction
+			uint32_t                     topk_evict_at_; // evict, when tick has this many rows
+
+			struct topk_row_t
+			{
+				uint64_t     weight;
+				key_t        key;
+				tick_item_t  *item;
+			};
+			std::vector<topk_row_t>      topk_rows_;     // scratch space for topk_evict()
+
+			// histogram increments queued by add_multi() chunk, see hv_pending_flush()
+			struct hv_pending_run_t
+			{
+				tick_item_t  *item;
+				int32_t      counts_index;
+				uint32_t     increment_by;
+			};
+			std::vector<tick_item_t*>      hv_pending_items_;
+			std::vector<int64_t>           hv_pending_values_;
+			std::vector<uint32_t>          hv_pending_incr_;
+			std::vector<int32_t>           hv_pending_indexes_;
+			std::vector<hv_pending_run_t>  hv_pending_runs_;
+
+			// memory limits, see report_mem_budget_t, nullptr = no limits
+			static constexpr uint32_t    mem_check_interval = 1024; // new keys between checks, estimates walk nmpa blocks
+			report_mem_budget_ptr        mem_budget_;
+			bool                         over_mem_budget_;
+			uint32_t                     new_keys_since_mem_check_;
+			key_t const                  overflow_key_;
+			uint64_t const               overflow_key_hash_;
 		};
 
 	public: // history
 
 		struct history_t : public report_history_t
 		{
-			using ring_t       = report_history_ringbuffer_t;
+			using ring_t       = report_history_tiered_ringbuffer_t;
 			using ringbuffer_t = ring_t::ringbuffer_t;
 
 			struct history_row_t
@@ -573,134 +988,1108 @@ namespace { namespace aux {
 				flat_histogram_t  hv;
 			};
 
-			struct history_tick_t : public report_tick_t // not required to inherit here, but get history ring for free
+			// what history_tick___for_each_row() gives out, points to tick columns or to a decoded row
+			struct history_row_ref_t
 			{
-				// precalculated mem usage, to avoid expensive computation in get_estimates()
-				uint64_t                   mem_used = 0;
-
-				std::vector<history_row_t> rows    = {};
+				uint64_t                 key_hash;
+				key_t const&             key;
+				data_t const&            data;
+				flat_histogram_t         *hv;  // nullptr, unless histograms were requested (and are enabled), unpacked temporary, can be moved from
 			};
 
-		public:
-
-			history_t(pinba_globals_t *globals, report_info_t const& rinfo)
-				: globals_(globals)
-				, stats_(nullptr)
-				, rinfo_(rinfo)
-				, hv_conf_(histogram___configure_with_rinfo(rinfo))
-				, ring_(rinfo.tick_count)
+			struct history_tick_t : public report_tick_t // not required to inherit here, but get history ring for free
 			{
-			}
+				// precalculated mem usage, to avoid expensive computation in get_estimates()
+				uint64_t                       mem_used = 0;
 
-			virtual void stats_init(report_stats_t *stats) override
-			{
-				stats_ = stats;
-			}
+				// rows as columns, so that merges without histograms never touch those (and hashes are scanned alone)
+				std::vector<uint64_t>          key_hashes = {};
+				std::vector<key_t>             keys       = {};
+				std::vector<data_t>            datas      = {};
+				packed_flat_histograms_t       hvs        = {}; // empty when histograms are disabled
 
-			virtual void merge_tick(report_tick_ptr tick_base) override
-			{
-				// re-process tick data, for more compact storage
-				auto *agg_tick = static_cast<tick_t const*>(tick_base.get()); // src (non-const to move from, see below)
-				auto    h_tick = meow::make_intrusive<history_tick_t>();      // dst
+				report_tick_hash_index_t       hash_index = {}; // only built when histograms are enabled, see hv_at_position()
 
-				// remember to grab repacker_state
-				h_tick->repacker_state = std::move(agg_tick->repacker_state);
+				bool                           trimmed    = false; // lighter rows were dropped to fit memory budget, see trim_tick()
 
-				// reserve, we know the size
-				h_tick->rows.reserve(agg_tick->ht.size());
-				h_tick->mem_used += h_tick->rows.capacity() * sizeof(*h_tick->rows.begin());
+				// rinfo.history_partitions > 0, flat ticks only, rows of partition p are [part_offsets[p], part_offsets[p+1])
+				// and part_totals[p] is their data sum, so that merges can skip a partition and still get totals right
+				std::vector<uint32_t>          part_offsets = {}; // empty = rows are not grouped
+				std::vector<data_t>            part_totals  = {};
 
-				for (auto const& ht_pair : agg_tick->ht)
-				{
-					h_tick->rows.emplace_back();
+				// tick_storage=compressed, columns and hash_index are empty then, see compressed_tick___encode()
+				bool                       is_compressed   = false;
+				bool                       compressed_hv   = false; // histograms are stored
+				uint32_t                   compressed_rows = 0;
+				std::vector<uint8_t>       compressed      = {};
+				std::vector<uint32_t>      restarts        = {};    // offsets of every compressed_restart_interval-th row
 
-					key_t       const& src_key  = ht_pair.first;
-					tick_item_t const& src_item = *ht_pair.second;
-					history_row_t    & dst_row  = h_tick->rows.back();
+				// words of ticks loaded from history file (shared by all of those) and of remote ticks merged into this one
+				// see persist_load() and federation_merge(), rollups get all words of their source ticks
+				std::vector<report_persist_words_ptr> persisted_words = {};
 
-					dst_row.key_hash = src_item.key_hash;
-					dst_row.key      = src_key;
-					dst_row.data     = src_item.data;
+				report_key_sketch_ptr          key_sketch = {}; // big ticks only, see estimate_unique_rows()
 
-					// FIXME: only convert if histograms are enabled!
-					dst_row.hv       = std::move(histogram___convert_hdr_to_flat(src_item.hv, hv_conf_));
-					h_tick->mem_used += dst_row.hv.values.capacity() * sizeof(*dst_row.hv.values.begin());
+				size_t row_count() const
+				{
+					return (is_compressed) ? compressed_rows : keys.size();
 				}
+			};
 
-				ring_.append(std::move(h_tick));
-			}
+			// compressed tick format
+			//  rows are sorted by key, key parts equal to the previous row key are skipped,
+			//  first differing part is delta encoded, the rest are stored as is
+			//  previous key is reset to zeroes every compressed_restart_interval rows, so lookups can start there
+			//  everything is a varint, histograms are flat_histogram___pack_append()-ed
+			static constexpr uint32_t compressed_restart_interval = 64;
 
-			virtual report_estimates_t get_estimates() override
+			static void compressed_tick___encode(history_tick_t *tick, std::vector<history_row_t>& rows, bool with_hv)
 			{
-				report_estimates_t result = {};
+				std::sort(rows.begin(), rows.end(), [](history_row_t const& l, history_row_t const& r) { return l.key < r.key; });
 
-				result.row_count = [&]() -> uint32_t
-				{
-					auto const& ringbuf = ring_.get_ringbuffer();
-					if (ringbuf.empty())
-						return 0;
+				std::vector<uint8_t>& out = tick->compressed;
+				key_t prev_key = {};
 
-					uint32_t non_unique_rows = 0;
+				for (uint32_t i = 0; i < rows.size(); i++)
+				{
+					history_row_t const& row = rows[i];
 
-					for (auto const& tick_base : ringbuf)
+					if ((i % compressed_restart_interval) == 0)
 					{
-						auto const& tick = static_cast<history_tick_t const&>(*tick_base);
-						non_unique_rows += tick.rows.size();
+						tick->restarts.push_back(out.size());
+						prev_key.fill(0);
 					}
 
-					// got stats from snapshot merge with exact values, adjust based uniq to total rows ratio
-					if (stats_->last_snapshot_src_rows && stats_->last_snapshot_uniq_rows)
+					uint32_t n_same = 0;
+					while (n_same < NKeys && row.key[n_same] == prev_key[n_same])
+						n_same++;
+
+					varint___append(&out, n_same);
+
+					if (n_same < NKeys)
 					{
-						double const uniq_to_raw_fraction = (double)stats_->last_snapshot_uniq_rows / stats_->last_snapshot_src_rows;
-						return non_unique_rows * uniq_to_raw_fraction;
-					}
+						varint___append(&out, uint32_t(row.key[n_same] - prev_key[n_same]));
 
-					// no stats from snapshot merge yet,
-					// use average tick size (aka lean low and assume, all values repeat every tick)
-					return (uint32_t)std::ceil((double)non_unique_rows / ringbuf.size());
-				}();
+						for (uint32_t k = n_same + 1; k < NKeys; k++)
+							varint___append(&out, row.key[k]);
+					}
 
-				result.mem_used += sizeof(*this);
+					prev_key = row.key;
 
-				for (auto const& tick_base : ring_.get_ringbuffer())
-				{
-					auto const& tick = static_cast<history_tick_t const&>(*tick_base);
+					varint___append(&out, row.data.req_count);
+					varint___append(&out, row.data.hit_count);
+					varint___append(&out, varint___zigzag(row.data.time_total.nsec));
+					varint___append(&out, varint___zigzag(row.data.ru_utime.nsec));
+					varint___append(&out, varint___zigzag(row.data.ru_stime.nsec));
 
-					result.mem_used += sizeof(tick);
-					result.mem_used += tick.mem_used;
+					if (with_hv)
+						flat_histogram___pack_append(&out, row.hv);
 				}
 
-				return result;
-			}
+				out.shrink_to_fit();
 
-		public: // snapshot
+				tick->is_compressed   = true;
+				tick->compressed_hv   = with_hv;
+				tick->compressed_rows = rows.size();
 
-			struct snapshot_traits
+				tick->mem_used += out.capacity();
+				tick->mem_used += tick->restarts.capacity() * sizeof(*tick->restarts.begin());
+			}
+
+			// sequential compressed tick reader, every row is read_key() then read_data()
+			struct compressed_reader_t
 			{
-				using src_ticks_t = ringbuffer_t;
-				using totals_t    = report_row_data___by_timer_t;
+				history_tick_t const *tick;
+				uint8_t const        *p;
+				uint32_t             row_i;
+				key_t                key;
+
+				explicit compressed_reader_t(history_tick_t const& t, uint32_t restart = 0)
+					: tick(&t)
+					, p(t.compressed.data() + (t.restarts.empty() ? 0 : t.restarts[restart]))
+					, row_i(restart * compressed_restart_interval)
+					, key()
+				{
+				}
 
-				struct row_t
+				bool at_end() const
+				{
+					return row_i >= tick->compressed_rows;
+				}
+
+				key_t const& read_key()
+				{
+					if ((row_i % compressed_restart_interval) == 0)
+						key.fill(0);
+
+					uint32_t const n_same = varint___read(&p);
+
+					if (n_same < NKeys)
+					{
+						key[n_same] += (uint32_t)varint___read(&p);
+
+						for (uint32_t k = n_same + 1; k < NKeys; k++)
+							key[k] = (uint32_t)varint___read(&p);
+					}
+
+					return key;
+				}
+
+				// histogram is filled only if requested and stored, skipped otherwise
+				void read_data(history_row_t *row, bool with_hv)
+				{
+					row->data.req_count  = (uint32_t)varint___read(&p);
+					row->data.hit_count  = (uint32_t)varint___read(&p);
+					row->data.time_total = duration_t { varint___unzigzag(varint___read(&p)) };
+					row->data.ru_utime   = duration_t { varint___unzigzag(varint___read(&p)) };
+					row->data.ru_stime   = duration_t { varint___unzigzag(varint___read(&p)) };
+
+					if (tick->compressed_hv)
+						flat_histogram___unpack(&p, (with_hv) ? &row->hv : nullptr);
+
+					row_i++;
+				}
+
+				// key_hash is recalculated here, that's the cpu price for not storing it
+				void read_row(history_row_t *row, bool with_hv)
+				{
+					row->key      = this->read_key();
+					row->key_hash = report_key_impl___hasher_t()(row->key);
+					this->read_data(row, with_hv);
+				}
+			};
+
+			// find a single row (with histogram) in compressed tick, returns false if key is not there
+			static bool compressed_tick___find(history_tick_t const& tick, key_t const& key, history_row_t *row)
+			{
+				if (tick.compressed_rows == 0)
+					return false;
+
+				// last restart, that starts with a key <= the one we need
+				uint32_t lo = 0;
+				uint32_t hi = tick.restarts.size();
+
+				while ((hi - lo) > 1)
+				{
+					uint32_t const mid = lo + (hi - lo) / 2;
+
+					compressed_reader_t reader { tick, mid };
+					if (key < reader.read_key())
+						hi = mid;
+					else
+						lo = mid;
+				}
+
+				compressed_reader_t reader { tick, lo };
+
+				for (uint32_t i = 0; (i < compressed_restart_interval) && !reader.at_end(); i++)
+				{
+					key_t const& row_key = reader.read_key();
+
+					if (row_key == key)
+					{
+						row->key      = row_key;
+						row->key_hash = report_key_impl___hasher_t()(row_key);
+						reader.read_data(row, true);
+						return true;
+					}
+
+					if (key < row_key)
+						return false;
+
+					reader.read_data(row, false);
+				}
+
+				return false;
+			}
+
+			// history partition of a key, by its history_partition_key part value, see history_tick_t::part_offsets
+			// not the key hash, so that filters on that key part know what partitions their words are in
+			static uint32_t history_partition_of(uint32_t word_id, uint32_t n_partitions)
+			{
+				return uint32_t((uint64_t(uint32_t(pinba::hash_mix64(word_id) >> 32)) * n_partitions) >> 32);
+			}
+
+			// history_tick___for_each_row() for flat tick rows [begin, end)
+			template<class Function>
+			static void history_tick___for_each_row_in(history_tick_t const& tick, size_t begin, size_t end, bool with_hv, Function const& func)
+			{
+				assert(!tick.is_compressed);
+
+				with_hv = with_hv && !tick.hvs.empty();
+
+				flat_histogram_t hv = {};
+
+				for (size_t i = begin; i < end; i++)
+				{
+					if (with_hv)
+						tick.hvs.unpack(i, &hv);
+
+					func(history_row_ref_t {
+						.key_hash = tick.key_hashes[i],
+						.key      = tick.keys[i],
+						.data     = tick.datas[i],
+						.hv       = (with_hv) ? &hv : nullptr,
+					});
+				}
+			}
+
+			// calls func(history_row_ref_t const&) for every row in the tick, compressed ones are decoded one by one
+			// and histograms are unpacked one by one (so row reference is only valid during the call)
+			template<class Function>
+			static void history_tick___for_each_row(history_tick_t const& tick, bool with_hv, Function const& func)
+			{
+				if (!tick.is_compressed)
+				{
+					history_tick___for_each_row_in(tick, 0, tick.keys.size(), with_hv, func);
+					return;
+				}
+
+				history_row_t row = {};
+
+				for (compressed_reader_t reader { tick }; !reader.at_end(); )
+				{
+					reader.read_row(&row, with_hv);
+
+					func(history_row_ref_t {
+						.key_hash = row.key_hash,
+						.key      = row.key,
+						.data     = row.data,
+						.hv       = (with_hv && tick.compressed_hv) ? &row.hv : nullptr,
+					});
+				}
+			}
+
+			// running aggregate over all ticks currently in the ring
+			// new ticks are added in merge_tick(), ticks falling out of the ring are subtracted
+			// this allows snapshots without histograms to avoid re-merging all ticks on every select
+			struct running_row_t
+			{
+				uint64_t  key_hash;
+				data_t    data;
+				uint32_t  n_ticks; // number of ticks in the ring, that have this key
+			};
+
+			struct running_hashtable_t
+				: public HashtableP::template map_t<key_t, running_row_t>
+			{
+			};
+			using running_ptr = std::shared_ptr<running_hashtable_t const>;
+
+			// what snapshot gets from us, behaves like ringbuffer_t for report_snapshot__impl_t
+			struct snapshot_source_t
+			{
+				ringbuffer_t           ticks;
+				running_ptr            running;
+				std::vector<uint32_t>  widths;  // fine ticks covered by ticks[i], see report_history_tiered_ringbuffer_t
+
+				using iterator       = ringbuffer_t::iterator;
+				using const_iterator = ringbuffer_t::const_iterator;
+
+				iterator       begin()       { return ticks.begin(); }
+				iterator       end()         { return ticks.end(); }
+				const_iterator begin() const { return ticks.begin(); }
+				const_iterator end()   const { return ticks.end(); }
+				size_t         size()  const { return ticks.size(); }
+
+				void clear()
+				{
+					ticks.clear();
+					ticks.shrink_to_fit();
+					running.reset();
+					widths.clear();
+				}
+			};
+
+		public:
+
+			history_t(pinba_globals_t *globals, report_info_t const& rinfo, report_conf___by_timer_t const& conf, report_mem_budget_ptr const& mem_budget, report_live_estimates_ptr live_estimates)
+				: globals_(globals)
+				, stats_(nullptr)
+				, counters_(nullptr)
+				, rinfo_(rinfo)
+				, hv_conf_(histogram___configure_with_rinfo(rinfo))
+				, compress_ticks_(conf.tick_storage == REPORT_TICK_STORAGE__COMPRESSED)
+				, ring_(rinfo.tick_count * rinfo.agg_threads, rollup_factors_for(conf, rinfo)) // every aggregator thread produces its own tick
+				, mem_budget_(mem_budget->is_enabled() ? mem_budget : nullptr)
+				, persist_signature_(persist_signature_for(conf))
+				, live_estimates_(std::move(live_estimates))
+			{
+			}
+
+			~history_t()
+			{
+				if (mem_budget_)
+					mem_budget_->history_mem_update(0);
+
+				for (auto const& sub : tick_subscriptions_)
+					sub->close();
+			}
+
+			// fine ticks come from all aggregator threads, so first rollup needs agg_threads times more of those
+			static std::vector<uint32_t> rollup_factors_for(report_conf___by_timer_t const& conf, report_info_t const& rinfo)
+			{
+				std::vector<uint32_t> result = conf.rollup_factors;
+
+				if (!result.empty())
+					result[0] *= rinfo.agg_threads;
+
+				return result;
+			}
+
+			// saved history is only usable by a report with the same keys and rollups
+			// filters are not included, their names have dictionary ids, that are not stable between restarts
+			static uint64_t persist_signature_for(report_conf___by_timer_t const& conf)
+			{
+				std::string sig;
+
+				for (auto const& kd : conf.keys)
+					sig += kd.name + "/";
+
+				for (auto const& factor : conf.rollup_factors)
+					sig += std::to_string(factor) + "/";
+
+				return pinba::hash_string(sig);
+			}
+
+			virtual void stats_init(report_stats_t *stats) override
+			{
+				stats_ = stats;
+				counters_ = report_stats___add_thread(stats);
+			}
+
+			virtual void merge_tick(report_tick_ptr tick_base) override
+			{
+				// re-process tick data, for more compact storage
+				auto *agg_tick = static_cast<tick_t const*>(tick_base.get()); // src (non-const to move from, see below)
+				auto    h_tick = meow::make_intrusive<history_tick_t>();      // dst
+
+				// remember to grab repacker_state
+				h_tick->repacker_state = std::move(agg_tick->repacker_state);
+
+				// reserve, we know the size
+				std::vector<history_row_t> rows;
+				rows.reserve(agg_tick->arena->ht.size());
+
+				for (auto const& ht_pair : agg_tick->arena->ht)
+				{
+					rows.emplace_back();
+
+					key_t       const& src_key  = ht_pair.first;
+					tick_item_t const& src_item = *ht_pair.second;
+					history_row_t    & dst_row  = rows.back();
+
+					dst_row.key_hash = src_item.key_hash;
+					dst_row.key      = src_key;
+					dst_row.data     = src_item.data;
+
+					if (rinfo_.hv_enabled)
+						dst_row.hv = flat_histogram___summarize(histogram___convert_hdr_to_flat(src_item.hv, hv_conf_), rinfo_.hv_summary_points);
+				}
+
+				// rows received from edges since the last tick, see federation_merge()
+				if (!remote_rows_.empty())
+					this->remote_rows_fold(h_tick.get(), rows);
+
+				this->store_rows(h_tick.get(), rows);
+
+				if (federation_sender_t *sender = globals_->federation_sender())
+					this->federation_send(sender, *h_tick);
+
+				if (!tick_subscriptions_.empty())
+					this->tick_publish(*h_tick);
+
+				this->running_add(*h_tick);
+				this->totals_add(*h_tick);
+
+				auto const rollup = [this](ringbuffer_t const& src)
+				{
+					for (auto const& tick_base : src)
+						this->totals_subtract(static_cast<history_tick_t const&>(*tick_base));
+
+					report_tick_ptr result = this->rollup_ticks(src);
+					this->totals_add(static_cast<history_tick_t const&>(*result));
+					return result;
+				};
+
+				for (auto const& evicted : ring_.append(std::move(h_tick), rollup))
+				{
+					this->running_subtract(static_cast<history_tick_t const&>(*evicted));
+					this->totals_subtract(static_cast<history_tick_t const&>(*evicted));
+				}
+
+				// running aggregate has changed, next snapshot must re-publish
+				running_published_.reset();
+				repacker_states_.reset();
+
+				if (mem_budget_)
+					this->mem_budget_enforce();
+
+				this->publish();
+			}
+
+		private:
+
+			// rows are consumed (moved from, or compressed), flat ticks get rows split into columns
+			void store_rows(history_tick_t *tick, std::vector<history_row_t>& rows)
+			{
+				tick->key_sketch = report_key_sketch___build(rows.size(), [&rows](size_t i) { return rows[i].key_hash; });
+				if (tick->key_sketch)
+					tick->mem_used += sizeof(*tick->key_sketch);
+
+				if (compress_ticks_)
+				{
+					compressed_tick___encode(tick, rows, rinfo_.hv_enabled);
+					return;
+				}
+
+				tick->key_hashes.reserve(rows.size());
+				tick->keys.reserve(rows.size());
+				tick->datas.reserve(rows.size());
+
+				if (rinfo_.hv_enabled)
+					tick->hvs.reserve(rows.size());
+
+				auto const push_row = [&](history_row_t& row)
+				{
+					tick->key_hashes.push_back(row.key_hash);
+					tick->keys.push_back(row.key);
+					tick->datas.push_back(row.data);
+
+					if (rinfo_.hv_enabled)
+						tick->hvs.push_back(row.hv);
+				};
+
+				if (rinfo_.history_partitions > 0)
+				{
+					// counting sort by partition, rows keep their order within one
+					uint32_t const n_parts = rinfo_.history_partitions;
+
+					tick->part_offsets.assign(n_parts + 1, 0);
+					tick->part_totals.assign(n_parts, data_t{});
+
+					std::vector<uint32_t> row_parts(rows.size());
+
+					for (size_t i = 0; i < rows.size(); i++)
+					{
+						uint32_t const p = history_partition_of(rows[i].key[rinfo_.history_partition_key], n_parts);
+						row_parts[i] = p;
+						tick->part_offsets[p + 1]++;
+						snapshot_traits::add_to_totals(&tick->part_totals[p], rows[i].data);
+					}
+
+					for (uint32_t p = 0; p < n_parts; p++)
+						tick->part_offsets[p + 1] += tick->part_offsets[p];
+
+					std::vector<uint32_t> order(rows.size());
+					std::vector<uint32_t> next(tick->part_offsets.begin(), tick->part_offsets.end() - 1);
+
+					for (size_t i = 0; i < rows.size(); i++)
+						order[next[row_parts[i]]++] = i;
+
+					for (uint32_t const i : order)
+						push_row(rows[i]);
+
+					tick->mem_used += tick->part_offsets.capacity() * sizeof(*tick->part_offsets.begin());
+					tick->mem_used += tick->part_totals.capacity() * sizeof(*tick->part_totals.begin());
+				}
+				else
+				{
+					for (auto& row : rows)
+						push_row(row);
+				}
+
+				tick->hvs.shrink_to_fit();
+
+				tick->mem_used += tick->key_hashes.capacity() * sizeof(*tick->key_hashes.begin());
+				tick->mem_used += tick->keys.capacity() * sizeof(*tick->keys.begin());
+				tick->mem_used += tick->datas.capacity() * sizeof(*tick->datas.begin());
+				tick->mem_used += tick->hvs.mem_used();
+
+				if (rinfo_.hv_enabled)
+				{
+					report_tick_hash_index___build_from_hashes(&tick->hash_index, tick->key_hashes);
+					tick->mem_used += tick->hash_index.capacity() * sizeof(*tick->hash_index.begin());
+				}
+			}
+
+			void totals_add(history_tick_t const& tick)
+			{
+				totals_.add(tick.row_count(), sizeof(tick) + tick.mem_used);
+			}
+
+			void totals_subtract(history_tick_t const& tick)
+			{
+				totals_.subtract(tick.row_count(), sizeof(tick) + tick.mem_used);
+			}
+
+			// publish memory usage, and trim oldest ticks while over budget (every flat tick is trimmed once)
+			void mem_budget_enforce()
+			{
+				uint64_t mem_used = this->mem_used();
+				mem_budget_->history_mem_update(mem_used);
+
+				if (!mem_budget_->is_over(0))
+					return;
+
+				ring_.replace_oldest_first([&](report_tick_ptr& tick_base)
+				{
+					auto const& tick = static_cast<history_tick_t const&>(*tick_base);
+
+					if (tick.is_compressed || tick.trimmed)
+						return true;
+
+					auto trimmed_tick = this->trim_tick(tick);
+
+					this->totals_subtract(tick);
+					this->totals_add(*trimmed_tick);
+
+					mem_used = mem_used - tick.mem_used + trimmed_tick->mem_used;
+					mem_budget_->history_mem_update(mem_used);
+
+					tick_base = std::move(trimmed_tick); // snapshots might still hold the old one, never modify in place
+
+					return mem_budget_->is_over(0);
+				});
+			}
+
+			// new tick with the heavier half of rows (by req_count), dropped rows are taken out of running aggregate
+			boost::intrusive_ptr<history_tick_t> trim_tick(history_tick_t const& tick)
+			{
+				size_t const n_rows = tick.keys.size();
+				size_t const n_keep = n_rows / 2;
+
+				std::vector<uint32_t> order(n_rows);
+				std::iota(order.begin(), order.end(), 0);
+
+				std::nth_element(order.begin(), order.begin() + n_keep, order.end(), [&tick](uint32_t l, uint32_t r)
+				{
+					return tick.datas[l].req_count > tick.datas[r].req_count;
+				});
+
+				auto h_tick = meow::make_intrusive<history_tick_t>();
+				h_tick->repacker_state  = tick.repacker_state;
+				h_tick->persisted_words = tick.persisted_words;
+				h_tick->trimmed         = true;
+
+				std::vector<history_row_t> rows;
+				rows.reserve(n_keep);
+
+				for (size_t i = 0; i < n_rows; i++)
+				{
+					uint32_t const offset = order[i];
+
+					if (i >= n_keep)
+					{
+						this->running_subtract_row(history_row_ref_t {
+							.key_hash = tick.key_hashes[offset],
+							.key      = tick.keys[offset],
+							.data     = tick.datas[offset],
+							.hv       = nullptr,
+						});
+						continue;
+					}
+
+					rows.emplace_back();
+					history_row_t& row = rows.back();
+
+					row.key_hash = tick.key_hashes[offset];
+					row.key      = tick.keys[offset];
+					row.data     = tick.datas[offset];
+
+					if (rinfo_.hv_enabled)
+						tick.hvs.unpack(offset, &row.hv);
+				}
+
+				counters_->rows_evicted += (n_rows - n_keep);
+
+				this->store_rows(h_tick.get(), rows);
+				return h_tick;
+			}
+
+			// merge ticks into a single coarse one, see report_history_tiered_ringbuffer_t
+			// source ticks are already in running aggregate, just fix key tick counts there
+			report_tick_ptr rollup_ticks(ringbuffer_t const& src)
+			{
+				struct rollup_row_t
+				{
+					history_row_t                           row;
+					uint32_t                                n_ticks;
+					std::vector<histogram_values_t const*>  saved_hv;
+				};
+
+				using rollup_hashtable_t = typename HashtableP::template map_t<key_t, rollup_row_t>;
+
+				bool const need_histograms = rinfo_.hv_enabled;
+
+				rollup_hashtable_t             ht;
+				std::deque<flat_histogram_t>   decoded_hvs; // histograms unpacked from ticks, saved_hv point here
+
+				auto h_tick = meow::make_intrusive<history_tick_t>();
+
+				for (auto const& tick_base : src)
+				{
+					auto const& tick = static_cast<history_tick_t const&>(*tick_base);
+
+					repacker_state___merge_to_from(h_tick->repacker_state, tick.repacker_state);
+
+					for (auto const& words : tick.persisted_words)
+					{
+						auto& dst_words = h_tick->persisted_words;
+						if (std::find(dst_words.begin(), dst_words.end(), words) == dst_words.end())
+							dst_words.push_back(words);
+					}
+
+					history_tick___for_each_row(tick, need_histograms, [&](history_row_ref_t const& src_row)
+					{
+						auto inserted_pair = ht.emplace_hash(src_row.key_hash, src_row.key, rollup_row_t{});
+						rollup_row_t& dst = inserted_pair.first.value();
+
+						dst.row.key_hash         = src_row.key_hash;
+						dst.row.data.req_count  += src_row.data.req_count;
+						dst.row.data.hit_count  += src_row.data.hit_count;
+						dst.row.data.time_total += src_row.data.time_total;
+						dst.row.data.ru_utime   += src_row.data.ru_utime;
+						dst.row.data.ru_stime   += src_row.data.ru_stime;
+						dst.n_ticks             += 1;
+
+						if (need_histograms)
+						{
+							decoded_hvs.emplace_back(std::move(*src_row.hv));
+							dst.saved_hv.push_back(&decoded_hvs.back().values);
+						}
+					});
+				}
+
+				std::vector<history_row_t> rows;
+				rows.reserve(ht.size());
+
+				for (auto it = ht.begin(), it_end = ht.end(); it != it_end; ++it)
+				{
+					rollup_row_t& src_row = it.value();
+
+					if (need_histograms)
+						flat_histogram___merge_multi(&src_row.row.hv, src_row.saved_hv.begin(), src_row.saved_hv.end());
+
+					// key is in one tick now, instead of n_ticks
+					if (src_row.n_ticks > 1)
+					{
+						auto running_it = running_.find(it->first, src_row.row.key_hash);
+						assert(running_it != running_.end());
+
+						running_it.value().n_ticks -= (src_row.n_ticks - 1);
+					}
+
+					rows.emplace_back(std::move(src_row.row));
+					rows.back().key = it->first;
+				}
+
+				this->store_rows(h_tick.get(), rows);
+
+				return h_tick;
+			}
+
+			void running_add(history_tick_t const& tick)
+			{
+				history_tick___for_each_row(tick, false, [this](history_row_ref_t const& src)
+				{
+					auto inserted_pair = running_.emplace_hash(src.key_hash, src.key, running_row_t{});
+					running_row_t& dst = inserted_pair.first.value();
+
+					dst.key_hash         = src.key_hash;
+					dst.data.req_count  += src.data.req_count;
+					dst.data.hit_count  += src.data.hit_count;
+					dst.data.time_total += src.data.time_total;
+					dst.data.ru_utime   += src.data.ru_utime;
+					dst.data.ru_stime   += src.data.ru_stime;
+					dst.n_ticks         += 1;
+				});
+			}
+
+			void running_subtract(history_tick_t const& tick)
+			{
+				history_tick___for_each_row(tick, false, [this](history_row_ref_t const& src)
+				{
+					this->running_subtract_row(src);
+				});
+			}
+
+			void running_subtract_row(history_row_ref_t const& src)
+			{
+				auto it = running_.find(src.key, src.key_hash);
+				assert(it != running_.end());
+
+				running_row_t& dst = it.value();
+
+				// key not present in any other tick, drop it, so the aggregate doesn't grow indefinitely
+				if (--dst.n_ticks == 0)
+				{
+					running_.erase(it);
+					return;
+				}
+
+				dst.data.req_count  -= src.data.req_count;
+				dst.data.hit_count  -= src.data.hit_count;
+				dst.data.time_total -= src.data.time_total;
+				dst.data.ru_utime   -= src.data.ru_utime;
+				dst.data.ru_stime   -= src.data.ru_stime;
+			}
+
+		public:
+
+			virtual report_estimates_t get_estimates() override
+			{
+				report_estimates_t result = {};
+
+				result.row_count = totals_.row_count_estimate(stats_);
+				result.mem_used  = this->mem_used();
+
+				return result;
+			}
+
+			uint64_t mem_used() const
+			{
+				uint64_t result = 0;
+
+				result += sizeof(*this);
+				result += running_.bucket_count() * sizeof(*running_.begin());
+
+				if (running_published_)
+					result += running_published_->bucket_count() * sizeof(*running_published_->begin());
+
+				result += totals_.mem_used;
+
+				return result;
+			}
+
+		public: // persistence, see report_persist.h
+
+			static constexpr uint32_t persist_data_fields = 5; // data_t, every field as u64
+
+			virtual pinba_error_t persist_save(std::string const& path) override
+			{
+				report_persist_writer_t writer { globals_, rinfo_, persist_data_fields, persist_signature_ };
+
+				ring_.for_each_tick([&](report_tick_ptr const& tick_base, uint32_t width)
+				{
+					auto const& tick = static_cast<history_tick_t const&>(*tick_base);
+
+					writer.tick_begin(width, tick.row_count());
+					this->persist_write_rows(writer, tick);
+				});
+
+				return writer.write_to_file(path);
+			}
+
+			void persist_write_rows(report_persist_writer_t& writer, history_tick_t const& tick)
+			{
+				history_tick___for_each_row(tick, rinfo_.hv_enabled, [&](history_row_ref_t const& row)
+				{
+					uint64_t const data[persist_data_fields] = {
+						row.data.req_count,
+						row.data.hit_count,
+						uint64_t(row.data.time_total.nsec),
+						uint64_t(row.data.ru_utime.nsec),
+						uint64_t(row.data.ru_stime.nsec),
+					};
+
+					writer.row(row.key.data(), data, row.hv);
+				});
+			}
+
+			virtual pinba_error_t persist_load(std::string const& path) override
+			{
+				if (!ring_.get_ringbuffer().empty())
+					return ff::fmt_err("history already has ticks, can't load older ones");
+
+				report_persist_reader_t reader { globals_ };
+
+				if (auto const err = reader.open(path))
+					return err;
+
+				if (auto const err = reader.validate(rinfo_, persist_data_fields, persist_signature_))
+					return err;
+
+				struct loaded_tick_t
+				{
+					boost::intrusive_ptr<history_tick_t>  tick;
+					uint32_t                              width;
+				};
+
+				std::vector<loaded_tick_t> loaded;
+				uint32_t                   covered_ticks = 0;
+
+				uint32_t width, n_rows;
+				while (reader.next_tick(&width, &n_rows))
+				{
+					auto h_tick = meow::make_intrusive<history_tick_t>();
+					h_tick->persisted_words.push_back(reader.words());
+
+					std::vector<history_row_t> rows(n_rows);
+
+					for (auto& row : rows)
+					{
+						uint64_t data[persist_data_fields];
+
+						if (!reader.next_row(row.key.data(), data, (rinfo_.hv_enabled) ? &row.hv : nullptr))
+							return (reader.error()) ? reader.error() : ff::fmt_err("tick has less rows than promised");
+
+						// word ids are different now, so are hashes
+						row.key_hash        = report_key_impl___hasher_t()(row.key);
+						row.data.req_count  = data[0];
+						row.data.hit_count  = data[1];
+						row.data.time_total = duration_t { int64_t(data[2]) };
+						row.data.ru_utime   = duration_t { int64_t(data[3]) };
+						row.data.ru_stime   = duration_t { int64_t(data[4]) };
+					}
+
+					this->store_rows(h_tick.get(), rows);
+
+					loaded.push_back({ std::move(h_tick), width });
+					covered_ticks += width;
+				}
+
+				if (reader.error())
+					return reader.error();
+
+				// time has passed since save, drop oldest ticks that are now out of the window
+				uint32_t to_skip = report_persist___ticks_to_skip(reader.header(), ring_.max_ticks(), covered_ticks);
+
+				size_t first = 0;
+				for (; (first < loaded.size()) && (to_skip > 0); first++)
+					to_skip -= std::min(to_skip, loaded[first].width);
+
+				for (size_t i = first; i < loaded.size(); i++)
+				{
+					history_tick_t const& tick = *loaded[i].tick;
+
+					if (!ring_.restore(loaded[i].tick, loaded[i].width))
+						return ff::fmt_err("tick {0} (width {1}) doesn't fit into history ring", i, loaded[i].width);
+
+					this->running_add(tick);
+					this->totals_add(tick);
+				}
+
+				running_published_.reset();
+				repacker_states_.reset();
+
+				if (mem_budget_)
+					this->mem_budget_enforce();
+
+				this->publish();
+				return {};
+			}
+
+		public: // federation, see federation.h
+
+			// edge, every tick goes upstream as soon as it's merged (with rows from our own edges, if any)
+			void federation_send(federation_sender_t *sender, history_tick_t const& tick)
+			{
+				if (tick.row_count() == 0)
+					return;
+
+				this->tick_encode(tick, &federation_buf_);
+				sender->send_tick(rinfo_.name, federation_buf_);
+			}
+
+			// single tick in report_persist format, what federation and tick subscribers get
+			void tick_encode(history_tick_t const& tick, std::string *out)
+			{
+				report_persist_writer_t writer { globals_, rinfo_, persist_data_fields, persist_signature_ };
+
+				writer.tick_begin(1, tick.row_count());
+				this->persist_write_rows(writer, tick);
+
+				writer.write_to_string(out);
+			}
+
+			virtual pinba_error_t tick_subscribe(report_tick_subscription_ptr subscription) override
+			{
+				tick_subscriptions_.push_back(std::move(subscription));
+				return {};
+			}
+
+			// empty ticks are published as well, subscribers want every tick, not just the ones with data
+			// encoded once, shared by all subscribers, closed ones (dropped or unsubscribed) are forgotten
+			void tick_publish(history_tick_t const& tick)
+			{
+				auto tick_data = std::make_shared<std::string>();
+				this->tick_encode(tick, tick_data.get());
+
+				report_tick_data_ptr const data = std::move(tick_data);
+
+				auto const it = std::remove_if(tick_subscriptions_.begin(), tick_subscriptions_.end(),
+					[&data](report_tick_subscription_ptr const& sub) { return !sub->push(data); });
+
+				uint32_t const n_gone = std::distance(it, tick_subscriptions_.end());
+				tick_subscriptions_.erase(it, tick_subscriptions_.end());
+
+				if (n_gone > 0)
+				{
+					LOG_DEBUG(globals_->logger(), "report '{0}'; {1} tick subscribers gone, {2} left",
+						rinfo_.name, n_gone, tick_subscriptions_.size());
+				}
+			}
+
+			// central, remote rows are summed up until the next local tick, which takes them all (see remote_rows_fold())
+			// appending remote ticks to the ring as they come would make time window shorter with every edge
+			virtual pinba_error_t federation_merge(std::string tick_data) override
+			{
+				report_persist_reader_t reader { globals_ };
+
+				if (auto const err = reader.open_buffer(std::move(tick_data)))
+					return err;
+
+				// edges can run different number of aggregator threads, ticks are folded into ours anyway
+				report_info_t rinfo = rinfo_;
+				rinfo.agg_threads = reader.header().agg_threads;
+
+				if (auto const err = reader.validate(rinfo, persist_data_fields, persist_signature_))
+					return err;
+
+				// tick that has been stuck somewhere for a whole window would otherwise be counted as fresh
+				int64_t const now_ns = duration_from_timeval(os_unix::clock_gettime_ex(CLOCK_REALTIME)).nsec;
+				if ((now_ns - reader.header().saved_at) > rinfo_.time_window.nsec)
+					return ff::fmt_err("tick is older than report time window");
+
+				// before any row is taken, rows reference these words
+				remote_words_.push_back(reader.words());
+
+				uint32_t width, n_rows;
+				while (reader.next_tick(&width, &n_rows))
+				{
+					for (uint32_t i = 0; i < n_rows; i++)
+					{
+						key_t            key;
+						uint64_t         data[persist_data_fields];
+						flat_histogram_t hv = {};
+
+						if (!reader.next_row(key.data(), data, (rinfo_.hv_enabled) ? &hv : nullptr))
+							return (reader.error()) ? reader.error() : ff::fmt_err("tick has less rows than promised");
+
+						uint64_t const key_hash = report_key_impl___hasher_t()(key);
+
+						auto inserted_pair = remote_rows_.emplace_hash(key_hash, key, remote_row_t{});
+						remote_row_t& dst = inserted_pair.first.value();
+
+						dst.row.key_hash         = key_hash;
+						dst.row.data.req_count  += data[0];
+						dst.row.data.hit_count  += data[1];
+						dst.row.data.time_total += duration_t { int64_t(data[2]) };
+						dst.row.data.ru_utime   += duration_t { int64_t(data[3]) };
+						dst.row.data.ru_stime   += duration_t { int64_t(data[4]) };
+
+						if (rinfo_.hv_enabled)
+						{
+							if (inserted_pair.second)
+								dst.row.hv = std::move(hv);
+							else
+								flat_histogram___add(&dst.row.hv, hv);
+						}
+					}
+				}
+
+				return reader.error();
+			}
+
+		private:
+
+			struct remote_row_t
+			{
+				history_row_t  row;
+				bool           folded = false;
+			};
+			using remote_hashtable_t = typename HashtableP::template map_t<key_t, remote_row_t>;
+
+			static void flat_histogram___add(flat_histogram_t *to, flat_histogram_t const& from)
+			{
+				histogram_values_t const *sources[] = { &to->values, &from.values };
+
+				flat_histogram_t merged = {};
+				flat_histogram___merge_multi(&merged, std::begin(sources), std::end(sources));
+
+				*to = std::move(merged);
+			}
+
+			// pending remote rows go into local tick rows, matching keys are summed up, the rest are appended
+			void remote_rows_fold(history_tick_t *tick, std::vector<history_row_t>& rows)
+			{
+				for (auto& row : rows)
+				{
+					auto it = remote_rows_.find(row.key, row.key_hash);
+					if (it == remote_rows_.end())
+						continue;
+
+					remote_row_t& remote = it.value();
+
+					row.data.req_count  += remote.row.data.req_count;
+					row.data.hit_count  += remote.row.data.hit_count;
+					row.data.time_total += remote.row.data.time_total;
+					row.data.ru_utime   += remote.row.data.ru_utime;
+					row.data.ru_stime   += remote.row.data.ru_stime;
+
+					if (rinfo_.hv_enabled)
+						flat_histogram___add(&row.hv, remote.row.hv);
+
+					remote.folded = true;
+				}
+
+				for (auto it = remote_rows_.begin(), it_end = remote_rows_.end(); it != it_end; ++it)
+				{
+					remote_row_t& remote = it.value();
+					if (remote.folded)
+						continue;
+
+					rows.emplace_back(std::move(remote.row));
+					rows.back().key = it->first;
+				}
+
+				remote_rows_.clear();
+
+				tick->persisted_words.insert(tick->persisted_words.end(), remote_words_.begin(), remote_words_.end());
+				remote_words_.clear();
+			}
+
+		public: // snapshot
+
+			struct snapshot_traits
+			{
+				using src_ticks_t = snapshot_source_t;
+				using totals_t    = report_row_data___by_timer_t;
+
+				// rows are keyed by hash, can merge in parallel by splitting key space
+				static constexpr bool can_merge_partitioned = true;
+
+				struct row_t
 				{
 					data_t       data;
+					uint64_t     key_hash;  // carried from tick, for lazy histogram lookups (and never recalculated)
 
 					// list of saved hvs, we merge only when requested (i.e. in hv_at_position)
 					// please note that we're also saving pointers to flat_histogram_t::values
 					// and will restore full structs on merge
 					// this a 'limitation' of multi_merge() function
-					std::vector<histogram_values_t const*>  saved_hv;
+					// list lives in hashtable_t::scratch
+					nmpa_ptr_list_t<histogram_values_t>     saved_hv;
 					flat_histogram_t                        merged_hv;
+					bool                                    hv_merged;
 				};
 
 				struct hashtable_t
-					: public tsl::robin_map<
-									  key_t
-									, row_t
-									, report_key_impl___hasher_t
-									, report_key_impl___equal_t
-									, std::allocator<std::pair<key_t, row_t>>
-									, /*StoreHash=*/ true>
+					: public HashtableP::template map_t<key_t, row_t>
 				{
+					// set when histograms were not requested in merge flags,
+					// rows find their histograms in these ticks on first access instead
+					ringbuffer_t const *lazy_hv_ticks = nullptr;
+
+					// histograms unpacked from ticks, row_t::saved_hv point here
+					mutable std::deque<flat_histogram_t> decoded_hvs;
+
+					// row_t::saved_hv storage
+					report_snapshot_scratch_t scratch;
+
+					// sums of rows skipped by report_snapshot_ctx_t::key_filter, for totals
+					totals_t filtered_out = {};
 				};
 
 			public:
@@ -710,81 +2099,82 @@ namespace { namespace aux {
 					return report_key_t { it->first };
 				}
 
+				static typename hashtable_t::iterator find_key(hashtable_t& ht, report_key_t const& k)
+				{
+					if (k.size() != NKeys)
+						return ht.end();
+
+					key_t key;
+					for (size_t i = 0; i < NKeys; i++)
+						key[i] = k[i];
+
+					return ht.find(key);
+				}
+
 				static void* value_at_position(hashtable_t const&, typename hashtable_t::iterator const& it)
 				{
 					return (void*)&it->second.data;
 				}
 
-				static void* hv_at_position(hashtable_t const&, typename hashtable_t::iterator const& it)
+				static void* hv_at_position(hashtable_t const& ht, typename hashtable_t::iterator const& it)
 				{
 					row_t *row = const_cast<row_t*>(&it->second); // will mutate the row, potentially
 
-					if (row->saved_hv.empty()) // already merged
+					if (row->hv_merged)
 						return &row->merged_hv;
 
-					struct merger_t
+					// histograms were not gathered in merge, find this row in every tick now
+					// this way only rows that are actually read pay for histogram merge (think ORDER BY ... LIMIT)
+					if (row->saved_hv.empty() && ht.lazy_hv_ticks)
 					{
-						flat_histogram_t *to;
-
-						inline bool compare(histogram_value_t const& l, histogram_value_t const& r) const
-						{
-							return l.bucket_id < r.bucket_id;
-						}
-
-						inline bool equal(histogram_value_t const& l, histogram_value_t const& r) const
-						{
-							return l.bucket_id == r.bucket_id;
-						}
-
-						inline void reserve(size_t const sz)
-						{
-							to->values.reserve(sz);
-						}
+						uint64_t const key_hash = row->key_hash;
+						size_t const   n_ticks  = ht.lazy_hv_ticks->size();
 
-						inline void push_back(histogram_values_t const *seq, histogram_value_t const& v)
+						for (auto const& tick_base : *ht.lazy_hv_ticks)
 						{
-							flat_histogram_t *src = MEOW_SELF_FROM_MEMBER(flat_histogram_t, values, seq);
-
-							bool const should_insert = [&]()
-							{
-								if (to->values.empty())
-									return true;
+							if (!tick_base)
+								continue;
 
-								return !equal(to->values.back(), v);
-							}();
+							auto const& tick = static_cast<history_tick_t const&>(*tick_base);
 
-							if (should_insert)
+							if (tick.is_compressed)
 							{
-								to->values.emplace_back(v);
+								history_row_t found_row = {};
+								if (compressed_tick___find(tick, it->first, &found_row))
+								{
+									ht.decoded_hvs.emplace_back(std::move(found_row.hv));
+									row->saved_hv.push_back(ht.scratch.nmpa(), n_ticks, &ht.decoded_hvs.back().values);
+								}
+								continue;
 							}
-							else
+
+							size_t const offset = report_tick_hash_index___find_in_columns(tick.hash_index, tick.key_hashes, tick.keys, key_hash, it->first);
+							if (offset != tick.keys.size())
 							{
-								to->values.back().value += v.value;
+								ht.decoded_hvs.emplace_back(tick.hvs.unpack(offset));
+								row->saved_hv.push_back(ht.scratch.nmpa(), n_ticks, &ht.decoded_hvs.back().values);
 							}
 						}
-					};
-
-					// merge histogram values
-					merger_t merger = { .to = &row->merged_hv };
-					pinba::multi_merge(&merger, row->saved_hv.begin(), row->saved_hv.end());
-
-					// merge histogram totals
-					for (auto const *src_hv_values : row->saved_hv)
-					{
-						flat_histogram_t *src = MEOW_SELF_FROM_MEMBER(flat_histogram_t, values, src_hv_values);
-						row->merged_hv.total_count  += src->total_count;
-						row->merged_hv.negative_inf += src->negative_inf;
-						row->merged_hv.positive_inf += src->positive_inf;
 					}
 
+					// merge histogram values and totals
+					flat_histogram___merge_multi(&row->merged_hv, row->saved_hv.begin(), row->saved_hv.end());
+
 					// clear source
 					row->saved_hv.clear();
+					row->hv_merged = true;
 
 					return &row->merged_hv;
 				}
 
-				static void calculate_raw_stats(report_snapshot_ctx_t *snapshot_ctx, src_ticks_t const& ticks, report_raw_stats_t *stats)
+				static uint32_t estimate_unique_rows(report_snapshot_ctx_t *snapshot_ctx, src_ticks_t const& ticks)
 				{
+					// running aggregate has every key in ticks exactly once
+					if (ticks.running)
+						return ticks.running->size();
+
+					report_unique_rows_estimator_t estimator;
+
 					for (auto const& tick_base : ticks)
 					{
 						if (!tick_base)
@@ -792,45 +2182,144 @@ namespace { namespace aux {
 
 						auto const& tick = static_cast<history_tick_t const&>(*tick_base);
 
-						stats->row_count += tick.rows.size();
+						if (tick.key_sketch)
+						{
+							estimator.add_sketch(*tick.key_sketch);
+							continue;
+						}
+
+						// small compressed ticks have no sketch either, decoding them here is about as costly as merging
+						if (tick.is_compressed)
+							return 0;
+
+						for (uint64_t const key_hash : tick.key_hashes)
+							estimator.add_key_hash(key_hash);
 					}
+
+					return estimator.estimate();
 				}
 
-				static void calculate_totals(report_snapshot_ctx_t *snapshot_ctx, hashtable_t const& data, totals_t *totals)
+				static void calculate_raw_stats(report_snapshot_ctx_t *snapshot_ctx, src_ticks_t const& ticks, report_raw_stats_t *stats)
 				{
-					for (auto const& data_pair : data)
+					for (auto const& tick_base : ticks)
 					{
-						auto const& row = data_pair.second.data;
+						if (!tick_base)
+							continue;
+
+						auto const& tick = static_cast<history_tick_t const&>(*tick_base);
 
-						totals->req_count  += row.req_count;
-						totals->hit_count  += row.hit_count;
-						totals->time_total += row.time_total;
-						totals->ru_utime   += row.ru_utime;
-						totals->ru_stime   += row.ru_stime;
+						stats->row_count += tick.row_count();
 					}
 				}
 
+				static void add_to_totals(totals_t *totals, data_t const& row)
+				{
+					totals->req_count  += row.req_count;
+					totals->hit_count  += row.hit_count;
+					totals->time_total += row.time_total;
+					totals->ru_utime   += row.ru_utime;
+					totals->ru_stime   += row.ru_stime;
+				}
+
+				static void calculate_totals(report_snapshot_ctx_t *snapshot_ctx, hashtable_t const& data, totals_t *totals)
+				{
+					add_to_totals(totals, data.filtered_out);
+
+					for (auto const& data_pair : data)
+						add_to_totals(totals, data_pair.second.data);
+				}
+
 				// merge from src ringbuffer to snapshot data
 				static void merge_ticks_into_data(
 					  report_snapshot_ctx_t *snapshot_ctx
 					, src_ticks_t& ticks
 					, hashtable_t& to
-					, report_snapshot_t::merge_flags_t flags)
+					, report_snapshot_t::merge_flags_t flags
+					, report_snapshot_partition_t const& part)
 				{
 					bool const need_histograms = (snapshot_ctx->rinfo.hv_enabled && (flags & report_snapshot_t::merge_flags::with_histograms));
 
-					// if we have result count estimate - try reserve the space in resulting hashtable
-					// this might get ugly, if we under-guess just slightly
-					// and face a giant rehash at the end of the merge
-					// but should save us some significant time on initial few rehashes
+					// unique row count from running aggregate or key sketches (see estimate_unique_rows()), with some headroom
+					// reserve once, instead of rehashing as we go (or a giant rehash at the end, if history guess was just slightly low)
 					if (snapshot_ctx->estimates.row_count > 0)
 					{
-						to.reserve(snapshot_ctx->estimates.row_count);
+						to.reserve(snapshot_ctx->estimates.row_count / part.count);
+					}
+
+					report_key_filter_t const& key_filter = snapshot_ctx->key_filter;
+					bool const need_filter = !key_filter.empty();
+
+					// fastpath: no histograms needed, just copy the running aggregate
+					// it is exactly equal to what merging all ticks would produce
+					// histograms can not be subtracted cheaply, so those still go through full tick merge below
+					if (!need_histograms && ticks.running)
+					{
+						running_hashtable_t const& running = *ticks.running;
+
+						to.reserve(running.size() / part.count);
+
+						for (auto it = running.begin(), it_end = running.end(); it != it_end; ++it)
+						{
+							if (!part.contains(it->second.key_hash))
+								continue;
+
+							if (need_filter && !key_filter.matches(it->first))
+							{
+								add_to_totals(&to.filtered_out, it->second.data);
+								continue;
+							}
+
+							auto inserted_pair = to.emplace_hash(it->second.key_hash, it->first, row_t{});
+							inserted_pair.first.value().data     = it->second.data;
+							inserted_pair.first.value().key_hash = it->second.key_hash;
+						}
+
+						LOG_DEBUG(snapshot_ctx->logger(), "prepare '{0}'; copied running aggregate, rows: {1}",
+							snapshot_ctx->rinfo.name, to.size());
+
+						// keep ticks for lazy histogram gathering, see below
+						if (snapshot_ctx->rinfo.hv_enabled)
+							to.lazy_hv_ticks = &ticks.ticks;
+						else if (part.count == 1)
+							ticks.clear();
+						return;
+					}
+
+					// partitioned history (see history_tick_t::part_offsets)
+					//  filter on partition key part - only partitions with filter words are scanned, others are filtered out as a whole
+					//  otherwise parallel merges take whole partitions each, instead of every one scanning all rows
+					uint32_t const n_hparts   = snapshot_ctx->rinfo.history_partitions;
+					uint32_t const hpart_key  = snapshot_ctx->rinfo.history_partition_key;
+					std::vector<uint8_t> hpart_wanted; // by history partition, empty = all rows are scanned
+					bool by_hpart = false;             // merge partition owns rows of hpart_wanted partitions, not by key hash
+
+					if (n_hparts > 0)
+					{
+						for (auto const& fpart : key_filter.parts)
+						{
+							if (fpart.key_index != hpart_key)
+								continue;
+
+							hpart_wanted.assign(n_hparts, 0);
+							for (uint32_t const word_id : fpart.word_ids)
+								hpart_wanted[history_partition_of(word_id, n_hparts)] = 1;
+							break;
+						}
+
+						if (hpart_wanted.empty() && (part.count > 1) && (n_hparts >= part.count))
+						{
+							by_hpart = true;
+
+							hpart_wanted.resize(n_hparts);
+							for (uint32_t p = 0; p < n_hparts; p++)
+								hpart_wanted[p] = ((p % part.count) == part.index);
+						}
 					}
 
 					uint64_t n_ticks = 0;
 					uint64_t key_lookups = 0;
 					uint64_t hv_appends = 0;
+					uint64_t hparts_skipped = 0;
 
 					for (auto const& tick_base : ticks)
 					{
@@ -841,12 +2330,24 @@ namespace { namespace aux {
 
 						n_ticks++;
 
-						for (size_t i = 0; i < tick.rows.size(); i++)
+						auto const row_owned = [&](history_row_ref_t const& src)
+						{
+							if (by_hpart)
+								return (hpart_wanted[history_partition_of(src.key[hpart_key], n_hparts)] != 0);
+							return part.contains(src.key_hash);
+						};
+
+						auto const merge_row = [&](history_row_ref_t const& src)
 						{
-							history_row_t const& src = tick.rows[i];
+							if (need_filter && !key_filter.matches(src.key))
+							{
+								add_to_totals(&to.filtered_out, src.data);
+								return;
+							}
 
 							auto inserted_pair = to.emplace_hash(src.key_hash, src.key, row_t{});
 							row_t&         dst = inserted_pair.first.value();
+							dst.key_hash = src.key_hash;
 
 							dst.data.req_count  += src.data.req_count;
 							dst.data.hit_count  += src.data.hit_count;
@@ -856,36 +2357,170 @@ namespace { namespace aux {
 
 							if (need_histograms)
 							{
-								flat_histogram_t const& src_hv = src.hv;
+								// rows are unpacked to a temporary, keep it alive with the snapshot
+								to.decoded_hvs.emplace_back(std::move(*src.hv));
 
-								// try preallocate
-								if (dst.saved_hv.empty())
-									dst.saved_hv.reserve(ticks.size());
+								// key is in every tick at most once, so ticks.size() is all the space we'll need
+								dst.saved_hv.push_back(to.scratch.nmpa(), ticks.size(), &to.decoded_hvs.back().values);
+							}
+						};
 
-								dst.saved_hv.push_back(&src_hv.values);
+						uint64_t n_scanned = 0;
+
+						if (hpart_wanted.empty() || tick.part_offsets.empty())
+						{
+							history_tick___for_each_row(tick, need_histograms, [&](history_row_ref_t const& src)
+							{
+								if (row_owned(src))
+									merge_row(src);
+							});
+							n_scanned = tick.row_count();
+						}
+						else
+						{
+							for (uint32_t p = 0; p < n_hparts; p++)
+							{
+								uint32_t const begin = tick.part_offsets[p];
+								uint32_t const end   = tick.part_offsets[p + 1];
+
+								if (!hpart_wanted[p])
+								{
+									// nothing matches the filter here, totals are added once (by the first merge partition)
+									if (!by_hpart && (part.index == 0))
+										add_to_totals(&to.filtered_out, tick.part_totals[p]);
+
+									hparts_skipped++;
+									continue;
+								}
+
+								// whole partition is ours when partitions are split between merges, key hash decides otherwise
+								history_tick___for_each_row_in(tick, begin, end, need_histograms, [&](history_row_ref_t const& src)
+								{
+									if (by_hpart || part.contains(src.key_hash))
+										merge_row(src);
+								});
+								n_scanned += (end - begin);
 							}
 						}
 
-						key_lookups += tick.rows.size();
+						key_lookups += n_scanned;
 
 						if (need_histograms)
-							hv_appends  += tick.rows.size();
+							hv_appends  += n_scanned;
 					}
 
-					LOG_DEBUG(snapshot_ctx->logger(), "prepare '{0}'; n_ticks: {1}, key_lookups: {2}, hv_appends: {3}",
-						snapshot_ctx->rinfo.name, n_ticks, key_lookups, hv_appends);
+					LOG_DEBUG(snapshot_ctx->logger(), "prepare '{0}'; n_ticks: {1}, key_lookups: {2}, hv_appends: {3}, history_partitions_skipped: {4}",
+						snapshot_ctx->rinfo.name, n_ticks, key_lookups, hv_appends, hparts_skipped);
 
-					// can clean ticks only if histograms were not merged
+					// can clean ticks only if histograms are disabled
 					// since histogram merger uses raw pointers to tick_data_t::hvs[]::values
 					// and those need to be alive while this snapshot is alive
-					if (!need_histograms)
+					// when histograms were not requested - they can still be gathered lazily from ticks
+					if (!need_histograms && snapshot_ctx->rinfo.hv_enabled)
+						to.lazy_hv_ticks = &ticks.ticks;
+
+					if (!snapshot_ctx->rinfo.hv_enabled && (part.count == 1))
 					{
 						ticks.clear();
-						ticks.shrink_to_fit();
 					}
 				}
 			};
 
+			// reads per tick rows straight from the ticks, see report_snapshot_t::get_series___by_timer()
+			struct snapshot_t : public report_snapshot__impl_t<snapshot_traits>
+			{
+				using base_t = report_snapshot__impl_t<snapshot_traits>;
+				using base_t::base_t;
+
+				virtual pinba_error_t get_series___by_timer(std::vector<report_series_row___by_timer_t> *result) override
+				{
+					if (this->prepared_)
+						return ff::fmt_err("series are read from ticks, snapshot must not be prepared");
+
+					snapshot_source_t const& src = this->ticks_;
+
+					report_key_filter_t const& key_filter = this->key_filter;
+					bool const need_filter = !key_filter.empty();
+
+					// every aggregator thread produces a fine tick per tick interval, rows of those are summed
+					uint32_t const n_threads = std::max<uint32_t>(1, this->rinfo.agg_threads);
+
+					uint32_t covered = 0;
+					for (uint32_t const width : src.widths)
+						covered += width;
+
+					uint32_t const n_intervals = (covered + n_threads - 1) / n_threads;
+
+					// rows of every key, oldest first
+					typename HashtableP::template map_t<key_t, uint32_t>  key_series;
+					std::vector<std::vector<report_series_row___by_timer_t>>  series;
+
+					uint32_t offset = 0; // fine ticks before the current one
+
+					for (size_t i = 0; i < src.ticks.size(); i++)
+					{
+						uint32_t const width          = src.widths[i];
+						uint32_t const interval_begin = offset / n_threads;
+						uint32_t const interval_width = std::max<uint32_t>(1, width / n_threads);
+						uint32_t const tick_ago       = (n_intervals > interval_begin + interval_width)
+															? n_intervals - interval_begin - interval_width
+															: 0;
+						offset += width;
+
+						if (!src.ticks[i])
+							continue;
+
+						auto const add_row = [&](key_t const& key, data_t const& data)
+						{
+							auto const inserted = key_series.emplace(key, (uint32_t)series.size());
+							if (inserted.second)
+								series.emplace_back();
+
+							auto& rows = series[inserted.first->second];
+
+							if (rows.empty() || (rows.back().tick_ago != tick_ago))
+							{
+								rows.emplace_back();
+								rows.back().key        = report_key_t { key };
+								rows.back().tick_ago   = tick_ago;
+								rows.back().tick_width = interval_width;
+							}
+
+							snapshot_traits::add_to_totals(&rows.back().data, data);
+						};
+
+						auto const& tick = static_cast<history_tick_t const&>(*src.ticks[i]);
+
+						// uncompressed ticks - scan key column only, data is touched for matching rows
+						if (!tick.is_compressed)
+						{
+							for (size_t row_i = 0; row_i < tick.keys.size(); row_i++)
+							{
+								if (need_filter && !key_filter.matches(tick.keys[row_i]))
+									continue;
+
+								add_row(tick.keys[row_i], tick.datas[row_i]);
+							}
+							continue;
+						}
+
+						history_tick___for_each_row(tick, false, [&](history_row_ref_t const& row)
+						{
+							if (need_filter && !key_filter.matches(row.key))
+								return;
+
+							add_row(row.key, row.data);
+						});
+					}
+
+					result->clear();
+					for (auto& rows : series)
+						result->insert(result->end(), rows.begin(), rows.end());
+
+					return {};
+				}
+			};
+
 			virtual report_snapshot_ptr get_snapshot() override
 			{
 				report_snapshot_ctx_t const sctx = {
@@ -893,21 +2528,118 @@ namespace { namespace aux {
 					.stats          = stats_,
 					.rinfo          = rinfo_,
 					.estimates      = this->get_estimates(),
+					.time_window_covered = report_history___covered_time(rinfo_, ring_.covered_ticks()),
+					.hv_conf        = hv_conf_,
+					.nmpa           = {}, // don't need this at the moment
+					.repacker_states = this->repacker_states(),
+				};
+
+				// publish running aggregate copy once per tick, all snapshots until the next tick share it
+				if (!running_published_)
+				{
+					running_published_ = std::make_shared<running_hashtable_t>(running_);
+					this->publish(); // selects coming after this one can skip report thread
+				}
+
+				return meow::make_unique<snapshot_t>(sctx, this->snapshot_source());
+			}
+
+			// any thread, only immutable members, atomics and published version are touched here
+			virtual report_snapshot_ptr get_published_snapshot() override
+			{
+				published_wanted_.store(true, std::memory_order_relaxed);
+
+				// versions without running aggregate would make every select merge all ticks
+				// get_snapshot() in report thread is no worse than that, and publishes running aggregate as well
+				auto const version = published_.current();
+				if (!version || !version->src.running)
+					return {};
+
+				report_snapshot_ctx_t const sctx = {
+					.globals        = globals_,
+					.stats          = stats_,
+					.rinfo          = rinfo_,
+					.estimates      = version->estimates,
+					.time_window_covered = version->time_window_covered,
 					.hv_conf        = hv_conf_,
-					.nmpa           = {} // don't need this at the moment
+					.nmpa           = {}, // don't need this at the moment
+					.repacker_states = version->repacker_states,
+				};
+
+				return meow::make_unique<snapshot_t>(sctx, version->src);
+			}
+
+		private:
+
+			snapshot_source_t snapshot_source()
+			{
+				snapshot_source_t src = {
+					.ticks   = ring_.get_ringbuffer(),
+					.running = running_published_,
+					.widths  = {},
 				};
 
-				using snapshot_t = report_snapshot__impl_t<snapshot_traits>;
-				return meow::make_unique<snapshot_t>(sctx, ring_.get_ringbuffer());
+				src.widths.reserve(src.ticks.size());
+				ring_.for_each_tick([&](report_tick_ptr const&, uint32_t width) { src.widths.push_back(width); });
+
+				return src;
+			}
+
+			// running aggregate is copied only if published snapshots have been taken since last publish()
+			// i.e. steady selects get it every tick, idle reports don't pay for a copy nobody reads
+			void publish()
+			{
+				if (!running_published_ && published_wanted_.exchange(false, std::memory_order_relaxed))
+					running_published_ = std::make_shared<running_hashtable_t>(running_);
+
+				auto version = std::make_shared<published_t::version_t>();
+				version->src                 = this->snapshot_source();
+				version->estimates           = this->get_estimates();
+				version->time_window_covered = report_history___covered_time(rinfo_, ring_.covered_ticks());
+				version->repacker_states     = this->repacker_states();
+
+				live_estimates_->store(version->estimates);
+				pinba_reclaim(globals_, published_.publish(std::move(version)));
+			}
+
+			// built once per ring change, shared by all snapshots until the next one
+			report_repacker_states_ptr repacker_states()
+			{
+				if (!repacker_states_)
+					repacker_states_ = report_repacker_states___from_ticks(ring_.get_ringbuffer());
+				return repacker_states_;
 			}
 
 		private:
 			pinba_globals_t              *globals_;
 			report_stats_t               *stats_;
+			report_thread_counters_t     *counters_;
 			report_info_t                rinfo_;
 			histogram_conf_t             hv_conf_;
+			bool                         compress_ticks_;
+
+			report_history_tiered_ringbuffer_t  ring_;
+			report_history_totals_t             totals_; // over ticks in ring_, see totals_add()
+
+			running_hashtable_t          running_;
+			running_ptr                  running_published_;
+
+			report_repacker_states_ptr   repacker_states_;  // of ticks in ring_, see repacker_states()
+
+			using published_t = report_history_publisher_t<snapshot_source_t>;
+			published_t                  published_;        // ring_ as of last merge_tick(), see get_published_snapshot()
+			std::atomic<bool>            published_wanted_ = {false}; // get_published_snapshot() has been called since last publish()
+
+			report_mem_budget_ptr        mem_budget_; // nullptr = no limits
+
+			uint64_t const               persist_signature_;
+			report_live_estimates_ptr    live_estimates_;   // shared with report, estimates of published_
 
-			report_history_ringbuffer_t  ring_;
+			remote_hashtable_t                     remote_rows_;   // from edges, waiting for the next tick, see federation_merge()
+			std::vector<report_persist_words_ptr>  remote_words_;  // words of remote_rows_
+			std::string                            federation_buf_;
+
+			std::vector<report_tick_subscription_ptr>  tick_subscriptions_; // see tick_publish()
 		};
 
 	public: // report_t
@@ -916,21 +2648,85 @@ namespace { namespace aux {
 			: globals_(globals)
 			, stats_(nullptr)
 			, conf_(conf)
+			, live_estimates_(std::make_shared<report_live_estimates_t>())
 		{
 			assert(conf_.keys.size() == NKeys);
 
 			rinfo_ = report_info_t {
-				.name            = conf_.name,
-				.kind            = REPORT_KIND__BY_TIMER_DATA,
-				.time_window     = conf_.time_window,
-				.tick_count      = conf_.tick_count,
-				.n_key_parts     = (uint32_t)conf_.keys.size(),
-				.hv_enabled      = (conf_.hv_bucket_count > 0),
-				.hv_kind         = HISTOGRAM_KIND__FLAT,
-				.hv_bucket_count = conf_.hv_bucket_count,
-				.hv_bucket_d     = conf_.hv_bucket_d,
-				.hv_min_value    = conf_.hv_min_value,
+				.name              = conf_.name,
+				.kind              = REPORT_KIND__BY_TIMER_DATA,
+				.time_window       = conf_.time_window,
+				.tick_count        = conf_.tick_count,
+				.agg_threads       = std::max<uint32_t>(1, conf_.agg_threads),
+				.n_key_parts       = (uint32_t)conf_.keys.size(),
+				.hv_enabled        = (conf_.hv_bucket_count > 0),
+				.hv_kind           = HISTOGRAM_KIND__FLAT,
+				.hv_bucket_count   = conf_.hv_bucket_count,
+				.hv_bucket_d       = conf_.hv_bucket_d,
+				.hv_min_value      = conf_.hv_min_value,
+				.hv_rel_accuracy   = conf_.hv_rel_accuracy,
+				.hv_summary_points = conf_.hv_summary_points,
+				.history_partitions    = conf_.history_partitions,
+				.history_partition_key = conf_.history_partition_key,
 			};
+
+			// same as aggregator_t::packet_bloom_, but for packet_prefilter_t
+			for (auto const& kd : conf_.keys)
+			{
+				if (RKD_TIMER_TAG == kd.kind)
+					packet_bloom_.add(kd.timer_tag);
+			}
+
+			for (auto const& ttf : conf_.timertag_filters)
+				packet_bloom_.add(ttf.name_id);
+
+			batch_filter_.timertag_bloom.merge(packet_bloom_);
+			batch_filter_.add_filters(conf_.filters);
+
+			std::atomic<uint32_t> const *governor_stage = mem_governor___is_enabled(globals_) ? &globals_->stats()->mem_governor.stage : nullptr;
+			mem_budget_ = std::make_shared<report_mem_budget_t>(conf_.max_mem, globals_->options()->report_max_mem_total, &globals_->stats()->reports.mem_used, governor_stage);
+
+			agg_signature_ = this->make_agg_signature();
+		}
+
+		// everything aggregator_t output depends on, history-only stuff (window, tick_count, storage, rollups) is not here
+		std::string make_agg_signature() const
+		{
+			// own memory budget makes aggregator drop keys based on own history size, can't share that
+			if (conf_.max_mem > 0)
+				return {};
+
+			std::string result = ff::fmt_str("timer/{0}/{1}/{2}:{3}/{4}/{5}/{6}/{7}/{8}",
+				conf_.hashtable_kind, conf_.topk_size, conf_.topk_metric,
+				conf_.hv_bucket_count, conf_.hv_bucket_d.nsec, conf_.hv_min_value.nsec, conf_.hv_rel_accuracy,
+				conf_.keys.size(), conf_.data_skip);
+
+			for (auto const& kd : conf_.keys)
+				ff::fmt(result, "|k:{0}", kd.name);
+
+			packet_t const dummy = {}; // to get field offsets out of pointers to members
+
+			for (auto const& fd : conf_.filters)
+			{
+				// filter function alone might do anything
+				if (fd.op.opcode == PACKET_FILTER_OP__CALL)
+					return {};
+
+				ptrdiff_t const field_off = ((fd.op.opcode == PACKET_FILTER_OP__FIELD_EQ) || (fd.op.opcode == PACKET_FILTER_OP__FIELD_IN))
+						? (reinterpret_cast<char const*>(&(dummy.*fd.op.field)) - reinterpret_cast<char const*>(&dummy))
+						: 0;
+
+				ff::fmt(result, "|f:{0}/{1}/{2}/{3}/{4}", fd.op.opcode, field_off, fd.op.name_id, fd.op.value_id, fd.op.time.nsec);
+
+				// word set spec has ids and patterns of the set, the only way to compare them
+				if (fd.op.word_set)
+					ff::fmt(result, "/{0}", fd.op.word_set->spec);
+			}
+
+			for (auto const& ttf : conf_.timertag_filters)
+				ff::fmt(result, "|t:{0}", ttf.name);
+
+			return result;
 		}
 
 		virtual str_ref name() const override
@@ -945,12 +2741,32 @@ namespace { namespace aux {
 
 		virtual report_agg_ptr create_aggregator() override
 		{
-			return std::make_shared<aggregator_t>(globals_, conf_, rinfo_);
+			return std::make_shared<aggregator_t>(globals_, conf_, rinfo_, mem_budget_);
 		}
 
 		virtual report_history_ptr create_history() override
 		{
-			return std::make_shared<history_t>(globals_, rinfo_);
+			return std::make_shared<history_t>(globals_, rinfo_, conf_, mem_budget_, live_estimates_);
+		}
+
+		virtual timertag_bloom_t const* packet_bloom() const override
+		{
+			return &packet_bloom_;
+		}
+
+		virtual packet_batch_filter_t const* batch_filter() const override
+		{
+			return &batch_filter_;
+		}
+
+		virtual std::string const& agg_signature() const override
+		{
+			return agg_signature_;
+		}
+
+		virtual report_live_estimates_ptr live_estimates() const override
+		{
+			return live_estimates_;
 		}
 
 	private:
@@ -959,8 +2775,23 @@ namespace { namespace aux {
 		report_info_t             rinfo_;
 
 		report_conf___by_timer_t  conf_;
+		timertag_bloom_t          packet_bloom_;
+		packet_batch_filter_t     batch_filter_;
+
+		report_mem_budget_ptr     mem_budget_;
+		std::string               agg_signature_;
+		report_live_estimates_ptr live_estimates_;  // shared with history
 	};
 
+	template<size_t NKeys>
+	inline report_ptr create_report___by_timer_n(pinba_globals_t *globals, report_conf___by_timer_t const& conf)
+	{
+		if (conf.hashtable_kind == REPORT_HASHTABLE__SWISS_MAP)
+			return std::make_shared<report___by_timer_t<NKeys, report_hashtable___swiss_map_t>>(globals, conf);
+
+		return std::make_shared<report___by_timer_t<NKeys, report_hashtable___robin_map_t>>(globals, conf);
+	}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 }} // namespace { namespace aux {
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -978,7 +2809,7 @@ report_ptr create_report_by_timer(pinba_globals_t *globals, report_conf___by_tim
 			throw std::logic_error(ff::fmt_str("report_by_timer supports up to {0} keys, {1} given", max_keys, n_keys));
 
 	#define CASE(z, N, unused) \
-		case N: return std::make_shared<aux::report___by_timer_t<N>>(globals, conf); \
+		case N: return aux::create_report___by_timer_n<N>(globals, conf); \
 	/**/
 
 	BOOST_PP_REPEAT_FROM_TO(1, BOOST_PP_ADD(PINBA_LIMIT___MAX_KEY_PARTS, 1), CASE, 0);
@@ -0,0 +1,436 @@
+#include "pinba_config.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <meow/defer.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/os_symbols.h"
+#include "pinba/report_executor.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct report_strand_t : public std::enable_shared_from_this<report_strand_t>
+{
+	std::mutex                              mtx;
+	std::condition_variable                 cv;                 // pause() waits here for the running task to finish
+	std::deque<report_executor_t::task_t>   tasks;
+	bool                                    scheduled = false;  // in some worker deque or running, never in two places at once
+	bool                                    running   = false;
+	bool                                    paused    = false;
+
+	std::atomic<uint64_t>                   cpu_time_ns = {0};
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct report_executor_impl_t : public report_executor_t
+	{
+		static constexpr size_t max_tasks_per_run = 16; // then let other strands queued on the same worker run
+
+		using steady_clock_t = std::chrono::steady_clock;
+
+		struct worker_t
+		{
+			std::mutex                     mtx;
+			std::deque<report_strand_ptr>  strands;  // owner takes from the back, thieves from the front
+			std::thread                    t;
+		};
+		using worker_ptr = std::unique_ptr<worker_t>;
+
+		struct strand_timer_t
+		{
+			report_strand_ptr   strand;
+			duration_t          interval;
+			timer_func_t        func;
+			std::atomic<bool>   pending = {false}; // posted, but hasn't run yet
+		};
+		using timer_ptr = std::shared_ptr<strand_timer_t>;
+
+		// worker thread this code is running in, to schedule strands to the same worker
+		static thread_local report_executor_impl_t *tls_executor_;
+		static thread_local uint32_t                tls_worker_id_;
+
+	public:
+
+		report_executor_impl_t(pinba_globals_t *globals, report_executor_conf_t const& conf)
+			: globals_(globals)
+			, conf_(conf)
+			, n_queued_(0)
+			, next_worker_(0)
+			, in_shutdown_(false)
+			, next_timer_id_(1)
+		{
+			if (conf_.n_threads == 0)
+				throw std::logic_error(ff::fmt_str("report_executor '{0}': n_threads must be > 0", conf_.name));
+
+			workers_.reserve(conf_.n_threads);
+			for (uint32_t i = 0; i < conf_.n_threads; i++)
+				workers_.emplace_back(meow::make_unique<worker_t>());
+
+			for (uint32_t i = 0; i < conf_.n_threads; i++)
+				workers_[i]->t = std::thread([this, i]() { this->worker_thread(i); });
+
+			timer_thread_ = std::thread([this]() { this->timer_thread(); });
+		}
+
+		virtual ~report_executor_impl_t()
+		{
+			{
+				std::lock_guard<std::mutex> lk_(timers_mtx_);
+				std::lock_guard<std::mutex> idle_lk_(idle_mtx_);
+				in_shutdown_ = true;
+			}
+			timers_cv_.notify_all();
+			idle_cv_.notify_all();
+
+			timer_thread_.join();
+
+			for (auto& w : workers_)
+				w->t.join();
+		}
+
+		virtual uint32_t thread_count() const override
+		{
+			return conf_.n_threads;
+		}
+
+		virtual report_strand_ptr create_strand() override
+		{
+			return std::make_shared<report_strand_t>();
+		}
+
+		virtual void post(report_strand_t *s, task_t task) override
+		{
+			bool need_schedule = false;
+			{
+				std::lock_guard<std::mutex> lk_(s->mtx);
+				s->tasks.push_back(std::move(task));
+
+				if (!s->scheduled && !s->paused)
+				{
+					s->scheduled  = true;
+					need_schedule = true;
+				}
+			}
+
+			if (need_schedule)
+				this->schedule(s->shared_from_this(), false);
+		}
+
+		virtual timer_id_t add_timer(report_strand_t *s, duration_t interval, timer_func_t func) override
+		{
+			auto t = std::make_shared<strand_timer_t>();
+			t->strand   = s->shared_from_this();
+			t->interval = interval;
+			t->func     = std::move(func);
+
+			std::lock_guard<std::mutex> lk_(timers_mtx_);
+
+			timer_id_t const id = next_timer_id_++;
+			timers_.emplace(id, t);
+			timer_queue_.emplace(steady_clock_t::now() + std::chrono::nanoseconds(interval.nsec), id);
+
+			timers_cv_.notify_all(); // might be the nearest one
+			return id;
+		}
+
+		virtual void cancel_timer(timer_id_t id) override
+		{
+			std::lock_guard<std::mutex> lk_(timers_mtx_);
+			timers_.erase(id); // queue entry is skipped when it's due
+		}
+
+		virtual void pause(report_strand_t *s) override
+		{
+			assert((tls_executor_ != this) && "can't pause strands from worker threads");
+
+			std::unique_lock<std::mutex> lk_(s->mtx);
+			s->paused = true;
+			s->cv.wait(lk_, [s]() { return !s->running; });
+		}
+
+		virtual void resume(report_strand_t *s) override
+		{
+			bool need_schedule = false;
+			{
+				std::lock_guard<std::mutex> lk_(s->mtx);
+				s->paused = false;
+
+				if (!s->scheduled && !s->tasks.empty())
+				{
+					s->scheduled  = true;
+					need_schedule = true;
+				}
+			}
+
+			if (need_schedule)
+				this->schedule(s->shared_from_this(), false);
+		}
+
+		virtual void clear(report_strand_t *s) override
+		{
+			std::deque<task_t> tasks;
+			{
+				std::lock_guard<std::mutex> lk_(s->mtx);
+				assert(s->paused && "strand must be paused to be cleared");
+
+				std::swap(tasks, s->tasks);
+			}
+			// destroy captures (batches and such) without holding the lock
+		}
+
+		virtual duration_t cpu_time(report_strand_t const *s) const override
+		{
+			return duration_t { (int64_t)s->cpu_time_ns.load(std::memory_order_relaxed) };
+		}
+
+	private:
+
+		// to_front = strand has just had its turn, let others run first (and let idle workers steal it)
+		void schedule(report_strand_ptr s, bool to_front)
+		{
+			uint32_t const worker_id = (tls_executor_ == this)
+					? tls_worker_id_
+					: (next_worker_.fetch_add(1, std::memory_order_relaxed) % conf_.n_threads);
+
+			worker_t *w = workers_[worker_id].get();
+			{
+				std::lock_guard<std::mutex> lk_(w->mtx);
+
+				if (to_front)
+					w->strands.push_front(std::move(s));
+				else
+					w->strands.push_back(std::move(s));
+			}
+
+			{
+				std::lock_guard<std::mutex> lk_(idle_mtx_);
+				n_queued_++;
+			}
+			idle_cv_.notify_one();
+		}
+
+		report_strand_ptr take(uint32_t worker_id)
+		{
+			// own deque first, newest strand is the most likely to be in cache
+			{
+				worker_t *w = workers_[worker_id].get();
+				std::lock_guard<std::mutex> lk_(w->mtx);
+
+				if (!w->strands.empty())
+				{
+					report_strand_ptr s = std::move(w->strands.back());
+					w->strands.pop_back();
+					n_queued_--;
+					return s;
+				}
+			}
+
+			// steal the oldest one from somebody else
+			for (uint32_t i = 1; i < conf_.n_threads; i++)
+			{
+				worker_t *w = workers_[(worker_id + i) % conf_.n_threads].get();
+				std::lock_guard<std::mutex> lk_(w->mtx);
+
+				if (!w->strands.empty())
+				{
+					report_strand_ptr s = std::move(w->strands.front());
+					w->strands.pop_front();
+					n_queued_--;
+					return s;
+				}
+			}
+
+			return {};
+		}
+
+		void run_strand(report_strand_ptr const& s)
+		{
+			{
+				std::lock_guard<std::mutex> lk_(s->mtx);
+
+				// paused while waiting in the deque, resume() will schedule it again
+				if (s->paused || s->tasks.empty())
+				{
+					s->scheduled = false;
+					return;
+				}
+
+				s->running = true;
+			}
+
+			timeval_t const cpu_start = os_unix::clock_gettime_ex(CLOCK_THREAD_CPUTIME_ID);
+
+			for (size_t i = 0; i < max_tasks_per_run; i++)
+			{
+				task_t task;
+				{
+					std::lock_guard<std::mutex> lk_(s->mtx);
+
+					if (s->paused || s->tasks.empty())
+						break;
+
+					task = std::move(s->tasks.front());
+					s->tasks.pop_front();
+				}
+
+				task();
+			}
+
+			timeval_t const cpu_end = os_unix::clock_gettime_ex(CLOCK_THREAD_CPUTIME_ID);
+			s->cpu_time_ns.fetch_add(duration_from_timeval(cpu_end - cpu_start).nsec, std::memory_order_relaxed);
+
+			bool need_schedule = false;
+			{
+				std::lock_guard<std::mutex> lk_(s->mtx);
+				s->running = false;
+
+				if (s->paused)
+				{
+					s->scheduled = false;
+					s->cv.notify_all();
+				}
+				else if (!s->tasks.empty())
+				{
+					need_schedule = true; // stays scheduled
+				}
+				else
+				{
+					s->scheduled = false;
+				}
+			}
+
+			if (need_schedule)
+				this->schedule(s, true);
+		}
+
+		void worker_thread(uint32_t worker_id)
+		{
+			std::string const thr_name = ff::fmt_str("{0}/{1}", conf_.name, worker_id);
+
+			PINBA___OS_CALL(globals_, set_thread_name, thr_name);
+			pinba_set_thread_cpus(globals_, conf_.cpus, thr_name);
+			pinba_set_thread_sched(globals_, conf_.sched, thr_name);
+
+			MEOW_DEFER(
+				LOG_DEBUG(globals_->logger(), "{0}; exiting", thr_name);
+			);
+
+			tls_executor_  = this;
+			tls_worker_id_ = worker_id;
+
+			while (true)
+			{
+				report_strand_ptr s = this->take(worker_id);
+				if (s)
+				{
+					this->run_strand(s);
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lk_(idle_mtx_);
+				idle_cv_.wait(lk_, [this]() { return in_shutdown_ || (n_queued_ > 0); });
+
+				// all strands are gone by now, whatever is left in the deques is dropped
+				if (in_shutdown_)
+					return;
+			}
+		}
+
+		void timer_thread()
+		{
+			std::string const thr_name = ff::fmt_str("{0}/timer", conf_.name);
+
+			PINBA___OS_CALL(globals_, set_thread_name, thr_name);
+
+			MEOW_DEFER(
+				LOG_DEBUG(globals_->logger(), "{0}; exiting", thr_name);
+			);
+
+			std::unique_lock<std::mutex> lk_(timers_mtx_);
+
+			while (!in_shutdown_)
+			{
+				if (timer_queue_.empty())
+				{
+					timers_cv_.wait(lk_);
+					continue;
+				}
+
+				auto const now = steady_clock_t::now();
+				auto const due = timer_queue_.begin()->first;
+
+				if (now < due)
+				{
+					timers_cv_.wait_until(lk_, due);
+					continue;
+				}
+
+				timer_id_t const id = timer_queue_.begin()->second;
+				timer_queue_.erase(timer_queue_.begin());
+
+				auto const it = timers_.find(id);
+				if (it == timers_.end()) // cancelled
+					continue;
+
+				timer_ptr const& t = it->second;
+
+				if (!t->pending.exchange(true))
+				{
+					this->post(t->strand.get(), [t]()
+					{
+						t->pending = false;
+						t->func(os_unix::clock_monotonic_now());
+					});
+				}
+
+				// keep the schedule, unless we've fallen behind by more than an interval
+				auto const interval = std::chrono::nanoseconds(t->interval.nsec);
+				auto const next     = ((due + interval) > now) ? (due + interval) : (now + interval);
+				timer_queue_.emplace(next, id);
+			}
+		}
+
+	private:
+		pinba_globals_t           *globals_;
+		report_executor_conf_t    conf_;
+
+		std::vector<worker_ptr>   workers_;
+
+		std::mutex                idle_mtx_;
+		std::condition_variable   idle_cv_;
+		std::atomic<int64_t>      n_queued_;    // strands in all worker deques, incremented under idle_mtx_ (might dip below 0 briefly)
+		std::atomic<uint32_t>     next_worker_; // round robin, for strands scheduled from outside
+		bool                      in_shutdown_; // under both idle_mtx_ and timers_mtx_
+
+		std::mutex                timers_mtx_;
+		std::condition_variable   timers_cv_;
+		std::unordered_map<timer_id_t, timer_ptr>     timers_;
+		std::multimap<steady_clock_t::time_point, timer_id_t> timer_queue_;
+		timer_id_t                next_timer_id_;
+
+		std::thread               timer_thread_;
+	};
+
+	thread_local report_executor_impl_t *report_executor_impl_t::tls_executor_  = nullptr;
+	thread_local uint32_t                report_executor_impl_t::tls_worker_id_ = 0;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+report_executor_ptr create_report_executor(pinba_globals_t *globals, report_executor_conf_t const& conf)
+{
+	return meow::make_unique<aux::report_executor_impl_t>(globals, conf);
+}
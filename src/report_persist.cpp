@@ -0,0 +1,534 @@
+#include "pinba_config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <meow/defer.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+#include <meow/unix/time.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/dictionary.h"
+#include "pinba/hash.h"
+#include "pinba/report.h"
+#include "pinba/report_persist.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+report_persist_words_t::~report_persist_words_t()
+{
+	if (dictionary && !word_ids.empty())
+		dictionary->erase_words___ref(word_ids.data(), word_ids.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct report_persist_writer_t::impl_t
+{
+	pinba_globals_t               *globals;
+	report_persist_header_t       header;
+
+	std::string                   ticks;    // serialized ticks section
+	std::unordered_set<uint32_t>  word_ids; // all words referenced from keys
+
+	template<class T>
+	void put(T const& value)
+	{
+		ticks.append((char const*)&value, sizeof(value));
+	}
+};
+
+report_persist_writer_t::report_persist_writer_t(pinba_globals_t *globals, report_info_t const& rinfo, uint32_t n_data_fields, uint64_t signature)
+	: impl_(meow::make_unique<impl_t>())
+{
+	impl_->globals = globals;
+
+	report_persist_header_t& h = impl_->header;
+	h = {};
+	h.magic           = PINBA_PERSIST_MAGIC;
+	h.version         = PINBA_PERSIST_VERSION;
+	h.kind            = rinfo.kind;
+	h.n_key_parts     = rinfo.n_key_parts;
+	h.n_data_fields   = n_data_fields;
+	h.hv_enabled      = rinfo.hv_enabled;
+	h.hv_bucket_count = rinfo.hv_bucket_count;
+	h.hv_bucket_d     = rinfo.hv_bucket_d.nsec;
+	h.hv_min_value    = rinfo.hv_min_value.nsec;
+	h.hv_rel_accuracy = rinfo.hv_rel_accuracy;
+	h.signature       = signature;
+	h.tick_d          = rinfo.time_window.nsec / rinfo.tick_count;
+	h.agg_threads     = rinfo.agg_threads;
+}
+
+report_persist_writer_t::~report_persist_writer_t()
+{
+}
+
+void report_persist_writer_t::tick_begin(uint32_t width, uint32_t n_rows)
+{
+	impl_->put(width);
+	impl_->put(n_rows);
+	impl_->header.n_ticks++;
+}
+
+void report_persist_writer_t::row(uint32_t const *key, uint64_t const *data, flat_histogram_t const *hv)
+{
+	report_persist_header_t const& h = impl_->header;
+
+	for (uint32_t i = 0; i < h.n_key_parts; i++)
+	{
+		impl_->put(key[i]);
+
+		if (key[i] != 0)
+			impl_->word_ids.insert(key[i]);
+	}
+
+	for (uint32_t i = 0; i < h.n_data_fields; i++)
+		impl_->put(data[i]);
+
+	if (!h.hv_enabled)
+		return;
+
+	static flat_histogram_t const empty_hv = {};
+	flat_histogram_t const& v = (hv) ? *hv : empty_hv;
+
+	impl_->put(v.total_count);
+	impl_->put(v.negative_inf);
+	impl_->put(v.positive_inf);
+	impl_->put(uint32_t(v.values.size()));
+	impl_->ticks.append((char const*)v.values.data(), v.values.size() * sizeof(*v.values.begin()));
+}
+
+void report_persist_writer_t::write_to_string(std::string *result)
+{
+	report_persist_header_t& h = impl_->header;
+
+	h.n_words  = impl_->word_ids.size();
+	h.saved_at = duration_from_timeval(os_unix::clock_gettime_ex(CLOCK_REALTIME)).nsec;
+
+	std::string& out = *result;
+	out.clear();
+	out.reserve(sizeof(h) + impl_->word_ids.size() * 32 + impl_->ticks.size() + sizeof(uint64_t));
+	out.append((char const*)&h, sizeof(h));
+
+	// ticks hold references to all these words, so get_word() is safe here
+	dictionary_t *d = impl_->globals->dictionary();
+
+	for (uint32_t const word_id : impl_->word_ids)
+	{
+		str_ref const word = d->get_word(word_id);
+		uint32_t const len = word.size();
+
+		out.append((char const*)&word_id, sizeof(word_id));
+		out.append((char const*)&len, sizeof(len));
+		out.append(word.data(), word.size());
+	}
+
+	out.append(impl_->ticks);
+
+	uint64_t const checksum = t1ha0(out.data(), out.size(), 0);
+	out.append((char const*)&checksum, sizeof(checksum));
+}
+
+pinba_error_t report_persist_writer_t::write_to_file(std::string const& path)
+{
+	std::string out;
+	this->write_to_string(&out);
+
+	// write + rename, so that readers never see partial files
+	std::string const tmp_path = path + ".tmp";
+
+	int const fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return ff::fmt_err("open({0}) failed: {1}:{2}", tmp_path, errno, strerror(errno));
+
+	bool unlink_tmp = true;
+	MEOW_DEFER(
+		if (unlink_tmp)
+			unlink(tmp_path.c_str());
+	);
+
+	{
+		MEOW_DEFER(
+			close(fd);
+		);
+
+		size_t written = 0;
+		while (written < out.size())
+		{
+			ssize_t const n = ::write(fd, out.data() + written, out.size() - written);
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				return ff::fmt_err("write({0}) failed: {1}:{2}", tmp_path, errno, strerror(errno));
+			}
+			written += n;
+		}
+
+		if (fsync(fd) < 0)
+			return ff::fmt_err("fsync({0}) failed: {1}:{2}", tmp_path, errno, strerror(errno));
+	}
+
+	if (rename(tmp_path.c_str(), path.c_str()) < 0)
+		return ff::fmt_err("rename({0}, {1}) failed: {2}:{3}", tmp_path, path, errno, strerror(errno));
+
+	unlink_tmp = false;
+	return {};
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct report_persist_reader_t::impl_t
+{
+	pinba_globals_t                         *globals   = nullptr;
+
+	void                                    *map_ptr   = MAP_FAILED;
+	size_t                                  map_size   = 0;
+	std::string                             buffer;               // open_buffer() data, when not mapped
+
+	report_persist_header_t                 header     = {};
+	uint8_t const                           *cursor    = nullptr;
+	uint8_t const                           *end       = nullptr; // checksum starts here
+
+	uint32_t                                ticks_left = 0;
+	uint32_t                                rows_left  = 0;
+
+	std::unordered_map<uint32_t, uint32_t>  word_remap;         // file word_id -> our word_id
+	report_persist_words_ptr                words;
+
+	pinba_error_t                           err;
+
+	~impl_t()
+	{
+		if (map_ptr != MAP_FAILED)
+			munmap(map_ptr, map_size);
+	}
+
+	bool take(void *dst, size_t sz)
+	{
+		if ((size_t)(end - cursor) < sz)
+		{
+			err = ff::fmt_err("history data is truncated");
+			return false;
+		}
+
+		memcpy(dst, cursor, sz);
+		cursor += sz;
+		return true;
+	}
+
+	template<class T>
+	bool take(T *value)
+	{
+		return this->take(value, sizeof(*value));
+	}
+};
+
+report_persist_reader_t::report_persist_reader_t(pinba_globals_t *globals)
+	: impl_(meow::make_unique<impl_t>())
+{
+	impl_->globals = globals;
+}
+
+report_persist_reader_t::~report_persist_reader_t()
+{
+}
+
+pinba_error_t report_persist_reader_t::open(std::string const& path)
+{
+	impl_t *r = impl_.get();
+
+	int const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return ff::fmt_err("open({0}) failed: {1}:{2}", path, errno, strerror(errno));
+
+	MEOW_DEFER(
+		close(fd);
+	);
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		return ff::fmt_err("fstat({0}) failed: {1}:{2}", path, errno, strerror(errno));
+
+	if ((size_t)st.st_size < sizeof(report_persist_header_t) + sizeof(uint64_t))
+		return ff::fmt_err("{0}: file is too short: {1}", path, st.st_size);
+
+	r->map_size = st.st_size;
+	r->map_ptr  = mmap(NULL, r->map_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	if (r->map_ptr == MAP_FAILED)
+		return ff::fmt_err("mmap({0}) failed: {1}:{2}", path, errno, strerror(errno));
+
+	madvise(r->map_ptr, r->map_size, MADV_SEQUENTIAL);
+
+	if (auto const err = this->parse((uint8_t const*)r->map_ptr, r->map_size))
+		return ff::fmt_err("{0}: {1}", path, err.what());
+
+	return {};
+}
+
+pinba_error_t report_persist_reader_t::open_buffer(std::string data)
+{
+	impl_t *r = impl_.get();
+
+	if (data.size() < sizeof(report_persist_header_t) + sizeof(uint64_t))
+		return ff::fmt_err("data is too short: {0}", data.size());
+
+	r->buffer = std::move(data);
+	return this->parse((uint8_t const*)r->buffer.data(), r->buffer.size());
+}
+
+pinba_error_t report_persist_reader_t::parse(uint8_t const *begin, size_t size)
+{
+	impl_t *r = impl_.get();
+
+	r->cursor = begin;
+	r->end    = begin + size - sizeof(uint64_t);
+
+	uint64_t checksum;
+	memcpy(&checksum, r->end, sizeof(checksum));
+
+	if (checksum != t1ha0(begin, r->end - begin, 0))
+		return ff::fmt_err("checksum mismatch");
+
+	r->take(&r->header);
+
+	report_persist_header_t const& h = r->header;
+
+	if (h.magic != PINBA_PERSIST_MAGIC)
+		return ff::fmt_err("bad magic {0}", h.magic);
+
+	if (h.version != PINBA_PERSIST_VERSION)
+		return ff::fmt_err("unsupported version {0}, expected {1}", h.version, PINBA_PERSIST_VERSION);
+
+	// remap words, dictionary refs are held until all loaded ticks are gone
+	dictionary_t *d = r->globals->dictionary();
+
+	r->words = std::make_shared<report_persist_words_t>();
+	r->words->dictionary = d;
+	r->words->word_ids.reserve(h.n_words);
+	r->word_remap.reserve(h.n_words);
+
+	for (uint32_t i = 0; i < h.n_words; i++)
+	{
+		uint32_t word_id, len;
+		if (!r->take(&word_id) || !r->take(&len))
+			return r->err;
+
+		if ((size_t)(r->end - r->cursor) < len)
+			return ff::fmt_err("history data is truncated");
+
+		str_ref const word { (char const*)r->cursor, len };
+		r->cursor += len;
+
+		// permanent words (report names, permanent field values) must stay in permanent dictionary, where their ids come from
+		// integer words are not in any dictionary, their ids are the values
+		uint32_t new_id;
+		if (dictionary_int_words_t::is_int_id(word_id))
+		{
+			new_id = word_id;
+		}
+		else if (word_id & permanent_dictionary_t::id_bit)
+		{
+			new_id = d->add_nameword(word).id;
+		}
+		else
+		{
+			new_id = d->get_or_add___ref(word)->id;
+			r->words->word_ids.push_back(new_id);
+		}
+
+		r->word_remap.emplace(word_id, new_id);
+	}
+
+	r->ticks_left = h.n_ticks;
+	return {};
+}
+
+pinba_error_t report_persist_reader_t::validate(report_info_t const& rinfo, uint32_t n_data_fields, uint64_t signature) const
+{
+	report_persist_header_t const& h = impl_->header;
+
+	if ((int)h.kind != rinfo.kind)
+		return ff::fmt_err("report kind mismatch, file: {0}, report: {1}", h.kind, rinfo.kind);
+
+	if (h.n_key_parts != rinfo.n_key_parts || h.n_data_fields != n_data_fields)
+		return ff::fmt_err("row layout mismatch, file: {0} keys + {1} fields, report: {2} keys + {3} fields",
+			h.n_key_parts, h.n_data_fields, rinfo.n_key_parts, n_data_fields);
+
+	bool const hv_same = (h.hv_enabled == (uint32_t)rinfo.hv_enabled)
+					&& (!h.hv_enabled || ((h.hv_bucket_count == rinfo.hv_bucket_count)
+										&& (h.hv_bucket_d == rinfo.hv_bucket_d.nsec)
+										&& (h.hv_min_value == rinfo.hv_min_value.nsec)
+										&& (h.hv_rel_accuracy == rinfo.hv_rel_accuracy)));
+	if (!hv_same)
+		return ff::fmt_err("histogram config mismatch");
+
+	if ((h.tick_d != rinfo.time_window.nsec / rinfo.tick_count) || (h.agg_threads != rinfo.agg_threads))
+		return ff::fmt_err("tick interval or agg_threads mismatch");
+
+	if (h.signature != signature)
+		return ff::fmt_err("report config signature mismatch, file: {0}, report: {1}", h.signature, signature);
+
+	return {};
+}
+
+report_persist_header_t const& report_persist_reader_t::header() const
+{
+	return impl_->header;
+}
+
+bool report_persist_reader_t::next_tick(uint32_t *width, uint32_t *n_rows)
+{
+	impl_t *r = impl_.get();
+
+	if (r->err || r->ticks_left == 0)
+		return false;
+
+	// skip whatever is left in the previous tick
+	while (r->rows_left > 0)
+	{
+		if (!this->next_row(nullptr, nullptr, nullptr))
+			return false;
+	}
+
+	if (!r->take(width) || !r->take(n_rows))
+		return false;
+
+	r->ticks_left -= 1;
+	r->rows_left   = *n_rows;
+	return true;
+}
+
+bool report_persist_reader_t::next_row(uint32_t *key, uint64_t *data, flat_histogram_t *hv)
+{
+	impl_t *r = impl_.get();
+	report_persist_header_t const& h = r->header;
+
+	if (r->err || r->rows_left == 0)
+		return false;
+
+	for (uint32_t i = 0; i < h.n_key_parts; i++)
+	{
+		uint32_t word_id;
+		if (!r->take(&word_id))
+			return false;
+
+		if (!key)
+			continue;
+
+		if (word_id == 0)
+		{
+			key[i] = 0;
+			continue;
+		}
+
+		auto const it = r->word_remap.find(word_id);
+		if (it == r->word_remap.end())
+		{
+			r->err = ff::fmt_err("word_id {0} is not in string table", word_id);
+			return false;
+		}
+		key[i] = it->second;
+	}
+
+	size_t const data_sz = h.n_data_fields * sizeof(uint64_t);
+	if (data)
+	{
+		if (!r->take(data, data_sz))
+			return false;
+	}
+	else
+	{
+		if ((size_t)(r->end - r->cursor) < data_sz)
+			return r->take(nullptr, data_sz); // sets error
+		r->cursor += data_sz;
+	}
+
+	if (h.hv_enabled)
+	{
+		flat_histogram_t tmp_hv;
+		flat_histogram_t& v = (hv) ? *hv : tmp_hv;
+
+		uint32_t n_values;
+		if (!r->take(&v.total_count) || !r->take(&v.negative_inf) || !r->take(&v.positive_inf) || !r->take(&n_values))
+			return false;
+
+		size_t const values_sz = n_values * sizeof(histogram_value_t);
+		if ((size_t)(r->end - r->cursor) < values_sz)
+			return r->take(nullptr, values_sz); // sets error
+
+		if (hv)
+		{
+			v.values.resize(n_values);
+			memcpy(v.values.data(), r->cursor, values_sz);
+		}
+		r->cursor += values_sz;
+	}
+
+	r->rows_left -= 1;
+	return true;
+}
+
+pinba_error_t const& report_persist_reader_t::error() const
+{
+	return impl_->err;
+}
+
+report_persist_words_ptr const& report_persist_reader_t::words() const
+{
+	return impl_->words;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::string report_persist___file_path(std::string const& history_dir, str_ref report_name, str_ref extension)
+{
+	std::string result = history_dir;
+	if (!result.empty() && result.back() != '/')
+		result += '/';
+
+	for (char const c : report_name)
+	{
+		bool const safe = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.';
+
+		if (safe)
+		{
+			result += c;
+			continue;
+		}
+
+		char buf[4];
+		snprintf(buf, sizeof(buf), "%%%02X", (unsigned char)c);
+		result += buf;
+	}
+
+	result.append(extension.data(), extension.size());
+	return result;
+}
+
+uint32_t report_persist___ticks_to_skip(report_persist_header_t const& h, uint32_t max_ticks, uint32_t covered_ticks)
+{
+	int64_t const now_ns = duration_from_timeval(os_unix::clock_gettime_ex(CLOCK_REALTIME)).nsec;
+
+	// clock went back, assume no time has passed
+	uint64_t const missed_intervals = (now_ns > h.saved_at && h.tick_d > 0) ? uint64_t(now_ns - h.saved_at) / h.tick_d : 0;
+	uint64_t const missed_ticks     = missed_intervals * std::max<uint32_t>(1, h.agg_threads); // every aggregator thread produces a tick
+
+	uint64_t const keep = (missed_ticks < max_ticks) ? (max_ticks - missed_ticks) : 0;
+
+	return (covered_ticks > keep) ? uint32_t(covered_ticks - keep) : 0;
+}
@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
 #include "pinba/globals.h"
 #include "pinba/packet.h"
 #include "pinba/histogram.h"
@@ -12,7 +16,7 @@
 template<class T>
 inline double operator/(T const& value, duration_t d)
 {
-	return ((double)value / d.nsec) * nsec_in_sec;
+	return (d.nsec > 0) ? ((double)value / d.nsec) * nsec_in_sec : 0;
 }
 
 void debug_dump_report_snapshot(FILE *sink, report_snapshot_t *snapshot, str_ref name)
@@ -88,14 +92,13 @@ void debug_dump_report_snapshot(FILE *sink, report_snapshot_t *snapshot, str_ref
 		{
 		case REPORT_KIND__BY_PACKET_DATA:
 		{
-			auto const *rinfo = snapshot->report_info();
 			auto const *data  = reinterpret_cast<report_row_data___by_packet_t*>(snapshot->get_data(pos));
 
 			ff::fmt(sink, "{{ {0}, {1}, {2}, {3}, {4}, {5}, {6} }",
 				data->req_count, data->timer_count, data->time_total, data->ru_utime, data->ru_stime,
 				data->traffic, data->mem_used);
 
-			auto const time_window = rinfo->time_window; // TODO: calculate real time window from snapshot data
+			auto const time_window = snapshot->time_window_covered();
 			ff::fmt(sink, " {{ rps: {0} }",
 				ff::as_printf("%.06lf", data->req_count / time_window));
 
@@ -105,14 +108,13 @@ void debug_dump_report_snapshot(FILE *sink, report_snapshot_t *snapshot, str_ref
 
 		case REPORT_KIND__BY_REQUEST_DATA:
 		{
-			auto const *rinfo = snapshot->report_info();
 			auto const *data  = reinterpret_cast<report_row_data___by_request_t*>(snapshot->get_data(pos));
 
 			ff::fmt(sink, "{{ {0}, {1}, {2}, {3}, {4}, {5} }",
 				data->req_count, data->time_total, data->ru_utime, data->ru_stime,
 				data->traffic, data->mem_used);
 
-			auto const time_window = rinfo->time_window; // TODO: calculate real time window from snapshot data
+			auto const time_window = snapshot->time_window_covered();
 			ff::fmt(sink, " {{ rps: {0} }",
 				ff::as_printf("%.06lf", data->req_count / time_window));
 
@@ -122,13 +124,12 @@ void debug_dump_report_snapshot(FILE *sink, report_snapshot_t *snapshot, str_ref
 
 		case REPORT_KIND__BY_TIMER_DATA:
 		{
-			auto const *rinfo = snapshot->report_info();
 			auto const *data  = reinterpret_cast<report_row_data___by_timer_t*>(snapshot->get_data(pos));
 
 			ff::fmt(sink, "{{ {0}, {1}, {2}, {3}, {4} }",
 				data->req_count, data->hit_count, data->time_total, data->ru_utime, data->ru_stime);
 
-			auto const time_window = rinfo->time_window; // TODO: calculate real time window from snapshot data
+			auto const time_window = snapshot->time_window_covered();
 			ff::fmt(sink, " {{ rps: {0}, tps: {1} }",
 				ff::as_printf("%.06lf", data->req_count / time_window),
 				ff::as_printf("%.06lf", data->hit_count / time_window));
@@ -148,4 +149,236 @@ void debug_dump_report_snapshot(FILE *sink, report_snapshot_t *snapshot, str_ref
 
 	ff::fmt(sink, "<<-----------------------<\n");
 	ff::fmt(sink, "\n");
-}
\ No newline at end of file
+}
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	inline void rollup_data_add(report_row_data___by_request_t *to, report_row_data___by_request_t const& from)
+	{
+		to->req_count      += from.req_count;
+		to->distinct_count  = std::max(to->distinct_count, from.distinct_count); // sketches are gone by now, lower bound is all we've got
+		to->time_total     += from.time_total;
+		to->ru_utime       += from.ru_utime;
+		to->ru_stime       += from.ru_stime;
+		to->traffic        += from.traffic;
+		to->mem_used       += from.mem_used;
+	}
+
+	inline void rollup_data_add(report_row_data___by_timer_t *to, report_row_data___by_timer_t const& from)
+	{
+		to->req_count  += from.req_count;
+		to->hit_count  += from.hit_count;
+		to->time_total += from.time_total;
+		to->ru_utime   += from.ru_utime;
+		to->ru_stime   += from.ru_stime;
+	}
+
+	template<class Data>
+	struct report_snapshot___rollup_t : public report_snapshot_t
+	{
+		struct row_t
+		{
+			report_key_t             key;
+			Data                     data;
+			std::vector<position_t>  src_pos;        // rows of src snapshot, for histograms
+			flat_histogram_t         hv        = {};
+			bool                     hv_merged = false;
+		};
+
+		report_snapshot___rollup_t(report_snapshot_ptr src, std::vector<uint32_t> const& key_parts)
+			: src_(std::move(src))
+			, rinfo_(*src_->report_info())
+		{
+			rinfo_.n_key_parts = key_parts.size();
+			rinfo_.hv_kind     = HISTOGRAM_KIND__FLAT; // hdr sources are converted on merge
+
+			std::unordered_map<report_key_t, uint32_t, report_key__hasher_t, report_key__equal_t> index;
+			index.reserve(src_->row_count());
+
+			for (auto pos = src_->pos_first(), end = src_->pos_last(); !src_->pos_equal(pos, end); pos = src_->pos_next(pos))
+			{
+				report_key_t const src_key = src_->get_key(pos);
+
+				report_key_t key;
+				for (uint32_t const part : key_parts)
+					key.push_back(src_key[part]);
+
+				auto const inserted = index.emplace(key, rows_.size());
+				if (inserted.second)
+				{
+					rows_.emplace_back();
+					rows_.back().key = key;
+				}
+
+				row_t& row = rows_[inserted.first->second];
+				rollup_data_add(&row.data, *static_cast<Data const*>(src_->get_data(pos)));
+				row.src_pos.push_back(pos);
+			}
+
+			index_ = std::move(index);
+		}
+
+		virtual report_info_t const* report_info() const override         { return &rinfo_; }
+		virtual histogram_conf_t const* histogram_conf() const override   { return src_->histogram_conf(); }
+		virtual duration_t time_window_covered() const override           { return src_->time_window_covered(); }
+		virtual dictionary_t const* dictionary() const override           { return src_->dictionary(); }
+		virtual snapshot_dictionary_t const* snapshot_dictionary() const override { return src_->snapshot_dictionary(); }
+
+		// src has been prepared, and filtered, before rows were rolled up
+		virtual void prepare(merge_flags_t) override                      {}
+		virtual bool is_prepared() const override                         { return true; }
+		virtual void set_key_filter(report_key_filter_t const&) override  {}
+
+		virtual size_t row_count() const override
+		{
+			return rows_.size();
+		}
+
+		virtual position_t pos_first() override                           { return pos_at(0); }
+		virtual position_t pos_last() override                            { return pos_at(rows_.size()); }
+		virtual position_t pos_next(position_t const& pos) override       { return pos_at(row_index(pos) + 1); }
+
+		virtual bool pos_equal(position_t const& l, position_t const& r) const override
+		{
+			return row_index(l) == row_index(r);
+		}
+
+		virtual position_t pos_find(report_key_t const& key) override
+		{
+			auto const it = index_.find(key);
+			return (it != index_.end()) ? pos_at(it->second) : this->pos_last();
+		}
+
+		virtual std::vector<position_t> pos_split(uint32_t n_ranges) override
+		{
+			size_t const n_rows = rows_.size();
+			n_ranges = uint32_t(std::max<size_t>(1, std::min<size_t>(n_ranges, n_rows)));
+
+			std::vector<position_t> result;
+			result.reserve(n_ranges + 1);
+
+			for (uint32_t i = 0; i <= n_ranges; i++)
+				result.push_back(pos_at(n_rows * i / n_ranges));
+
+			return result;
+		}
+
+		virtual report_key_t get_key(position_t const& pos) const override
+		{
+			return rows_[row_index(pos)].key;
+		}
+
+		virtual report_key_str_t get_key_str(position_t const& pos) const override
+		{
+			report_key_t const& k = rows_[row_index(pos)].key;
+
+			report_key_str_t result;
+			for (uint32_t i = 0; i < k.size(); ++i)
+				result.push_back(this->dictionary()->get_word(k[i]));
+			return result;
+		}
+
+		virtual int   data_kind() const override                          { return rinfo_.kind; }
+		virtual void* get_data(position_t const& pos) override            { return &rows_[row_index(pos)].data; }
+		virtual void* get_data_totals() const override                    { return src_->get_data_totals(); }
+
+		virtual int histogram_kind() const override
+		{
+			return HISTOGRAM_KIND__FLAT;
+		}
+
+		// merged from src rows on first access, same as snapshots do with ticks
+		virtual void* get_histogram(position_t const& pos) override
+		{
+			if (!rinfo_.hv_enabled)
+				return nullptr;
+
+			row_t& row = rows_[row_index(pos)];
+			if (row.hv_merged)
+				return &row.hv;
+
+			bool const src_hdr = (src_->histogram_kind() == HISTOGRAM_KIND__HDR);
+
+			std::vector<flat_histogram_t>           converted; // hdr sources, values below point here, so no reallocations
+			std::vector<histogram_values_t const*>  values;
+
+			converted.reserve(src_hdr ? row.src_pos.size() : 0);
+			values.reserve(row.src_pos.size());
+
+			for (auto const& src_pos : row.src_pos)
+			{
+				void const *hv = src_->get_histogram(src_pos);
+				if (hv == nullptr)
+					continue;
+
+				if (src_hdr)
+				{
+					converted.push_back(histogram___convert_hdr_to_flat(*static_cast<hdr_histogram_t const*>(hv), *src_->histogram_conf()));
+					values.push_back(&converted.back().values);
+				}
+				else
+				{
+					values.push_back(&static_cast<flat_histogram_t const*>(hv)->values);
+				}
+			}
+
+			flat_histogram___merge_multi(&row.hv, values.begin(), values.end());
+
+			row.src_pos.clear();
+			row.src_pos.shrink_to_fit();
+			row.hv_merged = true;
+
+			return &row.hv;
+		}
+
+	private:
+
+		static position_t pos_at(size_t index)
+		{
+			position_t result = {};
+			result.dummy___[0] = index;
+			return result;
+		}
+
+		static size_t row_index(position_t const& pos)
+		{
+			return pos.dummy___[0];
+		}
+
+	private:
+		report_snapshot_ptr  src_;
+		report_info_t        rinfo_;
+		std::vector<row_t>   rows_;
+
+		std::unordered_map<report_key_t, uint32_t, report_key__hasher_t, report_key__equal_t> index_; // key -> rows_ offset
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+report_snapshot_ptr report_snapshot___rollup(report_snapshot_ptr src, std::vector<uint32_t> const& key_parts)
+{
+	if (!src->is_prepared())
+		throw std::logic_error("report_snapshot___rollup: src snapshot must be prepared");
+
+	uint32_t const n_src_keys = src->report_info()->n_key_parts;
+	for (uint32_t const part : key_parts)
+	{
+		if (part >= n_src_keys)
+			throw std::logic_error(ff::fmt_str("report_snapshot___rollup: key part {0} out of range, src has {1}", part, n_src_keys));
+	}
+
+	switch (src->data_kind())
+	{
+		case REPORT_KIND__BY_REQUEST_DATA:
+			return meow::make_unique<aux::report_snapshot___rollup_t<report_row_data___by_request_t>>(std::move(src), key_parts);
+
+		case REPORT_KIND__BY_TIMER_DATA:
+			return meow::make_unique<aux::report_snapshot___rollup_t<report_row_data___by_timer_t>>(std::move(src), key_parts);
+
+		default:
+			throw std::runtime_error(ff::fmt_str("report_snapshot___rollup: only 'request' and 'timer' reports can be rolled up, got kind {0}", src->data_kind()));
+	}
+}
@@ -0,0 +1,254 @@
+#include "pinba_config.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <meow/defer.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/os_symbols.h"
+#include "pinba/report_ticker.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct report_ticker_impl_t : public report_ticker_t
+	{
+		struct subscriber_t
+		{
+			subscription_id_t  id;
+			tick_func_t        func;
+			duration_t         phase;  // called this much after aligned tick, see report_ticker_conf_t::stagger
+		};
+
+		// all subscribers with the same interval
+		struct group_t
+		{
+			duration_t                 interval;
+			timeval_t                  next_tick;
+			size_t                     next_sub;  // subs before this one have been called for next_tick already
+			std::vector<subscriber_t>  subs;      // sorted by phase
+		};
+
+		static timeval_t next_aligned_tick(timeval_t now, duration_t interval)
+		{
+			int64_t const now_ns = duration_from_timeval(now).nsec;
+			return timeval_from_duration(duration_t { (now_ns / interval.nsec + 1) * interval.nsec });
+		}
+
+		// when the next subscriber of the group is due, group must not be empty
+		static timeval_t group_due_time(group_t const& group)
+		{
+			int64_t const tick_ns = duration_from_timeval(group.next_tick).nsec;
+			return timeval_from_duration(duration_t { tick_ns + group.subs[group.next_sub].phase.nsec });
+		}
+
+		// golden ratio sequence, subscription ids are sequential and phases spread evenly over [0, stagger) for any count
+		duration_t phase_for(subscription_id_t id, duration_t interval) const
+		{
+			int64_t const stagger_ns = std::min(conf_.stagger.nsec, interval.nsec / 2);
+			if (stagger_ns <= 0)
+				return duration_t { 0 };
+
+			double const frac = double((id * UINT64_C(0x9E3779B97F4A7C15)) >> 11) / double(UINT64_C(1) << 53);
+			return duration_t { int64_t(frac * stagger_ns) };
+		}
+
+	public:
+
+		report_ticker_impl_t(pinba_globals_t *globals, report_ticker_conf_t const& conf)
+			: globals_(globals)
+			, conf_(conf)
+			, in_shutdown_(false)
+			, next_id_(1)
+		{
+		}
+
+		~report_ticker_impl_t()
+		{
+			this->shutdown();
+		}
+
+		virtual void startup() override
+		{
+			if (t_.joinable())
+				throw std::logic_error(ff::fmt_str("{0}: already started", conf_.name));
+
+			t_ = std::thread([this]() { this->worker_thread(); });
+		}
+
+		virtual void shutdown() override
+		{
+			if (!t_.joinable())
+				return;
+
+			{
+				std::lock_guard<std::mutex> lk_(mtx_);
+				in_shutdown_ = true;
+			}
+			cv_.notify_all();
+
+			t_.join();
+		}
+
+		virtual subscription_id_t subscribe(duration_t interval, tick_func_t func) override
+		{
+			if (interval.nsec <= 0)
+				throw std::logic_error(ff::fmt_str("{0}: bad tick interval {1}", conf_.name, interval));
+
+			std::lock_guard<std::mutex> lk_(mtx_);
+
+			subscription_id_t const id = next_id_++;
+
+			auto const inserted = groups_.emplace(interval.nsec, group_t{});
+			group_t& group = inserted.first->second;
+
+			if (inserted.second)
+			{
+				group.interval  = interval;
+				group.next_tick = next_aligned_tick(os_unix::clock_monotonic_now(), interval);
+				group.next_sub  = 0;
+			}
+
+			duration_t const phase = this->phase_for(id, interval);
+
+			auto const sub_it = std::upper_bound(group.subs.begin(), group.subs.end(), phase,
+				[](duration_t p, subscriber_t const& s) { return p.nsec < s.phase.nsec; });
+
+			// others are being called for current tick, new one waits for the next
+			if (size_t(sub_it - group.subs.begin()) < group.next_sub)
+				group.next_sub++;
+
+			group.subs.insert(sub_it, subscriber_t { .id = id, .func = std::move(func), .phase = phase });
+			interval_by_id_.emplace(id, interval.nsec);
+
+			cv_.notify_all(); // might be the nearest tick now
+			return id;
+		}
+
+		virtual void unsubscribe(subscription_id_t id) override
+		{
+			std::lock_guard<std::mutex> lk_(mtx_);
+
+			auto const id_it = interval_by_id_.find(id);
+			if (id_it == interval_by_id_.end())
+				return;
+
+			auto const group_it = groups_.find(id_it->second);
+			assert((group_it != groups_.end()) && "BUG: subscription without a group");
+
+			group_t& group = group_it->second;
+
+			auto const sub_it = std::find_if(group.subs.begin(), group.subs.end(), [id](subscriber_t const& s) { return s.id == id; });
+			assert((sub_it != group.subs.end()) && "BUG: subscription not in its group");
+
+			if (size_t(sub_it - group.subs.begin()) < group.next_sub)
+				group.next_sub--;
+
+			group.subs.erase(sub_it);
+
+			if (group.subs.empty())
+				groups_.erase(group_it);
+			else if (group.next_sub == group.subs.size()) // removed the last one waiting for current tick
+				this->group_advance(&group, os_unix::clock_monotonic_now());
+
+			interval_by_id_.erase(id_it);
+		}
+
+	private:
+
+		void worker_thread()
+		{
+			PINBA___OS_CALL(globals_, set_thread_name, conf_.name);
+
+			MEOW_DEFER(
+				LOG_DEBUG(globals_->logger(), "{0}; exiting", conf_.name);
+			);
+
+			std::unique_lock<std::mutex> lk_(mtx_);
+
+			while (!in_shutdown_)
+			{
+				// just a few distinct intervals usually, no need for anything fancy to find the nearest one
+				bool      have_due = false;
+				timeval_t nearest_due;
+				for (auto const& group_pair : groups_)
+				{
+					timeval_t const due = group_due_time(group_pair.second);
+					if (!have_due || (due < nearest_due))
+					{
+						nearest_due = due;
+						have_due    = true;
+					}
+				}
+
+				if (!have_due)
+				{
+					cv_.wait(lk_);
+					continue;
+				}
+
+				timeval_t const now = os_unix::clock_monotonic_now();
+
+				if (now < nearest_due)
+				{
+					cv_.wait_for(lk_, std::chrono::nanoseconds(duration_from_timeval(nearest_due - now).nsec));
+					continue;
+				}
+
+				for (auto& group_pair : groups_)
+				{
+					group_t& group = group_pair.second;
+
+					while ((group.next_sub < group.subs.size()) && !(now < group_due_time(group)))
+					{
+						group.subs[group.next_sub].func(group.next_tick);
+						group.next_sub++;
+					}
+
+					if (group.next_sub == group.subs.size())
+						this->group_advance(&group, now);
+				}
+			}
+		}
+
+		// all subscribers have been called for current tick
+		// skip ticks we've been too late for, if any, to stay aligned
+		void group_advance(group_t *group, timeval_t now)
+		{
+			group->next_tick = next_aligned_tick(now, group->interval);
+			group->next_sub  = 0;
+		}
+
+	private:
+		pinba_globals_t          *globals_;
+		report_ticker_conf_t     conf_;
+
+		std::mutex               mtx_;
+		std::condition_variable  cv_;
+		bool                     in_shutdown_;
+
+		std::map<int64_t, group_t>                        groups_;          // interval nsec -> group
+		std::unordered_map<subscription_id_t, int64_t>    interval_by_id_;  // -> groups_ key
+		subscription_id_t                                 next_id_;
+
+		std::thread              t_;
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+report_ticker_ptr create_report_ticker(pinba_globals_t *globals, report_ticker_conf_t const& conf)
+{
+	return meow::make_unique<aux::report_ticker_impl_t>(globals, conf);
+}
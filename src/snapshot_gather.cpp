@@ -0,0 +1,731 @@
+#include "pinba_config.h"
+
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <meow/defer.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/format_to_string.hpp>
+#include <meow/std_unique_ptr.hpp>
+#include <meow/str_ref_algo.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/os_symbols.h"
+#include "pinba/exporter.h"
+#include "pinba/multi_merge.h"
+#include "pinba/snapshot_gather.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// see exporter.h for the format, all ints are little-endian
+	constexpr size_t const header_size = 40;
+
+	inline uint32_t get_u32(uint8_t const *p)
+	{
+		return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+	}
+
+	inline uint64_t get_u64(uint8_t const *p)
+	{
+		return uint64_t(get_u32(p)) | (uint64_t(get_u32(p + 4)) << 32);
+	}
+
+	inline void put_u8(std::string *out, uint8_t v)
+	{
+		out->push_back(char(v));
+	}
+
+	inline void put_u32(std::string *out, uint32_t v)
+	{
+		char const b[4] = { char(v), char(v >> 8), char(v >> 16), char(v >> 24) };
+		out->append(b, sizeof(b));
+	}
+
+	inline void put_u64(std::string *out, uint64_t v)
+	{
+		put_u32(out, uint32_t(v));
+		put_u32(out, uint32_t(v >> 32));
+	}
+
+	// keys are compared as strings, every node has its own word ids
+	inline int key_compare(str_ref const *l, str_ref const *r, uint32_t n_key_parts)
+	{
+		for (uint32_t i = 0; i < n_key_parts; i++)
+		{
+			size_t const len = std::min(l[i].size(), r[i].size());
+
+			int const c = (len > 0) ? memcmp(l[i].data(), r[i].data(), len) : 0;
+			if (c != 0)
+				return c;
+
+			if (l[i].size() != r[i].size())
+				return (l[i].size() < r[i].size()) ? -1 : 1;
+		}
+
+		return 0;
+	}
+
+	struct column_desc_t
+	{
+		std::string  name;
+		uint8_t      type;   // PINBA_EXPORT_COLUMN__*
+	};
+
+	// a row, as seen by the merge, points into node snapshot or merged result
+	struct gather_row_t
+	{
+		str_ref const   *key;     // n_key_parts
+		uint64_t const  *values;  // n_columns
+	};
+	using gather_rows_t = std::vector<gather_row_t>;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// single node response, parsed incrementally as it arrives
+	struct node_snapshot_t
+	{
+		enum class stage_t { header, words, keys, column_header, column_values, done };
+
+		std::string    node;
+		std::string    data;        // response as received, words are referenced by offset until it's complete
+		size_t         parsed = 0;
+		stage_t        stage  = stage_t::header;
+		pinba_error_t  err;
+
+		uint32_t       kind        = 0;
+		uint64_t       time_window = 0;
+		uint32_t       n_key_parts = 0;
+		uint32_t       n_columns   = 0;
+		uint64_t       n_rows      = 0;
+		uint32_t       n_words     = 0;
+
+		std::unordered_map<uint32_t, uint32_t>      word_index;    // node word_id -> index in word_offsets
+		std::vector<std::pair<size_t, uint32_t>>    word_offsets;  // { offset in data, len }, [0] is the empty word
+
+		std::vector<uint32_t>       key_words;       // row-major, indexes in word_offsets
+		uint64_t                    key_cells_done = 0;
+
+		std::vector<column_desc_t>  columns;
+		std::vector<uint64_t>       values;          // row-major
+		uint64_t                    column_rows_done = 0;
+
+		// when complete
+		std::vector<str_ref>        key_strs;        // row-major
+		gather_rows_t               rows;            // sorted by key
+
+		size_t available() const
+		{
+			return data.size() - parsed;
+		}
+
+		uint8_t const* at() const
+		{
+			return (uint8_t const*)data.data() + parsed;
+		}
+
+		// parse whatever has arrived, true when there is nothing more to parse right now (or ever, see stage)
+		bool parse_step()
+		{
+			switch (stage)
+			{
+				case stage_t::header:
+				{
+					if (available() < sizeof(uint32_t))
+						return true;
+
+					uint32_t const magic = get_u32(at());
+					if (magic == PINBA_EXPORT_MAGIC_ERROR)
+					{
+						if (available() < 2 * sizeof(uint32_t))
+							return true;
+
+						uint32_t const len = get_u32(at() + sizeof(uint32_t));
+						if (available() < 2 * sizeof(uint32_t) + len)
+							return true;
+
+						err = ff::fmt_err("{0}", str_ref { (char const*)at() + 2 * sizeof(uint32_t), len });
+						stage = stage_t::done;
+						return true;
+					}
+
+					if (magic != PINBA_EXPORT_MAGIC)
+					{
+						err = ff::fmt_err("bad magic: {0}", magic);
+						stage = stage_t::done;
+						return true;
+					}
+
+					if (available() < header_size)
+						return true;
+
+					uint8_t const *p = at();
+
+					uint32_t const version = get_u32(p + 4);
+					if (version != PINBA_EXPORT_VERSION)
+					{
+						err = ff::fmt_err("unsupported version: {0}, expected {1}", version, PINBA_EXPORT_VERSION);
+						stage = stage_t::done;
+						return true;
+					}
+
+					kind        = get_u32(p + 8);
+					time_window = get_u64(p + 12);
+					n_key_parts = get_u32(p + 20);
+					n_columns   = get_u32(p + 24);
+					n_rows      = get_u64(p + 28);
+					n_words     = get_u32(p + 36);
+					parsed     += header_size;
+
+					if (n_rows > UINT32_MAX)
+					{
+						err = ff::fmt_err("too many rows: {0}", n_rows);
+						stage = stage_t::done;
+						return true;
+					}
+
+					word_offsets.reserve(n_words + 1);
+					word_offsets.emplace_back(0, 0);
+
+					stage = stage_t::words;
+					return false;
+				}
+
+				case stage_t::words:
+				{
+					if (word_offsets.size() == size_t(n_words) + 1)
+					{
+						key_words.resize(n_rows * n_key_parts);
+						stage = stage_t::keys;
+						return false;
+					}
+
+					if (available() < 2 * sizeof(uint32_t))
+						return true;
+
+					uint32_t const word_id = get_u32(at());
+					uint32_t const len     = get_u32(at() + sizeof(uint32_t));
+					if (available() < 2 * sizeof(uint32_t) + len)
+						return true;
+
+					word_index.emplace(word_id, uint32_t(word_offsets.size()));
+					word_offsets.emplace_back(parsed + 2 * sizeof(uint32_t), len);
+					parsed += 2 * sizeof(uint32_t) + len;
+					return false;
+				}
+
+				case stage_t::keys:
+				{
+					uint64_t const n_cells = n_rows * n_key_parts;
+
+					// key columns go one after another, cell i is row (i % n_rows) of key part (i / n_rows)
+					for (; key_cells_done < n_cells && available() >= sizeof(uint32_t); key_cells_done++)
+					{
+						uint32_t const word_id = get_u32(at());
+						parsed += sizeof(uint32_t);
+
+						uint32_t word_i = 0;
+						if (word_id != 0)
+						{
+							auto const it = word_index.find(word_id);
+							if (it == word_index.end())
+							{
+								err = ff::fmt_err("key word {0} is not in string table", word_id);
+								stage = stage_t::done;
+								return true;
+							}
+							word_i = it->second;
+						}
+
+						uint64_t const row  = key_cells_done % n_rows;
+						uint64_t const part = key_cells_done / n_rows;
+						key_words[row * n_key_parts + part] = word_i;
+					}
+
+					if (key_cells_done < n_cells)
+						return true;
+
+					values.resize(n_rows * n_columns);
+					stage = (n_columns > 0) ? stage_t::column_header : stage_t::done;
+					return false;
+				}
+
+				case stage_t::column_header:
+				{
+					if (available() < 1)
+						return true;
+
+					uint8_t const name_len = at()[0];
+					if (available() < size_t(1 + name_len + 1))
+						return true;
+
+					columns.push_back(column_desc_t {
+						.name = std::string((char const*)at() + 1, name_len),
+						.type = at()[1 + name_len],
+					});
+					parsed += 1 + name_len + 1;
+
+					column_rows_done = 0;
+					stage = stage_t::column_values;
+					return false;
+				}
+
+				case stage_t::column_values:
+				{
+					uint32_t const column_i = columns.size() - 1;
+
+					for (; column_rows_done < n_rows && available() >= sizeof(uint64_t); column_rows_done++)
+					{
+						values[column_rows_done * n_columns + column_i] = get_u64(at());
+						parsed += sizeof(uint64_t);
+					}
+
+					if (column_rows_done < n_rows)
+						return true;
+
+					stage = (columns.size() < n_columns) ? stage_t::column_header : stage_t::done;
+					return false;
+				}
+
+				case stage_t::done:
+					return true;
+			}
+
+			return true;
+		}
+
+		void parse_available()
+		{
+			while (!this->parse_step())
+				;
+		}
+
+		// data is not going to move anymore, resolve words and sort rows
+		void finish()
+		{
+			if (!err && stage != stage_t::done)
+				err = ff::fmt_err("response is truncated");
+
+			if (!err && parsed != data.size())
+				err = ff::fmt_err("{0} bytes of garbage after snapshot", data.size() - parsed);
+
+			if (err)
+				return;
+
+			key_strs.resize(key_words.size());
+			for (size_t i = 0; i < key_words.size(); i++)
+			{
+				auto const& wo = word_offsets[key_words[i]];
+				key_strs[i] = str_ref { data.data() + wo.first, wo.second };
+			}
+
+			rows.resize(n_rows);
+			for (uint64_t i = 0; i < n_rows; i++)
+			{
+				rows[i].key    = key_strs.data() + i * n_key_parts;
+				rows[i].values = values.data() + i * n_columns;
+			}
+
+			uint32_t const nkp = n_key_parts;
+			std::sort(rows.begin(), rows.end(), [nkp](gather_row_t const& l, gather_row_t const& r)
+			{
+				return key_compare(l.key, r.key, nkp) < 0;
+			});
+		}
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// rows merged so far, nodes are merged in as soon as they are done
+	struct gather_result_t
+	{
+		std::mutex              mtx;
+		node_snapshot_t const   *first = nullptr;  // header and columns of the first merged node, others must match
+		gather_rows_t           rows;
+		std::vector<uint64_t>   values;            // row-major, rows[i].values points here
+	};
+
+	// see flat_histogram___merge_multi_sparse(), same thing for rows
+	struct row_merger_t
+	{
+		uint32_t               n_key_parts;
+		uint32_t               n_columns;
+		gather_rows_t          *to;
+		std::vector<uint64_t>  *to_values;
+
+		inline bool compare(gather_row_t const& l, gather_row_t const& r) const
+		{
+			return key_compare(l.key, r.key, n_key_parts) < 0;
+		}
+
+		inline void reserve(size_t const sz)
+		{
+			to->reserve(sz);
+			to_values->reserve(sz * n_columns);
+		}
+
+		inline void push_back(gather_rows_t const *seq, gather_row_t const& row)
+		{
+			if (!to->empty() && key_compare(to->back().key, row.key, n_key_parts) == 0)
+			{
+				uint64_t *v = to_values->data() + (to->size() - 1) * n_columns;
+				for (uint32_t i = 0; i < n_columns; i++)
+					v[i] += row.values[i];
+				return;
+			}
+
+			to->push_back(gather_row_t { .key = row.key, .values = nullptr }); // values pointers are fixed up after merge
+			to_values->insert(to_values->end(), row.values, row.values + n_columns);
+		}
+	};
+
+	inline pinba_error_t gather_merge_node(gather_result_t *result, node_snapshot_t const& node)
+	{
+		std::lock_guard<std::mutex> lk_(result->mtx);
+
+		if (result->first == nullptr)
+		{
+			result->first = &node;
+		}
+		else
+		{
+			node_snapshot_t const& first = *result->first;
+
+			if (node.kind != first.kind || node.n_key_parts != first.n_key_parts || node.n_columns != first.n_columns)
+			{
+				return ff::fmt_err("report differs from the one on {0}: kind {1}/{2}, key parts {3}/{4}",
+					first.node, node.kind, first.kind, node.n_key_parts, first.n_key_parts);
+			}
+
+			for (uint32_t i = 0; i < node.n_columns; i++)
+			{
+				if (node.columns[i].name != first.columns[i].name || node.columns[i].type != first.columns[i].type)
+					return ff::fmt_err("column {0} differs from the one on {1}: {2}/{3}", i, first.node, node.columns[i].name, first.columns[i].name);
+			}
+		}
+
+		gather_rows_t          merged_rows;
+		std::vector<uint64_t>  merged_values;
+
+		row_merger_t merger = {
+			.n_key_parts = node.n_key_parts,
+			.n_columns   = node.n_columns,
+			.to          = &merged_rows,
+			.to_values   = &merged_values,
+		};
+
+		gather_rows_t const *sources[] = { &result->rows, &node.rows };
+		pinba::multi_merge(&merger, std::begin(sources), std::end(sources));
+
+		for (size_t i = 0; i < merged_rows.size(); i++)
+			merged_rows[i].values = merged_values.data() + i * node.n_columns;
+
+		// merged rows reference keys of nodes and values of their own, old values are not needed anymore
+		result->rows.swap(merged_rows);
+		result->values.swap(merged_values);
+
+		return {};
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	inline int gather_connect(std::string const& node, duration_t timeout, pinba_error_t *err)
+	{
+		timeval_t const tv_timeout = timeval_from_duration(timeout);
+		struct timeval const tv = { .tv_sec = tv_timeout.tv_sec, .tv_usec = tv_timeout.tv_usec };
+
+		auto const connect_fd = [&](int family, struct sockaddr const *addr, socklen_t addrlen) -> int
+		{
+			int const fd = ::socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (fd < 0)
+				return -1;
+
+			// connect() obeys SO_SNDTIMEO on linux
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+			if (::connect(fd, addr, addrlen) < 0)
+			{
+				int const saved_errno = errno;
+				close(fd);
+				errno = saved_errno;
+				return -1;
+			}
+
+			return fd;
+		};
+
+		str_ref const node_ref = node;
+		if (meow::prefix_compare(node_ref, "unix:"))
+		{
+			std::string const path = node.substr(5);
+
+			struct sockaddr_un addr = {};
+			addr.sun_family = AF_UNIX;
+
+			if (path.size() >= sizeof(addr.sun_path))
+			{
+				*err = ff::fmt_err("unix socket path is too long: {0}", path);
+				return -1;
+			}
+			memcpy(addr.sun_path, path.c_str(), path.size());
+
+			int const fd = connect_fd(AF_UNIX, (struct sockaddr*)&addr, sizeof(addr));
+			if (fd < 0)
+				*err = ff::fmt_err("connect({0}) failed: {1}:{2}", path, errno, strerror(errno));
+
+			return fd;
+		}
+
+		size_t const colon = node.rfind(':');
+		if (colon == std::string::npos)
+		{
+			*err = ff::fmt_err("expected 'host:port' or 'unix:/path'");
+			return -1;
+		}
+
+		std::string const host = node.substr(0, colon);
+		std::string const port = node.substr(colon + 1);
+
+		struct addrinfo hints = {};
+		hints.ai_family   = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		struct addrinfo *ai_list = nullptr;
+		int const gai_err = ::getaddrinfo(host.c_str(), port.c_str(), &hints, &ai_list);
+		if (gai_err != 0)
+		{
+			*err = ff::fmt_err("getaddrinfo({0}, {1}) failed: {2}", host, port, gai_strerror(gai_err));
+			return -1;
+		}
+
+		MEOW_DEFER(
+			freeaddrinfo(ai_list);
+		);
+
+		for (struct addrinfo const *ai = ai_list; ai != nullptr; ai = ai->ai_next)
+		{
+			int const fd = connect_fd(ai->ai_family, ai->ai_addr, ai->ai_addrlen);
+			if (fd >= 0)
+				return fd;
+		}
+
+		*err = ff::fmt_err("connect({0}) failed: {1}:{2}", node, errno, strerror(errno));
+		return -1;
+	}
+
+	inline void gather_fetch_node(std::string const& report_name, duration_t timeout, node_snapshot_t *ns)
+	{
+		int const fd = gather_connect(ns->node, timeout, &ns->err);
+		if (fd < 0)
+			return;
+
+		MEOW_DEFER(
+			close(fd);
+		);
+
+		std::string const request = report_name + "\n";
+		for (size_t sent = 0; sent < request.size();)
+		{
+			ssize_t const n = ::send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR)
+				continue;
+
+			if (n <= 0)
+			{
+				ns->err = ff::fmt_err("send() failed: {0}:{1}", errno, strerror(errno));
+				return;
+			}
+
+			sent += n;
+		}
+
+		// parse as we go, so that by the time the last byte arrives, only the sort is left
+		constexpr size_t const read_chunk = 256 * 1024;
+
+		while (true)
+		{
+			size_t const prev_size = ns->data.size();
+			ns->data.resize(prev_size + read_chunk);
+
+			ssize_t const n = ::recv(fd, &ns->data[prev_size], read_chunk, 0);
+			if (n < 0 && errno == EINTR)
+			{
+				ns->data.resize(prev_size);
+				continue;
+			}
+
+			if (n < 0)
+			{
+				ns->data.resize(prev_size);
+				ns->err = ff::fmt_err("recv() failed: {0}:{1}", errno, strerror(errno));
+				return;
+			}
+
+			ns->data.resize(prev_size + n);
+
+			if (n == 0) // server closes connection after the snapshot
+				break;
+
+			ns->parse_available();
+			if (ns->err)
+				return;
+		}
+
+		ns->finish();
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::vector<std::string> snapshot_gather___parse_nodes(str_ref nodes)
+{
+	std::vector<std::string> result;
+
+	std::string const s = nodes.str();
+	size_t pos = 0;
+
+	while (pos <= s.size())
+	{
+		size_t const comma = std::min(s.find(',', pos), s.size());
+
+		size_t b = pos, e = comma;
+		while (b < e && isspace((unsigned char)s[b])) b++;
+		while (e > b && isspace((unsigned char)s[e - 1])) e--;
+
+		if (e > b)
+			result.emplace_back(s.substr(b, e - b));
+
+		pos = comma + 1;
+	}
+
+	return result;
+}
+
+pinba_error_t snapshot_gather(pinba_globals_t *globals, snapshot_gather_conf_t const& conf, std::string const& report_name, std::string *out)
+{
+	if (conf.nodes.empty())
+		return ff::fmt_err("no nodes to gather from");
+
+	// nodes are referenced by merged rows, must outlive the result
+	std::vector<std::unique_ptr<aux::node_snapshot_t>> nodes;
+	for (auto const& node : conf.nodes)
+	{
+		nodes.emplace_back(meow::make_unique<aux::node_snapshot_t>());
+		nodes.back()->node = node;
+	}
+
+	aux::gather_result_t result;
+
+	// fetches are i/o bound and take as long as the slowest node, they'd only stall shared merge pool
+	std::vector<std::thread> threads;
+	threads.reserve(nodes.size());
+
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		threads.emplace_back([&, i]()
+		{
+			PINBA___OS_CALL(globals, set_thread_name, ff::fmt_str("gather/{0}", i));
+
+			aux::node_snapshot_t *ns = nodes[i].get();
+
+			try
+			{
+				aux::gather_fetch_node(report_name, conf.timeout, ns);
+
+				if (!ns->err)
+					ns->err = aux::gather_merge_node(&result, *ns);
+			}
+			catch (std::exception const& e)
+			{
+				ns->err = ff::fmt_err("{0}", e.what());
+			}
+		});
+	}
+
+	for (auto& t : threads)
+		t.join();
+
+	for (auto const& ns : nodes)
+	{
+		if (ns->err)
+			return ff::fmt_err("{0}: {1}", ns->node, ns->err.what());
+	}
+
+	aux::node_snapshot_t const& first = *result.first;
+
+	// word ids are local to this response
+	std::unordered_map<std::string, uint32_t> word_ids;
+	std::vector<str_ref>                      words;
+
+	std::vector<uint32_t> key_ids(result.rows.size() * first.n_key_parts);
+	for (size_t row_i = 0; row_i < result.rows.size(); row_i++)
+	{
+		for (uint32_t part = 0; part < first.n_key_parts; part++)
+		{
+			str_ref const word = result.rows[row_i].key[part];
+			if (word.empty())
+				continue;
+
+			auto const inserted_pair = word_ids.emplace(word.str(), uint32_t(words.size() + 1));
+			if (inserted_pair.second)
+				words.push_back(word);
+
+			key_ids[row_i * first.n_key_parts + part] = inserted_pair.first->second;
+		}
+	}
+
+	aux::put_u32(out, PINBA_EXPORT_MAGIC);
+	aux::put_u32(out, PINBA_EXPORT_VERSION);
+	aux::put_u32(out, first.kind);
+	aux::put_u64(out, first.time_window);
+	aux::put_u32(out, first.n_key_parts);
+	aux::put_u32(out, first.n_columns);
+	aux::put_u64(out, result.rows.size());
+	aux::put_u32(out, uint32_t(words.size()));
+
+	for (size_t i = 0; i < words.size(); i++)
+	{
+		aux::put_u32(out, uint32_t(i + 1));
+		aux::put_u32(out, uint32_t(words[i].size()));
+		out->append(words[i].data(), words[i].size());
+	}
+
+	out->reserve(out->size() + result.rows.size() * (first.n_key_parts * sizeof(uint32_t) + first.n_columns * sizeof(uint64_t)));
+
+	for (uint32_t part = 0; part < first.n_key_parts; part++)
+	{
+		for (size_t row_i = 0; row_i < result.rows.size(); row_i++)
+			aux::put_u32(out, key_ids[row_i * first.n_key_parts + part]);
+	}
+
+	for (uint32_t col = 0; col < first.n_columns; col++)
+	{
+		aux::column_desc_t const& c = first.columns[col];
+
+		aux::put_u8(out, uint8_t(c.name.size()));
+		out->append(c.name);
+		aux::put_u8(out, c.type);
+
+		for (auto const& row : result.rows)
+			aux::put_u64(out, row.values[col]);
+	}
+
+	return {};
+}
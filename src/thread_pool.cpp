@@ -0,0 +1,114 @@
+#include "pinba_config.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <meow/defer.hpp>
+
+#include "pinba/globals.h"
+#include "pinba/os_symbols.h"
+#include "pinba/thread_pool.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct thread_pool_impl_t : public thread_pool_t
+	{
+		thread_pool_impl_t(pinba_globals_t *globals, thread_pool_conf_t const& conf)
+			: globals_(globals)
+			, conf_(conf)
+			, in_shutdown_(false)
+		{
+			if (conf_.n_threads == 0)
+				throw std::logic_error(ff::fmt_str("thread_pool '{0}': n_threads must be > 0", conf_.name));
+
+			threads_.reserve(conf_.n_threads);
+
+			for (uint32_t i = 0; i < conf_.n_threads; i++)
+			{
+				threads_.emplace_back([this, i]() { this->worker_thread(i); });
+			}
+		}
+
+		virtual ~thread_pool_impl_t()
+		{
+			{
+				std::lock_guard<std::mutex> lk_(mtx_);
+				in_shutdown_ = true;
+			}
+			cv_.notify_all();
+
+			for (auto& t : threads_)
+				t.join();
+		}
+
+		virtual uint32_t thread_count() const override
+		{
+			return conf_.n_threads;
+		}
+
+		virtual void enqueue(task_t const& task) override
+		{
+			{
+				std::lock_guard<std::mutex> lk_(mtx_);
+				queue_.push_back(task);
+			}
+			cv_.notify_one();
+		}
+
+	private:
+
+		void worker_thread(uint32_t thread_id)
+		{
+			std::string const thr_name = ff::fmt_str("{0}/{1}", conf_.name, thread_id);
+
+			PINBA___OS_CALL(globals_, set_thread_name, thr_name);
+			pinba_set_thread_sched(globals_, conf_.sched, thr_name);
+
+			MEOW_DEFER(
+				LOG_DEBUG(globals_->logger(), "{0}; exiting", thr_name);
+			);
+
+			while (true)
+			{
+				task_t task;
+
+				{
+					std::unique_lock<std::mutex> lk_(mtx_);
+					cv_.wait(lk_, [this]() { return in_shutdown_ || !queue_.empty(); });
+
+					// drain the queue before exiting, somebody might be waiting on those tasks
+					if (queue_.empty())
+						return;
+
+					task = std::move(queue_.front());
+					queue_.pop_front();
+				}
+
+				task();
+			}
+		}
+
+	private:
+		pinba_globals_t          *globals_;
+		thread_pool_conf_t       conf_;
+
+		std::mutex               mtx_;
+		std::condition_variable  cv_;
+		std::deque<task_t>       queue_;
+		bool                     in_shutdown_;
+
+		std::vector<std::thread> threads_;
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+thread_pool_ptr create_thread_pool(pinba_globals_t *globals, thread_pool_conf_t const& conf)
+{
+	return meow::make_unique<aux::thread_pool_impl_t>(globals, conf);
+}
@@ -0,0 +1,105 @@
+#include "pinba_config.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+
+#include "pinba/globals.h"
+#include "pinba/tick_subscription.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct report_tick_subscription_impl_t : public report_tick_subscription_t
+	{
+		explicit report_tick_subscription_impl_t(uint32_t max_queued)
+			: max_queued_(max_queued)
+		{
+			if (max_queued_ == 0)
+				throw std::runtime_error("tick subscription queue size must be > 0");
+		}
+
+		virtual bool push(report_tick_data_ptr const& tick_data) override
+		{
+			std::lock_guard<std::mutex> lk_(mtx_);
+
+			if (closed_)
+				return false;
+
+			if (queue_.size() >= max_queued_)
+			{
+				dropped_ = true;
+				closed_  = true;
+				cv_.notify_all();
+				return false;
+			}
+
+			queue_.push_back(tick_data);
+			cv_.notify_one();
+			return true;
+		}
+
+		virtual report_tick_data_ptr pop(duration_t timeout) override
+		{
+			std::unique_lock<std::mutex> lk_(mtx_);
+
+			cv_.wait_for(lk_, std::chrono::nanoseconds(timeout.nsec), [this]() { return !queue_.empty() || closed_; });
+
+			if (queue_.empty())
+				return {};
+
+			report_tick_data_ptr result = std::move(queue_.front());
+			queue_.pop_front();
+			return result;
+		}
+
+		virtual void close() override
+		{
+			std::lock_guard<std::mutex> lk_(mtx_);
+
+			closed_ = true;
+			cv_.notify_all();
+		}
+
+		virtual void unsubscribe() override
+		{
+			std::lock_guard<std::mutex> lk_(mtx_);
+
+			closed_ = true;
+			queue_.clear();
+			cv_.notify_all();
+		}
+
+		virtual bool is_closed() const override
+		{
+			std::lock_guard<std::mutex> lk_(mtx_);
+			return closed_;
+		}
+
+		virtual bool is_dropped() const override
+		{
+			std::lock_guard<std::mutex> lk_(mtx_);
+			return dropped_;
+		}
+
+	private:
+		uint32_t const                    max_queued_;
+
+		mutable std::mutex                mtx_;
+		std::condition_variable           cv_;
+		std::deque<report_tick_data_ptr>  queue_;
+		bool                              closed_  = false; // no more pushes
+		bool                              dropped_ = false;
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace { namespace aux {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+report_tick_subscription_ptr create_report_tick_subscription(uint32_t max_queued)
+{
+	return std::make_shared<aux::report_tick_subscription_impl_t>(max_queued);
+}